@@ -2,6 +2,8 @@ package com.forrest.encoder;
 
 import android.media.MediaCodec;
 import android.media.MediaFormat;
+import android.os.Build;
+import android.os.Bundle;
 import android.util.Log;
 
 import java.io.IOException;
@@ -218,6 +220,38 @@ public abstract class MediaEncoder implements Runnable {
         encode((byte[])null, 0, getPTSUs());
 	}
 
+    /**
+     * Asks the encoder for an IDR as its next frame, e.g. when the receiver
+     * lost its reference pictures. Any thread; ignored before API 19.
+     */
+    public void requestSyncFrame() {
+		final MediaCodec codec = mMediaCodec;
+		if (codec == null || Build.VERSION.SDK_INT < Build.VERSION_CODES.KITKAT) return;
+		final Bundle params = new Bundle();
+		params.putInt(MediaCodec.PARAMETER_KEY_REQUEST_SYNC_FRAME, 0);
+		try {
+			codec.setParameters(params);	// API >= 19
+		} catch (final IllegalStateException e) {
+			Log.w(TAG, "failed requesting sync frame", e);
+		}
+	}
+
+    /**
+     * Changes the video encoder's bitrate on the fly, e.g. to the receiver's
+     * bandwidth estimate. Any thread; ignored before API 19.
+     */
+    public void setVideoBitrate(final int bitsPerSecond) {
+		final MediaCodec codec = mMediaCodec;
+		if (codec == null || Build.VERSION.SDK_INT < Build.VERSION_CODES.KITKAT) return;
+		final Bundle params = new Bundle();
+		params.putInt(MediaCodec.PARAMETER_KEY_VIDEO_BITRATE, bitsPerSecond);
+		try {
+			codec.setParameters(params);	// API >= 19
+		} catch (final IllegalStateException e) {
+			Log.w(TAG, "failed setting bitrate " + bitsPerSecond, e);
+		}
+	}
+
     /**
      * Method to set byte array to the MediaCodec encoder
      * @param buffer
@@ -383,8 +417,10 @@ LOOP:	while (mIsCapturing) {
                     if (!mMuxerStarted) {
                         throw new RuntimeException("drain:muxer hasn't started"); // muxer is not ready...this will prrograming failure.
                     }
-                    // write encoded data to muxer(need to adjust presentationTimeUs).
-                   	mBufferInfo.presentationTimeUs = getPTSUs();
+                    // keep the capture time the input was queued with, it becomes the RTP
+                    // timestamp; only keep it from going back (muxer requirement)
+                   	if (mBufferInfo.presentationTimeUs < prevOutputPTSUs)
+                   		mBufferInfo.presentationTimeUs = prevOutputPTSUs;
                    	muxer.writeSampleData(mTrackIndex, encodedData, mBufferInfo);
 					prevOutputPTSUs = mBufferInfo.presentationTimeUs;
                 }
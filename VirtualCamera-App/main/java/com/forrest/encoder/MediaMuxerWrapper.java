@@ -45,6 +45,24 @@ public class MediaMuxerWrapper {
 			byte ip1 = (byte) Integer.valueOf(tmp[1]).intValue();
 			byte ip2 = (byte) Integer.valueOf(tmp[2]).intValue();
 			byte ip3 = (byte) Integer.valueOf(tmp[3]).intValue();
+			mJrtpLibUtil.setOnKeyframeRequestListener(new JrtplibUtil.OnKeyframeRequestListener() {
+				@Override
+				public void onKeyframeRequest() {
+					final MediaEncoder encoder = mVideoEncoder;
+					if (encoder != null) {
+						encoder.requestSyncFrame();
+					}
+				}
+			});
+			mJrtpLibUtil.setOnTargetBitrateListener(new JrtplibUtil.OnTargetBitrateListener() {
+				@Override
+				public void onTargetBitrate(int bitsPerSecond) {
+					final MediaEncoder encoder = mVideoEncoder;
+					if (encoder != null) {
+						encoder.setVideoBitrate(bitsPerSecond);
+					}
+				}
+			});
 			mJrtpLibUtil.createSendSession(new byte[] {ip0, ip1, ip2, ip3});
 		}
 		if (mVideoEncoder != null) {
@@ -66,6 +84,8 @@ public class MediaMuxerWrapper {
 		}
 		if (mJrtpLibUtil != null) {
 			mJrtpLibUtil.destroySendSession();
+			mJrtpLibUtil.setOnKeyframeRequestListener(null);
+			mJrtpLibUtil.setOnTargetBitrateListener(null);
 		}
 	}
 
@@ -150,13 +170,13 @@ public class MediaMuxerWrapper {
 					byteBuffer.get(sps_pps, 0, bufferInfo.size);
 
 				} else if (bufferInfo.flags == 1 || bufferInfo.flags == 9) { // I
-					mJrtpLibUtil.sendData(sps_pps, sps_pps_len, 1);
+					mJrtpLibUtil.sendData(sps_pps, sps_pps_len, 1, bufferInfo.presentationTimeUs, false);
 					byteBuffer.get(databytes, 0, bufferInfo.size);
-					mJrtpLibUtil.sendData(databytes, bufferInfo.size, 1);
+					mJrtpLibUtil.sendData(databytes, bufferInfo.size, 1, bufferInfo.presentationTimeUs, true);
 
 				} else if (bufferInfo.flags == 0 || bufferInfo.flags == 8) { // P
 					byteBuffer.get(databytes, 0, bufferInfo.size);
-					mJrtpLibUtil.sendData(databytes, bufferInfo.size, 1);
+					mJrtpLibUtil.sendData(databytes, bufferInfo.size, 1, bufferInfo.presentationTimeUs, true);
 				}
 
 
@@ -165,7 +185,7 @@ public class MediaMuxerWrapper {
 //						trackIndex, bufferInfo.size, bufferInfo.flags, bufferInfo.presentationTimeUs/1000));
 				byteBuffer.get(databytes, 7, bufferInfo.size);
 				addADTStoPacket(databytes, bufferInfo.size+7);
-				mJrtpLibUtil.sendData(databytes, bufferInfo.size+7, 2);
+				mJrtpLibUtil.sendData(databytes, bufferInfo.size+7, 2, bufferInfo.presentationTimeUs, true);
 			}
 		}
 	}
@@ -1,59 +1,104 @@
-package com.forrest.jrtplib;
-
-import android.view.Surface;
-
-import com.forrest.util.AudioTrackUtil;
-
-
-public class JrtplibUtil {
-
-    static {
-        System.loadLibrary("jrtplib");
-    }
-
-    private long mContext;
-
-    private static JrtplibUtil instance;
-
-    //private AudioTrackUtil mAudioTrackUtil = new AudioTrackUtil();
-
-    private JrtplibUtil() {}
-
-    public static JrtplibUtil newInstance() {
-        if (instance == null) {
-            instance = new JrtplibUtil();
-        }
-        return instance;
-    }
-
-    public interface OnFrameAvailableListener {
-        void onFrameAvailable();
-    }
-
-    private OnFrameAvailableListener listener;
-
-    public native void createSendSession(byte[] ip);
-    public native void destroySendSession();
-    public native void sendData(byte[] data, int dataLen, int dataType);
-    public native void receiveData();
-
-    public native void displayInit();
-    public native void displayDraw(int x, int y, int w, int h);
-    public native void displayDestroy();
-    public native void setSurface(Surface surface);
-    public native void releaseSurface();
-
-    public void setOnFrameAvailableListener(OnFrameAvailableListener l) {
-        this.listener = l;
-    }
-
-    public void postEventFromNative(int event, byte[] data, int dataLen) {
-        if (event == 1) {
-            listener.onFrameAvailable();
-        } else if (event == 2) {
-            //mAudioTrackUtil.create();
-            //mAudioTrackUtil.writeData(data, 0, dataLen);
-        }
-    }
-
-}
+package com.forrest.jrtplib;
+
+import android.view.Surface;
+
+import com.forrest.util.AudioTrackUtil;
+
+
+public class JrtplibUtil {
+
+    static {
+        System.loadLibrary("jrtplib");
+    }
+
+    private long mContext;
+
+    private static JrtplibUtil instance;
+
+    //private AudioTrackUtil mAudioTrackUtil = new AudioTrackUtil();
+
+    private JrtplibUtil() {}
+
+    public static JrtplibUtil newInstance() {
+        if (instance == null) {
+            instance = new JrtplibUtil();
+        }
+        return instance;
+    }
+
+    public interface OnFrameAvailableListener {
+        void onFrameAvailable();
+    }
+
+    private OnFrameAvailableListener listener;
+
+    /**
+     * The receiver asks for a keyframe (RTCP PLI or FIR). Called on a native
+     * thread, at most every 100 ms.
+     */
+    public interface OnKeyframeRequestListener {
+        void onKeyframeRequest();
+    }
+
+    private volatile OnKeyframeRequestListener keyframeRequestListener;
+
+    /**
+     * The receiver's bandwidth estimate (RTCP APP "VCBR"), in bits/s. Called
+     * on a native thread, only when it moved by 5% or more.
+     */
+    public interface OnTargetBitrateListener {
+        void onTargetBitrate(int bitsPerSecond);
+    }
+
+    private volatile OnTargetBitrateListener targetBitrateListener;
+
+    public native void createSendSession(byte[] ip);
+    public native void destroySendSession();
+    /**
+     * dataType 1 video, 2 audio. presentationTimeUs becomes the RTP timestamp
+     * (90 kHz video, 44.1 kHz audio); endOfFrame is false for the SPS/PPS
+     * buffer sent ahead of an IDR, which then shares the IDR's timestamp.
+     */
+    public native void sendData(byte[] data, int dataLen, int dataType, long presentationTimeUs, boolean endOfFrame);
+    public native void receiveData();
+
+    public native void displayInit();
+    public native void displayDraw(int x, int y, int w, int h);
+    public native void displayDestroy();
+    public native void setSurface(Surface surface);
+    public native void releaseSurface();
+
+    public void setOnFrameAvailableListener(OnFrameAvailableListener l) {
+        this.listener = l;
+    }
+
+    public void setOnKeyframeRequestListener(OnKeyframeRequestListener l) {
+        this.keyframeRequestListener = l;
+    }
+
+    public void setOnTargetBitrateListener(OnTargetBitrateListener l) {
+        this.targetBitrateListener = l;
+    }
+
+    public void postEventFromNative(int event, byte[] data, int dataLen) {
+        if (event == 1) {
+            listener.onFrameAvailable();
+        } else if (event == 2) {
+            //mAudioTrackUtil.create();
+            //mAudioTrackUtil.writeData(data, 0, dataLen);
+        } else if (event == 3) {
+            // no data, dataLen is the RTCP feedback type
+            OnKeyframeRequestListener l = keyframeRequestListener;
+            if (l != null) {
+                l.onKeyframeRequest();
+            }
+        } else if (event == 4) {
+            // no data, dataLen is the target in bits/s
+            OnTargetBitrateListener l = targetBitrateListener;
+            if (l != null) {
+                l.onTargetBitrate(dataLen);
+            }
+        }
+    }
+
+}
@@ -245,6 +245,8 @@ static RTPErrorInfo ErrorDescriptions[]=
 	{ ERR_RTP_TCPTRANS_SOCKETNOTFOUNDINDESTINATIONS, "The specified destination address (socket) was not found in the list of destinations of the TCP transmitter" },
 	{ ERR_RTP_TCPTRANS_ERRORINSEND, "An error occurred in the TCP transmitter while sending a packet" },
 	{ ERR_RTP_TCPTRANS_ERRORINRECV, "An error occurred in the TCP transmitter while receiving a packet" },
+	{ ERR_RTP_TRANS_NOGATHERSUPPORT, "The transmitter cannot send packets from separate header and payload buffers" },
+	{ ERR_RTP_SESSION_NOTUSINGPOLLTHREAD, "The session does not use a poll thread" },
 	{ 0,0 }
 };
 
@@ -246,6 +246,8 @@ std::string JRTPLIB_IMPORTEXPORT RTPGetErrorString(int errcode);
 #define ERR_RTP_TCPTRANS_SOCKETNOTFOUNDINDESTINATIONS             -195
 #define ERR_RTP_TCPTRANS_ERRORINSEND                              -196
 #define ERR_RTP_TCPTRANS_ERRORINRECV                              -197
+#define ERR_RTP_TRANS_NOGATHERSUPPORT                             -198
+#define ERR_RTP_SESSION_NOTUSINGPOLLTHREAD                        -199
 
 #endif // RTPERRORS_H
 
@@ -34,6 +34,11 @@
 #include "rtperrors.h"
 #include "rtppacket.h"
 #include "rtpsources.h"
+#include "rtpstructs.h"
+#include "rtpdefines.h"
+#ifdef RTP_SUPPORT_NETINET_IN
+	#include <netinet/in.h>
+#endif // RTP_SUPPORT_NETINET_IN
 #include <time.h>
 #include <stdlib.h>
 
@@ -227,7 +232,43 @@ namespace jrtplib {
         if (status < 0)
             return status;
         packetlength = p.GetPacketLength();
+        PacketBuilt(p.GetPayloadLength(), timestampinc);
+        return 0;
+    }
 
+    int RTPPacketBuilder::BuildPacketHeader(size_t len, uint8_t pt, bool mark, uint32_t timestampinc,
+                                            uint8_t *header, size_t *headerlen) {
+        if (!init)
+            return ERR_RTP_PACKBUILD_NOTINIT;
+        if (pt > 127 || pt == 72 || pt == 73) // same checks as RTPPacket
+            return ERR_RTP_PACKET_BADPAYLOADTYPE;
+
+        size_t hdrlen = sizeof(RTPHeader) + sizeof(uint32_t) * ((size_t) numcsrcs);
+
+        if (hdrlen + len > maxpacksize)
+            return ERR_RTP_PACKET_DATAEXCEEDSMAXSIZE;
+
+        RTPHeader *rtphdr = (RTPHeader *) header;
+        rtphdr->version = RTP_VERSION;
+        rtphdr->padding = 0;
+        rtphdr->extension = 0;
+        rtphdr->csrccount = numcsrcs;
+        rtphdr->marker = (mark) ? 1 : 0;
+        rtphdr->payloadtype = pt;
+        rtphdr->sequencenumber = htons(seqnr);
+        rtphdr->timestamp = htonl(timestamp);
+        rtphdr->ssrc = htonl(ssrc);
+
+        uint32_t *curcsrc = (uint32_t *) (header + sizeof(RTPHeader));
+        for (int i = 0; i < numcsrcs; i++, curcsrc++)
+            *curcsrc = htonl(csrcs[i]);
+
+        *headerlen = hdrlen;
+        PacketBuilt(len, timestampinc);
+        return 0;
+    }
+
+    void RTPPacketBuilder::PacketBuilt(size_t payloadlen, uint32_t timestampinc) {
         if (numpackets == 0) // first packet
         {
             lastwallclocktime = RTPTime::CurrentTime();
@@ -239,12 +280,10 @@ namespace jrtplib {
             prevrtptimestamp = timestamp;
         }
 
-        numpayloadbytes += (uint32_t) p.GetPayloadLength();
+        numpayloadbytes += (uint32_t) payloadlen;
         numpackets++;
         timestamp += timestampinc;
         seqnr++;
-
-        return 0;
     }
 
 } // end namespace
@@ -62,6 +62,10 @@ public:
 	~RTPPollThread();
 	int Start(RTPTransmitter *trans);
 	void Stop();
+
+	/** See jthread::JThread::SetScheduling; takes effect at the next Start. */
+	int SetScheduling(int policy, int priority, int nice, uint64_t cpumask)	{ return JThread::SetScheduling(policy, priority, nice, cpumask); }
+	int GetSchedulingStats(jthread::JThreadSchedulingStats *stats)				{ return JThread::GetSchedulingStats(stats); }
 private:
 	void *Thread();
 	
@@ -0,0 +1,236 @@
+#include "rtppoolmemorymanager.h"
+#include "rtperrors.h"
+#include <stdlib.h>
+
+#include "rtpdebug.h"
+
+// every block starts with its memory type and size class, keeping the data 16 byte aligned
+#define RTPPOOLMEMORYMANAGER_HEADERSIZE						16
+// the size class recorded for heap blocks
+#define RTPPOOLMEMORYMANAGER_HEAPBLOCK						RTPPOOLMEMORYMANAGER_SIZECLASSES
+
+#ifdef RTP_SUPPORT_THREAD
+	#define TYPE_LOCK(t)									{ if (threadsafe) types[t].mutex.Lock(); }
+	#define TYPE_UNLOCK(t)									{ if (threadsafe) types[t].mutex.Unlock(); }
+	#define SLAB_LOCK										{ if (threadsafe) slabmutex.Lock(); }
+	#define SLAB_UNLOCK										{ if (threadsafe) slabmutex.Unlock(); }
+#else
+	#define TYPE_LOCK(t)
+	#define TYPE_UNLOCK(t)
+	#define SLAB_LOCK
+	#define SLAB_UNLOCK
+#endif // RTP_SUPPORT_THREAD
+
+namespace jrtplib
+{
+
+static const size_t sizeclasses[RTPPOOLMEMORYMANAGER_SIZECLASSES] = { 32, 64, 128, 256, 512, 1024, 1536, 2048 };
+
+struct RTPPoolBlockHeader
+{
+	uint16_t memtype;
+	uint16_t sizeclass;
+};
+
+RTPPoolMemoryManager::RTPPoolMemoryManager(size_t maxslabbytes)
+{
+	for (int t = 0 ; t < RTPPOOLMEMORYMANAGER_MEMTYPES ; t++)
+	{
+		for (int c = 0 ; c < RTPPOOLMEMORYMANAGER_SIZECLASSES ; c++)
+			types[t].freelists[c] = 0;
+	}
+	for (int c = 0 ; c < RTPPOOLMEMORYMANAGER_SIZECLASSES ; c++)
+	{
+		carvepos[c] = 0;
+		carveend[c] = 0;
+	}
+	slabs = 0;
+	slabbytes = 0;
+	RTPPoolMemoryManager::maxslabbytes = maxslabbytes;
+	threadsafe = false;
+}
+
+RTPPoolMemoryManager::~RTPPoolMemoryManager()
+{
+	// blocks still in use from the heap are the owner's to free first
+	while (slabs)
+	{
+		uint8_t *next = *((uint8_t **)slabs);
+		free(slabs);
+		slabs = next;
+	}
+}
+
+int RTPPoolMemoryManager::Init(bool threadsafe)
+{
+#ifdef RTP_SUPPORT_THREAD
+	if (threadsafe)
+	{
+		for (int t = 0 ; t < RTPPOOLMEMORYMANAGER_MEMTYPES ; t++)
+		{
+			if (!types[t].mutex.IsInitialized() && types[t].mutex.Init() < 0)
+				return ERR_RTP_SESSION_CANTINITMUTEX;
+		}
+		if (!slabmutex.IsInitialized() && slabmutex.Init() < 0)
+			return ERR_RTP_SESSION_CANTINITMUTEX;
+	}
+	RTPPoolMemoryManager::threadsafe = threadsafe;
+	return 0;
+#else
+	if (threadsafe)
+		return ERR_RTP_NOTHREADSUPPORT;
+	return 0;
+#endif // RTP_SUPPORT_THREAD
+}
+
+int RTPPoolMemoryManager::GetSizeClass(size_t numbytes)
+{
+	for (int c = 0 ; c < RTPPOOLMEMORYMANAGER_SIZECLASSES ; c++)
+	{
+		if (numbytes <= sizeclasses[c])
+			return c;
+	}
+	return RTPPOOLMEMORYMANAGER_HEAPBLOCK;
+}
+
+// Takes the next block of the size class from its slab, starting a new slab
+// when that one is used up; 0 at the slab limit.
+uint8_t *RTPPoolMemoryManager::CarveBlock(int sizeclass)
+{
+	size_t blocksize = RTPPOOLMEMORYMANAGER_HEADERSIZE + sizeclasses[sizeclass];
+	uint8_t *block = 0;
+
+	SLAB_LOCK
+	if (carvepos[sizeclass] == 0 || carvepos[sizeclass] + blocksize > carveend[sizeclass])
+	{
+		uint8_t *slab = 0;
+
+		if (slabbytes + RTPPOOLMEMORYMANAGER_SLABSIZE <= maxslabbytes)
+			slab = (uint8_t *)malloc(RTPPOOLMEMORYMANAGER_SLABSIZE);
+		if (slab)
+		{
+			// the first 16 bytes link the slabs
+			*((uint8_t **)slab) = slabs;
+			slabs = slab;
+			slabbytes += RTPPOOLMEMORYMANAGER_SLABSIZE;
+			carvepos[sizeclass] = slab + RTPPOOLMEMORYMANAGER_HEADERSIZE;
+			carveend[sizeclass] = slab + RTPPOOLMEMORYMANAGER_SLABSIZE;
+		}
+		else
+		{
+			carvepos[sizeclass] = 0;
+			carveend[sizeclass] = 0;
+		}
+	}
+	if (carvepos[sizeclass])
+	{
+		block = carvepos[sizeclass];
+		carvepos[sizeclass] += blocksize;
+	}
+	SLAB_UNLOCK
+	return block;
+}
+
+void *RTPPoolMemoryManager::AllocateBuffer(size_t numbytes, int memtype)
+{
+	int t = (memtype >= 0 && memtype < RTPPOOLMEMORYMANAGER_MEMTYPES)?memtype:RTPMEM_TYPE_OTHER;
+	int c = GetSizeClass(numbytes);
+	TypePool &pool = types[t];
+	uint8_t *block = 0;
+
+	TYPE_LOCK(t)
+	if (c != RTPPOOLMEMORYMANAGER_HEAPBLOCK)
+	{
+		if ((block = pool.freelists[c]) != 0)
+		{
+			pool.freelists[c] = *((uint8_t **)(block + RTPPOOLMEMORYMANAGER_HEADERSIZE));
+			pool.stats.hits++;
+		}
+		else
+			block = CarveBlock(c);
+	}
+	if (block == 0)
+	{
+		c = RTPPOOLMEMORYMANAGER_HEAPBLOCK;
+		if ((block = (uint8_t *)malloc(RTPPOOLMEMORYMANAGER_HEADERSIZE + numbytes)) == 0)
+		{
+			TYPE_UNLOCK(t)
+			return 0;
+		}
+		pool.stats.heapallocations++;
+	}
+	pool.stats.allocations++;
+	if (++pool.stats.inuse > pool.stats.highwater)
+		pool.stats.highwater = pool.stats.inuse;
+	TYPE_UNLOCK(t)
+
+	RTPPoolBlockHeader *header = (RTPPoolBlockHeader *)block;
+	header->memtype = (uint16_t)t;
+	header->sizeclass = (uint16_t)c;
+	return block + RTPPOOLMEMORYMANAGER_HEADERSIZE;
+}
+
+void RTPPoolMemoryManager::FreeBuffer(void *buffer)
+{
+	if (buffer == 0)
+		return;
+
+	uint8_t *block = (uint8_t *)buffer - RTPPOOLMEMORYMANAGER_HEADERSIZE;
+	RTPPoolBlockHeader *header = (RTPPoolBlockHeader *)block;
+	int t = header->memtype;
+	int c = header->sizeclass;
+	TypePool &pool = types[t];
+
+	TYPE_LOCK(t)
+	pool.stats.inuse--;
+	if (c != RTPPOOLMEMORYMANAGER_HEAPBLOCK)
+	{
+		*((uint8_t **)buffer) = pool.freelists[c];
+		pool.freelists[c] = block;
+	}
+	TYPE_UNLOCK(t)
+
+	if (c == RTPPOOLMEMORYMANAGER_HEAPBLOCK)
+		free(block);
+}
+
+RTPPoolMemoryManager::Stats RTPPoolMemoryManager::GetStats(int memtype)
+{
+	Stats stats;
+
+	if (memtype < 0 || memtype >= RTPPOOLMEMORYMANAGER_MEMTYPES)
+		return stats;
+	TYPE_LOCK(memtype)
+	stats = types[memtype].stats;
+	TYPE_UNLOCK(memtype)
+	return stats;
+}
+
+RTPPoolMemoryManager::Stats RTPPoolMemoryManager::GetTotalStats()
+{
+	Stats total;
+
+	for (int t = 0 ; t < RTPPOOLMEMORYMANAGER_MEMTYPES ; t++)
+	{
+		Stats stats = GetStats(t);
+
+		total.allocations += stats.allocations;
+		total.hits += stats.hits;
+		total.heapallocations += stats.heapallocations;
+		total.inuse += stats.inuse;
+		total.highwater += stats.highwater;
+	}
+	return total;
+}
+
+size_t RTPPoolMemoryManager::GetSlabBytes()
+{
+	size_t bytes;
+
+	SLAB_LOCK
+	bytes = slabbytes;
+	SLAB_UNLOCK
+	return bytes;
+}
+
+} // end namespace
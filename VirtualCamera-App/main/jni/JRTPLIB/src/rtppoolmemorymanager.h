@@ -0,0 +1,122 @@
+/**
+ * \file rtppoolmemorymanager.h
+ */
+
+#ifndef RTPPOOLMEMORYMANAGER_H
+
+#define RTPPOOLMEMORYMANAGER_H
+
+#include "rtpconfig.h"
+#include "rtpmemorymanager.h"
+#include "rtptypes.h"
+#include <stddef.h>
+#ifdef RTP_SUPPORT_THREAD
+	#include <jthread/jmutex.h>
+#endif // RTP_SUPPORT_THREAD
+
+/** Size classes, 32 bytes up to RTPPOOLMEMORYMANAGER_MAXBLOCKSIZE. */
+#define RTPPOOLMEMORYMANAGER_SIZECLASSES					8
+
+/** The largest pooled block: a received packet slot of a batched RTPUDPv4Transmitter. */
+#define RTPPOOLMEMORYMANAGER_MAXBLOCKSIZE					2048
+
+/** Memory types with freelists of their own, RTPMEM_TYPE_OTHER up to RTPMEM_TYPE_BUFFER_SRTPDATA. */
+#define RTPPOOLMEMORYMANAGER_MEMTYPES						34
+
+/** Blocks are carved from slabs of this size. */
+#define RTPPOOLMEMORYMANAGER_SLABSIZE						(32*1024)
+
+/** Default limit on the memory held in slabs. */
+#define RTPPOOLMEMORYMANAGER_DEFAULTMAXSLABBYTES			(8*1024*1024)
+
+namespace jrtplib
+{
+
+/** A memory manager keeping freed blocks on freelists per memory type and size class.
+ *  Requests up to 2048 bytes are rounded up to one of the size classes 32, 64, 128, 256, 512,
+ *  1024, 1536 and 2048; the last two take MTU sized packet buffers and the receive slots of a
+ *  batched RTPUDPv4Transmitter. Blocks are carved from 32 KiB slabs and, once freed, go onto the
+ *  freelist for their memory type and size class, where the next allocation of that kind finds
+ *  them. Slabs are only released when the manager is destroyed, so the memory held settles at the
+ *  high-water mark of what was in use. Larger requests, and requests once the slabs have reached
+ *  their limit, go to the heap.
+ *
+ *  Every memory type has a lock of its own: the thread receiving packets and the thread deleting
+ *  them only meet on the freelists of the types they share. The manager has to outlive every block
+ *  allocated from it. RTPSession creates one for itself when RTPSessionParams::SetUseMemoryPool is set.
+ */
+class JRTPLIB_IMPORTEXPORT RTPPoolMemoryManager : public RTPMemoryManager
+{
+public:
+	/** Allocation counters, for one memory type or summed over all of them. */
+	class Stats
+	{
+	public:
+		Stats() : allocations(0), hits(0), heapallocations(0), inuse(0), highwater(0) { }
+
+		/** Blocks handed out. */
+		uint64_t allocations;
+
+		/** Blocks that were taken from a freelist. */
+		uint64_t hits;
+
+		/** Blocks that came from the heap: larger than the largest size class, or past the slab limit. */
+		uint64_t heapallocations;
+
+		/** Blocks handed out and not freed yet. */
+		size_t inuse;
+
+		/** The most blocks in use at any time; summed per type for the totals. */
+		size_t highwater;
+	};
+
+	/** Slabs are allocated up to \c maxslabbytes in total. */
+	RTPPoolMemoryManager(size_t maxslabbytes = RTPPOOLMEMORYMANAGER_DEFAULTMAXSLABBYTES);
+	~RTPPoolMemoryManager();
+
+	/** Initializes the locks; without them (\c threadsafe is \c false, or before Init) the manager
+	 *  may only be used from one thread.
+	 */
+	int Init(bool threadsafe);
+
+	void *AllocateBuffer(size_t numbytes, int memtype);
+	void FreeBuffer(void *buffer);
+
+	/** Returns the counters of memory type \c memtype. */
+	Stats GetStats(int memtype);
+
+	/** Returns the counters summed over all memory types. */
+	Stats GetTotalStats();
+
+	/** Returns how much memory the slabs take. */
+	size_t GetSlabBytes();
+private:
+	struct TypePool
+	{
+		uint8_t *freelists[RTPPOOLMEMORYMANAGER_SIZECLASSES];
+		Stats stats;
+#ifdef RTP_SUPPORT_THREAD
+		jthread::JMutex mutex;
+#endif // RTP_SUPPORT_THREAD
+	};
+
+	static int GetSizeClass(size_t numbytes);
+	uint8_t *CarveBlock(int sizeclass);
+
+	TypePool types[RTPPOOLMEMORYMANAGER_MEMTYPES];
+
+	// the slab carved from for each size class, and the slab list; behind slabmutex
+	uint8_t *carvepos[RTPPOOLMEMORYMANAGER_SIZECLASSES];
+	uint8_t *carveend[RTPPOOLMEMORYMANAGER_SIZECLASSES];
+	uint8_t *slabs;
+	size_t slabbytes;
+	size_t maxslabbytes;
+	bool threadsafe;
+#ifdef RTP_SUPPORT_THREAD
+	jthread::JMutex slabmutex;
+#endif // RTP_SUPPORT_THREAD
+};
+
+} // end namespace
+
+#endif // RTPPOOLMEMORYMANAGER_H
@@ -51,8 +51,12 @@
 #include "rtpmemoryobject.h"
 #include <list>
 
+/** Fragments handed to the transmitter per call by RTPSession::SendPacketAfterSlice. */
+#define RTPSESSION_MAXGATHERPACKETS						64
+
 #ifdef RTP_SUPPORT_THREAD
 	#include <jthread/jmutex.h>	
+	#include <jthread/jthread.h>
 #endif // RTP_SUPPORT_THREAD
 
 namespace jrtplib
@@ -69,6 +73,7 @@ class RTPTransmissionInfo;
 class RTCPCompoundPacket;
 class RTCPPacket;
 class RTCPAPPPacket;
+class RTPPoolMemoryManager;
 
 /** High level class for using RTP.
  *  For most RTP based applications, the RTPSession class will probably be the one to use. It handles 
@@ -122,6 +127,24 @@ public:
 
 	/** Returns whether the session has been created or not. */
 	bool IsActive();
+
+	/** Returns the memory pool the session allocates from, or null when RTPSessionParams::SetUseMemoryPool
+	 *  was not set. It stays until the session is created without one or deleted, so packets taken from
+	 *  the session can still be deleted after RTPSession::Destroy.
+	 */
+	RTPPoolMemoryManager *GetMemoryPool() const													{ return mempool; }
+
+	/** Returns the transmitter the session uses, for counters of its own, or null when the
+	 *  session was not created.
+	 */
+	RTPTransmitter *GetTransmitter() const														{ return (created)?rtptrans:0; }
+
+#ifdef RTP_SUPPORT_THREAD
+	/** Returns how the poll thread is scheduled and how long it waited for a CPU; see
+	 *  RTPSessionParams::SetPollThreadScheduling.
+	 */
+	int GetPollThreadSchedulingStats(jthread::JThreadSchedulingStats *stats);
+#endif // RTP_SUPPORT_THREAD
 	
 	/** Returns our own SSRC. */
 	uint32_t GetLocalSSRC();
@@ -155,6 +178,11 @@ public:
 	int SendPacket(const void *data,size_t len);
 
 	// add by yuzh
+	// Sends the Annex-B NAL \c data (start code included) as FU-A fragments when it
+	// exceeds the slice size. Where the transmitter supports RTPTransmitter::SendRTPDataGather
+	// the fragments are sent straight from \c data, RTPSESSION_MAXGATHERPACKETS at a time;
+	// otherwise each one is copied into slice_data and sent with SendPacket. Only the last
+	// fragment carries \c mark; the timestamp advances by \c timestampinc after the first.
 	int SendPacketAfterSlice(const void *data, size_t len, uint8_t pt, bool mark, uint32_t timestampinc);
 
 	/** Sends the RTP packet with payload \c data which has length \c len.
@@ -538,6 +566,14 @@ protected:
 
 	/** Is called when an RTCP compound packet has just been sent (useful to inspect outgoing RTCP data). */
 	virtual void OnSendRTCPCompoundPacket(RTCPCompoundPacket *pack);
+
+	/** Is called when an RTP packet has just been sent.
+	 *  Is called when an RTP packet has just been sent, while the packet builder is still
+	 *  locked. The packet is \c header followed by \c payload; for packets built in one
+	 *  piece \c payloadlen is zero. The buffers are only valid during the call, so a copy
+	 *  must be made to keep the packet (e.g. for retransmissions).
+	 */
+	virtual void OnSendRTPPacket(const RTPGatherPacket &packet);
 #ifdef RTP_SUPPORT_THREAD
 	/** Is called when error \c errcode was detected in the poll thread. */
 	virtual void OnPollThreadError(int errcode);
@@ -606,12 +642,17 @@ protected:
 	virtual void OnValidatedRTPPacket(RTPSourceData *srcdat, RTPPacket *rtppack, bool isonprobation, bool *ispackethandled);
 private:
 	int InternalCreate(const RTPSessionParams &sessparams);
+	int CreateMemoryPool(const RTPSessionParams &sessparams);
+	void DeleteMemoryPool();
+	void SetComponentMemoryManager(RTPMemoryManager *mgr);
 	int CreateCNAME(uint8_t *buffer,size_t *bufferlength,bool resolve);
 	int ProcessPolledData();
 	int ProcessRTCPCompoundPacket(RTCPCompoundPacket &rtcpcomppack,RTPRawPacket *pack);
 	RTPRandom *GetRandomNumberGenerator(RTPRandom *r);
 	int SendRTPData(const void *data, size_t len);
 	int SendRTCPData(const void *data, size_t len);
+	int SendSlicesGather(const uint8_t *data, size_t len, uint8_t pt, bool mark, uint32_t timestampinc);
+	void NotifyBuiltPacketSent();
 
 	RTPRandom *rtprnd;
 	bool deletertprnd;
@@ -636,6 +677,9 @@ private:
 
 	uint8_t *slice_data;
 	size_t slice_data_max_size;  //切片使用的最大数据长度 maxpacksize - 200，不包含 fu_indicator 和 fu_header
+	uint8_t *slice_headers;      // RTP + FU headers of the gathered fragments, RTPSESSION_MAXGATHERPACKETS of them
+	RTPGatherPacket *slice_packets;
+	bool slice_gather;           // the transmitter can send from the caller's buffer
 
 	RTPSessionSources sources;
 	RTPPacketBuilder packetbuilder;
@@ -644,6 +688,7 @@ private:
 	RTPCollisionList collisionlist;
 
 	std::list<RTCPCompoundPacket *> byepackets;
+	RTPPoolMemoryManager *mempool;
 	
 #ifdef RTP_SUPPORT_THREAD
 	RTPPollThread *pollthread;
@@ -678,6 +723,7 @@ inline void RTPSession::OnRTCPSDESPrivateItem(RTPSourceData *, const void *, siz
 
 inline void RTPSession::OnBYEPacket(RTPSourceData *)                                                    { }
 inline void RTPSession::OnSendRTCPCompoundPacket(RTCPCompoundPacket *)                                  { }
+inline void RTPSession::OnSendRTPPacket(const RTPGatherPacket &)                                        { }
 
 #ifdef RTP_SUPPORT_THREAD
 inline void RTPSession::OnPollThreadError(int)                                                          { }
@@ -42,6 +42,7 @@
 #include "rtptypes.h"
 #include "rtpmemoryobject.h"
 #include "rtptimeutilities.h"
+#include "rtperrors.h"
 
 namespace jrtplib
 {
@@ -52,6 +53,19 @@ class RTPTransmissionParams;
 class RTPTime;
 class RTPTransmissionInfo;
 
+/** Describes an RTP packet whose header and payload lie in separate buffers.
+ *  Describes an RTP packet whose header and payload lie in separate buffers, so that
+ *  a payload can be sent straight from the caller's memory (see RTPTransmitter::SendRTPDataGather).
+ */
+class JRTPLIB_IMPORTEXPORT RTPGatherPacket
+{
+public:
+	const void *header;
+	size_t headerlen;
+	const void *payload;
+	size_t payloadlen;
+};
+
 /** Abstract class from which actual transmission components should be derived.
  *  Abstract class from which actual transmission components should be derived.
  *  The abstract class RTPTransmitter specifies the interface for
@@ -157,6 +171,15 @@ public:
 	/** Send a packet with length \c len containing \c data	to all RTP addresses of the current destination list. */
 	virtual int SendRTPData(const void *data,size_t len) = 0;	
 
+	/** Sends the \c count packets in \c packets to all RTP addresses of the current destination list.
+	 *  Sends the \c count packets in \c packets to all RTP addresses of the current destination list,
+	 *  in order, each packet being the concatenation of its header and payload buffers. Transmitters
+	 *  which cannot send from separate buffers return ERR_RTP_TRANS_NOGATHERSUPPORT, and the caller
+	 *  should then build and send the packets one by one; a call with \c count set to zero sends
+	 *  nothing and can be used to find this out beforehand.
+	 */
+	virtual int SendRTPDataGather(const RTPGatherPacket * /*packets*/,int /*count*/)	{ return ERR_RTP_TRANS_NOGATHERSUPPORT; }
+
 	/** Send a packet with length \c len containing \c data to all RTCP addresses of the current destination list. */
 	virtual int SendRTCPData(const void *data,size_t len) = 0;
 
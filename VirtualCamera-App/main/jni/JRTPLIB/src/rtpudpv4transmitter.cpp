@@ -42,6 +42,14 @@
 #include <stdio.h>
 #include <assert.h>
 #include <vector>
+#ifndef RTP_SOCKETTYPE_WINSOCK
+	#include <sys/uio.h>
+	#include <netinet/udp.h>
+	#include <errno.h>
+#endif // RTP_SOCKETTYPE_WINSOCK
+#ifdef RTP_HAVE_EPOLL
+	#include <sys/epoll.h>
+#endif // RTP_HAVE_EPOLL
 #ifdef RTPDEBUG
 	#include <iostream>
 #endif // RTPDEBUG
@@ -54,6 +62,21 @@ using namespace std;
 
 #define RTPUDPV4TRANS_MAXPACKSIZE							65535
 #define RTPUDPV4TRANS_IFREQBUFSIZE							8192
+#define RTPUDPV4TRANS_MAXGSOSEGMENTS							64
+#define RTPUDPV4TRANS_MAXGSOBYTES							(65535-20-8)
+
+#if defined(RTP_HAVE_SENDMMSG) && defined(UDP_SEGMENT)
+	#define RTPUDPV4TRANS_HAVE_GSO
+#endif // RTP_HAVE_SENDMMSG && UDP_SEGMENT
+
+#if defined(RTP_HAVE_RECVMMSG) && defined(SO_RXQ_OVFL)
+	#define RTPUDPV4TRANS_HAVE_RXQOVFL
+#endif // RTP_HAVE_RECVMMSG && SO_RXQ_OVFL
+
+#ifdef RTP_HAVE_RECVMMSG
+	// room for the SO_RXQ_OVFL drop count of a batch receive slot
+	#define RTPUDPV4TRANS_BATCHCONTROLSIZE						CMSG_SPACE(sizeof(uint32_t))
+#endif // RTP_HAVE_RECVMMSG
 
 #define RTPUDPV4TRANS_IS_MCASTADDR(x)							(((x)&0xF0000000) == 0xE0000000)
 
@@ -97,6 +120,23 @@ RTPUDPv4Transmitter::RTPUDPv4Transmitter(RTPMemoryManager *mgr) : RTPTransmitter
 {
 	created = false;
 	init = false;
+#ifdef RTP_HAVE_RECVMMSG
+	batchcount = 0;
+	batchslotsize = 0;
+	batchslots = 0;
+	batchmsgs = 0;
+	batchiovecs = 0;
+	batchaddrs = 0;
+	batchcontrol = 0;
+#endif // RTP_HAVE_RECVMMSG
+#ifdef RTP_HAVE_EPOLL
+	epollfd = -1;
+#endif // RTP_HAVE_EPOLL
+	rtpsockdrops = 0;
+	rtcpsockdrops = 0;
+	oversizedpackets = 0;
+	rtpsendcalls = 0;
+	usegso = false;
 }
 
 RTPUDPv4Transmitter::~RTPUDPv4Transmitter()
@@ -536,6 +576,42 @@ int RTPUDPv4Transmitter::Create(size_t maximumpacketsize,const RTPTransmissionPa
 	}
 
 	maxpacksize = maximumpacketsize;
+	oversizedpackets = 0;
+	rtpsendcalls = 0;
+	rtpsockdrops = 0;
+	rtcpsockdrops = 0;
+#ifdef RTPUDPV4TRANS_HAVE_GSO
+	usegso = params->GetSegmentationOffload();
+#else
+	usegso = false;
+#endif // RTPUDPV4TRANS_HAVE_GSO
+#ifdef RTP_HAVE_RECVMMSG
+	if (params->GetBatchReceivePackets() > 0)
+	{
+		size_t slotsize = params->GetBatchReceiveSlotSize();
+
+		if (slotsize == 0)
+			slotsize = (maxpacksize > RTPUDPV4TRANS_BATCHMINSLOTSIZE)?maxpacksize:RTPUDPV4TRANS_BATCHMINSLOTSIZE;
+		if ((status = CreateBatchRing(params->GetBatchReceivePackets(),slotsize)) < 0)
+		{
+			m_abortDesc.Destroy();
+			CLOSESOCKETS;
+			MAINMUTEX_UNLOCK
+			return status;
+		}
+#ifdef RTPUDPV4TRANS_HAVE_RXQOVFL
+		// the kernel's drop count then comes along with the datagrams
+		int rxqovfl = 1;
+
+		setsockopt(rtpsock,SOL_SOCKET,SO_RXQ_OVFL,(const char *)&rxqovfl,sizeof(int));
+		if (rtcpsock != rtpsock)
+			setsockopt(rtcpsock,SOL_SOCKET,SO_RXQ_OVFL,(const char *)&rxqovfl,sizeof(int));
+#endif // RTPUDPV4TRANS_HAVE_RXQOVFL
+	}
+#endif // RTP_HAVE_RECVMMSG
+#ifdef RTP_HAVE_EPOLL
+	CreateEpoll();
+#endif // RTP_HAVE_EPOLL
 	multicastTTL = params->GetMulticastTTL();
 	mcastifaceIP = params->GetMulticastInterfaceIP();
 	receivemode = RTPTransmitter::AcceptAll;
@@ -574,6 +650,9 @@ void RTPUDPv4Transmitter::Destroy()
 	multicastgroups.Clear();
 #endif // RTP_SUPPORT_IPV4MULTICAST
 	FlushPackets();
+#ifdef RTP_HAVE_RECVMMSG
+	DestroyBatchRing();
+#endif // RTP_HAVE_RECVMMSG
 	ClearAcceptIgnoreInfo();
 	localIPs.clear();
 	created = false;
@@ -581,13 +660,22 @@ void RTPUDPv4Transmitter::Destroy()
 	if (waitingfordata)
 	{
 		m_pAbortDesc->SendAbortSignal();
-		m_abortDesc.Destroy(); // Doesn't do anything if not initialized
 		MAINMUTEX_UNLOCK
 		WAITMUTEX_LOCK // to make sure that the WaitForIncomingData function ended
 		WAITMUTEX_UNLOCK
+		// only now: closing the abort socket takes it off the epoll ready list,
+		// which could put epoll_wait back to sleep before it saw the signal
+		m_abortDesc.Destroy(); // Doesn't do anything if not initialized
 	}
 	else
 		m_abortDesc.Destroy(); // Doesn't do anything if not initialized
+#ifdef RTP_HAVE_EPOLL
+	if (epollfd >= 0)
+	{
+		close(epollfd);
+		epollfd = -1;
+	}
+#endif // RTP_HAVE_EPOLL
 
 	MAINMUTEX_UNLOCK
 }
@@ -844,7 +932,11 @@ int RTPUDPv4Transmitter::WaitForIncomingData(const RTPTime &delay,bool *dataavai
 	WAITMUTEX_LOCK
 	MAINMUTEX_UNLOCK
 
+#ifdef RTP_HAVE_EPOLL
+	int status = (epollfd >= 0)?WaitEpoll(readflags,delay):RTPSelect(socks, readflags, 3, delay);
+#else
 	int status = RTPSelect(socks, readflags, 3, delay);
+#endif // RTP_HAVE_EPOLL
 	if (status < 0)
 	{
 		MAINMUTEX_LOCK
@@ -925,6 +1017,7 @@ int RTPUDPv4Transmitter::SendRTPData(const void *data,size_t len)
 	while (destinations.HasCurrentElement())
 	{
 		sendto(rtpsock,(const char *)data,len,0,(const struct sockaddr *)destinations.GetCurrentElement().GetRTPSockAddr(),sizeof(struct sockaddr_in));
+		rtpsendcalls++;
 		destinations.GotoNextElement();
 	}
 	
@@ -932,6 +1025,163 @@ int RTPUDPv4Transmitter::SendRTPData(const void *data,size_t len)
 	return 0;
 }
 
+#ifndef RTP_SOCKETTYPE_WINSOCK
+
+int RTPUDPv4Transmitter::SendRTPDataGather(const RTPGatherPacket *packets,int count)
+{
+	if (!init)
+		return ERR_RTP_UDPV4TRANS_NOTINIT;
+
+	MAINMUTEX_LOCK
+	
+	if (!created)
+	{
+		MAINMUTEX_UNLOCK
+		return ERR_RTP_UDPV4TRANS_NOTCREATED;
+	}
+	for (int i = 0 ; i < count ; i++)
+	{
+		if (packets[i].headerlen+packets[i].payloadlen > maxpacksize)
+		{
+			MAINMUTEX_UNLOCK
+			return ERR_RTP_UDPV4TRANS_SPECIFIEDSIZETOOBIG;
+		}
+	}
+	
+	destinations.GotoFirstElement();
+	while (destinations.HasCurrentElement())
+	{
+		const struct sockaddr_in *addr = destinations.GetCurrentElement().GetRTPSockAddr();
+		int sent = 0;
+
+		while (sent < count)
+		{
+			int num = 0;
+
+			if (usegso)
+				num = SendGatherSegments(addr,packets+sent,count-sent);
+			if (num == 0)
+				num = SendGatherPackets(addr,packets+sent,count-sent);
+			if (num <= 0) // as with sendto above, a failed send just skips this destination
+				break;
+			sent += num;
+		}
+		destinations.GotoNextElement();
+	}
+	
+	MAINMUTEX_UNLOCK
+	return 0;
+}
+
+// Sends the leading run of equally sized packets (the last one may be shorter)
+// as one UDP_SEGMENT datagram. Returns the number of packets sent, 0 if the
+// caller should use SendGatherPackets instead, or -1 on a send error.
+int RTPUDPv4Transmitter::SendGatherSegments(const struct sockaddr_in *addr,const RTPGatherPacket *packets,int count)
+{
+#ifdef RTPUDPV4TRANS_HAVE_GSO
+	struct iovec iovecs[2*RTPUDPV4TRANS_MAXGSOSEGMENTS];
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		struct cmsghdr align;
+	} control;
+	struct msghdr msg;
+	size_t segsize = packets[0].headerlen+packets[0].payloadlen;
+	size_t total = 0;
+	int num = 0;
+
+	while (num < count && num < RTPUDPV4TRANS_MAXGSOSEGMENTS)
+	{
+		size_t len = packets[num].headerlen+packets[num].payloadlen;
+
+		if (len > segsize || total+len > RTPUDPV4TRANS_MAXGSOBYTES)
+			break;
+		iovecs[2*num].iov_base = (void *)packets[num].header;
+		iovecs[2*num].iov_len = packets[num].headerlen;
+		iovecs[2*num+1].iov_base = (void *)packets[num].payload;
+		iovecs[2*num+1].iov_len = packets[num].payloadlen;
+		total += len;
+		num++;
+		if (len < segsize) // only the last segment may be shorter
+			break;
+	}
+	if (num < 2)
+		return 0;
+
+	memset(&msg,0,sizeof(msg));
+	msg.msg_name = (void *)addr;
+	msg.msg_namelen = sizeof(struct sockaddr_in);
+	msg.msg_iov = iovecs;
+	msg.msg_iovlen = 2*num;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = IPPROTO_UDP;
+	cmsg->cmsg_type = UDP_SEGMENT;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	uint16_t gsosize = (uint16_t)segsize;
+	memcpy(CMSG_DATA(cmsg),&gsosize,sizeof(gsosize));
+
+	rtpsendcalls++;
+	if (sendmsg(rtpsock,&msg,0) < 0)
+	{
+		if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)
+		{
+			usegso = false; // kernel or device without UDP GSO
+			return 0;
+		}
+		return -1;
+	}
+	return num;
+#else
+	return 0;
+#endif // RTPUDPV4TRANS_HAVE_GSO
+}
+
+// Sends up to RTPUDPV4TRANS_MAXGATHERPACKETS packets, with one sendmmsg call
+// where available. Returns the number of packets sent or -1 on a send error.
+int RTPUDPv4Transmitter::SendGatherPackets(const struct sockaddr_in *addr,const RTPGatherPacket *packets,int count)
+{
+#ifdef RTP_HAVE_SENDMMSG
+	struct mmsghdr msgs[RTPUDPV4TRANS_MAXGATHERPACKETS];
+	struct iovec iovecs[2*RTPUDPV4TRANS_MAXGATHERPACKETS];
+	int num = (count < RTPUDPV4TRANS_MAXGATHERPACKETS)?count:RTPUDPV4TRANS_MAXGATHERPACKETS;
+
+	memset(msgs,0,sizeof(struct mmsghdr)*num);
+	for (int i = 0 ; i < num ; i++)
+	{
+		iovecs[2*i].iov_base = (void *)packets[i].header;
+		iovecs[2*i].iov_len = packets[i].headerlen;
+		iovecs[2*i+1].iov_base = (void *)packets[i].payload;
+		iovecs[2*i+1].iov_len = packets[i].payloadlen;
+		msgs[i].msg_hdr.msg_name = (void *)addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		msgs[i].msg_hdr.msg_iov = &iovecs[2*i];
+		msgs[i].msg_hdr.msg_iovlen = 2;
+	}
+	rtpsendcalls++;
+	return sendmmsg(rtpsock,msgs,num,0);
+#else
+	struct iovec iovecs[2];
+	struct msghdr msg;
+
+	iovecs[0].iov_base = (void *)packets[0].header;
+	iovecs[0].iov_len = packets[0].headerlen;
+	iovecs[1].iov_base = (void *)packets[0].payload;
+	iovecs[1].iov_len = packets[0].payloadlen;
+	memset(&msg,0,sizeof(msg));
+	msg.msg_name = (void *)addr;
+	msg.msg_namelen = sizeof(struct sockaddr_in);
+	msg.msg_iov = iovecs;
+	msg.msg_iovlen = 2;
+	rtpsendcalls++;
+	return (sendmsg(rtpsock,&msg,0) < 0)?-1:1;
+#endif // RTP_HAVE_SENDMMSG
+}
+
+#endif // RTP_SOCKETTYPE_WINSOCK
+
 int RTPUDPv4Transmitter::SendRTCPData(const void *data,size_t len)
 {
 	if (!init)
@@ -1475,6 +1725,11 @@ int RTPUDPv4Transmitter::PollSocket(bool rtp)
 	struct sockaddr_in srcaddr;
 	bool dataavailable;
 	
+#ifdef RTP_HAVE_RECVMMSG
+	if (batchcount > 0)
+		return PollSocketBatch(rtp);
+#endif // RTP_HAVE_RECVMMSG
+
 	if (rtp)
 		sock = rtpsock;
 	else
@@ -1568,6 +1823,227 @@ int RTPUDPv4Transmitter::PollSocket(bool rtp)
 	return 0;
 }
 
+#ifdef RTP_HAVE_RECVMMSG
+
+int RTPUDPv4Transmitter::CreateBatchRing(int packets,size_t slotsize)
+{
+	// one block for the bookkeeping, the mmsghdr array and the control buffers first so they are suitably aligned
+	size_t blocksize = (size_t)packets*(sizeof(struct mmsghdr)+RTPUDPV4TRANS_BATCHCONTROLSIZE+sizeof(struct iovec)+sizeof(uint8_t *)+sizeof(struct sockaddr_in));
+	uint8_t *block = RTPNew(GetMemoryManager(),RTPMEM_TYPE_OTHER) uint8_t[blocksize];
+
+	if (block == 0)
+		return ERR_RTP_OUTOFMEM;
+	memset(block,0,blocksize);
+	batchmsgs = (struct mmsghdr *)block;
+	batchcontrol = (uint8_t *)(batchmsgs+packets);
+	batchiovecs = (struct iovec *)(batchcontrol+(size_t)packets*RTPUDPV4TRANS_BATCHCONTROLSIZE);
+	batchslots = (uint8_t **)(batchiovecs+packets);
+	batchaddrs = (struct sockaddr_in *)(batchslots+packets);
+	batchcount = packets;
+	batchslotsize = slotsize;
+
+	for (int i = 0 ; i < packets ; i++)
+	{
+		batchslots[i] = RTPNew(GetMemoryManager(),RTPMEM_TYPE_BUFFER_RECEIVEDRTPPACKET) uint8_t[slotsize];
+		if (batchslots[i] == 0)
+		{
+			DestroyBatchRing();
+			return ERR_RTP_OUTOFMEM;
+		}
+	}
+	return 0;
+}
+
+void RTPUDPv4Transmitter::DestroyBatchRing()
+{
+	if (batchmsgs == 0)
+		return;
+	for (int i = 0 ; i < batchcount ; i++)
+	{
+		if (batchslots[i])
+			RTPDeleteByteArray(batchslots[i],GetMemoryManager());
+	}
+	RTPDeleteByteArray((uint8_t *)batchmsgs,GetMemoryManager());
+	batchmsgs = 0;
+	batchcontrol = 0;
+	batchiovecs = 0;
+	batchslots = 0;
+	batchaddrs = 0;
+	batchcount = 0;
+}
+
+// The batched PollSocket: the sockets are drained without blocking, a full
+// ring per recvmmsg call, and the slots the datagrams landed in are handed to
+// the RTPRawPackets as they are.
+int RTPUDPv4Transmitter::PollSocketBatch(bool rtp)
+{
+	SocketType sock = (rtp)?rtpsock:rtcpsock;
+	int received;
+
+	do
+	{
+		for (int i = 0 ; i < batchcount ; i++)
+		{
+			if (batchslots[i] == 0)
+			{
+				batchslots[i] = RTPNew(GetMemoryManager(),RTPMEM_TYPE_BUFFER_RECEIVEDRTPPACKET) uint8_t[batchslotsize];
+				if (batchslots[i] == 0)
+					return ERR_RTP_OUTOFMEM;
+			}
+			batchiovecs[i].iov_base = batchslots[i];
+			batchiovecs[i].iov_len = batchslotsize;
+			batchmsgs[i].msg_hdr.msg_name = &batchaddrs[i];
+			batchmsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			batchmsgs[i].msg_hdr.msg_iov = &batchiovecs[i];
+			batchmsgs[i].msg_hdr.msg_iovlen = 1;
+			batchmsgs[i].msg_hdr.msg_control = batchcontrol+(size_t)i*RTPUDPV4TRANS_BATCHCONTROLSIZE;
+			batchmsgs[i].msg_hdr.msg_controllen = RTPUDPV4TRANS_BATCHCONTROLSIZE;
+			batchmsgs[i].msg_hdr.msg_flags = 0;
+			batchmsgs[i].msg_len = 0;
+		}
+
+		received = recvmmsg(sock,batchmsgs,batchcount,MSG_DONTWAIT,0);
+		if (received <= 0) // EAGAIN once drained; like recvfrom before, errors just end the poll
+			return 0;
+
+		RTPTime curtime = RTPTime::CurrentTime();
+		for (int i = 0 ; i < received ; i++)
+		{
+			size_t recvlen = batchmsgs[i].msg_len;
+			struct sockaddr_in *srcaddr = &batchaddrs[i];
+			bool acceptdata;
+
+#ifdef RTPUDPV4TRANS_HAVE_RXQOVFL
+			for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&batchmsgs[i].msg_hdr) ; cmsg != 0 ; cmsg = CMSG_NXTHDR(&batchmsgs[i].msg_hdr,cmsg))
+			{
+				if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+				{
+					uint32_t drops;
+
+					// the socket's total so far, only sent once there are any
+					memcpy(&drops,CMSG_DATA(cmsg),sizeof(uint32_t));
+					if (rtp)
+						rtpsockdrops = drops;
+					else
+						rtcpsockdrops = drops;
+				}
+			}
+#endif // RTPUDPV4TRANS_HAVE_RXQOVFL
+			if (batchmsgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			{
+				oversizedpackets++;
+				continue;
+			}
+			if (recvlen == 0) // make sure a packet of length zero is not queued
+				continue;
+
+			if (receivemode == RTPTransmitter::AcceptAll)
+				acceptdata = true;
+			else
+				acceptdata = ShouldAcceptData(ntohl(srcaddr->sin_addr.s_addr),ntohs(srcaddr->sin_port));
+			if (!acceptdata)
+				continue;
+
+			RTPRawPacket *pack;
+			RTPIPv4Address *addr;
+			uint8_t *data = batchslots[i];
+
+			addr = RTPNew(GetMemoryManager(),RTPMEM_TYPE_CLASS_RTPADDRESS) RTPIPv4Address(ntohl(srcaddr->sin_addr.s_addr),ntohs(srcaddr->sin_port));
+			if (addr == 0)
+				return ERR_RTP_OUTOFMEM;
+
+			bool isrtp = rtp;
+			if (rtpsock == rtcpsock) // check payload type when multiplexing
+			{
+				isrtp = true;
+
+				if (recvlen > sizeof(RTCPCommonHeader))
+				{
+					RTCPCommonHeader *rtcpheader = (RTCPCommonHeader *)data;
+					uint8_t packettype = rtcpheader->packettype;
+
+					if (packettype >= 200 && packettype <= 204)
+						isrtp = false;
+				}
+			}
+
+			pack = RTPNew(GetMemoryManager(),RTPMEM_TYPE_CLASS_RTPRAWPACKET) RTPRawPacket(data,recvlen,addr,curtime,isrtp,GetMemoryManager());
+			if (pack == 0)
+			{
+				RTPDelete(addr,GetMemoryManager());
+				return ERR_RTP_OUTOFMEM;
+			}
+			batchslots[i] = 0; // the packet owns it now
+			rawpacketlist.push_back(pack);
+		}
+	} while (received == batchcount);
+
+	return 0;
+}
+
+#endif // RTP_HAVE_RECVMMSG
+
+#ifdef RTP_HAVE_EPOLL
+
+// The sockets are registered once, so WaitForIncomingData does not build a
+// new poll set on every call. Without the epoll descriptor it uses RTPSelect.
+void RTPUDPv4Transmitter::CreateEpoll()
+{
+	SocketType socks[3] = { rtpsock, rtcpsock, m_pAbortDesc->GetAbortSocket() };
+
+	if ((epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return;
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		struct epoll_event ev;
+
+		if (i == 1 && rtcpsock == rtpsock)
+			continue;
+		memset(&ev,0,sizeof(struct epoll_event));
+		ev.events = EPOLLIN;
+		ev.data.u32 = (uint32_t)i; // the readflags index
+		if (epoll_ctl(epollfd,EPOLL_CTL_ADD,socks[i],&ev) < 0)
+		{
+			close(epollfd);
+			epollfd = -1;
+			return;
+		}
+	}
+}
+
+int RTPUDPv4Transmitter::WaitEpoll(int8_t *readflags,const RTPTime &delay)
+{
+	struct epoll_event events[3];
+	int timeoutmsec = -1;
+
+	readflags[0] = readflags[1] = readflags[2] = 0;
+	if (delay.GetDouble() >= 0)
+	{
+		// rounded up: a wait shorter than a millisecond would otherwise return right away
+		double dtimeoutmsec = delay.GetDouble()*1000.0;
+
+		if (dtimeoutmsec > 2147483647.0)
+			dtimeoutmsec = 2147483647.0;
+		timeoutmsec = (int)dtimeoutmsec;
+		if ((double)timeoutmsec < dtimeoutmsec)
+			timeoutmsec++;
+	}
+
+	int status = epoll_wait(epollfd,events,3,timeoutmsec);
+	if (status < 0)
+	{
+		// ignore an EINTR, like RTPSelect
+		if (errno == EINTR)
+			return 0;
+		return ERR_RTP_SELECT_ERRORINPOLL;
+	}
+	for (int i = 0 ; i < status ; i++)
+		readflags[events[i].data.u32] = 1;
+	return status;
+}
+
+#endif // RTP_HAVE_EPOLL
+
 int RTPUDPv4Transmitter::ProcessAddAcceptIgnoreEntry(uint32_t ip,uint16_t port)
 {
 	acceptignoreinfo.GotoElement(ip);
@@ -47,6 +47,12 @@
 #include "rtpabortdescriptors.h"
 #include <list>
 
+#ifdef RTP_HAVE_RECVMMSG
+struct mmsghdr;
+struct iovec;
+#endif // RTP_HAVE_RECVMMSG
+struct sockaddr_in;
+
 #ifdef RTP_SUPPORT_THREAD
 	#include <jthread/jmutex.h>
 #endif // RTP_SUPPORT_THREAD
@@ -58,6 +64,8 @@
 #define RTPUDPV4TRANS_RTCPRECEIVEBUFFER							32768
 #define RTPUDPV4TRANS_RTPTRANSMITBUFFER							32768
 #define RTPUDPV4TRANS_RTCPTRANSMITBUFFER						32768
+#define RTPUDPV4TRANS_BATCHMINSLOTSIZE							2048
+#define RTPUDPV4TRANS_MAXGATHERPACKETS							64
 
 namespace jrtplib
 {
@@ -124,6 +132,27 @@ public:
 	/** Can be used to allow the RTP port base to be any number, not just even numbers. */
 	void SetAllowOddPortbase(bool f)							{ allowoddportbase = f; }
 
+	/** Makes the transmitter read up to \c packets datagrams per system call.
+	 *  Makes the transmitter read up to \c packets datagrams per system call with
+	 *  \c recvmmsg, straight into a ring of reusable buffers of \c slotsize bytes which
+	 *  become the packet data, so nothing is copied. A \c slotsize of zero uses the
+	 *  session's maximum packet size, but at least RTPUDPV4TRANS_BATCHMINSLOTSIZE;
+	 *  datagrams which do not fit are dropped and counted, see
+	 *  RTPUDPv4Transmitter::GetOversizedPacketCount. With \c packets set to zero (the
+	 *  default), or where \c recvmmsg is not available, every datagram is read with
+	 *  its own \c recvfrom as before.
+	 */
+	void SetBatchReceive(int packets, size_t slotsize = 0)		{ batchrecvpackets = packets; batchrecvslotsize = slotsize; }
+
+	/** Allows UDP segmentation offload for packets sent with SendRTPDataGather.
+	 *  Allows UDP segmentation offload (\c UDP_SEGMENT) for packets sent with
+	 *  RTPUDPv4Transmitter::SendRTPDataGather: a run of equally sized packets then
+	 *  leaves in a single system call and is split by the kernel or the network
+	 *  card. Where the kernel refuses it, the transmitter falls back to \c sendmmsg
+	 *  by itself. Enabled by default.
+	 */
+	void SetSegmentationOffload(bool f)							{ segmentationoffload = f; }
+
 	/** Force the RTCP socket to use a specific port, not necessarily one more than
 	 *  the RTP port (set this to zero to disable). */
 	void SetForcedRTCPPort(uint16_t rtcpport)					{ forcedrtcpport = rtcpport; }
@@ -156,6 +185,15 @@ public:
 	/** If true, any RTP portbase will be allowed, not just even numbers. */
 	bool GetAllowOddPortbase() const							{ return allowoddportbase; }
 
+	/** Returns the number of datagrams read per system call, zero for one at a time. */
+	int GetBatchReceivePackets() const							{ return batchrecvpackets; }
+
+	/** Returns the size of the batch receive buffers, zero for the session's maximum packet size. */
+	size_t GetBatchReceiveSlotSize() const						{ return batchrecvslotsize; }
+
+	/** Returns \c true if UDP segmentation offload may be used for gathered sends. */
+	bool GetSegmentationOffload() const							{ return segmentationoffload; }
+
 	/** If non-zero, the specified port will be used to receive RTCP traffic. */
 	uint16_t GetForcedRTCPPort() const							{ return forcedrtcpport; }
 
@@ -177,6 +215,9 @@ private:
 	bool rtcpmux;
 	bool allowoddportbase;
 	uint16_t forcedrtcpport;
+	int batchrecvpackets;
+	size_t batchrecvslotsize;
+	bool segmentationoffload;
 
 	SocketType rtpsock, rtcpsock;
 	bool useexistingsockets;
@@ -197,6 +238,9 @@ inline RTPUDPv4TransmissionParams::RTPUDPv4TransmissionParams() : RTPTransmissio
 	rtcpmux = false;
 	allowoddportbase = false;
 	forcedrtcpport = 0;
+	batchrecvpackets = 0;
+	batchrecvslotsize = 0;
+	segmentationoffload = true;
 	useexistingsockets = false;
 	rtpsock = 0;
 	rtcpsock = 0;
@@ -277,6 +321,9 @@ public:
 	
 	int SendRTPData(const void *data,size_t len);	
 	int SendRTCPData(const void *data,size_t len);
+#ifndef RTP_SOCKETTYPE_WINSOCK
+	int SendRTPDataGather(const RTPGatherPacket *packets,int count);
+#endif // RTP_SOCKETTYPE_WINSOCK
 
 	int AddDestination(const RTPAddress &addr);
 	int DeleteDestination(const RTPAddress &addr);
@@ -301,6 +348,19 @@ public:
 #ifdef RTPDEBUG
 	void Dump();
 #endif // RTPDEBUG
+
+	/** Returns the number of datagrams dropped because they did not fit a batch receive buffer. */
+	uint64_t GetOversizedPacketCount() const				{ return oversizedpackets; }
+
+	/** Returns the number of send system calls made for RTP data so far. */
+	uint64_t GetRTPSendCallCount() const					{ return rtpsendcalls; }
+
+	/** Returns the number of datagrams the kernel dropped because the receive buffer of the RTP
+	 *  or RTCP socket was full. The count comes with the datagrams read by batch receive
+	 *  (SO_RXQ_OVFL), so it stays zero without it, and it only moves once a datagram arrives
+	 *  after the drops.
+	 */
+	uint64_t GetSocketDropCount() const						{ return (uint64_t)rtpsockdrops + (uint64_t)rtcpsockdrops; }
 private:
 	int CreateLocalIPList();
 	bool GetLocalIPList_Interfaces();
@@ -308,6 +368,19 @@ private:
 	void AddLoopbackAddress();
 	void FlushPackets();
 	int PollSocket(bool rtp);
+#ifdef RTP_HAVE_RECVMMSG
+	int CreateBatchRing(int packets,size_t slotsize);
+	void DestroyBatchRing();
+	int PollSocketBatch(bool rtp);
+#endif // RTP_HAVE_RECVMMSG
+#ifdef RTP_HAVE_EPOLL
+	void CreateEpoll();
+	int WaitEpoll(int8_t *readflags,const RTPTime &delay);
+#endif // RTP_HAVE_EPOLL
+#ifndef RTP_SOCKETTYPE_WINSOCK
+	int SendGatherSegments(const struct sockaddr_in *addr,const RTPGatherPacket *packets,int count);
+	int SendGatherPackets(const struct sockaddr_in *addr,const RTPGatherPacket *packets,int count);
+#endif // RTP_SOCKETTYPE_WINSOCK
 	int ProcessAddAcceptIgnoreEntry(uint32_t ip,uint16_t port);
 	int ProcessDeleteAcceptIgnoreEntry(uint32_t ip,uint16_t port);
 #ifdef RTP_SUPPORT_IPV4MULTICAST
@@ -338,6 +411,24 @@ private:
 	bool supportsmulticasting;
 	size_t maxpacksize;
 
+#ifdef RTP_HAVE_RECVMMSG
+	// recvmmsg ring: a slot handed over to an RTPRawPacket is reallocated before the next call
+	int batchcount;
+	size_t batchslotsize;
+	uint8_t **batchslots;
+	struct mmsghdr *batchmsgs;
+	struct iovec *batchiovecs;
+	struct sockaddr_in *batchaddrs;
+	uint8_t *batchcontrol;
+#endif // RTP_HAVE_RECVMMSG
+#ifdef RTP_HAVE_EPOLL
+	int epollfd; // the RTP, RTCP and abort sockets; -1 makes WaitForIncomingData use RTPSelect
+#endif // RTP_HAVE_EPOLL
+	uint32_t rtpsockdrops,rtcpsockdrops;
+	uint64_t oversizedpackets;
+	uint64_t rtpsendcalls;
+	bool usegso; // cleared for good once the kernel refuses UDP_SEGMENT
+
 	class PortInfo
 	{
 	public:
@@ -0,0 +1,8 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+
+int main(void)
+{
+	struct mmsghdr msgs[2];
+	return sendmmsg(-1, msgs, 2, 0);
+}
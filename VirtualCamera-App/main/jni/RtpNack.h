@@ -0,0 +1,156 @@
+#ifndef __RTP_NACK_H__
+#define __RTP_NACK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+namespace jrtplib {
+class RTPPacket;
+}
+
+// RFC 4585 transport layer feedback, generic NACK
+#define RTCP_RTPFB              205
+#define RTCP_RTPFB_FMT_NACK     1
+
+// FCI of a generic NACK: the media source SSRC, then (PID, BLP) pairs, each
+// covering a sequence number and the 16 that follow it. seqs must be in
+// sequence order. Returns the FCI length in bytes (a multiple of 4), or 0 when
+// maxlen cannot hold the SSRC and the first pair. Pairs that do not fit are
+// left out.
+size_t RtpNack_BuildFci(uint32_t mediaSsrc, const uint16_t *seqs, int count, uint8_t *out, size_t maxlen);
+
+// Parses one RTCP packet (common header included) as a generic NACK. Returns
+// the number of sequence numbers stored in seqs, or -1 when the packet is not
+// a generic NACK. Sequence numbers beyond maxSeqs are dropped.
+int RtpNack_Parse(const uint8_t *rtcp, size_t len, uint32_t *mediaSsrc, uint16_t *seqs, int maxSeqs);
+
+typedef void (*rtp_packet_callback)(void *userdata, jrtplib::RTPPacket *packet);
+
+// Receive side of the retransmission loop. Packets are held in a ring indexed
+// by sequence number and handed on strictly in order; a gap stops delivery
+// until the missing packet is retransmitted or the hold time runs out, after
+// which the packets behind it go on as a loss. CollectNacks returns the
+// missing sequence numbers that are due for a (re)request.
+//
+// A hold time of 0 turns the buffer into a pass-through: nothing is held or
+// requested. With ordering off, packets go on as they arrive and the buffer
+// only keeps track of the gaps for the NACKs; an RtpJitterBuffer behind it
+// orders them by frame. Packets go to deliver, which takes ownership; those
+// the buffer drops (duplicates, Reset) go to release.
+//
+// Single threaded.
+class RtpNackBuffer
+{
+public:
+    struct Stats {
+        uint64_t packets;
+        uint64_t reordered;         // arrived behind a later packet
+        uint64_t missing;           // sequence numbers found missing
+        uint64_t requested;         // sequence numbers put in NACKs, retries included
+        uint64_t recovered;         // missing packets that arrived after being requested
+        uint64_t lost;              // given up on
+        uint64_t duplicates;
+        uint64_t late;              // arrived after being given up on
+    };
+
+    RtpNackBuffer(rtp_packet_callback deliver, rtp_packet_callback release, void *userdata,
+            int capacity = 1024);
+    ~RtpNackBuffer();
+
+    // holdUs: how long a gap may stall delivery, counted from its detection.
+    // retryUs: interval between NACKs for the same packet, at most maxRetries.
+    void SetTiming(long long holdUs, long long retryUs, int maxRetries);
+    // On by default. Packets arriving after their gap was given up on are
+    // still delivered when off.
+    void SetOrdering(bool ordered);
+
+    void Push(jrtplib::RTPPacket *packet, long long nowUs);
+    // Gives up on gaps whose hold time is over and delivers what is behind them.
+    void Poll(long long nowUs);
+    // Returns how many sequence numbers were stored, and the media SSRC.
+    int CollectNacks(long long nowUs, uint16_t *seqs, int maxSeqs, uint32_t *mediaSsrc);
+    // Next time Poll or CollectNacks has something to do, -1 when no gap is open.
+    long long GetNextDeadlineUs() const;
+
+    // Delivers everything held, skipping the gaps.
+    void Flush();
+    // Releases everything held and forgets the stream.
+    void Reset();
+
+    const Stats &GetStats() const { return mStats; }
+    int GetHeldPackets() const { return mHeld; }
+
+private:
+    struct Slot {
+        jrtplib::RTPPacket *packet;
+        bool missing;
+        int retries;
+        long long missingSinceUs;
+        long long nackAtUs;
+    };
+
+    Slot &SlotOf(uint16_t seq) { return mSlots[seq & (mCapacity - 1)]; }
+    const Slot &SlotOf(uint16_t seq) const { return mSlots[seq & (mCapacity - 1)]; }
+    void Deliver(long long nowUs);
+    void Restart(uint16_t seq);
+
+    rtp_packet_callback mDeliver;
+    rtp_packet_callback mRelease;
+    void *mUserdata;
+
+    Slot *mSlots;
+    int mCapacity;          // power of two
+    int mHeld;
+
+    long long mHoldUs;
+    long long mRetryUs;
+    int mMaxRetries;
+    bool mOrdered;
+
+    bool mHaveSeq;
+    uint32_t mSsrc;
+    uint16_t mNextSeq;      // next one to deliver
+    uint16_t mHighestSeq;   // highest one seen, mNextSeq - 1 when nothing is held
+
+    Stats mStats;
+};
+
+// Send side: copies of the last capacity RTP packets, by sequence number,
+// for answering NACKs. Store and Lookup may be called from different threads.
+class RtpRetransmitCache
+{
+public:
+    struct Stats {
+        uint64_t stored;
+        uint64_t requested;
+        uint64_t resent;            // found and copied out
+        uint64_t missed;            // already overwritten or never sent
+    };
+
+    RtpRetransmitCache(int capacity = 1024, size_t maxPacketSize = 1500);
+    ~RtpRetransmitCache();
+
+    // The packet is header followed by payload; either may be empty.
+    void Store(const void *header, size_t headerLen, const void *payload, size_t payloadLen);
+    // Copies the packet with sequence number seq to out and returns its length,
+    // 0 when it is no longer held.
+    size_t Lookup(uint16_t seq, uint8_t *out, size_t maxlen);
+
+    Stats GetStats();
+
+private:
+    struct Slot {
+        uint8_t *data;
+        size_t len;
+        uint16_t seq;
+    };
+
+    Slot *mSlots;
+    int mCapacity;          // power of two
+    size_t mMaxPacketSize;
+    pthread_mutex_t mLock;
+    Stats mStats;
+};
+
+#endif // __RTP_NACK_H__
@@ -0,0 +1,157 @@
+#ifndef __RTP_RATE_CONTROL_H__
+#define __RTP_RATE_CONTROL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// RTCP APP packet with the receiver's target bitrate for the sender's
+// encoder: name "VCBR", subtype 0, then the media source SSRC and the
+// bitrate in bits/s, both 32 bit big endian.
+#define RTCP_APP_RATE_NAME      "VCBR"
+#define RTCP_APP_RATE_SUBTYPE   0
+#define RTCP_APP_RATE_LENGTH    8
+
+// The APP data for SendRTCPAPPPacket. Returns its length, 0 when maxlen is too small.
+size_t RtpRate_BuildApp(uint32_t mediaSsrc, uint32_t bitrate, uint8_t *out, size_t maxlen);
+// Takes apart what RTCPAPPPacket hands out. Returns 0, or -1 when it is some
+// other APP packet.
+int RtpRate_ParseApp(const uint8_t *name, uint8_t subtype, const uint8_t *data, size_t len,
+        uint32_t *mediaSsrc, uint32_t *bitrate);
+
+// Receive side congestion control, after GCC (draft-ietf-rmcat-gcc), in two parts:
+//
+// Delay based: packets are grouped into frames by RTP timestamp. The growth
+// of the one way delay between frames is smoothed and its trend over the
+// last frames fitted by a line; a slope above an adaptive threshold means a
+// queue is building (overuse) and the rate drops to 85% of what actually
+// arrives. Otherwise the rate grows by 8% per second, up to 1.5 times what
+// arrives. This needs RTP timestamps on a media clock: when their pace does
+// not match the clock rate within 20% (the sender stamps a fixed increment
+// per unit, say), the delay part stays out and only loss steers.
+//
+// Loss based: from the RTPSourceData counters, per feedback interval. Above
+// 10% loss the rate is cut by half the loss ratio, below 2% it may grow
+// again, in between it holds.
+//
+// The target is the lower of the two, within [minBitrate, maxBitrate].
+//
+// Single threaded.
+class RtpRateController
+{
+public:
+    struct Config {
+        uint32_t minBitrate;            // bits/s
+        uint32_t maxBitrate;
+        uint32_t startBitrate;
+        long long intervalUs;           // between updates, and target reports to the sender
+        double clockRate;               // RTP timestamp units per second
+    };
+
+    // What RTPSourceData says about the stream, counted since it started.
+    struct SourceStats {
+        uint32_t extendedHighestSeq;    // INF_GetExtendedHighestSequenceNumber
+        uint32_t packetsReceived;       // INF_GetNumPacketsReceived
+        uint32_t jitter;                // INF_GetJitter, in timestamp units
+    };
+
+    enum {
+        USAGE_NORMAL = 0,
+        USAGE_OVER,
+        USAGE_UNDER,
+    };
+
+    struct Stats {
+        uint64_t packets;
+        uint64_t frames;                // timestamp groups that completed
+        uint64_t updates;
+        uint64_t overuses;              // delay based decreases
+        uint64_t lossDecreases;
+        uint32_t receivedBitrate;       // over the last second
+        double loss;                    // last interval, 0..1
+        double jitterMs;
+        double trend;                   // modified delay trend, compared with threshold
+        double threshold;
+        int usage;
+        bool clockValid;                // timestamps follow the clock rate, the delay part is on
+    };
+
+    // Defaults: 300 kbit/s to 8 Mbit/s starting at 2 Mbit/s, 200 ms, 90 kHz.
+    static void GetDefaultConfig(Config *config);
+
+    RtpRateController(const Config &config);
+
+    // Every RTP packet as it arrives; retransmissions included.
+    void OnPacket(long long arrivalUs, uint32_t rtpTimestamp, size_t bytes);
+    // Recomputes the target once the interval is over. Returns true when it
+    // did: the target should go to the sender now.
+    bool Update(long long nowUs, const SourceStats &source);
+    long long GetNextDeadlineUs() const { return mNextUpdateUs; }
+
+    uint32_t GetTargetBitrate() const { return mTarget; }
+    const Stats &GetStats() const { return mStats; }
+
+    // Forgets the stream, the target goes back to the start bitrate.
+    void Reset();
+
+private:
+    enum { TREND_WINDOW = 20, RATE_BUCKETS = 10 };
+
+    void OnFrame(long long arrivalUs, uint32_t rtpTimestamp);
+    void CheckClock(long long arrivalUs, uint32_t rtpTimestamp);
+    void Detect(double trend, long long arrivalUs, double deltaMs);
+    uint32_t ReceivedBitrate() const;
+
+    Config mConfig;
+
+    // frame grouping
+    bool mHaveGroup;
+    uint32_t mGroupTimestamp;
+    long long mGroupFirstUs;
+    long long mGroupLastUs;
+    bool mHavePrevGroup;
+    uint32_t mPrevTimestamp;
+    long long mPrevArrivalUs;
+
+    // clock check: timestamps against arrival over a few seconds
+    long long mClockStartUs;
+    uint32_t mClockStartTimestamp;
+
+    // trendline
+    double mAccumulatedDelayMs;
+    double mSmoothedDelayMs;
+    long long mFirstArrivalUs;
+    double mTrendX[TREND_WINDOW];
+    double mTrendY[TREND_WINDOW];
+    int mTrendCount;
+    int mTrendNext;
+    int mDeltas;
+    double mPrevTrend;
+    double mThreshold;
+    long long mLastThresholdUs;
+    double mOveruseMs;
+    int mOveruseCount;
+    int mUsage;
+
+    // received rate: bytes per update interval over about a second
+    uint64_t mIntervalBytes;
+    uint64_t mBucketBytes[RATE_BUCKETS];
+    long long mBucketUs[RATE_BUCKETS];
+    int mBucketNext;
+
+    // rate control
+    bool mStarted;
+    long long mLastUpdateUs;
+    long long mNextUpdateUs;
+    long long mLastDecreaseUs;
+    long long mLastLossDecreaseUs;
+    double mDelayBased;
+    double mLossBased;
+    uint32_t mTarget;
+    bool mHaveSource;
+    uint32_t mLastExtendedSeq;
+    uint32_t mLastReceived;
+
+    Stats mStats;
+};
+
+#endif // __RTP_RATE_CONTROL_H__
@@ -12,6 +12,7 @@
 #include <JRTPLIB/src/rtpsession.h>
 #include <JRTPLIB/src/rtppacket.h>
 #include <Common/thread/thread.h>
+#include <Common/thread/Semaphore.h>
 #include <AnsyncDecoder/AnsyncDecoder.h>
 #include <display/display.h>
 
@@ -20,9 +21,14 @@
 #include "rtpipv4address.h"
 #include "rtpsessionparams.h"
 #include "rtperrors.h"
+#include "rtcppacket.h"
+#include "rtcpapppacket.h"
 #include "rtplibraryversion.h"
 
 #include "fflog.h"
+#include "RtpNack.h"
+#include "RtpKeyframeRequest.h"
+#include "RtpRateControl.h"
 
 using namespace jrtplib;
 
@@ -196,8 +202,139 @@ int test2() {
 int receiveVideoPacket(void *data, size_t *dataLen);
 int receiveAudioPacket(void *data, size_t *dataLen);
 
-RTPSession videoSession;
-RTPSession audioSession;
+Semaphore *recvSem;
+
+#define NACK_MAX_SEQS 256
+// the receiver repeats its PLI/FIR until an IDR arrives; the encoder needs
+// only one nudge per IDR
+#define KEYFRAME_REQUEST_MIN_INTERVAL_US 100000LL
+// the receiver reports its target every interval; the encoder is only
+// reconfigured when it moved by this much (percent)
+#define TARGET_BITRATE_MIN_CHANGE 5
+
+static void post_keyframe_request(int fmt);
+static void post_target_bitrate(uint32_t bitrate);
+
+// The poll thread of each session blocks on its sockets; after every step it
+// wakes the receive thread, so packets are drained as soon as they arrive
+// instead of on a fixed 20 ms tick.
+//
+// With a retransmitCache (video), every packet sent is kept there and the
+// receiver's generic NACKs are answered from the poll thread. With
+// forwardKeyframeRequests (video), the receiver's PLI/FIR go to Java as
+// event 3, for the encoder to send an IDR. With forwardBitrate (video), the
+// receiver's target bitrate (RTCP APP "VCBR") goes to Java as event 4.
+//
+// RTP timestamps follow the encoder's presentation times on a clockRate
+// media clock (90 kHz for video): AdvanceTimestamp before each unit, then
+// send it with no increment so all of its packets carry the same timestamp.
+class NotifyRTPSession : public RTPSession {
+public:
+    NotifyRTPSession() : retransmitCache(NULL), forwardKeyframeRequests(false), lastKeyframeRequestUs(0),
+            keyframeRequests(0), keyframeRequestsForwarded(0), forwardBitrate(false), lastTargetBitrate(0),
+            bitrateReports(0), bitrateReportsForwarded(0), clockRate(90000), timestampStarted(false),
+            firstPtsUs(0), timestampTicks(0) {}
+
+    RtpRetransmitCache *retransmitCache;
+    bool forwardKeyframeRequests;
+    long long lastKeyframeRequestUs;
+    unsigned long long keyframeRequests;
+    unsigned long long keyframeRequestsForwarded;
+    bool forwardBitrate;
+    uint32_t lastTargetBitrate;
+    unsigned long long bitrateReports;
+    unsigned long long bitrateReportsForwarded;
+    uint32_t clockRate;
+    bool timestampStarted;
+
+    // Moves the timestamp to ptsUs, counted from the first unit sent.
+    void AdvanceTimestamp(long long ptsUs) {
+        if (!timestampStarted) {
+            timestampStarted = true;
+            firstPtsUs = ptsUs;
+            timestampTicks = 0;
+        }
+        uint32_t ticks = (uint32_t) ((ptsUs - firstPtsUs) * clockRate / 1000000LL);
+        IncrementTimestamp(ticks - timestampTicks);
+        timestampTicks = ticks;
+    }
+
+protected:
+    void OnPollThreadStep() {
+        Semaphore_Signal(recvSem);
+    }
+
+    void OnSendRTPPacket(const RTPGatherPacket &packet) {
+        if (retransmitCache != NULL) {
+            retransmitCache->Store(packet.header, packet.headerlen, packet.payload, packet.payloadlen);
+        }
+    }
+
+    void OnUnknownPacketType(RTCPPacket *rtcppack, const RTPTime &receivetime, const RTPAddress *senderaddress) {
+        uint16_t seqs[NACK_MAX_SEQS];
+        uint8_t data[RTP_DEFAULTPACKETSIZE];
+        uint32_t ssrc;
+
+        int fmt = RtpKeyframeRequest_Parse(rtcppack->GetPacketData(), rtcppack->GetPacketLength(), &ssrc);
+        if (fmt >= 0) {
+            if (forwardKeyframeRequests && ssrc == GetLocalSSRC()) {
+                OnKeyframeRequest(fmt, receivetime);
+            }
+            return;
+        }
+        if (retransmitCache == NULL) {
+            return;
+        }
+        int count = RtpNack_Parse(rtcppack->GetPacketData(), rtcppack->GetPacketLength(), &ssrc, seqs, NACK_MAX_SEQS);
+        if (count <= 0 || ssrc != GetLocalSSRC()) {
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            size_t len = retransmitCache->Lookup(seqs[i], data, sizeof(data));
+            if (len > 0) {
+                SendRawData(data, len, true);
+            }
+        }
+    }
+
+    void OnAPPPacket(RTCPAPPPacket *apppacket, const RTPTime &receivetime, const RTPAddress *senderaddress) {
+        uint32_t ssrc, bitrate;
+        if (!forwardBitrate || RtpRate_ParseApp(apppacket->GetName(), apppacket->GetSubType(),
+                apppacket->GetAPPData(), apppacket->GetAPPDataLength(), &ssrc, &bitrate) < 0) {
+            return;
+        }
+        if (ssrc != GetLocalSSRC() || bitrate == 0) {
+            return;
+        }
+        bitrateReports++;
+        uint32_t change = bitrate > lastTargetBitrate ? bitrate - lastTargetBitrate : lastTargetBitrate - bitrate;
+        if (lastTargetBitrate != 0 && (uint64_t) change * 100 < (uint64_t) lastTargetBitrate * TARGET_BITRATE_MIN_CHANGE) {
+            return;
+        }
+        lastTargetBitrate = bitrate;
+        bitrateReportsForwarded++;
+        post_target_bitrate(bitrate);
+    }
+
+private:
+    long long firstPtsUs;
+    uint32_t timestampTicks;
+
+    void OnKeyframeRequest(int fmt, const RTPTime &receivetime) {
+        long long nowUs = (long long) receivetime.GetSeconds() * 1000000LL + receivetime.GetMicroSeconds();
+        keyframeRequests++;
+        if (keyframeRequestsForwarded > 0 && nowUs - lastKeyframeRequestUs < KEYFRAME_REQUEST_MIN_INTERVAL_US) {
+            return;
+        }
+        lastKeyframeRequestUs = nowUs;
+        keyframeRequestsForwarded++;
+        LOGFD("receiver asks for a keyframe (%s)", fmt == RTCP_PSFB_FMT_FIR ? "FIR" : "PLI");
+        post_keyframe_request(fmt);
+    }
+};
+
+NotifyRTPSession videoSession;
+NotifyRTPSession audioSession;
 uint8_t recvData[1024*1024];
 size_t recvLen;
 uint8_t mediaType;
@@ -225,6 +362,22 @@ static void java_callback_init(JNIEnv *env) {
     CHECK_NULL_ASSERT(postEventId)
 }
 
+// Poll thread of the video session. data is NULL, dataLen is the RTCP FMT.
+static void post_keyframe_request(int fmt) {
+    JNIEnv *env;
+    jvm->AttachCurrentThread(&env, NULL);
+    env->CallVoidMethod(gObj, postEventId, 3, NULL, fmt);
+    jvm->DetachCurrentThread();
+}
+
+// Poll thread of the video session. data is NULL, dataLen is the target in bits/s.
+static void post_target_bitrate(uint32_t bitrate) {
+    JNIEnv *env;
+    jvm->AttachCurrentThread(&env, NULL);
+    env->CallVoidMethod(gObj, postEventId, 4, NULL, (jint) bitrate);
+    jvm->DetachCurrentThread();
+}
+
 static void copyFrame(const uint8_t *src, uint8_t *dest, const int width, const int height, const int stride_src, const int stride_dest) {
     const int h8 = height % 8;
     for (int i = 0; i < h8; i++) {
@@ -304,9 +457,9 @@ static void decoder_cb(void *userdata, void *data, int dataLen, int w, int h, u3
 }
 
 static void thread_recv_data(void *d) {
-    recvQuit = 0;
     decoder = AnsyncDecoder_Create(NULL, 0, NULL, 0, NULL, decoder_cb);
     while (!recvQuit) {
+        Semaphore_Wait(recvSem);
         receiveAudioPacket(recvData, &recvLen);
         receiveVideoPacket(recvData, &recvLen);
     }
@@ -315,14 +468,32 @@ static void thread_recv_data(void *d) {
 }
 
 int createMediaSession(const uint8_t *ip) {
+    if (recvSem == NULL) {
+        recvSem = Semaphore_Create("recv", 0);
+    }
+    recvQuit = 0;
+
     // 视频发送接收端口
     RTPSessionParams sessionparams;
-    sessionparams.SetOwnTimestampUnit(1.0 / 9000.0);
+    sessionparams.SetOwnTimestampUnit(1.0 / 90000.0);
     sessionparams.SetAcceptOwnPackets(true);
 
     RTPUDPv4TransmissionParams transparams;
     transparams.SetPortbase(5000);
 
+    if (videoSession.retransmitCache == NULL) {
+        // about a second of a 10 Mbit/s stream
+        videoSession.retransmitCache = new RtpRetransmitCache(1024, RTP_DEFAULTPACKETSIZE);
+    }
+    videoSession.forwardKeyframeRequests = true;
+    videoSession.keyframeRequests = 0;
+    videoSession.keyframeRequestsForwarded = 0;
+    videoSession.forwardBitrate = true;
+    videoSession.lastTargetBitrate = 0;
+    videoSession.bitrateReports = 0;
+    videoSession.bitrateReportsForwarded = 0;
+    videoSession.clockRate = 90000;
+    videoSession.timestampStarted = false;
     int status = videoSession.Create(sessionparams, &transparams);
     CHECK_ERROR_JRTPLIB(status);
 //
@@ -337,12 +508,15 @@ int createMediaSession(const uint8_t *ip) {
     videoSession.SetDefaultTimestampIncrement(0);
 
     // 音频发送接收端口
+    // the AAC sample rate, as in the ADTS header MediaMuxerWrapper writes
     RTPSessionParams sessionparams2;
-    sessionparams2.SetOwnTimestampUnit(1.0 / 9000.0);
+    sessionparams2.SetOwnTimestampUnit(1.0 / 44100.0);
     sessionparams2.SetAcceptOwnPackets(true);
 
     RTPUDPv4TransmissionParams transparams2;
     transparams2.SetPortbase(5100);
+    audioSession.clockRate = 44100;
+    audioSession.timestampStarted = false;
     status = audioSession.Create(sessionparams2, &transparams2);
     CHECK_ERROR_JRTPLIB(status);
 
@@ -362,10 +536,24 @@ int createMediaSession(const uint8_t *ip) {
 
 int destroyMediaSession() {
     RTPTime delay = RTPTime(2.0);
-    videoSession.BYEDestroy(delay, "stop rtp videoSession", strlen("stop rtp videoSession"));
-    audioSession.BYEDestroy(delay, "stop rtp audioSession", strlen("stop rtp audioSession"));
     recvQuit = 1;
+    Semaphore_Signal(recvSem);
     Thread_Destroy(recvThread);
+    recvThread = NULL;
+    videoSession.BYEDestroy(delay, "stop rtp videoSession", strlen("stop rtp videoSession"));
+    audioSession.BYEDestroy(delay, "stop rtp audioSession", strlen("stop rtp audioSession"));
+    if (videoSession.retransmitCache != NULL) {
+        RtpRetransmitCache::Stats stats = videoSession.retransmitCache->GetStats();
+        LOGFD("retransmit cache: %llu stored, %llu requested, %llu resent, %llu missed",
+              (unsigned long long) stats.stored, (unsigned long long) stats.requested,
+              (unsigned long long) stats.resent, (unsigned long long) stats.missed);
+        delete videoSession.retransmitCache;
+        videoSession.retransmitCache = NULL;
+    }
+    LOGFD("keyframe requests: %llu received, %llu forwarded", videoSession.keyframeRequests,
+          videoSession.keyframeRequestsForwarded);
+    LOGFD("target bitrate: %llu reports, %llu forwarded, last %u bit/s", videoSession.bitrateReports,
+          videoSession.bitrateReportsForwarded, videoSession.lastTargetBitrate);
     if (glFrameData.data != NULL) {
         free(glFrameData.data);
         glFrameData.data = NULL;
@@ -373,18 +561,21 @@ int destroyMediaSession() {
     return 0;
 }
 
-// type = 1 video; type = 2 audio
-int sendMediaPacket(const void *data, size_t len, int type) {
+// type = 1 video; type = 2 audio. ptsUs is the encoder's presentation time;
+// endOfFrame is false for the SPS and PPS that go ahead of an IDR with its
+// timestamp, so only the picture's last packet is marked.
+int sendMediaPacket(const void *data, size_t len, int type, long long ptsUs, bool endOfFrame) {
     if (type == 1) {
-        videoSession.SendPacketAfterSlice(data, len, 96, true, 10);
+        videoSession.AdvanceTimestamp(ptsUs);
+        videoSession.SendPacketAfterSlice(data, len, 96, endOfFrame, 0);
     } else if (type == 2) {
-        audioSession.SendPacket(data, len, 96, true, 10);
+        audioSession.AdvanceTimestamp(ptsUs);
+        audioSession.SendPacket(data, len, 96, true, 0);
     }
     return 0;
 }
 
 int receiveVideoPacket(void *data, size_t *dataLen) {
-    RTPTime delay(0.020);
     videoSession.BeginDataAccess();
     if (videoSession.GotoFirstSource()) {
         do {
@@ -406,7 +597,7 @@ int receiveVideoPacket(void *data, size_t *dataLen) {
                         memcpy((uint8_t *)data + *dataLen, packet->GetPayloadData() + 2, packet->GetPayloadLength() - 2 );
                         *dataLen += packet->GetPayloadLength() - 2;
 //                        LOGFD("切片RTP包结束 dataLen(%d) timestamp(%u)", *dataLen, packet->GetTimestamp());
-                        AnsyncDecoder_ReceiveData(decoder, data, (int)*dataLen, 0, 1);
+                        AnsyncDecoder_ReceiveData(decoder, data, (int)*dataLen, packet->GetTimestamp(), 1);
 
                     } else {
                         memcpy((uint8_t *)data + *dataLen, packet->GetPayloadData() + 2, packet->GetPayloadLength() - 2 );
@@ -416,7 +607,7 @@ int receiveVideoPacket(void *data, size_t *dataLen) {
                 } else { // 单个包 SPS:7 PPS:8 I:5 P:1
                     memcpy(data, packet->GetPayloadData(), packet->GetPayloadLength());
                     *dataLen = packet->GetPayloadLength();
-                    AnsyncDecoder_ReceiveData(decoder, data, (int)*dataLen, 0, 1);
+                    AnsyncDecoder_ReceiveData(decoder, data, (int)*dataLen, packet->GetTimestamp(), 1);
 //                    LOGFD("单个RTP包 dataLen(%d) timestamp = %u", *dataLen, packet->GetTimestamp());
                 }
                 videoSession.DeletePacket(packet);
@@ -424,12 +615,10 @@ int receiveVideoPacket(void *data, size_t *dataLen) {
         } while (videoSession.GotoNextSource());
     }
     videoSession.EndDataAccess();
-    RTPTime::Wait(delay);
     return 0;
 }
 
 int receiveAudioPacket(void *data, size_t *dataLen) {
-    RTPTime delay(0.020);
     audioSession.BeginDataAccess();
     if (audioSession.GotoFirstSource()) {
         do {
@@ -441,14 +630,13 @@ int receiveAudioPacket(void *data, size_t *dataLen) {
 
                 memcpy(data, packet->GetPayloadData(), packet->GetPayloadLength());
                 *dataLen = packet->GetPayloadLength();
-                AnsyncDecoder_ReceiveData(decoder, data, (int)*dataLen, 0, 2);
+                AnsyncDecoder_ReceiveData(decoder, data, (int)*dataLen, packet->GetTimestamp(), 2);
 //                LOGFD("单个 Audio RTP包 dataLen(%d) timestamp = %u", *dataLen, packet->GetTimestamp());
                 audioSession.DeletePacket(packet);
             }
         } while (audioSession.GotoNextSource());
     }
     audioSession.EndDataAccess();
-    RTPTime::Wait(delay);
     return 0;
 }
 
@@ -475,9 +663,10 @@ Java_com_forrest_jrtplib_JrtplibUtil_destroySendSession(JNIEnv *env, jobject ins
 
 extern "C"
 JNIEXPORT void JNICALL
-Java_com_forrest_jrtplib_JrtplibUtil_sendData(JNIEnv *env, jobject instance, jbyteArray data_, jint dataLen, jint dataType) {
+Java_com_forrest_jrtplib_JrtplibUtil_sendData(JNIEnv *env, jobject instance, jbyteArray data_, jint dataLen, jint dataType,
+                                              jlong presentationTimeUs, jboolean endOfFrame) {
     jbyte *data = env->GetByteArrayElements(data_, NULL);
-    sendMediaPacket(data, (size_t) dataLen, dataType);
+    sendMediaPacket(data, (size_t) dataLen, dataType, (long long) presentationTimeUs, endOfFrame == JNI_TRUE);
     env->ReleaseByteArrayElements(data_, data, 0);
 }
 
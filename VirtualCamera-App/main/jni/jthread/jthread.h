@@ -30,15 +30,35 @@
 #define JTHREAD_JTHREAD_H
 
 #include "jmutex.h"
+#include <sched.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define ERR_JTHREAD_CANTINITMUTEX						-1
 #define ERR_JTHREAD_CANTSTARTTHREAD						-2
 #define ERR_JTHREAD_THREADFUNCNOTSET					-3
 #define ERR_JTHREAD_NOTRUNNING							-4
 #define ERR_JTHREAD_ALREADYRUNNING						-5
+#define ERR_JTHREAD_INVALIDSCHEDULING					-6
 
 namespace jthread {
 
+/** The scheduling a thread ended up with, and how long it spent runnable but
+ *  waiting for a CPU, from the kernel's schedstat and context switch counts. */
+class JThreadSchedulingStats
+{
+public:
+	JThreadSchedulingStats() : policy(SCHED_OTHER), priority(0), nice(0), cpumask(0), rundelayns(0),
+	                           timeslices(0), voluntaryswitches(0), involuntaryswitches(0) { }
+
+	int policy, priority, nice;
+	uint64_t cpumask;			// 0 when the affinity was left alone
+	uint64_t rundelayns;
+	uint64_t timeslices;
+	uint64_t voluntaryswitches;
+	uint64_t involuntaryswitches;	// preempted while it still had work
+};
+
 class JThread {
 public:
 	JThread();
@@ -50,14 +70,33 @@ public:
 	void *GetReturnValue();
 	bool IsSameThread();
 
+	/** Sets the scheduling the thread gives itself when it starts: \c policy is
+	 *  SCHED_OTHER, SCHED_FIFO or SCHED_RR, \c priority the real-time priority and
+	 *  \c nice the nice value for SCHED_OTHER, which is also what a real-time
+	 *  policy falls back to when the process may not use it. \c cpumask has a bit
+	 *  per CPU the thread may run on, zero leaves the affinity alone. Takes effect
+	 *  at the next Start. */
+	int SetScheduling(int policy, int priority, int nice, uint64_t cpumask = 0);
+
+	/** Live while the thread runs, final once it has returned. */
+	int GetSchedulingStats(JThreadSchedulingStats *stats);
+
 protected:
 	void ThreadStarted();
 
 private:
 	static void *TheThread(void *param);
+	void ApplyScheduling();
+	static void ReadSchedulingCounters(pid_t tid, JThreadSchedulingStats *stats);
 	pthread_t threadid;
 	void *retval;
 	bool running;
+
+	bool schedset;
+	int schedpolicy, schedpriority, schednice;
+	uint64_t schedcpumask;
+	pid_t tid;					// behind runningmutex, like the stats
+	JThreadSchedulingStats schedstats;
 	
 	JMutex runningmutex;
 	JMutex continuemutex,continuemutex2;
@@ -19,14 +19,29 @@ LOCAL_CFLAGS :=
 LOCAL_SRC_FILES:= \
     main_virtualcamera.cpp  \
     VirtualCameraService.cpp  \
+    LatencyHistogram.cpp  \
+    FramePresenter.cpp  \
+    H264Depacketizer.cpp  \
+    RtpNack.cpp  \
+    RtpKeyframeRequest.cpp  \
+    RtpRateControl.cpp  \
+    RtpJitterBuffer.cpp  \
+    RtpCaptureClock.cpp  \
     IVirtualCameraService.cpp  \
     AnsyncDecoder/ff_mp4.c  \
     AnsyncDecoder/sps_pps.c  \
     AnsyncDecoder/AnsyncDecoder.c  \
+    AnsyncDecoder/decoder_backend_avcodec.c  \
+    AnsyncDecoder/decoder_backend_mediacodec.c  \
+    AnsyncDecoder/decoder_backend_null.c  \
     jthread/jmutex.cpp  \
     jthread/jthread.cpp  \
     Common/dtimenow.c  \
     Common/circular_list.c  \
+    Common/yuv420.c  \
+    Common/yuv_convert.c  \
+    Common/yuv_convert_x86.c  \
+    Common/yuv_convert_neon.c  \
     Common/network/NetworkSocket.c  \
     Common/thread/linux/mutex_pthread.c  \
     Common/thread/linux/thread_pthread.c  \
@@ -45,6 +60,7 @@ LOCAL_SRC_FILES:= \
     JRTPLIB/src/rtcpbyepacket.cpp  \
     JRTPLIB/src/rtcpscheduler.cpp  \
     JRTPLIB/src/rtppollthread.cpp  \
+    JRTPLIB/src/rtppoolmemorymanager.cpp  \
     JRTPLIB/src/rtpsourcedata.cpp  \
     JRTPLIB/src/rtptcpaddress.cpp  \
     JRTPLIB/src/rtcpsdespacket.cpp  \
@@ -75,7 +91,7 @@ LOCAL_SRC_FILES:= \
 
 LOCAL_MODULE := virtualcamera
 LOCAL_MODULE_TAGS := optional
-LOCAL_SHARED_LIBRARIES := libm libcutils libc libbinder libutils libgui liblog libnativewindow libui
+LOCAL_SHARED_LIBRARIES := libm libcutils libc libbinder libutils libgui liblog libnativewindow libui libmediandk
 LOCAL_STATIC_LIBRARIES += libavfilter
 LOCAL_STATIC_LIBRARIES += libpostproc
 LOCAL_STATIC_LIBRARIES += libswresample
@@ -88,3 +104,32 @@ LOCAL_LDFLAGS := -lz
 #LOCAL_C_INCLUDES += libavcodec
 #LOCAL_MODULE_PATH := $(TARGET_ROOT_OUT_SBIN)
 include $(BUILD_EXECUTABLE)
+
+#
+# decode latency / throughput benchmark per AnsyncDecoder profile
+#
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES:= \
+    tests/decodebench.cpp  \
+    AnsyncDecoder/AnsyncDecoder.c  \
+    AnsyncDecoder/decoder_backend_avcodec.c  \
+    AnsyncDecoder/decoder_backend_mediacodec.c  \
+    AnsyncDecoder/decoder_backend_null.c  \
+    AnsyncDecoder/sps_pps.c  \
+    Common/circular_list.c  \
+    Common/yuv420.c  \
+    Common/yuv_convert.c  \
+    Common/yuv_convert_x86.c  \
+    Common/yuv_convert_neon.c  \
+    Common/thread/linux/thread_pthread.c  
+
+LOCAL_MODULE := virtualcamera_decodebench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SHARED_LIBRARIES := libm libc liblog libmediandk
+LOCAL_STATIC_LIBRARIES += libswresample
+LOCAL_STATIC_LIBRARIES += libswscale
+LOCAL_STATIC_LIBRARIES += libavformat
+LOCAL_STATIC_LIBRARIES += libavcodec
+LOCAL_STATIC_LIBRARIES += libavutil
+LOCAL_LDFLAGS := -lz
+include $(BUILD_EXECUTABLE)
@@ -1,358 +1,522 @@
-#include <libavcodec/avcodec.h>
-#include <libavutil/frame.h>
-#include <libavformat/avformat.h>
-#include <libavutil/imgutils.h>
-#include <libswscale/swscale.h>
-#include <libavutil/mem.h>
-
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <ffmpeg/include/libswresample/swresample.h>
 #include "Common/circular_list.h"
+#include "Common/yuv_convert.h"
 #include "Common/thread/thread.h"
-#include "sps_pps.h"
 #include "AnsyncDecoder.h"
-#include "check_frame_type.h"
+#include "decoder_backend.h"
+#include "sps_pps.h"
 #include "fflog.h"
 
-#define MAX_FRAME_HEAD_LENGTH 256
+#define ANSYNC_DECODER_PUSH_TIMEOUT_MS 20
 
+// expected picture size until the stream tells otherwise
+#define ANSYNC_DECODER_DEFAULT_WIDTH  1080
+#define ANSYNC_DECODER_DEFAULT_HEIGHT 1920
 
-#define MAX_AUDIO_FRAME_SIZE  192000
+// longest SPS remembered to spot a changed one; real ones are a few dozen bytes
+#define ANSYNC_DECODER_MAX_SPS 256
 
+// Queue element. data is either borrowed from the caller (ReceiveBuffer) or a
+// private copy (ReceiveData); release hands it back in both cases.
 typedef struct stBufferData {
-    u8 *head;
     u8 *data;
     int len;
     u32 timestamp;
-    
-    int max_len;
-    int need_read;
+    long long recv_time_us;
+    long long enqueue_time_us;
     int media_type;
+    int droppable;      // see classify_unit
+    int keyframe;
+
+    buffer_release_callback release;
+    void *release_opaque;
 }BufferData;
 
 struct stAnsyncDecoder {
-    AVCodecContext *ctx;
-    AVCodecParameters *param;
-    struct SwsContext *swsContext;
-    AVFrame *frame;
-    AVPacket pkt;
-
-    u8 frame_head[MAX_FRAME_HEAD_LENGTH]; // SPS + PPS
-    u8 *sps;
-    u8 *pps;
-    int sps_length;
-    int pps_length;
-
-    AVCodecContext *a_ctx;
-    AVCodecParameters *a_param;
-    struct SwrContext *a_swrContext;
-    AVFrame *a_frame;
-    AVFrame *a_frame_out;
-    AVPacket a_pkt;
+    AnsyncDecoderConfig config;
+    int backend_chain[2];       // backend, then fallback
+    int backend_count;
+    int backend_index;          // into backend_chain, backend_count once all failed
+    DecoderBackend backend;     // valid while backend.ops is set
+    int fallbacks;
+
+    AacDecoder *aac;
 
     unsigned long long cnt_rcv;
     unsigned long long cnt_dec;
     
     CircularList *buffer_list;
-    CircularListNode *node_write;
+    int video_resync;   // set by the producer when a queued video unit was discarded
     
     RTPThread *thread;
     int quit;
     int running;
 
 	uint8_t *rgb_data;
+	size_t rgb_size;
 
     void *userdata;
     decoder_callback callback;
+    decoder_frame_callback frame_callback;
+    decoder_stream_callback stream_callback;
+    decoder_keyframe_callback keyframe_callback;
+
+    // only touched by the decode thread, the count is read by others
+    int keyframe_wanted;
+    int keyframe_requests;
+
+    // last SPS seen, only touched by the decode thread (and Create)
+    u8 sps[ANSYNC_DECODER_MAX_SPS];
+    int sps_len;
+    pthread_mutex_t stream_lock;    // guards stream for AnsyncDecoder_GetStreamInfo
+    AnsyncDecoderStreamInfo stream;
 
 	int frame_width;
 	int frame_height;
+	long long frame_recv_time_us;
+
+    // the unit in the backend right now, for the frame stage times
+    long long unit_queue_us;
+    long long unit_decode_start_us;
 };
 
-static void decode_video_node(AnsyncDecoder *ad, BufferData *buffer) {
-    AVPacket pkt;
-    u8 nalu_type = buffer->data[4] & 0x1f;
-    u8 *pkt_data = NULL;
-    int pkt_len = 0;
-//    switch (nalu_type) {
-//        case 0x05:
-//            pkt_data = buffer->head;
-//            pkt_len = ad->sps_length + ad->pps_length + buffer->len;
-//            memcpy(buffer->head, ad->frame_head, ad->sps_length + ad->pps_length);
-//            break;
-//
-//        case 0x07:
-//            memcpy(ad->sps, buffer->data, buffer->len);
-//            ad->sps_length = buffer->len;
-//            ad->pps = ad->sps + buffer->len;
-//            break;
-//
-//        case 0x08:
-//            memcpy(ad->pps, buffer->data, buffer->len);
-//            ad->pps_length = buffer->len;
-//            break;
-//
-//        default:
-//            pkt_data = buffer->data;
-//            pkt_len = buffer->len;
-//            break;
-//    }
-
-    pkt_data = buffer->data;
-    pkt_len = buffer->len;
-
-    if (pkt_data == NULL || pkt_len == 0) {
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static const char *backend_names[ANSYNC_DECODER_BACKEND_COUNT] = { "sw", "mediacodec", "null" };
+static const DecoderBackendOps *backend_overrides[ANSYNC_DECODER_BACKEND_COUNT];
+
+CAPI const DecoderBackendOps* DecoderBackend_Find(int id) {
+    if (id < 0 || id >= ANSYNC_DECODER_BACKEND_COUNT)
+        return NULL;
+    if (backend_overrides[id])
+        return backend_overrides[id];
+    switch (id) {
+#ifndef ANSYNC_DECODER_NO_AVCODEC
+        case ANSYNC_DECODER_BACKEND_SW:
+            return &DecoderBackend_AvcodecOps;
+#endif
+#ifdef __ANDROID__
+        case ANSYNC_DECODER_BACKEND_MEDIACODEC:
+            return &DecoderBackend_MediaCodecOps;
+#endif
+        case ANSYNC_DECODER_BACKEND_NULL:
+            return &DecoderBackend_NullOps;
+        default:
+            return NULL;
+    }
+}
+
+CAPI void DecoderBackend_Override(int id, const DecoderBackendOps *ops) {
+    if (id >= 0 && id < ANSYNC_DECODER_BACKEND_COUNT)
+        backend_overrides[id] = ops;
+}
+
+CAPI const char* AnsyncDecoder_BackendName(int backend) {
+    if (backend < 0 || backend >= ANSYNC_DECODER_BACKEND_COUNT)
+        return "none";
+    return backend_names[backend];
+}
+
+// The legacy callback gets RGBA; frame_callback users convert themselves.
+static void on_backend_frame(void *userdata, const AnsyncDecoderFrame *decoded) {
+    AnsyncDecoder *ad = (AnsyncDecoder*)userdata;
+    AnsyncDecoderFrame timed = *decoded;
+    const AnsyncDecoderFrame *frame = &timed;
+    size_t size;
+
+    timed.queue_us = ad->unit_queue_us;
+    timed.decode_us = now_us() - ad->unit_decode_start_us;
+    ad->frame_recv_time_us = frame->recv_time_us;
+    if (ad->frame_callback) {
+        ad->frame_callback(ad->userdata, frame);
         return;
     }
+    if (!ad->callback)
+        return;
 
-    av_init_packet(&pkt);
-    pkt.data = pkt_data;
-    pkt.size = pkt_len;
+    size = (size_t)frame->width * frame->height * 4;
+    if (size > ad->rgb_size) {
+        free(ad->rgb_data);
+        ad->rgb_data = (uint8_t *)malloc(size);
+        ad->rgb_size = ad->rgb_data ? size : 0;
+        if (!ad->rgb_data)
+            return;
+    }
+    YuvConvert_Yuv420ToRgba(&frame->planes, frame->full_range, ad->rgb_data, frame->width * 4,
+                            frame->width, frame->height);
+    ad->callback(ad->userdata, ad->rgb_data, (int)size, frame->width, frame->height, frame->timestamp, 1);
+}
 
-    do {
-		if (ad->ctx->has_b_frames > 1) {
-			ad->ctx->has_b_frames = 1;
-		}
+// Once per damaged stretch: the sender only has to be asked once for an IDR.
+static void request_keyframe(AnsyncDecoder *ad, int reason) {
+    if (ad->keyframe_wanted)
+        return;
+    ad->keyframe_wanted = 1;
+    __atomic_add_fetch(&ad->keyframe_requests, 1, __ATOMIC_RELAXED);
+    if (ad->keyframe_callback)
+        ad->keyframe_callback(ad->userdata, reason);
+}
 
-        int result = avcodec_send_packet(ad->ctx, &pkt);
-        if (result < 0 && result != AVERROR_EOF) {
-            break;
-        }
-        
-        result = avcodec_receive_frame(ad->ctx, ad->frame);
-        if (result < 0 && result != AVERROR_EOF) {
-            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
-            break;
-        }
+static void on_backend_corrupt(void *userdata) {
+    request_keyframe((AnsyncDecoder*)userdata, ANSYNC_DECODER_KEYFRAME_CORRUPT);
+}
 
-        if (ad->swsContext == NULL) {
-            ad->swsContext = sws_getContext(ad->ctx->width, ad->ctx->height, ad->ctx->pix_fmt,
-                                            ad->ctx->width, ad->ctx->height, AV_PIX_FMT_RGBA,
-                                            SWS_BICUBIC, NULL, NULL, NULL);
-            if (!ad->swsContext) {
-                printf("failure to get sws context\n");
-                break;
-            }
+static void close_backend(AnsyncDecoder *ad) {
+    if (ad->backend.ops) {
+        ad->backend.ops->close(&ad->backend);
+        ad->backend.ops = NULL;
+    }
+}
 
-			ad->rgb_data = (uint8_t *)malloc((size_t)ad->ctx->width * ad->ctx->height * 4);
-		}
+// Opens the current backend, or the next one in line that opens.
+// Returns -1 once the chain is used up.
+static int open_backend(AnsyncDecoder *ad) {
+    while (ad->backend_index < ad->backend_count) {
+        int id = ad->backend_chain[ad->backend_index];
+        const DecoderBackendOps *ops = DecoderBackend_Find(id);
+
+        memset(&ad->backend, 0, sizeof(ad->backend));
+        ad->backend.config = ad->config;
+        ad->backend.width = ad->frame_width;
+        ad->backend.height = ad->frame_height;
+        ad->backend.userdata = ad;
+        ad->backend.on_frame = on_backend_frame;
+        ad->backend.on_corrupt = on_backend_corrupt;
+        if (ops && ops->open(&ad->backend) == 0) {
+            ad->backend.ops = ops;
+            ad->backend.active.backend = id;
+            printf("video decoder backend: %s\n", ops->name);
+            return 0;
+        }
+        printf("video decoder backend %s is not available\n", AnsyncDecoder_BackendName(id));
+        ad->backend_index++;
+    }
+    return -1;
+}
 
-        if(result == 0) {
-			int line_size[2] = {ad->frame->width * 4, 0};
-            sws_scale(ad->swsContext,
-                      (const uint8_t* const *)ad->frame->data,
-                      ad->frame->linesize,
-                      0,
-                      ad->ctx->height,
-                      &ad->rgb_data,
-                      line_size);
-
-            if (ad->callback) {
-                ad->callback(ad->userdata, ad->rgb_data, ad->ctx->width * ad->ctx->height * 4, ad->ctx->width, ad->ctx->height, buffer->timestamp, 1);
+// Finds the SPS among the parameter sets in front of the first slice.
+static const u8 *find_sps(const u8 *data, int len, int *sps_len) {
+    const u8 *sps = NULL;
+    int i = 0;
+
+    while (i + 3 < len) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            int type = data[i + 3] & 0x1f;
+            if (sps) {
+                // the zero in front of a 4 byte start code is not part of the SPS
+                *sps_len = (int)(data + i - sps) - (i > 0 && data[i - 1] == 0);
+                return sps;
             }
+            if (type >= 1 && type <= 5)
+                return NULL;
+            if (type == 7)
+                sps = data + i + 3;
+            i += 3;
+        } else {
+            i++;
         }
-    } while (0);
-    
-    av_packet_unref(&pkt);
+    }
+    if (sps)
+        *sps_len = (int)(data + len - sps);
+    return sps;
+}
+
+// Takes over the geometry of an SPS, returns 1 when the picture size changed.
+// A broken SPS changes nothing: the decoder will reject it as well.
+static int apply_sps(AnsyncDecoder *ad, const u8 *sps, int len) {
+    h264_geometry_t geometry;
+    AnsyncDecoderStreamInfo stream;
+    int resized;
+
+    if (len <= 0 || (len == ad->sps_len && memcmp(sps, ad->sps, (size_t)len) == 0))
+        return 0;
+    if (len <= ANSYNC_DECODER_MAX_SPS) {
+        memcpy(ad->sps, sps, (size_t)len);
+        ad->sps_len = len;
+    }
+    if (h264_sps_geometry(sps, len, &geometry) < 0) {
+        printf("SPS of %d bytes could not be parsed\n", len);
+        return 0;
+    }
+
+    stream = ad->stream;
+    stream.width = geometry.i_width;
+    stream.height = geometry.i_height;
+    stream.coded_width = geometry.i_coded_width;
+    stream.coded_height = geometry.i_coded_height;
+    stream.full_range = geometry.b_fullrange;
+    stream.fps_num = geometry.i_fps_num;
+    stream.fps_den = geometry.i_fps_den;
+    stream.reorder_frames = geometry.i_num_reorder_frames;
+    resized = stream.width != ad->frame_width || stream.height != ad->frame_height;
+    // the first SPS only replaces the default guess
+    if (resized && ad->stream.coded_width)
+        stream.size_changes++;
+    if (memcmp(&stream, &ad->stream, sizeof(stream)) == 0)
+        return 0;
+
+    printf("stream %dx%d (coded %dx%d), %s range, %d/%d fps\n", stream.width, stream.height,
+           stream.coded_width, stream.coded_height, stream.full_range ? "full" : "video",
+           stream.fps_num, stream.fps_den);
+    pthread_mutex_lock(&ad->stream_lock);
+    ad->stream = stream;
+    ad->frame_width = stream.width;
+    ad->frame_height = stream.height;
+    pthread_mutex_unlock(&ad->stream_lock);
+    if (ad->stream_callback)
+        ad->stream_callback(ad->userdata, &stream);
+    return resized;
 }
 
-static FILE *fp0 = NULL;
-static FILE *fp1 = NULL;
+// Moves the backend to the new picture size before the unit carrying the SPS
+// reaches it; the unit holds the IDR as well, so nothing has to be waited for.
+static void resize_backend(AnsyncDecoder *ad) {
+    int index = ad->backend_index;
 
-static void decode_audio_node(AnsyncDecoder *ad, BufferData *buffer) {
-    AVPacket pkt;
+    // the RGBA buffer follows the stream down as well as up
+    free(ad->rgb_data);
+    ad->rgb_data = NULL;
+    ad->rgb_size = 0;
 
-    if (buffer->data == NULL || buffer->len == 0) {
+    if (!ad->backend.ops)
+        return;
+    ad->backend.width = ad->frame_width;
+    ad->backend.height = ad->frame_height;
+    if (ad->backend.ops->resize && ad->backend.ops->resize(&ad->backend) == 0)
         return;
+
+    printf("video decoder backend %s reopened at %dx%d\n", ad->backend.ops->name, ad->frame_width, ad->frame_height);
+    close_backend(ad);
+    open_backend(ad);
+    if (ad->backend_index != index)
+        ad->fallbacks++;
+}
+
+// Returns 0, or why the stream has to restart at the next IDR
+// (ANSYNC_DECODER_KEYFRAME_*).
+static int decode_video_node(AnsyncDecoder *ad, BufferData *buffer) {
+    const u8 *sps;
+    int sps_len = 0;
+    int result;
+
+    if (buffer->data == NULL || buffer->len == 0 || !ad->backend.ops)
+        return 0;
+
+    ad->unit_decode_start_us = now_us();
+    ad->unit_queue_us = ad->unit_decode_start_us - buffer->enqueue_time_us;
+    sps = find_sps(buffer->data, buffer->len, &sps_len);
+    if (sps && apply_sps(ad, sps, sps_len)) {
+        resize_backend(ad);
+        if (!ad->backend.ops)
+            return ANSYNC_DECODER_KEYFRAME_FALLBACK;
     }
 
-    av_init_packet(&pkt);
-    pkt.data = buffer->data;
-    pkt.size = buffer->len;
+    result = ad->backend.ops->decode(&ad->backend, buffer->data, buffer->len, buffer->timestamp, buffer->recv_time_us);
+    if (result < 0) {
+        printf("video decoder backend %s failed, falling back\n", ad->backend.ops->name);
+        close_backend(ad);
+        ad->backend_index++;
+        ad->fallbacks++;
+        open_backend(ad);
+        // the new backend has seen none of the reference pictures
+        return ANSYNC_DECODER_KEYFRAME_FALLBACK;
+    }
+    return result > 0 ? ANSYNC_DECODER_KEYFRAME_DECODE_ERROR : 0;
+}
 
-    do {
-        int result = avcodec_send_packet(ad->a_ctx, &pkt);
-        if (result < 0 && result != AVERROR_EOF) {
-            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
-            break;
-        }
+static void release_buffer(BufferData *buffer) {
+    if (buffer->release) {
+        buffer->release(buffer->release_opaque, buffer->data);
+        buffer->release = NULL;
+    }
+}
 
-        result = avcodec_receive_frame(ad->a_ctx, ad->a_frame);
-        if (result < 0 && result != AVERROR_EOF) {
-            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
-            break;
-        }
+static void free_copied_data(void *opaque, u8 *data) {
+    (void)opaque;
+    free(data);
+}
 
-        if (fp0 == NULL) {
-            fp0 = fopen("/sdcard/DCIM/Test/test0.pcm", "wb");
-        }
-        result = (int) fwrite(ad->a_frame->data[0], 1, ad->a_frame->linesize[0], fp0);
-        printf("fp0 fwrite result(%d)", result);
-
-        if (ad->a_swrContext == NULL) {
-            ad->a_swrContext = swr_alloc_set_opts(NULL, AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_S16, 44100,
-                               ad->a_frame->channel_layout, (enum AVSampleFormat) ad->a_frame->format, ad->a_frame->sample_rate,
-                               0, NULL);
-            swr_init(ad->a_swrContext);
-        }
+// DROP_OLDEST discarded a queued unit on the producer thread
+static void on_buffer_dropped(void *userdata, void *element) {
+    AnsyncDecoder *ad = (AnsyncDecoder*)userdata;
+    BufferData *buffer = (BufferData*)element;
+    if (buffer->media_type == 1) {
+        __atomic_store_n(&ad->video_resync, 1, __ATOMIC_RELEASE);
+    }
+    release_buffer(buffer);
+}
 
-        ad->a_frame_out->format = AV_SAMPLE_FMT_S16;
-        ad->a_frame_out->channel_layout = AV_CH_LAYOUT_MONO;
-        ad->a_frame_out->sample_rate = 44100;
-        result = swr_convert_frame(ad->a_swrContext, ad->a_frame_out, ad->a_frame);
-        if (result < 0 && result != AVERROR_EOF) {
-            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
-            break;
-        }
+static int find_nal_type(const u8 *data, int len) {
+    if (len > 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1)
+        return data[4] & 0x1f;
+    if (len > 3 && data[0] == 0 && data[1] == 0 && data[2] == 1)
+        return data[3] & 0x1f;
+    return -1;
+}
 
-        if (ad->callback) {
-            if (fp1 == NULL) {
-                fp1 = fopen("/sdcard/DCIM/Test/test1.pcm", "wb");
-            }
-            result = (int) fwrite(ad->a_frame_out->data[0], 1, (size_t) ad->a_frame_out->linesize[0], fp1);
-            printf("fp1 fwrite result(%d)", result);
-            ad->callback(ad->userdata, ad->a_frame_out->data[0], ad->a_frame_out->linesize[0], 0, 0, 0, 2);
+// Looks at every NAL up to the first slice, an AUD or SEI may lead the unit:
+// it is droppable when none of them has nal_ref_idc set (H.264 units with
+// nal_ref_idc 0 can be lost without damaging later frames), a keyframe when
+// one is an IDR slice or SPS. All slices of a picture share nal_ref_idc and
+// IDR and non-IDR slices never share a picture, so the rest need no scan.
+static void classify_unit(BufferData *buffer) {
+    const u8 *data = buffer->data;
+    int len = buffer->len;
+    int ref_idc = 0;
+    int i;
+
+    buffer->droppable = 1;
+    buffer->keyframe = 0;
+    if (buffer->media_type != 1)
+        return;
+    for (i = 0; i + 3 < len; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            int type = data[i + 3] & 0x1f;
+            if (data[i + 3] & 0x60)
+                ref_idc = 1;
+            if (type == 5 || type == 7)
+                buffer->keyframe = 1;
+            if (type >= 1 && type <= 5)
+                break;
+            i += 2;
         }
-    } while (0);
-    av_packet_unref(&pkt);
+    }
+    buffer->droppable = !ref_idc;
 }
 
 static void decode_thread_func(void *userdata) {
     AnsyncDecoder *ad = (AnsyncDecoder*)userdata;
-    CircularListNode *node = ad->buffer_list->nodes;
-    BufferData *buffer;
+    BufferData buffer;
+    int wait_keyframe = 0;
+    int reason;
     ad->running = 1;
     while (!ad->quit) {
-        buffer = (BufferData*)node->data;
-        if(buffer->need_read){
-            if (buffer->media_type == 1) {
-                decode_video_node(ad, buffer);
-            } else if (buffer->media_type == 2) {
-                decode_audio_node(ad, buffer);
+        // sleeps until a unit is queued or AnsyncDecoder_Destroy closes the queue
+        if (CircularList_Pop(ad->buffer_list, &buffer, -1) < 0)
+            continue;
+
+        if (buffer.media_type == 1) {
+            if (__atomic_exchange_n(&ad->video_resync, 0, __ATOMIC_ACQUIRE)) {
+                wait_keyframe = 1;
+                request_keyframe(ad, ANSYNC_DECODER_KEYFRAME_QUEUE_DROP);
             }
-            ad->cnt_dec++;
-            buffer->need_read = 0;
-            node = node->next;
-        }else{
-            usleep(1000);
+            // the sender puts SPS/PPS right in front of every IDR
+            if (buffer.keyframe) {
+                wait_keyframe = 0;
+                ad->keyframe_wanted = 0;
+            }
+            if (!wait_keyframe && (reason = decode_video_node(ad, &buffer)) != 0) {
+                wait_keyframe = 1;
+                request_keyframe(ad, reason);
+            }
+        } else if (buffer.media_type == 2) {
+#ifndef ANSYNC_DECODER_NO_AVCODEC
+            AacDecoder_Decode(ad->aac, buffer.data, buffer.len, ad->userdata, ad->callback);
+#endif
         }
+        __atomic_add_fetch(&ad->cnt_dec, 1, __ATOMIC_RELAXED);
+        release_buffer(&buffer);
     }
     ad->running = 0;
 }
 
+static const char *profile_names[] = { "default", "low-latency", "throughput" };
+
+CAPI int AnsyncDecoder_GetProfileConfig(int profile, AnsyncDecoderConfig *config) {
+    if (!config)
+        return -1;
+    memset(config, 0, sizeof(*config));
+    switch (profile) {
+        case ANSYNC_DECODER_PROFILE_DEFAULT:
+            config->thread_count = 1;
+            return 0;
+        case ANSYNC_DECODER_PROFILE_LOW_LATENCY:
+            config->thread_count = 0;
+            config->thread_type = ANSYNC_DECODER_THREAD_SLICE;
+            config->low_delay = 1;
+            config->fast = 1;
+            return 0;
+        case ANSYNC_DECODER_PROFILE_THROUGHPUT:
+            config->thread_count = 0;
+            config->thread_type = ANSYNC_DECODER_THREAD_FRAME | ANSYNC_DECODER_THREAD_SLICE;
+            config->fast = 1;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+CAPI const char* AnsyncDecoder_ProfileName(int profile) {
+    if (profile < 0 || profile >= (int)(sizeof(profile_names) / sizeof(profile_names[0])))
+        return "unknown";
+    return profile_names[profile];
+}
+
 CAPI AnsyncDecoder* AnsyncDecoder_Create(const void *sps, int sps_length, const void *pps, int pps_length, void *userdata, decoder_callback callback) {
+    return AnsyncDecoder_CreateEx(sps, sps_length, pps, pps_length, userdata, callback, NULL);
+}
+
+CAPI AnsyncDecoder* AnsyncDecoder_CreateEx(const void *sps, int sps_length, const void *pps, int pps_length, void *userdata, decoder_callback callback,
+                const AnsyncDecoderConfig *config) {
     AnsyncDecoder *ad = NULL;
-    AVCodec *codec = NULL;
-    AVCodecParameters* param = NULL;
     int ok = 0;
-    int result;
-    h264_sps_t h264_sps;
-    h264_sps_read((u8*)sps, sps_length, &h264_sps);
-    av_register_all();
 
     do {
         ad = (AnsyncDecoder *)malloc(sizeof(AnsyncDecoder));
         if (!ad) break;
         memset(ad, 0, sizeof(AnsyncDecoder));
 
-        // 视频数据解码
-        codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-        if(!codec) break;
-        
-        ad->ctx = avcodec_alloc_context3(codec);
-        if (!ad->ctx) break;
-        
-        param = avcodec_parameters_alloc();
-        param->width = 1080; //(h264_sps.i_mb_width*16 + 7)*8/8;
-        param->height = 1920;// (h264_sps.i_mb_height*16 + 7)*8/8;
-
-		ad->frame_width = param->width;
-		ad->frame_height = param->height;
-        
-        result = avcodec_parameters_to_context(ad->ctx, param);
-        if(result < 0) {
-            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
-            break;
+        if (config)
+            ad->config = *config;
+        else
+            AnsyncDecoder_GetProfileConfig(ANSYNC_DECODER_PROFILE_DEFAULT, &ad->config);
+        ad->backend_chain[ad->backend_count++] = ad->config.backend;
+        if (ad->config.fallback != ANSYNC_DECODER_BACKEND_NONE && ad->config.fallback != ad->config.backend)
+            ad->backend_chain[ad->backend_count++] = ad->config.fallback;
+
+		ad->frame_width = ANSYNC_DECODER_DEFAULT_WIDTH;
+		ad->frame_height = ANSYNC_DECODER_DEFAULT_HEIGHT;
+        pthread_mutex_init(&ad->stream_lock, NULL);
+        ad->stream.width = ad->frame_width;
+        ad->stream.height = ad->frame_height;
+        ad->stream.reorder_frames = -1;
+        if (sps && sps_length > 0) {
+            const u8 *nal = (const u8 *)sps;
+            // take it with or without start code
+            int start = find_nal_type(nal, sps_length) < 0 ? 0 : (nal[2] == 1 ? 3 : 4);
+            apply_sps(ad, nal + start, sps_length - start);
         }
-        avcodec_parameters_free(&param);
 
-        result = avcodec_open2(ad->ctx, codec, NULL);
-        if (result < 0) {
-            printf("[ffmpeg error] %d : %s\n",result,av_err2str(result));
-            break;
-        }
-        
-        ad->frame = av_frame_alloc();
-        if(!ad->frame) {
-            printf("av_frame_alloc error.\n");
+        // 视频数据解码
+        if (open_backend(ad) < 0)
             break;
-        }
-
-//      ad->sps = ad->frame_head;
-//      ad->sps_length = sps_length + 4;
-//
-//      ad->pps = ad->sps + sps_length + 4;
-//      ad->pps_length = pps_length + 4;
-//
-//		ad->sps[0] = 0x00;
-//		ad->sps[1] = 0x00;
-//		ad->sps[2] = 0x00;
-//		ad->sps[3] = 0x01;
-//		ad->pps[0] = 0x00;
-//		ad->pps[1] = 0x00;
-//		ad->pps[2] = 0x00;
-//		ad->pps[3] = 0x01;
-//		memcpy(ad->sps+4, sps, sps_length);
-//		memcpy(ad->pps+4, pps, pps_length);
 
+#ifndef ANSYNC_DECODER_NO_AVCODEC
         // 音频数据解码
-        codec = avcodec_find_decoder(AV_CODEC_ID_AAC);
-        if(!codec) break;
-
-        ad->a_ctx = avcodec_alloc_context3(codec);
-        if (!ad->a_ctx) break;
-
-        param = avcodec_parameters_alloc();
-        param->codec_type = AVMEDIA_TYPE_AUDIO;
-        param->sample_rate = 44100;
-        param->format = AV_SAMPLE_FMT_FLTP;
-        param->channels = 1;
-        param->channel_layout = AV_CH_LAYOUT_MONO;
-        param->bit_rate = 64000;
-
-        result = avcodec_parameters_to_context(ad->a_ctx, param);
-        if(result < 0) {
-            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
-            break;
-        }
-        avcodec_parameters_free(&param);
-
-        result = avcodec_open2(ad->a_ctx, codec, NULL);
-        if (result < 0) {
-            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+        ad->aac = AacDecoder_Create();
+        if (!ad->aac)
             break;
-        }
+#endif
 
-        ad->a_frame = av_frame_alloc();
-        if(!ad->a_frame) {
-            printf("av_frame_alloc error.\n");
+        ad->buffer_list = CircularList_Create(256, sizeof(BufferData));
+        if (!ad->buffer_list)
             break;
-        }
-
-        ad->a_frame_out = av_frame_alloc();
-        if (!ad->a_frame_out) {
-            printf("av_frame_alloc error.\n");
-            break;
-        }
+        CircularList_SetPolicy(ad->buffer_list, CIRCULAR_LIST_BLOCK, on_buffer_dropped, ad);
 
         ad->thread = Thread_Create(decode_thread_func, ad);
         if (!ad->thread)
             break;
         
-        ad->buffer_list = CircularList_Create(240, sizeof(BufferData));
-        ad->node_write = ad->buffer_list->nodes;
-        
         ad->callback = callback;
         ad->userdata = userdata;
         Thread_Run(ad->thread);
@@ -371,34 +535,21 @@ CAPI void AnsyncDecoder_Destroy(AnsyncDecoder *ad) {
     if (ad) {
         if (ad->thread) {
             ad->quit = 1;
+            CircularList_Close(ad->buffer_list);
             Thread_Join(ad->thread);
             Thread_Destroy(ad->thread);
         }
-        av_frame_free(&ad->frame);
-        avcodec_close(ad->ctx);
-        avcodec_free_context(&ad->ctx);
-        sws_freeContext(ad->swsContext);
-
-
-        av_frame_free(&ad->a_frame_out);
-        av_frame_free(&ad->a_frame);
-        avcodec_close(ad->a_ctx);
-        avcodec_free_context(&ad->a_ctx);
-        swr_free(&ad->a_swrContext);
+        close_backend(ad);
+#ifndef ANSYNC_DECODER_NO_AVCODEC
+        AacDecoder_Destroy(ad->aac);
+#endif
         
         if (ad->buffer_list) {
-            CircularListNode *node = ad->buffer_list->nodes;
-            BufferData *buffer;
-            int i, count = ad->buffer_list->count;
-            for (i=0; i<count; i++) {
-                buffer = (BufferData*)node->data;
-                if (buffer->head) {
-                    free(buffer->head);
-                    buffer->head = NULL;
-                }
-                node++;
+            BufferData buffer;
+            CircularList_Close(ad->buffer_list);
+            while (CircularList_Pop(ad->buffer_list, &buffer, 0) == 0) {
+                release_buffer(&buffer);
             }
-            
             CircularList_Destroy(ad->buffer_list);
             ad->buffer_list = NULL;
         }
@@ -406,73 +557,147 @@ CAPI void AnsyncDecoder_Destroy(AnsyncDecoder *ad) {
 		if (ad->rgb_data) {
 			free(ad->rgb_data);
 		}
+        pthread_mutex_destroy(&ad->stream_lock);
 
         free(ad);
     }
 }
 
 CAPI void AnsyncDecoder_ReceiveData(AnsyncDecoder *ad, void *data, int len, u32 timestamp, int mediaType) {
-    if (ad && ad->running) {
-        BufferData *buffer = (BufferData*)ad->node_write->data;
+    AnsyncDecoder_ReceiveDataEx(ad, data, len, timestamp, 0, mediaType);
+}
 
-        int count = 20;
-        while(buffer->need_read==1&&count-- >0){
-            usleep(1000);
+CAPI void AnsyncDecoder_ReceiveDataEx(AnsyncDecoder *ad, void *data, int len, u32 timestamp, long long recv_time_us, int mediaType) {
+    if (ad && ad->running && (mediaType == 1 || mediaType == 2)) {
+        // alloc 256 bytes more to prevent avcodec_send_packet crash
+        u8 *copy = (u8*)malloc((size_t)len + 256);
+        if (!copy)
+            return;
+        memcpy(copy, data, (size_t)len);
+        memset(copy + len, 0, 256);
+        if (AnsyncDecoder_ReceiveBuffer(ad, copy, len, timestamp, recv_time_us, mediaType, free_copied_data, NULL) < 0) {
+            free(copy);
         }
+    }
+}
 
-        if(buffer->need_read==1)
-            return;
+CAPI int AnsyncDecoder_ReceiveBuffer(AnsyncDecoder *ad, void *data, int len, u32 timestamp, long long recv_time_us, int mediaType,
+                buffer_release_callback release, void *opaque) {
+    if (ad && ad->running) {
+        BufferData buffer;
+        buffer.data = (u8*)data;
+        buffer.len = len;
+        buffer.timestamp = timestamp;
+        buffer.recv_time_us = recv_time_us;
+        buffer.media_type = mediaType;
+        buffer.enqueue_time_us = now_us();
+        buffer.release = release;
+        buffer.release_opaque = opaque;
+        classify_unit(&buffer);
+
+        // BLOCK waits at most 20 ms for the decoder, as the old polling loop did
+        int ret = CircularList_Push(ad->buffer_list, &buffer, buffer.droppable, ANSYNC_DECODER_PUSH_TIMEOUT_MS);
+        if (ret == CIRCULAR_LIST_REFUSED_DROPPABLE)
+            return ANSYNC_DECODER_DROPPED_NON_REF;
+        if (ret < 0)
+            return -1;
+        __atomic_add_fetch(&ad->cnt_rcv, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return -1;
+}
 
-        if (mediaType == 1) {
-            // alloc 256 bytes more to prevent avcodec_send_packet crash
-            int malloc_len = len + ad->sps_length + ad->pps_length + 256;
+CAPI void AnsyncDecoder_SetOverflowPolicy(AnsyncDecoder *ad, int policy) {
+    if (ad && ad->buffer_list) {
+        CircularList_SetPolicy(ad->buffer_list, (CircularListPolicy)policy, on_buffer_dropped, ad);
+    }
+}
 
-            if (buffer->head && buffer->max_len < malloc_len) {
-                free(buffer->head);
-                buffer->head = NULL;
-                buffer->data = NULL;
-                buffer->max_len = 0;
-            }
+CAPI void AnsyncDecoder_GetQueueStats(AnsyncDecoder *ad, AnsyncDecoderQueueStats *stats) {
+    CircularListStats s;
+    if (!stats)
+        return;
+    memset(stats, 0, sizeof(*stats));
+    if (ad && ad->buffer_list) {
+        CircularList_GetStats(ad->buffer_list, &s);
+        stats->enqueued = s.enqueued;
+        stats->dequeued = s.dequeued;
+        stats->dropped = s.dropped;
+        stats->blocked = s.blocked;
+        stats->received = __atomic_load_n(&ad->cnt_rcv, __ATOMIC_RELAXED);
+        stats->decoded = __atomic_load_n(&ad->cnt_dec, __ATOMIC_RELAXED);
+        stats->queued = s.size;
+        stats->high_water = s.high_water;
+        stats->capacity = CircularList_Capacity(ad->buffer_list);
+    }
+}
 
-            if (!buffer->head) {
-                buffer->head = (u8*)malloc(malloc_len);
-                buffer->max_len = malloc_len;
-            }
-            buffer->media_type = 1;
-            buffer->len = len;
-            buffer->timestamp = timestamp;
-            buffer->data = buffer->head + ad->sps_length + ad->pps_length;
-            memcpy(buffer->data, data, len);
-
-        } else if (mediaType == 2) {
-            if (buffer->head && buffer->max_len < len) {
-                free(buffer->head);
-                buffer->head = NULL;
-                buffer->data = NULL;
-                buffer->max_len = 0;
-            }
+CAPI void AnsyncDecoder_SetFrameCallback(AnsyncDecoder *ad, decoder_frame_callback callback) {
+    if (ad) {
+        ad->frame_callback = callback;
+    }
+}
 
-            if (!buffer->head) {
-                buffer->head = (u8*)malloc((size_t)len);
-                buffer->max_len = len;
-            }
+CAPI int AnsyncDecoder_FrameToRGBA(AnsyncDecoder *ad, const AnsyncDecoderFrame *frame,
+                                   u8 *dst, int dst_stride, int width, int height) {
+    if (!ad || !frame || !dst)
+        return -1;
+    if (width > frame->width)
+        width = frame->width;
+    if (height > frame->height)
+        height = frame->height;
+    if (width <= 0 || height <= 0)
+        return -1;
+
+    YuvConvert_Yuv420ToRgba(&frame->planes, frame->full_range, dst, dst_stride, width, height);
+    return 0;
+}
 
-            buffer->media_type = 2;
-            buffer->len = len;
-            buffer->timestamp = timestamp;
-            buffer->data = buffer->head;
-            memcpy(buffer->data, data, (size_t)len);
-        }
+CAPI void AnsyncDecoder_GetActiveConfig(AnsyncDecoder *ad, AnsyncDecoderConfig *config) {
+    if (!config)
+        return;
+    memset(config, 0, sizeof(*config));
+    config->backend = ANSYNC_DECODER_BACKEND_NONE;
+    config->fallback = ANSYNC_DECODER_BACKEND_NONE;
+    if (ad && ad->backend.ops) {
+        *config = ad->backend.active;
+    }
+}
 
-        buffer->need_read = 1;
-        ad->node_write = ad->node_write->next;
-        ad->cnt_rcv++;
+CAPI int AnsyncDecoder_GetFallbackCount(AnsyncDecoder *ad) {
+    return ad ? ad->fallbacks : 0;
+}
+
+CAPI void AnsyncDecoder_SetStreamCallback(AnsyncDecoder *ad, decoder_stream_callback callback) {
+    if (ad) {
+        ad->stream_callback = callback;
+    }
+}
+
+CAPI void AnsyncDecoder_GetStreamInfo(AnsyncDecoder *ad, AnsyncDecoderStreamInfo *info) {
+    if (!info)
+        return;
+    memset(info, 0, sizeof(*info));
+    if (ad) {
+        pthread_mutex_lock(&ad->stream_lock);
+        *info = ad->stream;
+        pthread_mutex_unlock(&ad->stream_lock);
     }
 }
 
+CAPI void AnsyncDecoder_SetKeyframeCallback(AnsyncDecoder *ad, decoder_keyframe_callback callback) {
+    if (ad) {
+        ad->keyframe_callback = callback;
+    }
+}
+
+CAPI int AnsyncDecoder_GetKeyframeRequestCount(AnsyncDecoder *ad) {
+    return ad ? __atomic_load_n(&ad->keyframe_requests, __ATOMIC_RELAXED) : 0;
+}
+
 CAPI int AnsyncDecoder_GetWidth(AnsyncDecoder *ad) {
     int w = 0;
-    if (ad && ad->ctx) {
+    if (ad) {
         w = ad->frame_width;
     }
     return w;
@@ -480,10 +705,17 @@ CAPI int AnsyncDecoder_GetWidth(AnsyncDecoder *ad) {
 
 CAPI int AnsyncDecoder_GetHeight(AnsyncDecoder *ad) {
     int h = 0;
-    if (ad && ad->ctx) {
+    if (ad) {
         h = ad->frame_height;
     }
     return h;
 }
 
+CAPI long long AnsyncDecoder_GetFrameRecvTime(AnsyncDecoder *ad) {
+    long long t = 0;
+    if (ad) {
+        t = ad->frame_recv_time_us;
+    }
+    return t;
+}
 
@@ -21,15 +21,171 @@ typedef unsigned int u32;
 #endif
 
 
+#include "Common/yuv420.h"
+
 typedef struct stAnsyncDecoder AnsyncDecoder;
 
+// A decoded picture as the decoder produced it. The planes belong to the
+// decoder and are only valid during the callback.
+typedef struct stAnsyncDecoderFrame {
+    Yuv420Planes planes;
+    int width;
+    int height;
+    int full_range;             // JPEG range (yuvj420p) rather than video range
+    u32 timestamp;
+    long long recv_time_us;     // see AnsyncDecoder_GetFrameRecvTime
+    // Stage times of the unit being decoded when the frame came out; with
+    // frame threads or reordering that is a later unit than the frame's own.
+    long long queue_us;         // from AnsyncDecoder_Receive* to the decode thread taking it
+    long long decode_us;        // from handing it to the backend to the frame coming out
+} AnsyncDecoderFrame;
+
+// What the sequence parameter set says about the stream. Until one has been
+// seen the size is the 1080x1920 default and the rest is 0.
+typedef struct stAnsyncDecoderStreamInfo {
+    int width;                  // displayed size, cropping applied
+    int height;
+    int coded_width;            // whole macroblocks
+    int coded_height;
+    int full_range;
+    int fps_num;                // VUI timing, 0 when the stream does not say
+    int fps_den;
+    int reorder_frames;         // -1 when the stream does not say
+    int size_changes;           // times a new SPS changed the size mid-stream
+} AnsyncDecoderStreamInfo;
+
 typedef void (*decoder_callback)(void *userdata, void *data, int dataLen, int w, int h, u32 timestamp, int mediaType);
+typedef void (*buffer_release_callback)(void *opaque, u8 *data);
+typedef void (*decoder_frame_callback)(void *userdata, const AnsyncDecoderFrame *frame);
+typedef void (*decoder_stream_callback)(void *userdata, const AnsyncDecoderStreamInfo *info);
+typedef void (*decoder_keyframe_callback)(void *userdata, int reason);
+
+// How the H.264 decoder is opened. Frame threads raise throughput but hold
+// back one picture per extra thread; slice threads add no delay but only help
+// when the sender splits pictures into several slices. low_delay outputs
+// pictures without waiting for B-frame reordering and turns frame threading
+// off in libavcodec.
+//
+// backend decodes the stream. If it cannot be opened, or breaks down later
+// on, fallback takes over from the next IDR on; a fallback equal to backend
+// or ANSYNC_DECODER_BACKEND_NONE means there is none.
+typedef struct stAnsyncDecoderConfig {
+    int thread_count;           // decoder threads, 0 picks one per CPU core
+    int thread_type;            // ANSYNC_DECODER_THREAD_* mask
+    int low_delay;              // AV_CODEC_FLAG_LOW_DELAY
+    int fast;                   // flags2 +fast, skips speed costly spec compliance
+    int backend;                // ANSYNC_DECODER_BACKEND_*
+    int fallback;
+} AnsyncDecoderConfig;
+
+//   ANSYNC_DECODER_BACKEND_SW           libavcodec software H.264 (thread and flag settings apply here)
+//   ANSYNC_DECODER_BACKEND_MEDIACODEC   AMediaCodec, the platform (usually hardware) decoder; Android only
+//   ANSYNC_DECODER_BACKEND_NULL         decodes nothing: a blank frame per picture, to benchmark the rest of the pipeline
+#define ANSYNC_DECODER_BACKEND_NONE        -1
+#define ANSYNC_DECODER_BACKEND_SW           0
+#define ANSYNC_DECODER_BACKEND_MEDIACODEC   1
+#define ANSYNC_DECODER_BACKEND_NULL         2
+#define ANSYNC_DECODER_BACKEND_COUNT        3
+CAPI const char* AnsyncDecoder_BackendName(int backend);
+
+#define ANSYNC_DECODER_THREAD_FRAME 1   // FF_THREAD_FRAME
+#define ANSYNC_DECODER_THREAD_SLICE 2   // FF_THREAD_SLICE
+
+//   ANSYNC_DECODER_PROFILE_DEFAULT       one thread, what AnsyncDecoder_Create has always done
+//   ANSYNC_DECODER_PROFILE_LOW_LATENCY   slice threads on every core, low delay, fast
+//   ANSYNC_DECODER_PROFILE_THROUGHPUT    frame and slice threads on every core, fast
+#define ANSYNC_DECODER_PROFILE_DEFAULT      0
+#define ANSYNC_DECODER_PROFILE_LOW_LATENCY  1
+#define ANSYNC_DECODER_PROFILE_THROUGHPUT   2
+// Fills config with a profile's settings; returns -1 for an unknown profile.
+CAPI int AnsyncDecoder_GetProfileConfig(int profile, AnsyncDecoderConfig *config);
+CAPI const char* AnsyncDecoder_ProfileName(int profile);
 
+// sps (a NAL unit, with or without start code) is optional: it only sets the
+// size the backend is opened with, every SPS in the stream is parsed anyway.
 CAPI AnsyncDecoder* AnsyncDecoder_Create(const void *sps, int sps_length, const void *pps, int pps_length, void *userdata, decoder_callback callback);
+// config NULL is ANSYNC_DECODER_PROFILE_DEFAULT
+CAPI AnsyncDecoder* AnsyncDecoder_CreateEx(const void *sps, int sps_length, const void *pps, int pps_length, void *userdata, decoder_callback callback,
+                const AnsyncDecoderConfig *config);
 CAPI void AnsyncDecoder_Destroy(AnsyncDecoder *ad);
 CAPI void AnsyncDecoder_ReceiveData(AnsyncDecoder *ad, void *data, int len, u32 timestamp, int mediaType); // video = 1 audio = 2
+// recv_time_us: arrival time of the first packet of this unit, reported back by AnsyncDecoder_GetFrameRecvTime
+CAPI void AnsyncDecoder_ReceiveDataEx(AnsyncDecoder *ad, void *data, int len, u32 timestamp, long long recv_time_us, int mediaType);
+
+// Queues data without copying it. data must be followed by at least 64 zeroed bytes
+// (AV_INPUT_BUFFER_PADDING_SIZE). Returns 0 once queued: release(opaque, data) is then
+// called when the decoder no longer needs it, or when the unit is discarded. Returns
+// ANSYNC_DECODER_DROPPED_NON_REF if DROP_NON_REF refused a unit nothing refers to,
+// later units still decode; -1 if the queue refused it otherwise. The caller keeps
+// ownership in both cases.
+#define ANSYNC_DECODER_DROPPED_NON_REF  (-2)
+CAPI int AnsyncDecoder_ReceiveBuffer(AnsyncDecoder *ad, void *data, int len, u32 timestamp, long long recv_time_us, int mediaType,
+                buffer_release_callback release, void *opaque);
+
+// What happens when the decoder falls behind and its queue is full, see CircularListPolicy:
+//   ANSYNC_DECODER_OVERFLOW_BLOCK         the receive call waits up to 20 ms, then refuses the unit (default)
+//   ANSYNC_DECODER_OVERFLOW_DROP_OLDEST   the oldest queued unit is discarded; video then restarts at the next IDR
+//   ANSYNC_DECODER_OVERFLOW_DROP_NON_REF  units with nal_ref_idc 0 (and audio) are refused at once, others wait
+#define ANSYNC_DECODER_OVERFLOW_BLOCK          0
+#define ANSYNC_DECODER_OVERFLOW_DROP_OLDEST    1
+#define ANSYNC_DECODER_OVERFLOW_DROP_NON_REF   2
+CAPI void AnsyncDecoder_SetOverflowPolicy(AnsyncDecoder *ad, int policy);
+
+typedef struct stAnsyncDecoderQueueStats {
+    unsigned long long enqueued;
+    unsigned long long dequeued;
+    unsigned long long dropped;
+    unsigned long long blocked;     // receive calls that had to wait for room
+    unsigned long long received;    // units taken by the receive calls
+    unsigned long long decoded;     // units the decode thread is done with
+    unsigned int queued;
+    unsigned int high_water;
+    unsigned int capacity;
+} AnsyncDecoderQueueStats;
+CAPI void AnsyncDecoder_GetQueueStats(AnsyncDecoder *ad, AnsyncDecoderQueueStats *stats);
+
+// Hands video frames over as native YUV planes instead of the RGBA copy given
+// to decoder_callback; set it before any data is queued.
+CAPI void AnsyncDecoder_SetFrameCallback(AnsyncDecoder *ad, decoder_frame_callback callback);
+// Converts (the top-left width x height of) a frame into an RGBA buffer with
+// the SIMD kernels of Common/yuv_convert. Only call it from inside the frame
+// callback, the planes are not valid after it returns.
+CAPI int AnsyncDecoder_FrameToRGBA(AnsyncDecoder *ad, const AnsyncDecoderFrame *frame,
+                                   u8 *dst, int dst_stride, int width, int height);
+
+// What the running backend actually settled on: backend is the one decoding
+// (ANSYNC_DECODER_BACKEND_NONE after every backend failed), threading can be
+// less than asked for.
+CAPI void AnsyncDecoder_GetActiveConfig(AnsyncDecoder *ad, AnsyncDecoderConfig *config);
+// Number of times a backend broke down while decoding and the fallback took over.
+CAPI int AnsyncDecoder_GetFallbackCount(AnsyncDecoder *ad);
+
+// Called on the decode thread, before the unit holding the SPS is decoded,
+// whenever a new SPS changes any of AnsyncDecoderStreamInfo. Set it before any
+// data is queued.
+CAPI void AnsyncDecoder_SetStreamCallback(AnsyncDecoder *ad, decoder_stream_callback callback);
+CAPI void AnsyncDecoder_GetStreamInfo(AnsyncDecoder *ad, AnsyncDecoderStreamInfo *info);
+
+// Called on the decode thread when the video can only recover from an IDR,
+// with why. It is called once until a unit holding an IDR or SPS
+// arrives; asking the sender for one (RTCP PLI/FIR) is up to the callback.
+// Set it before any data is queued.
+//   ANSYNC_DECODER_KEYFRAME_DECODE_ERROR   the backend could not decode a unit, the stream waits for an IDR
+//   ANSYNC_DECODER_KEYFRAME_CORRUPT        a picture came out concealed, decoding goes on from damaged references
+//   ANSYNC_DECODER_KEYFRAME_FALLBACK       a backend broke down, the fallback waits for an IDR
+//   ANSYNC_DECODER_KEYFRAME_QUEUE_DROP     the queue discarded a unit, the stream waits for an IDR
+#define ANSYNC_DECODER_KEYFRAME_DECODE_ERROR   1
+#define ANSYNC_DECODER_KEYFRAME_CORRUPT        2
+#define ANSYNC_DECODER_KEYFRAME_FALLBACK       3
+#define ANSYNC_DECODER_KEYFRAME_QUEUE_DROP     4
+CAPI void AnsyncDecoder_SetKeyframeCallback(AnsyncDecoder *ad, decoder_keyframe_callback callback);
+// Number of times the keyframe callback was called, or would have been.
+CAPI int AnsyncDecoder_GetKeyframeRequestCount(AnsyncDecoder *ad);
 
+// displayed size from the last SPS
 CAPI int AnsyncDecoder_GetWidth(AnsyncDecoder *ad);
 CAPI int AnsyncDecoder_GetHeight(AnsyncDecoder *ad);
+// only valid inside the decoder callback: arrival time of the frame being delivered
+CAPI long long AnsyncDecoder_GetFrameRecvTime(AnsyncDecoder *ad);
 
 #endif /* __ANSYNC_DECODER_H__ */
@@ -0,0 +1,67 @@
+#ifndef __DECODER_BACKEND_H__
+#define __DECODER_BACKEND_H__
+
+// Video decoder backends behind the AnsyncDecoder_* API. AnsyncDecoder owns
+// the queue and the decode thread; a backend only turns H.264 access units
+// into AnsyncDecoderFrames. Every call happens on the decode thread.
+
+#include "AnsyncDecoder.h"
+
+typedef struct stDecoderBackend DecoderBackend;
+
+// Hands a picture to AnsyncDecoder. The planes only have to stay valid for
+// the duration of the call.
+typedef void (*decoder_backend_frame_callback)(void *userdata, const AnsyncDecoderFrame *frame);
+// A picture came out with concealed errors: the references are damaged until
+// the next IDR, although decoding goes on.
+typedef void (*decoder_backend_corrupt_callback)(void *userdata);
+
+typedef struct stDecoderBackendOps {
+    const char *name;
+    // < 0 when the backend is not available here; close is not called then
+    int (*open)(DecoderBackend *b);
+    // 0 when the unit was taken, > 0 when it was dropped or could not be
+    // decoded (the stream then restarts at the next IDR), < 0 when the backend
+    // broke down and the next one in line should take over
+    int (*decode)(DecoderBackend *b, const u8 *data, int len, u32 timestamp, long long recv_time_us);
+    void (*close)(DecoderBackend *b);
+    // Optional. A new SPS changed the picture size, b->width and b->height
+    // already hold it. 0 when the backend carries on; without resize, or when
+    // it fails, the backend is closed and opened again at the new size.
+    int (*resize)(DecoderBackend *b);
+} DecoderBackendOps;
+
+struct stDecoderBackend {
+    const DecoderBackendOps *ops;
+    void *priv;
+
+    // set up by AnsyncDecoder before open
+    AnsyncDecoderConfig config;
+    int width;                  // expected size from the SPS, a hint for backends that need one up front
+    int height;
+    void *userdata;
+    decoder_backend_frame_callback on_frame;
+    decoder_backend_corrupt_callback on_corrupt;
+
+    // filled in by open: what the backend actually runs with
+    AnsyncDecoderConfig active;
+};
+
+// NULL when id is unknown or the backend is not built into this binary
+CAPI const DecoderBackendOps* DecoderBackend_Find(int id);
+// Stands ops in for backend id, NULL restores the built-in one. For tests.
+CAPI void DecoderBackend_Override(int id, const DecoderBackendOps *ops);
+
+// the built-in backends, for the C side only
+extern const DecoderBackendOps DecoderBackend_AvcodecOps;
+extern const DecoderBackendOps DecoderBackend_MediaCodecOps;
+extern const DecoderBackendOps DecoderBackend_NullOps;
+
+// Audio units (AAC, mono) always go through libavcodec; the PCM (s16, 44.1
+// kHz) is handed to the legacy decoder_callback with mediaType 2.
+typedef struct stAacDecoder AacDecoder;
+CAPI AacDecoder* AacDecoder_Create(void);
+CAPI void AacDecoder_Decode(AacDecoder *aac, const u8 *data, int len, void *userdata, decoder_callback callback);
+CAPI void AacDecoder_Destroy(AacDecoder *aac);
+
+#endif /* __DECODER_BACKEND_H__ */
@@ -0,0 +1,365 @@
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavformat/avformat.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+#include <libavutil/mem.h>
+
+#include <ffmpeg/include/libswresample/swresample.h>
+#include "decoder_backend.h"
+#include "fflog.h"
+
+// libavcodec software H.264, ANSYNC_DECODER_BACKEND_SW
+
+typedef struct stAvcodecBackend {
+    AVCodecContext *ctx;
+    AVFrame *frame;
+
+    struct SwsContext *yuv_sws;     // odd decoder formats to I420
+    AVFrame *yuv_frame;
+} AvcodecBackend;
+
+// Formats the software decoder rarely produces (4:2:2, 4:4:4, high bit depth)
+// are brought to I420 once here so consumers only ever see 4:2:0 8 bit.
+static AVFrame* convert_to_i420(AvcodecBackend *av, AVFrame *src) {
+    if (!av->yuv_frame || av->yuv_frame->width != src->width || av->yuv_frame->height != src->height) {
+        av_frame_free(&av->yuv_frame);
+        av->yuv_frame = av_frame_alloc();
+        if (!av->yuv_frame)
+            return NULL;
+        av->yuv_frame->format = AV_PIX_FMT_YUV420P;
+        av->yuv_frame->width = src->width;
+        av->yuv_frame->height = src->height;
+        if (av_frame_get_buffer(av->yuv_frame, 32) < 0) {
+            av_frame_free(&av->yuv_frame);
+            return NULL;
+        }
+    }
+    av->yuv_sws = sws_getCachedContext(av->yuv_sws, src->width, src->height, (enum AVPixelFormat)src->format,
+                                       src->width, src->height, AV_PIX_FMT_YUV420P,
+                                       SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (!av->yuv_sws)
+        return NULL;
+    sws_scale(av->yuv_sws, (const uint8_t* const *)src->data, src->linesize, 0, src->height,
+              av->yuv_frame->data, av->yuv_frame->linesize);
+    return av->yuv_frame;
+}
+
+static void deliver_yuv_frame(DecoderBackend *b, u32 timestamp) {
+    AvcodecBackend *av = (AvcodecBackend*)b->priv;
+    AVFrame *f = av->frame;
+    AnsyncDecoderFrame out;
+
+    memset(&out, 0, sizeof(out));
+    switch (f->format) {
+        case AV_PIX_FMT_NV12:
+        case AV_PIX_FMT_NV21:
+            out.planes.y = f->data[0];
+            out.planes.cb = f->format == AV_PIX_FMT_NV12 ? f->data[1] : f->data[1] + 1;
+            out.planes.cr = f->format == AV_PIX_FMT_NV12 ? f->data[1] + 1 : f->data[1];
+            out.planes.y_stride = f->linesize[0];
+            out.planes.c_stride = f->linesize[1];
+            out.planes.c_step = 2;
+            break;
+        case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_YUVJ420P:
+            break;
+        default:
+            f = convert_to_i420(av, f);
+            if (!f) {
+                printf("cannot convert pixel format %d\n", av->frame->format);
+                return;
+            }
+            break;
+    }
+    if (out.planes.c_step == 0) {
+        out.planes.y = f->data[0];
+        out.planes.cb = f->data[1];
+        out.planes.cr = f->data[2];
+        out.planes.y_stride = f->linesize[0];
+        out.planes.c_stride = f->linesize[1];
+        out.planes.c_step = 1;
+    }
+    out.width = f->width;
+    out.height = f->height;
+    out.full_range = av->frame->format == AV_PIX_FMT_YUVJ420P || av->frame->color_range == AVCOL_RANGE_JPEG;
+    out.timestamp = timestamp;
+    out.recv_time_us = av->frame->reordered_opaque;
+    b->on_frame(b->userdata, &out);
+}
+
+static void avcodec_backend_close(DecoderBackend *b) {
+    AvcodecBackend *av = (AvcodecBackend*)b->priv;
+    if (av) {
+        av_frame_free(&av->frame);
+        avcodec_close(av->ctx);
+        avcodec_free_context(&av->ctx);
+        sws_freeContext(av->yuv_sws);
+        av_frame_free(&av->yuv_frame);
+        free(av);
+        b->priv = NULL;
+    }
+}
+
+static int avcodec_backend_open(DecoderBackend *b) {
+    AvcodecBackend *av = NULL;
+    AVCodec *codec = NULL;
+    AVCodecParameters *param = NULL;
+    const AnsyncDecoderConfig *config = &b->config;
+    int result;
+
+    av_register_all();
+    codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+    if (!codec)
+        return -1;
+
+    av = (AvcodecBackend *)malloc(sizeof(AvcodecBackend));
+    if (!av)
+        return -1;
+    memset(av, 0, sizeof(AvcodecBackend));
+    b->priv = av;
+
+    do {
+        av->ctx = avcodec_alloc_context3(codec);
+        if (!av->ctx) break;
+
+        param = avcodec_parameters_alloc();
+        if (!param) break;
+        param->width = b->width;
+        param->height = b->height;
+        result = avcodec_parameters_to_context(av->ctx, param);
+        avcodec_parameters_free(&param);
+        if (result < 0) {
+            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+            break;
+        }
+
+        av->ctx->thread_count = config->thread_count;
+        av->ctx->thread_type = config->thread_type & (FF_THREAD_FRAME | FF_THREAD_SLICE);
+        if (config->low_delay)
+            av->ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        if (config->fast)
+            av->ctx->flags2 |= AV_CODEC_FLAG2_FAST;
+
+        result = avcodec_open2(av->ctx, codec, NULL);
+        if (result < 0) {
+            printf("[ffmpeg error] %d : %s\n",result,av_err2str(result));
+            break;
+        }
+        printf("h264 decoder: %d threads, %s%s%s\n", av->ctx->thread_count,
+               av->ctx->active_thread_type == FF_THREAD_FRAME ? "frame threaded" :
+               av->ctx->active_thread_type == FF_THREAD_SLICE ? "slice threaded" : "single threaded",
+               config->low_delay ? ", low delay" : "", config->fast ? ", fast" : "");
+
+        av->frame = av_frame_alloc();
+        if (!av->frame) {
+            printf("av_frame_alloc error.\n");
+            break;
+        }
+
+        b->active = *config;
+        b->active.thread_count = av->ctx->thread_count;
+        b->active.thread_type = av->ctx->active_thread_type;
+        return 0;
+    } while (0);
+
+    avcodec_backend_close(b);
+    return -1;
+}
+
+static int avcodec_backend_decode(DecoderBackend *b, const u8 *data, int len, u32 timestamp, long long recv_time_us) {
+    AvcodecBackend *av = (AvcodecBackend*)b->priv;
+    AVPacket pkt;
+
+    av_init_packet(&pkt);
+    pkt.data = (u8*)data;
+    pkt.size = len;
+    pkt.pts = timestamp;
+    // carried through reordering so the callback sees the arrival time of the frame it gets
+    av->ctx->reordered_opaque = recv_time_us;
+
+    // Keeps the reorder delay at one picture. Frame threads keep their own
+    // copy of the context, so there it would only race with them.
+    if (av->ctx->active_thread_type != FF_THREAD_FRAME && av->ctx->has_b_frames > 1) {
+        av->ctx->has_b_frames = 1;
+    }
+
+    // A corrupt unit is the stream's problem, not the decoder's: the decoder
+    // stays, but the pictures that follow would be built on a broken reference,
+    // so the stream restarts at the next IDR.
+    int result = avcodec_send_packet(av->ctx, &pkt);
+    if (result < 0 && result != AVERROR_EOF) {
+        printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+        av_packet_unref(&pkt);
+        return 1;
+    }
+
+    // frame threads hand pictures back late, and sometimes more than one at a time
+    while ((result = avcodec_receive_frame(av->ctx, av->frame)) == 0) {
+        if ((av->frame->flags & AV_FRAME_FLAG_CORRUPT) || av->frame->decode_error_flags)
+            b->on_corrupt(b->userdata);
+        deliver_yuv_frame(b, av->frame->pkt_pts != AV_NOPTS_VALUE ? (u32)av->frame->pkt_pts : timestamp);
+    }
+    av_packet_unref(&pkt);
+    if (result < 0 && result != AVERROR(EAGAIN) && result != AVERROR_EOF) {
+        printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+        return 1;
+    }
+    return 0;
+}
+
+// libavcodec reads the SPS itself and reallocates its pictures
+static int avcodec_backend_resize(DecoderBackend *b) {
+    return 0;
+}
+
+const DecoderBackendOps DecoderBackend_AvcodecOps = {
+    "sw",
+    avcodec_backend_open,
+    avcodec_backend_decode,
+    avcodec_backend_close,
+    avcodec_backend_resize,
+};
+
+// AAC audio, always libavcodec
+
+struct stAacDecoder {
+    AVCodecContext *a_ctx;
+    struct SwrContext *a_swrContext;
+    AVFrame *a_frame;
+    AVFrame *a_frame_out;
+};
+
+AacDecoder* AacDecoder_Create(void) {
+    AacDecoder *aac = NULL;
+    AVCodec *codec = NULL;
+    AVCodecParameters *param = NULL;
+    int ok = 0;
+    int result;
+
+    av_register_all();
+    do {
+        aac = (AacDecoder *)malloc(sizeof(AacDecoder));
+        if (!aac) break;
+        memset(aac, 0, sizeof(AacDecoder));
+
+        codec = avcodec_find_decoder(AV_CODEC_ID_AAC);
+        if(!codec) break;
+
+        aac->a_ctx = avcodec_alloc_context3(codec);
+        if (!aac->a_ctx) break;
+
+        param = avcodec_parameters_alloc();
+        if (!param) break;
+        param->codec_type = AVMEDIA_TYPE_AUDIO;
+        param->sample_rate = 44100;
+        param->format = AV_SAMPLE_FMT_FLTP;
+        param->channels = 1;
+        param->channel_layout = AV_CH_LAYOUT_MONO;
+        param->bit_rate = 64000;
+
+        result = avcodec_parameters_to_context(aac->a_ctx, param);
+        avcodec_parameters_free(&param);
+        if(result < 0) {
+            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+            break;
+        }
+
+        result = avcodec_open2(aac->a_ctx, codec, NULL);
+        if (result < 0) {
+            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+            break;
+        }
+
+        aac->a_frame = av_frame_alloc();
+        if(!aac->a_frame) {
+            printf("av_frame_alloc error.\n");
+            break;
+        }
+
+        aac->a_frame_out = av_frame_alloc();
+        if (!aac->a_frame_out) {
+            printf("av_frame_alloc error.\n");
+            break;
+        }
+        ok = 1;
+    } while (0);
+
+    if (!ok) {
+        AacDecoder_Destroy(aac);
+        aac = NULL;
+    }
+    return aac;
+}
+
+void AacDecoder_Destroy(AacDecoder *aac) {
+    if (aac) {
+        av_frame_free(&aac->a_frame_out);
+        av_frame_free(&aac->a_frame);
+        avcodec_close(aac->a_ctx);
+        avcodec_free_context(&aac->a_ctx);
+        swr_free(&aac->a_swrContext);
+        free(aac);
+    }
+}
+
+static FILE *fp0 = NULL;
+static FILE *fp1 = NULL;
+
+void AacDecoder_Decode(AacDecoder *aac, const u8 *data, int len, void *userdata, decoder_callback callback) {
+    AVPacket pkt;
+
+    if (data == NULL || len == 0) {
+        return;
+    }
+
+    av_init_packet(&pkt);
+    pkt.data = (u8*)data;
+    pkt.size = len;
+
+    do {
+        int result = avcodec_send_packet(aac->a_ctx, &pkt);
+        if (result < 0 && result != AVERROR_EOF) {
+            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+            break;
+        }
+
+        result = avcodec_receive_frame(aac->a_ctx, aac->a_frame);
+        if (result < 0 && result != AVERROR_EOF) {
+            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+            break;
+        }
+
+        if (fp0 == NULL) {
+            fp0 = fopen("/sdcard/DCIM/Test/test0.pcm", "wb");
+        }
+        result = (int) fwrite(aac->a_frame->data[0], 1, aac->a_frame->linesize[0], fp0);
+        printf("fp0 fwrite result(%d)", result);
+
+        if (aac->a_swrContext == NULL) {
+            aac->a_swrContext = swr_alloc_set_opts(NULL, AV_CH_LAYOUT_MONO, AV_SAMPLE_FMT_S16, 44100,
+                               aac->a_frame->channel_layout, (enum AVSampleFormat) aac->a_frame->format, aac->a_frame->sample_rate,
+                               0, NULL);
+            swr_init(aac->a_swrContext);
+        }
+
+        aac->a_frame_out->format = AV_SAMPLE_FMT_S16;
+        aac->a_frame_out->channel_layout = AV_CH_LAYOUT_MONO;
+        aac->a_frame_out->sample_rate = 44100;
+        result = swr_convert_frame(aac->a_swrContext, aac->a_frame_out, aac->a_frame);
+        if (result < 0 && result != AVERROR_EOF) {
+            printf("[ffmpeg error] %d : %s\n",result, av_err2str(result));
+            break;
+        }
+
+        if (callback) {
+            if (fp1 == NULL) {
+                fp1 = fopen("/sdcard/DCIM/Test/test1.pcm", "wb");
+            }
+            result = (int) fwrite(aac->a_frame_out->data[0], 1, (size_t) aac->a_frame_out->linesize[0], fp1);
+            printf("fp1 fwrite result(%d)", result);
+            callback(userdata, aac->a_frame_out->data[0], aac->a_frame_out->linesize[0], 0, 0, 0, 2);
+        }
+    } while (0);
+    av_packet_unref(&pkt);
+}
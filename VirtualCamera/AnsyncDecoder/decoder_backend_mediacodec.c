@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <media/NdkMediaCodec.h>
+#include <media/NdkMediaFormat.h>
+
+#include "decoder_backend.h"
+#include "fflog.h"
+
+// ANSYNC_DECODER_BACKEND_MEDIACODEC: the platform H.264 decoder through the
+// NDK, output read back from ByteBuffers so the frames take the same path as
+// the software ones. Any codec error makes the backend report a breakdown,
+// AnsyncDecoder then moves on to the fallback.
+
+// how long decode waits for the codec to free an input buffer
+#define MEDIACODEC_INPUT_TIMEOUT_US 20000
+// units in flight whose RTP timestamp and arrival time are remembered
+#define MEDIACODEC_PENDING 64
+
+// MediaCodecInfo.CodecCapabilities
+#define COLOR_FormatYUV420Planar        19
+#define COLOR_FormatYUV420SemiPlanar    21
+
+typedef struct stPendingUnit {
+    long long seq;
+    u32 timestamp;
+    long long recv_time_us;
+} PendingUnit;
+
+typedef struct stMediaCodecBackend {
+    AMediaCodec *codec;
+    int started;
+
+    // output layout, from the last format change
+    int width;
+    int height;
+    int stride;
+    int slice_height;
+    int color_format;
+    int crop_left;
+    int crop_top;
+
+    long long seq;              // presentationTimeUs of the next unit
+    PendingUnit pending[MEDIACODEC_PENDING];
+} MediaCodecBackend;
+
+static void mediacodec_backend_close(DecoderBackend *b) {
+    MediaCodecBackend *m = (MediaCodecBackend *)b->priv;
+    if (m) {
+        if (m->codec) {
+            if (m->started)
+                AMediaCodec_stop(m->codec);
+            AMediaCodec_delete(m->codec);
+        }
+        free(m);
+        b->priv = NULL;
+    }
+}
+
+static int mediacodec_backend_open(DecoderBackend *b) {
+    MediaCodecBackend *m;
+    AMediaFormat *format;
+    media_status_t status;
+
+    m = (MediaCodecBackend *)malloc(sizeof(MediaCodecBackend));
+    if (!m)
+        return -1;
+    memset(m, 0, sizeof(MediaCodecBackend));
+    b->priv = m;
+
+    m->codec = AMediaCodec_createDecoderByType("video/avc");
+    if (!m->codec) {
+        LOGE("no video/avc decoder");
+        mediacodec_backend_close(b);
+        return -1;
+    }
+
+    format = AMediaFormat_new();
+    AMediaFormat_setString(format, AMEDIAFORMAT_KEY_MIME, "video/avc");
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_WIDTH, b->width);
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_HEIGHT, b->height);
+    // asked for, not guaranteed: the output format change tells what we got
+    AMediaFormat_setInt32(format, AMEDIAFORMAT_KEY_COLOR_FORMAT, COLOR_FormatYUV420SemiPlanar);
+    // realtime priority; low-latency is honoured from Android 11 on
+    AMediaFormat_setInt32(format, "priority", 0);
+    if (b->config.low_delay)
+        AMediaFormat_setInt32(format, "low-latency", 1);
+
+    status = AMediaCodec_configure(m->codec, format, NULL, NULL, 0);
+    if (status == AMEDIA_OK) {
+        status = AMediaCodec_start(m->codec);
+        m->started = status == AMEDIA_OK;
+    }
+    LOGD("MediaCodec %s: %s", status == AMEDIA_OK ? "started" : "failed", AMediaFormat_toString(format));
+    AMediaFormat_delete(format);
+    if (status != AMEDIA_OK) {
+        LOGE("MediaCodec configure / start failed: %d", status);
+        mediacodec_backend_close(b);
+        return -1;
+    }
+
+    m->width = b->width;
+    m->height = b->height;
+    m->stride = b->width;
+    m->slice_height = b->height;
+    m->color_format = COLOR_FormatYUV420SemiPlanar;
+
+    memset(&b->active, 0, sizeof(b->active));
+    b->active.low_delay = b->config.low_delay;
+    b->active.backend = ANSYNC_DECODER_BACKEND_MEDIACODEC;
+    b->active.fallback = b->config.fallback;
+    return 0;
+}
+
+static int read_output_format(MediaCodecBackend *m) {
+    AMediaFormat *format = AMediaCodec_getOutputFormat(m->codec);
+    int32_t v, left, top, right, bottom;
+
+    if (!format)
+        return -1;
+    if (AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_WIDTH, &v))
+        m->width = v;
+    if (AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_HEIGHT, &v))
+        m->height = v;
+    m->stride = AMediaFormat_getInt32(format, "stride", &v) && v >= m->width ? v : m->width;
+    m->slice_height = AMediaFormat_getInt32(format, "slice-height", &v) && v >= m->height ? v : m->height;
+    if (AMediaFormat_getInt32(format, AMEDIAFORMAT_KEY_COLOR_FORMAT, &v))
+        m->color_format = v;
+    m->crop_left = 0;
+    m->crop_top = 0;
+    if (AMediaFormat_getInt32(format, "crop-left", &left) &&
+        AMediaFormat_getInt32(format, "crop-top", &top) &&
+        AMediaFormat_getInt32(format, "crop-right", &right) &&
+        AMediaFormat_getInt32(format, "crop-bottom", &bottom)) {
+        m->width = right - left + 1;
+        m->height = bottom - top + 1;
+        // chroma is addressed at even positions
+        m->crop_left = left & ~1;
+        m->crop_top = top & ~1;
+    }
+    LOGD("MediaCodec output format: %s", AMediaFormat_toString(format));
+    AMediaFormat_delete(format);
+
+    if (m->color_format != COLOR_FormatYUV420Planar && m->color_format != COLOR_FormatYUV420SemiPlanar) {
+        LOGE("MediaCodec output color format %#x is not supported", m->color_format);
+        return -1;
+    }
+    return 0;
+}
+
+static void deliver_output(DecoderBackend *b, u8 *data, size_t size, long long pts) {
+    MediaCodecBackend *m = (MediaCodecBackend *)b->priv;
+    PendingUnit *p = &m->pending[pts % MEDIACODEC_PENDING];
+    size_t luma = (size_t)m->stride * m->slice_height;
+    size_t chroma_width = (size_t)(m->width + 1) / 2;
+    size_t chroma_height = (size_t)(m->height + 1) / 2;
+    size_t y_offset, cb_offset, cr_offset, end, chroma_end;
+    AnsyncDecoderFrame out;
+
+    if (m->width <= 0 || m->height <= 0) {
+        LOGW("MediaCodec output size %dx%d is not valid", m->width, m->height);
+        return;
+    }
+
+    memset(&out, 0, sizeof(out));
+    y_offset = (size_t)m->crop_top * m->stride + m->crop_left;
+    out.planes.y_stride = m->stride;
+    // one past the last byte each plane is read at, cropped rows included
+    end = y_offset + (size_t)(m->height - 1) * m->stride + m->width;
+    if (m->color_format == COLOR_FormatYUV420SemiPlanar) {
+        cb_offset = luma + (size_t)(m->crop_top / 2) * m->stride + m->crop_left;
+        cr_offset = cb_offset + 1;
+        out.planes.c_stride = m->stride;
+        out.planes.c_step = 2;
+        chroma_end = cb_offset + (chroma_height - 1) * m->stride + 2 * chroma_width;
+    } else {
+        int c_stride = m->stride / 2;
+        size_t c_offset = (size_t)(m->crop_top / 2) * c_stride + m->crop_left / 2;
+        cb_offset = luma + c_offset;
+        cr_offset = luma + (size_t)c_stride * (m->slice_height / 2) + c_offset;
+        out.planes.c_stride = c_stride;
+        out.planes.c_step = 1;
+        // cr comes after cb
+        chroma_end = cr_offset + (chroma_height - 1) * c_stride + chroma_width;
+    }
+    if (chroma_end > end)
+        end = chroma_end;
+    if (size < end) {
+        LOGW("MediaCodec output buffer too small: %zu for %dx%d stride %d, %zu read", size, m->width, m->height,
+             m->stride, end);
+        return;
+    }
+    out.planes.y = data + y_offset;
+    out.planes.cb = data + cb_offset;
+    out.planes.cr = data + cr_offset;
+    out.width = m->width;
+    out.height = m->height;
+    if (p->seq == pts) {
+        out.timestamp = p->timestamp;
+        out.recv_time_us = p->recv_time_us;
+    }
+    b->on_frame(b->userdata, &out);
+}
+
+// < 0 when the codec failed
+static int drain_output(DecoderBackend *b) {
+    MediaCodecBackend *m = (MediaCodecBackend *)b->priv;
+    for (;;) {
+        AMediaCodecBufferInfo info;
+        ssize_t index = AMediaCodec_dequeueOutputBuffer(m->codec, &info, 0);
+        if (index == AMEDIACODEC_INFO_TRY_AGAIN_LATER)
+            return 0;
+        if (index == AMEDIACODEC_INFO_OUTPUT_BUFFERS_CHANGED)
+            continue;
+        if (index == AMEDIACODEC_INFO_OUTPUT_FORMAT_CHANGED) {
+            if (read_output_format(m) < 0)
+                return -1;
+            continue;
+        }
+        if (index < 0) {
+            LOGE("MediaCodec dequeueOutputBuffer failed: %zd", index);
+            return -1;
+        }
+
+        size_t size = 0;
+        u8 *data = AMediaCodec_getOutputBuffer(m->codec, (size_t)index, &size);
+        if (data && info.size > 0 && (size_t)info.offset + info.size <= size)
+            deliver_output(b, data + info.offset, (size_t)info.size, info.presentationTimeUs);
+        AMediaCodec_releaseOutputBuffer(m->codec, (size_t)index, false);
+    }
+}
+
+static int mediacodec_backend_decode(DecoderBackend *b, const u8 *data, int len, u32 timestamp, long long recv_time_us) {
+    MediaCodecBackend *m = (MediaCodecBackend *)b->priv;
+    PendingUnit *p;
+    size_t capacity = 0;
+    u8 *in;
+    ssize_t index;
+
+    if (drain_output(b) < 0)
+        return -1;
+
+    index = AMediaCodec_dequeueInputBuffer(m->codec, MEDIACODEC_INPUT_TIMEOUT_US);
+    if (index == AMEDIACODEC_INFO_TRY_AGAIN_LATER) {
+        LOGW("MediaCodec has no input buffer, unit dropped");
+        return 1;
+    }
+    if (index < 0) {
+        LOGE("MediaCodec dequeueInputBuffer failed: %zd", index);
+        return -1;
+    }
+    in = AMediaCodec_getInputBuffer(m->codec, (size_t)index, &capacity);
+    if (!in)
+        return -1;
+    if ((size_t)len > capacity) {
+        LOGW("unit of %d bytes does not fit a %zu byte input buffer, dropped", len, capacity);
+        AMediaCodec_queueInputBuffer(m->codec, (size_t)index, 0, 0, 0, 0);
+        return 1;
+    }
+
+    memcpy(in, data, (size_t)len);
+    p = &m->pending[m->seq % MEDIACODEC_PENDING];
+    p->seq = m->seq;
+    p->timestamp = timestamp;
+    p->recv_time_us = recv_time_us;
+    if (AMediaCodec_queueInputBuffer(m->codec, (size_t)index, 0, (size_t)len, (uint64_t)m->seq, 0) != AMEDIA_OK) {
+        LOGE("MediaCodec queueInputBuffer failed");
+        return -1;
+    }
+    m->seq++;
+
+    return drain_output(b) < 0 ? -1 : 0;
+}
+
+const DecoderBackendOps DecoderBackend_MediaCodecOps = {
+    "mediacodec",
+    mediacodec_backend_open,
+    mediacodec_backend_decode,
+    mediacodec_backend_close,
+    NULL,                       // reconfigured by reopening at the new size
+};
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "decoder_backend.h"
+
+// ANSYNC_DECODER_BACKEND_NULL: decodes nothing. Every unit holding a slice
+// comes out at once as a black frame of the expected size, so the queue, the
+// callbacks and everything after them can be measured without decode cost.
+
+typedef struct stNullBackend {
+    u8 *picture;                // I420, video range black
+} NullBackend;
+
+static u8 *alloc_picture(int width, int height) {
+    size_t luma = (size_t)width * height;
+    size_t chroma = 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+    u8 *picture;
+
+    if (width <= 0 || height <= 0)
+        return NULL;
+    picture = (u8 *)malloc(luma + chroma);
+    if (picture) {
+        memset(picture, 16, luma);
+        memset(picture + luma, 128, chroma);
+    }
+    return picture;
+}
+
+static int null_backend_open(DecoderBackend *b) {
+    NullBackend *n;
+
+    n = (NullBackend *)malloc(sizeof(NullBackend));
+    if (!n)
+        return -1;
+    n->picture = alloc_picture(b->width, b->height);
+    if (!n->picture) {
+        free(n);
+        return -1;
+    }
+    b->priv = n;
+
+    memset(&b->active, 0, sizeof(b->active));
+    b->active.thread_count = 1;
+    b->active.backend = ANSYNC_DECODER_BACKEND_NULL;
+    b->active.fallback = b->config.fallback;
+    return 0;
+}
+
+static int has_slice(const u8 *data, int len) {
+    int i;
+    for (i = 0; i + 3 < len; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            int type = data[i + 3] & 0x1f;
+            if (type >= 1 && type <= 5)
+                return 1;
+            i += 2;
+        }
+    }
+    return 0;
+}
+
+static int null_backend_decode(DecoderBackend *b, const u8 *data, int len, u32 timestamp, long long recv_time_us) {
+    NullBackend *n = (NullBackend *)b->priv;
+    AnsyncDecoderFrame out;
+    int c_width = (b->width + 1) / 2;
+
+    if (!has_slice(data, len))
+        return 0;
+
+    memset(&out, 0, sizeof(out));
+    out.planes.y = n->picture;
+    out.planes.cb = n->picture + (size_t)b->width * b->height;
+    out.planes.cr = out.planes.cb + (size_t)c_width * ((b->height + 1) / 2);
+    out.planes.y_stride = b->width;
+    out.planes.c_stride = c_width;
+    out.planes.c_step = 1;
+    out.width = b->width;
+    out.height = b->height;
+    out.timestamp = timestamp;
+    out.recv_time_us = recv_time_us;
+    b->on_frame(b->userdata, &out);
+    return 0;
+}
+
+static int null_backend_resize(DecoderBackend *b) {
+    NullBackend *n = (NullBackend *)b->priv;
+    u8 *picture = alloc_picture(b->width, b->height);
+
+    if (!picture)
+        return -1;
+    free(n->picture);
+    n->picture = picture;
+    return 0;
+}
+
+static void null_backend_close(DecoderBackend *b) {
+    NullBackend *n = (NullBackend *)b->priv;
+    if (n) {
+        free(n->picture);
+        free(n);
+        b->priv = NULL;
+    }
+}
+
+const DecoderBackendOps DecoderBackend_NullOps = {
+    "null",
+    null_backend_open,
+    null_backend_decode,
+    null_backend_close,
+    null_backend_resize,
+};
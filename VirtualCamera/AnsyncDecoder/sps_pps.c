@@ -175,26 +175,25 @@ enum AVColorSpace{
 
 static inline int decode_hrd_parameters(bs_t *s, h264_sps_t *sps)
 {
-//    int cpb_count, i;
-//    cpb_count = get_ue_golomb_31(&s->gb) + 1;
-//
-//    if(cpb_count > 32U){
-//        av_log(h->s.avctx, AV_LOG_ERROR, "cpb_count %d invalid\n", cpb_count);
-//        return -1;
-//    }
-//
-//    bs_read(s, 4); /* bit_rate_scale */
-//    bs_read(s, 4); /* cpb_size_scale */
-//    for(i=0; i<cpb_count; i++){
-//        get_ue_golomb_long(&s->gb); /* bit_rate_value_minus1 */
-//        get_ue_golomb_long(&s->gb); /* cpb_size_value_minus1 */
-//        bs_read1(s);     /* cbr_flag */
-//    }
-//    sps->initial_cpb_removal_delay_length = bs_read(s, 5) + 1;
-//    sps->cpb_removal_delay_length = bs_read(s, 5) + 1;
-//    sps->dpb_output_delay_length = bs_read(s, 5) + 1;
-//    sps->time_offset_length = bs_read(s, 5);
-//    sps->cpb_cnt = cpb_count;
+    int cpb_count, i;
+    cpb_count = bs_read_ue(s) + 1;
+
+    if(cpb_count > 32){
+        //_TRACE("cpb_count %d invalid\n", cpb_count);
+        return -1;
+    }
+
+    bs_read(s, 4); /* bit_rate_scale */
+    bs_read(s, 4); /* cpb_size_scale */
+    for(i=0; i<cpb_count; i++){
+        bs_read_ue(s); /* bit_rate_value_minus1 */
+        bs_read_ue(s); /* cpb_size_value_minus1 */
+        bs_read(s, 1); /* cbr_flag */
+    }
+    bs_read(s, 5); /* initial_cpb_removal_delay_length_minus1 */
+    bs_read(s, 5); /* cpb_removal_delay_length_minus1 */
+    bs_read(s, 5); /* dpb_output_delay_length_minus1 */
+    bs_read(s, 5); /* time_offset_length */
     return 0;
 }
 
@@ -376,7 +375,9 @@ int h264_sps_read( unsigned char *nal, int nal_len, h264_sps_t *sps)
     sps->b_constraint_set1 = b_constraint_set1;
     sps->b_constraint_set2 = b_constraint_set2;
 
-    if(sps->i_profile_idc >= 100){ //high profile
+    sps->i_chroma_format_idc = 1; /* 4:2:0 unless the high profiles say otherwise */
+    if(sps->i_profile_idc >= 100 || sps->i_profile_idc == 44 ||
+       sps->i_profile_idc == 83 || sps->i_profile_idc == 86){ //high profile
         sps->i_chroma_format_idc= bs_read_ue( s );
         if(sps->i_chroma_format_idc >= 32 )
             return -1;
@@ -492,6 +493,79 @@ error:
     return -1;
 }
 
+#define H264_SPS_MAX_SIZE 1024
+
+int h264_sps_geometry( const unsigned char *nal, int nal_len, h264_geometry_t *geometry )
+{
+    unsigned char rbsp[H264_SPS_MAX_SIZE];
+    h264_sps_t sps;
+    int i, n = 0, zeros = 0, id;
+    int crop_unit_x, crop_unit_y;
+    int crop_left, crop_right, crop_top, crop_bottom;
+
+    /* drop the emulation_prevention_three_bytes, bs_t reads plain RBSP */
+    for( i = 0; i < nal_len && n < H264_SPS_MAX_SIZE; i++ )
+    {
+        if( zeros >= 2 && nal[i] == 0x03 )
+        {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+        rbsp[n++] = nal[i];
+    }
+
+    memset( &sps, 0, sizeof(sps) );
+    id = h264_sps_read( rbsp, n, &sps );
+    if( id < 0 || sps.i_mb_width <= 0 || sps.i_mb_height <= 0 ||
+        sps.i_mb_width > 1024 || sps.i_mb_height > 1024 )
+    {
+        return -1;
+    }
+
+    switch( sps.i_chroma_format_idc )
+    {
+        case 0: crop_unit_x = 1; crop_unit_y = 1; break;    /* monochrome */
+        case 2: crop_unit_x = 2; crop_unit_y = 1; break;    /* 4:2:2 */
+        case 3: crop_unit_x = 1; crop_unit_y = 1; break;    /* 4:4:4 */
+        default: crop_unit_x = 2; crop_unit_y = 2; break;   /* 4:2:0 */
+    }
+    crop_unit_y *= 2 - sps.b_frame_mbs_only;
+
+    memset( geometry, 0, sizeof(*geometry) );
+    geometry->i_coded_width = sps.i_mb_width * 16;
+    geometry->i_coded_height = sps.i_mb_height * 16 * (2 - sps.b_frame_mbs_only);
+
+    crop_left = sps.crop.i_left * crop_unit_x;
+    crop_right = sps.crop.i_right * crop_unit_x;
+    crop_top = sps.crop.i_top * crop_unit_y;
+    crop_bottom = sps.crop.i_bottom * crop_unit_y;
+    if( sps.b_crop && crop_left >= 0 && crop_right >= 0 && crop_top >= 0 && crop_bottom >= 0 &&
+        crop_left + crop_right < geometry->i_coded_width &&
+        crop_top + crop_bottom < geometry->i_coded_height )
+    {
+        geometry->i_crop_left = crop_left;
+        geometry->i_crop_right = crop_right;
+        geometry->i_crop_top = crop_top;
+        geometry->i_crop_bottom = crop_bottom;
+    }
+    geometry->i_width = geometry->i_coded_width - geometry->i_crop_left - geometry->i_crop_right;
+    geometry->i_height = geometry->i_coded_height - geometry->i_crop_top - geometry->i_crop_bottom;
+
+    if( sps.b_vui )
+    {
+        geometry->b_fullrange = sps.vui.b_signal_type_present && sps.vui.b_fullrange;
+        if( sps.vui.b_timing_info_present && sps.vui.i_num_units_in_tick > 0 && sps.vui.i_time_scale > 0 )
+        {
+            /* a tick is a field: two per frame */
+            geometry->i_fps_num = sps.vui.i_time_scale;
+            geometry->i_fps_den = 2 * sps.vui.i_num_units_in_tick;
+        }
+    }
+    geometry->i_num_reorder_frames = sps.b_vui && sps.vui.b_bitstream_restriction ? sps.vui.i_num_reorder_frames : -1;
+    return id;
+}
+
 /* return -1 if invalid, else the id */
 int h264_pps_read( unsigned char *nal, int nal_len, h264_pps_t *pps )
 {
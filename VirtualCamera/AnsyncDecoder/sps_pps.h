@@ -165,6 +165,26 @@ typedef struct
 /* return -1 if invalid, else the id */
 int h264_sps_read( unsigned char *nal, int nal_len, h264_sps_t *sps);
 
+typedef struct
+{
+    int i_width;                /* displayed size, cropping applied */
+    int i_height;
+    int i_coded_width;          /* whole macroblocks */
+    int i_coded_height;
+    int i_crop_left;            /* in pixels */
+    int i_crop_right;
+    int i_crop_top;
+    int i_crop_bottom;
+    int b_fullrange;
+    int i_fps_num;              /* 0 when the SPS has no timing info */
+    int i_fps_den;
+    int i_num_reorder_frames;   /* -1 when not signalled */
+} h264_geometry_t;
+
+/* nal: a whole SPS NAL unit from its header byte on, emulation prevention
+ * bytes still in. return -1 if invalid, else the id */
+int h264_sps_geometry( const unsigned char *nal, int nal_len, h264_geometry_t *geometry );
+
 /* return -1 if invalid, else the id */
 int h264_pps_read( unsigned char *nal, int nal_len, h264_pps_t *pps );
 
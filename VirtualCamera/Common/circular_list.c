@@ -1,42 +1,311 @@
 #include <stdlib.h>
 #include <memory.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include "circular_list.h"
 
-CAPI CircularList* CircularList_Create(unsigned int count, unsigned int element_size) {
-    int i, next, prev, size = sizeof(CircularList) + sizeof(CircularListNode)*count + element_size*count;
-    char *pool_ptr;
-    CircularList* clist = (CircularList*)malloc(size);
-    if (clist) {
-        memset(clist, 0, size);
-        clist->nodes = (CircularListNode*)(clist+1);
-        clist->pool = (void*)(clist->nodes + count);
-        clist->count = count;
-        clist->element_size = element_size;
+#define CACHE_LINE 64
+
+struct stCircularList {
+    // written by the producer only (and by the consumer's CAS on head)
+    unsigned int tail __attribute__((aligned(CACHE_LINE)));
+    u64 enqueued;
+    u64 dropped;
+    u64 blocked;
+    unsigned int high_water;
+    int producer_waiting;
+
+    unsigned int head __attribute__((aligned(CACHE_LINE)));
+    u64 dequeued;
+    int consumer_waiting;
+
+    int closed __attribute__((aligned(CACHE_LINE)));
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+
+    CircularListPolicy policy;
+    circular_list_drop_callback on_drop;
+    void *on_drop_userdata;
+
+    unsigned int count;
+    unsigned int mask;
+    unsigned int element_size;
+    u8 *pool;
+    u8 *scratch;                // element discarded by the producer
+};
+
+#define LOAD_ACQ(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define LOAD_RLX(p)         __atomic_load_n(p, __ATOMIC_RELAXED)
+#define STORE_REL(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define INC_RLX(p)          __atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED)
+
+static inline u8* slot(CircularList *list, unsigned int index) {
+    return list->pool + (size_t)(index & list->mask) * list->element_size;
+}
+
+static int is_not_empty(CircularList *list) {
+    return __atomic_load_n(&list->tail, __ATOMIC_SEQ_CST) != __atomic_load_n(&list->head, __ATOMIC_SEQ_CST);
+}
+
+static int is_not_full(CircularList *list) {
+    return __atomic_load_n(&list->tail, __ATOMIC_SEQ_CST) - __atomic_load_n(&list->head, __ATOMIC_SEQ_CST) < list->count;
+}
+
+static void make_deadline(struct timespec *ts, int timeout_ms) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += timeout_ms / 1000;
+    ts->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+// Sleeps until ready() holds. The waiting flag is raised under the lock before
+// ready() is checked again, and the other side tests it after publishing its
+// index, so a wakeup cannot fall between the check and the wait.
+static int wait_for(CircularList *list, int *waiting, pthread_cond_t *cond, int (*ready)(CircularList*),
+                    const struct timespec *deadline) {
+    int ret = 0;
+    pthread_mutex_lock(&list->lock);
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    while (!ready(list)) {
+        if (LOAD_RLX(&list->closed)) {
+            ret = -1;
+            break;
+        }
+        if (deadline) {
+            if (pthread_cond_timedwait(cond, &list->lock, deadline) == ETIMEDOUT) {
+                ret = ready(list) ? 0 : -1;
+                break;
+            }
+        } else {
+            pthread_cond_wait(cond, &list->lock);
+        }
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&list->lock);
+    return ret;
+}
 
-        pool_ptr = clist->pool;
-        for (i=0; i<(int)count; i++, pool_ptr += element_size) {
-            next = i+1;
-            if (next == (int)count)
-                next = 0;
+static void notify(CircularList *list, int *waiting, pthread_cond_t *cond) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (LOAD_RLX(waiting)) {
+        pthread_mutex_lock(&list->lock);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&list->lock);
+    }
+}
+
+CAPI CircularList* CircularList_Create(unsigned int count, unsigned int element_size) {
+    CircularList *clist = NULL;
+    pthread_condattr_t attr;
+    unsigned int n = 1;
+    int ok = 0;
 
-            prev = i-1;
-            if (prev < 0)
-                prev = count-1;
+    while (n < count)
+        n <<= 1;
 
-            clist->nodes[i].data = (void*)pool_ptr;
-            clist->nodes[i].prev = &(clist->nodes[prev]);
-            clist->nodes[i].next = &(clist->nodes[next]);
-            clist->nodes[i].index = i;
+    do {
+        if (posix_memalign((void**)&clist, CACHE_LINE, sizeof(CircularList)) != 0) {
+            clist = NULL;
+            break;
         }
+        memset(clist, 0, sizeof(CircularList));
+        clist->count = n;
+        clist->mask = n - 1;
+        clist->element_size = element_size;
+        clist->policy = CIRCULAR_LIST_BLOCK;
 
+        clist->pool = (u8*)calloc(n, element_size);
+        clist->scratch = (u8*)malloc(element_size);
+        if (!clist->pool || !clist->scratch) break;
+
+        pthread_mutex_init(&clist->lock, NULL);
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&clist->not_empty, &attr);
+        pthread_cond_init(&clist->not_full, &attr);
+        pthread_condattr_destroy(&attr);
+        ok = 1;
+    } while (0);
+
+    if (!ok && clist) {
+        free(clist->pool);
+        free(clist->scratch);
+        free(clist);
+        clist = NULL;
     }
     return clist;
 }
 
 CAPI void CircularList_Destroy(CircularList *list) {
-    if (list) free(list);
+    if (list) {
+        pthread_cond_destroy(&list->not_empty);
+        pthread_cond_destroy(&list->not_full);
+        pthread_mutex_destroy(&list->lock);
+        free(list->pool);
+        free(list->scratch);
+        free(list);
+    }
 }
 
 CAPI void CircularList_Reset(CircularList *list) {
-    if (list) memset(list->pool, 0, list->element_size*list->count);
+    if (list) {
+        memset(list->pool, 0, (size_t)list->element_size * list->count);
+        list->head = list->tail = 0;
+        list->closed = 0;
+        list->enqueued = list->dequeued = list->dropped = list->blocked = 0;
+        list->high_water = 0;
+    }
+}
+
+CAPI void CircularList_SetPolicy(CircularList *list, CircularListPolicy policy,
+                                 circular_list_drop_callback on_drop, void *userdata) {
+    if (list) {
+        list->policy = policy;
+        list->on_drop = on_drop;
+        list->on_drop_userdata = userdata;
+    }
+}
+
+// Producer side of DROP_OLDEST. The consumer may be copying the same element
+// out; whoever moves head first owns it, the loser retries.
+static void drop_oldest(CircularList *list, unsigned int head) {
+    memcpy(list->scratch, slot(list, head), list->element_size);
+    if (__atomic_compare_exchange_n(&list->head, &head, head + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        INC_RLX(&list->dropped);
+        if (list->on_drop)
+            list->on_drop(list->on_drop_userdata, list->scratch);
+    }
+}
+
+CAPI int CircularList_Push(CircularList *list, const void *element, int droppable, int timeout_ms) {
+    struct timespec deadline;
+    int have_deadline = 0;
+    int waited = 0;
+    unsigned int tail, head, size;
+
+    if (!list)
+        return -1;
+    if (LOAD_RLX(&list->closed)) {
+        INC_RLX(&list->dropped);
+        return -1;
+    }
+
+    tail = LOAD_RLX(&list->tail);
+    for (;;) {
+        head = LOAD_ACQ(&list->head);
+        if (tail - head < list->count)
+            break;
+
+        if (list->policy == CIRCULAR_LIST_DROP_OLDEST) {
+            drop_oldest(list, head);
+            continue;
+        }
+        if (list->policy == CIRCULAR_LIST_DROP_NON_REF && droppable) {
+            INC_RLX(&list->dropped);
+            return CIRCULAR_LIST_REFUSED_DROPPABLE;
+        }
+        if (timeout_ms == 0) {
+            INC_RLX(&list->dropped);
+            return -1;
+        }
+
+        if (!waited) {
+            waited = 1;
+            INC_RLX(&list->blocked);
+        }
+        if (timeout_ms > 0 && !have_deadline) {
+            make_deadline(&deadline, timeout_ms);
+            have_deadline = 1;
+        }
+        if (wait_for(list, &list->producer_waiting, &list->not_full, is_not_full,
+                     have_deadline ? &deadline : NULL) < 0) {
+            INC_RLX(&list->dropped);
+            return -1;
+        }
+    }
+
+    memcpy(slot(list, tail), element, list->element_size);
+    STORE_REL(&list->tail, tail + 1);
+    INC_RLX(&list->enqueued);
+
+    size = tail + 1 - head;
+    if (size > LOAD_RLX(&list->high_water))
+        __atomic_store_n(&list->high_water, size, __ATOMIC_RELAXED);
+
+    notify(list, &list->consumer_waiting, &list->not_empty);
+    return 0;
+}
+
+CAPI int CircularList_Pop(CircularList *list, void *element, int timeout_ms) {
+    struct timespec deadline;
+    int have_deadline = 0;
+    unsigned int head, tail;
+
+    if (!list)
+        return -1;
+
+    for (;;) {
+        head = LOAD_ACQ(&list->head);
+        tail = LOAD_ACQ(&list->tail);
+        if (head != tail) {
+            memcpy(element, slot(list, head), list->element_size);
+            // fails only if the producer discarded this element meanwhile
+            if (__atomic_compare_exchange_n(&list->head, &head, head + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+
+        if (timeout_ms == 0 || LOAD_RLX(&list->closed))
+            return -1;
+        if (timeout_ms > 0 && !have_deadline) {
+            make_deadline(&deadline, timeout_ms);
+            have_deadline = 1;
+        }
+        if (wait_for(list, &list->consumer_waiting, &list->not_empty, is_not_empty,
+                     have_deadline ? &deadline : NULL) < 0)
+            return -1;
+    }
+
+    INC_RLX(&list->dequeued);
+    notify(list, &list->producer_waiting, &list->not_full);
+    return 0;
+}
+
+CAPI void CircularList_Close(CircularList *list) {
+    if (list) {
+        pthread_mutex_lock(&list->lock);
+        __atomic_store_n(&list->closed, 1, __ATOMIC_RELAXED);
+        pthread_cond_broadcast(&list->not_empty);
+        pthread_cond_broadcast(&list->not_full);
+        pthread_mutex_unlock(&list->lock);
+    }
+}
+
+CAPI unsigned int CircularList_Size(CircularList *list) {
+    unsigned int head, tail;
+    if (!list)
+        return 0;
+    head = LOAD_ACQ(&list->head);
+    tail = LOAD_ACQ(&list->tail);
+    return tail - head;
+}
+
+CAPI unsigned int CircularList_Capacity(CircularList *list) {
+    return list ? list->count : 0;
+}
+
+CAPI void CircularList_GetStats(CircularList *list, CircularListStats *stats) {
+    if (!list || !stats)
+        return;
+    stats->enqueued = LOAD_RLX(&list->enqueued);
+    stats->dequeued = LOAD_RLX(&list->dequeued);
+    stats->dropped = LOAD_RLX(&list->dropped);
+    stats->blocked = LOAD_RLX(&list->blocked);
+    stats->size = CircularList_Size(list);
+    stats->high_water = LOAD_RLX(&list->high_water);
 }
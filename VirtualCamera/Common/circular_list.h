@@ -1,33 +1,67 @@
 #ifndef __CIRULAR_LIST_H__
 #define __CIRULAR_LIST_H__
 
-typedef struct stCircularList       CircularList;
-typedef struct stCircularListNode   CircularListNode;
-
-struct stCircularListNode {
-    void *data;
-    CircularListNode *prev;
-    CircularListNode *next;
-    unsigned int index;
-};
-
-struct stCircularList {
-    CircularListNode *nodes;
-    void *pool;
-    unsigned int count;
-    unsigned int element_size;
-};
-
-#ifndef CAPI
-#ifdef __cplusplus
-#define CAPI extern "C"
-#else
-#define CAPI
-#endif
-#endif
+#include "common.h"
 
+// Bounded single-producer/single-consumer ring of fixed size elements.
+//
+// Elements are copied in by CircularList_Push and out by CircularList_Pop, so
+// a slot is free again as soon as it has been popped. Indices are published
+// with acquire/release atomics; a side that has to wait sleeps on a condition
+// variable and is woken by the other side, nobody polls.
+//
+// Exactly one thread may push and one thread may pop.
+
+typedef struct stCircularList CircularList;
+
+typedef enum {
+    CIRCULAR_LIST_BLOCK = 0,        // wait for room, up to the push timeout
+    CIRCULAR_LIST_DROP_OLDEST,      // discard the oldest queued element
+    CIRCULAR_LIST_DROP_NON_REF,     // discard the new element if it is droppable, else wait
+} CircularListPolicy;
+
+typedef struct stCircularListStats {
+    u64 enqueued;
+    u64 dequeued;
+    u64 dropped;                    // refused pushes and discarded elements
+    u64 blocked;                    // pushes that had to wait for room
+    unsigned int size;              // elements queued right now
+    unsigned int high_water;
+} CircularListStats;
+
+// Called on the producer thread with a copy of every element the ring discards
+// on its own (DROP_OLDEST). Refused pushes are not reported, the caller still
+// owns what it tried to push.
+typedef void (*circular_list_drop_callback)(void *userdata, void *element);
+
+// count is rounded up to a power of two.
 CAPI CircularList* CircularList_Create(unsigned int count, unsigned int element_size);
 CAPI void CircularList_Destroy(CircularList *list);
+// Empties and reopens the ring and clears the counters; neither side may be active.
 CAPI void CircularList_Reset(CircularList *list);
 
+CAPI void CircularList_SetPolicy(CircularList *list, CircularListPolicy policy,
+                                 circular_list_drop_callback on_drop, void *userdata);
+
+// timeout_ms < 0 waits until there is room or the ring is closed.
+// droppable marks an element DROP_NON_REF may refuse without waiting.
+// Returns 0 when queued, CIRCULAR_LIST_REFUSED_DROPPABLE when DROP_NON_REF
+// refused a droppable element on a full ring, -1 when otherwise refused (full
+// or closed).
+#define CIRCULAR_LIST_REFUSED_DROPPABLE (-2)
+CAPI int CircularList_Push(CircularList *list, const void *element, int droppable, int timeout_ms);
+
+// timeout_ms < 0 waits until an element arrives or the ring is closed.
+// Returns 0 with the element copied out, -1 if none arrived in time. A closed
+// ring still hands out what is queued.
+CAPI int CircularList_Pop(CircularList *list, void *element, int timeout_ms);
+
+// Wakes both sides and makes every later wait return at once; pushes are
+// refused from then on. Used on shutdown, CircularList_Reset reopens the ring.
+CAPI void CircularList_Close(CircularList *list);
+
+CAPI unsigned int CircularList_Size(CircularList *list);
+CAPI unsigned int CircularList_Capacity(CircularList *list);
+CAPI void CircularList_GetStats(CircularList *list, CircularListStats *stats);
+
 #endif // __CIRULAR_LIST_H__
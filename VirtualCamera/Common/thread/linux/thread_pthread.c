@@ -1,6 +1,14 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
 #include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include "../thread.h"
 
@@ -9,11 +17,100 @@ struct stThread {
     thread_func func;
     void *userdata;
     pthread_attr_t attr;
+    int has_sched;
+    ThreadSched sched;
+    pthread_mutex_t lock;       // guards what follows
+    pid_t tid;
+    int finished;
+    ThreadSchedStats stats;     // the counters are filled in once the thread returns
 };
 
+static void sReadSchedCounters(pid_t tid, ThreadSchedStats *stats) {
+    char path[64];
+    char line[128];
+    unsigned long long run, wait, slices, count;
+    FILE *f;
+
+    // "<on cpu ns> <waiting on a runqueue ns> <timeslices>"
+    snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", (int)tid);
+    if ((f = fopen(path, "r")) != NULL) {
+        if (fscanf(f, "%llu %llu %llu", &run, &wait, &slices) == 3) {
+            stats->run_delay_ns = wait;
+            stats->timeslices = slices;
+        }
+        fclose(f);
+    }
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)tid);
+    if ((f = fopen(path, "r")) != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (sscanf(line, "voluntary_ctxt_switches: %llu", &count) == 1) {
+                stats->voluntary_switches = count;
+            } else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu", &count) == 1) {
+                stats->involuntary_switches = count;
+            }
+        }
+        fclose(f);
+    }
+}
+
+// Runs on the new thread, before its function.
+static void sApplySched(RTPThread *thread) {
+    ThreadSchedStats *stats = &(thread->stats);
+    const ThreadSched *sched = &(thread->sched);
+    struct sched_param param;
+    int policy;
+
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+        stats->policy = policy;
+        stats->priority = param.sched_priority;
+    }
+    if (thread->has_sched) {
+        if (sched->cpus != 0) {
+            cpu_set_t set;
+            int cpu;
+            CPU_ZERO(&set);
+            for (cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; cpu++) {
+                if (sched->cpus & (1ULL << cpu)) {
+                    CPU_SET(cpu, &set);
+                }
+            }
+            if (sched_setaffinity(0, sizeof(set), &set) == 0) {
+                stats->cpus = sched->cpus;
+            }
+        }
+        param.sched_priority = sched->priority;
+        if ((sched->policy == SCHED_FIFO || sched->policy == SCHED_RR)
+                && pthread_setschedparam(pthread_self(), sched->policy, &param) == 0) {
+            stats->policy = sched->policy;
+            stats->priority = sched->priority;
+        } else {
+            // asked for, or refused CAP_SYS_NICE (EPERM) for a real-time policy
+            param.sched_priority = 0;
+            if (stats->policy != SCHED_OTHER && pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0) {
+                stats->policy = SCHED_OTHER;
+                stats->priority = 0;
+            }
+            // a nice value below the current one may be refused as well
+            setpriority(PRIO_PROCESS, thread->tid, sched->nice);
+        }
+    }
+    stats->nice = getpriority(PRIO_PROCESS, thread->tid);
+}
+
 static void* pthread_func(void *userdata) {
     RTPThread* thread = (RTPThread*)userdata;
+    pthread_mutex_lock(&(thread->lock));
+    thread->tid = (pid_t)syscall(SYS_gettid);
+    sApplySched(thread);
+    pthread_mutex_unlock(&(thread->lock));
+
     thread->func(thread->userdata);
+
+    // the task's /proc entries go away with it
+    pthread_mutex_lock(&(thread->lock));
+    sReadSchedCounters(thread->tid, &(thread->stats));
+    thread->finished = 1;
+    pthread_mutex_unlock(&(thread->lock));
     return NULL;
 }
 
@@ -29,6 +126,12 @@ CAPI RTPThread* Thread_Create(thread_func func, void *userdata) {
         t->t = 0;
         t->func = func;
         t->userdata = userdata;
+        t->has_sched = 0;
+        memset(&(t->sched), 0, sizeof(t->sched));
+        pthread_mutex_init(&(t->lock), NULL);
+        t->tid = 0;
+        t->finished = 0;
+        memset(&(t->stats), 0, sizeof(t->stats));
         
         ok = 1;
     } while (0);
@@ -42,20 +145,50 @@ CAPI RTPThread* Thread_Create(thread_func func, void *userdata) {
     
 }
 
+CAPI int Thread_SetSched(RTPThread *t, const ThreadSched *sched) {
+    if (!t || !sched || t->t != 0) {
+        return -1;
+    }
+    if (sched->policy != SCHED_OTHER && sched->policy != SCHED_FIFO && sched->policy != SCHED_RR) {
+        return -1;
+    }
+    t->sched = *sched;
+    t->has_sched = 1;
+    return 0;
+}
+
 CAPI int Thread_Run(RTPThread *t) {
     int r = 0;
     if (t && t->t == 0) {
-        struct sched_param param;
+        pthread_mutex_lock(&(t->lock));
+        t->tid = 0;
+        t->finished = 0;
+        memset(&(t->stats), 0, sizeof(t->stats));
+        pthread_mutex_unlock(&(t->lock));
+        // the scheduling is set by the thread itself (sApplySched), so a
+        // refused real-time policy can fall back instead of failing the start
         pthread_attr_init(&(t->attr));
-        int policy = SCHED_RR;
-        pthread_attr_setschedpolicy(&(t->attr), policy);
-        param.sched_priority = (sched_get_priority_max(policy) + sched_get_priority_min(policy))/3;
-        pthread_attr_setschedparam(&(t->attr), &param);
         r = pthread_create(&(t->t), &(t->attr), pthread_func, t);
     }
     return r;
 }
 
+CAPI int Thread_GetSchedStats(RTPThread *t, ThreadSchedStats *stats) {
+    int r = -1;
+    if (t && stats) {
+        pthread_mutex_lock(&(t->lock));
+        if (t->tid != 0) {
+            *stats = t->stats;
+            if (!t->finished) {
+                sReadSchedCounters(t->tid, stats);
+            }
+            r = 0;
+        }
+        pthread_mutex_unlock(&(t->lock));
+    }
+    return r;
+}
+
 CAPI void Thread_Join(RTPThread *t) {
     if (t && t->t) {
         pthread_join(t->t, NULL);
@@ -67,6 +200,7 @@ CAPI void Thread_Join(RTPThread *t) {
 CAPI void Thread_Destroy(RTPThread *t) {
     if (t) {
         Thread_Join(t);
+        pthread_mutex_destroy(&(t->lock));
         free(t);
     }
 }
@@ -12,4 +12,33 @@ CAPI void Thread_Join(RTPThread *t);
 CAPI void Thread_Detach(RTPThread *t);
 CAPI void Thread_Destroy(RTPThread *t);
 
+// How a thread schedules itself once it starts. The policy is one of
+// SCHED_OTHER, SCHED_FIFO and SCHED_RR from <sched.h>; a real-time policy the
+// process is not allowed to use falls back to SCHED_OTHER at the nice value.
+typedef struct stThreadSched {
+    int policy;
+    int priority;               // real-time priority, SCHED_FIFO and SCHED_RR only
+    int nice;                   // SCHED_OTHER, and the fallback for a refused real-time policy
+    u64 cpus;                   // CPUs to run on, bit 0 for CPU 0; 0 leaves the affinity alone
+} ThreadSched;
+
+// Sets the scheduling of a thread not running yet; without it a thread
+// inherits the scheduling of the one calling Thread_Run.
+CAPI int Thread_SetSched(RTPThread *t, const ThreadSched *sched);
+
+// What the thread got, and how long it spent runnable but waiting for a CPU
+// (the kernel's schedstat run delay). Counts are live while the thread runs
+// and final once it has returned.
+typedef struct stThreadSchedStats {
+    int policy;                 // as applied, after any fallback
+    int priority;
+    int nice;
+    u64 cpus;                   // 0 when the affinity was left alone
+    u64 run_delay_ns;           // time runnable but waiting for a CPU
+    u64 timeslices;             // times the thread got a CPU
+    u64 voluntary_switches;     // blocked (waited for data, a lock, ...)
+    u64 involuntary_switches;   // preempted while it still had work
+} ThreadSchedStats;
+CAPI int Thread_GetSchedStats(RTPThread *t, ThreadSchedStats *stats);
+
 #endif // __SIMPLE_THREAD_H__
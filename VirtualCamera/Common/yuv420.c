@@ -0,0 +1,55 @@
+#include <memory.h>
+#include "yuv420.h"
+
+static void copy_plane(const u8 *src, int src_stride, u8 *dst, int dst_stride, int width, int height) {
+    int i;
+    if (src_stride == width && dst_stride == width) {
+        memcpy(dst, src, (size_t)width * height);
+        return;
+    }
+    for (i = 0; i < height; i++) {
+        memcpy(dst, src, (size_t)width);
+        src += src_stride;
+        dst += dst_stride;
+    }
+}
+
+CAPI void Yuv420_Copy(const Yuv420Planes *src, const Yuv420Planes *dst, int width, int height) {
+    int cw = (width + 1) / 2;
+    int ch = (height + 1) / 2;
+    int i, j;
+
+    if (!src || !dst || width <= 0 || height <= 0)
+        return;
+
+    copy_plane(src->y, src->y_stride, dst->y, dst->y_stride, width, height);
+
+    if (src->c_step == 1 && dst->c_step == 1) {
+        copy_plane(src->cb, src->c_stride, dst->cb, dst->c_stride, cw, ch);
+        copy_plane(src->cr, src->c_stride, dst->cr, dst->c_stride, cw, ch);
+        return;
+    }
+
+    if (src->c_step == 2 && dst->c_step == 2 && (src->cr - src->cb) == (dst->cr - dst->cb)) {
+        // same interleave order, the chroma plane is copied as one
+        const u8 *s = src->cb < src->cr ? src->cb : src->cr;
+        u8 *d = dst->cb < dst->cr ? dst->cb : dst->cr;
+        copy_plane(s, src->c_stride, d, dst->c_stride, cw * 2, ch);
+        return;
+    }
+
+    for (j = 0; j < ch; j++) {
+        const u8 *scb = src->cb + (size_t)j * src->c_stride;
+        const u8 *scr = src->cr + (size_t)j * src->c_stride;
+        u8 *dcb = dst->cb + (size_t)j * dst->c_stride;
+        u8 *dcr = dst->cr + (size_t)j * dst->c_stride;
+        for (i = 0; i < cw; i++) {
+            *dcb = *scb;
+            *dcr = *scr;
+            scb += src->c_step;
+            scr += src->c_step;
+            dcb += dst->c_step;
+            dcr += dst->c_step;
+        }
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef __YUV420_H__
+#define __YUV420_H__
+
+#include "common.h"
+
+// One 4:2:0 image as three plane pointers, laid out like android_ycbcr:
+// c_step is 1 for planar (I420/YV12) and 2 for semi-planar (NV12/NV21), in
+// which case cb and cr point into the same interleaved plane.
+typedef struct stYuv420Planes {
+    u8 *y;
+    u8 *cb;
+    u8 *cr;
+    int y_stride;
+    int c_stride;
+    int c_step;
+} Yuv420Planes;
+
+// Copies width x height pixels between any two 4:2:0 layouts; rows are
+// copied whole when the chroma layouts match, otherwise the chroma samples
+// are (de)interleaved.
+CAPI void Yuv420_Copy(const Yuv420Planes *src, const Yuv420Planes *dst, int width, int height);
+
+#endif // __YUV420_H__
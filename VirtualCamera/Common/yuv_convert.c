@@ -0,0 +1,196 @@
+#include <pthread.h>
+#include <stddef.h>
+#include "yuv_convert_priv.h"
+
+typedef struct stYuvConvertKernels {
+    YuvConvertIsa isa;
+    yuv_rgba_to_yuv_rows rgba_to_yuv;
+    yuv_yuv_to_rgba_row yuv_to_rgba;
+} YuvConvertKernels;
+
+static const YuvConvertKernels s_kernels_c = { YUV_CONVERT_ISA_C, NULL, NULL };
+#ifdef YUV_CONVERT_HAVE_X86
+static const YuvConvertKernels s_kernels_sse2 = {
+    YUV_CONVERT_ISA_SSE2, yuv_rgba_to_yuv_rows_sse2, yuv_yuv_to_rgba_row_sse2
+};
+static const YuvConvertKernels s_kernels_avx2 = {
+    YUV_CONVERT_ISA_AVX2, yuv_rgba_to_yuv_rows_avx2, yuv_yuv_to_rgba_row_avx2
+};
+#endif
+#ifdef YUV_CONVERT_HAVE_NEON
+static const YuvConvertKernels s_kernels_neon = {
+    YUV_CONVERT_ISA_NEON, yuv_rgba_to_yuv_rows_neon, yuv_yuv_to_rgba_row_neon
+};
+#endif
+
+static const YuvToRgbCoeffs s_video_range = { 16, 75, 102, 25, 52, 129 };
+static const YuvToRgbCoeffs s_full_range = { 0, 64, 90, 22, 46, 113 };
+
+static const YuvConvertKernels *s_kernels = NULL;
+static pthread_once_t s_kernels_once = PTHREAD_ONCE_INIT;
+
+static const YuvConvertKernels* kernels_for(YuvConvertIsa isa) {
+    switch (isa) {
+    case YUV_CONVERT_ISA_C:
+        return &s_kernels_c;
+#ifdef YUV_CONVERT_HAVE_X86
+    case YUV_CONVERT_ISA_SSE2:
+#if defined(__i386__)
+        if (!__builtin_cpu_supports("sse2"))
+            return NULL;
+#endif
+        return &s_kernels_sse2;
+    case YUV_CONVERT_ISA_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? &s_kernels_avx2 : NULL;
+#endif
+#ifdef YUV_CONVERT_HAVE_NEON
+    // compiled in only when the target ABI guarantees NEON
+    case YUV_CONVERT_ISA_NEON:
+        return &s_kernels_neon;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static const YuvConvertKernels* best_kernels(void) {
+    static const YuvConvertIsa order[] = {
+        YUV_CONVERT_ISA_AVX2, YUV_CONVERT_ISA_SSE2, YUV_CONVERT_ISA_NEON
+    };
+    const YuvConvertKernels *k;
+    unsigned int i;
+    for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        k = kernels_for(order[i]);
+        if (k)
+            return k;
+    }
+    return &s_kernels_c;
+}
+
+static void init_kernels(void) {
+    __atomic_store_n(&s_kernels, best_kernels(), __ATOMIC_RELEASE);
+}
+
+static const YuvConvertKernels* get_kernels(void) {
+    pthread_once(&s_kernels_once, init_kernels);
+    return __atomic_load_n(&s_kernels, __ATOMIC_ACQUIRE);
+}
+
+static inline u8 clamp_u8(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : (u8)v);
+}
+
+static inline u8 rgb_to_y(const u8 *p) {
+    return (u8)((YUV_Y_R * p[0] + YUV_Y_G * p[1] + YUV_Y_B * p[2] + 128) >> 8);
+}
+
+// Starts at column x (even) and replicates the last column of an odd width;
+// y1 is NULL for the last row of an odd height, rgba1 then equals rgba0.
+static void rgba_to_yuv_rows_c(const u8 *rgba0, const u8 *rgba1, u8 *y0, u8 *y1,
+                               u8 *cb, u8 *cr, int c_step, int x, int width) {
+    for (; x < width; x += 2) {
+        const u8 *p0 = rgba0 + (size_t)x * 4;
+        const u8 *p1 = rgba1 + (size_t)x * 4;
+        int n = x + 1 < width ? 4 : 0;
+        int r = (p0[0] + p0[n] + p1[0] + p1[n] + 2) >> 2;
+        int g = (p0[1] + p0[n + 1] + p1[1] + p1[n + 1] + 2) >> 2;
+        int b = (p0[2] + p0[n + 2] + p1[2] + p1[n + 2] + 2) >> 2;
+        int c = (x / 2) * c_step;
+
+        y0[x] = rgb_to_y(p0);
+        if (n)
+            y0[x + 1] = rgb_to_y(p0 + 4);
+        if (y1) {
+            y1[x] = rgb_to_y(p1);
+            if (n)
+                y1[x + 1] = rgb_to_y(p1 + 4);
+        }
+        cb[c] = (u8)(((YUV_CB_R * r + YUV_CB_G * g + YUV_CB_B * b + 128) >> 8) + 128);
+        cr[c] = (u8)(((YUV_CR_R * r + YUV_CR_G * g + YUV_CR_B * b + 128) >> 8) + 128);
+    }
+}
+
+static void yuv_to_rgba_row_c(const u8 *y, const u8 *cb, const u8 *cr, int c_step,
+                              u8 *rgba, int x, int width, const YuvToRgbCoeffs *k) {
+    u8 *d = rgba + (size_t)x * 4;
+    for (; x < width; x++) {
+        int u = cb[(x / 2) * c_step] - 128;
+        int v = cr[(x / 2) * c_step] - 128;
+        int c = (y[x] - k->y_off) * k->y_mul + 32;
+        d[0] = clamp_u8((c + k->v_r * v) >> 6);
+        d[1] = clamp_u8((c - k->u_g * u - k->v_g * v) >> 6);
+        d[2] = clamp_u8((c + k->u_b * u) >> 6);
+        d[3] = 255;
+        d += 4;
+    }
+}
+
+CAPI void YuvConvert_RgbaToYuv420(const u8 *rgba, int rgba_stride, const Yuv420Planes *dst,
+                                  int width, int height) {
+    const YuvConvertKernels *k = get_kernels();
+    int j, x;
+
+    if (!rgba || !dst || width <= 0 || height <= 0)
+        return;
+
+    for (j = 0; j < height; j += 2) {
+        const u8 *row0 = rgba + (size_t)j * rgba_stride;
+        const u8 *row1 = j + 1 < height ? row0 + rgba_stride : row0;
+        u8 *y0 = dst->y + (size_t)j * dst->y_stride;
+        u8 *y1 = j + 1 < height ? y0 + dst->y_stride : NULL;
+        u8 *cb = dst->cb + (size_t)(j / 2) * dst->c_stride;
+        u8 *cr = dst->cr + (size_t)(j / 2) * dst->c_stride;
+
+        x = 0;
+        if (k->rgba_to_yuv && y1)
+            x = k->rgba_to_yuv(row0, row1, y0, y1, cb, cr, dst->c_step, width);
+        rgba_to_yuv_rows_c(row0, row1, y0, y1, cb, cr, dst->c_step, x, width);
+    }
+}
+
+CAPI void YuvConvert_Yuv420ToRgba(const Yuv420Planes *src, int full_range, u8 *rgba, int rgba_stride,
+                                  int width, int height) {
+    const YuvConvertKernels *k = get_kernels();
+    const YuvToRgbCoeffs *coeffs = full_range ? &s_full_range : &s_video_range;
+    int j, x;
+
+    if (!src || !rgba || width <= 0 || height <= 0)
+        return;
+
+    for (j = 0; j < height; j++) {
+        const u8 *y = src->y + (size_t)j * src->y_stride;
+        const u8 *cb = src->cb + (size_t)(j / 2) * src->c_stride;
+        const u8 *cr = src->cr + (size_t)(j / 2) * src->c_stride;
+        u8 *d = rgba + (size_t)j * rgba_stride;
+
+        x = 0;
+        if (k->yuv_to_rgba)
+            x = k->yuv_to_rgba(y, cb, cr, src->c_step, d, width, coeffs);
+        yuv_to_rgba_row_c(y, cb, cr, src->c_step, d, x, width, coeffs);
+    }
+}
+
+CAPI int YuvConvert_SetIsa(YuvConvertIsa isa) {
+    const YuvConvertKernels *k = isa == YUV_CONVERT_ISA_AUTO ? best_kernels() : kernels_for(isa);
+    if (!k)
+        return -1;
+    pthread_once(&s_kernels_once, init_kernels);
+    __atomic_store_n(&s_kernels, k, __ATOMIC_RELEASE);
+    return 0;
+}
+
+CAPI YuvConvertIsa YuvConvert_GetIsa(void) {
+    return get_kernels()->isa;
+}
+
+CAPI const char* YuvConvert_IsaName(YuvConvertIsa isa) {
+    switch (isa) {
+    case YUV_CONVERT_ISA_AUTO: return "auto";
+    case YUV_CONVERT_ISA_C:    return "c";
+    case YUV_CONVERT_ISA_SSE2: return "sse2";
+    case YUV_CONVERT_ISA_AVX2: return "avx2";
+    case YUV_CONVERT_ISA_NEON: return "neon";
+    default:                   return "unknown";
+    }
+}
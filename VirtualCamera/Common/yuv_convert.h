@@ -0,0 +1,38 @@
+#ifndef __YUV_CONVERT_H__
+#define __YUV_CONVERT_H__
+
+#include "yuv420.h"
+
+// RGBA <-> YUV 4:2:0 colour conversion, BT.601.
+//
+// The destination or source layout (I420, YV12, NV12, NV21) is whatever the
+// Yuv420Planes describe. Every function has a plain C kernel and SIMD kernels
+// (SSE2 and AVX2 on x86, NEON on ARM); the fastest one the CPU supports is
+// picked on first use. All kernels produce bit-identical output.
+//
+// RGBA -> YUV writes full range (JFIF) YUV, the layout camera clients expect
+// from NV21 and YCbCr_420_888; each chroma sample is the average of its 2x2
+// pixels. YUV -> RGBA takes either range and upsamples chroma by repetition.
+
+typedef enum {
+    YUV_CONVERT_ISA_AUTO = 0,
+    YUV_CONVERT_ISA_C,
+    YUV_CONVERT_ISA_SSE2,
+    YUV_CONVERT_ISA_AVX2,
+    YUV_CONVERT_ISA_NEON,
+} YuvConvertIsa;
+
+CAPI void YuvConvert_RgbaToYuv420(const u8 *rgba, int rgba_stride, const Yuv420Planes *dst,
+                                  int width, int height);
+
+CAPI void YuvConvert_Yuv420ToRgba(const Yuv420Planes *src, int full_range, u8 *rgba, int rgba_stride,
+                                  int width, int height);
+
+// Forces a kernel set, for tests and benchmarks; AUTO goes back to the best
+// supported one. Returns -1 if the CPU or the build does not support isa.
+// Not thread safe against conversions running at the same time.
+CAPI int YuvConvert_SetIsa(YuvConvertIsa isa);
+CAPI YuvConvertIsa YuvConvert_GetIsa(void);
+CAPI const char* YuvConvert_IsaName(YuvConvertIsa isa);
+
+#endif // __YUV_CONVERT_H__
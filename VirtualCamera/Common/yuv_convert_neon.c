@@ -0,0 +1,116 @@
+#include "yuv_convert_priv.h"
+
+#ifdef YUV_CONVERT_HAVE_NEON
+
+#include <arm_neon.h>
+
+// 16 pixels per step; vld4/vst4 do the RGBA (de)interleave and vld2/vst2 the
+// NV12/NV21 one.
+
+static inline uint8x16_t neon_luma(uint8x16x4_t p) {
+    uint16x8_t lo = vmull_u8(vget_low_u8(p.val[0]), vdup_n_u8(YUV_Y_R));
+    uint16x8_t hi = vmull_u8(vget_high_u8(p.val[0]), vdup_n_u8(YUV_Y_R));
+    lo = vmlal_u8(lo, vget_low_u8(p.val[1]), vdup_n_u8(YUV_Y_G));
+    hi = vmlal_u8(hi, vget_high_u8(p.val[1]), vdup_n_u8(YUV_Y_G));
+    lo = vmlal_u8(lo, vget_low_u8(p.val[2]), vdup_n_u8(YUV_Y_B));
+    hi = vmlal_u8(hi, vget_high_u8(p.val[2]), vdup_n_u8(YUV_Y_B));
+    return vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8));
+}
+
+// rounded mean of each 2x2 block
+static inline int16x8_t neon_avg2x2(uint8x16_t row0, uint8x16_t row1) {
+    return vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(row0), row1), 2));
+}
+
+static inline uint8x8_t neon_chroma(int16x8_t r, int16x8_t g, int16x8_t b, int16_t kr, int16_t kg, int16_t kb) {
+    int16x8_t c = vmulq_n_s16(r, kr);
+    c = vmlaq_n_s16(c, g, kg);
+    c = vmlaq_n_s16(c, b, kb);
+    c = vaddq_s16(vrshrq_n_s16(c, 8), vdupq_n_s16(128));
+    return vqmovun_s16(c);
+}
+
+int yuv_rgba_to_yuv_rows_neon(const u8 *rgba0, const u8 *rgba1, u8 *y0, u8 *y1,
+                              u8 *cb, u8 *cr, int c_step, int width) {
+    int x;
+    if (c_step != 1 && cr != cb + 1 && cb != cr + 1)
+        return 0;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        uint8x16x4_t p0 = vld4q_u8(rgba0 + x * 4);
+        uint8x16x4_t p1 = vld4q_u8(rgba1 + x * 4);
+        int16x8_t r, g, b;
+        uint8x8x2_t uv;
+
+        vst1q_u8(y0 + x, neon_luma(p0));
+        vst1q_u8(y1 + x, neon_luma(p1));
+
+        r = neon_avg2x2(p0.val[0], p1.val[0]);
+        g = neon_avg2x2(p0.val[1], p1.val[1]);
+        b = neon_avg2x2(p0.val[2], p1.val[2]);
+        uv.val[0] = neon_chroma(r, g, b, YUV_CB_R, YUV_CB_G, YUV_CB_B);
+        uv.val[1] = neon_chroma(r, g, b, YUV_CR_R, YUV_CR_G, YUV_CR_B);
+
+        if (c_step == 1) {
+            vst1_u8(cb + x / 2, uv.val[0]);
+            vst1_u8(cr + x / 2, uv.val[1]);
+        } else if (cr == cb + 1) {
+            vst2_u8(cb + x, uv);
+        } else {
+            uint8x8_t t = uv.val[0];
+            uv.val[0] = uv.val[1];
+            uv.val[1] = t;
+            vst2_u8(cr + x, uv);
+        }
+    }
+    return x;
+}
+
+// c + t for the 16 pixels sharing the 8 chroma terms t, narrowed with clamping
+static inline uint8x16_t neon_rgb_channel(int16x8_t c_lo, int16x8_t c_hi, int16x8_t t, int add) {
+    int16x8x2_t d = vzipq_s16(t, t);
+    int16x8_t lo = add ? vqaddq_s16(c_lo, d.val[0]) : vqsubq_s16(c_lo, d.val[0]);
+    int16x8_t hi = add ? vqaddq_s16(c_hi, d.val[1]) : vqsubq_s16(c_hi, d.val[1]);
+    return vcombine_u8(vqshrun_n_s16(lo, 6), vqshrun_n_s16(hi, 6));
+}
+
+int yuv_yuv_to_rgba_row_neon(const u8 *y, const u8 *cb, const u8 *cr, int c_step,
+                             u8 *rgba, int width, const YuvToRgbCoeffs *k) {
+    const uint8x8_t bias = vdup_n_u8(128);
+    const uint8x8_t y_off = vdup_n_u8((u8)k->y_off);
+    const int16x8_t round = vdupq_n_s16(32);
+    int x;
+    if (c_step != 1 && cr != cb + 1 && cb != cr + 1)
+        return 0;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        uint8x16_t yy = vld1q_u8(y + x);
+        uint8x8_t u8v, v8v;
+        int16x8_t u, v, c_lo, c_hi, guv;
+        uint8x16x4_t out;
+
+        if (c_step == 1) {
+            u8v = vld1_u8(cb + x / 2);
+            v8v = vld1_u8(cr + x / 2);
+        } else {
+            uint8x8x2_t pairs = vld2_u8(cb < cr ? cb + x : cr + x);
+            u8v = cb < cr ? pairs.val[0] : pairs.val[1];
+            v8v = cb < cr ? pairs.val[1] : pairs.val[0];
+        }
+        // the widening subtract wraps, read back as signed it is the difference
+        u = vreinterpretq_s16_u16(vsubl_u8(u8v, bias));
+        v = vreinterpretq_s16_u16(vsubl_u8(v8v, bias));
+        c_lo = vmlaq_n_s16(round, vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(yy), y_off)), (int16_t)k->y_mul);
+        c_hi = vmlaq_n_s16(round, vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(yy), y_off)), (int16_t)k->y_mul);
+        guv = vmlaq_n_s16(vmulq_n_s16(u, (int16_t)k->u_g), v, (int16_t)k->v_g);
+
+        out.val[0] = neon_rgb_channel(c_lo, c_hi, vmulq_n_s16(v, (int16_t)k->v_r), 1);
+        out.val[1] = neon_rgb_channel(c_lo, c_hi, guv, 0);
+        out.val[2] = neon_rgb_channel(c_lo, c_hi, vmulq_n_s16(u, (int16_t)k->u_b), 1);
+        out.val[3] = vdupq_n_u8(255);
+        vst4q_u8(rgba + x * 4, out);
+    }
+    return x;
+}
+
+#endif // YUV_CONVERT_HAVE_NEON
@@ -0,0 +1,70 @@
+#ifndef __YUV_CONVERT_PRIV_H__
+#define __YUV_CONVERT_PRIV_H__
+
+#include "yuv_convert.h"
+
+// Shared between yuv_convert.c and the SIMD kernel files only.
+//
+// RGBA -> YUV, 8 bit fixed point:
+//   Y  = ( 77 R + 150 G +  29 B + 128) >> 8
+//   Cb = ((-43 R -  84 G + 127 B + 128) >> 8) + 128
+//   Cr = ((127 R - 106 G -  21 B + 128) >> 8) + 128
+// with R, G, B of a chroma sample the rounded mean of its 2x2 pixels. 127
+// rather than 128 keeps every intermediate inside int16.
+//
+// YUV -> RGBA, 6 bit fixed point, u = Cb - 128, v = Cr - 128:
+//   c = (Y - y_off) * y_mul + 32
+//   R = (c + v_r v) >> 6,  G = (c - u_g u - v_g v) >> 6,  B = (c + u_b u) >> 6
+// clamped to 0..255. Only B can leave int16, and only when it clamps to 255
+// anyway, so the SIMD kernels may use saturating 16 bit adds.
+
+#define YUV_Y_R     77
+#define YUV_Y_G     150
+#define YUV_Y_B     29
+#define YUV_CB_R    (-43)
+#define YUV_CB_G    (-84)
+#define YUV_CB_B    127
+#define YUV_CR_R    127
+#define YUV_CR_G    (-106)
+#define YUV_CR_B    (-21)
+
+typedef struct stYuvToRgbCoeffs {
+    int y_off;
+    int y_mul;
+    int v_r;
+    int u_g;
+    int v_g;
+    int u_b;
+} YuvToRgbCoeffs;
+
+// A SIMD row kernel converts as many leading pixels as fit its vector width
+// and returns how many it did; yuv_convert.c finishes the row in C. Both
+// rgba_to_yuv rows are always present, the last row of an odd height is
+// done in C. With c_step 2 a kernel only handles cb and cr adjacent (NV12 or
+// NV21) and returns 0 otherwise.
+typedef int (*yuv_rgba_to_yuv_rows)(const u8 *rgba0, const u8 *rgba1, u8 *y0, u8 *y1,
+                                    u8 *cb, u8 *cr, int c_step, int width);
+typedef int (*yuv_yuv_to_rgba_row)(const u8 *y, const u8 *cb, const u8 *cr, int c_step,
+                                   u8 *rgba, int width, const YuvToRgbCoeffs *k);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUV_CONVERT_HAVE_X86 1
+int yuv_rgba_to_yuv_rows_sse2(const u8 *rgba0, const u8 *rgba1, u8 *y0, u8 *y1,
+                              u8 *cb, u8 *cr, int c_step, int width);
+int yuv_yuv_to_rgba_row_sse2(const u8 *y, const u8 *cb, const u8 *cr, int c_step,
+                             u8 *rgba, int width, const YuvToRgbCoeffs *k);
+int yuv_rgba_to_yuv_rows_avx2(const u8 *rgba0, const u8 *rgba1, u8 *y0, u8 *y1,
+                              u8 *cb, u8 *cr, int c_step, int width);
+int yuv_yuv_to_rgba_row_avx2(const u8 *y, const u8 *cb, const u8 *cr, int c_step,
+                             u8 *rgba, int width, const YuvToRgbCoeffs *k);
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define YUV_CONVERT_HAVE_NEON 1
+int yuv_rgba_to_yuv_rows_neon(const u8 *rgba0, const u8 *rgba1, u8 *y0, u8 *y1,
+                              u8 *cb, u8 *cr, int c_step, int width);
+int yuv_yuv_to_rgba_row_neon(const u8 *y, const u8 *cb, const u8 *cr, int c_step,
+                             u8 *rgba, int width, const YuvToRgbCoeffs *k);
+#endif
+
+#endif // __YUV_CONVERT_PRIV_H__
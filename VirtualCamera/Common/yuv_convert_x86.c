@@ -0,0 +1,303 @@
+#include "yuv_convert_priv.h"
+
+#ifdef YUV_CONVERT_HAVE_X86
+
+#include <immintrin.h>
+
+// The kernels are compiled with target attributes so the rest of the build
+// needs neither -msse2 (32 bit x86) nor -mavx2, and are only ever called after
+// yuv_convert.c checked the CPU.
+#define SSE2_FN __attribute__((target("sse2")))
+#define AVX2_FN __attribute__((target("avx2")))
+
+/* ---------------------------------------------------------------- SSE2 */
+
+// 8 RGBA pixels into R, G, B as 8 x int16
+static inline SSE2_FN void sse2_load_rgb(const u8 *p, __m128i *r, __m128i *g, __m128i *b) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i c = _mm_loadu_si128((const __m128i *)(p + 16));
+    *r = _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(c, mask));
+    *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask), _mm_and_si128(_mm_srli_epi32(c, 8), mask));
+    *b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask), _mm_and_si128(_mm_srli_epi32(c, 16), mask));
+}
+
+// the sum reaches 65408, fine as unsigned 16 bit with a logical shift
+static inline SSE2_FN __m128i sse2_luma(__m128i r, __m128i g, __m128i b) {
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(YUV_Y_R)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(YUV_Y_G)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(YUV_Y_B)));
+    return _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+}
+
+static inline SSE2_FN __m128i sse2_chroma(__m128i r, __m128i g, __m128i b, int kr, int kg, int kb) {
+    __m128i c = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)), _mm_mullo_epi16(g, _mm_set1_epi16(kg)));
+    c = _mm_add_epi16(c, _mm_mullo_epi16(b, _mm_set1_epi16(kb)));
+    c = _mm_srai_epi16(_mm_add_epi16(c, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(c, _mm_set1_epi16(128));
+}
+
+// two rows of 8 pixels into 4 chroma averages of 2x2
+static inline SSE2_FN __m128i sse2_avg2x2(__m128i row0, __m128i row1) {
+    return _mm_madd_epi16(_mm_add_epi16(row0, row1), _mm_set1_epi16(1));
+}
+
+SSE2_FN int yuv_rgba_to_yuv_rows_sse2(const u8 *rgba0, const u8 *rgba1, u8 *y0, u8 *y1,
+                                      u8 *cb, u8 *cr, int c_step, int width) {
+    int x;
+    if (c_step != 1 && cr != cb + 1 && cb != cr + 1)
+        return 0;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i r0l, g0l, b0l, r0h, g0h, b0h, r1l, g1l, b1l, r1h, g1h, b1h;
+        __m128i r, g, b, u, v;
+        sse2_load_rgb(rgba0 + x * 4, &r0l, &g0l, &b0l);
+        sse2_load_rgb(rgba0 + x * 4 + 32, &r0h, &g0h, &b0h);
+        sse2_load_rgb(rgba1 + x * 4, &r1l, &g1l, &b1l);
+        sse2_load_rgb(rgba1 + x * 4 + 32, &r1h, &g1h, &b1h);
+
+        _mm_storeu_si128((__m128i *)(y0 + x),
+                         _mm_packus_epi16(sse2_luma(r0l, g0l, b0l), sse2_luma(r0h, g0h, b0h)));
+        _mm_storeu_si128((__m128i *)(y1 + x),
+                         _mm_packus_epi16(sse2_luma(r1l, g1l, b1l), sse2_luma(r1h, g1h, b1h)));
+
+        r = _mm_packs_epi32(sse2_avg2x2(r0l, r1l), sse2_avg2x2(r0h, r1h));
+        g = _mm_packs_epi32(sse2_avg2x2(g0l, g1l), sse2_avg2x2(g0h, g1h));
+        b = _mm_packs_epi32(sse2_avg2x2(b0l, b1l), sse2_avg2x2(b0h, b1h));
+        r = _mm_srli_epi16(_mm_add_epi16(r, _mm_set1_epi16(2)), 2);
+        g = _mm_srli_epi16(_mm_add_epi16(g, _mm_set1_epi16(2)), 2);
+        b = _mm_srli_epi16(_mm_add_epi16(b, _mm_set1_epi16(2)), 2);
+        u = sse2_chroma(r, g, b, YUV_CB_R, YUV_CB_G, YUV_CB_B);
+        v = sse2_chroma(r, g, b, YUV_CR_R, YUV_CR_G, YUV_CR_B);
+
+        if (c_step == 1) {
+            __m128i uv = _mm_packus_epi16(u, v);
+            _mm_storel_epi64((__m128i *)(cb + x / 2), uv);
+            _mm_storel_epi64((__m128i *)(cr + x / 2), _mm_srli_si128(uv, 8));
+        } else if (cr == cb + 1) {
+            _mm_storeu_si128((__m128i *)(cb + x), _mm_or_si128(u, _mm_slli_epi16(v, 8)));
+        } else {
+            _mm_storeu_si128((__m128i *)(cr + x), _mm_or_si128(v, _mm_slli_epi16(u, 8)));
+        }
+    }
+    return x;
+}
+
+// 8 chroma samples as int16 with 128 taken off
+static inline SSE2_FN void sse2_load_uv(const u8 *cb, const u8 *cr, int c_step, __m128i *u, __m128i *v) {
+    const __m128i zero = _mm_setzero_si128();
+    if (c_step == 1) {
+        *u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)cb), zero);
+        *v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)cr), zero);
+    } else {
+        const __m128i mask = _mm_set1_epi16(0xff);
+        __m128i pairs = _mm_loadu_si128((const __m128i *)(cb < cr ? cb : cr));
+        __m128i lo = _mm_and_si128(pairs, mask);
+        __m128i hi = _mm_srli_epi16(pairs, 8);
+        *u = cb < cr ? lo : hi;
+        *v = cb < cr ? hi : lo;
+    }
+    *u = _mm_sub_epi16(*u, _mm_set1_epi16(128));
+    *v = _mm_sub_epi16(*v, _mm_set1_epi16(128));
+}
+
+static inline SSE2_FN __m128i sse2_rgb_channel(__m128i c_lo, __m128i c_hi, __m128i t, int add) {
+    __m128i t_lo = _mm_unpacklo_epi16(t, t);
+    __m128i t_hi = _mm_unpackhi_epi16(t, t);
+    __m128i lo = add ? _mm_adds_epi16(c_lo, t_lo) : _mm_subs_epi16(c_lo, t_lo);
+    __m128i hi = add ? _mm_adds_epi16(c_hi, t_hi) : _mm_subs_epi16(c_hi, t_hi);
+    return _mm_packus_epi16(_mm_srai_epi16(lo, 6), _mm_srai_epi16(hi, 6));
+}
+
+SSE2_FN int yuv_yuv_to_rgba_row_sse2(const u8 *y, const u8 *cb, const u8 *cr, int c_step,
+                                     u8 *rgba, int width, const YuvToRgbCoeffs *k) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+    const __m128i y_off = _mm_set1_epi16(k->y_off);
+    const __m128i y_mul = _mm_set1_epi16(k->y_mul);
+    const __m128i round = _mm_set1_epi16(32);
+    int x;
+    if (c_step != 1 && cr != cb + 1 && cb != cr + 1)
+        return 0;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i u, v, yy, c_lo, c_hi, r, g, b, rg, ba;
+        u8 *d = rgba + x * 4;
+
+        sse2_load_uv(cb + (x / 2) * c_step, cr + (x / 2) * c_step, c_step, &u, &v);
+        yy = _mm_loadu_si128((const __m128i *)(y + x));
+        c_lo = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(yy, zero), y_off), y_mul);
+        c_hi = _mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(yy, zero), y_off), y_mul);
+        c_lo = _mm_add_epi16(c_lo, round);
+        c_hi = _mm_add_epi16(c_hi, round);
+
+        r = sse2_rgb_channel(c_lo, c_hi, _mm_mullo_epi16(v, _mm_set1_epi16(k->v_r)), 1);
+        g = sse2_rgb_channel(c_lo, c_hi, _mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(k->u_g)),
+                                                        _mm_mullo_epi16(v, _mm_set1_epi16(k->v_g))), 0);
+        b = sse2_rgb_channel(c_lo, c_hi, _mm_mullo_epi16(u, _mm_set1_epi16(k->u_b)), 1);
+
+        rg = _mm_unpacklo_epi8(r, g);
+        ba = _mm_unpacklo_epi8(b, alpha);
+        _mm_storeu_si128((__m128i *)d, _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(d + 16), _mm_unpackhi_epi16(rg, ba));
+        rg = _mm_unpackhi_epi8(r, g);
+        ba = _mm_unpackhi_epi8(b, alpha);
+        _mm_storeu_si128((__m128i *)(d + 32), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(d + 48), _mm_unpackhi_epi16(rg, ba));
+    }
+    return x;
+}
+
+/* ---------------------------------------------------------------- AVX2 */
+
+// Packs and unpacks work per 128 bit lane; the 0xD8 permutes put the 64 bit
+// quarters back into pixel order after a pack.
+
+// 16 RGBA pixels into R, G, B as 16 x int16, in pixel order
+static inline AVX2_FN void avx2_load_rgb(const u8 *p, __m256i *r, __m256i *g, __m256i *b) {
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    __m256i a = _mm256_loadu_si256((const __m256i *)p);
+    __m256i c = _mm256_loadu_si256((const __m256i *)(p + 32));
+    *r = _mm256_packs_epi32(_mm256_and_si256(a, mask), _mm256_and_si256(c, mask));
+    *g = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(a, 8), mask),
+                            _mm256_and_si256(_mm256_srli_epi32(c, 8), mask));
+    *b = _mm256_packs_epi32(_mm256_and_si256(_mm256_srli_epi32(a, 16), mask),
+                            _mm256_and_si256(_mm256_srli_epi32(c, 16), mask));
+    *r = _mm256_permute4x64_epi64(*r, 0xD8);
+    *g = _mm256_permute4x64_epi64(*g, 0xD8);
+    *b = _mm256_permute4x64_epi64(*b, 0xD8);
+}
+
+static inline AVX2_FN __m256i avx2_luma(__m256i r, __m256i g, __m256i b) {
+    __m256i y = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(YUV_Y_R)),
+                                 _mm256_mullo_epi16(g, _mm256_set1_epi16(YUV_Y_G)));
+    y = _mm256_add_epi16(y, _mm256_mullo_epi16(b, _mm256_set1_epi16(YUV_Y_B)));
+    return _mm256_srli_epi16(_mm256_add_epi16(y, _mm256_set1_epi16(128)), 8);
+}
+
+static inline AVX2_FN __m256i avx2_chroma(__m256i r, __m256i g, __m256i b, int kr, int kg, int kb) {
+    __m256i c = _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(kr)),
+                                 _mm256_mullo_epi16(g, _mm256_set1_epi16(kg)));
+    c = _mm256_add_epi16(c, _mm256_mullo_epi16(b, _mm256_set1_epi16(kb)));
+    c = _mm256_srai_epi16(_mm256_add_epi16(c, _mm256_set1_epi16(128)), 8);
+    return _mm256_add_epi16(c, _mm256_set1_epi16(128));
+}
+
+// two rows of 16 pixels (lo) and the next 16 (hi) into 16 averages, in order
+static inline AVX2_FN __m256i avx2_avg2x2(__m256i lo0, __m256i lo1, __m256i hi0, __m256i hi1) {
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i s = _mm256_packs_epi32(_mm256_madd_epi16(_mm256_add_epi16(lo0, lo1), one),
+                                   _mm256_madd_epi16(_mm256_add_epi16(hi0, hi1), one));
+    s = _mm256_permute4x64_epi64(s, 0xD8);
+    return _mm256_srli_epi16(_mm256_add_epi16(s, _mm256_set1_epi16(2)), 2);
+}
+
+AVX2_FN int yuv_rgba_to_yuv_rows_avx2(const u8 *rgba0, const u8 *rgba1, u8 *y0, u8 *y1,
+                                      u8 *cb, u8 *cr, int c_step, int width) {
+    int x;
+    if (c_step != 1 && cr != cb + 1 && cb != cr + 1)
+        return 0;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m256i r0l, g0l, b0l, r0h, g0h, b0h, r1l, g1l, b1l, r1h, g1h, b1h;
+        __m256i r, g, b, u, v, luma;
+        avx2_load_rgb(rgba0 + x * 4, &r0l, &g0l, &b0l);
+        avx2_load_rgb(rgba0 + x * 4 + 64, &r0h, &g0h, &b0h);
+        avx2_load_rgb(rgba1 + x * 4, &r1l, &g1l, &b1l);
+        avx2_load_rgb(rgba1 + x * 4 + 64, &r1h, &g1h, &b1h);
+
+        luma = _mm256_packus_epi16(avx2_luma(r0l, g0l, b0l), avx2_luma(r0h, g0h, b0h));
+        _mm256_storeu_si256((__m256i *)(y0 + x), _mm256_permute4x64_epi64(luma, 0xD8));
+        luma = _mm256_packus_epi16(avx2_luma(r1l, g1l, b1l), avx2_luma(r1h, g1h, b1h));
+        _mm256_storeu_si256((__m256i *)(y1 + x), _mm256_permute4x64_epi64(luma, 0xD8));
+
+        r = avx2_avg2x2(r0l, r1l, r0h, r1h);
+        g = avx2_avg2x2(g0l, g1l, g0h, g1h);
+        b = avx2_avg2x2(b0l, b1l, b0h, b1h);
+        u = avx2_chroma(r, g, b, YUV_CB_R, YUV_CB_G, YUV_CB_B);
+        v = avx2_chroma(r, g, b, YUV_CR_R, YUV_CR_G, YUV_CR_B);
+
+        if (c_step == 1) {
+            __m256i uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(u, v), 0xD8);
+            _mm_storeu_si128((__m128i *)(cb + x / 2), _mm256_castsi256_si128(uv));
+            _mm_storeu_si128((__m128i *)(cr + x / 2), _mm256_extracti128_si256(uv, 1));
+        } else if (cr == cb + 1) {
+            _mm256_storeu_si256((__m256i *)(cb + x), _mm256_or_si256(u, _mm256_slli_epi16(v, 8)));
+        } else {
+            _mm256_storeu_si256((__m256i *)(cr + x), _mm256_or_si256(v, _mm256_slli_epi16(u, 8)));
+        }
+    }
+    return x;
+}
+
+// 16 chroma samples as int16 with 128 taken off
+static inline AVX2_FN void avx2_load_uv(const u8 *cb, const u8 *cr, int c_step, __m256i *u, __m256i *v) {
+    if (c_step == 1) {
+        *u = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)cb));
+        *v = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)cr));
+    } else {
+        __m256i pairs = _mm256_loadu_si256((const __m256i *)(cb < cr ? cb : cr));
+        __m256i lo = _mm256_and_si256(pairs, _mm256_set1_epi16(0xff));
+        __m256i hi = _mm256_srli_epi16(pairs, 8);
+        *u = cb < cr ? lo : hi;
+        *v = cb < cr ? hi : lo;
+    }
+    *u = _mm256_sub_epi16(*u, _mm256_set1_epi16(128));
+    *v = _mm256_sub_epi16(*v, _mm256_set1_epi16(128));
+}
+
+// Unpacking the chroma terms within each lane lines up with unpacking luma:
+// lo holds pixels 0-7 and 16-23, hi holds 8-15 and 24-31.
+static inline AVX2_FN __m256i avx2_rgb_channel(__m256i c_lo, __m256i c_hi, __m256i t, int add) {
+    __m256i t_lo = _mm256_unpacklo_epi16(t, t);
+    __m256i t_hi = _mm256_unpackhi_epi16(t, t);
+    __m256i lo = add ? _mm256_adds_epi16(c_lo, t_lo) : _mm256_subs_epi16(c_lo, t_lo);
+    __m256i hi = add ? _mm256_adds_epi16(c_hi, t_hi) : _mm256_subs_epi16(c_hi, t_hi);
+    return _mm256_packus_epi16(_mm256_srai_epi16(lo, 6), _mm256_srai_epi16(hi, 6));
+}
+
+AVX2_FN int yuv_yuv_to_rgba_row_avx2(const u8 *y, const u8 *cb, const u8 *cr, int c_step,
+                                     u8 *rgba, int width, const YuvToRgbCoeffs *k) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi8((char)0xff);
+    const __m256i y_off = _mm256_set1_epi16(k->y_off);
+    const __m256i y_mul = _mm256_set1_epi16(k->y_mul);
+    const __m256i round = _mm256_set1_epi16(32);
+    int x;
+    if (c_step != 1 && cr != cb + 1 && cb != cr + 1)
+        return 0;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+        __m256i u, v, yy, c_lo, c_hi, r, g, b, rg, ba, p0, p1, p2, p3;
+        u8 *d = rgba + x * 4;
+
+        avx2_load_uv(cb + (x / 2) * c_step, cr + (x / 2) * c_step, c_step, &u, &v);
+        yy = _mm256_loadu_si256((const __m256i *)(y + x));
+        c_lo = _mm256_mullo_epi16(_mm256_sub_epi16(_mm256_unpacklo_epi8(yy, zero), y_off), y_mul);
+        c_hi = _mm256_mullo_epi16(_mm256_sub_epi16(_mm256_unpackhi_epi8(yy, zero), y_off), y_mul);
+        c_lo = _mm256_add_epi16(c_lo, round);
+        c_hi = _mm256_add_epi16(c_hi, round);
+
+        r = avx2_rgb_channel(c_lo, c_hi, _mm256_mullo_epi16(v, _mm256_set1_epi16(k->v_r)), 1);
+        g = avx2_rgb_channel(c_lo, c_hi, _mm256_add_epi16(_mm256_mullo_epi16(u, _mm256_set1_epi16(k->u_g)),
+                                                           _mm256_mullo_epi16(v, _mm256_set1_epi16(k->v_g))), 0);
+        b = avx2_rgb_channel(c_lo, c_hi, _mm256_mullo_epi16(u, _mm256_set1_epi16(k->u_b)), 1);
+
+        // per lane: p0 = pixels 0-3 | 16-19, p1 = 4-7 | 20-23, p2 = 8-11 | 24-27, p3 = 12-15 | 28-31
+        rg = _mm256_unpacklo_epi8(r, g);
+        ba = _mm256_unpacklo_epi8(b, alpha);
+        p0 = _mm256_unpacklo_epi16(rg, ba);
+        p1 = _mm256_unpackhi_epi16(rg, ba);
+        rg = _mm256_unpackhi_epi8(r, g);
+        ba = _mm256_unpackhi_epi8(b, alpha);
+        p2 = _mm256_unpacklo_epi16(rg, ba);
+        p3 = _mm256_unpackhi_epi16(rg, ba);
+        _mm256_storeu_si256((__m256i *)d, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i *)(d + 32), _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256((__m256i *)(d + 64), _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256((__m256i *)(d + 96), _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    return x;
+}
+
+#endif // YUV_CONVERT_HAVE_X86
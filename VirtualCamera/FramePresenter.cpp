@@ -0,0 +1,360 @@
+#define LOG_TAG "VIRTUALCAMERA"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+
+#include <inttypes.h>
+#include <algorithm>
+
+#include <cutils/log.h>
+#include <utils/Trace.h>
+#include <system/window.h>
+
+#include <JRTPLIB/src/rtptimeutilities.h>
+#include <Common/yuv_convert.h>
+
+#include "FramePresenter.h"
+
+#define ALIGN(x, mask) ( ((x) + (mask) - 1) & ~((mask) - 1) )
+
+// how long the presenter thread may sit in dequeueBuffer before it looks at
+// mQuit again
+static const nsecs_t kDequeueTimeoutNs = 100000000LL;
+
+namespace android {
+
+static long long sNowUs() {
+    jrtplib::RTPTime now = jrtplib::RTPTime::CurrentTime();
+    return (long long)now.GetSeconds() * 1000000LL + now.GetMicroSeconds();
+}
+
+FramePresenter::FramePresenter(const char *name, LatencyHistogram *histogram) :
+        mName(name),
+        mConvertCounter(String8::format("VirtualCamera %s convert us", name)),
+        mHistogram(histogram),
+        mDepth(0),
+        mLastTimestampNs(0),
+        mReady(NULL),
+        mFilled(NULL),
+        mSpare(NULL),
+        mThread(NULL),
+        mQuit(1),
+        mFrames(0),
+        mPresented(0),
+        mNoBuffer(0),
+        mReplaced(0),
+        mDequeueErrors(0),
+        mErrors(0),
+        mConvertHistogram(1, 20),
+        mQueueHistogram(2, 20),
+        mCaptureHistogram(5, 20) {
+    for (int i = 0; i < kMaxDepth; i++) {
+        mSlots[i].anb = NULL;
+        mSlots[i].locked = false;
+    }
+}
+
+FramePresenter::~FramePresenter() {
+    Mutex::Autolock l(mLock);
+    stopLocked();
+    mSurface.clear();
+    CircularList_Destroy(mReady);
+    CircularList_Destroy(mFilled);
+}
+
+void FramePresenter::setWindow(const sp<Surface>& surface, int depth) {
+    Mutex::Autolock l(mLock);
+    stopLocked();
+    mSurface = surface;
+    mDepth = std::max(1, std::min(depth, (int)kMaxDepth));
+    if (mSurface != 0) {
+        ALOGD("%s presenter: %d buffers dequeued ahead", mName.c_str(), mDepth);
+        startLocked();
+    }
+}
+
+void FramePresenter::startLocked() {
+    if (!mReady) {
+        mReady = CircularList_Create(kMaxDepth, sizeof(Slot *));
+        // one pending frame: a newer one replaces it rather than queue behind it
+        mFilled = CircularList_Create(1, sizeof(Slot *));
+        CircularList_SetPolicy(mFilled, CIRCULAR_LIST_DROP_OLDEST, sOnReplaced, this);
+    }
+    CircularList_Reset(mReady);
+    CircularList_Reset(mFilled);
+
+    mSurface->setDequeueTimeout(kDequeueTimeoutNs);
+    mFree.clear();
+    for (int i = 0; i < mDepth; i++) {
+        mFree.push_back(&mSlots[i]);
+    }
+    mSpare = NULL;
+    mLastTimestampNs = 0;
+    mQuit = 0;
+    mThread = Thread_Create(sThreadLoop, this);
+    Thread_Run(mThread);
+}
+
+void FramePresenter::stopLocked() {
+    if (!mThread)
+        return;
+
+    mQuit = 1;
+    CircularList_Close(mFilled);
+    Thread_Destroy(mThread);
+    mThread = NULL;
+
+    // present() is held off by mLock and the thread is gone: hand every
+    // buffer still dequeued back to the surface
+    for (int i = 0; i < mDepth; i++) {
+        if (mSlots[i].anb) {
+            releaseSlot(&mSlots[i], false);
+        }
+    }
+    mSpare = NULL;
+    mFree.clear();
+}
+
+void FramePresenter::sThreadLoop(void *userdata) {
+    static_cast<FramePresenter *>(userdata)->threadLoop();
+}
+
+void FramePresenter::threadLoop() {
+    ALOGD("%s presenter thread BEGIN", mName.c_str());
+    while (!mQuit) {
+        bool starved = false;
+        while (!mQuit && !mFree.empty()) {
+            Slot *slot = mFree.back();
+            if (!acquireSlot(slot)) {
+                starved = true;
+                break;
+            }
+            mFree.pop_back();
+            CircularList_Push(mReady, &slot, 0, 0);
+        }
+
+        // with every buffer out only a filled one can be next; otherwise
+        // look again soon, unless dequeueing just failed
+        Slot *slot = NULL;
+        int timeout = mFree.empty() ? -1 : (starved ? 10 : 0);
+        if (CircularList_Pop(mFilled, &slot, timeout) == 0) {
+            releaseSlot(slot, true);
+            mFree.push_back(slot);
+        }
+    }
+    ALOGD("%s presenter thread END", mName.c_str());
+}
+
+bool FramePresenter::acquireSlot(Slot *slot) {
+    ATRACE_CALL();
+    ANativeWindow *anw = mSurface.get();
+    status_t err = native_window_dequeue_buffer_and_wait(anw, &slot->anb);
+    if (err != NO_ERROR) {
+        // TIMED_OUT just means the consumer holds every buffer
+        if (err != TIMED_OUT) {
+            ALOGV("%s: %s dequeue failed: %s (%d)", __FUNCTION__, mName.c_str(), strerror(-err), err);
+        }
+        slot->anb = NULL;
+        mDequeueErrors++;
+        return false;
+    }
+
+    slot->buffer = GraphicBuffer::from(slot->anb);
+    slot->format = slot->buffer->getPixelFormat();
+    uint32_t width = slot->buffer->getWidth();
+    uint32_t height = slot->buffer->getHeight();
+    uint32_t stride = slot->buffer->getStride();
+    uint8_t *img = NULL;
+
+    switch (slot->format) {
+        case HAL_PIXEL_FORMAT_RGBA_8888:
+        case HAL_PIXEL_FORMAT_RGBX_8888:
+            err = slot->buffer->lock(GRALLOC_USAGE_SW_WRITE_OFTEN, (void **)&img);
+            slot->rgba = img;
+            slot->rgbaStride = stride * 4;
+            break;
+        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+            // NV21
+            err = slot->buffer->lock(GRALLOC_USAGE_SW_WRITE_OFTEN, (void **)&img);
+            slot->planes.y = img;
+            slot->planes.cr = img + height * stride;
+            slot->planes.cb = slot->planes.cr + 1;
+            slot->planes.y_stride = stride;
+            slot->planes.c_stride = stride;
+            slot->planes.c_step = 2;
+            break;
+        case HAL_PIXEL_FORMAT_YV12: {
+            if ((width & 1) || (height & 1)) {
+                ALOGE("%s: Dimens %" PRIu32 " x %" PRIu32 " are not divisible by 2.", __FUNCTION__,
+                        width, height);
+                err = BAD_VALUE;
+                break;
+            }
+            LOG_ALWAYS_FATAL_IF(stride % 16, "Stride is not 16 pixel aligned %d", stride);
+            uint32_t cStride = ALIGN(stride / 2, 16);
+            err = slot->buffer->lock(GRALLOC_USAGE_SW_WRITE_OFTEN, (void **)&img);
+            slot->planes.y = img;
+            slot->planes.cr = img + height * stride;
+            slot->planes.cb = slot->planes.cr + cStride * height / 2;
+            slot->planes.y_stride = stride;
+            slot->planes.c_stride = cStride;
+            slot->planes.c_step = 1;
+            break;
+        }
+        default: {
+            // YCbCr_420_888 and implementation defined YUV
+            android_ycbcr ycbcr = android_ycbcr();
+            err = slot->buffer->lockYCbCr(GRALLOC_USAGE_SW_WRITE_OFTEN, &ycbcr);
+            slot->planes.y = reinterpret_cast<uint8_t *>(ycbcr.y);
+            slot->planes.cb = reinterpret_cast<uint8_t *>(ycbcr.cb);
+            slot->planes.cr = reinterpret_cast<uint8_t *>(ycbcr.cr);
+            slot->planes.y_stride = ycbcr.ystride;
+            slot->planes.c_stride = ycbcr.cstride;
+            slot->planes.c_step = ycbcr.chroma_step;
+            break;
+        }
+    }
+
+    if (err != NO_ERROR) {
+        ALOGE("%s: %s failed to lock buffer (format %#x): %s (%d)", __FUNCTION__, mName.c_str(),
+                slot->format, strerror(-err), err);
+        mErrors++;
+        releaseSlot(slot, false);
+        return false;
+    }
+    slot->locked = true;
+    return true;
+}
+
+void FramePresenter::releaseSlot(Slot *slot, bool queue) {
+    ATRACE_CALL();
+    ANativeWindow *anw = mSurface.get();
+    status_t err;
+
+    if (slot->locked) {
+        slot->locked = false;
+        err = slot->buffer->unlock();
+        if (err != NO_ERROR) {
+            ALOGE("%s: %s failed to unlock buffer: %s (%d)", __FUNCTION__, mName.c_str(), strerror(-err), err);
+            mErrors++;
+            queue = false;
+        }
+    }
+
+    if (queue) {
+        int64_t timestampNs = NATIVE_WINDOW_TIMESTAMP_AUTO;
+        if (slot->captureTimeUs >= 0) {
+            // the RTPTime clock is CLOCK_MONOTONIC moved to the epoch
+            timestampNs = systemTime(SYSTEM_TIME_MONOTONIC) + (slot->captureTimeUs - sNowUs()) * 1000LL;
+            if (timestampNs <= mLastTimestampNs) {
+                timestampNs = mLastTimestampNs + 1;
+            }
+            mLastTimestampNs = timestampNs;
+        }
+        native_window_set_buffers_timestamp(anw, timestampNs);
+        err = anw->queueBuffer(anw, slot->anb, /*fenceFd*/-1);
+        if (err != NO_ERROR) {
+            ALOGE("%s: %s failed to queue buffer: %s (%d)", __FUNCTION__, mName.c_str(), strerror(-err), err);
+            mErrors++;
+        } else {
+            mPresented++;
+            long long nowUs = sNowUs();
+            mQueueHistogram.add(slot->filledTimeUs * 1000LL, nowUs * 1000LL);
+            if (mHistogram && slot->recvTimeUs > 0) {
+                mHistogram->add(slot->recvTimeUs * 1000LL, nowUs * 1000LL);
+            }
+            if (slot->captureTimeUs >= 0) {
+                mCaptureHistogram.add(slot->captureTimeUs * 1000LL, nowUs * 1000LL);
+            }
+        }
+    } else {
+        anw->cancelBuffer(anw, slot->anb, /*fenceFd*/-1);
+    }
+    slot->anb = NULL;
+    slot->buffer.clear();
+}
+
+void FramePresenter::sOnReplaced(void *userdata, void *element) {
+    FramePresenter *p = static_cast<FramePresenter *>(userdata);
+    // runs inside present(), on the decoder thread
+    p->mSpare = *(Slot **)element;
+    p->mReplaced++;
+}
+
+int FramePresenter::present(const AnsyncDecoderFrame *frame, long long captureTimeUs) {
+    ATRACE_CALL();
+    Mutex::Autolock l(mLock);
+    if (!mThread || !frame)
+        return -1;
+
+    mFrames++;
+    Slot *slot = mSpare;
+    mSpare = NULL;
+    if (!slot && CircularList_Pop(mReady, &slot, 0) < 0) {
+        mNoBuffer++;
+        return -1;
+    }
+
+    uint32_t width = std::min((uint32_t)frame->width, slot->buffer->getWidth());
+    uint32_t height = std::min((uint32_t)frame->height, slot->buffer->getHeight());
+    long long startUs = sNowUs();
+    if (slot->format == HAL_PIXEL_FORMAT_RGBA_8888 || slot->format == HAL_PIXEL_FORMAT_RGBX_8888) {
+        YuvConvert_Yuv420ToRgba(&frame->planes, frame->full_range, slot->rgba, slot->rgbaStride,
+                width, height);
+    } else {
+        Yuv420_Copy(&frame->planes, &slot->planes, width, height);
+    }
+    slot->recvTimeUs = frame->recv_time_us;
+    slot->captureTimeUs = captureTimeUs;
+    slot->filledTimeUs = sNowUs();
+    mConvertHistogram.add(startUs * 1000LL, slot->filledTimeUs * 1000LL);
+    ATRACE_INT(mConvertCounter.c_str(), (int32_t)(slot->filledTimeUs - startUs));
+
+    // may hand the previous, not yet queued frame back through sOnReplaced
+    CircularList_Push(mFilled, &slot, 0, 0);
+    return 0;
+}
+
+FramePresenter::Stats FramePresenter::getStats() const {
+    Stats s;
+    s.frames = mFrames;
+    s.presented = mPresented;
+    s.noBuffer = mNoBuffer;
+    s.replaced = mReplaced;
+    s.dequeueErrors = mDequeueErrors;
+    s.errors = mErrors;
+    Mutex::Autolock l(mLock);
+    s.ready = mReady ? CircularList_Size(mReady) : 0;
+    s.pending = mFilled ? CircularList_Size(mFilled) : 0;
+    s.depth = mThread ? mDepth : 0;
+    return s;
+}
+
+void FramePresenter::resetStats() {
+    mFrames = 0;
+    mPresented = 0;
+    mNoBuffer = 0;
+    mReplaced = 0;
+    mDequeueErrors = 0;
+    mErrors = 0;
+    mConvertHistogram.reset();
+    mQueueHistogram.reset();
+    mCaptureHistogram.reset();
+}
+
+void FramePresenter::dump(int fd) const {
+    Stats s = getStats();
+    dprintf(fd, "  %s presenter: depth %u, %u ready, %u pending\n", mName.c_str(), s.depth, s.ready, s.pending);
+    dprintf(fd, "    %" PRIu64 " frames, %" PRIu64 " presented, %" PRIu64 " dropped (no buffer), %" PRIu64
+            " replaced, %" PRIu64 " dequeue errors, %" PRIu64 " errors\n", s.frames, s.presented, s.noBuffer,
+            s.replaced, s.dequeueErrors, s.errors);
+    String8 name;
+    name.appendFormat("    %s convert", mName.c_str());
+    mConvertHistogram.dump(fd, name.c_str());
+    name.clear();
+    name.appendFormat("    %s present to queueBuffer", mName.c_str());
+    mQueueHistogram.dump(fd, name.c_str());
+    name.clear();
+    name.appendFormat("    %s capture to queueBuffer", mName.c_str());
+    mCaptureHistogram.dump(fd, name.c_str());
+}
+
+};
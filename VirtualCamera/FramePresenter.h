@@ -0,0 +1,134 @@
+#ifndef __VIRTUALCAMERA_FRAME_PRESENTER_H__
+#define __VIRTUALCAMERA_FRAME_PRESENTER_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include <utils/Mutex.h>
+#include <utils/StrongPointer.h>
+#include <utils/String8.h>
+#include <gui/Surface.h>
+#include <ui/GraphicBuffer.h>
+
+#include <Common/circular_list.h>
+#include <Common/thread/thread.h>
+#include <AnsyncDecoder/AnsyncDecoder.h>
+
+#include "LatencyHistogram.h"
+
+namespace android
+{
+
+// Presenter stage between the decoder and one output surface.
+//
+// A presenter thread keeps up to depth gralloc buffers dequeued and locked
+// ahead of time. present() runs on the decoder thread: it only copies or
+// converts the frame into one of those buffers and hands it back, the
+// presenter thread unlocks and queues it and dequeues the replacement. A
+// slow consumer therefore never blocks the decoder:
+//  - with no dequeued buffer ready the frame is dropped (noBuffer),
+//  - a filled buffer the presenter thread has not queued yet is taken back
+//    and overwritten by the next frame (replaced), so the surface always
+//    gets the newest picture.
+//
+// RGBA_8888 / RGBX_8888 buffers get a YUV -> RGBA conversion, every 4:2:0
+// format a plane copy.
+//
+// A frame with a capture time is queued with it as the buffer timestamp
+// (on CLOCK_MONOTONIC, never going back), so consumers see the spacing the
+// frames were captured with; without one the surface stamps the buffer.
+//
+// present() must be called from one thread; setWindow() may be called from
+// any other.
+class FramePresenter
+{
+public:
+    struct Stats {
+        uint64_t frames;            // frames offered by present()
+        uint64_t presented;         // buffers queued to the surface
+        uint64_t noBuffer;          // frames dropped, no dequeued buffer was ready
+        uint64_t replaced;          // filled buffers overwritten by a newer frame
+        uint64_t dequeueErrors;     // failed or timed out dequeues
+        uint64_t errors;            // lock, unlock and queue failures
+        uint32_t ready;             // buffers dequeued and waiting for a frame
+        uint32_t pending;           // filled buffers waiting to be queued
+        uint32_t depth;
+    };
+
+    // histogram, if set, gets a sample from frame arrival to queueBuffer
+    FramePresenter(const char *name, LatencyHistogram *histogram = NULL);
+    ~FramePresenter();
+
+    // Stops presenting to the previous surface (cancelling the buffers it
+    // held) and starts on the new one; NULL detaches.
+    void setWindow(const sp<Surface>& surface, int depth);
+
+    // 0 when the frame went into a buffer, < 0 when it was dropped.
+    // captureTimeUs is on the RTPTime::CurrentTime clock, -1 when unknown.
+    int present(const AnsyncDecoderFrame *frame, long long captureTimeUs = -1);
+
+    Stats getStats() const;
+    void resetStats();
+    // counters and the convert / queue stage histograms
+    void dump(int fd) const;
+
+    static const int kMaxDepth = 8;
+
+private:
+    struct Slot {
+        ANativeWindowBuffer *anb;
+        sp<GraphicBuffer> buffer;
+        int format;
+        bool locked;
+        Yuv420Planes planes;        // 4:2:0 formats
+        uint8_t *rgba;              // RGBA formats
+        int rgbaStride;
+        long long recvTimeUs;
+        long long captureTimeUs;
+        long long filledTimeUs;     // when present() handed it over
+    };
+
+    static void sThreadLoop(void *userdata);
+    void threadLoop();
+    bool acquireSlot(Slot *slot);
+    void releaseSlot(Slot *slot, bool queue);
+    void startLocked();
+    void stopLocked();
+    static void sOnReplaced(void *userdata, void *element);
+
+    String8 mName;
+    String8 mConvertCounter;        // systrace counter
+    LatencyHistogram *mHistogram;
+
+    mutable Mutex mLock;            // present() against setWindow()
+    sp<Surface> mSurface;
+    int mDepth;
+    Slot mSlots[kMaxDepth];
+    std::vector<Slot *> mFree;      // presenter thread only: not dequeued
+    nsecs_t mLastTimestampNs;       // presenter thread only: of the last buffer queued
+    CircularList *mReady;           // presenter thread -> present(): dequeued and locked
+    CircularList *mFilled;          // present() -> presenter thread: to be queued
+    Slot *mSpare;                   // present() only: a replaced buffer to refill
+    RTPThread *mThread;
+    volatile int mQuit;
+
+    std::atomic<uint64_t> mFrames;
+    std::atomic<uint64_t> mPresented;
+    std::atomic<uint64_t> mNoBuffer;
+    std::atomic<uint64_t> mReplaced;
+    std::atomic<uint64_t> mDequeueErrors;
+    std::atomic<uint64_t> mErrors;
+
+    // present(): the copy or YUV -> RGBA conversion into the buffer
+    LatencyHistogram mConvertHistogram;
+    // present() done -> queueBuffer returned: waiting for the presenter
+    // thread plus the unlock and queue themselves
+    LatencyHistogram mQueueHistogram;
+    // capture -> queueBuffer returned, for frames with a capture time
+    LatencyHistogram mCaptureHistogram;
+};
+
+};
+
+#endif // __VIRTUALCAMERA_FRAME_PRESENTER_H__
@@ -0,0 +1,408 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <JRTPLIB/src/rtppacket.h>
+
+#include "H264Depacketizer.h"
+#include "fflog.h"
+
+using namespace jrtplib;
+
+#define NAL_TYPE_SLICE      1
+#define NAL_TYPE_IDR        5
+#define NAL_TYPE_SEI        6
+#define NAL_TYPE_SPS        7
+#define NAL_TYPE_PPS        8
+#define NAL_TYPE_AUD        9
+#define NAL_TYPE_STAP_A     24
+#define NAL_TYPE_FU_A       28
+
+// same window as RFC 3550 appendix A.1
+#define H264_MAX_MISORDER   100
+
+static const uint8_t sStartCode[4] = {0x00, 0x00, 0x00, 0x01};
+
+static inline size_t sStartCodeLength(const uint8_t *data, size_t len) {
+    if (len >= 3 && data[0] == 0 && data[1] == 0 && data[2] == 1)
+        return 3;
+    if (len >= 4 && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1)
+        return 4;
+    return 0;
+}
+
+H264Depacketizer::H264Depacketizer(h264_unit_callback callback, void *userdata,
+        int poolSize, size_t initialUnitSize)
+    : mCallback(callback),
+      mUserdata(userdata),
+      mSlots(NULL),
+      mPoolSize(poolSize > 0 ? poolSize : 1),
+      mInitialUnitSize(initialUnitSize),
+      mUnitSizeHint(0),
+      mHaveSeq(false),
+      mSsrc(0),
+      mLastSeq(0),
+      mWaitIdr(true),
+      mUnitActive(false),
+      mUnitSlot(NULL),
+      mUnitLen(0),
+      mUnitTimestamp(0),
+      mUnitRecvTimeUs(0),
+      mUnitFlags(0),
+      mInFu(false) {
+    memset(&mStats, 0, sizeof(mStats));
+    mSlots = new Slot[mPoolSize];
+    for (int i = 0; i < mPoolSize; i++) {
+        mSlots[i].busy.store(false, std::memory_order_relaxed);
+        mSlots[i].data = NULL;
+        mSlots[i].capacity = 0;
+    }
+}
+
+// The consumer must have released (or been destroyed with) every unit it holds.
+H264Depacketizer::~H264Depacketizer() {
+    for (int i = 0; i < mPoolSize; i++) {
+        free(mSlots[i].data);
+    }
+    delete[] mSlots;
+}
+
+int H264Depacketizer::GetFreeSlots() const {
+    int n = 0;
+    for (int i = 0; i < mPoolSize; i++) {
+        if (!mSlots[i].busy.load(std::memory_order_acquire))
+            n++;
+    }
+    return n;
+}
+
+size_t H264Depacketizer::GetPoolBytes() const {
+    size_t n = 0;
+    for (int i = 0; i < mPoolSize; i++) {
+        n += mSlots[i].capacity;
+    }
+    return n;
+}
+
+void H264Depacketizer::SetUnitSizeHint(size_t bytes) {
+    mUnitSizeHint.store(bytes, std::memory_order_relaxed);
+}
+
+void H264Depacketizer::ReleaseUnit(void *opaque, uint8_t * /*data*/) {
+    Slot *slot = (Slot *)opaque;
+    if (slot) {
+        slot->busy.store(false, std::memory_order_release);
+    }
+}
+
+H264Depacketizer::Slot *H264Depacketizer::AcquireSlot() {
+    size_t hint = mUnitSizeHint.load(std::memory_order_relaxed);
+    if (hint != 0)
+        mInitialUnitSize = hint;
+
+    for (int i = 0; i < mPoolSize; i++) {
+        bool expected = false;
+        if (mSlots[i].busy.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            Slot *slot = &mSlots[i];
+            // one huge IDR, or a bigger stream before a size change, must not
+            // pin its buffer in every slot for the rest of the session
+            if (hint != 0 && slot->capacity > 4 * hint) {
+                free(slot->data);
+                slot->data = NULL;
+                slot->capacity = 0;
+            }
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+void H264Depacketizer::BeginUnit(uint32_t timestamp, long long recvTimeUs) {
+    mUnitActive = true;
+    mUnitSlot = NULL;
+    mUnitLen = 0;
+    mUnitTimestamp = timestamp;
+    mUnitRecvTimeUs = recvTimeUs;
+    mUnitFlags = 0;
+    mInFu = false;
+}
+
+void H264Depacketizer::DropUnit() {
+    if (!mUnitActive)
+        return;
+    if (mUnitSlot) {
+        ReleaseUnit(mUnitSlot, NULL);
+        mUnitSlot = NULL;
+        mStats.droppedUnits++;
+    }
+    mUnitActive = false;
+    mInFu = false;
+}
+
+void H264Depacketizer::OnLoss() {
+    DropUnit();
+    mWaitIdr = true;
+}
+
+void H264Depacketizer::Reset() {
+    DropUnit();
+    mHaveSeq = false;
+    mWaitIdr = true;
+}
+
+bool H264Depacketizer::Append(const uint8_t *data, size_t len) {
+    if (mUnitSlot == NULL) {
+        // the slot is taken on the first byte so stray packets never hold one
+        if (mUnitLen != 0)
+            return false;
+        if ((mUnitSlot = AcquireSlot()) == NULL) {
+            mStats.poolExhausted++;
+            return false;
+        }
+    }
+
+    size_t need = mUnitLen + len + H264_UNIT_PADDING;
+    if (need > mUnitSlot->capacity) {
+        size_t capacity = mUnitSlot->capacity ? mUnitSlot->capacity : mInitialUnitSize;
+        while (capacity < need)
+            capacity *= 2;
+        uint8_t *p = (uint8_t *)realloc(mUnitSlot->data, capacity);
+        if (p == NULL) {
+            LOGFE("out of memory growing unit buffer to %zu bytes", capacity);
+            return false;
+        }
+        mUnitSlot->data = p;
+        mUnitSlot->capacity = capacity;
+    }
+    memcpy(mUnitSlot->data + mUnitLen, data, len);
+    mUnitLen += len;
+    return true;
+}
+
+bool H264Depacketizer::AppendNal(const uint8_t *nal, size_t len) {
+    if (!Append(sStartCode, sizeof(sStartCode)))
+        return false;
+    MarkNal(nal[0] & 0x1f);
+    return Append(nal, len);
+}
+
+void H264Depacketizer::MarkNal(uint8_t type) {
+    if (type == NAL_TYPE_IDR)
+        mUnitFlags |= NAL_HAS_IDR;
+    if (type >= NAL_TYPE_SLICE && type <= NAL_TYPE_IDR)
+        mUnitFlags |= NAL_HAS_SLICE;
+}
+
+// Legacy payloads carry their own start codes and may hold several NALs (SPS + PPS).
+// IDR and non-IDR slices never share a picture, so the first slice settles the
+// unit type and the rest of the payload need not be scanned.
+void H264Depacketizer::ScanAnnexB(const uint8_t *data, size_t len) {
+    size_t i = 0;
+    while (i + 3 < len && !(mUnitFlags & NAL_HAS_SLICE)) {
+        if (data[i] == 0 && data[i + 1] == 0) {
+            size_t sc = sStartCodeLength(data + i, len - i);
+            if (sc > 0 && i + sc < len) {
+                MarkNal(data[i + sc] & 0x1f);
+                i += sc + 1;
+                continue;
+            }
+        }
+        i++;
+    }
+}
+
+void H264Depacketizer::FinishUnit() {
+    if (!mUnitActive)
+        return;
+
+    if (mInFu) {
+        // last fragment of the NAL never arrived
+        OnLoss();
+        return;
+    }
+    if (mUnitLen == 0) {
+        DropUnit();
+        return;
+    }
+
+    if (mWaitIdr) {
+        if (mUnitFlags & NAL_HAS_IDR) {
+            mWaitIdr = false;
+        } else if (mUnitFlags & NAL_HAS_SLICE) {
+            // references are broken until the next IDR, parameter sets are still useful
+            ReleaseUnit(mUnitSlot, NULL);
+            mUnitSlot = NULL;
+            mUnitActive = false;
+            mStats.skippedUnits++;
+            return;
+        }
+    }
+
+    Slot *slot = mUnitSlot;
+    memset(slot->data + mUnitLen, 0, H264_UNIT_PADDING);
+
+    H264AccessUnit unit;
+    unit.data = slot->data;
+    unit.len = mUnitLen;
+    unit.timestamp = mUnitTimestamp;
+    unit.recvTimeUs = mUnitRecvTimeUs;
+    unit.keyframe = (mUnitFlags & NAL_HAS_IDR) != 0;
+    unit.opaque = slot;
+
+    mUnitSlot = NULL;
+    mUnitActive = false;
+
+    int ret = mCallback != NULL ? mCallback(mUserdata, &unit) : -1;
+    if (ret == H264_UNIT_DROPPED_NON_REF) {
+        // nothing refers to it, the next unit decodes fine
+        ReleaseUnit(slot, NULL);
+        mStats.nonRefDropped++;
+        return;
+    }
+    if (ret < 0) {
+        ReleaseUnit(slot, NULL);
+        mStats.droppedUnits++;
+        mWaitIdr = true;
+        return;
+    }
+    mStats.units++;
+    if (unit.keyframe)
+        mStats.keyframes++;
+}
+
+int H264Depacketizer::ProcessPacket(const RTPPacket *packet) {
+    if (packet == NULL)
+        return -1;
+
+    const uint8_t *payload = packet->GetPayloadData();
+    size_t len = packet->GetPayloadLength();
+    uint16_t seq = packet->GetSequenceNumber();
+    uint32_t timestamp = packet->GetTimestamp();
+
+    mStats.packets++;
+
+    if (mHaveSeq && packet->GetSSRC() != mSsrc) {
+        // sender restarted
+        Reset();
+    }
+    if (mHaveSeq) {
+        int16_t delta = (int16_t)(uint16_t)(seq - (uint16_t)(mLastSeq + 1));
+        if (delta < 0 && delta >= -H264_MAX_MISORDER) {
+            // duplicate, or reordered behind a packet we already consumed
+            mStats.latePackets++;
+            return 0;
+        }
+        if (delta > 0) {
+            mStats.lostPackets += delta;
+            OnLoss();
+        } else if (delta < 0) {
+            // sequence jumped far back, treat it as a new stream
+            OnLoss();
+        }
+    }
+    mHaveSeq = true;
+    mSsrc = packet->GetSSRC();
+    mLastSeq = seq;
+
+    if (payload == NULL || len == 0)
+        return 0;
+
+    // A new timestamp starts a new access unit. FU-A fragments from the legacy
+    // sender do not share a timestamp, so never split inside a fragmented NAL.
+    if (mUnitActive && !mInFu && timestamp != mUnitTimestamp) {
+        FinishUnit();
+    }
+    if (!mUnitActive) {
+        RTPTime t = packet->GetReceiveTime();
+        BeginUnit(timestamp, (long long)t.GetSeconds() * 1000000LL + t.GetMicroSeconds());
+    }
+
+    uint8_t type = payload[0] & 0x1f;
+    bool ok = true;
+
+    if (payload[0] == 0) {
+        // legacy single packet: already Annex-B
+        if (mInFu) {
+            OnLoss();
+            return 0;
+        }
+        ScanAnnexB(payload, len);
+        ok = Append(payload, len);
+    } else if (type >= 1 && type <= 23) {
+        if (mInFu) {
+            OnLoss();
+            return 0;
+        }
+        ok = AppendNal(payload, len);
+    } else if (type == NAL_TYPE_STAP_A) {
+        mStats.stapPackets++;
+        if (mInFu) {
+            OnLoss();
+            return 0;
+        }
+        size_t off = 1;
+        while (ok && off + 2 <= len) {
+            size_t nalLen = ((size_t)payload[off] << 8) | payload[off + 1];
+            off += 2;
+            if (nalLen == 0 || off + nalLen > len) {
+                LOGFW("malformed STAP-A (seq %u)", seq);
+                OnLoss();
+                return 0;
+            }
+            ok = AppendNal(payload + off, nalLen);
+            off += nalLen;
+        }
+    } else if (type == NAL_TYPE_FU_A) {
+        mStats.fuPackets++;
+        if (len < 3) {
+            OnLoss();
+            return 0;
+        }
+        uint8_t fuHeader = payload[1];
+        const uint8_t *frag = payload + 2;
+        size_t fragLen = len - 2;
+
+        if (fuHeader & 0x80) {
+            if (mInFu) {
+                // previous fragmented NAL never ended
+                long long recvTimeUs = mUnitRecvTimeUs;
+                OnLoss();
+                BeginUnit(timestamp, recvTimeUs);
+            }
+            mInFu = true;
+            if (sStartCodeLength(frag, fragLen) > 0) {
+                ScanAnnexB(frag, fragLen);
+                ok = Append(frag, fragLen);
+            } else {
+                uint8_t nalHeader = (payload[0] & 0xe0) | (fuHeader & 0x1f);
+                MarkNal(nalHeader & 0x1f);
+                ok = Append(sStartCode, sizeof(sStartCode)) && Append(&nalHeader, 1) && Append(frag, fragLen);
+            }
+        } else {
+            if (!mInFu) {
+                // start fragment lost; the gap was already reported or this is a stray
+                OnLoss();
+                return 0;
+            }
+            ok = Append(frag, fragLen);
+        }
+        if (fuHeader & 0x40) {
+            mInFu = false;
+        }
+    } else {
+        // STAP-B, MTAP and FU-B are not used in non-interleaved mode
+        mStats.unsupportedPackets++;
+        OnLoss();
+        return 0;
+    }
+
+    if (!ok) {
+        // no pool slot or no memory: the unit is gone, resync on the next IDR
+        OnLoss();
+        return 0;
+    }
+
+    if (packet->HasMarker() && !mInFu) {
+        FinishUnit();
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+#ifndef __H264_DEPACKETIZER_H__
+#define __H264_DEPACKETIZER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace jrtplib {
+class RTPPacket;
+}
+
+// Zeroed bytes kept after every unit so it can go straight into avcodec_send_packet
+#define H264_UNIT_PADDING 256
+
+typedef struct stH264AccessUnit {
+    uint8_t *data;          // Annex-B byte stream, followed by H264_UNIT_PADDING zero bytes
+    size_t len;
+    uint32_t timestamp;     // RTP timestamp
+    long long recvTimeUs;   // arrival time of the first packet of the unit
+    bool keyframe;          // contains an IDR slice
+    void *opaque;           // pool slot, hand back through H264Depacketizer::ReleaseUnit
+} H264AccessUnit;
+
+// Return 0 when the consumer keeps the unit (and calls ReleaseUnit later),
+// H264_UNIT_DROPPED_NON_REF when it discards a unit no later frame refers to,
+// any other value < 0 to refuse it. A refused or discarded unit is recycled;
+// only a refusal makes the stream resync on the next IDR.
+#define H264_UNIT_DROPPED_NON_REF (-2)
+typedef int (*h264_unit_callback)(void *userdata, H264AccessUnit *unit);
+
+// RFC 6184 depacketizer for single NAL, STAP-A and FU-A payloads.
+//
+// Fragments are appended once into a pooled unit buffer, which is then handed
+// to the consumer as is, so a NAL is copied exactly once between the RTP
+// packet and the decoder. A sequence gap, an unterminated FU-A or an exhausted
+// pool drops the unit in progress and everything after it up to the next IDR
+// (parameter sets are still let through).
+//
+// The legacy sender (RTPSession::SendPacketAfterSlice) puts the Annex-B start
+// code inside the payload instead of a NAL header; such payloads are detected
+// by their leading zero byte and copied through untouched.
+//
+// ProcessPacket and Reset must be called from one thread; ReleaseUnit may be
+// called from any thread.
+class H264Depacketizer
+{
+public:
+    struct Stats {
+        uint64_t packets;
+        uint64_t units;             // units handed to the consumer
+        uint64_t keyframes;
+        uint64_t lostPackets;       // sequence numbers never seen
+        uint64_t latePackets;       // duplicate or too late to be used
+        uint64_t droppedUnits;      // discarded because of loss, refusal or pool exhaustion
+        uint64_t skippedUnits;      // complete units discarded while waiting for an IDR
+        uint64_t nonRefDropped;     // units the consumer discarded as non-reference
+        uint64_t stapPackets;
+        uint64_t fuPackets;
+        uint64_t unsupportedPackets;
+        uint64_t poolExhausted;
+    };
+
+    H264Depacketizer(h264_unit_callback callback, void *userdata,
+            int poolSize = 16, size_t initialUnitSize = 256 * 1024);
+    ~H264Depacketizer();
+
+    int ProcessPacket(const jrtplib::RTPPacket *packet);
+    // Drops the unit in progress and waits for the next IDR.
+    void Reset();
+    // True from the start, and after loss or a refused unit, until a unit with
+    // an IDR goes out; the units in between are skipped.
+    bool IsWaitingForIdr() const { return mWaitIdr; }
+
+    // Matches buffer_release_callback of AnsyncDecoder_ReceiveBuffer.
+    static void ReleaseUnit(void *opaque, uint8_t *data);
+
+    // Expected size of the biggest units, e.g. derived from the SPS picture
+    // size. Slots start at this size from now on, and free slots that grew to
+    // more than four times of it are given back when next taken. Any thread.
+    void SetUnitSizeHint(size_t bytes);
+
+    const Stats &GetStats() const { return mStats; }
+    int GetPoolSize() const { return mPoolSize; }
+    int GetFreeSlots() const;
+    // bytes held by the pool; ProcessPacket thread only
+    size_t GetPoolBytes() const;
+
+private:
+    struct Slot {
+        std::atomic<bool> busy;
+        uint8_t *data;
+        size_t capacity;
+    };
+
+    enum {
+        NAL_HAS_IDR = 1,
+        NAL_HAS_SLICE = 2,
+    };
+
+    void BeginUnit(uint32_t timestamp, long long recvTimeUs);
+    void FinishUnit();
+    void DropUnit();
+    void OnLoss();
+    bool Append(const uint8_t *data, size_t len);
+    bool AppendNal(const uint8_t *nal, size_t len);
+    void MarkNal(uint8_t type);
+    void ScanAnnexB(const uint8_t *data, size_t len);
+    Slot *AcquireSlot();
+
+    h264_unit_callback mCallback;
+    void *mUserdata;
+
+    Slot *mSlots;
+    int mPoolSize;
+    size_t mInitialUnitSize;
+    std::atomic<size_t> mUnitSizeHint;     // 0 while unset
+
+    bool mHaveSeq;
+    uint32_t mSsrc;
+    uint16_t mLastSeq;
+    bool mWaitIdr;
+
+    bool mUnitActive;
+    Slot *mUnitSlot;        // NULL while the active unit is being discarded
+    size_t mUnitLen;
+    uint32_t mUnitTimestamp;
+    long long mUnitRecvTimeUs;
+    int mUnitFlags;
+    bool mInFu;
+
+    Stats mStats;
+};
+
+#endif // __H264_DEPACKETIZER_H__
@@ -61,11 +61,18 @@
 #define RTP_SUPPORT_IPV6
 #define RTP_SUPPORT_IPV6MULTICAST
 #define RTP_SUPPORT_SENDAPP
+#define RTP_SUPPORT_RTCPUNKNOWN
 #define RTP_SUPPORT_MEMORYMANAGEMENT
 #define RTP_HAVE_ARRAYALLOC
 //#define RTP_SUPPORT_SRTP
 #define RTP_HAVE_POLL
 #define RTP_HAVE_MSG_NOSIGNAL
 
+#ifdef __linux__
+#define RTP_HAVE_RECVMMSG
+#define RTP_HAVE_SENDMMSG
+#define RTP_HAVE_EPOLL
+#endif // __linux__
+
 #endif // RTPCONFIG_UNIX_H
 
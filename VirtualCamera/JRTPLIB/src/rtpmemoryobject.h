@@ -54,6 +54,9 @@ protected:
 #endif // RTP_SUPPORT_MEMORYMANAGEMENT
 	virtual ~RTPMemoryObject()										{ }
 
+	// installs the pool of RTPSessionParams::SetUseMemoryPool in the session's components
+	friend class RTPSession;
+
 #ifdef RTP_SUPPORT_MEMORYMANAGEMENT	
 	RTPMemoryManager *GetMemoryManager() const						{ return mgr; }
 	void SetMemoryManager(RTPMemoryManager *m)						{ mgr = m; }
@@ -46,6 +46,9 @@
 #include "rtptypes.h"
 #include "rtpmemoryobject.h"
 
+/** Space needed for a header built by RTPPacketBuilder::BuildPacketHeader. */
+#define RTPPACKETBUILDER_MAXHEADERSIZE				(12+4*RTP_MAXCSRCS)
+
 namespace jrtplib
 {
 
@@ -124,6 +127,17 @@ public:
 	                  uint8_t pt,bool mark,uint32_t timestampinc,
 	                  uint16_t hdrextID,const void *hdrextdata,size_t numhdrextwords);
 
+	/** Builds only the header of a packet with payload length \c len.
+	 *  Builds only the header of a packet with payload length \c len into \c header, which must
+	 *  have room for RTPPACKETBUILDER_MAXHEADERSIZE bytes, and stores its size in \c headerlen.
+	 *  The payload itself is left to the caller, who sends it from its own buffer right after the
+	 *  header (see RTPTransmitter::SendRTPDataGather). Payload type, marker, timestamp increment,
+	 *  sequence numbering and the sender statistics are handled exactly as for BuildPacket. The
+	 *  last built packet returned by GetPacket is not affected.
+	 */
+	int BuildPacketHeader(size_t len,uint8_t pt,bool mark,uint32_t timestampinc,
+	                      uint8_t *header,size_t *headerlen);
+
 	/** Returns a pointer to the last built RTP packet data. */
 	uint8_t *GetPacket()						{ if (!init) return 0; return buffer; }
 
@@ -193,6 +207,7 @@ public:
 	 */
 	void AdjustSSRC(uint32_t s)					{ ssrc = s; }
 private:
+	void PacketBuilt(size_t payloadlen,uint32_t timestampinc);
 	int PrivateBuildPacket(const void *data,size_t len,
 	                  uint8_t pt,bool mark,uint32_t timestampinc,bool gotextension,
 	                  uint16_t hdrextID = 0,const void *hdrextdata = 0,size_t numhdrextwords = 0);
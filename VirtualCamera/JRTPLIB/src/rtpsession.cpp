@@ -43,6 +43,7 @@
 #include "rtppacket.h"
 #include "rtptimeutilities.h"
 #include "rtpmemorymanager.h"
+#include "rtppoolmemorymanager.h"
 #include "rtprandomrand48.h"
 #include "rtprandomrands.h"
 #include "rtprandomurandom.h"
@@ -121,6 +122,7 @@ namespace jrtplib {
         m_changeOutgoingData = false;
 
         created = false;
+        mempool = 0;
         timeinit.Dummy();
 //        std::cout.rdbuf(&mosb);
         //std::cout << (void *)(rtprnd) << std::endl;
@@ -128,6 +130,7 @@ namespace jrtplib {
 
     RTPSession::~RTPSession() {
         Destroy();
+        DeleteMemoryPool();
 
         if (deletertprnd)
             delete rtprnd;
@@ -153,6 +156,9 @@ namespace jrtplib {
         if ((maxpacksize = sessparams.GetMaximumPacketSize()) < RTP_MINPACKETSIZE)
             return ERR_RTP_SESSION_MAXPACKETSIZETOOSMALL;
 
+        if ((status = CreateMemoryPool(sessparams)) < 0)
+            return status;
+
         // Initialize the transmission component
 
         rtptrans = 0;
@@ -214,6 +220,9 @@ namespace jrtplib {
         if ((maxpacksize = sessparams.GetMaximumPacketSize()) < RTP_MINPACKETSIZE)
             return ERR_RTP_SESSION_MAXPACKETSIZETOOSMALL;
 
+        // the session deletes the transmitter's raw packets, so both keep the manager they were built with
+        DeleteMemoryPool();
+
         rtptrans = transmitter;
 
         if ((status = rtptrans->SetMaximumPacketSize(maxpacksize)) < 0)
@@ -229,6 +238,9 @@ namespace jrtplib {
         // add by yuzh 添加用来存储切片数据的内存
         slice_data_max_size = maxpacksize - 200; // 最大的size - 200 + fu_indicator + fu_header
         slice_data = (uint8_t *)malloc(slice_data_max_size + 2);
+        slice_headers = (uint8_t *)malloc(RTPSESSION_MAXGATHERPACKETS * (RTPPACKETBUILDER_MAXHEADERSIZE + 2));
+        slice_packets = (RTPGatherPacket *)malloc(RTPSESSION_MAXGATHERPACKETS * sizeof(RTPGatherPacket));
+        slice_gather = (rtptrans->SendRTPDataGather(0, 0) != ERR_RTP_TRANS_NOGATHERSUPPORT);
 
         // Initialize packet builder
         if ((status = packetbuilder.Init(maxpacksize)) < 0) {
@@ -395,6 +407,18 @@ namespace jrtplib {
                 rtcpbuilder.Destroy();
                 return ERR_RTP_OUTOFMEM;
             }
+            int policy, priority, nice;
+            uint64_t cpumask;
+            if (sessparams.GetPollThreadScheduling(&policy, &priority, &nice, &cpumask) &&
+                (status = pollthread->SetScheduling(policy, priority, nice, cpumask)) < 0) {
+                if (deletetransmitter)
+                    RTPDelete(rtptrans, GetMemoryManager());
+                RTPDelete(pollthread, GetMemoryManager());
+                packetbuilder.Destroy();
+                sources.Clear();
+                rtcpbuilder.Destroy();
+                return ERR_RTP_POLLTHREAD_CANTSTARTTHREAD;
+            }
             if ((status = pollthread->Start(rtptrans)) < 0) {
                 if (deletetransmitter)
                     RTPDelete(rtptrans, GetMemoryManager());
@@ -411,6 +435,52 @@ namespace jrtplib {
         return 0;
     }
 
+    // Installs the pool asked for in sessparams in the session and its components,
+    // before the transmitter is created with the same manager. A pool from an
+    // earlier Create is kept; one that is no longer wanted goes.
+    int RTPSession::CreateMemoryPool(const RTPSessionParams &sessparams) {
+#ifdef RTP_SUPPORT_MEMORYMANAGEMENT
+        // a manager given to the constructor stays in charge
+        if (!sessparams.GetUseMemoryPool() || (GetMemoryManager() != 0 && mempool == 0)) {
+            DeleteMemoryPool();
+            return 0;
+        }
+        if (mempool != 0)
+            return 0;
+
+        int status;
+
+        mempool = new RTPPoolMemoryManager(sessparams.GetMemoryPoolLimit());
+        if ((status = mempool->Init(needthreadsafety)) < 0) {
+            delete mempool;
+            mempool = 0;
+            return status;
+        }
+        SetComponentMemoryManager(mempool);
+#else
+        JRTPLIB_UNUSED(sessparams);
+#endif // RTP_SUPPORT_MEMORYMANAGEMENT
+        return 0;
+    }
+
+    void RTPSession::DeleteMemoryPool() {
+        if (mempool == 0)
+            return;
+        SetComponentMemoryManager(0);
+        delete mempool;
+        mempool = 0;
+    }
+
+    // Only the components that hand their allocations to one another: the
+    // tables inside them free what they allocate themselves.
+    void RTPSession::SetComponentMemoryManager(RTPMemoryManager *mgr) {
+        SetMemoryManager(mgr);
+        sources.SetMemoryManager(mgr);
+        packetbuilder.SetMemoryManager(mgr);
+        rtcpbuilder.SetMemoryManager(mgr);
+        collisionlist.SetMemoryManager(mgr);
+    }
+
     void RTPSession::Destroy() {
         if (!created)
             return;
@@ -435,6 +505,8 @@ namespace jrtplib {
         byepackets.clear();
 
         free(slice_data);
+        free(slice_headers);
+        free(slice_packets);
 
         created = false;
     }
@@ -522,6 +594,16 @@ namespace jrtplib {
         return created;
     }
 
+#ifdef RTP_SUPPORT_THREAD
+    int RTPSession::GetPollThreadSchedulingStats(jthread::JThreadSchedulingStats *stats) {
+        if (!created)
+            return ERR_RTP_SESSION_NOTCREATED;
+        if (pollthread == 0 || pollthread->GetSchedulingStats(stats) < 0)
+            return ERR_RTP_SESSION_NOTUSINGPOLLTHREAD;
+        return 0;
+    }
+#endif // RTP_SUPPORT_THREAD
+
     uint32_t RTPSession::GetLocalSSRC() {
         if (!created)
             return 0;
@@ -591,6 +673,7 @@ namespace jrtplib {
             BUILDER_UNLOCK
             return status;
         }
+        NotifyBuiltPacketSent();
         BUILDER_UNLOCK
 
         SOURCES_LOCK
@@ -617,6 +700,7 @@ namespace jrtplib {
             BUILDER_UNLOCK
             return status;
         }
+        NotifyBuiltPacketSent();
         BUILDER_UNLOCK
 
         SOURCES_LOCK
@@ -635,7 +719,9 @@ namespace jrtplib {
         if (!created)
             return ERR_RTP_SESSION_NOTCREATED;
 
-        if (len > slice_data_max_size) {
+        if (len > slice_data_max_size && slice_gather && !m_changeOutgoingData) {
+            return SendSlicesGather((const uint8_t *) data, len, pt, mark, timestampinc);
+        } else if (len > slice_data_max_size) {
 
             uint8_t nalu_header = ((uint8_t *) data)[4];
             uint8_t fu_indicator;
@@ -665,7 +751,7 @@ namespace jrtplib {
                         memcpy(slice_data + 2, (uint8_t *) data + step * slice_data_max_size, (size_t) l);
                         slice_len = (size_t) l + 2;
                     }
-                    status = SendPacket(slice_data, slice_len, pt, true, 0);
+                    status = SendPacket(slice_data, slice_len, pt, mark, 0);
                     CHECK_ERROR_JRTPLIB(status);
 
                 } else { // 0x07
@@ -686,6 +772,75 @@ namespace jrtplib {
         return 0;
     }
 
+    // Hands the packet that is still in packetbuilder to OnSendRTPPacket; called
+    // with the builder lock held.
+    void RTPSession::NotifyBuiltPacketSent() {
+        RTPGatherPacket packet;
+
+        packet.header = packetbuilder.GetPacket();
+        packet.headerlen = packetbuilder.GetPacketLength();
+        packet.payload = 0;
+        packet.payloadlen = 0;
+        OnSendRTPPacket(packet);
+    }
+
+    // Same packets as the slice_data loop in SendPacketAfterSlice, but only the
+    // RTP and FU headers are built; the payloads go out of data as they are.
+    int RTPSession::SendSlicesGather(const uint8_t *data, size_t len, uint8_t pt, bool mark, uint32_t timestampinc) {
+        uint8_t nalu_header = data[4];
+        uint8_t fu_indicator = (nalu_header & (uint8_t) 0xE0) | (uint8_t) 28;
+        size_t n = (len + slice_data_max_size - 1) / slice_data_max_size;
+        size_t step = 0;
+        int status = 0;
+
+        while (step < n) {
+            int count = 0;
+
+            BUILDER_LOCK
+            for (; step < n && count < RTPSESSION_MAXGATHERPACKETS; step++, count++) {
+                size_t offset = step * slice_data_max_size;
+                size_t slice_len = (len - offset < slice_data_max_size) ? len - offset : slice_data_max_size;
+                uint8_t *header = slice_headers + count * (RTPPACKETBUILDER_MAXHEADERSIZE + 2);
+                uint8_t fu_header = nalu_header & (uint8_t) 0x1F;
+                size_t headerlen;
+
+                if (step == 0)
+                    fu_header |= (uint8_t) 0x80;
+                if (step == n - 1)
+                    fu_header |= (uint8_t) 0x40;
+                // as before: the first fragment advances the timestamp, the last one carries mark
+                if ((status = packetbuilder.BuildPacketHeader(slice_len + 2, pt, mark && step == n - 1,
+                                                              step == 0 ? timestampinc : 0, header, &headerlen)) < 0)
+                    break;
+                header[headerlen] = fu_indicator;
+                header[headerlen + 1] = fu_header;
+                slice_packets[count].header = header;
+                slice_packets[count].headerlen = headerlen + 2;
+                slice_packets[count].payload = data + offset;
+                slice_packets[count].payloadlen = slice_len;
+            }
+            if (status >= 0)
+                status = rtptrans->SendRTPDataGather(slice_packets, count);
+            if (status >= 0) {
+                for (int i = 0; i < count; i++)
+                    OnSendRTPPacket(slice_packets[i]);
+            }
+            BUILDER_UNLOCK
+            if (status < 0)
+                return status;
+
+            SOURCES_LOCK
+            for (int i = 0; i < count; i++)
+                sources.SentRTPPacket();
+            SOURCES_UNLOCK
+        }
+
+        PACKSENT_LOCK
+        sentpackets = true;
+        PACKSENT_UNLOCK
+        return 0;
+    }
+
     int RTPSession::SendPacketEx(const void *data, size_t len, uint16_t hdrextID, const void *hdrextdata, size_t numhdrextwords) {
         int status;
 
@@ -701,6 +856,7 @@ namespace jrtplib {
             BUILDER_UNLOCK
             return status;
         }
+        NotifyBuiltPacketSent();
         BUILDER_UNLOCK
 
         SOURCES_LOCK
@@ -727,6 +883,7 @@ namespace jrtplib {
             BUILDER_UNLOCK
             return status;
         }
+        NotifyBuiltPacketSent();
         BUILDER_UNLOCK
 
         SOURCES_LOCK
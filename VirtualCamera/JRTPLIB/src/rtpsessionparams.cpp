@@ -34,6 +34,7 @@
 #include "rtpsessionparams.h"
 #include "rtpdefines.h"
 #include "rtperrors.h"
+#include "rtppoolmemorymanager.h"
 
 #include "rtpdebug.h"
 
@@ -49,6 +50,13 @@ RTPSessionParams::RTPSessionParams() : mininterval(0,0)
 	usepollthread = false;
 	m_needThreadSafety = false;
 #endif // RTP_SUPPORT_THREAD
+	pollthreadsched = false;
+	pollthreadpolicy = 0;
+	pollthreadpriority = 0;
+	pollthreadnice = 0;
+	pollthreadcpumask = 0;
+	usememorypool = false;
+	memorypoollimit = RTPPOOLMEMORYMANAGER_DEFAULTMAXSLABBYTES;
 	maxpacksize = RTP_DEFAULTPACKETSIZE;
 	receivemode = RTPTransmitter::AcceptAll;
 	acceptown = false;
@@ -68,6 +68,19 @@ public:
 	/** Returns whether the session should use a poll thread or not (default is \c true). */
 	bool IsUsingPollThread() const								{ return usepollthread; }
 
+	/** Sets the scheduling policy, real-time priority, nice value and CPU mask of the poll thread,
+	 *  as described for jthread::JThread::SetScheduling. Without it the poll thread inherits the
+	 *  scheduling of the thread that creates the session.
+	 */
+	void SetPollThreadScheduling(int policy, int priority, int nice, uint64_t cpumask = 0)
+																{ pollthreadsched = true; pollthreadpolicy = policy; pollthreadpriority = priority;
+																  pollthreadnice = nice; pollthreadcpumask = cpumask; }
+
+	/** Returns whether the poll thread scheduling was set, filling in the values if it was. */
+	bool GetPollThreadScheduling(int *policy, int *priority, int *nice, uint64_t *cpumask) const
+																{ *policy = pollthreadpolicy; *priority = pollthreadpriority; *nice = pollthreadnice;
+																  *cpumask = pollthreadcpumask; return pollthreadsched; }
+
 	/** Sets the maximum allowed packet size for the session. */
 	void SetMaximumPacketSize(size_t max)						{ maxpacksize = max; }
 
@@ -218,9 +231,29 @@ public:
 
 	/** Returns `true` if thread safety was requested using RTPSessionParams::SetNeedThreadSafety. */
 	bool NeedThreadSafety() const								{ return m_needThreadSafety; }
+
+	/** If \c usepool is \c true, the session allocates from an RTPPoolMemoryManager of its own.
+	 *  This only takes effect when the session creates its transmitter and was not constructed with
+	 *  a memory manager; a transmitter passed to RTPSession::Create keeps the manager it has.
+	 */
+	void SetUseMemoryPool(bool usepool)							{ usememorypool = usepool; }
+
+	/** Returns whether the session allocates from a memory pool (default is \c false). */
+	bool GetUseMemoryPool() const								{ return usememorypool; }
+
+	/** Sets the limit on the memory the pool keeps in slabs; allocations beyond it go to the heap. */
+	void SetMemoryPoolLimit(size_t maxbytes)					{ memorypoollimit = maxbytes; }
+
+	/** Returns the limit on the memory the pool keeps in slabs (default is 8 MiB). */
+	size_t GetMemoryPoolLimit() const							{ return memorypoollimit; }
 private:
 	bool acceptown;
 	bool usepollthread;
+	bool pollthreadsched;
+	int pollthreadpolicy, pollthreadpriority, pollthreadnice;
+	uint64_t pollthreadcpumask;
+	bool usememorypool;
+	size_t memorypoollimit;
 	size_t maxpacksize;
 	double owntsunit;
 	RTPTransmitter::ReceiveMode receivemode;
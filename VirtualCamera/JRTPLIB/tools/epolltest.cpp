@@ -0,0 +1,8 @@
+#include <sys/epoll.h>
+
+int main(void)
+{
+	struct epoll_event events[2];
+	int fd = epoll_create1(EPOLL_CLOEXEC);
+	return epoll_wait(fd, events, 2, 0);
+}
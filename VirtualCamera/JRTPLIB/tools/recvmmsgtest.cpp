@@ -0,0 +1,8 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+
+int main(void)
+{
+	struct mmsghdr msgs[2];
+	return recvmmsg(-1, msgs, 2, MSG_DONTWAIT, 0);
+}
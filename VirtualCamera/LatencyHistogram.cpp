@@ -0,0 +1,107 @@
+#define LOG_TAG "VirtualCameraLatencyHistogram"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <cutils/log.h>
+
+#include "LatencyHistogram.h"
+
+namespace android {
+
+LatencyHistogram::LatencyHistogram(int32_t binSizeMs, int32_t binCount) :
+        mBinSizeMs(binSizeMs),
+        mBinCount(binCount),
+        mBins(binCount),
+        mTotalCount(0),
+        mMaxDuration(0),
+        mTotalDuration(0) {
+}
+
+void LatencyHistogram::add(nsecs_t start, nsecs_t end) {
+    nsecs_t duration = end - start;
+    int32_t durationMs = static_cast<int32_t>(duration / 1000000LL);
+    int32_t binIndex = durationMs / mBinSizeMs;
+
+    if (binIndex < 0) {
+        binIndex = 0;
+    } else if (binIndex >= mBinCount) {
+        binIndex = mBinCount-1;
+    }
+
+    Mutex::Autolock l(mLock);
+    mBins[binIndex]++;
+    mTotalCount++;
+    if (duration > 0) {
+        mTotalDuration += duration;
+        if (duration > mMaxDuration) mMaxDuration = duration;
+    }
+}
+
+void LatencyHistogram::reset() {
+    Mutex::Autolock l(mLock);
+    memset(mBins.data(), 0, mBins.size() * sizeof(int64_t));
+    mTotalCount = 0;
+    mMaxDuration = 0;
+    mTotalDuration = 0;
+}
+
+void LatencyHistogram::dump(int fd, const char* name) const {
+    Mutex::Autolock l(mLock);
+    if (mTotalCount == 0) {
+        return;
+    }
+
+    String8 lines;
+    lines.appendFormat("%s (%" PRId64 ") samples, avg %.2f ms, max %.2f ms\n", name, mTotalCount,
+            mTotalDuration / 1000000.0 / mTotalCount, mMaxDuration / 1000000.0);
+
+    String8 lineBins, lineBinCounts;
+    formatHistogramText(lineBins, lineBinCounts);
+
+    lineBins.append("\n");
+    lineBinCounts.append("\n");
+    lines.append(lineBins);
+    lines.append(lineBinCounts);
+
+    write(fd, lines.string(), lines.size());
+}
+
+void LatencyHistogram::log(const char* fmt, ...) {
+    Mutex::Autolock l(mLock);
+    if (mTotalCount == 0) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    String8 histogramName = String8::formatV(fmt, args);
+    ALOGI("%s (%" PRId64 ") samples, avg %.2f ms, max %.2f ms:", histogramName.string(), mTotalCount,
+            mTotalDuration / 1000000.0 / mTotalCount, mMaxDuration / 1000000.0);
+    va_end(args);
+
+    String8 lineBins, lineBinCounts;
+    formatHistogramText(lineBins, lineBinCounts);
+
+    ALOGI("%s", lineBins.c_str());
+    ALOGI("%s", lineBinCounts.c_str());
+}
+
+void LatencyHistogram::formatHistogramText(
+        String8& lineBins, String8& lineBinCounts) const {
+    lineBins = "  ";
+    lineBinCounts = "  ";
+
+    for (int32_t i = 0; i < mBinCount; i++) {
+        if (i == mBinCount - 1) {
+            lineBins.append("    inf (max ms)");
+        } else {
+            lineBins.appendFormat("%7d", mBinSizeMs*(i+1));
+        }
+        lineBinCounts.appendFormat("   %02.2f", 100.0*mBins[i]/mTotalCount);
+    }
+    lineBinCounts.append(" (%)");
+}
+
+};
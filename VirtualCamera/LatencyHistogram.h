@@ -0,0 +1,41 @@
+#ifndef __VIRTUALCAMERA_LATENCY_HISTOGRAM_H__
+#define __VIRTUALCAMERA_LATENCY_HISTOGRAM_H__
+
+#include <vector>
+
+#include <utils/Timers.h>
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+
+namespace android
+{
+
+// Latency histogram for the virtual camera pipeline, modeled on
+// CameraLatencyHistogram in libcameraservice/utils. Samples are added from
+// the receive/decoder threads and read from binder threads, so access is
+// serialized internally.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram() = delete;
+    LatencyHistogram(int32_t binSizeMs, int32_t binCount=10);
+    void add(nsecs_t start, nsecs_t end);
+    void reset();
+
+    void dump(int fd, const char* name) const;
+    void log(const char* format, ...);
+private:
+    int32_t mBinSizeMs;
+    int32_t mBinCount;
+    std::vector<int64_t> mBins;
+    uint64_t mTotalCount;
+    nsecs_t mMaxDuration;
+    nsecs_t mTotalDuration;
+    mutable Mutex mLock;
+
+    void formatHistogramText(String8& lineBins, String8& lineBinCounts) const;
+};
+
+};
+
+#endif // __VIRTUALCAMERA_LATENCY_HISTOGRAM_H__
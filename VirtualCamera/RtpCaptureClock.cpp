@@ -0,0 +1,100 @@
+#include <string.h>
+
+#include "RtpCaptureClock.h"
+
+// how long the timestamps are checked against the arrivals, and how far off they may be
+#define CAPTURE_CLOCK_PACE_WINDOW_US    1000000LL
+#define CAPTURE_CLOCK_PACE_TOLERANCE    0.2
+#define CAPTURE_CLOCK_MAX_JUMP_S        10
+
+RtpCaptureClock::RtpCaptureClock(uint32_t clockRate, long long windowUs)
+    : mClockRate(clockRate > 0 ? clockRate : 90000),
+      mWindowUs(windowUs),
+      mStarted(false),
+      mLastTimestamp(0),
+      mLastTicks(0),
+      mPaceStartUs(0),
+      mPaceStartTicks(0) {
+    pthread_mutex_init(&mLock, NULL);
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+RtpCaptureClock::~RtpCaptureClock() {
+    pthread_mutex_destroy(&mLock);
+}
+
+void RtpCaptureClock::RestartLocked(uint32_t timestamp, long long arrivalUs) {
+    mStarted = true;
+    mLastTimestamp = timestamp;
+    mLastTicks = 0;
+    mMinimum.clear();
+    mPaceStartUs = arrivalUs;
+    mPaceStartTicks = 0;
+    mStats.valid = false;
+}
+
+void RtpCaptureClock::OnFrame(uint32_t timestamp, long long arrivalUs) {
+    pthread_mutex_lock(&mLock);
+    mStats.frames++;
+    if (!mStarted) {
+        RestartLocked(timestamp, arrivalUs);
+    }
+    int32_t delta = (int32_t)(timestamp - mLastTimestamp);
+    if (delta > (int32_t)mClockRate * CAPTURE_CLOCK_MAX_JUMP_S || delta < -(int32_t)mClockRate * CAPTURE_CLOCK_MAX_JUMP_S) {
+        mStats.restarts++;
+        RestartLocked(timestamp, arrivalUs);
+        delta = 0;
+    }
+    long long ticks = mLastTicks + delta;
+    if (delta > 0) {
+        mLastTimestamp = timestamp;
+        mLastTicks = ticks;
+    }
+
+    Sample sample;
+    sample.arrivalUs = arrivalUs;
+    sample.transitUs = arrivalUs - TicksToUs(ticks);
+    while (!mMinimum.empty() && mMinimum.back().transitUs >= sample.transitUs)
+        mMinimum.pop_back();
+    mMinimum.push_back(sample);
+    while (mMinimum.front().arrivalUs < arrivalUs - mWindowUs)
+        mMinimum.pop_front();
+    mStats.offsetUs = mMinimum.front().transitUs;
+    mStats.delayUs = sample.transitUs - mStats.offsetUs;
+
+    long long spanUs = arrivalUs - mPaceStartUs;
+    if (delta > 0 && spanUs >= CAPTURE_CLOCK_PACE_WINDOW_US) {
+        double ratio = (double)TicksToUs(ticks - mPaceStartTicks) / spanUs;
+        mStats.valid = ratio >= 1.0 - CAPTURE_CLOCK_PACE_TOLERANCE && ratio <= 1.0 + CAPTURE_CLOCK_PACE_TOLERANCE;
+        mPaceStartUs = arrivalUs;
+        mPaceStartTicks = ticks;
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+long long RtpCaptureClock::ToLocalUs(uint32_t timestamp) const {
+    long long us = -1;
+    pthread_mutex_lock(&mLock);
+    if (mStarted && mStats.valid) {
+        us = TicksToUs(mLastTicks + (int32_t)(timestamp - mLastTimestamp)) + mStats.offsetUs;
+    }
+    pthread_mutex_unlock(&mLock);
+    return us;
+}
+
+void RtpCaptureClock::Reset() {
+    pthread_mutex_lock(&mLock);
+    mStarted = false;
+    mMinimum.clear();
+    mStats.valid = false;
+    mStats.offsetUs = 0;
+    mStats.delayUs = 0;
+    pthread_mutex_unlock(&mLock);
+}
+
+RtpCaptureClock::Stats RtpCaptureClock::GetStats() const {
+    pthread_mutex_lock(&mLock);
+    Stats stats = mStats;
+    pthread_mutex_unlock(&mLock);
+    return stats;
+}
@@ -0,0 +1,68 @@
+#ifndef __RTP_CAPTURE_CLOCK_H__
+#define __RTP_CAPTURE_CLOCK_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <deque>
+
+// Maps the sender's RTP timestamps, its capture times on the media clock,
+// onto the local clock the packet receive times are on (RTPTime::CurrentTime).
+//
+// The two clocks are not synchronized, so the offset between them is the
+// smallest transit (first packet arrival minus timestamp) of the frames that
+// arrived within the last window: a frame's local capture time is where it
+// would have arrived with the quickest frame's encoding and network delay.
+// The delay of a frame beyond that is what the link and the receive path
+// added to it, and frames keep the spacing they were captured with. The
+// window lets the offset follow a slow drift between the two clocks.
+//
+// Timestamps have to advance at the clock rate, within 20%, before anything
+// is mapped; a sender stamping a fixed increment per unit gets -1 throughout.
+// A jump of more than 10 s either way starts over.
+//
+// OnFrame is called from one thread; ToLocalUs from any.
+class RtpCaptureClock
+{
+public:
+    struct Stats {
+        uint64_t frames;
+        uint64_t restarts;          // timestamp jumps
+        bool valid;                 // timestamps follow the clock rate
+        long long offsetUs;         // smallest transit in the window
+        long long delayUs;          // the last frame's transit beyond that
+    };
+
+    RtpCaptureClock(uint32_t clockRate = 90000, long long windowUs = 5000000);
+    ~RtpCaptureClock();
+
+    // arrivalUs: when the first packet of the frame with this timestamp came in
+    void OnFrame(uint32_t timestamp, long long arrivalUs);
+    // The frame's capture time on the local clock, -1 while there is no valid mapping.
+    long long ToLocalUs(uint32_t timestamp) const;
+    void Reset();
+
+    Stats GetStats() const;
+
+private:
+    struct Sample {
+        long long arrivalUs;
+        long long transitUs;
+    };
+
+    void RestartLocked(uint32_t timestamp, long long arrivalUs);
+    long long TicksToUs(long long ticks) const { return ticks * 1000000LL / mClockRate; }
+
+    const uint32_t mClockRate;
+    const long long mWindowUs;
+
+    mutable pthread_mutex_t mLock;
+    bool mStarted;
+    uint32_t mLastTimestamp;        // newest timestamp seen, and its extended value
+    long long mLastTicks;
+    std::deque<Sample> mMinimum;    // increasing transits, the window's smallest first
+    long long mPaceStartUs;         // start of the current clock rate check
+    long long mPaceStartTicks;
+    Stats mStats;
+};
+
+#endif // __RTP_CAPTURE_CLOCK_H__
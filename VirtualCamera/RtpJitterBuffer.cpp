@@ -0,0 +1,289 @@
+#include <string.h>
+#include <algorithm>
+
+#include <JRTPLIB/src/rtppacket.h>
+
+#include "RtpJitterBuffer.h"
+
+using namespace jrtplib;
+
+// same window as RFC 3550 appendix A.1
+#define RTP_JITTER_MAX_MISORDER 100
+
+static int sRoundUpPow2(int n) {
+    int p = 16;
+    while (p < n && p < 32768)
+        p <<= 1;
+    return p;
+}
+
+static inline long long sArrivalUs(const RTPPacket *packet, long long nowUs) {
+    RTPTime t = packet->GetReceiveTime();
+    long long us = (long long)t.GetSeconds() * 1000000LL + t.GetMicroSeconds();
+    return us > 0 ? us : nowUs;
+}
+
+RtpJitterBuffer::RtpJitterBuffer(rtp_packet_callback deliver, rtp_packet_callback release, void *userdata,
+        int capacity)
+    : mDeliver(deliver),
+      mRelease(release),
+      mUserdata(userdata),
+      mSlots(NULL),
+      mCapacity(sRoundUpPow2(capacity)),
+      mHeld(0),
+      mMinDelayUs(10000),
+      mMaxDelayUs(200000),
+      mPolicy(POLICY_DISCARD),
+      mHaveSeq(false),
+      mSsrc(0),
+      mNextSeq(0),
+      mHighestSeq(0xffff),
+      mHaveTimestamp(false),
+      mLastTimestamp(0),
+      mHaveGivenUp(false),
+      mGivenUpOpen(false),
+      mGivenUpTimestamp(0),
+      mGivenUpFirstUs(0),
+      mDeadlineUs(-1),
+      mSampleCount(0),
+      mSampleNext(0),
+      mTargetUs(10000) {
+    memset(&mStats, 0, sizeof(mStats));
+    mSlots = new Slot[mCapacity];
+    memset(mSlots, 0, sizeof(Slot) * mCapacity);
+}
+
+RtpJitterBuffer::~RtpJitterBuffer() {
+    Reset();
+    delete[] mSlots;
+}
+
+void RtpJitterBuffer::SetDelay(long long minDelayUs, long long maxDelayUs) {
+    mMinDelayUs = minDelayUs > 0 ? minDelayUs : 0;
+    mMaxDelayUs = maxDelayUs > mMinDelayUs ? maxDelayUs : mMinDelayUs;
+    mTargetUs = std::min(std::max(mTargetUs, mMinDelayUs), mMaxDelayUs);
+}
+
+void RtpJitterBuffer::SetPolicy(int policy) {
+    mPolicy = policy == POLICY_FORWARD ? POLICY_FORWARD : POLICY_DISCARD;
+}
+
+void RtpJitterBuffer::Restart(uint16_t seq) {
+    mNextSeq = seq;
+    mHighestSeq = (uint16_t)(seq - 1);
+}
+
+void RtpJitterBuffer::Push(RTPPacket *packet, long long nowUs) {
+    uint16_t seq = packet->GetSequenceNumber();
+    uint32_t timestamp = packet->GetTimestamp();
+    long long arrivalUs = sArrivalUs(packet, nowUs);
+
+    mStats.packets++;
+    if (mHaveSeq && packet->GetSSRC() != mSsrc) {
+        // sender restarted
+        Flush();
+        mHaveSeq = false;
+    }
+    if (!mHaveSeq) {
+        mHaveSeq = true;
+        mSsrc = packet->GetSSRC();
+        mHaveTimestamp = false;
+        mHaveGivenUp = false;
+        Restart(seq);
+    }
+
+    int16_t behind = (int16_t)(uint16_t)(mNextSeq - seq);
+    if (!mHaveTimestamp && behind > 0 && behind <= RTP_JITTER_MAX_MISORDER
+            && (uint16_t)(mHighestSeq - seq) < (uint16_t)mCapacity) {
+        // nothing went yet: the stream starts earlier than its first packet said
+        mNextSeq = seq;
+    }
+
+    // a marked buffer may be followed by more with the same timestamp (SPS and
+    // PPS ahead of their IDR, the legacy sender's next unit): only an older
+    // one, or the rest of a frame given up on before its end was seen, is late
+    int16_t ahead = (int16_t)(uint16_t)(seq - mNextSeq);
+    bool older = mHaveTimestamp && ((int32_t)(timestamp - mLastTimestamp) < 0
+            || (mHaveGivenUp && mGivenUpOpen && timestamp == mGivenUpTimestamp));
+    if ((ahead < 0 && ahead >= -RTP_JITTER_MAX_MISORDER) || (older && ahead >= 0)) {
+        // its frame went already
+        mStats.late++;
+        if (mHaveGivenUp && timestamp == mGivenUpTimestamp)
+            AddSample(arrivalUs - mGivenUpFirstUs);
+        mRelease(mUserdata, packet);
+        if (ahead >= 0 && ahead < mCapacity) {
+            // the tail of a frame whose end was not known: no gap for the next one
+            SlotOf(seq).gone = true;
+            if ((int16_t)(uint16_t)(seq - mHighestSeq) > 0)
+                mHighestSeq = seq;
+            Release(nowUs);
+        }
+        return;
+    }
+    if (ahead < 0 || ahead >= mCapacity) {
+        // jumped far back, or too far ahead to keep the frames in between
+        Flush();
+        mHaveTimestamp = false;
+        Restart(seq);
+    }
+
+    Slot &slot = SlotOf(seq);
+    if (slot.packet != NULL) {
+        mStats.duplicates++;
+        mRelease(mUserdata, packet);
+        return;
+    }
+    if ((int16_t)(uint16_t)(seq - mHighestSeq) > 0)
+        mHighestSeq = seq;
+    else
+        mStats.reordered++;
+    slot.packet = packet;
+    slot.arrivalUs = arrivalUs;
+    mHeld++;
+
+    Release(nowUs);
+}
+
+void RtpJitterBuffer::Poll(long long nowUs) {
+    if (mHeld > 0)
+        Release(nowUs);
+}
+
+void RtpJitterBuffer::Release(long long nowUs) {
+    mDeadlineUs = -1;
+    while (mHeld > 0) {
+        // the head frame: from mNextSeq up to its marker, or up to the next timestamp
+        uint16_t stop = (uint16_t)(mHighestSeq + 1);
+        uint16_t s = mNextSeq;
+        uint16_t end = mHighestSeq;
+        bool gap = false;
+        bool ended = false;
+        bool haveTimestamp = false;
+        uint32_t timestamp = 0;
+        long long firstUs = 0, lastUs = 0;
+        for (; s != stop; s++) {
+            Slot &slot = SlotOf(s);
+            if (slot.packet == NULL) {
+                if (!slot.gone || haveTimestamp)
+                    gap = true;
+                continue;
+            }
+            if (!haveTimestamp) {
+                haveTimestamp = true;
+                timestamp = slot.packet->GetTimestamp();
+                firstUs = lastUs = slot.arrivalUs;
+            } else if (slot.packet->GetTimestamp() != timestamp) {
+                // a missing packet right before could belong to either frame: gap says incomplete
+                ended = true;
+                end = (uint16_t)(s - 1);
+                break;
+            }
+            firstUs = std::min(firstUs, slot.arrivalUs);
+            lastUs = std::max(lastUs, slot.arrivalUs);
+            if (slot.packet->HasMarker()) {
+                ended = true;
+                end = s;
+                break;
+            }
+        }
+
+        if (ended && !gap) {
+            for (s = mNextSeq; s != (uint16_t)(end + 1); s++) {
+                Slot &slot = SlotOf(s);
+                RTPPacket *packet = slot.packet;
+                slot.gone = false;
+                if (packet == NULL)
+                    continue;
+                slot.packet = NULL;
+                mHeld--;
+                mDeliver(mUserdata, packet);
+            }
+            mStats.frames++;
+            mNextSeq = (uint16_t)(end + 1);
+            mHaveTimestamp = true;
+            mLastTimestamp = timestamp;
+            AddSample(lastUs - firstUs);
+            continue;
+        }
+        if (nowUs < firstUs + mTargetUs) {
+            mDeadlineUs = firstUs + mTargetUs;
+            break;
+        }
+        GiveUp(end, ended, timestamp, firstUs);
+    }
+}
+
+void RtpJitterBuffer::GiveUp(uint16_t end, bool ended, uint32_t timestamp, long long firstUs) {
+    for (uint16_t s = mNextSeq; s != (uint16_t)(end + 1); s++) {
+        Slot &slot = SlotOf(s);
+        RTPPacket *packet = slot.packet;
+        if (packet == NULL) {
+            if (!slot.gone)
+                mStats.lost++;
+            slot.gone = false;
+            continue;
+        }
+        slot.packet = NULL;
+        mHeld--;
+        if (mPolicy == POLICY_FORWARD)
+            mDeliver(mUserdata, packet);
+        else
+            mRelease(mUserdata, packet);
+    }
+    mStats.incomplete++;
+    mNextSeq = (uint16_t)(end + 1);
+    mHaveTimestamp = true;
+    mLastTimestamp = timestamp;
+    mHaveGivenUp = true;
+    mGivenUpOpen = !ended;
+    mGivenUpTimestamp = timestamp;
+    mGivenUpFirstUs = firstUs;
+}
+
+void RtpJitterBuffer::AddSample(long long delayUs) {
+    mSamples[mSampleNext] = delayUs > 0 ? delayUs : 0;
+    mSampleNext = (mSampleNext + 1) % DELAY_SAMPLES;
+    if (mSampleCount < DELAY_SAMPLES)
+        mSampleCount++;
+
+    long long sorted[DELAY_SAMPLES];
+    memcpy(sorted, mSamples, sizeof(long long) * mSampleCount);
+    int rank = mSampleCount * 95 / 100;
+    std::nth_element(sorted, sorted + rank, sorted + mSampleCount);
+    long long want = sorted[rank] + sorted[rank] / 4;
+    want = std::min(std::max(want, mMinDelayUs), mMaxDelayUs);
+    if (want >= mTargetUs)
+        mTargetUs = want;
+    else
+        mTargetUs -= (mTargetUs - want + 63) / 64;
+}
+
+void RtpJitterBuffer::Flush() {
+    if (!mHaveSeq)
+        return;
+    while (mNextSeq != (uint16_t)(mHighestSeq + 1)) {
+        Slot &slot = SlotOf(mNextSeq);
+        mNextSeq++;
+        if (slot.packet != NULL) {
+            RTPPacket *packet = slot.packet;
+            slot.packet = NULL;
+            mHeld--;
+            mDeliver(mUserdata, packet);
+        } else if (!slot.gone) {
+            mStats.lost++;
+        }
+        slot.gone = false;
+    }
+    mDeadlineUs = -1;
+}
+
+void RtpJitterBuffer::Reset() {
+    for (int i = 0; i < mCapacity; i++) {
+        if (mSlots[i].packet != NULL)
+            mRelease(mUserdata, mSlots[i].packet);
+    }
+    memset(mSlots, 0, sizeof(Slot) * mCapacity);
+    mHeld = 0;
+    mHaveSeq = false;
+    mDeadlineUs = -1;
+}
@@ -0,0 +1,127 @@
+#ifndef __RTP_JITTER_BUFFER_H__
+#define __RTP_JITTER_BUFFER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "RtpNack.h"
+
+namespace jrtplib {
+class RTPPacket;
+}
+
+// Frame aware jitter buffer in front of the depacketizer. Packets are held in
+// a ring indexed by sequence number; the frame at the head (the packets from
+// the next expected sequence number on that share an RTP timestamp) goes out
+// in sequence order as soon as it is complete, i.e. its marker packet and
+// everything before it are there. A frame may also end without a marker when
+// the next timestamp follows without a gap: the legacy sender stamps the
+// first fragment of a unit with the previous unit's timestamp, and its units
+// simply go out in two parts.
+//
+// An incomplete head frame waits until its playout deadline, the arrival of
+// its first packet plus the target delay. Then it is discarded (the
+// depacketizer sees the sequence jump and waits for the next IDR) or what
+// arrived of it is forwarded, depending on the policy; the frames behind it
+// wait in either case. Packets of a frame that already went are late and
+// released.
+//
+// The target delay adapts to how long frames take to complete: the 95th
+// percentile of the last frames' first-to-last packet spread plus a quarter,
+// within [minDelayUs, maxDelayUs]. It rises at once and falls back slowly.
+// Packets arriving late for a frame given up on count with what they would
+// have needed, so a link that recovers its losses by retransmission ends up
+// with enough delay for them.
+//
+// Packets go to deliver, which takes ownership; those the buffer drops go to
+// release. Single threaded.
+class RtpJitterBuffer
+{
+public:
+    enum {
+        POLICY_DISCARD = 0,     // incomplete frames are dropped at their deadline
+        POLICY_FORWARD,         // what arrived of them goes on
+    };
+
+    struct Stats {
+        uint64_t packets;
+        uint64_t frames;            // complete frames delivered
+        uint64_t incomplete;        // frames still incomplete at their deadline
+        uint64_t lost;              // sequence numbers not there by their frame's deadline
+        uint64_t late;              // packets of frames already delivered or given up on
+        uint64_t duplicates;
+        uint64_t reordered;         // arrived behind a later packet
+    };
+
+    RtpJitterBuffer(rtp_packet_callback deliver, rtp_packet_callback release, void *userdata,
+            int capacity = 1024);
+    ~RtpJitterBuffer();
+
+    // Defaults: 10 to 200 ms, discard.
+    void SetDelay(long long minDelayUs, long long maxDelayUs);
+    void SetPolicy(int policy);
+
+    // The packet's receive time is its arrival; nowUs is on the same clock.
+    void Push(jrtplib::RTPPacket *packet, long long nowUs);
+    // Gives up on the head frame once its deadline is over.
+    void Poll(long long nowUs);
+    // The head frame's deadline, -1 when nothing is held.
+    long long GetNextDeadlineUs() const { return mDeadlineUs; }
+
+    // Delivers everything held in sequence order, skipping the gaps.
+    void Flush();
+    // Releases everything held and forgets the stream.
+    void Reset();
+
+    long long GetTargetDelayUs() const { return mTargetUs; }
+    const Stats &GetStats() const { return mStats; }
+    int GetHeldPackets() const { return mHeld; }
+
+private:
+    enum { DELAY_SAMPLES = 128 };
+
+    struct Slot {
+        jrtplib::RTPPacket *packet;
+        long long arrivalUs;
+        bool gone;          // arrived late for a frame already given up on
+    };
+
+    Slot &SlotOf(uint16_t seq) { return mSlots[seq & (mCapacity - 1)]; }
+    void Restart(uint16_t seq);
+    void Release(long long nowUs);
+    void GiveUp(uint16_t end, bool ended, uint32_t timestamp, long long firstUs);
+    void AddSample(long long delayUs);
+
+    rtp_packet_callback mDeliver;
+    rtp_packet_callback mRelease;
+    void *mUserdata;
+
+    Slot *mSlots;
+    int mCapacity;          // power of two
+    int mHeld;
+
+    long long mMinDelayUs;
+    long long mMaxDelayUs;
+    int mPolicy;
+
+    bool mHaveSeq;
+    uint32_t mSsrc;
+    uint16_t mNextSeq;      // first one of the head frame
+    uint16_t mHighestSeq;
+    bool mHaveTimestamp;
+    uint32_t mLastTimestamp;        // of the last frame that went
+    bool mHaveGivenUp;
+    bool mGivenUpOpen;              // its end was not seen
+    uint32_t mGivenUpTimestamp;     // the last frame given up on, and when it started
+    long long mGivenUpFirstUs;
+    long long mDeadlineUs;
+
+    long long mSamples[DELAY_SAMPLES];
+    int mSampleCount;
+    int mSampleNext;
+    long long mTargetUs;
+
+    Stats mStats;
+};
+
+#endif // __RTP_JITTER_BUFFER_H__
@@ -0,0 +1,89 @@
+#include <string.h>
+
+#include "RtpKeyframeRequest.h"
+
+static inline void sPut32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint32_t sGet32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+size_t RtpKeyframeRequest_BuildPli(uint32_t mediaSsrc, uint8_t *out, size_t maxlen) {
+    if (maxlen < 4)
+        return 0;
+    sPut32(out, mediaSsrc);
+    return 4;
+}
+
+size_t RtpKeyframeRequest_BuildFir(uint32_t mediaSsrc, uint8_t seqNr, uint8_t *out, size_t maxlen) {
+    if (maxlen < 12)
+        return 0;
+    // RFC 5104 4.3.1.2: the media source field is unused, the FCI names the stream
+    sPut32(out, 0);
+    sPut32(out + 4, mediaSsrc);
+    out[8] = seqNr;
+    out[9] = out[10] = out[11] = 0;
+    return 12;
+}
+
+int RtpKeyframeRequest_Parse(const uint8_t *rtcp, size_t len, uint32_t *mediaSsrc) {
+    // common header, sender SSRC, media SSRC
+    if (len < 12)
+        return -1;
+    if ((rtcp[0] >> 6) != 2 || rtcp[1] != RTCP_PSFB)
+        return -1;
+    size_t packetlen = ((size_t)(rtcp[2] << 8 | rtcp[3]) + 1) * 4;
+    if (packetlen > len)
+        return -1;
+
+    int fmt = rtcp[0] & 0x1f;
+    if (fmt == RTCP_PSFB_FMT_PLI) {
+        *mediaSsrc = sGet32(rtcp + 8);
+        return fmt;
+    }
+    if (fmt == RTCP_PSFB_FMT_FIR && packetlen >= 20) {
+        *mediaSsrc = sGet32(rtcp + 12);
+        return fmt;
+    }
+    return -1;
+}
+
+RtpKeyframeRequester::RtpKeyframeRequester(long long intervalUs)
+    : mIntervalUs(intervalUs > 0 ? intervalUs : 1),
+      mPending(false),
+      mNextUs(0),
+      mFirSeqNr(0) {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+void RtpKeyframeRequester::SetInterval(long long intervalUs) {
+    mIntervalUs = intervalUs > 0 ? intervalUs : 1;
+}
+
+void RtpKeyframeRequester::Request(long long nowUs) {
+    if (mPending)
+        return;
+    mPending = true;
+    mNextUs = nowUs;
+    mFirSeqNr++;
+    mStats.requests++;
+}
+
+bool RtpKeyframeRequester::Due(long long nowUs) {
+    if (!mPending || nowUs < mNextUs)
+        return false;
+    mNextUs = nowUs + mIntervalUs;
+    mStats.sent++;
+    return true;
+}
+
+void RtpKeyframeRequester::OnKeyframe() {
+    if (mPending)
+        mStats.answered++;
+    mPending = false;
+}
@@ -0,0 +1,68 @@
+#ifndef __RTP_KEYFRAME_REQUEST_H__
+#define __RTP_KEYFRAME_REQUEST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// RFC 4585 payload specific feedback: picture loss indication, and the full
+// intra request of RFC 5104
+#define RTCP_PSFB               206
+#define RTCP_PSFB_FMT_PLI       1
+#define RTCP_PSFB_FMT_FIR       4
+
+// What follows the sender SSRC in a PLI: the media source SSRC and no FCI.
+// Returns the length in bytes, 0 when maxlen is too small.
+size_t RtpKeyframeRequest_BuildPli(uint32_t mediaSsrc, uint8_t *out, size_t maxlen);
+// What follows the sender SSRC in a FIR: a media source SSRC of 0, then one
+// FCI entry (SSRC, command sequence number, reserved). seqNr goes up by one
+// for every new request and stays the same for repetitions. Returns the
+// length in bytes, 0 when maxlen is too small.
+size_t RtpKeyframeRequest_BuildFir(uint32_t mediaSsrc, uint8_t seqNr, uint8_t *out, size_t maxlen);
+
+// Parses one RTCP packet (common header included) as a PLI or FIR. Returns
+// RTCP_PSFB_FMT_PLI or RTCP_PSFB_FMT_FIR with the SSRC of the stream asked
+// for an IDR (for a FIR, the one in its first FCI entry), -1 for anything else.
+int RtpKeyframeRequest_Parse(const uint8_t *rtcp, size_t len, uint32_t *mediaSsrc);
+
+// Receive side: paces the requests for a keyframe. The first one is due at
+// once; while no keyframe arrives, it is repeated every interval, as either
+// the request or the keyframe may have been lost on the way.
+//
+// Single threaded.
+class RtpKeyframeRequester
+{
+public:
+    struct Stats {
+        uint64_t requests;          // times a keyframe was asked for while none was pending
+        uint64_t sent;              // requests due, repetitions included
+        uint64_t answered;          // keyframes that arrived while one was pending
+    };
+
+    RtpKeyframeRequester(long long intervalUs = 300000);
+
+    void SetInterval(long long intervalUs);
+
+    // The stream can only recover from a keyframe.
+    void Request(long long nowUs);
+    // True when a request has to go out now; it is counted as sent.
+    bool Due(long long nowUs);
+    // A keyframe arrived, whatever asked for it.
+    void OnKeyframe();
+
+    bool IsPending() const { return mPending; }
+    // Next time Due returns true, -1 when nothing is pending.
+    long long GetNextDeadlineUs() const { return mPending ? mNextUs : -1; }
+    // For RtpKeyframeRequest_BuildFir.
+    uint8_t GetFirSeqNr() const { return mFirSeqNr; }
+    const Stats &GetStats() const { return mStats; }
+
+private:
+    long long mIntervalUs;
+    bool mPending;
+    long long mNextUs;
+    uint8_t mFirSeqNr;
+
+    Stats mStats;
+};
+
+#endif // __RTP_KEYFRAME_REQUEST_H__
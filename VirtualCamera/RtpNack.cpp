@@ -0,0 +1,348 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <JRTPLIB/src/rtppacket.h>
+
+#include "RtpNack.h"
+
+using namespace jrtplib;
+
+// same window as RFC 3550 appendix A.1
+#define RTP_NACK_MAX_MISORDER   100
+
+static int sRoundUpPow2(int n) {
+    int p = 16;
+    while (p < n && p < 32768)
+        p <<= 1;
+    return p;
+}
+
+static inline void sPut16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline uint16_t sGet16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+size_t RtpNack_BuildFci(uint32_t mediaSsrc, const uint16_t *seqs, int count, uint8_t *out, size_t maxlen) {
+    if (count <= 0 || maxlen < 8)
+        return 0;
+
+    sPut16(out, (uint16_t)(mediaSsrc >> 16));
+    sPut16(out + 2, (uint16_t)mediaSsrc);
+    size_t len = 4;
+    int i = 0;
+    while (i < count && len + 4 <= maxlen) {
+        uint16_t pid = seqs[i++];
+        uint16_t blp = 0;
+        while (i < count) {
+            uint16_t d = (uint16_t)(seqs[i] - pid);
+            if (d == 0 || d > 16)
+                break;
+            blp |= (uint16_t)(1 << (d - 1));
+            i++;
+        }
+        sPut16(out + len, pid);
+        sPut16(out + len + 2, blp);
+        len += 4;
+    }
+    return len;
+}
+
+int RtpNack_Parse(const uint8_t *rtcp, size_t len, uint32_t *mediaSsrc, uint16_t *seqs, int maxSeqs) {
+    // common header, sender SSRC, media SSRC, at least one (PID, BLP)
+    if (len < 16)
+        return -1;
+    if ((rtcp[0] >> 6) != 2 || (rtcp[0] & 0x1f) != RTCP_RTPFB_FMT_NACK || rtcp[1] != RTCP_RTPFB)
+        return -1;
+    size_t packetlen = ((size_t)sGet16(rtcp + 2) + 1) * 4;
+    if (packetlen > len || packetlen < 16)
+        return -1;
+
+    *mediaSsrc = (uint32_t)sGet16(rtcp + 8) << 16 | sGet16(rtcp + 10);
+    int n = 0;
+    for (size_t offset = 12; offset + 4 <= packetlen; offset += 4) {
+        uint16_t pid = sGet16(rtcp + offset);
+        uint16_t blp = sGet16(rtcp + offset + 2);
+        if (n < maxSeqs)
+            seqs[n++] = pid;
+        for (int b = 0; b < 16 && n < maxSeqs; b++) {
+            if (blp & (1 << b))
+                seqs[n++] = (uint16_t)(pid + b + 1);
+        }
+    }
+    return n;
+}
+
+RtpNackBuffer::RtpNackBuffer(rtp_packet_callback deliver, rtp_packet_callback release, void *userdata,
+        int capacity)
+    : mDeliver(deliver),
+      mRelease(release),
+      mUserdata(userdata),
+      mSlots(NULL),
+      mCapacity(sRoundUpPow2(capacity)),
+      mHeld(0),
+      mHoldUs(80000),
+      mRetryUs(20000),
+      mMaxRetries(3),
+      mOrdered(true),
+      mHaveSeq(false),
+      mSsrc(0),
+      mNextSeq(0),
+      mHighestSeq(0xffff) {
+    memset(&mStats, 0, sizeof(mStats));
+    mSlots = new Slot[mCapacity];
+    memset(mSlots, 0, sizeof(Slot) * mCapacity);
+}
+
+RtpNackBuffer::~RtpNackBuffer() {
+    Reset();
+    delete[] mSlots;
+}
+
+void RtpNackBuffer::SetTiming(long long holdUs, long long retryUs, int maxRetries) {
+    if (holdUs <= 0 && mHoldUs > 0)
+        Flush();
+    mHoldUs = holdUs > 0 ? holdUs : 0;
+    mRetryUs = retryUs > 0 ? retryUs : 1;
+    mMaxRetries = maxRetries > 0 ? maxRetries : 0;
+}
+
+void RtpNackBuffer::SetOrdering(bool ordered) {
+    if (!ordered && mOrdered)
+        Flush();
+    mOrdered = ordered;
+}
+
+void RtpNackBuffer::Restart(uint16_t seq) {
+    mNextSeq = seq;
+    mHighestSeq = (uint16_t)(seq - 1);
+}
+
+void RtpNackBuffer::Push(RTPPacket *packet, long long nowUs) {
+    uint16_t seq = packet->GetSequenceNumber();
+
+    mStats.packets++;
+    if (mHoldUs <= 0) {
+        mDeliver(mUserdata, packet);
+        return;
+    }
+
+    if (mHaveSeq && packet->GetSSRC() != mSsrc) {
+        // sender restarted
+        Flush();
+        mHaveSeq = false;
+    }
+    if (!mHaveSeq) {
+        mHaveSeq = true;
+        mSsrc = packet->GetSSRC();
+        Restart(seq);
+    }
+
+    int16_t ahead = (int16_t)(uint16_t)(seq - mNextSeq);
+    if (ahead < 0 && ahead >= -RTP_NACK_MAX_MISORDER) {
+        // a duplicate of a delivered packet, or a retransmission that came too late
+        mStats.late++;
+        if (mOrdered)
+            mRelease(mUserdata, packet);
+        else
+            mDeliver(mUserdata, packet);
+        return;
+    }
+    if (ahead < 0 || ahead >= mCapacity) {
+        // jumped far back, or too far ahead to keep the gap: start over from here
+        Flush();
+        Restart(seq);
+    }
+
+    Slot &slot = SlotOf(seq);
+    // unordered, a packet already passed on only leaves its slot not missing
+    if (slot.packet != NULL
+            || (!mOrdered && (int16_t)(uint16_t)(seq - mHighestSeq) <= 0 && !slot.missing)) {
+        mStats.duplicates++;
+        mRelease(mUserdata, packet);
+        return;
+    }
+    if ((int16_t)(uint16_t)(seq - mHighestSeq) > 0) {
+        for (uint16_t s = (uint16_t)(mHighestSeq + 1); s != seq; s++) {
+            Slot &gap = SlotOf(s);
+            gap.missing = true;
+            gap.retries = 0;
+            gap.missingSinceUs = nowUs;
+            gap.nackAtUs = nowUs;
+            mStats.missing++;
+        }
+        mHighestSeq = seq;
+    } else {
+        mStats.reordered++;
+        if (slot.missing && slot.retries > 0)
+            mStats.recovered++;
+    }
+    slot.missing = false;
+    if (mOrdered) {
+        slot.packet = packet;
+        mHeld++;
+    } else {
+        mDeliver(mUserdata, packet);
+    }
+
+    Deliver(nowUs);
+}
+
+void RtpNackBuffer::Deliver(long long nowUs) {
+    while (mNextSeq != (uint16_t)(mHighestSeq + 1)) {
+        Slot &slot = SlotOf(mNextSeq);
+        if (slot.packet != NULL) {
+            RTPPacket *packet = slot.packet;
+            slot.packet = NULL;
+            mHeld--;
+            mNextSeq++;
+            mDeliver(mUserdata, packet);
+        } else if (!slot.missing) {
+            // unordered: went on when it arrived
+            mNextSeq++;
+        } else if (nowUs - slot.missingSinceUs >= mHoldUs
+                || (slot.retries >= mMaxRetries && nowUs >= slot.nackAtUs)) {
+            // out of time, or out of requests and the last one went unanswered
+            slot.missing = false;
+            mStats.lost++;
+            mNextSeq++;
+        } else {
+            break;
+        }
+    }
+}
+
+void RtpNackBuffer::Poll(long long nowUs) {
+    if (mHaveSeq)
+        Deliver(nowUs);
+}
+
+int RtpNackBuffer::CollectNacks(long long nowUs, uint16_t *seqs, int maxSeqs, uint32_t *mediaSsrc) {
+    int n = 0;
+
+    if (!mHaveSeq)
+        return 0;
+    for (uint16_t s = mNextSeq; s != (uint16_t)(mHighestSeq + 1) && n < maxSeqs; s++) {
+        Slot &slot = SlotOf(s);
+        if (!slot.missing || slot.retries >= mMaxRetries || slot.nackAtUs > nowUs)
+            continue;
+        seqs[n++] = s;
+        slot.retries++;
+        slot.nackAtUs = nowUs + mRetryUs;
+    }
+    mStats.requested += n;
+    *mediaSsrc = mSsrc;
+    return n;
+}
+
+long long RtpNackBuffer::GetNextDeadlineUs() const {
+    long long deadline = -1;
+
+    if (!mHaveSeq)
+        return -1;
+    for (uint16_t s = mNextSeq; s != (uint16_t)(mHighestSeq + 1); s++) {
+        const Slot &slot = SlotOf(s);
+        if (!slot.missing)
+            continue;
+        // the next request, or giving up
+        long long t = slot.missingSinceUs + mHoldUs;
+        if (slot.nackAtUs < t)
+            t = slot.nackAtUs;
+        if (deadline < 0 || t < deadline)
+            deadline = t;
+    }
+    return deadline;
+}
+
+void RtpNackBuffer::Flush() {
+    if (!mHaveSeq)
+        return;
+    while (mNextSeq != (uint16_t)(mHighestSeq + 1)) {
+        Slot &slot = SlotOf(mNextSeq);
+        mNextSeq++;
+        if (slot.packet != NULL) {
+            RTPPacket *packet = slot.packet;
+            slot.packet = NULL;
+            mHeld--;
+            mDeliver(mUserdata, packet);
+        } else if (slot.missing) {
+            slot.missing = false;
+            mStats.lost++;
+        }
+    }
+}
+
+void RtpNackBuffer::Reset() {
+    for (int i = 0; i < mCapacity; i++) {
+        if (mSlots[i].packet != NULL)
+            mRelease(mUserdata, mSlots[i].packet);
+    }
+    memset(mSlots, 0, sizeof(Slot) * mCapacity);
+    mHeld = 0;
+    mHaveSeq = false;
+}
+
+RtpRetransmitCache::RtpRetransmitCache(int capacity, size_t maxPacketSize)
+    : mSlots(NULL),
+      mCapacity(sRoundUpPow2(capacity)),
+      mMaxPacketSize(maxPacketSize) {
+    memset(&mStats, 0, sizeof(mStats));
+    pthread_mutex_init(&mLock, NULL);
+    mSlots = new Slot[mCapacity];
+    memset(mSlots, 0, sizeof(Slot) * mCapacity);
+}
+
+RtpRetransmitCache::~RtpRetransmitCache() {
+    for (int i = 0; i < mCapacity; i++)
+        free(mSlots[i].data);
+    delete[] mSlots;
+    pthread_mutex_destroy(&mLock);
+}
+
+void RtpRetransmitCache::Store(const void *header, size_t headerLen, const void *payload, size_t payloadLen) {
+    size_t len = headerLen + payloadLen;
+    if (headerLen < 4 || len > mMaxPacketSize)
+        return;
+
+    uint16_t seq = sGet16((const uint8_t *)header + 2);
+    pthread_mutex_lock(&mLock);
+    Slot &slot = mSlots[seq & (mCapacity - 1)];
+    if (slot.data == NULL)
+        slot.data = (uint8_t *)malloc(mMaxPacketSize);
+    if (slot.data != NULL) {
+        memcpy(slot.data, header, headerLen);
+        if (payloadLen > 0)
+            memcpy(slot.data + headerLen, payload, payloadLen);
+        slot.len = len;
+        slot.seq = seq;
+        mStats.stored++;
+    }
+    pthread_mutex_unlock(&mLock);
+}
+
+size_t RtpRetransmitCache::Lookup(uint16_t seq, uint8_t *out, size_t maxlen) {
+    size_t len = 0;
+
+    pthread_mutex_lock(&mLock);
+    mStats.requested++;
+    Slot &slot = mSlots[seq & (mCapacity - 1)];
+    if (slot.len > 0 && slot.seq == seq && slot.len <= maxlen) {
+        memcpy(out, slot.data, slot.len);
+        len = slot.len;
+        mStats.resent++;
+    } else {
+        mStats.missed++;
+    }
+    pthread_mutex_unlock(&mLock);
+    return len;
+}
+
+RtpRetransmitCache::Stats RtpRetransmitCache::GetStats() {
+    pthread_mutex_lock(&mLock);
+    Stats stats = mStats;
+    pthread_mutex_unlock(&mLock);
+    return stats;
+}
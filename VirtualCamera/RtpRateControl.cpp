@@ -0,0 +1,351 @@
+#include <math.h>
+#include <string.h>
+
+#include "RtpRateControl.h"
+
+// delay trend, as in the GCC trendline estimator
+#define RATE_SMOOTHING          0.9     // of the accumulated delay
+#define RATE_TREND_GAIN         4.0
+#define RATE_TREND_MAX_DELTAS   60
+#define RATE_THRESHOLD_START    12.5    // ms
+#define RATE_THRESHOLD_MIN      6.0
+#define RATE_THRESHOLD_MAX      600.0
+#define RATE_THRESHOLD_UP       0.0087  // per ms, while the trend is above the threshold
+#define RATE_THRESHOLD_DOWN     0.039
+#define RATE_OVERUSE_MS         10.0    // how long the trend has to stay above the threshold
+
+// how the target moves
+#define RATE_INCREASE_PER_S     1.08
+#define RATE_DECREASE           0.85    // of the received rate, on overuse
+#define RATE_RECEIVED_HEADROOM  1.5     // the target does not run away from what arrives
+#define RATE_LOSS_HIGH          0.10
+#define RATE_LOSS_LOW           0.02
+#define RATE_LOSS_MIN_PACKETS   20      // fewer expected in an interval say nothing about loss
+
+// the timestamps have to keep pace with arrival over this long before the delay part is used
+#define RATE_CLOCK_WINDOW_US    2000000LL
+#define RATE_CLOCK_TOLERANCE    0.2
+
+static inline void sPut32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static inline uint32_t sGet32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+size_t RtpRate_BuildApp(uint32_t mediaSsrc, uint32_t bitrate, uint8_t *out, size_t maxlen) {
+    if (maxlen < RTCP_APP_RATE_LENGTH)
+        return 0;
+    sPut32(out, mediaSsrc);
+    sPut32(out + 4, bitrate);
+    return RTCP_APP_RATE_LENGTH;
+}
+
+int RtpRate_ParseApp(const uint8_t *name, uint8_t subtype, const uint8_t *data, size_t len,
+        uint32_t *mediaSsrc, uint32_t *bitrate) {
+    if (memcmp(name, RTCP_APP_RATE_NAME, 4) != 0 || subtype != RTCP_APP_RATE_SUBTYPE
+            || data == NULL || len < RTCP_APP_RATE_LENGTH)
+        return -1;
+    *mediaSsrc = sGet32(data);
+    *bitrate = sGet32(data + 4);
+    return 0;
+}
+
+void RtpRateController::GetDefaultConfig(Config *config) {
+    config->minBitrate = 300000;
+    config->maxBitrate = 8000000;
+    config->startBitrate = 2000000;
+    config->intervalUs = 200000;
+    config->clockRate = 90000.0;
+}
+
+RtpRateController::RtpRateController(const Config &config)
+    : mConfig(config) {
+    if (mConfig.maxBitrate < mConfig.minBitrate)
+        mConfig.maxBitrate = mConfig.minBitrate;
+    if (mConfig.intervalUs <= 0)
+        mConfig.intervalUs = 200000;
+    Reset();
+}
+
+void RtpRateController::Reset() {
+    mHaveGroup = false;
+    mGroupTimestamp = 0;
+    mGroupFirstUs = 0;
+    mGroupLastUs = 0;
+    mHavePrevGroup = false;
+    mPrevTimestamp = 0;
+    mPrevArrivalUs = 0;
+
+    mClockStartUs = -1;
+    mClockStartTimestamp = 0;
+
+    mAccumulatedDelayMs = 0;
+    mSmoothedDelayMs = 0;
+    mFirstArrivalUs = -1;
+    mTrendCount = 0;
+    mTrendNext = 0;
+    mDeltas = 0;
+    mPrevTrend = 0;
+    mThreshold = RATE_THRESHOLD_START;
+    mLastThresholdUs = -1;
+    mOveruseMs = 0;
+    mOveruseCount = 0;
+    mUsage = USAGE_NORMAL;
+
+    mIntervalBytes = 0;
+    memset(mBucketBytes, 0, sizeof(mBucketBytes));
+    memset(mBucketUs, 0, sizeof(mBucketUs));
+    mBucketNext = 0;
+
+    mStarted = false;
+    mLastUpdateUs = 0;
+    mNextUpdateUs = -1;
+    mLastDecreaseUs = -1;
+    mLastLossDecreaseUs = -1;
+    uint32_t start = mConfig.startBitrate;
+    if (start < mConfig.minBitrate)
+        start = mConfig.minBitrate;
+    if (start > mConfig.maxBitrate)
+        start = mConfig.maxBitrate;
+    mDelayBased = start;
+    mLossBased = start;
+    mTarget = start;
+    mHaveSource = false;
+    mLastExtendedSeq = 0;
+    mLastReceived = 0;
+
+    memset(&mStats, 0, sizeof(mStats));
+    mStats.threshold = mThreshold;
+}
+
+void RtpRateController::OnPacket(long long arrivalUs, uint32_t rtpTimestamp, size_t bytes) {
+    mStats.packets++;
+    mIntervalBytes += bytes;
+    if (!mStarted) {
+        mStarted = true;
+        mLastUpdateUs = arrivalUs;
+        mNextUpdateUs = arrivalUs + mConfig.intervalUs;
+    }
+
+    if (!mHaveGroup) {
+        mHaveGroup = true;
+        mGroupTimestamp = rtpTimestamp;
+        mGroupFirstUs = mGroupLastUs = arrivalUs;
+        return;
+    }
+    int32_t ahead = (int32_t)(rtpTimestamp - mGroupTimestamp);
+    if (ahead == 0) {
+        mGroupLastUs = arrivalUs;
+    } else if (ahead > 0) {
+        // the previous frame is complete
+        OnFrame(mGroupLastUs, mGroupTimestamp);
+        mGroupTimestamp = rtpTimestamp;
+        mGroupFirstUs = mGroupLastUs = arrivalUs;
+    }
+    // older frames (reordering, retransmissions) say nothing about the queue now
+}
+
+void RtpRateController::CheckClock(long long arrivalUs, uint32_t rtpTimestamp) {
+    if (mClockStartUs < 0) {
+        mClockStartUs = arrivalUs;
+        mClockStartTimestamp = rtpTimestamp;
+        return;
+    }
+    long long spanUs = arrivalUs - mClockStartUs;
+    if (spanUs < RATE_CLOCK_WINDOW_US)
+        return;
+    double ratio = (uint32_t)(rtpTimestamp - mClockStartTimestamp) / mConfig.clockRate * 1000000.0 / spanUs;
+    bool valid = fabs(ratio - 1.0) <= RATE_CLOCK_TOLERANCE;
+    if (valid != mStats.clockValid) {
+        // start the trend over on either change
+        mTrendCount = 0;
+        mTrendNext = 0;
+        mDeltas = 0;
+        mAccumulatedDelayMs = 0;
+        mSmoothedDelayMs = 0;
+        mUsage = USAGE_NORMAL;
+    }
+    mStats.clockValid = valid;
+    mClockStartUs = arrivalUs;
+    mClockStartTimestamp = rtpTimestamp;
+}
+
+void RtpRateController::OnFrame(long long arrivalUs, uint32_t rtpTimestamp) {
+    mStats.frames++;
+    CheckClock(arrivalUs, rtpTimestamp);
+    if (!mHavePrevGroup) {
+        mHavePrevGroup = true;
+        mPrevTimestamp = rtpTimestamp;
+        mPrevArrivalUs = arrivalUs;
+        return;
+    }
+    double sendDeltaMs = (uint32_t)(rtpTimestamp - mPrevTimestamp) / mConfig.clockRate * 1000.0;
+    double arrivalDeltaMs = (arrivalUs - mPrevArrivalUs) / 1000.0;
+    mPrevTimestamp = rtpTimestamp;
+    mPrevArrivalUs = arrivalUs;
+    if (!mStats.clockValid)
+        return;
+
+    // one way delay growth, smoothed, against arrival time
+    mAccumulatedDelayMs += arrivalDeltaMs - sendDeltaMs;
+    mSmoothedDelayMs = RATE_SMOOTHING * mSmoothedDelayMs + (1 - RATE_SMOOTHING) * mAccumulatedDelayMs;
+    if (mFirstArrivalUs < 0)
+        mFirstArrivalUs = arrivalUs;
+    mTrendX[mTrendNext] = (arrivalUs - mFirstArrivalUs) / 1000.0;
+    mTrendY[mTrendNext] = mSmoothedDelayMs;
+    mTrendNext = (mTrendNext + 1) % TREND_WINDOW;
+    if (mTrendCount < TREND_WINDOW)
+        mTrendCount++;
+    if (mDeltas < RATE_TREND_MAX_DELTAS)
+        mDeltas++;
+    if (mTrendCount < TREND_WINDOW)
+        return;
+
+    // least squares slope of the smoothed delay
+    double sumX = 0, sumY = 0;
+    for (int i = 0; i < TREND_WINDOW; i++) {
+        sumX += mTrendX[i];
+        sumY += mTrendY[i];
+    }
+    double meanX = sumX / TREND_WINDOW, meanY = sumY / TREND_WINDOW;
+    double num = 0, den = 0;
+    for (int i = 0; i < TREND_WINDOW; i++) {
+        num += (mTrendX[i] - meanX) * (mTrendY[i] - meanY);
+        den += (mTrendX[i] - meanX) * (mTrendX[i] - meanX);
+    }
+    double slope = den > 0 ? num / den : mPrevTrend;
+    Detect(slope, arrivalUs, sendDeltaMs);
+    mPrevTrend = slope;
+}
+
+void RtpRateController::Detect(double slope, long long arrivalUs, double deltaMs) {
+    double trend = slope * mDeltas * RATE_TREND_GAIN;
+    mStats.trend = trend;
+
+    if (trend > mThreshold) {
+        mOveruseMs += deltaMs;
+        mOveruseCount++;
+        if (mOveruseMs > RATE_OVERUSE_MS && mOveruseCount > 1 && slope >= mPrevTrend) {
+            mOveruseMs = 0;
+            mOveruseCount = 0;
+            mUsage = USAGE_OVER;
+        }
+    } else if (trend < -mThreshold) {
+        mOveruseMs = 0;
+        mOveruseCount = 0;
+        mUsage = USAGE_UNDER;
+    } else {
+        mOveruseMs = 0;
+        mOveruseCount = 0;
+        mUsage = USAGE_NORMAL;
+    }
+
+    // the threshold follows the trend, slowly up and faster down, so that it
+    // neither starves against a competing TCP flow nor misses a real queue
+    if (mLastThresholdUs < 0)
+        mLastThresholdUs = arrivalUs;
+    double absTrend = fabs(trend);
+    if (absTrend <= mThreshold + 15.0) {
+        double k = absTrend < mThreshold ? RATE_THRESHOLD_DOWN : RATE_THRESHOLD_UP;
+        double dtMs = (arrivalUs - mLastThresholdUs) / 1000.0;
+        if (dtMs > 100.0)
+            dtMs = 100.0;
+        mThreshold += k * (absTrend - mThreshold) * dtMs;
+        if (mThreshold < RATE_THRESHOLD_MIN)
+            mThreshold = RATE_THRESHOLD_MIN;
+        if (mThreshold > RATE_THRESHOLD_MAX)
+            mThreshold = RATE_THRESHOLD_MAX;
+    }
+    mLastThresholdUs = arrivalUs;
+    mStats.threshold = mThreshold;
+}
+
+uint32_t RtpRateController::ReceivedBitrate() const {
+    uint64_t bytes = 0;
+    long long us = 0;
+    for (int i = 0; i < RATE_BUCKETS; i++) {
+        bytes += mBucketBytes[i];
+        us += mBucketUs[i];
+    }
+    return us > 0 ? (uint32_t)(bytes * 8 * 1000000ULL / (uint64_t)us) : 0;
+}
+
+bool RtpRateController::Update(long long nowUs, const SourceStats &source) {
+    if (!mStarted || nowUs < mNextUpdateUs)
+        return false;
+
+    long long dtUs = nowUs - mLastUpdateUs;
+    mBucketBytes[mBucketNext] = mIntervalBytes;
+    mBucketUs[mBucketNext] = dtUs;
+    mBucketNext = (mBucketNext + 1) % RATE_BUCKETS;
+    mIntervalBytes = 0;
+    mLastUpdateUs = nowUs;
+    mNextUpdateUs = nowUs + mConfig.intervalUs;
+    mStats.updates++;
+
+    uint32_t received = ReceivedBitrate();
+    double cap = received * RATE_RECEIVED_HEADROOM + 10000.0;
+    double growth = pow(RATE_INCREASE_PER_S, dtUs / 1000000.0);
+    mStats.receivedBitrate = received;
+    mStats.usage = mUsage;
+
+    // delay based
+    if (mUsage == USAGE_OVER) {
+        // once per round of feedback: the encoder needs a moment to follow
+        if (mLastDecreaseUs < 0 || nowUs - mLastDecreaseUs >= 2 * mConfig.intervalUs) {
+            double lowered = received * RATE_DECREASE;
+            if (lowered < mDelayBased)
+                mDelayBased = lowered;
+            mLastDecreaseUs = nowUs;
+            mStats.overuses++;
+        }
+        mUsage = USAGE_NORMAL;
+    } else if (mUsage == USAGE_NORMAL) {
+        double raised = mDelayBased * growth;
+        mDelayBased = raised < cap ? raised : (mDelayBased > cap ? mDelayBased : cap);
+    }
+
+    // loss based, from the RTPSourceData counters
+    if (!mHaveSource) {
+        mHaveSource = true;
+        mLastExtendedSeq = source.extendedHighestSeq;
+        mLastReceived = source.packetsReceived;
+    }
+    uint32_t expected = source.extendedHighestSeq - mLastExtendedSeq;
+    if (expected >= RATE_LOSS_MIN_PACKETS) {
+        uint32_t got = source.packetsReceived - mLastReceived;
+        double loss = got >= expected ? 0.0 : (double)(expected - got) / expected;
+        mLastExtendedSeq = source.extendedHighestSeq;
+        mLastReceived = source.packetsReceived;
+        mStats.loss = loss;
+        if (loss > RATE_LOSS_HIGH) {
+            if (mLastLossDecreaseUs < 0 || nowUs - mLastLossDecreaseUs >= 2 * mConfig.intervalUs) {
+                mLossBased = mTarget * (1.0 - 0.5 * loss);
+                mLastLossDecreaseUs = nowUs;
+                mStats.lossDecreases++;
+            }
+        } else if (loss < RATE_LOSS_LOW) {
+            double raised = mLossBased * growth;
+            mLossBased = raised < cap ? raised : (mLossBased > cap ? mLossBased : cap);
+        }
+    }
+    mStats.jitterMs = source.jitter / mConfig.clockRate * 1000.0;
+
+    double target = mDelayBased < mLossBased ? mDelayBased : mLossBased;
+    if (target < mConfig.minBitrate)
+        target = mConfig.minBitrate;
+    if (target > mConfig.maxBitrate)
+        target = mConfig.maxBitrate;
+    // neither part climbs far beyond what is used
+    if (mDelayBased > mConfig.maxBitrate)
+        mDelayBased = mConfig.maxBitrate;
+    if (mLossBased > mConfig.maxBitrate)
+        mLossBased = mConfig.maxBitrate;
+    mTarget = (uint32_t)target;
+    return true;
+}
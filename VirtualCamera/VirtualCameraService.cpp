@@ -1,14 +1,19 @@
 #define LOG_TAG "VIRTUALCAMERA"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <atomic>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include <fcntl.h>
+#include <sched.h>
 #include <errno.h>
 #include <cutils/log.h>
 #include <cutils/properties.h>
@@ -19,12 +24,24 @@
 #include <JRTPLIB/src/rtpudpv4transmitter.h>
 #include <JRTPLIB/src/rtpsessionparams.h>
 #include <JRTPLIB/src/rtpsession.h>
+#include <JRTPLIB/src/rtppoolmemorymanager.h>
 #include <JRTPLIB/src/rtppacket.h>
+#include <JRTPLIB/src/rtpsourcedata.h>
+#include <JRTPLIB/src/rtperrors.h>
 #include <Common/thread/thread.h>
 #include <AnsyncDecoder/AnsyncDecoder.h>
 
 #include "VirtualCameraService.h"
-
+#include "LatencyHistogram.h"
+#include "H264Depacketizer.h"
+#include "RtpNack.h"
+#include "RtpJitterBuffer.h"
+#include "RtpKeyframeRequest.h"
+#include "RtpRateControl.h"
+#include "RtpCaptureClock.h"
+#include "FramePresenter.h"
+
+#include <binder/IPCThreadState.h>
 #include <binder/IServiceManager.h>
 #include <gui/ISurfaceComposer.h>
 #include <utils/String16.h>
@@ -41,434 +58,631 @@ using namespace jrtplib;
 using namespace android;
 
 static RTPThread* msRecvThread = NULL;
+// the receive (and poll) thread's scheduling and socket drops of the last session, for dumpsys
+static ThreadSchedStats msRecvThreadStats;
+static ThreadSchedStats msPollThreadStats;
+static bool msHavePollThreadStats = false;
+static uint64_t msSocketDrops = 0;
 static int msRecvQuit = 1;
 static AnsyncDecoder* msDecoder = NULL;
-static android::sp<ANativeWindow> msWindow;
-static android::sp<ANativeWindow> msCallBackWindow;
+static H264Depacketizer* msDepacketizer = NULL;
+static RtpNackBuffer* msNackBuffer = NULL;
+// NULL when packets go from the NACK buffer straight to the depacketizer
+static RtpJitterBuffer* msJitterBuffer = NULL;
+static RtpKeyframeRequester* msKeyframeRequester = NULL;
+// 0 off, else RTCP_PSFB_FMT_PLI or RTCP_PSFB_FMT_FIR
+static int msKeyframeRequestFmt = 0;
+// set by the decode thread, taken by the receive thread
+static std::atomic<bool> msKeyframeWanted(false);
+static bool msHaveVideoSsrc = false;
+static uint32_t msVideoSsrc = 0;
+// NULL when the receiver does not steer the sender's bitrate
+static RtpRateController* msRateController = NULL;
+// the sender's 90 kHz capture times on our receive clock
+static RtpCaptureClock msCaptureClock;
 static RTPSession msVideoSession;
 static Mutex mInputMutex;
 
-static void sCopyFrame(const uint8_t *src, uint8_t *dest, 
-                const int width, const int height, const int stride_src, const int stride_dest) {
-    const int h8 = height % 8;
-
-    for (int i = 0; i < h8; i++) {
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-    }
-
-    for (int i = 0; i < height; i += 8) {
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-        memcpy(dest, src, width);
-        dest += stride_dest; src += stride_src;
-    }
-}
-
-static int sDirectCopyToSurface(uint8_t *rgb, int w, int h, 
-                ANativeWindow *window) { 
-    int result = 0;
-    if (window != NULL) {
-        ANativeWindow_Buffer buffer;
-        if (ANativeWindow_lock(window, &buffer, NULL) == 0) {
-            //ALOGD("sDirectCopyToSurface width = %d , height = %d, stride = %d, w = %d , h = %d", buffer.width, buffer.height, buffer.stride, w, h);
-            if (buffer.stride == w) {
-                memcpy(buffer.bits, rgb, (size_t) (buffer.stride * (h<buffer.height?h:buffer.height) * 4));
-            } else {
-                const uint8_t *src = rgb;
-                const int src_w = w * 4;
-                const int src_step = w * 4;
-                uint8_t *dest = (uint8_t *)buffer.bits;
-                const int dest_w = buffer.width * 4;
-                const int dest_step = buffer.stride * 4;
-                const int width = src_w < dest_w ? src_w : dest_w;
-                const int height = h < buffer.height ? h : buffer.height;
-                sCopyFrame(src, dest, width, height-10, src_step, dest_step);
-            }
-            //ALOGD("buffer width = %d , height = %d , stride = %d , format = %d ", buffer.width, buffer.height, buffer.stride, buffer.format);
-            /*if(msCallBackWindow.get() != 0){
-                ANativeWindow_Buffer callbuffer;
-                if (ANativeWindow_lock(msCallBackWindow.get(), &callbuffer, NULL) == 0) {
-                    memcpy(callbuffer.bits, buffer.bits, buffer.stride * 4 * buffer.height);
-                    //ALOGD(" callbuffer width = %d , height = %d , stride = %d , format = %d ", callbuffer.width, callbuffer.height, callbuffer.stride, callbuffer.format);
-                    ANativeWindow_unlockAndPost(msCallBackWindow.get());
-                } 
-            }*/
-            //ALOGD("%s: data1 = %d, data2 = %d, data3 = %d,", __FUNCTION__, (uint8_t)rgb[0], (uint8_t)rgb[1], (uint8_t)rgb[2]);
-            ANativeWindow_unlockAndPost(window);
-        } else {
-            result = -1;
-        }
+// What dumpsys shows of the receive thread's objects. Their counters are only
+// touched by that thread, which copies them here at the end of every loop.
+struct ReceiveStatsSnapshot {
+    bool haveDepacketizer;
+    H264Depacketizer::Stats depacketizer;
+    int freeSlots;
+    int poolSize;
+    bool haveNack;
+    RtpNackBuffer::Stats nack;
+    int nackHeld;
+    bool haveJitterBuffer;
+    RtpJitterBuffer::Stats jitter;
+    long long jitterTargetUs;
+    int jitterHeld;
+    bool haveKeyframeRequester;
+    RtpKeyframeRequester::Stats keyframe;
+    bool keyframePending;
+    bool haveRateController;
+    RtpRateController::Stats rate;
+    uint32_t targetBitrate;
+};
+static Mutex msStatsLock;
+static ReceiveStatsSnapshot msStatsSnapshot = ReceiveStatsSnapshot();
+
+// persist.virtualcamera.rtp.polling=1 restores the old poll thread + 20 ms sleep receive loop,
+// otherwise the receive thread blocks on the RTP/RTCP sockets itself.
+static bool msRecvPolling = false;
+// Per stage latency, all reset at session start and shown by dumpsys:
+// first RTP packet of a unit -> unit reassembled and handed to the decoder
+static LatencyHistogram msRecvToUnitHistogram(1, 20);
+// handed to the decoder -> the decode thread takes it
+static LatencyHistogram msDecoderQueueHistogram(2, 20);
+// decode thread hands the unit to the backend -> frame out
+static LatencyHistogram msDecodeHistogram(2, 20);
+// RTP packet arrival -> frame posted to the preview surface
+static LatencyHistogram msRecvToSurfaceHistogram(5, 20);
+static long long msSessionStartUs = 0;
+static FramePresenter msPreviewPresenter("preview", &msRecvToSurfaceHistogram);
+static FramePresenter msCallBackPresenter("callback");
+
+// persist.virtualcamera.presenter.depth: buffers each surface keeps dequeued ahead of the decoder
+static int sPresenterDepth() {
+    return property_get_int32("persist.virtualcamera.presenter.depth", 2);
+}
 
-    } else {
-        result = -1;
+// Read at every session start:
+//   persist.virtualcamera.decoder.profile   0 default (one thread), 1 low latency, 2 throughput
+//   persist.virtualcamera.decoder.threads   overrides the profile's thread count, 0 = one per core
+//   persist.virtualcamera.decoder.lowdelay  overrides the profile's low delay flag (0 / 1)
+//   persist.virtualcamera.decoder.fast      overrides the profile's flags2 fast (0 / 1)
+//   persist.virtualcamera.decoder.backend   0 libavcodec (default), 1 MediaCodec, 2 null (no decoding)
+//   persist.virtualcamera.decoder.fallback  backend taking over when that one fails, -1 none (default 0)
+static void sDecoderConfig(AnsyncDecoderConfig *config) {
+    int profile = property_get_int32("persist.virtualcamera.decoder.profile", ANSYNC_DECODER_PROFILE_DEFAULT);
+    if (AnsyncDecoder_GetProfileConfig(profile, config) < 0) {
+        ALOGW("unknown decoder profile %d, using default", profile);
+        profile = ANSYNC_DECODER_PROFILE_DEFAULT;
+        AnsyncDecoder_GetProfileConfig(profile, config);
     }
-    return result;
+    config->thread_count = property_get_int32("persist.virtualcamera.decoder.threads", config->thread_count);
+    config->low_delay = property_get_int32("persist.virtualcamera.decoder.lowdelay", config->low_delay);
+    config->fast = property_get_int32("persist.virtualcamera.decoder.fast", config->fast);
+    config->backend = property_get_int32("persist.virtualcamera.decoder.backend", ANSYNC_DECODER_BACKEND_SW);
+    config->fallback = property_get_int32("persist.virtualcamera.decoder.fallback", ANSYNC_DECODER_BACKEND_SW);
+    ALOGD("decoder profile %s: %s backend (fallback %s), %d threads (type %#x), low delay %d, fast %d",
+            AnsyncDecoder_ProfileName(profile), AnsyncDecoder_BackendName(config->backend),
+            AnsyncDecoder_BackendName(config->fallback), config->thread_count, config->thread_type,
+            config->low_delay, config->fast);
 }
 
-#define ALIGN(x, mask) ( ((x) + (mask) - 1) & ~((mask) - 1) )
-
-#define red(x)   (((x) >> 11) & 0x1f)
-#define green(x) (((x) >>  5) & 0x3f)
-#define blue(x)  ( (x)        & 0x1f)
-
-#define cc(x) \
-            if(x > 200){ \
-                x -= 10;  \
-            } \
-
-static void rgbToYuv420(uint8_t* rgbBuf, size_t width, size_t height, uint8_t* yPlane,
-        uint8_t* crPlane, uint8_t* cbPlane, size_t chromaStep, size_t yStride, size_t chromaStride) {
-    uint8_t R, G, B;
-    //uint16_t color0;
-    double A = 0;
-    size_t index = 0;
-    for (size_t j = 0; j < height; j++) {
-        uint8_t* cr = crPlane;
-        uint8_t* cb = cbPlane;
-        uint8_t* y = yPlane;
-        bool jEven = (j & 1) == 0;
-        for (size_t i = 0; i < width; i++) {
-            R =  rgbBuf[index++];
-            G =  rgbBuf[index++];
-            B =  rgbBuf[index++];
-            A =  rgbBuf[index++] / 255.0;
-
-            //R = R * A  + (1.0-A)*255;
-            //G = G * A  + (1.0-A)*255;
-            //B = B * A  + (1.0-A)*255;
-
-            //cc(R)
-            //cc(G)
-            //cc(B)
-            
-            /*color0 = G << 8 | R;
-
-            R = red(color0);
-            G = green(color0);
-            B = blue(color0);
-
-            R = (R<< 3) | (R >> 2);
-            G = (G<< 2) | (G >> 4);
-            B = (B<< 3) | (B >> 2);*/
-
-            *y++ = (77 * R + 150 * G +  29 * B) >> 8;
-            if (jEven && (i & 1) == 0) {
-                *cb = (( -43 * R - 85 * G + 128 * B) >> 8) + 128;
-                *cr = (( 128 * R - 107 * G - 21 * B) >> 8) + 128;
-                cr += chromaStep;
-                cb += chromaStep;
-            }
-            // Skip alpha
-            //index++;
-        }
-        yPlane += yStride;
-        if (jEven) {
-            crPlane += chromaStride;
-            cbPlane += chromaStride;
-        }
-    }
+// persist.virtualcamera.rtp.rcvbuf: RTP socket receive buffer in bytes. A few
+// frames of the largest expected stream are plenty; the kernel caps it at
+// net.core.rmem_max anyway.
+static int sRtpReceiveBuffer() {
+    return property_get_int32("persist.virtualcamera.rtp.rcvbuf", 8 * 1024 * 1024);
 }
 
-static void rgbToYuv420(uint8_t* rgbBuf, size_t width, size_t height, android_ycbcr* ycbcr) {
-    size_t cStep = ycbcr->chroma_step;
-    size_t cStride = ycbcr->cstride;
-    size_t yStride = ycbcr->ystride;
-    ALOGV("%s: yStride is: %zu, cStride is: %zu, cStep is: %zu", __FUNCTION__, yStride, cStride,
-            cStep);
-    rgbToYuv420(rgbBuf, width, height, reinterpret_cast<uint8_t*>(ycbcr->y),
-            reinterpret_cast<uint8_t*>(ycbcr->cr), reinterpret_cast<uint8_t*>(ycbcr->cb),
-            cStep, yStride, cStride);
-}
-
-static status_t produceFrame(const sp<ANativeWindow>& anw,
-                             uint8_t* pixelBuffer,
-                             int32_t bufWidth, // Width of the pixelBuffer
-                             int32_t bufHeight, // Height of the pixelBuffer
-                             int32_t pixelFmt, // Format of the pixelBuffer
-                             int32_t bufSize) {
-    ATRACE_CALL();
-    status_t err = NO_ERROR;
-    ANativeWindowBuffer* anb;
-    ALOGV("%s: Dequeue buffer from %p %dx%d (fmt=%x, size=%x)",
-            __FUNCTION__, anw.get(), bufWidth, bufHeight, pixelFmt, bufSize);
-
-    if (anw == 0) {
-        ALOGE("%s: anw must not be NULL", __FUNCTION__);
-        return BAD_VALUE;
-    } else if (pixelBuffer == NULL) {
-        ALOGE("%s: pixelBuffer must not be NULL", __FUNCTION__);
-        return BAD_VALUE;
-    } else if (bufWidth < 0) {
-        ALOGE("%s: width must be non-negative", __FUNCTION__);
-        return BAD_VALUE;
-    } else if (bufHeight < 0) {
-        ALOGE("%s: height must be non-negative", __FUNCTION__);
-        return BAD_VALUE;
-    } else if (bufSize < 0) {
-        ALOGE("%s: bufSize must be non-negative", __FUNCTION__);
-        return BAD_VALUE;
-    }
-
-    size_t width = static_cast<size_t>(bufWidth);
-    size_t height = static_cast<size_t>(bufHeight);
-    size_t bufferLength = static_cast<size_t>(bufSize);
-
-    // TODO: Switch to using Surface::lock and Surface::unlockAndPost
-    err = native_window_dequeue_buffer_and_wait(anw.get(), &anb);
-    if (err != NO_ERROR) {
-        ALOGE("%s: Failed to dequeue buffer, error %s (%d).", __FUNCTION__,
-                strerror(-err), err);
-        //OVERRIDE_SURFACE_ERROR(err);
-        return err;
-    }
-
-    sp<GraphicBuffer> buf(GraphicBuffer::from(anb));
-    uint32_t grallocBufWidth = buf->getWidth();
-    uint32_t grallocBufHeight = buf->getHeight();
-    uint32_t grallocBufStride = buf->getStride();
-    //ALOGD("%s: Received gralloc buffer with bad dimensions %" PRIu32 "x%" PRIu32
-    //        ", expecting dimensions %zu x %zu",  __FUNCTION__, grallocBufWidth,
-    //        grallocBufHeight, width, height);
-    width = grallocBufWidth;
-    height = grallocBufHeight;
-    if (grallocBufWidth != width || grallocBufHeight != height) {
-        ALOGE("%s: Received gralloc buffer with bad dimensions %" PRIu32 "x%" PRIu32
-                ", expecting dimensions %zu x %zu",  __FUNCTION__, grallocBufWidth,
-                grallocBufHeight, width, height);
-        return BAD_VALUE;
-    }
-
-    int32_t bufFmt = 0;
-    err = anw->query(anw.get(), NATIVE_WINDOW_FORMAT, &bufFmt);
-    if (err != NO_ERROR) {
-        ALOGE("%s: Error while querying surface pixel format %s (%d).", __FUNCTION__,
-                strerror(-err), err);
-        //OVERRIDE_SURFACE_ERROR(err);
-        return err;
-    }
-
-    uint64_t tmpSize = (pixelFmt == HAL_PIXEL_FORMAT_BLOB) ? grallocBufWidth :
-            4 * grallocBufHeight * grallocBufWidth;
-    if (bufFmt != pixelFmt) {
-        if (bufFmt == HAL_PIXEL_FORMAT_RGBA_8888 && pixelFmt == HAL_PIXEL_FORMAT_BLOB) {
-            ALOGV("%s: Using BLOB to RGBA format override.", __FUNCTION__);
-            tmpSize = 4 * (grallocBufWidth + grallocBufStride * (grallocBufHeight - 1));
-        } else {
-            ALOGW("%s: Format mismatch in produceFrame: expecting format %#" PRIx32
-                    ", but received buffer with format %#" PRIx32, __FUNCTION__, pixelFmt, bufFmt);
-        }
-    }
-    //ALOGD("%s: Format mismatch in produceFrame: expecting format %#" PRIx32
-    //                ", but received buffer with format %#" PRIx32, __FUNCTION__, pixelFmt, bufFmt);
-    if (tmpSize > SIZE_MAX) {
-        ALOGE("%s: Overflow calculating size, buffer with dimens %zu x %zu is absurdly large...",
-                __FUNCTION__, width, height);
-        return BAD_VALUE;
-    }
+// persist.virtualcamera.rtp.batch: datagrams read per recvmmsg call, 0 for the
+// old ioctl/recvfrom loop. 32 covers a typical frame's worth of slices.
+static int sRtpBatchReceive() {
+    return property_get_int32("persist.virtualcamera.rtp.batch", 32);
+}
 
-    size_t totalSizeBytes = tmpSize;
+// persist.virtualcamera.rtp.mempool: the session's packets come from a pool of
+// MTU sized blocks instead of the heap, 0 turns it off (default 1).
+//   persist.virtualcamera.rtp.mempool.max   KiB the pool may keep (default 8192)
+static void sRtpMemoryPoolConfig(RTPSessionParams *params) {
+    bool pooled = property_get_bool("persist.virtualcamera.rtp.mempool", true);
+    int maxKb = property_get_int32("persist.virtualcamera.rtp.mempool.max", 8192);
+    params->SetUseMemoryPool(pooled);
+    params->SetMemoryPoolLimit((size_t)maxKb * 1024);
+    ALOGD("RTP memory pool: %s, up to %d KiB", pooled ? "on" : "off", maxKb);
+}
 
-    ALOGV("%s: Pixel format chosen: %x", __FUNCTION__, pixelFmt);
-    switch(pixelFmt) {
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP: {
-            if (bufferLength < totalSizeBytes) {
-                ALOGE("%s: PixelBuffer size %zu too small for given dimensions",
-                        __FUNCTION__, bufferLength);
-                return BAD_VALUE;
-            }
-            uint8_t* img = NULL;
-            ALOGV("%s: Lock buffer from %p for write", __FUNCTION__, anw.get());
-            err = buf->lock(GRALLOC_USAGE_SW_WRITE_OFTEN, (void**)(&img));
-            if (err != NO_ERROR) return err;
-
-            uint8_t* yPlane = img;
-            uint8_t* uPlane = img + height * width;
-            uint8_t* vPlane = uPlane + 1;
-            size_t chromaStep = 2;
-            size_t yStride = width;
-            size_t chromaStride = width;
-
-            rgbToYuv420(pixelBuffer, width, height, yPlane,
-                    uPlane, vPlane, chromaStep, yStride, chromaStride);
-            break;
-        }
-        case HAL_PIXEL_FORMAT_YV12: {
-            if (bufferLength < totalSizeBytes) {
-                ALOGE("%s: PixelBuffer size %zu too small for given dimensions",
-                        __FUNCTION__, bufferLength);
-                return BAD_VALUE;
-            }
+// Scheduling of the receive thread, and of the poll thread with
+// persist.virtualcamera.rtp.polling, so an I-frame burst is read before the
+// socket buffer fills up on a busy host:
+//   persist.virtualcamera.rtp.thread.policy    0 SCHED_OTHER, 1 SCHED_FIFO (default), 2 SCHED_RR
+//   persist.virtualcamera.rtp.thread.priority  real-time priority (default 2)
+//   persist.virtualcamera.rtp.thread.nice      nice value for SCHED_OTHER, also taken when the
+//                                              real-time policy is refused (default -8)
+//   persist.virtualcamera.rtp.thread.cpus      CPU mask such as 0xc0 for CPUs 6 and 7, 0 any (default)
+static void sRecvThreadSchedConfig(ThreadSched *sched) {
+    char cpus[PROPERTY_VALUE_MAX];
+    sched->policy = property_get_int32("persist.virtualcamera.rtp.thread.policy", SCHED_FIFO);
+    if (sched->policy != SCHED_OTHER && sched->policy != SCHED_FIFO && sched->policy != SCHED_RR) {
+        ALOGW("unknown receive thread policy %d, using SCHED_FIFO", sched->policy);
+        sched->policy = SCHED_FIFO;
+    }
+    sched->priority = property_get_int32("persist.virtualcamera.rtp.thread.priority", 2);
+    sched->nice = property_get_int32("persist.virtualcamera.rtp.thread.nice", -8);
+    property_get("persist.virtualcamera.rtp.thread.cpus", cpus, "0");
+    sched->cpus = strtoull(cpus, NULL, 0);
+    ALOGD("receive thread: policy %d, priority %d, nice %d, cpus %#llx", sched->policy, sched->priority,
+            sched->nice, sched->cpus);
+}
 
-            if ((width & 1) || (height & 1)) {
-                ALOGE("%s: Dimens %zu x %zu are not divisible by 2.", __FUNCTION__, width, height);
-                return BAD_VALUE;
-            }
+static const char *sSchedPolicyName(int policy) {
+    switch (policy) {
+    case SCHED_OTHER: return "SCHED_OTHER";
+    case SCHED_FIFO: return "SCHED_FIFO";
+    case SCHED_RR: return "SCHED_RR";
+    default: return "other policy";
+    }
+}
 
-            uint8_t* img = NULL;
-            ALOGV("%s: Lock buffer from %p for write", __FUNCTION__, anw.get());
-            err = buf->lock(GRALLOC_USAGE_SW_WRITE_OFTEN, (void**)(&img));
-            if (err != NO_ERROR) {
-                ALOGE("%s: Error %s (%d) while locking gralloc buffer for write.", __FUNCTION__,
-                        strerror(-err), err);
-                return err;
-            }
+static void sFormatThreadSched(const ThreadSchedStats &stats, char *buf, size_t size) {
+    snprintf(buf, size, "%s %d, nice %d, cpus %#llx, %llu timeslices, %.1f ms waiting for a CPU "
+            "(%.1f us per timeslice), %llu preemptions", sSchedPolicyName(stats.policy), stats.priority,
+            stats.nice, stats.cpus, stats.timeslices, stats.run_delay_ns / 1000000.0,
+            stats.timeslices > 0 ? stats.run_delay_ns / 1000.0 / stats.timeslices : 0.0,
+            stats.involuntary_switches);
+}
 
-            uint32_t stride = buf->getStride();
-            ALOGV("%s: stride is: %" PRIu32, __FUNCTION__, stride);
-            LOG_ALWAYS_FATAL_IF(stride % 16, "Stride is not 16 pixel aligned %d", stride);
+static void sFromJThreadStats(const jthread::JThreadSchedulingStats &from, ThreadSchedStats *to) {
+    to->policy = from.policy;
+    to->priority = from.priority;
+    to->nice = from.nice;
+    to->cpus = from.cpumask;
+    to->run_delay_ns = from.rundelayns;
+    to->timeslices = from.timeslices;
+    to->voluntary_switches = from.voluntaryswitches;
+    to->involuntary_switches = from.involuntaryswitches;
+}
 
-            uint32_t cStride = ALIGN(stride / 2, 16);
-            size_t chromaStep = 1;
+// the session was created with RTPUDPv4TransmissionParams
+static uint64_t sSocketDrops() {
+    RTPUDPv4Transmitter *transmitter = static_cast<RTPUDPv4Transmitter *>(msVideoSession.GetTransmitter());
+    return transmitter != NULL ? transmitter->GetSocketDropCount() : 0;
+}
 
-            uint8_t* yPlane = img;
-            uint8_t* crPlane = img + static_cast<uint32_t>(height) * stride;
-            uint8_t* cbPlane = crPlane + cStride * static_cast<uint32_t>(height) / 2;
+// Generic NACK (RFC 4585) towards the sender, which keeps its last packets for
+// retransmission:
+//   persist.virtualcamera.rtp.nack.hold     ms a sequence gap may hold back the packets
+//                                           behind it, 0 turns NACKs off (default 80)
+//   persist.virtualcamera.rtp.nack.retry    ms between requests for the same packet (default 20)
+//   persist.virtualcamera.rtp.nack.retries  requests per packet (default 3)
+static void sNackConfig(RtpNackBuffer *buffer) {
+    int holdMs = property_get_int32("persist.virtualcamera.rtp.nack.hold", 80);
+    int retryMs = property_get_int32("persist.virtualcamera.rtp.nack.retry", 20);
+    int retries = property_get_int32("persist.virtualcamera.rtp.nack.retries", 3);
+    buffer->SetTiming(holdMs * 1000LL, retryMs * 1000LL, retries);
+    ALOGD("NACK: hold %d ms, retry every %d ms, %d retries", holdMs, retryMs, retries);
+}
 
-            rgbToYuv420(pixelBuffer, width, height, yPlane,
-                    crPlane, cbPlane, chromaStep, stride, cStride);
-            break;
-        }
-        case HAL_PIXEL_FORMAT_YCbCr_420_888: {
-            // Software writes with YCbCr_420_888 format are unsupported
-            // by the gralloc module for now
-            if (bufferLength < totalSizeBytes) {
-                ALOGE("%s: PixelBuffer size %zu too small for given dimensions",
-                        __FUNCTION__, bufferLength);
-                return BAD_VALUE;
-            }
-            android_ycbcr ycbcr = android_ycbcr();
-            ALOGV("%s: Lock buffer from %p for write", __FUNCTION__, anw.get());
-
-            err = buf->lockYCbCr(GRALLOC_USAGE_SW_WRITE_OFTEN, &ycbcr);
-            if (err != NO_ERROR) {
-                ALOGE("%s: Failed to lock ycbcr buffer, error %s (%d).", __FUNCTION__,
-                        strerror(-err), err);
-                return err;
-            }
-            rgbToYuv420(pixelBuffer, width, height, &ycbcr);
-            break;
-        }
-        default: {
-            ALOGE("%s: Invalid pixel format in produceFrame: %x", __FUNCTION__, pixelFmt);
-            return BAD_VALUE;
-        }
+static void sVideoPacketDeliver(void *userdata, RTPPacket *packet);
+static void sVideoPacketRelease(void *userdata, RTPPacket *packet);
+
+// Frame aware jitter buffer between the NACK buffer and the depacketizer:
+//   persist.virtualcamera.rtp.jitter          0 off, 1 on (default)
+//   persist.virtualcamera.rtp.jitter.min      ms, lowest target delay (default 10)
+//   persist.virtualcamera.rtp.jitter.max      ms, highest target delay (default 200)
+//   persist.virtualcamera.rtp.jitter.policy   frames still incomplete at their deadline:
+//                                             0 discarded (default), 1 forwarded as they are
+static RtpJitterBuffer *sJitterBufferConfig() {
+    if (!property_get_bool("persist.virtualcamera.rtp.jitter", true)) {
+        ALOGD("jitter buffer: off");
+        return NULL;
     }
+    int minMs = property_get_int32("persist.virtualcamera.rtp.jitter.min", 10);
+    int maxMs = property_get_int32("persist.virtualcamera.rtp.jitter.max", 200);
+    int policy = property_get_int32("persist.virtualcamera.rtp.jitter.policy", RtpJitterBuffer::POLICY_DISCARD);
+    RtpJitterBuffer *buffer = new RtpJitterBuffer(sVideoPacketDeliver, sVideoPacketRelease, NULL);
+    buffer->SetDelay(minMs * 1000LL, maxMs * 1000LL);
+    buffer->SetPolicy(policy);
+    ALOGD("jitter buffer: %d..%d ms, incomplete frames %s", minMs, maxMs,
+            policy == RtpJitterBuffer::POLICY_FORWARD ? "forwarded" : "discarded");
+    return buffer;
+}
 
-    ALOGV("%s: Unlock buffer from %p", __FUNCTION__, anw.get());
-    err = buf->unlock();
-    if (err != NO_ERROR) {
-        ALOGE("%s: Failed to unlock buffer, error %s (%d).", __FUNCTION__, strerror(-err), err);
-        return err;
-    }
+// Keyframe requests towards the sender, whenever the decoder reports damage or
+// the depacketizer waits for an IDR after loss:
+//   persist.virtualcamera.rtp.keyframe.request   0 off, 1 PLI (default), 2 FIR
+//   persist.virtualcamera.rtp.keyframe.interval  ms between repetitions while no
+//                                                keyframe arrives (default 300)
+static void sKeyframeRequestConfig(RtpKeyframeRequester *requester) {
+    int mode = property_get_int32("persist.virtualcamera.rtp.keyframe.request", 1);
+    int intervalMs = property_get_int32("persist.virtualcamera.rtp.keyframe.interval", 300);
+    msKeyframeRequestFmt = mode == 1 ? RTCP_PSFB_FMT_PLI : (mode == 2 ? RTCP_PSFB_FMT_FIR : 0);
+    requester->SetInterval(intervalMs * 1000LL);
+    ALOGD("keyframe requests: %s, repeated every %d ms", msKeyframeRequestFmt == RTCP_PSFB_FMT_PLI ? "PLI"
+            : (msKeyframeRequestFmt == RTCP_PSFB_FMT_FIR ? "FIR" : "off"), intervalMs);
+}
 
-    ALOGV("%s: Queue buffer to %p", __FUNCTION__, anw.get());
-    err = anw->queueBuffer(anw.get(), buf->getNativeBuffer(), /*fenceFd*/-1);
-    if (err != NO_ERROR) {
-        ALOGE("%s: Failed to queue buffer, error %s (%d).", __FUNCTION__, strerror(-err), err);
-        //OVERRIDE_SURFACE_ERROR(err);
-        return err;
+// Receiver side bitrate control: the target is sent back to the sender's
+// encoder in an RTCP APP packet ("VCBR") every interval.
+//   persist.virtualcamera.rtp.rate           0 off, 1 on (default)
+//   persist.virtualcamera.rtp.rate.min       kbit/s (default 300)
+//   persist.virtualcamera.rtp.rate.max       kbit/s (default 8000)
+//   persist.virtualcamera.rtp.rate.start     kbit/s (default 2000)
+//   persist.virtualcamera.rtp.rate.interval  ms between updates (default 200)
+static RtpRateController *sRateControlConfig() {
+    if (!property_get_bool("persist.virtualcamera.rtp.rate", true)) {
+        ALOGD("bitrate control: off");
+        return NULL;
     }
-    return NO_ERROR;
+    RtpRateController::Config config;
+    RtpRateController::GetDefaultConfig(&config);
+    config.minBitrate = property_get_int32("persist.virtualcamera.rtp.rate.min", config.minBitrate / 1000) * 1000;
+    config.maxBitrate = property_get_int32("persist.virtualcamera.rtp.rate.max", config.maxBitrate / 1000) * 1000;
+    config.startBitrate = property_get_int32("persist.virtualcamera.rtp.rate.start", config.startBitrate / 1000) * 1000;
+    config.intervalUs = property_get_int32("persist.virtualcamera.rtp.rate.interval",
+            (int32_t)(config.intervalUs / 1000)) * 1000LL;
+    ALOGD("bitrate control: %u..%u kbit/s, start %u kbit/s, every %lld ms", config.minBitrate / 1000,
+            config.maxBitrate / 1000, config.startBitrate / 1000, config.intervalUs / 1000);
+    return new RtpRateController(config);
 }
 
-static int sDirectCopyToCallBackSurface(uint8_t *rgb, int w, int h, 
-                ANativeWindow *window) {
-    int result = 0;
-    if (window != NULL) {
-        produceFrame(window, rgb, w, h, HAL_PIXEL_FORMAT_YCbCr_420_888, w*h*4);
-    } else {
-        result = -1;
+// Decoder thread, whenever a new SPS changes the stream: depacketizer slots
+// are sized after the picture instead of the largest unit ever seen.
+static void sDecoder_stream_cb(void *userdata, const AnsyncDecoderStreamInfo *info) {
+    ALOGD("stream %dx%d (coded %dx%d), %s range, %d/%d fps, %d size change(s)", info->width, info->height,
+            info->coded_width, info->coded_height, info->full_range ? "full" : "video", info->fps_num,
+            info->fps_den, info->size_changes);
+    // an IDR rarely takes more than 1.5 bits per pixel
+    size_t unitSize = (size_t)info->coded_width * info->coded_height * 3 / 16;
+    if (msDepacketizer != NULL) {
+        msDepacketizer->SetUnitSizeHint(unitSize > 64 * 1024 ? unitSize : 64 * 1024);
     }
-    return result;
 }
 
+static void sLogPresenterStats(const FramePresenter &presenter, const char *name) {
+    FramePresenter::Stats stats = presenter.getStats();
+    ALOGD("%s presenter: %" PRIu64 " frames, %" PRIu64 " presented, %" PRIu64 " dropped (no buffer), %" PRIu64
+            " replaced, %" PRIu64 " dequeue errors, %" PRIu64 " errors", name, stats.frames, stats.presented,
+            stats.noBuffer, stats.replaced, stats.dequeueErrors, stats.errors);
+}
+
+// Decoder thread: the picture is damaged until the next IDR.
+static void sDecoder_keyframe_cb(void *userdata, int reason) {
+    ALOGD("decoder needs a keyframe (reason %d)", reason);
+    msKeyframeWanted.store(true);
+}
+
+// Audio only; video arrives through sDecoder_frame_cb.
 static void sDecoder_cb(void *userdata, void *data, int dataLen, 
                 int w, int h, u32 timestamp, int mediaType) {
-    if (mediaType == 1) {
-        //Mutex::Autolock l(mInputMutex);
-        sDirectCopyToCallBackSurface((uint8_t *)data, w, h, msCallBackWindow.get());
-        sDirectCopyToSurface((uint8_t *)data, w, h, msWindow.get());
+}
+
+// Decoder thread: only fills buffers the presenters dequeued ahead, never waits for a consumer.
+static void sDecoder_frame_cb(void *userdata, const AnsyncDecoderFrame *frame) {
+    msDecoderQueueHistogram.add(0, frame->queue_us * 1000LL);
+    msDecodeHistogram.add(0, frame->decode_us * 1000LL);
+    ATRACE_INT("VirtualCamera decoder queue us", (int32_t)frame->queue_us);
+    ATRACE_INT("VirtualCamera decode us", (int32_t)frame->decode_us);
+    long long captureUs = msCaptureClock.ToLocalUs(frame->timestamp);
+    msCallBackPresenter.present(frame, captureUs);
+    msPreviewPresenter.present(frame, captureUs);
+}
+
+static long long sNowUs() {
+    RTPTime now = RTPTime::CurrentTime();
+    return (long long)now.GetSeconds() * 1000000LL + now.GetMicroSeconds();
+}
+
+static int sVideoUnitReady(void *userdata, H264AccessUnit *unit);
+
+// In sequence order, a frame at a time when the jitter buffer is on.
+static void sVideoPacketDeliver(void *userdata, RTPPacket *packet) {
+    msDepacketizer->ProcessPacket(packet);
+    msVideoSession.DeletePacket(packet);
+}
+
+static void sVideoPacketRelease(void *userdata, RTPPacket *packet) {
+    msVideoSession.DeletePacket(packet);
+}
+
+static int sVideoUnitReady(void *userdata, H264AccessUnit *unit) {
+    long long nowUs = sNowUs();
+    msRecvToUnitHistogram.add(unit->recvTimeUs * 1000LL, nowUs * 1000LL);
+    ATRACE_INT("VirtualCamera unit assembly us", (int32_t)(nowUs - unit->recvTimeUs));
+    ATRACE_INT("VirtualCamera unit bytes", (int32_t)unit->len);
+    if (unit->keyframe) {
+        msKeyframeRequester->OnKeyframe();
+    }
+    msCaptureClock.OnFrame(unit->timestamp, unit->recvTimeUs);
+    int ret = AnsyncDecoder_ReceiveBuffer(msDecoder, unit->data, (int)unit->len, unit->timestamp,
+            unit->recvTimeUs, 1, H264Depacketizer::ReleaseUnit, unit->opaque);
+    if (ret == ANSYNC_DECODER_DROPPED_NON_REF) {
+        return H264_UNIT_DROPPED_NON_REF;
     }
+    return ret;
 }
 
-static int sReceiveVideoPacket(void *data, size_t *dataLen) {
-    RTPTime delay(0.020);
+// Packets leave the NACK buffer in sequence order, gaps given up on included,
+// or as they arrive when the jitter buffer orders them.
+static void sNackDeliver(void *userdata, RTPPacket *packet) {
+    if (msJitterBuffer != NULL) {
+        msJitterBuffer->Push(packet, sNowUs());
+        return;
+    }
+    sVideoPacketDeliver(userdata, packet);
+}
+
+static void sDrainVideoPackets() {
+    long long nowUs = sNowUs();
     msVideoSession.BeginDataAccess();
     if (msVideoSession.GotoFirstSource()) {
         do {
             RTPPacket *packet;
             while ((packet = msVideoSession.GetNextPacket()) != 0) {
-                uint8_t fu_indicator_type = packet->GetPayloadData()[0] & (uint8_t)0x1f;
-                if (fu_indicator_type == 28) {
-                    uint8_t flag = packet->GetPayloadData()[1] & (uint8_t)0xC0;
-                    if (flag == 0x80) {
-                        memcpy((uint8_t *)data, packet->GetPayloadData() + 2, packet->GetPayloadLength() - 2 );
-                        *dataLen = packet->GetPayloadLength() - 2;
-
-                    } else if (flag == 0x40) {
-                        memcpy((uint8_t *)data + *dataLen, packet->GetPayloadData() + 2, packet->GetPayloadLength() - 2 );
-                        *dataLen += packet->GetPayloadLength() - 2;
-                        AnsyncDecoder_ReceiveData(msDecoder, data, (int)*dataLen, 0, 1);
-                        *dataLen = 0;
-
-                    } else {
-                        memcpy((uint8_t *)data + *dataLen, packet->GetPayloadData() + 2, packet->GetPayloadLength() - 2 );
-                        *dataLen += packet->GetPayloadLength() - 2;
-                        
-                    }
-
-                } else {
-                    memcpy(data, packet->GetPayloadData(), packet->GetPayloadLength());
-                    *dataLen = packet->GetPayloadLength();
-                    AnsyncDecoder_ReceiveData(msDecoder, data, (int)*dataLen, 0, 1);
-                    *dataLen = 0;
-
+                msHaveVideoSsrc = true;
+                msVideoSsrc = packet->GetSSRC();
+                if (msRateController != NULL) {
+                    RTPTime arrival = packet->GetReceiveTime();
+                    msRateController->OnPacket((long long)arrival.GetSeconds() * 1000000LL + arrival.GetMicroSeconds(),
+                            packet->GetTimestamp(), packet->GetPacketLength());
                 }
-                msVideoSession.DeletePacket(packet);
+                msNackBuffer->Push(packet, nowUs);
             }
         } while (msVideoSession.GotoNextSource());
     }
     msVideoSession.EndDataAccess();
-    RTPTime::Wait(delay);
+}
+
+#define VIDEO_NACK_MAX_SEQS 64
+
+// Requests the missing packets that are due, then lets go of the gaps whose
+// hold time is over and of the frames whose playout deadline is.
+static void sServiceNacks() {
+    long long nowUs = sNowUs();
+    uint16_t seqs[VIDEO_NACK_MAX_SEQS];
+    uint32_t ssrc = 0;
+    int count = msNackBuffer->CollectNacks(nowUs, seqs, VIDEO_NACK_MAX_SEQS, &ssrc);
+    if (count > 0) {
+        uint8_t fci[4 + VIDEO_NACK_MAX_SEQS * 4];
+        size_t len = RtpNack_BuildFci(ssrc, seqs, count, fci, sizeof(fci));
+        int status = msVideoSession.SendUnknownPacket(false, RTCP_RTPFB, RTCP_RTPFB_FMT_NACK, fci, len);
+        if (status < 0) {
+            ALOGW("%s: NACK for %d packet(s) not sent: %s", __FUNCTION__, count, RTPGetErrorString(status).c_str());
+        }
+        ATRACE_INT("VirtualCamera NACKed packets", count);
+    }
+    msNackBuffer->Poll(nowUs);
+    if (msJitterBuffer != NULL) {
+        msJitterBuffer->Poll(nowUs);
+        ATRACE_INT("VirtualCamera jitter target us", (int32_t)msJitterBuffer->GetTargetDelayUs());
+    }
+}
+
+// Asks the sender for an IDR while the decoder or the depacketizer waits for
+// one, rate limited by the requester.
+static void sServiceKeyframeRequests() {
+    if (msKeyframeRequestFmt == 0 || !msHaveVideoSsrc) {
+        return;
+    }
+    long long nowUs = sNowUs();
+    if (msKeyframeWanted.exchange(false) || msDepacketizer->IsWaitingForIdr()) {
+        msKeyframeRequester->Request(nowUs);
+    }
+    if (!msKeyframeRequester->Due(nowUs)) {
+        return;
+    }
+    uint8_t data[12];
+    size_t len = msKeyframeRequestFmt == RTCP_PSFB_FMT_FIR
+            ? RtpKeyframeRequest_BuildFir(msVideoSsrc, msKeyframeRequester->GetFirSeqNr(), data, sizeof(data))
+            : RtpKeyframeRequest_BuildPli(msVideoSsrc, data, sizeof(data));
+    int status = msVideoSession.SendUnknownPacket(false, RTCP_PSFB, (uint8_t)msKeyframeRequestFmt, data, len);
+    if (status < 0) {
+        ALOGW("%s: keyframe request not sent: %s", __FUNCTION__, RTPGetErrorString(status).c_str());
+    }
+    ATRACE_INT("VirtualCamera keyframe requests", (int32_t)msKeyframeRequester->GetStats().sent);
+}
+
+// Feeds the source's reception counters to the rate controller and reports
+// the new target to the sender whenever an interval is over.
+static void sServiceRateControl() {
+    if (msRateController == NULL || !msHaveVideoSsrc) {
+        return;
+    }
+    RtpRateController::SourceStats source = RtpRateController::SourceStats();
+    msVideoSession.BeginDataAccess();
+    RTPSourceData *data = msVideoSession.GetSourceInfo(msVideoSsrc);
+    if (data != NULL) {
+        source.extendedHighestSeq = data->INF_GetExtendedHighestSequenceNumber();
+        source.packetsReceived = data->INF_GetNumPacketsReceived();
+        source.jitter = data->INF_GetJitter();
+    }
+    msVideoSession.EndDataAccess();
+    if (data == NULL || !msRateController->Update(sNowUs(), source)) {
+        return;
+    }
+    uint8_t app[RTCP_APP_RATE_LENGTH];
+    size_t len = RtpRate_BuildApp(msVideoSsrc, msRateController->GetTargetBitrate(), app, sizeof(app));
+    int status = msVideoSession.SendRTCPAPPPacket(RTCP_APP_RATE_SUBTYPE, (const uint8_t *)RTCP_APP_RATE_NAME,
+            app, len);
+    if (status < 0) {
+        ALOGW("%s: target bitrate not sent: %s", __FUNCTION__, RTPGetErrorString(status).c_str());
+    }
+    ATRACE_INT("VirtualCamera target kbit/s", (int32_t)(msRateController->GetTargetBitrate() / 1000));
+    ATRACE_INT("VirtualCamera received kbit/s", (int32_t)(msRateController->GetStats().receivedBitrate / 1000));
+}
+
+static int sReceiveVideoPacket() {
+    if (msRecvPolling) {
+        RTPTime delay(0.020);
+        sDrainVideoPackets();
+        sServiceNacks();
+        sServiceKeyframeRequests();
+        sServiceRateControl();
+        RTPTime::Wait(delay);
+        return 0;
+    }
+
+    // Sleep until the RTP or RTCP socket becomes readable (or the next RTCP
+    // packet is due), then let the session process it and drain right away.
+    RTPTime delay = msVideoSession.GetRTCPDelay();
+    if (delay > RTPTime(1.0)) {
+        delay = RTPTime(1.0);
+    }
+    // wake up for the next NACK, give-up, playout deadline, keyframe request or
+    // bitrate report as well
+    long long deadlineUs = msNackBuffer->GetNextDeadlineUs();
+    long long playoutUs = msJitterBuffer != NULL ? msJitterBuffer->GetNextDeadlineUs() : -1;
+    if (playoutUs >= 0 && (deadlineUs < 0 || playoutUs < deadlineUs)) {
+        deadlineUs = playoutUs;
+    }
+    long long keyframeUs = msKeyframeRequestFmt != 0 ? msKeyframeRequester->GetNextDeadlineUs() : -1;
+    if (keyframeUs >= 0 && (deadlineUs < 0 || keyframeUs < deadlineUs)) {
+        deadlineUs = keyframeUs;
+    }
+    long long rateUs = msRateController != NULL ? msRateController->GetNextDeadlineUs() : -1;
+    if (rateUs >= 0 && (deadlineUs < 0 || rateUs < deadlineUs)) {
+        deadlineUs = rateUs;
+    }
+    if (deadlineUs >= 0) {
+        long long waitUs = std::max(deadlineUs - sNowUs(), 1000LL);
+        if (RTPTime(waitUs / 1000000.0) < delay) {
+            delay = RTPTime(waitUs / 1000000.0);
+        }
+    }
+    bool dataAvailable = false;
+    int status = msVideoSession.WaitForIncomingData(delay, &dataAvailable);
+    if (status < 0) {
+        ALOGE("%s: WaitForIncomingData failed: %s", __FUNCTION__, RTPGetErrorString(status).c_str());
+        return status;
+    }
+    if ((status = msVideoSession.Poll()) < 0) {
+        ALOGE("%s: Poll failed: %s", __FUNCTION__, RTPGetErrorString(status).c_str());
+        return status;
+    }
+    if (dataAvailable) {
+        sDrainVideoPackets();
+    }
+    sServiceNacks();
+    sServiceKeyframeRequests();
+    sServiceRateControl();
     return 0;
 }
 
+// Receive thread only, the objects are its own.
+static void sPublishReceiveStats() {
+    ReceiveStatsSnapshot snapshot = ReceiveStatsSnapshot();
+    if (msDepacketizer != NULL) {
+        snapshot.haveDepacketizer = true;
+        snapshot.depacketizer = msDepacketizer->GetStats();
+        snapshot.freeSlots = msDepacketizer->GetFreeSlots();
+        snapshot.poolSize = msDepacketizer->GetPoolSize();
+    }
+    if (msNackBuffer != NULL) {
+        snapshot.haveNack = true;
+        snapshot.nack = msNackBuffer->GetStats();
+        snapshot.nackHeld = msNackBuffer->GetHeldPackets();
+    }
+    if (msJitterBuffer != NULL) {
+        snapshot.haveJitterBuffer = true;
+        snapshot.jitter = msJitterBuffer->GetStats();
+        snapshot.jitterTargetUs = msJitterBuffer->GetTargetDelayUs();
+        snapshot.jitterHeld = msJitterBuffer->GetHeldPackets();
+    }
+    if (msKeyframeRequester != NULL) {
+        snapshot.haveKeyframeRequester = true;
+        snapshot.keyframe = msKeyframeRequester->GetStats();
+        snapshot.keyframePending = msKeyframeRequester->IsPending();
+    }
+    if (msRateController != NULL) {
+        snapshot.haveRateController = true;
+        snapshot.rate = msRateController->GetStats();
+        snapshot.targetBitrate = msRateController->GetTargetBitrate();
+    }
+    Mutex::Autolock l(msStatsLock);
+    msStatsSnapshot = snapshot;
+}
+
 static void thread_recv_virtualcamera(void *d) 
 {
-    size_t srecvLen = 0;
-    size_t bufferlen = sizeof(uint8_t)*1080*1920*4;
-    uint8_t* srecvData = (uint8_t*)malloc(bufferlen);
-    if(srecvData == NULL)
-        return ;
     ALOGD("thread_recv_virtualcamera BEGIN");
-    msRecvQuit = 0;
-    msDecoder = AnsyncDecoder_Create(NULL, 0, NULL, 0, NULL, sDecoder_cb);
+    AnsyncDecoderConfig decoderConfig;
+    sDecoderConfig(&decoderConfig);
+    msDecoder = AnsyncDecoder_CreateEx(NULL, 0, NULL, 0, NULL, sDecoder_cb, &decoderConfig);
+    if (msDecoder == NULL) {
+        ALOGE("no video decoder backend could be opened");
+    }
+    AnsyncDecoder_SetFrameCallback(msDecoder, sDecoder_frame_cb);
+    AnsyncDecoder_SetStreamCallback(msDecoder, sDecoder_stream_cb);
+    AnsyncDecoder_SetKeyframeCallback(msDecoder, sDecoder_keyframe_cb);
+    // 0 block (default), 1 drop oldest, 2 drop non-reference units
+    AnsyncDecoder_SetOverflowPolicy(msDecoder, property_get_int32("persist.virtualcamera.decoder.overflow",
+            ANSYNC_DECODER_OVERFLOW_BLOCK));
+    msDepacketizer = new H264Depacketizer(sVideoUnitReady, NULL);
+    msNackBuffer = new RtpNackBuffer(sNackDeliver, sVideoPacketRelease, NULL);
+    sNackConfig(msNackBuffer);
+    msJitterBuffer = sJitterBufferConfig();
+    // the jitter buffer puts frames in order: the NACK buffer only finds the gaps
+    msNackBuffer->SetOrdering(msJitterBuffer == NULL);
+    msKeyframeRequester = new RtpKeyframeRequester();
+    sKeyframeRequestConfig(msKeyframeRequester);
+    msKeyframeWanted.store(false);
+    msRateController = sRateControlConfig();
+    msCaptureClock.Reset();
+    msHaveVideoSsrc = false;
     ALOGD("thread_recv_virtualcamera BEGIN BEGIN");
     while (!msRecvQuit) {
-        //memset(srecvData, 0, bufferlen);
-        sReceiveVideoPacket(srecvData, &srecvLen);
+        if (sReceiveVideoPacket() < 0) {
+            RTPTime::Wait(RTPTime(0.020));
+        }
+        sPublishReceiveStats();
     }
     ALOGD("thread_recv_virtualcamera END");
-    if(srecvData){
-        free(srecvData);
-        srecvData = NULL;
+    const RtpNackBuffer::Stats &nackStats = msNackBuffer->GetStats();
+    ALOGD("NACK: %" PRIu64 " missing, %" PRIu64 " requested, %" PRIu64 " recovered, %" PRIu64 " lost, %" PRIu64
+            " reordered, %" PRIu64 " duplicate, %" PRIu64 " late", nackStats.missing, nackStats.requested,
+            nackStats.recovered, nackStats.lost, nackStats.reordered, nackStats.duplicates, nackStats.late);
+    if (msJitterBuffer != NULL) {
+        const RtpJitterBuffer::Stats &jitterStats = msJitterBuffer->GetStats();
+        ALOGD("jitter buffer: target %lld ms, %" PRIu64 " frames, %" PRIu64 " incomplete, %" PRIu64 " lost, %"
+                PRIu64 " late, %" PRIu64 " duplicate, %" PRIu64 " reordered", msJitterBuffer->GetTargetDelayUs() / 1000,
+                jitterStats.frames, jitterStats.incomplete, jitterStats.lost, jitterStats.late,
+                jitterStats.duplicates, jitterStats.reordered);
     }
-    ALOGD("thread_recv_virtualcamera END END");
+    const RtpKeyframeRequester::Stats &keyframeStats = msKeyframeRequester->GetStats();
+    ALOGD("keyframe requests: %" PRIu64 " needed, %" PRIu64 " sent, %" PRIu64 " answered, %d from the decoder",
+            keyframeStats.requests, keyframeStats.sent, keyframeStats.answered,
+            AnsyncDecoder_GetKeyframeRequestCount(msDecoder));
+    if (msRateController != NULL) {
+        const RtpRateController::Stats &rateStats = msRateController->GetStats();
+        ALOGD("bitrate control: target %u kbit/s, %" PRIu64 " updates, %" PRIu64 " delay and %" PRIu64
+                " loss decreases, delay part %s", msRateController->GetTargetBitrate() / 1000, rateStats.updates,
+                rateStats.overuses, rateStats.lossDecreases, rateStats.clockValid ? "on" : "off (no media clock)");
+    }
+    RtpCaptureClock::Stats clockStats = msCaptureClock.GetStats();
+    ALOGD("capture clock: %" PRIu64 " frames, %" PRIu64 " restarts, %s, last frame %lld ms over the quickest",
+            clockStats.frames, clockStats.restarts, clockStats.valid ? "valid" : "no media clock",
+            clockStats.delayUs / 1000);
+    // whatever is still held goes with the session
+    msNackBuffer->Reset();
+    if (msJitterBuffer != NULL) {
+        msJitterBuffer->Reset();
+    }
+    AnsyncDecoderQueueStats queueStats;
+    AnsyncDecoder_GetQueueStats(msDecoder, &queueStats);
+    ALOGD("decoder queue: %llu enqueued, %llu dequeued, %llu dropped, %llu blocked, high water %u/%u",
+            queueStats.enqueued, queueStats.dequeued, queueStats.dropped, queueStats.blocked,
+            queueStats.high_water, queueStats.capacity);
+    AnsyncDecoderConfig activeConfig;
+    AnsyncDecoder_GetActiveConfig(msDecoder, &activeConfig);
+    ALOGD("decoder backend at the end: %s, %d fallback(s)", AnsyncDecoder_BackendName(activeConfig.backend),
+            AnsyncDecoder_GetFallbackCount(msDecoder));
+    // the decoder hands its pending units back to the depacketizer pool
     AnsyncDecoder_Destroy(msDecoder);
     msDecoder = NULL;
+    const H264Depacketizer::Stats &stats = msDepacketizer->GetStats();
+    ALOGD("depacketizer: %" PRIu64 " packets, %" PRIu64 " units, %" PRIu64 " lost, %" PRIu64 " late, %" PRIu64
+            " dropped units, %" PRIu64 " skipped units, %" PRIu64 " non-reference dropped", stats.packets,
+            stats.units, stats.lostPackets, stats.latePackets, stats.droppedUnits, stats.skippedUnits,
+            stats.nonRefDropped);
+    delete msNackBuffer;
+    msNackBuffer = NULL;
+    delete msJitterBuffer;
+    msJitterBuffer = NULL;
+    delete msKeyframeRequester;
+    msKeyframeRequester = NULL;
+    delete msRateController;
+    msRateController = NULL;
+    delete msDepacketizer;
+    msDepacketizer = NULL;
+    {
+        Mutex::Autolock l(msStatsLock);
+        msStatsSnapshot = ReceiveStatsSnapshot();
+    }
     ALOGD("thread_recv_virtualcamera END END END");
 }
 
@@ -480,14 +694,48 @@ static int sDestroyMediaSession() {
 
     ALOGD("sDestroyMediaSession BEGIN");
 
-    msVideoSession.BYEDestroy(delay, 
-                "stop rtp msVideoSession", strlen("stop rtp msVideoSession"));
-
     msRecvQuit = 1;
+    if (!msRecvPolling) {
+        msVideoSession.AbortWait();
+    }
 
     ALOGD("sDestroyMediaSession END");
+    Thread_Join(msRecvThread);
+    char sched[256];
+    if (Thread_GetSchedStats(msRecvThread, &msRecvThreadStats) == 0) {
+        sFormatThreadSched(msRecvThreadStats, sched, sizeof(sched));
+        ALOGD("receive thread: %s", sched);
+    }
     Thread_Destroy(msRecvThread);
     msRecvThread = NULL;
+    jthread::JThreadSchedulingStats pollStats;
+    msHavePollThreadStats = msVideoSession.GetPollThreadSchedulingStats(&pollStats) == 0;
+    if (msHavePollThreadStats) {
+        sFromJThreadStats(pollStats, &msPollThreadStats);
+        sFormatThreadSched(msPollThreadStats, sched, sizeof(sched));
+        ALOGD("poll thread: %s", sched);
+    }
+    msSocketDrops = sSocketDrops();
+    ALOGD("RTP socket: %" PRIu64 " datagrams dropped with the receive buffer full", msSocketDrops);
+
+    msVideoSession.BYEDestroy(delay, 
+                "stop rtp msVideoSession", strlen("stop rtp msVideoSession"));
+    // the pool stays with the session object and counts over all sessions
+    RTPPoolMemoryManager *pool = msVideoSession.GetMemoryPool();
+    if (pool != NULL) {
+        RTPPoolMemoryManager::Stats poolStats = pool->GetTotalStats();
+        ALOGD("RTP memory pool: %" PRIu64 " allocations, %" PRIu64 " reused, %" PRIu64 " from the heap, "
+                "high water %zu blocks, %zu KiB in slabs", poolStats.allocations, poolStats.hits,
+                poolStats.heapallocations, poolStats.highwater, pool->GetSlabBytes() / 1024);
+    }
+
+    // kept until the next session starts, for dumpsys
+    msRecvToUnitHistogram.log("RTP receive to access unit latency");
+    msDecoderQueueHistogram.log("decoder queue latency");
+    msDecodeHistogram.log("decode latency");
+    msRecvToSurfaceHistogram.log("RTP receive to surface latency");
+    sLogPresenterStats(msPreviewPresenter, "preview");
+    sLogPresenterStats(msCallBackPresenter, "callback");
     ALOGD("sDestroyMediaSession END END");
     return 0;
 }
@@ -506,11 +754,19 @@ static int sCreateMediaSession(const uint8_t *ip) {
     RTPSessionParams sessionparams;
     sessionparams.SetOwnTimestampUnit(1.0 / 60.0);
     sessionparams.SetAcceptOwnPackets(true);
+    msRecvPolling = property_get_bool("persist.virtualcamera.rtp.polling", false);
+    sessionparams.SetUsePollThread(msRecvPolling);
+    ThreadSched recvSched;
+    sRecvThreadSchedConfig(&recvSched);
+    sessionparams.SetPollThreadScheduling(recvSched.policy, recvSched.priority, recvSched.nice, recvSched.cpus);
+    sRtpMemoryPoolConfig(&sessionparams);
     ALOGD("sCreateMediaSession 2");
     RTPUDPv4TransmissionParams transparams;
     transparams.SetPortbase(5000);
-    transparams.SetRTPReceiveBuffer(1080*1920*4*60);
-	transparams.SetRTCPReceiveBuffer(1080*1920*4*60);
+    transparams.SetRTPReceiveBuffer(sRtpReceiveBuffer());
+    transparams.SetBatchReceive(sRtpBatchReceive());
+    // only reports arrive there
+    transparams.SetRTCPReceiveBuffer(64 * 1024);
     ALOGD("sCreateMediaSession 3");
     int status = msVideoSession.Create(sessionparams, &transparams);
     CHECK_ERROR_JRTPLIB(status);
@@ -525,7 +781,16 @@ static int sCreateMediaSession(const uint8_t *ip) {
     msVideoSession.SetDefaultMark(false);
     msVideoSession.SetDefaultTimestampIncrement(160);
     ALOGD("sCreateMediaSession 7");
+    msRecvToUnitHistogram.reset();
+    msDecoderQueueHistogram.reset();
+    msDecodeHistogram.reset();
+    msRecvToSurfaceHistogram.reset();
+    msPreviewPresenter.resetStats();
+    msCallBackPresenter.resetStats();
+    msSessionStartUs = sNowUs();
+    msRecvQuit = 0;
     msRecvThread = Thread_Create(thread_recv_virtualcamera, NULL);
+    Thread_SetSched(msRecvThread, &recvSched);
     Thread_Run(msRecvThread);
     ALOGD("sCreateMediaSession END");
     return 0;
@@ -646,9 +911,21 @@ status_t VirtualCameraService::setSurface(const sp<IGraphicBufferProducer>& buff
             ALOGD("buffer width = %d , height = %d , stride = %d , format = %d ", buffer.width, buffer.height, buffer.stride, buffer.format);
             ANativeWindow_unlockAndPost(window.get());
         }
+
+        // room for the presenter's dequeued-ahead buffers next to the consumer's
+        int minUndequeued = 0;
+        res = static_cast<ANativeWindow*>(window.get())->query(
+                window.get(), NATIVE_WINDOW_MIN_UNDEQUEUED_BUFFERS, &minUndequeued);
+        if (res != OK) {
+            ALOGW("%s: Unable to query consumer undequeued", __FUNCTION__);
+        }
+        res = native_window_set_buffer_count(window.get(), minUndequeued + sPresenterDepth() + 1);
+        if (res != OK) {
+            ALOGW("%s: Unable to set buffer count", __FUNCTION__);
+        }
     }
 
-    msWindow = window;
+    msPreviewPresenter.setWindow(window, sPresenterDepth());
     return NO_ERROR;
 }
 
@@ -656,7 +933,7 @@ status_t VirtualCameraService::releaseSurface()
 {
     Mutex::Autolock l(mInputMutex);
     ALOGD("%s", __FUNCTION__);
-    msWindow = nullptr;
+    msPreviewPresenter.setWindow(NULL, 0);
     return NO_ERROR;
 }
 
@@ -731,7 +1008,7 @@ status_t VirtualCameraService::setCallBackSurface(const sp<IGraphicBufferProduce
         }
 
         ALOGD("%s: Consumer wants %d buffers, HAL wants %d", __FUNCTION__, maxConsumerBuffers, 0);
-        res = native_window_set_buffer_count(window.get(), maxConsumerBuffers + 6);
+        res = native_window_set_buffer_count(window.get(), maxConsumerBuffers + std::max(6, sPresenterDepth() + 1));
         if (res != OK) {
             ALOGW("%s: Unable to set buffer count", __FUNCTION__);
         }
@@ -744,7 +1021,7 @@ status_t VirtualCameraService::setCallBackSurface(const sp<IGraphicBufferProduce
         }*/
     }
 
-    msCallBackWindow = window;
+    msCallBackPresenter.setWindow(window, sPresenterDepth());
     return NO_ERROR;
 }
 
@@ -762,7 +1039,129 @@ status_t VirtualCameraService::releaseCallBackSurface()
     }*/
 
     ALOGD("%s", __FUNCTION__);
-    msCallBackWindow = nullptr;
+    msCallBackPresenter.setWindow(NULL, 0);
+    return NO_ERROR;
+}
+
+status_t VirtualCameraService::dump(int fd, const Vector<String16>& args)
+{
+    if (!checkCallingPermission(String16("android.permission.DUMP"))) {
+        dprintf(fd, "Permission Denial: can't dump virtual.camera from pid=%d, uid=%d\n",
+                IPCThreadState::self()->getCallingPid(), IPCThreadState::self()->getCallingUid());
+        return NO_ERROR;
+    }
+    Mutex::Autolock l(mInputMutex);
+
+    double seconds = msSessionStartUs > 0 ? (sNowUs() - msSessionStartUs) / 1000000.0 : 0;
+    dprintf(fd, "VirtualCameraService: session %s, %.1f s since it started\n",
+            msRecvThread != NULL ? "running" : "stopped", seconds);
+    if (seconds <= 0) {
+        seconds = 1;
+    }
+
+    // The receive thread's objects change under us, only their last published copy is read.
+    // The decoder's getters are thread safe, and it only goes away in sDestroyMediaSession,
+    // under mInputMutex.
+    ReceiveStatsSnapshot snapshot;
+    {
+        Mutex::Autolock sl(msStatsLock);
+        snapshot = msStatsSnapshot;
+    }
+    AnsyncDecoder *decoder = msDecoder;
+    if (snapshot.haveDepacketizer) {
+        const H264Depacketizer::Stats &stats = snapshot.depacketizer;
+        dprintf(fd, "  depacketizer: %" PRIu64 " packets, %" PRIu64 " units (%.1f/s), %" PRIu64 " keyframes, %"
+                PRIu64 " lost, %" PRIu64 " late, %" PRIu64 " dropped units, %" PRIu64 " skipped units, %" PRIu64
+                " non-reference dropped, %d/%d slots free\n",
+                stats.packets, stats.units, stats.units / seconds, stats.keyframes, stats.lostPackets,
+                stats.latePackets, stats.droppedUnits, stats.skippedUnits, stats.nonRefDropped,
+                snapshot.freeSlots, snapshot.poolSize);
+    }
+    if (snapshot.haveNack) {
+        const RtpNackBuffer::Stats &stats = snapshot.nack;
+        dprintf(fd, "  NACK: %" PRIu64 " missing, %" PRIu64 " requested, %" PRIu64 " recovered, %" PRIu64 " lost, %"
+                PRIu64 " reordered, %" PRIu64 " duplicate, %" PRIu64 " late, %d held\n", stats.missing,
+                stats.requested, stats.recovered, stats.lost, stats.reordered, stats.duplicates, stats.late,
+                snapshot.nackHeld);
+    }
+    if (snapshot.haveJitterBuffer) {
+        const RtpJitterBuffer::Stats &stats = snapshot.jitter;
+        dprintf(fd, "  jitter buffer: target %.1f ms, %" PRIu64 " frames, %" PRIu64 " incomplete, %" PRIu64
+                " lost, %" PRIu64 " late, %" PRIu64 " duplicate, %" PRIu64 " reordered, %d held\n",
+                snapshot.jitterTargetUs / 1000.0, stats.frames, stats.incomplete, stats.lost, stats.late,
+                stats.duplicates, stats.reordered, snapshot.jitterHeld);
+    }
+    if (snapshot.haveKeyframeRequester) {
+        const RtpKeyframeRequester::Stats &stats = snapshot.keyframe;
+        dprintf(fd, "  keyframe requests: %" PRIu64 " needed, %" PRIu64 " sent, %" PRIu64 " answered, %s\n",
+                stats.requests, stats.sent, stats.answered, snapshot.keyframePending ? "pending" : "none pending");
+    }
+    if (snapshot.haveRateController) {
+        const RtpRateController::Stats &stats = snapshot.rate;
+        dprintf(fd, "  bitrate control: target %u kbit/s, received %u kbit/s, %.1f%% loss, %.1f ms jitter, "
+                "%" PRIu64 " updates, %" PRIu64 " delay and %" PRIu64 " loss decreases, delay part %s\n",
+                snapshot.targetBitrate / 1000, stats.receivedBitrate / 1000, stats.loss * 100,
+                stats.jitterMs, stats.updates, stats.overuses, stats.lossDecreases,
+                stats.clockValid ? "on" : "off (no media clock)");
+    }
+    RtpCaptureClock::Stats clockStats = msCaptureClock.GetStats();
+    dprintf(fd, "  capture clock: %" PRIu64 " frames, %" PRIu64 " restarts, %s, offset %.1f ms, last frame %.1f ms"
+            " over the quickest\n", clockStats.frames, clockStats.restarts,
+            clockStats.valid ? "valid" : "no media clock", clockStats.offsetUs / 1000.0, clockStats.delayUs / 1000.0);
+    // live while the session runs, else what sDestroyMediaSession kept
+    ThreadSchedStats recvStats = msRecvThreadStats;
+    ThreadSchedStats pollStats = msPollThreadStats;
+    bool havePollStats = msHavePollThreadStats;
+    uint64_t socketDrops = msSocketDrops;
+    if (msRecvThread != NULL) {
+        jthread::JThreadSchedulingStats live;
+        Thread_GetSchedStats(msRecvThread, &recvStats);
+        havePollStats = msVideoSession.GetPollThreadSchedulingStats(&live) == 0;
+        if (havePollStats) {
+            sFromJThreadStats(live, &pollStats);
+        }
+        socketDrops = sSocketDrops();
+    }
+    char sched[256];
+    sFormatThreadSched(recvStats, sched, sizeof(sched));
+    dprintf(fd, "  receive thread: %s\n", sched);
+    if (havePollStats) {
+        sFormatThreadSched(pollStats, sched, sizeof(sched));
+        dprintf(fd, "  poll thread: %s\n", sched);
+    }
+    dprintf(fd, "  RTP socket: %" PRIu64 " datagrams dropped with the receive buffer full\n", socketDrops);
+    RTPPoolMemoryManager *pool = msVideoSession.GetMemoryPool();
+    if (pool != NULL) {
+        RTPPoolMemoryManager::Stats stats = pool->GetTotalStats();
+        RTPPoolMemoryManager::Stats packets = pool->GetStats(RTPMEM_TYPE_BUFFER_RECEIVEDRTPPACKET);
+        dprintf(fd, "  RTP memory pool: %" PRIu64 " allocations, %.1f%% reused (packet buffers %.1f%%), %" PRIu64
+                " from the heap, %zu in use, high water %zu, %zu KiB in slabs\n", stats.allocations,
+                stats.allocations > 0 ? stats.hits * 100.0 / stats.allocations : 0.0,
+                packets.allocations > 0 ? packets.hits * 100.0 / packets.allocations : 0.0,
+                stats.heapallocations, stats.inuse, stats.highwater, pool->GetSlabBytes() / 1024);
+    }
+    if (decoder != NULL) {
+        AnsyncDecoderQueueStats queueStats;
+        AnsyncDecoderStreamInfo stream;
+        AnsyncDecoderConfig activeConfig;
+        AnsyncDecoder_GetQueueStats(decoder, &queueStats);
+        AnsyncDecoder_GetStreamInfo(decoder, &stream);
+        AnsyncDecoder_GetActiveConfig(decoder, &activeConfig);
+        dprintf(fd, "  decoder: %s backend, %d fallback(s), %d keyframe request(s), stream %dx%d\n",
+                AnsyncDecoder_BackendName(activeConfig.backend), AnsyncDecoder_GetFallbackCount(decoder),
+                AnsyncDecoder_GetKeyframeRequestCount(decoder), stream.width, stream.height);
+        dprintf(fd, "    %llu received, %llu decoded (%.1f/s), %llu dropped, %llu blocked, %u queued, high water %u/%u\n",
+                queueStats.received, queueStats.decoded, queueStats.decoded / seconds, queueStats.dropped,
+                queueStats.blocked, queueStats.queued, queueStats.high_water, queueStats.capacity);
+    }
+    msPreviewPresenter.dump(fd);
+    msCallBackPresenter.dump(fd);
+
+    dprintf(fd, "  latency per stage:\n");
+    msRecvToUnitHistogram.dump(fd, "    RTP receive to access unit");
+    msDecoderQueueHistogram.dump(fd, "    decoder queue");
+    msDecodeHistogram.dump(fd, "    decode");
+    msRecvToSurfaceHistogram.dump(fd, "    RTP receive to preview surface");
     return NO_ERROR;
 }
 
@@ -29,6 +29,9 @@ public:
     virtual status_t setCallBackSurface(const sp<IGraphicBufferProducer>& bufferProducer, int32_t width, int32_t height, int32_t format, int32_t transform);
     virtual status_t releaseCallBackSurface();
 
+    // dumpsys virtual.camera: per stage latency histograms and throughput of the running session
+    virtual status_t dump(int fd, const Vector<String16>& args);
+
 private:
 
 };
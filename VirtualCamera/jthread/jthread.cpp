@@ -29,6 +29,10 @@
 #include <sys/time.h>
 #include <time.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 namespace jthread {
 
@@ -37,6 +41,12 @@ JThread::JThread() {
 	mutexinit = false;
 	running = false;
 	threadid = 0;
+	schedset = false;
+	schedpolicy = SCHED_OTHER;
+	schedpriority = 0;
+	schednice = 0;
+	schedcpumask = 0;
+	tid = 0;
 }
 
 JThread::~JThread()
@@ -172,6 +182,117 @@ bool JThread::IsSameThread()
 	return same;
 }
 
+int JThread::SetScheduling(int policy, int priority, int nice, uint64_t cpumask)
+{
+	if (policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR)
+		return ERR_JTHREAD_INVALIDSCHEDULING;
+	schedset = true;
+	schedpolicy = policy;
+	schedpriority = priority;
+	schednice = nice;
+	schedcpumask = cpumask;
+	return 0;
+}
+
+int JThread::GetSchedulingStats(JThreadSchedulingStats *stats)
+{
+	if (!mutexinit)
+		return ERR_JTHREAD_NOTRUNNING;
+
+	runningmutex.Lock();
+	if (tid == 0)
+	{
+		runningmutex.Unlock();
+		return ERR_JTHREAD_NOTRUNNING;
+	}
+	*stats = schedstats;
+	if (running)
+		ReadSchedulingCounters(tid, stats);
+	runningmutex.Unlock();
+	return 0;
+}
+
+// Called by the new thread itself, so a real-time policy it may not use can
+// fall back to SCHED_OTHER instead of failing pthread_create.
+void JThread::ApplyScheduling()
+{
+	struct sched_param param;
+	int policy;
+
+	schedstats = JThreadSchedulingStats();
+	if (pthread_getschedparam(pthread_self(), &policy, &param) == 0)
+	{
+		schedstats.policy = policy;
+		schedstats.priority = param.sched_priority;
+	}
+	if (schedset)
+	{
+		if (schedcpumask != 0)
+		{
+			cpu_set_t set;
+
+			CPU_ZERO(&set);
+			for (int cpu = 0 ; cpu < 64 && cpu < CPU_SETSIZE ; cpu++)
+			{
+				if (schedcpumask & (((uint64_t)1) << cpu))
+					CPU_SET(cpu, &set);
+			}
+			if (sched_setaffinity(0, sizeof(set), &set) == 0)
+				schedstats.cpumask = schedcpumask;
+		}
+		param.sched_priority = schedpriority;
+		if ((schedpolicy == SCHED_FIFO || schedpolicy == SCHED_RR) &&
+		    pthread_setschedparam(pthread_self(), schedpolicy, &param) == 0)
+		{
+			schedstats.policy = schedpolicy;
+			schedstats.priority = schedpriority;
+		}
+		else
+		{
+			param.sched_priority = 0;
+			if (schedstats.policy != SCHED_OTHER && pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) == 0)
+			{
+				schedstats.policy = SCHED_OTHER;
+				schedstats.priority = 0;
+			}
+			setpriority(PRIO_PROCESS, tid, schednice);
+		}
+	}
+	schedstats.nice = getpriority(PRIO_PROCESS, tid);
+}
+
+void JThread::ReadSchedulingCounters(pid_t tid, JThreadSchedulingStats *stats)
+{
+	char path[64];
+	char line[128];
+	unsigned long long run, wait, slices, count;
+	FILE *f;
+
+	// "<on cpu ns> <waiting on a runqueue ns> <timeslices>"
+	snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", (int)tid);
+	if ((f = fopen(path, "r")) != NULL)
+	{
+		if (fscanf(f, "%llu %llu %llu", &run, &wait, &slices) == 3)
+		{
+			stats->rundelayns = wait;
+			stats->timeslices = slices;
+		}
+		fclose(f);
+	}
+	snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)tid);
+	if ((f = fopen(path, "r")) != NULL)
+	{
+		while (fgets(line, sizeof(line), f) != NULL)
+		{
+			if (sscanf(line, "voluntary_ctxt_switches: %llu", &count) == 1)
+				stats->voluntaryswitches = count;
+			else if (sscanf(line, "nonvoluntary_ctxt_switches: %llu", &count) == 1)
+				stats->involuntaryswitches = count;
+		}
+		fclose(f);
+	}
+}
+
 void *JThread::TheThread(void *param)
 {
 	JThread *jthread;
@@ -181,6 +302,8 @@ void *JThread::TheThread(void *param)
 	
 	jthread->continuemutex2.Lock();
 	jthread->runningmutex.Lock();
+	jthread->tid = (pid_t)syscall(SYS_gettid);
+	jthread->ApplyScheduling();
 	jthread->running = true;
 	jthread->runningmutex.Unlock();
 	
@@ -190,6 +313,7 @@ void *JThread::TheThread(void *param)
 	ret = jthread->Thread();
 
 	jthread->runningmutex.Lock();
+	ReadSchedulingCounters(jthread->tid, &jthread->schedstats); // gone with the task
 	jthread->running = false;
 	jthread->retval = ret;
 	jthread->threadid = 0;
@@ -0,0 +1,266 @@
+// Host unit test for the SPSC ring in Common/circular_list: ordering, the three
+// overflow policies, close, and a two-thread stress run. Also prints the
+// push-to-pop wakeup latency of an idle consumer.
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "Common/circular_list.h"
+#include "testharness.h"
+
+static long long sNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Item {
+    unsigned int seq;
+    long long pushNs;
+};
+
+static void testOrderAndCapacity() {
+    CircularList *list = CircularList_Create(5, sizeof(Item));
+    EXPECT(list != NULL);
+    EXPECT(CircularList_Capacity(list) == 8);
+
+    Item item = {0, 0};
+    for (unsigned int i = 0; i < 8; i++) {
+        item.seq = i;
+        EXPECT(CircularList_Push(list, &item, 0, 0) == 0);
+    }
+    item.seq = 8;
+    EXPECT(CircularList_Push(list, &item, 0, 0) < 0);
+    EXPECT(CircularList_Size(list) == 8);
+
+    for (unsigned int i = 0; i < 8; i++) {
+        EXPECT(CircularList_Pop(list, &item, 0) == 0);
+        EXPECT(item.seq == i);
+    }
+    EXPECT(CircularList_Pop(list, &item, 0) < 0);
+
+    CircularListStats stats;
+    CircularList_GetStats(list, &stats);
+    EXPECT(stats.enqueued == 8);
+    EXPECT(stats.dequeued == 8);
+    EXPECT(stats.dropped == 1);
+    EXPECT(stats.high_water == 8);
+    CircularList_Destroy(list);
+}
+
+static std::vector<unsigned int> sDropped;
+
+static void sOnDrop(void * /*userdata*/, void *element) {
+    sDropped.push_back(((Item *)element)->seq);
+}
+
+static void testDropOldest() {
+    CircularList *list = CircularList_Create(4, sizeof(Item));
+    CircularList_SetPolicy(list, CIRCULAR_LIST_DROP_OLDEST, sOnDrop, NULL);
+    sDropped.clear();
+
+    Item item = {0, 0};
+    for (unsigned int i = 0; i < 7; i++) {
+        item.seq = i;
+        EXPECT(CircularList_Push(list, &item, 0, 0) == 0);
+    }
+    EXPECT(sDropped.size() == 3);
+    for (size_t i = 0; i < sDropped.size(); i++)
+        EXPECT(sDropped[i] == i);
+    for (unsigned int i = 3; i < 7; i++) {
+        EXPECT(CircularList_Pop(list, &item, 0) == 0);
+        EXPECT(item.seq == i);
+    }
+    CircularList_Destroy(list);
+}
+
+static void testDropNonRef() {
+    CircularList *list = CircularList_Create(2, sizeof(Item));
+    CircularList_SetPolicy(list, CIRCULAR_LIST_DROP_NON_REF, NULL, NULL);
+
+    Item item = {0, 0};
+    EXPECT(CircularList_Push(list, &item, 0, 0) == 0);
+    EXPECT(CircularList_Push(list, &item, 1, 0) == 0);
+    // full: a droppable element is refused at once, a reference one waits
+    long long start = sNowNs();
+    EXPECT(CircularList_Push(list, &item, 1, 1000) == CIRCULAR_LIST_REFUSED_DROPPABLE);
+    EXPECT(sNowNs() - start < 500000000LL);
+    start = sNowNs();
+    EXPECT(CircularList_Push(list, &item, 0, 20) == -1);
+    EXPECT(sNowNs() - start >= 19000000LL);
+
+    CircularListStats stats;
+    CircularList_GetStats(list, &stats);
+    EXPECT(stats.dropped == 2);
+    EXPECT(stats.blocked == 1);
+    CircularList_Destroy(list);
+}
+
+static void *sDelayedPop(void *arg) {
+    CircularList *list = (CircularList *)arg;
+    Item item;
+    usleep(10000);
+    CircularList_Pop(list, &item, -1);
+    return NULL;
+}
+
+static void testBlockUntilRoom() {
+    CircularList *list = CircularList_Create(1, sizeof(Item));
+    Item item = {0, 0};
+    EXPECT(CircularList_Push(list, &item, 0, 0) == 0);
+
+    pthread_t t;
+    pthread_create(&t, NULL, sDelayedPop, list);
+    item.seq = 1;
+    EXPECT(CircularList_Push(list, &item, 0, -1) == 0);
+    pthread_join(t, NULL);
+
+    EXPECT(CircularList_Pop(list, &item, 0) == 0);
+    EXPECT(item.seq == 1);
+    CircularListStats stats;
+    CircularList_GetStats(list, &stats);
+    EXPECT(stats.blocked == 1);
+    EXPECT(stats.dropped == 0);
+    CircularList_Destroy(list);
+}
+
+static void *sWaitForever(void *arg) {
+    CircularList *list = (CircularList *)arg;
+    Item item;
+    return (void *)(long)CircularList_Pop(list, &item, -1);
+}
+
+static void testClose() {
+    CircularList *list = CircularList_Create(4, sizeof(Item));
+    pthread_t t;
+    pthread_create(&t, NULL, sWaitForever, list);
+    usleep(5000);
+    CircularList_Close(list);
+    void *ret;
+    pthread_join(t, &ret);
+    EXPECT((long)ret < 0);
+
+    Item item = {0, 0};
+    EXPECT(CircularList_Push(list, &item, 0, -1) < 0);
+    CircularList_Reset(list);
+    EXPECT(CircularList_Push(list, &item, 0, 0) == 0);
+    CircularList_Destroy(list);
+}
+
+struct StressArgs {
+    CircularList *list;
+    unsigned int count;
+    bool ordered;
+    unsigned int received;
+};
+
+static void *sStressConsumer(void *arg) {
+    StressArgs *a = (StressArgs *)arg;
+    Item item;
+    long long last = -1;
+    while (CircularList_Pop(a->list, &item, -1) == 0) {
+        if ((long long)item.seq <= last || (a->ordered && item.seq != (unsigned int)(last + 1))) {
+            fprintf(stderr, "out of order: %u after %lld\n", item.seq, last);
+            sFailures++;
+            break;
+        }
+        last = item.seq;
+        a->received++;
+    }
+    return NULL;
+}
+
+static void stress(CircularListPolicy policy) {
+    StressArgs a;
+    a.list = CircularList_Create(64, sizeof(Item));
+    a.count = 2000000;
+    a.ordered = policy == CIRCULAR_LIST_BLOCK;
+    a.received = 0;
+    CircularList_SetPolicy(a.list, policy, NULL, NULL);
+
+    pthread_t t;
+    pthread_create(&t, NULL, sStressConsumer, &a);
+    Item item = {0, 0};
+    for (unsigned int i = 0; i < a.count; i++) {
+        item.seq = i;
+        EXPECT(CircularList_Push(a.list, &item, 0, -1) == 0);
+    }
+    // drain, then let the consumer's last wait return
+    while (CircularList_Size(a.list) > 0)
+        usleep(1000);
+    CircularList_Close(a.list);
+    pthread_join(t, NULL);
+
+    CircularListStats stats;
+    CircularList_GetStats(a.list, &stats);
+    EXPECT(stats.enqueued == a.count);
+    EXPECT(stats.dequeued == a.received);
+    EXPECT(stats.enqueued == stats.dequeued + stats.dropped);
+    if (policy == CIRCULAR_LIST_BLOCK)
+        EXPECT(a.received == a.count);
+    printf("stress %s: %u pushed, %u popped, %llu dropped, %llu blocked\n",
+            policy == CIRCULAR_LIST_BLOCK ? "block" : "drop-oldest", a.count, a.received,
+            (unsigned long long)stats.dropped, (unsigned long long)stats.blocked);
+    CircularList_Destroy(a.list);
+}
+
+struct LatencyArgs {
+    CircularList *list;
+    std::vector<long long> samples;
+};
+
+static void *sLatencyConsumer(void *arg) {
+    LatencyArgs *a = (LatencyArgs *)arg;
+    Item item;
+    while (CircularList_Pop(a->list, &item, -1) == 0)
+        a->samples.push_back(sNowNs() - item.pushNs);
+    return NULL;
+}
+
+// A frame every 2 ms to a sleeping consumer: what the decoder thread sees.
+static void reportWakeupLatency() {
+    LatencyArgs a;
+    a.list = CircularList_Create(16, sizeof(Item));
+    pthread_t t;
+    pthread_create(&t, NULL, sLatencyConsumer, &a);
+    Item item = {0, 0};
+    for (int i = 0; i < 500; i++) {
+        usleep(2000);
+        item.pushNs = sNowNs();
+        CircularList_Push(a.list, &item, 0, -1);
+    }
+    usleep(2000);
+    CircularList_Close(a.list);
+    pthread_join(t, NULL);
+
+    std::sort(a.samples.begin(), a.samples.end());
+    if (!a.samples.empty()) {
+        printf("wakeup latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+                a.samples[a.samples.size() / 2] / 1000.0,
+                a.samples[a.samples.size() * 99 / 100] / 1000.0,
+                a.samples.back() / 1000.0);
+    }
+    CircularList_Destroy(a.list);
+}
+
+int main() {
+    testOrderAndCapacity();
+    testDropOldest();
+    testDropNonRef();
+    testBlockUntilRoom();
+    testClose();
+    stress(CIRCULAR_LIST_BLOCK);
+    stress(CIRCULAR_LIST_DROP_OLDEST);
+    reportWakeupLatency();
+
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("circularlisttest: all passed\n");
+    return 0;
+}
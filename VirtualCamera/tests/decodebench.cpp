@@ -0,0 +1,245 @@
+// Decode latency against throughput for each AnsyncDecoder profile.
+//
+// Needs libavcodec, so it is built for the device by Android.mk
+// (virtualcamera_decodebench) rather than by the host CMakeLists.txt.
+// The input is a raw Annex-B H.264 stream, e.g. recorded from the sender
+// with ffmpeg -c copy -f h264.
+//
+// For every profile the stream is decoded twice:
+//  - paced at -r fps like a live session: per frame latency from queueing
+//    the access unit to the frame callback,
+//  - unpaced, as fast as the queue accepts units: decoded frames per second
+//    and CPU ms per frame (more than wall ms per frame means several cores).
+//
+// -b picks the backend (see ANSYNC_DECODER_BACKEND_*): 2, the null backend,
+// shows what the queue and callbacks cost without any decoding.
+//
+//   decodebench -i stream.h264 [-b backend] [-p profile] [-t threads] [-r fps] [-n loops]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "AnsyncDecoder/AnsyncDecoder.h"
+
+#define PADDING 256
+
+static long long sNowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long sCpuUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+struct Unit {
+    std::vector<uint8_t> data;      // len bytes followed by PADDING zero bytes
+    int len;
+};
+
+// Splits an Annex-B stream into access units the way the depacketizer hands
+// them over: parameter sets and SEI go with the picture that follows.
+static void sSplitAccessUnits(const std::vector<uint8_t> &in, std::vector<Unit> &units) {
+    std::vector<size_t> starts;
+    for (size_t i = 0; i + 3 < in.size(); i++) {
+        if (in[i] == 0 && in[i + 1] == 0 && in[i + 2] == 1) {
+            starts.push_back(i > 0 && in[i - 1] == 0 ? i - 1 : i);
+            i += 2;
+        }
+    }
+    if (starts.empty())
+        return;
+    starts.push_back(in.size());
+
+    size_t auStart = starts[0];
+    bool hasSlice = false;
+    for (size_t n = 0; n + 1 < starts.size(); n++) {
+        size_t hdr = starts[n] + (in[starts[n] + 2] == 1 ? 3 : 4);
+        if (hdr + 1 >= in.size())
+            break;
+        int type = in[hdr] & 0x1f;
+        bool slice = type >= 1 && type <= 5;
+        // first_mb_in_slice == 0 starts a picture: ue(v) 0 is a single 1 bit
+        if (hasSlice && ((slice && (in[hdr + 1] & 0x80)) || (type >= 6 && type <= 9))) {
+            Unit u;
+            u.len = (int)(starts[n] - auStart);
+            u.data.assign(in.begin() + auStart, in.begin() + starts[n]);
+            u.data.resize(u.len + PADDING, 0);
+            units.push_back(u);
+            auStart = starts[n];
+            hasSlice = false;
+        }
+        hasSlice = hasSlice || slice;
+    }
+    if (in.size() > auStart) {
+        Unit u;
+        u.len = (int)(in.size() - auStart);
+        u.data.assign(in.begin() + auStart, in.end());
+        u.data.resize(u.len + PADDING, 0);
+        units.push_back(u);
+    }
+}
+
+struct Run {
+    std::atomic<int> frames;
+    std::vector<long long> latencyUs;   // decoder thread only until Destroy
+    long long lastFrameUs;
+};
+
+static void sFrameCb(void *userdata, const AnsyncDecoderFrame *frame) {
+    Run *run = (Run *)userdata;
+    long long now = sNowUs();
+    run->latencyUs.push_back(now - frame->recv_time_us);
+    run->lastFrameUs = now;
+    run->frames++;
+}
+
+static void sRelease(void *opaque, uint8_t *data) {
+}
+
+// Frame threads keep the last pictures until more input arrives, so the end
+// of a run is when no frame has come out for a while.
+static void sWaitIdle(Run *run) {
+    int last = -1;
+    while (run->frames != last) {
+        last = run->frames;
+        usleep(300000);
+    }
+}
+
+static int sDecode(const std::vector<Unit> &units, int loops, const AnsyncDecoderConfig *config,
+        int fps, Run *run, AnsyncDecoderConfig *active) {
+    AnsyncDecoder *ad = AnsyncDecoder_CreateEx(NULL, 0, NULL, 0, run, NULL, config);
+    if (!ad)
+        return -1;
+    AnsyncDecoder_SetFrameCallback(ad, sFrameCb);
+    AnsyncDecoder_GetActiveConfig(ad, active);
+
+    long long start = sNowUs();
+    int n = 0;
+    for (int l = 0; l < loops; l++) {
+        for (size_t i = 0; i < units.size(); i++, n++) {
+            if (fps > 0) {
+                long long due = start + (long long)n * 1000000LL / fps;
+                long long now = sNowUs();
+                if (due > now)
+                    usleep((useconds_t)(due - now));
+            }
+            const Unit &u = units[i];
+            // refused while the decoder thread is starting up or the queue is full
+            while (AnsyncDecoder_ReceiveBuffer(ad, (void *)u.data.data(), u.len, (uint32_t)(n * 3000), sNowUs(), 1,
+                                               sRelease, NULL) < 0)
+                ;
+        }
+    }
+    sWaitIdle(run);
+    AnsyncDecoder_Destroy(ad);
+    return 0;
+}
+
+static long long sPercentile(std::vector<long long> &v, int pct) {
+    if (v.empty())
+        return 0;
+    size_t i = std::min(v.size() - 1, v.size() * pct / 100);
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+int main(int argc, char *argv[]) {
+    const char *input = NULL;
+    int backend = ANSYNC_DECODER_BACKEND_SW, profile = -1, threads = -1, fps = 30, loops = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:b:p:t:r:n:")) != -1) {
+        switch (opt) {
+        case 'i': input = optarg; break;
+        case 'b': backend = atoi(optarg); break;
+        case 'p': profile = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 'r': fps = atoi(optarg); break;
+        case 'n': loops = atoi(optarg); break;
+        default:
+            input = NULL;
+            break;
+        }
+    }
+    if (!input || fps <= 0 || loops <= 0) {
+        fprintf(stderr, "usage: %s -i stream.h264 [-b backend] [-p profile] [-t threads] [-r fps] [-n loops]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *fp = fopen(input, "rb");
+    if (!fp) {
+        perror(input);
+        return 1;
+    }
+    std::vector<uint8_t> stream;
+    uint8_t chunk[65536];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        stream.insert(stream.end(), chunk, chunk + got);
+    fclose(fp);
+
+    std::vector<Unit> units;
+    sSplitAccessUnits(stream, units);
+    printf("%s: %zu access units x %d, paced at %d fps, %s backend\n", input, units.size(), loops, fps,
+            AnsyncDecoder_BackendName(backend));
+    printf("  %-12s %-7s %-13s %7s %7s %7s %7s | %8s %10s\n", "profile", "threads", "type",
+            "avg ms", "p50 ms", "p99 ms", "max ms", "max fps", "cpu ms/f");
+
+    for (int p = ANSYNC_DECODER_PROFILE_DEFAULT; p <= ANSYNC_DECODER_PROFILE_THROUGHPUT; p++) {
+        if (profile >= 0 && p != profile)
+            continue;
+        AnsyncDecoderConfig config, active;
+        AnsyncDecoder_GetProfileConfig(p, &config);
+        if (threads >= 0)
+            config.thread_count = threads;
+        config.backend = backend;
+        config.fallback = ANSYNC_DECODER_BACKEND_NONE;
+
+        Run paced;
+        paced.frames = 0;
+        paced.lastFrameUs = 0;
+        if (sDecode(units, loops, &config, fps, &paced, &active) < 0) {
+            fprintf(stderr, "cannot create the decoder for %s\n", AnsyncDecoder_ProfileName(p));
+            return 1;
+        }
+        long long sum = 0;
+        for (size_t i = 0; i < paced.latencyUs.size(); i++)
+            sum += paced.latencyUs[i];
+        double avg = paced.latencyUs.empty() ? 0 : (double)sum / paced.latencyUs.size();
+
+        Run unpaced;
+        unpaced.frames = 0;
+        unpaced.lastFrameUs = 0;
+        long long start = sNowUs();
+        long long cpu = sCpuUs();
+        sDecode(units, loops, &config, 0, &unpaced, &active);
+        cpu = sCpuUs() - cpu;
+        double secs = (unpaced.lastFrameUs - start) / 1e6;
+
+        const char *type = active.thread_type == ANSYNC_DECODER_THREAD_FRAME ? "frame" :
+                           active.thread_type == ANSYNC_DECODER_THREAD_SLICE ? "slice" : "none";
+        char flags[32];
+        snprintf(flags, sizeof(flags), "%s%s%s", type, active.low_delay ? "+lowdelay" : "",
+                active.fast ? "+fast" : "");
+        printf("  %-12s %-7d %-13s %7.2f %7.2f %7.2f %7.2f | %8.1f %10.2f\n", AnsyncDecoder_ProfileName(p),
+                active.thread_count, flags, avg / 1000.0,
+                sPercentile(paced.latencyUs, 50) / 1000.0, sPercentile(paced.latencyUs, 99) / 1000.0,
+                sPercentile(paced.latencyUs, 100) / 1000.0,
+                secs > 0 ? unpaced.frames / secs : 0.0,
+                unpaced.frames ? cpu / 1000.0 / unpaced.frames : 0.0);
+        if (paced.frames < (int)(units.size() * loops) * 9 / 10)
+            printf("  %-12s only %d of %zu frames decoded\n", "", paced.frames.load(), units.size() * loops);
+    }
+    return 0;
+}
@@ -0,0 +1,481 @@
+// Host unit test for the AnsyncDecoder backend selection: the null backend
+// behind both callbacks, falling through a backend that is not built in,
+// handing over to the fallback when a backend breaks down mid-stream,
+// following the picture size of the SPS in the stream, and asking for a
+// keyframe once per damaged stretch of the stream.
+// libavcodec is not needed: the library is built with ANSYNC_DECODER_NO_AVCODEC.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "AnsyncDecoder/AnsyncDecoder.h"
+#include "AnsyncDecoder/decoder_backend.h"
+#include "testharness.h"
+
+// SPS + PPS + IDR slice, P slice, SEI only; each followed by the padding
+// AnsyncDecoder_ReceiveBuffer asks for
+static const uint8_t sIdr[64 + 24] = {
+    0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f,
+    0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80,
+    0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00,
+};
+static const uint8_t sP[64 + 8] = { 0, 0, 0, 1, 0x41, 0x9a, 0x02, 0x00 };
+// sIdr behind an access unit delimiter and an SEI
+static const uint8_t sAudIdr[64 + 38] = {
+    0, 0, 0, 1, 0x09, 0x10,
+    0, 0, 0, 1, 0x06, 0x05, 0x01, 0x80,
+    0, 0, 0, 1, 0x67, 0x42, 0x00, 0x1f,
+    0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80,
+    0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00,
+};
+static const uint8_t sSei[64 + 8] = { 0, 0, 0, 1, 0x06, 0x05, 0x01, 0x80 };
+
+// Writes an SPS bit by bit and escapes it into a NAL unit with start code.
+class SpsWriter {
+public:
+    void bits(uint32_t value, int count) {
+        for (int i = count - 1; i >= 0; i--)
+            mBits.push_back((value >> i) & 1);
+    }
+    void ue(uint32_t value) {
+        uint64_t v = (uint64_t)value + 1;
+        int len = 0;
+        while ((v >> len) > 1)
+            len++;
+        bits(0, len);
+        bits((uint32_t)v, len + 1);
+    }
+    std::vector<uint8_t> unit() {
+        bits(1, 1);                 // rbsp_stop_one_bit
+        while (mBits.size() % 8)
+            mBits.push_back(0);
+        std::vector<uint8_t> out = { 0, 0, 0, 1, 0x67 };
+        int zeros = 0;
+        for (size_t i = 0; i < mBits.size(); i += 8) {
+            uint8_t byte = 0;
+            for (int j = 0; j < 8; j++)
+                byte = (uint8_t)(byte << 1 | mBits[i + j]);
+            if (zeros >= 2 && byte <= 3) {
+                out.push_back(3);   // emulation_prevention_three_byte
+                zeros = 0;
+            }
+            out.push_back(byte);
+            zeros = byte == 0 ? zeros + 1 : 0;
+        }
+        return out;
+    }
+private:
+    std::vector<int> mBits;
+};
+
+// Baseline SPS; with fps a VUI with timing (one tick per field), signal type and reordering
+static std::vector<uint8_t> sMakeSps(int width, int height, int fps, bool fullRange) {
+    int mbWidth = (width + 15) / 16, mbHeight = (height + 15) / 16;
+    SpsWriter w;
+    w.bits(66, 8);                  // profile_idc
+    w.bits(0, 8);                   // constraint flags
+    w.bits(31, 8);                  // level_idc
+    w.ue(0);                        // seq_parameter_set_id
+    w.ue(0);                        // log2_max_frame_num_minus4
+    w.ue(2);                        // pic_order_cnt_type
+    w.ue(1);                        // max_num_ref_frames
+    w.bits(0, 1);                   // gaps_in_frame_num_value_allowed_flag
+    w.ue(mbWidth - 1);
+    w.ue(mbHeight - 1);
+    w.bits(1, 1);                   // frame_mbs_only_flag
+    w.bits(1, 1);                   // direct_8x8_inference_flag
+    bool crop = mbWidth * 16 != width || mbHeight * 16 != height;
+    w.bits(crop, 1);
+    if (crop) {
+        w.ue(0);
+        w.ue((mbWidth * 16 - width) / 2);
+        w.ue(0);
+        w.ue((mbHeight * 16 - height) / 2);
+    }
+    w.bits(fps > 0, 1);             // vui_parameters_present_flag
+    if (fps > 0) {
+        w.bits(0, 1);               // aspect_ratio_info_present_flag
+        w.bits(0, 1);               // overscan_info_present_flag
+        w.bits(1, 1);               // video_signal_type_present_flag
+        w.bits(5, 3);
+        w.bits(fullRange, 1);
+        w.bits(0, 1);               // colour_description_present_flag
+        w.bits(0, 1);               // chroma_loc_info_present_flag
+        w.bits(1, 1);               // timing_info_present_flag
+        w.bits(1, 32);              // num_units_in_tick, needs escaping
+        w.bits(2 * fps, 32);        // time_scale
+        w.bits(1, 1);               // fixed_frame_rate_flag
+        w.bits(1, 1);               // nal_hrd_parameters_present_flag
+        w.ue(0);                    //   cpb_cnt_minus1
+        w.bits(0, 4);
+        w.bits(0, 4);
+        w.ue(999);                  //   bit_rate_value_minus1
+        w.ue(999);                  //   cpb_size_value_minus1
+        w.bits(0, 1);               //   cbr_flag
+        w.bits(23, 5);
+        w.bits(23, 5);
+        w.bits(23, 5);
+        w.bits(24, 5);
+        w.bits(0, 1);               // vcl_hrd_parameters_present_flag
+        w.bits(0, 1);               // low_delay_hrd_flag
+        w.bits(0, 1);               // pic_struct_present_flag
+        w.bits(1, 1);               // bitstream_restriction_flag
+        w.bits(1, 1);
+        w.ue(0);
+        w.ue(0);
+        w.ue(16);
+        w.ue(16);
+        w.ue(0);                    // max_num_reorder_frames
+        w.ue(1);                    // max_dec_frame_buffering
+    }
+    return w.unit();
+}
+
+// SPS, then the PPS and IDR slice of sIdr, then the padding
+static std::vector<uint8_t> sMakeIdr(int width, int height, int fps, bool fullRange) {
+    static const uint8_t rest[] = {
+        0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80,
+        0, 0, 0, 1, 0x65, 0x88, 0x84, 0x00,
+    };
+    std::vector<uint8_t> unit = sMakeSps(width, height, fps, fullRange);
+    unit.insert(unit.end(), rest, rest + sizeof(rest));
+    return unit;
+}
+
+struct Received {
+    std::vector<uint32_t> timestamps;
+    std::vector<long long> recvTimes;
+    int width;
+    int height;
+    int rgbaLen;
+    uint8_t rgbaFirst[4];
+    std::vector<int> frameWidths;
+    int badStageTimes;
+    std::vector<AnsyncDecoderStreamInfo> streams;
+    std::vector<int> keyframeReasons;
+};
+
+static void sFrameCb(void *userdata, const AnsyncDecoderFrame *frame) {
+    Received *r = (Received *)userdata;
+    r->timestamps.push_back(frame->timestamp);
+    r->recvTimes.push_back(frame->recv_time_us);
+    r->width = frame->width;
+    r->height = frame->height;
+    r->frameWidths.push_back(frame->width);
+    if (frame->queue_us < 0 || frame->decode_us < 0)
+        r->badStageTimes++;
+}
+
+static void sStreamCb(void *userdata, const AnsyncDecoderStreamInfo *info) {
+    ((Received *)userdata)->streams.push_back(*info);
+}
+
+static void sKeyframeCb(void *userdata, int reason) {
+    ((Received *)userdata)->keyframeReasons.push_back(reason);
+}
+
+static void sRgbaCb(void *userdata, void *data, int dataLen, int w, int h, u32 timestamp, int /*mediaType*/) {
+    Received *r = (Received *)userdata;
+    r->timestamps.push_back(timestamp);
+    r->width = w;
+    r->height = h;
+    r->rgbaLen = dataLen;
+    memcpy(r->rgbaFirst, data, 4);
+}
+
+static void sNoRelease(void * /*opaque*/, uint8_t * /*data*/) {
+}
+
+static void sPush(AnsyncDecoder *ad, const uint8_t *unit, int len, uint32_t timestamp) {
+    // refused until the decode thread runs
+    for (int i = 0; i < 1000; i++) {
+        if (AnsyncDecoder_ReceiveBuffer(ad, (void *)unit, len, timestamp, timestamp * 10LL, 1,
+                                        sNoRelease, NULL) == 0)
+            return;
+        usleep(1000);
+    }
+    EXPECT(!"unit not accepted");
+}
+
+static void sWaitFrames(Received *r, size_t count) {
+    for (int i = 0; i < 200 && r->timestamps.size() < count; i++)
+        usleep(5000);
+    // anything that should not have come out gets the chance to
+    usleep(20000);
+}
+
+static AnsyncDecoderConfig sConfig(int backend, int fallback) {
+    AnsyncDecoderConfig config;
+    AnsyncDecoder_GetProfileConfig(ANSYNC_DECODER_PROFILE_DEFAULT, &config);
+    config.backend = backend;
+    config.fallback = fallback;
+    return config;
+}
+
+static void testNullBackend() {
+    Received r = Received();
+    AnsyncDecoderConfig config = sConfig(ANSYNC_DECODER_BACKEND_NULL, ANSYNC_DECODER_BACKEND_NONE);
+    AnsyncDecoder *ad = AnsyncDecoder_CreateEx(NULL, 0, NULL, 0, &r, NULL, &config);
+    EXPECT(ad != NULL);
+    if (!ad)
+        return;
+    AnsyncDecoder_SetFrameCallback(ad, sFrameCb);
+
+    AnsyncDecoderConfig active;
+    AnsyncDecoder_GetActiveConfig(ad, &active);
+    EXPECT(active.backend == ANSYNC_DECODER_BACKEND_NULL);
+
+    sPush(ad, sIdr, 24, 3000);
+    sPush(ad, sSei, 8, 6000);
+    sPush(ad, sP, 8, 9000);
+    sWaitFrames(&r, 2);
+    AnsyncDecoderQueueStats stats;
+    AnsyncDecoder_GetQueueStats(ad, &stats);
+    EXPECT(stats.received == 3 && stats.decoded == 3);
+    AnsyncDecoder_Destroy(ad);
+
+    EXPECT(r.timestamps.size() == 2);
+    if (r.timestamps.size() == 2) {
+        EXPECT(r.timestamps[0] == 3000 && r.timestamps[1] == 9000);
+        EXPECT(r.recvTimes[0] == 30000 && r.recvTimes[1] == 90000);
+    }
+    EXPECT(r.width == 1080 && r.height == 1920);
+    EXPECT(r.badStageTimes == 0);
+}
+
+static void testNullBackendRgba() {
+    Received r = Received();
+    AnsyncDecoderConfig config = sConfig(ANSYNC_DECODER_BACKEND_NULL, ANSYNC_DECODER_BACKEND_NONE);
+    AnsyncDecoder *ad = AnsyncDecoder_CreateEx(NULL, 0, NULL, 0, &r, sRgbaCb, &config);
+    EXPECT(ad != NULL);
+    if (!ad)
+        return;
+
+    sPush(ad, sIdr, 24, 3000);
+    sWaitFrames(&r, 1);
+    AnsyncDecoder_Destroy(ad);
+
+    EXPECT(r.timestamps.size() == 1);
+    EXPECT(r.rgbaLen == 1080 * 1920 * 4);
+    // video range black
+    EXPECT(r.rgbaFirst[0] == 0 && r.rgbaFirst[1] == 0 && r.rgbaFirst[2] == 0 && r.rgbaFirst[3] == 255);
+}
+
+static void testUnavailableBackend() {
+    Received r = Received();
+    // libavcodec is compiled out and MediaCodec is Android only
+    AnsyncDecoderConfig config = sConfig(ANSYNC_DECODER_BACKEND_SW, ANSYNC_DECODER_BACKEND_NONE);
+    EXPECT(AnsyncDecoder_CreateEx(NULL, 0, NULL, 0, &r, NULL, &config) == NULL);
+
+    config = sConfig(ANSYNC_DECODER_BACKEND_MEDIACODEC, ANSYNC_DECODER_BACKEND_NULL);
+    AnsyncDecoder *ad = AnsyncDecoder_CreateEx(NULL, 0, NULL, 0, &r, NULL, &config);
+    EXPECT(ad != NULL);
+    AnsyncDecoderConfig active;
+    AnsyncDecoder_GetActiveConfig(ad, &active);
+    EXPECT(active.backend == ANSYNC_DECODER_BACKEND_NULL);
+    EXPECT(AnsyncDecoder_GetFallbackCount(ad) == 0);
+    AnsyncDecoder_Destroy(ad);
+}
+
+// stands in for MediaCodec: a frame per unit until the third one, then breaks down
+static int sFlakyDecodes;
+static int sFlakyCloses;
+
+static int sFlakyOpen(DecoderBackend *b) {
+    b->active = b->config;
+    return 0;
+}
+
+static void sDeliverPixel(DecoderBackend *b, u32 timestamp, long long recv_time_us) {
+    static uint8_t pixel[4] = { 16, 16, 128, 128 };
+    AnsyncDecoderFrame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.planes.y = pixel;
+    frame.planes.cb = pixel + 2;
+    frame.planes.cr = pixel + 3;
+    frame.planes.y_stride = 2;
+    frame.planes.c_stride = 1;
+    frame.planes.c_step = 1;
+    frame.width = 2;
+    frame.height = 1;
+    frame.timestamp = timestamp;
+    frame.recv_time_us = recv_time_us;
+    b->on_frame(b->userdata, &frame);
+}
+
+static int sFlakyDecode(DecoderBackend *b, const u8 * /*data*/, int /*len*/, u32 timestamp, long long recv_time_us) {
+    if (++sFlakyDecodes == 3)
+        return -1;
+    sDeliverPixel(b, timestamp, recv_time_us);
+    return 0;
+}
+
+static void sFlakyClose(DecoderBackend * /*b*/) {
+    sFlakyCloses++;
+}
+
+static const DecoderBackendOps sFlakyOps = { "flaky", sFlakyOpen, sFlakyDecode, sFlakyClose, NULL };
+
+static void testFallbackMidStream() {
+    Received r = Received();
+    DecoderBackend_Override(ANSYNC_DECODER_BACKEND_MEDIACODEC, &sFlakyOps);
+    AnsyncDecoderConfig config = sConfig(ANSYNC_DECODER_BACKEND_MEDIACODEC, ANSYNC_DECODER_BACKEND_NULL);
+    AnsyncDecoder *ad = AnsyncDecoder_CreateEx(NULL, 0, NULL, 0, &r, NULL, &config);
+    EXPECT(ad != NULL);
+    if (!ad) {
+        DecoderBackend_Override(ANSYNC_DECODER_BACKEND_MEDIACODEC, NULL);
+        return;
+    }
+    AnsyncDecoder_SetFrameCallback(ad, sFrameCb);
+
+    sPush(ad, sIdr, 24, 1);
+    sPush(ad, sP, 8, 2);
+    sPush(ad, sP, 8, 3);        // the flaky backend gives up here
+    sPush(ad, sP, 8, 4);        // the null backend waits for an IDR
+    sPush(ad, sIdr, 24, 5);
+    sPush(ad, sP, 8, 6);
+    sWaitFrames(&r, 4);
+
+    AnsyncDecoderConfig active;
+    AnsyncDecoder_GetActiveConfig(ad, &active);
+    EXPECT(active.backend == ANSYNC_DECODER_BACKEND_NULL);
+    EXPECT(AnsyncDecoder_GetFallbackCount(ad) == 1);
+    AnsyncDecoder_Destroy(ad);
+    DecoderBackend_Override(ANSYNC_DECODER_BACKEND_MEDIACODEC, NULL);
+
+    EXPECT(sFlakyDecodes == 3);
+    EXPECT(sFlakyCloses == 1);
+    static const uint32_t expected[] = { 1, 2, 5, 6 };
+    EXPECT(r.timestamps.size() == 4);
+    for (size_t i = 0; i < r.timestamps.size() && i < 4; i++)
+        EXPECT(r.timestamps[i] == expected[i]);
+    EXPECT(r.width == 1080 && r.height == 1920);
+}
+
+// stands in for libavcodec on a damaged stream: the timestamp says what goes wrong
+#define ERRATIC_UNDECODABLE 0x100
+#define ERRATIC_CONCEALED   0x200
+static int sErraticDecodes;
+
+static int sErraticDecode(DecoderBackend *b, const u8 * /*data*/, int /*len*/, u32 timestamp, long long recv_time_us) {
+    sErraticDecodes++;
+    if (timestamp & ERRATIC_UNDECODABLE)
+        return 1;
+    if (timestamp & ERRATIC_CONCEALED)
+        b->on_corrupt(b->userdata);
+    sDeliverPixel(b, timestamp, recv_time_us);
+    return 0;
+}
+
+static const DecoderBackendOps sErraticOps = { "erratic", sFlakyOpen, sErraticDecode, sFlakyClose, NULL };
+
+static void testKeyframeRequests() {
+    Received r = Received();
+    DecoderBackend_Override(ANSYNC_DECODER_BACKEND_MEDIACODEC, &sErraticOps);
+    AnsyncDecoderConfig config = sConfig(ANSYNC_DECODER_BACKEND_MEDIACODEC, ANSYNC_DECODER_BACKEND_NONE);
+    AnsyncDecoder *ad = AnsyncDecoder_CreateEx(NULL, 0, NULL, 0, &r, NULL, &config);
+    EXPECT(ad != NULL);
+    if (!ad) {
+        DecoderBackend_Override(ANSYNC_DECODER_BACKEND_MEDIACODEC, NULL);
+        return;
+    }
+    AnsyncDecoder_SetFrameCallback(ad, sFrameCb);
+    AnsyncDecoder_SetKeyframeCallback(ad, sKeyframeCb);
+
+    sPush(ad, sIdr, 24, 1);
+    sPush(ad, sP, 8, 2 | ERRATIC_UNDECODABLE);     // request, then wait for an IDR
+    sPush(ad, sP, 8, 3);                           // not decoded
+    sPush(ad, sAudIdr, 38, 4);                     // ends the wait, though not the first NAL
+    sPush(ad, sP, 8, 5 | ERRATIC_CONCEALED);       // request, decoding goes on
+    sPush(ad, sP, 8, 6 | ERRATIC_CONCEALED);       // already asked
+    sPush(ad, sP, 8, 7 | ERRATIC_UNDECODABLE);     // already asked
+    sPush(ad, sIdr, 24, 8);
+    sPush(ad, sP, 8, 9 | ERRATIC_UNDECODABLE);     // a new stretch
+    sWaitFrames(&r, 5);
+
+    EXPECT(AnsyncDecoder_GetKeyframeRequestCount(ad) == 3);
+    AnsyncDecoder_Destroy(ad);
+    DecoderBackend_Override(ANSYNC_DECODER_BACKEND_MEDIACODEC, NULL);
+
+    EXPECT(sErraticDecodes == 8);
+    static const int reasons[] = {
+        ANSYNC_DECODER_KEYFRAME_DECODE_ERROR, ANSYNC_DECODER_KEYFRAME_CORRUPT, ANSYNC_DECODER_KEYFRAME_DECODE_ERROR
+    };
+    EXPECT(r.keyframeReasons.size() == 3);
+    for (size_t i = 0; i < r.keyframeReasons.size() && i < 3; i++)
+        EXPECT(r.keyframeReasons[i] == reasons[i]);
+    EXPECT(r.timestamps.size() == 5);
+}
+
+static void testStreamGeometry() {
+    Received r = Received();
+    AnsyncDecoderConfig config = sConfig(ANSYNC_DECODER_BACKEND_NULL, ANSYNC_DECODER_BACKEND_NONE);
+    // the SPS given up front sets the size the backend opens with
+    std::vector<uint8_t> first = sMakeSps(640, 360, 0, false);
+    AnsyncDecoder *ad = AnsyncDecoder_CreateEx(first.data() + 4, (int)first.size() - 4, NULL, 0, &r, NULL, &config);
+    EXPECT(ad != NULL);
+    if (!ad)
+        return;
+    AnsyncDecoder_SetFrameCallback(ad, sFrameCb);
+    AnsyncDecoder_SetStreamCallback(ad, sStreamCb);
+    EXPECT(AnsyncDecoder_GetWidth(ad) == 640 && AnsyncDecoder_GetHeight(ad) == 360);
+
+    AnsyncDecoderStreamInfo info;
+    AnsyncDecoder_GetStreamInfo(ad, &info);
+    EXPECT(info.coded_width == 640 && info.coded_height == 368);
+    EXPECT(info.fps_num == 0 && info.reorder_frames == -1 && info.size_changes == 0);
+
+    std::vector<uint8_t> small = sMakeIdr(640, 360, 0, false);
+    std::vector<uint8_t> big = sMakeIdr(1920, 1080, 30, true);
+    small.resize(small.size() + 64);
+    big.resize(big.size() + 64);
+    sPush(ad, small.data(), (int)small.size() - 64, 1);    // same SPS: no callback
+    sPush(ad, sP, 8, 2);
+    sPush(ad, big.data(), (int)big.size() - 64, 3);
+    sPush(ad, sP, 8, 4);
+    sPush(ad, big.data(), (int)big.size() - 64, 5);        // repeated: no callback
+    sPush(ad, small.data(), (int)small.size() - 64, 6);
+    sWaitFrames(&r, 6);
+
+    AnsyncDecoder_GetStreamInfo(ad, &info);
+    EXPECT(AnsyncDecoder_GetFallbackCount(ad) == 0);
+    AnsyncDecoder_Destroy(ad);
+
+    static const int widths[] = { 640, 640, 1920, 1920, 1920, 640 };
+    EXPECT(r.frameWidths.size() == 6);
+    for (size_t i = 0; i < r.frameWidths.size() && i < 6; i++)
+        EXPECT(r.frameWidths[i] == widths[i]);
+
+    EXPECT(r.streams.size() == 2);
+    if (r.streams.size() == 2) {
+        const AnsyncDecoderStreamInfo &hd = r.streams[0];
+        EXPECT(hd.width == 1920 && hd.height == 1080);
+        EXPECT(hd.coded_width == 1920 && hd.coded_height == 1088);
+        EXPECT(hd.full_range == 1);
+        EXPECT(hd.fps_num == 60 && hd.fps_den == 2);
+        EXPECT(hd.reorder_frames == 0);
+        EXPECT(hd.size_changes == 1);
+        EXPECT(r.streams[1].width == 640 && r.streams[1].height == 360);
+        EXPECT(r.streams[1].size_changes == 2);
+    }
+    EXPECT(info.width == 640 && info.size_changes == 2);
+}
+
+int main() {
+    testNullBackend();
+    testNullBackendRgba();
+    testUnavailableBackend();
+    testFallbackMidStream();
+    testKeyframeRequests();
+    testStreamGeometry();
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("decoderbackendtest passed\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Reassembly throughput of H264Depacketizer against the copy-twice path it
+// replaced in VirtualCameraService (payloads gathered into an 8 MB staging
+// buffer, then copied again into the decoder queue).
+//
+//   h264depacketizerbench [-i iterations] [-r] [capture.pcap [udp-port]]
+//
+// Without a capture, 10 seconds of a 1080p-like stream (30 fps, IDR every
+// 60 frames) is synthesized in the legacy format, or in RFC 6184 format with -r.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "H264Depacketizer.h"
+#include "rtpteststream.h"
+
+static long long sNowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t sBytesOut = 0;
+
+static int sOnUnit(void * /*userdata*/, H264AccessUnit *unit) {
+    sBytesOut += unit->len;
+    H264Depacketizer::ReleaseUnit(unit->opaque, unit->data);
+    return 0;
+}
+
+// The receive loop as it was: FU-A payloads gathered into a staging buffer
+// and every NAL copied once more into the decoder's queue node.
+struct CopyTwice {
+    uint8_t *staging;
+    size_t stagingLen;
+    uint8_t *node;
+    size_t nodeCapacity;
+
+    CopyTwice() : stagingLen(0), node(NULL), nodeCapacity(0) {
+        staging = (uint8_t *)malloc(1080 * 1920 * 4);
+    }
+    ~CopyTwice() {
+        free(staging);
+        free(node);
+    }
+
+    void Submit() {
+        if (nodeCapacity < stagingLen + 256) {
+            free(node);
+            nodeCapacity = stagingLen + 256;
+            node = (uint8_t *)malloc(nodeCapacity);
+        }
+        memcpy(node, staging, stagingLen);
+        sBytesOut += stagingLen;
+        stagingLen = 0;
+    }
+
+    void Process(const jrtplib::RTPPacket *packet) {
+        const uint8_t *payload = packet->GetPayloadData();
+        size_t len = packet->GetPayloadLength();
+        if ((payload[0] & 0x1f) == 28) {
+            uint8_t flag = payload[1] & 0xc0;
+            if (flag == 0x80)
+                stagingLen = 0;
+            memcpy(staging + stagingLen, payload + 2, len - 2);
+            stagingLen += len - 2;
+            if (flag == 0x40)
+                Submit();
+        } else {
+            memcpy(staging, payload, len);
+            stagingLen = len;
+            Submit();
+        }
+    }
+};
+
+int main(int argc, char *argv[]) {
+    int iterations = 20;
+    bool rfc = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:r")) != -1) {
+        switch (opt) {
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        case 'r':
+            rfc = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i iterations] [-r] [capture.pcap [udp-port]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<TestRtpPacket> raw;
+    if (optind < argc) {
+        uint16_t port = optind + 1 < argc ? (uint16_t)atoi(argv[optind + 1]) : 0;
+        if (sReadPcap(argv[optind], port, raw) <= 0) {
+            fprintf(stderr, "no RTP packets in %s\n", argv[optind]);
+            return 1;
+        }
+    } else {
+        std::vector<TestFrame> frames = sMakeStream(300, 60, 180000, 20000, 1);
+        TestPacketizer packetizer;
+        for (size_t i = 0; i < frames.size(); i++) {
+            if (rfc)
+                packetizer.AddRfc(frames[i], 1400, raw);
+            else
+                packetizer.AddLegacy(frames[i].data, 1200, raw);
+        }
+    }
+
+    std::vector<jrtplib::RTPPacket *> packets;
+    size_t bytesIn = 0;
+    for (size_t i = 0; i < raw.size(); i++) {
+        jrtplib::RTPPacket *p = sParseRtp(raw[i].bytes.data(), raw[i].bytes.size(), raw[i].recvTimeUs);
+        if (p) {
+            packets.push_back(p);
+            bytesIn += p->GetPayloadLength();
+        }
+    }
+    printf("%zu packets, %.1f MB of payload, %d iterations\n",
+            packets.size(), bytesIn / 1048576.0, iterations);
+
+    size_t total = packets.size() * (size_t)iterations;
+
+    sBytesOut = 0;
+    long long start = sNowNs();
+    {
+        CopyTwice legacy;
+        for (int it = 0; it < iterations; it++) {
+            for (size_t i = 0; i < packets.size(); i++)
+                legacy.Process(packets[i]);
+        }
+    }
+    long long legacyNs = sNowNs() - start;
+    size_t legacyBytes = sBytesOut;
+
+    sBytesOut = 0;
+    H264Depacketizer depacketizer(sOnUnit, NULL);
+    start = sNowNs();
+    for (int it = 0; it < iterations; it++) {
+        depacketizer.Reset();
+        for (size_t i = 0; i < packets.size(); i++)
+            depacketizer.ProcessPacket(packets[i]);
+    }
+    long long depackNs = sNowNs() - start;
+
+    printf("%-14s %10.1f ns/packet %12.0f packets/s %9.1f MB/s out\n", "copy twice",
+            (double)legacyNs / total, total * 1e9 / legacyNs, legacyBytes / 1048576.0 * 1e9 / legacyNs);
+    printf("%-14s %10.1f ns/packet %12.0f packets/s %9.1f MB/s out\n", "depacketizer",
+            (double)depackNs / total, total * 1e9 / depackNs, sBytesOut / 1048576.0 * 1e9 / depackNs);
+
+    const H264Depacketizer::Stats &s = depacketizer.GetStats();
+    printf("units %llu, keyframes %llu, lost %llu, dropped %llu, skipped %llu\n",
+            (unsigned long long)s.units, (unsigned long long)s.keyframes,
+            (unsigned long long)s.lostPackets, (unsigned long long)s.droppedUnits,
+            (unsigned long long)s.skippedUnits);
+
+    for (size_t i = 0; i < packets.size(); i++)
+        delete packets[i];
+    return 0;
+}
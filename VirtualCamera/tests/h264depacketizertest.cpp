@@ -0,0 +1,480 @@
+// Host unit test for H264Depacketizer. Feeds synthetic legacy and RFC 6184
+// streams, with loss, reordering, duplicates and wrap-around injected, and
+// checks the reassembled access units byte for byte.
+//
+//   h264depacketizertest [capture.pcap [udp-port]]
+//
+// With a capture, it is replayed as well and the unit statistics are printed.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "H264Depacketizer.h"
+#include "rtpteststream.h"
+#include "testharness.h"
+
+#define LEGACY_SLICE_MAX    1200    // RTPSession: maxpacksize(1400) - 200
+#define RFC_MTU             1400
+
+struct Collector {
+    std::vector<ByteVector> units;
+    std::vector<bool> keyframes;
+    std::vector<uint32_t> timestamps;
+    std::vector<void *> held;       // units not yet released
+    bool hold;
+    int refuseNext;                 // returned for the next unit instead of keeping it
+
+    Collector() : hold(false), refuseNext(0) {}
+
+    void ReleaseAll() {
+        for (size_t i = 0; i < held.size(); i++)
+            H264Depacketizer::ReleaseUnit(held[i], NULL);
+        held.clear();
+    }
+};
+
+static int sOnUnit(void *userdata, H264AccessUnit *unit) {
+    Collector *c = (Collector *)userdata;
+    if (c->refuseNext < 0) {
+        int ret = c->refuseNext;
+        c->refuseNext = 0;
+        return ret;
+    }
+    for (int i = 0; i < H264_UNIT_PADDING; i++) {
+        if (unit->data[unit->len + i] != 0) {
+            fprintf(stderr, "unit padding not zeroed\n");
+            sFailures++;
+            break;
+        }
+    }
+    c->units.push_back(ByteVector(unit->data, unit->data + unit->len));
+    c->keyframes.push_back(unit->keyframe);
+    c->timestamps.push_back(unit->timestamp);
+    if (c->hold)
+        c->held.push_back(unit->opaque);
+    else
+        H264Depacketizer::ReleaseUnit(unit->opaque, unit->data);
+    return 0;
+}
+
+static void sFeed(H264Depacketizer &d, const std::vector<TestRtpPacket> &packets) {
+    for (size_t i = 0; i < packets.size(); i++) {
+        jrtplib::RTPPacket *p = sParseRtp(packets[i].bytes.data(), packets[i].bytes.size(),
+                packets[i].recvTimeUs);
+        EXPECT(p != NULL);
+        if (p == NULL)
+            continue;
+        d.ProcessPacket(p);
+        delete p;
+    }
+}
+
+static std::vector<TestRtpPacket> sLegacyPackets(const std::vector<TestFrame> &frames,
+        std::vector<size_t> *frameEnds = NULL, uint16_t seq = 1000) {
+    TestPacketizer packetizer;
+    packetizer.SetSequenceNumber(seq);
+    std::vector<TestRtpPacket> packets;
+    for (size_t i = 0; i < frames.size(); i++) {
+        packetizer.AddLegacy(frames[i].data, LEGACY_SLICE_MAX, packets);
+        if (frameEnds)
+            frameEnds->push_back(packets.size());
+    }
+    return packets;
+}
+
+// index of the parameter set buffer that starts the next GOP after frame i
+static size_t sNextGop(const std::vector<TestFrame> &frames, size_t i) {
+    for (size_t j = i + 1; j < frames.size(); j++) {
+        if (frames[j].nalOffsets.size() > 1)
+            return j;
+    }
+    return frames.size();
+}
+
+static void testLegacyStream() {
+    std::vector<TestFrame> frames = sMakeStream(30, 10, 60000, 4000, 1);
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames);
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, packets);
+
+    EXPECT(c.units.size() == frames.size());
+    for (size_t i = 0; i < frames.size() && i < c.units.size(); i++) {
+        EXPECT(c.units[i] == frames[i].data);
+        EXPECT(c.keyframes[i] == frames[i].keyframe);
+    }
+    EXPECT(d.GetStats().lostPackets == 0);
+    EXPECT(d.GetStats().droppedUnits == 0);
+    EXPECT(d.GetStats().keyframes == 3);
+    EXPECT(d.GetFreeSlots() == d.GetPoolSize());
+}
+
+static void testRfcStream() {
+    std::vector<TestFrame> frames = sMakeStream(20, 10, 60000, 800, 2);
+    TestPacketizer packetizer;
+    std::vector<TestRtpPacket> packets;
+    for (size_t i = 0; i < frames.size(); i++)
+        packetizer.AddRfc(frames[i], RFC_MTU, packets);
+
+    // SPS+PPS travel in a STAP-A ahead of the IDR and share its timestamp
+    std::vector<ByteVector> expected;
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (frames[i].nalOffsets.size() > 1) {
+            ByteVector au = frames[i].data;
+            au.insert(au.end(), frames[i + 1].data.begin(), frames[i + 1].data.end());
+            expected.push_back(au);
+            i++;
+        } else {
+            expected.push_back(frames[i].data);
+        }
+    }
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, packets);
+
+    EXPECT(c.units.size() == expected.size());
+    for (size_t i = 0; i < expected.size() && i < c.units.size(); i++)
+        EXPECT(c.units[i] == expected[i]);
+    EXPECT(d.GetStats().stapPackets == 2);
+    EXPECT(d.GetStats().keyframes == 2);
+    for (size_t i = 1; i < c.timestamps.size(); i++)
+        EXPECT(c.timestamps[i] == c.timestamps[i - 1] + 3000);
+}
+
+// The JNI sender with presentation times: SPS+PPS go unmarked with the IDR's
+// timestamp, so they come out in one unit with it, stamped at 90 kHz.
+static void testTimedLegacyStream() {
+    std::vector<TestFrame> frames = sMakeStream(30, 10, 60000, 4000, 11);
+    TestPacketizer packetizer;
+    std::vector<TestRtpPacket> packets;
+    std::vector<ByteVector> expected;
+    std::vector<uint32_t> timestamps;
+    long long ptsUs = 5000000;
+    for (size_t i = 0; i < frames.size(); i++) {
+        uint32_t timestamp = (uint32_t)(ptsUs * 9 / 100);
+        bool parameterSets = frames[i].nalOffsets.size() > 1;
+        packetizer.AddTimed(frames[i].data, LEGACY_SLICE_MAX, timestamp, !parameterSets, packets);
+        if (parameterSets) {
+            expected.push_back(frames[i].data);
+            continue;
+        }
+        if (i > 0 && frames[i - 1].nalOffsets.size() > 1)
+            expected.back().insert(expected.back().end(), frames[i].data.begin(), frames[i].data.end());
+        else
+            expected.push_back(frames[i].data);
+        timestamps.push_back(timestamp);
+        ptsUs += 33333;
+    }
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, packets);
+
+    EXPECT(c.units.size() == expected.size());
+    for (size_t i = 0; i < expected.size() && i < c.units.size(); i++) {
+        EXPECT(c.units[i] == expected[i]);
+        EXPECT(c.timestamps[i] == timestamps[i]);
+    }
+    EXPECT(d.GetStats().keyframes == 3);
+    EXPECT(d.GetStats().droppedUnits == 0);
+}
+
+static void testLossDropsToNextIdr() {
+    std::vector<TestFrame> frames = sMakeStream(20, 10, 60000, 4000, 3);
+    std::vector<size_t> ends;
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames, &ends);
+
+    // frames: 0 SPS/PPS, 1 IDR, 2.. P; lose a middle fragment of frame 4
+    size_t victim = ends[3] + 1;
+    EXPECT(ends[4] - ends[3] > 2);
+    packets.erase(packets.begin() + victim);
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, packets);
+
+    // 0..3 delivered, 4 dropped, the rest of the GOP skipped, then the
+    // parameter sets and the IDR resync
+    size_t next = sNextGop(frames, 4);
+    EXPECT(c.units.size() == 4 + (frames.size() - next));
+    for (size_t i = 0; i < 4 && i < c.units.size(); i++)
+        EXPECT(c.units[i] == frames[i].data);
+    for (size_t i = next; i < frames.size() && i - next + 4 < c.units.size(); i++)
+        EXPECT(c.units[i - next + 4] == frames[i].data);
+    EXPECT(d.GetStats().lostPackets == 1);
+    EXPECT(d.GetStats().droppedUnits == 1);
+    EXPECT(d.GetStats().skippedUnits == next - 5);
+    EXPECT(d.GetFreeSlots() == d.GetPoolSize());
+}
+
+static void testLastFragmentLost() {
+    std::vector<TestFrame> frames = sMakeStream(10, 5, 30000, 3000, 4);
+    std::vector<size_t> ends;
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames, &ends);
+
+    // the marker packet of frame 2 goes missing, frame 3 follows with a new timestamp
+    packets.erase(packets.begin() + ends[2] - 1);
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, packets);
+
+    // 0..1 delivered, 2 dropped, the rest of the GOP skipped
+    size_t next = sNextGop(frames, 2);
+    EXPECT(c.units.size() == 2 + (frames.size() - next));
+    EXPECT(d.GetStats().lostPackets == 1);
+    EXPECT(d.GetStats().skippedUnits == next - 3);
+}
+
+static void testReorderAndDuplicate() {
+    std::vector<TestFrame> frames = sMakeStream(12, 6, 20000, 3000, 5);
+    std::vector<size_t> ends;
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames, &ends);
+
+    // a duplicate is harmless
+    std::vector<TestRtpPacket> dup = packets;
+    dup.insert(dup.begin() + ends[2] + 1, dup[ends[2]]);
+    {
+        Collector c;
+        H264Depacketizer d(sOnUnit, &c);
+        sFeed(d, dup);
+        EXPECT(c.units.size() == frames.size());
+        EXPECT(d.GetStats().latePackets == 1);
+        EXPECT(d.GetStats().lostPackets == 0);
+    }
+
+    // a swapped pair shows up as a gap and a late packet, and costs the unit
+    std::vector<TestRtpPacket> swapped = packets;
+    std::swap(swapped[ends[3] + 1], swapped[ends[3] + 2]);
+    {
+        Collector c;
+        H264Depacketizer d(sOnUnit, &c);
+        sFeed(d, swapped);
+        EXPECT(d.GetStats().latePackets == 1);
+        EXPECT(d.GetStats().lostPackets == 1);
+        EXPECT(d.GetStats().droppedUnits == 1);
+        // 0..3 delivered, 4 dropped, the rest of the GOP skipped
+        EXPECT(c.units.size() == 4 + (frames.size() - sNextGop(frames, 4)));
+    }
+}
+
+static void testSequenceWrap() {
+    std::vector<TestFrame> frames = sMakeStream(10, 10, 40000, 3000, 6);
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames, NULL, 65500);
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, packets);
+
+    EXPECT(c.units.size() == frames.size());
+    EXPECT(d.GetStats().lostPackets == 0);
+    EXPECT(d.GetStats().latePackets == 0);
+}
+
+static void testStartsMidStream() {
+    std::vector<TestFrame> frames = sMakeStream(16, 8, 20000, 3000, 7);
+    std::vector<size_t> ends;
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames, &ends);
+
+    // join in the middle of frame 3
+    packets.erase(packets.begin(), packets.begin() + ends[2] + 1);
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, packets);
+
+    size_t next = sNextGop(frames, 3);
+    EXPECT(c.units.size() == frames.size() - next);
+    EXPECT(!c.units.empty() && c.units[0] == frames[next].data);
+    EXPECT(c.keyframes.size() > 1 && c.keyframes[1]);
+}
+
+static void testPoolExhaustion() {
+    std::vector<TestFrame> frames = sMakeStream(12, 6, 20000, 3000, 8);
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames);
+
+    Collector c;
+    c.hold = true;
+    H264Depacketizer d(sOnUnit, &c, 3, 4096);
+    sFeed(d, packets);
+
+    // three units held, nothing after them finds a slot
+    EXPECT(c.units.size() == 3);
+    EXPECT(d.GetStats().poolExhausted > 0);
+    EXPECT(d.GetFreeSlots() == 0);
+
+    // once the consumer catches up the stream recovers on the next IDR
+    c.ReleaseAll();
+    c.hold = false;
+    EXPECT(d.GetFreeSlots() == d.GetPoolSize());
+    std::vector<TestRtpPacket> more = sLegacyPackets(frames, NULL, 2000);
+    sFeed(d, more);
+    EXPECT(c.units.size() == 3 + frames.size());
+}
+
+static void testUnitSizeHint() {
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c, 4, 256 * 1024);
+
+    // a big stream grows the one slot in use to 1 MiB
+    std::vector<TestFrame> big = sMakeStream(6, 6, 600000, 3000, 10);
+    sFeed(d, sLegacyPackets(big));
+    EXPECT(c.units.size() == big.size());
+    EXPECT(d.GetPoolBytes() == 1024 * 1024);
+
+    // the stream shrinks: the oversized slot is given back and regrows to the hint
+    d.SetUnitSizeHint(64 * 1024);
+    std::vector<TestFrame> small = sMakeStream(6, 6, 20000, 3000, 11);
+    sFeed(d, sLegacyPackets(small, NULL, 2000));
+    EXPECT(c.units.size() == big.size() + small.size());
+    for (size_t i = 0; i < small.size() && big.size() + i < c.units.size(); i++)
+        EXPECT(c.units[big.size() + i] == small[i].data);
+    EXPECT(d.GetPoolBytes() == 64 * 1024);
+    EXPECT(d.GetFreeSlots() == d.GetPoolSize());
+}
+
+static void testConsumerRefusal() {
+    std::vector<TestFrame> frames = sMakeStream(12, 6, 20000, 3000, 9);
+    std::vector<size_t> ends;
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames, &ends);
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    std::vector<TestRtpPacket> head(packets.begin(), packets.begin() + ends[1]);
+    std::vector<TestRtpPacket> tail(packets.begin() + ends[1], packets.end());
+    sFeed(d, head);
+    c.refuseNext = -1;
+    sFeed(d, tail);
+
+    // frame 2 refused, the rest of the GOP skipped
+    EXPECT(c.units.size() == 2 + (frames.size() - sNextGop(frames, 2)));
+    EXPECT(d.GetStats().droppedUnits == 1);
+    EXPECT(d.GetFreeSlots() == d.GetPoolSize());
+}
+
+static void testConsumerDropsNonRef() {
+    std::vector<TestFrame> frames = sMakeStream(12, 6, 20000, 3000, 9);
+    std::vector<size_t> ends;
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames, &ends);
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    std::vector<TestRtpPacket> head(packets.begin(), packets.begin() + ends[1]);
+    std::vector<TestRtpPacket> tail(packets.begin() + ends[1], packets.end());
+    sFeed(d, head);
+    c.refuseNext = H264_UNIT_DROPPED_NON_REF;
+    sFeed(d, tail);
+
+    // only frame 2 is gone, the stream does not wait for an IDR
+    EXPECT(c.units.size() == frames.size() - 1);
+    for (size_t i = 3; i < frames.size() && i - 1 < c.units.size(); i++)
+        EXPECT(c.units[i - 1] == frames[i].data);
+    EXPECT(d.GetStats().nonRefDropped == 1);
+    EXPECT(d.GetStats().droppedUnits == 0);
+    EXPECT(d.GetStats().skippedUnits == 0);
+    EXPECT(d.GetFreeSlots() == d.GetPoolSize());
+}
+
+static void testMalformed() {
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    TestPacketizer packetizer;
+    std::vector<TestRtpPacket> packets;
+
+    // STAP-A whose NAL size runs past the payload, then an FU-B
+    TestFrame bad;
+    uint32_t seed = 10;
+    bad.data = sMakeNal(0x67, 8, &seed);
+    ByteVector pps = sMakeNal(0x68, 4, &seed);
+    bad.nalOffsets.push_back(0);
+    bad.nalOffsets.push_back(bad.data.size());
+    bad.data.insert(bad.data.end(), pps.begin(), pps.end());
+    bad.keyframe = false;
+    packetizer.AddRfc(bad, RFC_MTU, packets);
+    packets.back().bytes[12 + 2] = 0xff;
+
+    TestRtpPacket fub = packets.back();
+    fub.bytes[3]++;
+    fub.bytes[12] = 29;
+    packets.push_back(fub);
+
+    sFeed(d, packets);
+    EXPECT(c.units.empty());
+    EXPECT(d.GetStats().unsupportedPackets == 1);
+    EXPECT(d.GetFreeSlots() == d.GetPoolSize());
+}
+
+static void testPcapRoundTrip() {
+    std::vector<TestFrame> frames = sMakeStream(20, 10, 60000, 4000, 11);
+    std::vector<TestRtpPacket> packets = sLegacyPackets(frames);
+
+    char path[] = "/tmp/h264depacketizertest-XXXXXX";
+    int fd = mkstemp(path);
+    EXPECT(fd >= 0);
+    if (fd < 0)
+        return;
+    close(fd);
+
+    EXPECT(sWritePcap(path, 5004, packets) == 0);
+    std::vector<TestRtpPacket> read;
+    EXPECT(sReadPcap(path, 5004, read) == (int)packets.size());
+    std::vector<TestRtpPacket> other;
+    EXPECT(sReadPcap(path, 5006, other) == 0);
+    unlink(path);
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, read);
+    EXPECT(c.units.size() == frames.size());
+    for (size_t i = 0; i < frames.size() && i < c.units.size(); i++)
+        EXPECT(c.units[i] == frames[i].data);
+}
+
+static void replayCapture(const char *path, uint16_t port) {
+    std::vector<TestRtpPacket> packets;
+    int n = sReadPcap(path, port, packets);
+    if (n < 0) {
+        fprintf(stderr, "cannot read %s\n", path);
+        sFailures++;
+        return;
+    }
+
+    Collector c;
+    H264Depacketizer d(sOnUnit, &c);
+    sFeed(d, packets);
+    const H264Depacketizer::Stats &s = d.GetStats();
+    printf("%s: %d packets, %llu units (%llu keyframes), lost %llu, late %llu, dropped %llu, skipped %llu\n",
+            path, n, (unsigned long long)s.units, (unsigned long long)s.keyframes,
+            (unsigned long long)s.lostPackets, (unsigned long long)s.latePackets,
+            (unsigned long long)s.droppedUnits, (unsigned long long)s.skippedUnits);
+}
+
+int main(int argc, char *argv[]) {
+    testLegacyStream();
+    testRfcStream();
+    testTimedLegacyStream();
+    testLossDropsToNextIdr();
+    testLastFragmentLost();
+    testReorderAndDuplicate();
+    testSequenceWrap();
+    testStartsMidStream();
+    testPoolExhaustion();
+    testUnitSizeHint();
+    testConsumerRefusal();
+    testConsumerDropsNonRef();
+    testMalformed();
+    testPcapRoundTrip();
+
+    if (argc > 1)
+        replayCapture(argv[1], argc > 2 ? (uint16_t)atoi(argv[2]) : 0);
+
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("h264depacketizertest: all passed\n");
+    return 0;
+}
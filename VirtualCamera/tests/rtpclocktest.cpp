@@ -0,0 +1,282 @@
+// Host test for the capture timestamps: RtpCaptureClock mapping 90 kHz
+// timestamps onto the receive clock (jitter, wrap-around, a sender with a
+// fixed increment, jumps, clock drift), and a loopback run where a sender
+// stamps its units the way the JNI sender does and the receiver checks the
+// timestamps and markers on the wire.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "RtpCaptureClock.h"
+#include "rtpteststream.h"
+#include "testharness.h"
+
+#include "rtpsession.h"
+#include "rtpsessionparams.h"
+#include "rtpudpv4transmitter.h"
+#include "rtpipv4address.h"
+
+using namespace jrtplib;
+
+#define FRAME_US    33333
+
+// Frames captured every FRAME_US on the sender's clock, arriving 40 ms plus
+// up to jitterUs later; the sender's clock runs ppm fast against ours.
+struct Link {
+    uint32_t firstTimestamp;
+    long long jitterUs;
+    long long ppm;
+    uint32_t seed;
+
+    Link(uint32_t timestamp, long long jitter, long long drift = 0)
+        : firstTimestamp(timestamp), jitterUs(jitter), ppm(drift), seed(7) {}
+
+    long long CaptureUs(int frame) const { return 1000000LL + (long long)frame * FRAME_US; }
+    uint32_t Timestamp(int frame) const {
+        long long senderUs = (long long)frame * FRAME_US * (1000000 + ppm) / 1000000;
+        return firstTimestamp + (uint32_t)(senderUs * 9 / 100);
+    }
+    long long ArrivalUs(int frame) {
+        return CaptureUs(frame) + 40000 + (jitterUs > 0 ? sTestRand(&seed) % jitterUs : 0);
+    }
+};
+
+static void sRun(RtpCaptureClock &clock, Link &link, int frames, std::vector<long long> *mapped,
+        std::vector<long long> *arrivals) {
+    for (int i = 0; i < frames; i++) {
+        long long arrivalUs = link.ArrivalUs(i);
+        clock.OnFrame(link.Timestamp(i), arrivalUs);
+        if (mapped)
+            mapped->push_back(clock.ToLocalUs(link.Timestamp(i)));
+        if (arrivals)
+            arrivals->push_back(arrivalUs);
+    }
+}
+
+static void testMapsCaptureTimes() {
+    RtpCaptureClock clock;
+    Link link(123456, 30000);
+    std::vector<long long> mapped, arrivals;
+    EXPECT(clock.ToLocalUs(link.Timestamp(0)) == -1);
+    sRun(clock, link, 300, &mapped, &arrivals);
+
+    // nothing before the first second of timestamps has been checked
+    EXPECT(mapped[10] == -1);
+    int checked = 0;
+    for (size_t i = 60; i < mapped.size(); i++) {
+        EXPECT(mapped[i] >= 0);
+        // never later than the arrival, at most the jitter before it
+        EXPECT(mapped[i] <= arrivals[i]);
+        EXPECT(arrivals[i] - mapped[i] < 30000);
+        if (i > 200) {
+            // the window's quickest frame is close to the 40 ms floor by now
+            EXPECT(mapped[i] - link.CaptureUs((int)i) >= 40000 && mapped[i] - link.CaptureUs((int)i) < 41000);
+        }
+        checked++;
+    }
+    EXPECT(checked > 200);
+
+    // mapped afterwards, the frames keep their capture spacing, to a 90 kHz tick
+    long long previous = clock.ToLocalUs(link.Timestamp(250));
+    for (int i = 251; i < 300; i++) {
+        long long us = clock.ToLocalUs(link.Timestamp(i));
+        EXPECT(us - previous >= FRAME_US - 12 && us - previous <= FRAME_US + 12);
+        previous = us;
+    }
+    RtpCaptureClock::Stats stats = clock.GetStats();
+    EXPECT(stats.frames == 300);
+    EXPECT(stats.valid);
+    EXPECT(stats.restarts == 0);
+    printf("testMapsCaptureTimes passed\n");
+}
+
+static void testTimestampWrap() {
+    RtpCaptureClock clock;
+    Link link(0xffffffffu - 90000 * 3, 10000);
+    std::vector<long long> mapped;
+    sRun(clock, link, 300, &mapped, NULL);
+    for (size_t i = 61; i < mapped.size(); i++) {
+        EXPECT(mapped[i] > mapped[i - 1]);
+        EXPECT(mapped[i] - mapped[i - 1] <= FRAME_US + 10000);
+    }
+    EXPECT(clock.GetStats().restarts == 0);
+    printf("testTimestampWrap passed\n");
+}
+
+static void testFixedIncrement() {
+    // what the sender stamped before: 10 per unit
+    RtpCaptureClock clock;
+    uint32_t timestamp = 1000;
+    for (int i = 0; i < 300; i++) {
+        clock.OnFrame(timestamp, 1000000LL + (long long)i * FRAME_US);
+        EXPECT(clock.ToLocalUs(timestamp) == -1);
+        timestamp += 10;
+    }
+    EXPECT(!clock.GetStats().valid);
+    printf("testFixedIncrement passed\n");
+}
+
+static void testJumpRestarts() {
+    RtpCaptureClock clock;
+    Link link(5000, 5000);
+    sRun(clock, link, 100, NULL, NULL);
+    EXPECT(clock.GetStats().valid);
+
+    // the sender restarted with a new random timestamp base
+    Link restarted(0x80000000u, 5000);
+    uint32_t seed = 3;
+    for (int i = 0; i < 100; i++) {
+        long long arrivalUs = link.CaptureUs(100 + i) + 40000 + sTestRand(&seed) % 5000;
+        restarted.firstTimestamp = 0x80000000u;
+        clock.OnFrame(restarted.Timestamp(i), arrivalUs);
+        if (i < 25)
+            EXPECT(clock.ToLocalUs(restarted.Timestamp(i)) == -1);
+    }
+    RtpCaptureClock::Stats stats = clock.GetStats();
+    EXPECT(stats.restarts == 1);
+    EXPECT(stats.valid);
+    long long us = clock.ToLocalUs(restarted.Timestamp(99));
+    EXPECT(us - link.CaptureUs(199) >= 40000 && us - link.CaptureUs(199) < 45000);
+    printf("testJumpRestarts passed\n");
+}
+
+static void testDrift() {
+    // 200 ppm is far more than crystals drift apart; the window follows it
+    RtpCaptureClock clock;
+    Link link(42, 20000, 200);
+    std::vector<long long> mapped, arrivals;
+    sRun(clock, link, 30 * 120, &mapped, &arrivals);
+    for (size_t i = mapped.size() - 300; i < mapped.size(); i++) {
+        EXPECT(mapped[i] <= arrivals[i] + 2000);
+        EXPECT(arrivals[i] - mapped[i] < 22000);
+    }
+    EXPECT(clock.GetStats().valid);
+    printf("testDrift passed\n");
+}
+
+static bool sCreate(RTPSession &session, RTPUDPv4Transmitter &transmitter, const char *cname) {
+    RTPUDPv4TransmissionParams transparams;
+    transparams.SetPortbase(0);
+    RTPSessionParams sessionparams;
+    sessionparams.SetOwnTimestampUnit(1.0 / 90000.0);
+    sessionparams.SetUsePollThread(false);
+    sessionparams.SetCNAME(cname);      // no login name in containers
+    int status;
+    if ((status = transmitter.Init(false)) < 0
+            || (status = transmitter.Create(sessionparams.GetMaximumPacketSize(), &transparams)) < 0
+            || (status = session.Create(sessionparams, &transmitter)) < 0) {
+        fprintf(stderr, "cannot create the %s session: %s\n", cname, RTPGetErrorString(status).c_str());
+        return false;
+    }
+    return true;
+}
+
+static RTPIPv4Address sAddressOf(RTPUDPv4Transmitter &transmitter) {
+    uint8_t loopback[] = { 127, 0, 0, 1 };
+    RTPUDPv4TransmissionInfo *info = (RTPUDPv4TransmissionInfo *)transmitter.GetTransmissionInfo();
+    RTPIPv4Address addr(loopback, info->GetRTPPort(), info->GetRTCPPort());
+    transmitter.DeleteTransmissionInfo(info);
+    return addr;
+}
+
+struct WirePacket {
+    uint16_t seq;
+    uint32_t timestamp;
+    bool marker;
+};
+
+static void sReceive(RTPSession &receiver, std::vector<WirePacket> &wire) {
+    bool available = false;
+    receiver.WaitForIncomingData(RTPTime(0.005), &available);
+    receiver.Poll();
+    receiver.BeginDataAccess();
+    if (receiver.GotoFirstSource()) {
+        do {
+            RTPPacket *packet;
+            while ((packet = receiver.GetNextPacket()) != NULL) {
+                WirePacket w = { packet->GetSequenceNumber(), packet->GetTimestamp(), packet->HasMarker() };
+                wire.push_back(w);
+                receiver.DeletePacket(packet);
+            }
+        } while (receiver.GotoNextSource());
+    }
+    receiver.EndDataAccess();
+}
+
+static void testSenderLoopback() {
+    RTPUDPv4Transmitter sending(0);
+    RTPUDPv4Transmitter receiving(0);
+    RTPSession sender;
+    RTPSession receiver;
+    if (!sCreate(sender, sending, "sender") || !sCreate(receiver, receiving, "receiver")) {
+        sFailures++;
+        return;
+    }
+    sender.AddDestination(sAddressOf(receiving));
+
+    // as NotifyRTPSession::AdvanceTimestamp and sendMediaPacket do it
+    std::vector<TestFrame> frames = sMakeStream(12, 6, 6000, 2000, 5);
+    std::vector<WirePacket> wire;
+    std::vector<uint32_t> ticks;
+    long long firstPtsUs = 7000000, ptsUs = firstPtsUs;
+    uint32_t sentTicks = 0;
+    for (size_t i = 0; i < frames.size(); i++) {
+        bool parameterSets = frames[i].nalOffsets.size() > 1;
+        uint32_t t = (uint32_t)((ptsUs - firstPtsUs) * 90000 / 1000000LL);
+        sender.IncrementTimestamp(t - sentTicks);
+        sentTicks = t;
+        EXPECT(sender.SendPacketAfterSlice(frames[i].data.data(), frames[i].data.size(), 96, !parameterSets, 0) >= 0);
+        ticks.push_back(t);
+        // a burst of all of them could overrun the receive socket
+        sReceive(receiver, wire);
+        if (!parameterSets)
+            ptsUs += FRAME_US;
+    }
+
+    for (int i = 0; i < 20; i++)
+        sReceive(receiver, wire);
+
+    // a picture's packets, the SPS+PPS ahead of an IDR included, share its
+    // timestamp and only the last one is marked
+    std::vector<uint32_t> pictures;
+    for (size_t i = 0; i < ticks.size(); i++) {
+        if (pictures.empty() || pictures.back() != ticks[i])
+            pictures.push_back(ticks[i]);
+    }
+    EXPECT(pictures.size() == 12);
+    EXPECT(wire.size() > frames.size());
+    uint32_t base = wire.empty() ? 0 : wire[0].timestamp;
+    size_t picture = 0;
+    for (size_t i = 0; i < wire.size() && picture < pictures.size(); i++) {
+        EXPECT(wire[i].seq == (uint16_t)(wire[0].seq + i));
+        EXPECT(wire[i].timestamp - base == pictures[picture]);
+        bool last = i + 1 == wire.size() || wire[i + 1].timestamp != wire[i].timestamp;
+        EXPECT(wire[i].marker == last);
+        if (last)
+            picture++;
+    }
+    EXPECT(picture == pictures.size());
+    EXPECT(pictures.back() == (uint32_t)(11LL * FRAME_US * 9 / 100));
+
+    sender.Destroy();
+    receiver.Destroy();
+    sending.Destroy();
+    receiving.Destroy();
+    printf("testSenderLoopback passed\n");
+}
+
+int main() {
+    testMapsCaptureTimes();
+    testTimestampWrap();
+    testFixedIncrement();
+    testJumpRestarts();
+    testDrift();
+    testSenderLoopback();
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("rtpclocktest: all passed\n");
+    return 0;
+}
@@ -0,0 +1,374 @@
+// Host test for RtpJitterBuffer: frames going out as soon as they are
+// complete, deadlines and the two policies for incomplete frames, late and
+// duplicate packets, the adaptive target delay, and a stream with reordering,
+// jitter and loss fed through it into H264Depacketizer on a virtual clock.
+//
+//   rtpjittertest [-n frames] [-l loss percent] [-j jitter ms]
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "H264Depacketizer.h"
+#include "RtpJitterBuffer.h"
+#include "rtpteststream.h"
+#include "testharness.h"
+
+using namespace jrtplib;
+
+#define TEST_MTU    1200
+
+struct Sink {
+    std::vector<uint16_t> delivered;
+    int released;
+
+    Sink() : released(0) {}
+};
+
+static void sSinkDeliver(void *userdata, RTPPacket *packet) {
+    ((Sink *)userdata)->delivered.push_back(packet->GetSequenceNumber());
+    delete packet;
+}
+
+static void sSinkRelease(void *userdata, RTPPacket *packet) {
+    ((Sink *)userdata)->released++;
+    delete packet;
+}
+
+// frames of packetsPerFrame FU-A fragments each, the last one marked
+static std::vector<TestRtpPacket> sFrames(uint16_t seq, int frames, int packetsPerFrame,
+        uint32_t ssrc = 0x12345678) {
+    TestPacketizer packetizer(ssrc, seq);
+    std::vector<TestRtpPacket> packets;
+    uint32_t seed = 1;
+    for (int i = 0; i < frames; i++) {
+        TestFrame frame;
+        frame.data = sMakeNal(0x41, TEST_MTU * packetsPerFrame - TEST_MTU / 2, &seed);
+        frame.nalOffsets.push_back(0);
+        frame.keyframe = false;
+        packetizer.AddRfc(frame, TEST_MTU, packets);
+    }
+    return packets;
+}
+
+static void sPush(RtpJitterBuffer &buffer, const TestRtpPacket &p, long long nowUs) {
+    RTPPacket *packet = sParseRtp(p.bytes.data(), p.bytes.size(), nowUs);
+    EXPECT(packet != NULL);
+    if (packet != NULL)
+        buffer.Push(packet, nowUs);
+}
+
+static void testCompleteFramesGoAtOnce() {
+    Sink sink;
+    RtpJitterBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    std::vector<TestRtpPacket> packets = sFrames(65530, 5, 3);
+    EXPECT(packets.size() == 15);
+    for (size_t i = 0; i < packets.size(); i++) {
+        sPush(buffer, packets[i], 1000000 + i * 100);
+        // nothing of a frame before its marker, all of it right after
+        EXPECT(sink.delivered.size() == (i + 1) / 3 * 3);
+    }
+    for (size_t i = 0; i < sink.delivered.size(); i++)
+        EXPECT(sink.delivered[i] == (uint16_t)(65530 + i));
+    EXPECT(buffer.GetHeldPackets() == 0);
+    EXPECT(buffer.GetNextDeadlineUs() == -1);
+    EXPECT(buffer.GetStats().frames == 5);
+    EXPECT(buffer.GetStats().incomplete == 0);
+    printf("testCompleteFramesGoAtOnce passed\n");
+}
+
+static void testReorderWithinFrame() {
+    Sink sink;
+    RtpJitterBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    std::vector<TestRtpPacket> packets = sFrames(100, 3, 3);
+    long long t = 1000000;
+
+    sPush(buffer, packets[0], t);
+    sPush(buffer, packets[2], t);
+    EXPECT(sink.delivered.empty());
+    EXPECT(buffer.GetNextDeadlineUs() == t + buffer.GetTargetDelayUs());
+    // the second frame waits behind the first
+    sPush(buffer, packets[3], t);
+    sPush(buffer, packets[4], t);
+    sPush(buffer, packets[5], t);
+    EXPECT(sink.delivered.empty());
+    sPush(buffer, packets[1], t + 1000);
+    EXPECT(sink.delivered.size() == 6);
+    for (size_t i = 0; i < sink.delivered.size(); i++)
+        EXPECT(sink.delivered[i] == (uint16_t)(100 + i));
+    EXPECT(buffer.GetStats().reordered == 1);
+    EXPECT(buffer.GetStats().frames == 2);
+
+    // one of a frame that went, then a duplicate of a held packet
+    sPush(buffer, packets[5], t + 2000);
+    EXPECT(buffer.GetStats().late == 1);
+    sPush(buffer, packets[6], t + 3000);
+    sPush(buffer, packets[6], t + 3000);
+    EXPECT(buffer.GetStats().duplicates == 1);
+    EXPECT(sink.released == 2);
+    printf("testReorderWithinFrame passed\n");
+}
+
+static void sIncomplete(int policy) {
+    Sink sink;
+    RtpJitterBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    buffer.SetPolicy(policy);
+    std::vector<TestRtpPacket> packets = sFrames(200, 3, 3);
+    long long t = 1000000;
+    long long target = buffer.GetTargetDelayUs();
+
+    for (size_t i = 0; i < packets.size(); i++) {
+        if (i != 4)
+            sPush(buffer, packets[i], t);
+    }
+    EXPECT(sink.delivered.size() == 3);
+    EXPECT(buffer.GetNextDeadlineUs() == t + target);
+    buffer.Poll(t + target - 1);
+    EXPECT(sink.delivered.size() == 3);
+    buffer.Poll(t + target);
+    // the second frame is given up on, the third goes right behind it
+    const RtpJitterBuffer::Stats &stats = buffer.GetStats();
+    EXPECT(stats.incomplete == 1);
+    EXPECT(stats.lost == 1);
+    EXPECT(stats.frames == 2);
+    if (policy == RtpJitterBuffer::POLICY_DISCARD) {
+        EXPECT(sink.delivered.size() == 6);
+        EXPECT(sink.released == 2);
+        EXPECT(sink.delivered[3] == 206);
+    } else {
+        EXPECT(sink.delivered.size() == 8);
+        EXPECT(sink.released == 0);
+        EXPECT(sink.delivered[3] == 203 && sink.delivered[4] == 205 && sink.delivered[5] == 206);
+    }
+    EXPECT(buffer.GetHeldPackets() == 0);
+    EXPECT(buffer.GetNextDeadlineUs() == -1);
+
+    // the retransmission comes too late, and teaches the buffer how long it takes
+    sPush(buffer, packets[4], t + 60000);
+    EXPECT(stats.late == 1);
+    EXPECT(buffer.GetTargetDelayUs() >= 60000);
+}
+
+static void testIncompleteFrames() {
+    sIncomplete(RtpJitterBuffer::POLICY_DISCARD);
+    sIncomplete(RtpJitterBuffer::POLICY_FORWARD);
+    printf("testIncompleteFrames passed\n");
+}
+
+static void testTailLost() {
+    Sink sink;
+    RtpJitterBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    std::vector<TestRtpPacket> packets = sFrames(300, 2, 3);
+    long long t = 1000000;
+
+    // the marker packet is missing and the next frame is not there yet
+    sPush(buffer, packets[0], t);
+    sPush(buffer, packets[1], t);
+    buffer.Poll(t + buffer.GetTargetDelayUs());
+    EXPECT(buffer.GetStats().incomplete == 1);
+    EXPECT(sink.released == 2);
+    // its tail turns up late, then the next frame goes through without a gap
+    sPush(buffer, packets[2], t + 50000);
+    EXPECT(buffer.GetStats().late == 1);
+    for (size_t i = 3; i < packets.size(); i++)
+        sPush(buffer, packets[i], t + 60000);
+    EXPECT(sink.delivered.size() == 3);
+    EXPECT(buffer.GetStats().frames == 1);
+    EXPECT(buffer.GetStats().lost == 0);
+    printf("testTailLost passed\n");
+}
+
+static void testTargetAdapts() {
+    Sink sink;
+    RtpJitterBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    buffer.SetDelay(5000, 100000);
+    std::vector<TestRtpPacket> packets = sFrames(400, 400, 2);
+    long long t = 1000000;
+
+    // every frame's second packet is 30 ms behind the first for a while...
+    size_t i = 0;
+    for (; i < 40; i += 2, t += 33333) {
+        sPush(buffer, packets[i], t);
+        sPush(buffer, packets[i + 1], t + 30000);
+    }
+    EXPECT(buffer.GetTargetDelayUs() >= 30000 && buffer.GetTargetDelayUs() <= 40000);
+    // ...then the link is clean again: the delay holds for a while, then comes back down
+    long long before = buffer.GetTargetDelayUs();
+    for (; i < 80; i += 2, t += 33333) {
+        sPush(buffer, packets[i], t);
+        sPush(buffer, packets[i + 1], t + 200);
+    }
+    EXPECT(buffer.GetTargetDelayUs() == before);
+    for (; i < packets.size(); i += 2, t += 33333) {
+        sPush(buffer, packets[i], t);
+        sPush(buffer, packets[i + 1], t + 200);
+    }
+    EXPECT(buffer.GetTargetDelayUs() < 7000);
+    EXPECT(buffer.GetStats().frames == 400);
+    EXPECT(buffer.GetStats().incomplete == 0);
+
+    // never beyond the configured range
+    buffer.SetDelay(5000, 20000);
+    EXPECT(buffer.GetTargetDelayUs() <= 20000);
+    printf("testTargetAdapts passed\n");
+}
+
+struct Receiver {
+    H264Depacketizer *depacketizer;
+    long long units;
+    bool ordered;
+    bool haveSeq;
+    uint16_t lastSeq;
+};
+
+static int sCountUnit(void *userdata, H264AccessUnit *unit) {
+    ((Receiver *)userdata)->units++;
+    H264Depacketizer::ReleaseUnit(unit->opaque, unit->data);
+    return 0;
+}
+
+static void sReceiverDeliver(void *userdata, RTPPacket *packet) {
+    Receiver *r = (Receiver *)userdata;
+    uint16_t seq = packet->GetSequenceNumber();
+    if (r->haveSeq && (int16_t)(uint16_t)(seq - r->lastSeq) <= 0)
+        r->ordered = false;
+    r->haveSeq = true;
+    r->lastSeq = seq;
+    r->depacketizer->ProcessPacket(packet);
+    delete packet;
+}
+
+static void sReceiverRelease(void * /*userdata*/, RTPPacket *packet) {
+    delete packet;
+}
+
+struct Arrival {
+    long long us;
+    size_t index;
+
+    bool operator<(const Arrival &other) const {
+        return us < other.us || (us == other.us && index < other.index);
+    }
+};
+
+// Every packet takes 20 ms plus up to jitterMs, lossPercent of them never arrive.
+static void sRunStream(const std::vector<TestFrame> &frames, int lossPercent, int jitterMs,
+        RtpJitterBuffer::Stats *stats, Receiver *receiver) {
+    TestPacketizer packetizer(0x1234, 65000);
+    std::vector<TestRtpPacket> packets;
+    for (size_t i = 0; i < frames.size(); i++)
+        packetizer.AddRfc(frames[i], TEST_MTU, packets);
+    // the parameter sets go out together with their IDR
+    for (size_t i = packets.size() - 1; i > 0; i--) {
+        if (memcmp(&packets[i - 1].bytes[4], &packets[i].bytes[4], 4) == 0)
+            packets[i - 1].recvTimeUs = packets[i].recvTimeUs;
+    }
+
+    uint32_t seed = 7;
+    std::vector<Arrival> arrivals;
+    for (size_t i = 0; i < packets.size(); i++) {
+        if (sTestRand(&seed) % 100 < (uint32_t)lossPercent)
+            continue;
+        Arrival a;
+        a.us = packets[i].recvTimeUs + 20000 + (jitterMs > 0 ? sTestRand(&seed) % (jitterMs * 1000) : 0);
+        a.index = i;
+        arrivals.push_back(a);
+    }
+    std::sort(arrivals.begin(), arrivals.end());
+
+    H264Depacketizer depacketizer(sCountUnit, receiver);
+    receiver->depacketizer = &depacketizer;
+    receiver->units = 0;
+    receiver->ordered = true;
+    receiver->haveSeq = false;
+    RtpJitterBuffer buffer(sReceiverDeliver, sReceiverRelease, receiver);
+    size_t next = 0;
+    long long endUs = arrivals.empty() ? 0 : arrivals.back().us + 1000000;
+    for (long long t = arrivals.empty() ? 0 : arrivals[0].us; t <= endUs; t += 1000) {
+        while (next < arrivals.size() && arrivals[next].us <= t) {
+            const TestRtpPacket &p = packets[arrivals[next].index];
+            RTPPacket *packet = sParseRtp(p.bytes.data(), p.bytes.size(), arrivals[next].us);
+            if (packet != NULL)
+                buffer.Push(packet, t);
+            next++;
+        }
+        buffer.Poll(t);
+    }
+    *stats = buffer.GetStats();
+    EXPECT(buffer.GetHeldPackets() == 0);
+    EXPECT(depacketizer.GetStats().latePackets == 0);
+}
+
+static void testStream(int frames, int lossPercent, int jitterMs) {
+    std::vector<TestFrame> stream = sMakeStream(frames, 30, 20000, 3000, 11);
+    RtpJitterBuffer::Stats stats;
+    Receiver receiver;
+
+    // reordering only: every frame complete, every unit out, except for the
+    // first few while the target delay learns the jitter
+    sRunStream(stream, 0, jitterMs, &stats, &receiver);
+    printf("  %d ms jitter: %" PRIu64 " frames, %" PRIu64 " incomplete, %" PRIu64 " reordered, %lld units\n",
+           jitterMs, stats.frames, stats.incomplete, stats.reordered, receiver.units);
+    EXPECT(receiver.ordered);
+    // the parameter sets share their IDR's timestamp
+    EXPECT(stats.frames + stats.incomplete == (uint64_t)frames);
+    EXPECT(stats.incomplete <= 3);
+    if (stats.incomplete == 0)
+        EXPECT(receiver.units == frames);
+
+    // and loss: still in order, nothing late reaches the depacketizer
+    sRunStream(stream, lossPercent, jitterMs, &stats, &receiver);
+    printf("  %d%% loss: %" PRIu64 " frames, %" PRIu64 " incomplete, %" PRIu64 " lost, %" PRIu64
+           " late, %lld units\n", lossPercent, stats.frames, stats.incomplete, stats.lost, stats.late,
+           receiver.units);
+    EXPECT(receiver.ordered);
+    if (lossPercent > 0) {
+        EXPECT(stats.incomplete > 0);
+        EXPECT(stats.lost > 0);
+    }
+    EXPECT(receiver.units > 0);
+    printf("testStream passed\n");
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 300;
+    int loss = 3;
+    int jitterMs = 8;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:j:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'l':
+            loss = atoi(optarg);
+            break;
+        case 'j':
+            jitterMs = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-l loss percent] [-j jitter ms]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames <= 0 || loss < 0 || loss > 50 || jitterMs < 0 || jitterMs > 100) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    testCompleteFramesGoAtOnce();
+    testReorderWithinFrame();
+    testIncompleteFrames();
+    testTailLost();
+    testTargetAdapts();
+    testStream(frames, loss, jitterMs);
+
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("rtpjittertest: all passed\n");
+    return 0;
+}
@@ -0,0 +1,207 @@
+// Host test for the keyframe request feedback (RFC 4585 PLI, RFC 5104 FIR):
+// the packet encoding, the RtpKeyframeRequester pacing, and a loopback run
+// where a receiver RTPSession asks the sender for an IDR the way
+// VirtualCameraService does and the sender picks it up in
+// OnUnknownPacketType, as the JNI sender does.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "RtpKeyframeRequest.h"
+#include "RtpNack.h"
+#include "testharness.h"
+
+#include "rtpsession.h"
+#include "rtpsessionparams.h"
+#include "rtpudpv4transmitter.h"
+#include "rtpipv4address.h"
+#include "rtcppacket.h"
+
+using namespace jrtplib;
+
+// A whole RTCP feedback packet as SendUnknownPacket puts it on the wire.
+static std::vector<uint8_t> sFeedback(uint8_t pt, uint8_t fmt, const uint8_t *data, size_t len) {
+    std::vector<uint8_t> packet(8 + len);
+    size_t words = packet.size() / 4 - 1;
+    packet[0] = (uint8_t)(0x80 | fmt);
+    packet[1] = pt;
+    packet[2] = (uint8_t)(words >> 8);
+    packet[3] = (uint8_t)words;
+    packet[4] = 0xaa;       // sender SSRC
+    packet[5] = 0xbb;
+    packet[6] = 0xcc;
+    packet[7] = 0xdd;
+    memcpy(&packet[8], data, len);
+    return packet;
+}
+
+static void testPliRoundTrip() {
+    uint8_t data[12];
+    uint32_t ssrc = 0;
+    EXPECT(RtpKeyframeRequest_BuildPli(0x12345678, data, 3) == 0);
+    size_t len = RtpKeyframeRequest_BuildPli(0x12345678, data, sizeof(data));
+    EXPECT(len == 4);
+    std::vector<uint8_t> packet = sFeedback(RTCP_PSFB, RTCP_PSFB_FMT_PLI, data, len);
+    EXPECT(RtpKeyframeRequest_Parse(packet.data(), packet.size(), &ssrc) == RTCP_PSFB_FMT_PLI);
+    EXPECT(ssrc == 0x12345678);
+    printf("testPliRoundTrip passed\n");
+}
+
+static void testFirRoundTrip() {
+    uint8_t data[12];
+    uint32_t ssrc = 0;
+    EXPECT(RtpKeyframeRequest_BuildFir(0x12345678, 7, data, 11) == 0);
+    size_t len = RtpKeyframeRequest_BuildFir(0x12345678, 7, data, sizeof(data));
+    EXPECT(len == 12);
+    // media source 0, then SSRC, sequence number, reserved
+    static const uint8_t expected[12] = { 0, 0, 0, 0, 0x12, 0x34, 0x56, 0x78, 7, 0, 0, 0 };
+    EXPECT(memcmp(data, expected, sizeof(expected)) == 0);
+    std::vector<uint8_t> packet = sFeedback(RTCP_PSFB, RTCP_PSFB_FMT_FIR, data, len);
+    EXPECT(RtpKeyframeRequest_Parse(packet.data(), packet.size(), &ssrc) == RTCP_PSFB_FMT_FIR);
+    EXPECT(ssrc == 0x12345678);
+    printf("testFirRoundTrip passed\n");
+}
+
+static void testParseRejects() {
+    uint8_t data[12];
+    uint32_t ssrc = 0;
+    RtpKeyframeRequest_BuildPli(0x12345678, data, sizeof(data));
+
+    // a generic NACK is transport layer feedback
+    std::vector<uint8_t> nack = sFeedback(RTCP_RTPFB, RTCP_RTPFB_FMT_NACK, data, 4);
+    EXPECT(RtpKeyframeRequest_Parse(nack.data(), nack.size(), &ssrc) == -1);
+    // slice loss indication (FMT 2) is not asked for
+    std::vector<uint8_t> sli = sFeedback(RTCP_PSFB, 2, data, 4);
+    EXPECT(RtpKeyframeRequest_Parse(sli.data(), sli.size(), &ssrc) == -1);
+    // truncated
+    std::vector<uint8_t> pli = sFeedback(RTCP_PSFB, RTCP_PSFB_FMT_PLI, data, 4);
+    EXPECT(RtpKeyframeRequest_Parse(pli.data(), pli.size() - 4, &ssrc) == -1);
+    // a FIR without FCI
+    std::vector<uint8_t> fir = sFeedback(RTCP_PSFB, RTCP_PSFB_FMT_FIR, data, 4);
+    EXPECT(RtpKeyframeRequest_Parse(fir.data(), fir.size(), &ssrc) == -1);
+    // RTP version 1
+    pli[0] &= 0x3f;
+    pli[0] |= 0x40;
+    EXPECT(RtpKeyframeRequest_Parse(pli.data(), pli.size(), &ssrc) == -1);
+    printf("testParseRejects passed\n");
+}
+
+static void testRequesterPacing() {
+    RtpKeyframeRequester requester(300000);
+    EXPECT(!requester.IsPending() && requester.GetNextDeadlineUs() == -1);
+    EXPECT(!requester.Due(0));
+
+    requester.Request(1000);
+    uint8_t seqNr = requester.GetFirSeqNr();
+    EXPECT(requester.Due(1000));            // at once
+    EXPECT(!requester.Due(2000));
+    requester.Request(50000);               // already pending: no new request, no new FIR number
+    EXPECT(!requester.Due(50000));
+    EXPECT(requester.GetFirSeqNr() == seqNr);
+    EXPECT(requester.GetNextDeadlineUs() == 301000);
+    EXPECT(requester.Due(301000));          // no keyframe yet: repeated
+    requester.OnKeyframe();
+    EXPECT(!requester.IsPending() && !requester.Due(1000000));
+    requester.OnKeyframe();                 // a regular keyframe answers nothing
+
+    requester.Request(2000000);
+    EXPECT(requester.GetFirSeqNr() == (uint8_t)(seqNr + 1));
+    EXPECT(requester.Due(2000000));
+
+    const RtpKeyframeRequester::Stats &stats = requester.GetStats();
+    EXPECT(stats.requests == 2 && stats.sent == 3 && stats.answered == 1);
+    printf("testRequesterPacing passed\n");
+}
+
+// What the JNI sender does with the feedback it gets.
+class KeyframeSender : public RTPSession
+{
+public:
+    std::vector<int> fmts;
+
+protected:
+    void OnUnknownPacketType(RTCPPacket *rtcppack, const RTPTime &, const RTPAddress *) {
+        uint32_t ssrc;
+        int fmt = RtpKeyframeRequest_Parse(rtcppack->GetPacketData(), rtcppack->GetPacketLength(), &ssrc);
+        if (fmt >= 0 && ssrc == GetLocalSSRC())
+            fmts.push_back(fmt);
+    }
+};
+
+static bool sCreate(RTPSession &session, RTPUDPv4Transmitter &transmitter, const char *cname) {
+    RTPUDPv4TransmissionParams transparams;
+    transparams.SetPortbase(0);
+    RTPSessionParams sessionparams;
+    sessionparams.SetOwnTimestampUnit(1.0 / 90000.0);
+    sessionparams.SetUsePollThread(false);
+    sessionparams.SetCNAME(cname);      // no login name in containers
+    int status;
+    if ((status = transmitter.Init(false)) < 0
+            || (status = transmitter.Create(sessionparams.GetMaximumPacketSize(), &transparams)) < 0
+            || (status = session.Create(sessionparams, &transmitter)) < 0) {
+        fprintf(stderr, "cannot create the %s session: %s\n", cname, RTPGetErrorString(status).c_str());
+        return false;
+    }
+    return true;
+}
+
+static RTPIPv4Address sAddressOf(RTPUDPv4Transmitter &transmitter) {
+    uint8_t loopback[] = { 127, 0, 0, 1 };
+    RTPUDPv4TransmissionInfo *info = (RTPUDPv4TransmissionInfo *)transmitter.GetTransmissionInfo();
+    RTPIPv4Address addr(loopback, info->GetRTPPort(), info->GetRTCPPort());
+    transmitter.DeleteTransmissionInfo(info);
+    return addr;
+}
+
+static void testLoopback() {
+    RTPUDPv4Transmitter sending(0);
+    RTPUDPv4Transmitter receiving(0);
+    KeyframeSender sender;
+    RTPSession receiver;
+    if (!sCreate(sender, sending, "sender") || !sCreate(receiver, receiving, "receiver")) {
+        sFailures++;
+        return;
+    }
+    sender.AddDestination(sAddressOf(receiving));
+    receiver.AddDestination(sAddressOf(sending));
+
+    uint8_t data[12];
+    uint32_t ssrc = sender.GetLocalSSRC();
+    size_t len = RtpKeyframeRequest_BuildPli(ssrc, data, sizeof(data));
+    EXPECT(receiver.SendUnknownPacket(false, RTCP_PSFB, RTCP_PSFB_FMT_PLI, data, len) > 0);
+    len = RtpKeyframeRequest_BuildFir(ssrc, 1, data, sizeof(data));
+    EXPECT(receiver.SendUnknownPacket(false, RTCP_PSFB, RTCP_PSFB_FMT_FIR, data, len) > 0);
+    // meant for another stream
+    len = RtpKeyframeRequest_BuildPli(ssrc + 1, data, sizeof(data));
+    EXPECT(receiver.SendUnknownPacket(false, RTCP_PSFB, RTCP_PSFB_FMT_PLI, data, len) > 0);
+
+    for (int i = 0; i < 50 && sender.fmts.size() < 2; i++) {
+        bool available = false;
+        sender.WaitForIncomingData(RTPTime(0.01), &available);
+        sender.Poll();
+    }
+    EXPECT(sender.fmts.size() == 2);
+    if (sender.fmts.size() == 2)
+        EXPECT(sender.fmts[0] == RTCP_PSFB_FMT_PLI && sender.fmts[1] == RTCP_PSFB_FMT_FIR);
+
+    sender.Destroy();
+    receiver.Destroy();
+    sending.Destroy();
+    receiving.Destroy();
+    printf("testLoopback passed\n");
+}
+
+int main() {
+    testPliRoundTrip();
+    testFirRoundTrip();
+    testParseRejects();
+    testRequesterPacing();
+    testLoopback();
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("rtpkeyframetest: all passed\n");
+    return 0;
+}
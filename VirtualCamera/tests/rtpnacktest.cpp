@@ -0,0 +1,573 @@
+// Host test for the generic NACK (RFC 4585) retransmission path: the FCI
+// encoding, RtpNackBuffer ordering/request/give-up logic, and a lossy loopback
+// harness where a sender RTPSession with an RtpRetransmitCache answers the
+// NACKs of a receiver feeding H264Depacketizer, as VirtualCameraService does.
+//
+//   rtpnacktest [-n frames] [-l loss percent]
+//
+// The harness runs on a virtual clock, so the outcome does not depend on the
+// speed of the machine; loss is only applied to RTP, never to the NACKs.
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "H264Depacketizer.h"
+#include "RtpNack.h"
+#include "rtpteststream.h"
+#include "testharness.h"
+
+#include "rtpsession.h"
+#include "rtpsessionparams.h"
+#include "rtpudpv4transmitter.h"
+#include "rtpipv4address.h"
+#include "rtcppacket.h"
+
+using namespace jrtplib;
+
+#define LEGACY_SLICE_MAX    1200    // RTPSession: maxpacksize(1400) - 200
+
+struct Sink {
+    std::vector<uint16_t> delivered;
+    int released;
+
+    Sink() : released(0) {}
+};
+
+static void sSinkDeliver(void *userdata, RTPPacket *packet) {
+    ((Sink *)userdata)->delivered.push_back(packet->GetSequenceNumber());
+    delete packet;
+}
+
+static void sSinkRelease(void *userdata, RTPPacket *packet) {
+    ((Sink *)userdata)->released++;
+    delete packet;
+}
+
+// count empty packets starting at seq, from one SSRC
+static std::vector<TestRtpPacket> sPackets(uint16_t seq, int count, uint32_t ssrc = 0x12345678) {
+    TestPacketizer packetizer(ssrc, seq);
+    std::vector<TestRtpPacket> packets;
+    for (int i = 0; i < count; i++)
+        packetizer.AddLegacy(ByteVector(8, 0x41), LEGACY_SLICE_MAX, packets);
+    return packets;
+}
+
+static void sPush(RtpNackBuffer &buffer, const TestRtpPacket &p, long long nowUs) {
+    RTPPacket *packet = sParseRtp(p.bytes.data(), p.bytes.size(), nowUs);
+    EXPECT(packet != NULL);
+    if (packet != NULL)
+        buffer.Push(packet, nowUs);
+}
+
+static void testFciRoundTrip() {
+    // a BLP run, a PID on its own, and a run across the wrap
+    const uint16_t seqs[] = { 100, 101, 105, 116, 117, 300, 65534, 65535, 0, 3 };
+    const int count = sizeof(seqs) / sizeof(seqs[0]);
+    uint8_t packet[128];
+    packet[0] = 0x80 | RTCP_RTPFB_FMT_NACK;
+    packet[1] = RTCP_RTPFB;
+    memset(packet + 4, 0xaa, 4);    // sender SSRC
+    size_t fci = RtpNack_BuildFci(0xdeadbeef, seqs, count, packet + 8, sizeof(packet) - 8);
+    // 100 covers up to 116, then 117, 300 and 65534 (which covers 3)
+    EXPECT(fci == 4 + 4 * 4);
+    packet[2] = 0;
+    packet[3] = (uint8_t)((8 + fci) / 4 - 1);
+
+    uint32_t ssrc = 0;
+    uint16_t parsed[64];
+    int n = RtpNack_Parse(packet, 8 + fci, &ssrc, parsed, 64);
+    EXPECT(n == count);
+    EXPECT(ssrc == 0xdeadbeef);
+    for (int i = 0; i < n && i < count; i++)
+        EXPECT(parsed[i] == seqs[i]);
+
+    // truncated output keeps whole pairs only
+    EXPECT(RtpNack_BuildFci(1, seqs, count, packet + 8, 4 + 4 + 3) == 8);
+    EXPECT(RtpNack_BuildFci(1, seqs, count, packet + 8, 7) == 0);
+    // not a generic NACK
+    packet[1] = 206;
+    EXPECT(RtpNack_Parse(packet, 8 + fci, &ssrc, parsed, 64) == -1);
+    packet[1] = RTCP_RTPFB;
+    packet[0] = 0x80 | 15;
+    EXPECT(RtpNack_Parse(packet, 8 + fci, &ssrc, parsed, 64) == -1);
+    printf("testFciRoundTrip passed\n");
+}
+
+static void testInOrderPassThrough() {
+    Sink sink;
+    RtpNackBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    std::vector<TestRtpPacket> packets = sPackets(65530, 20);
+    for (size_t i = 0; i < packets.size(); i++)
+        sPush(buffer, packets[i], 1000000);
+
+    EXPECT(sink.delivered.size() == 20);
+    for (size_t i = 0; i < sink.delivered.size(); i++)
+        EXPECT(sink.delivered[i] == (uint16_t)(65530 + i));
+    EXPECT(buffer.GetHeldPackets() == 0);
+    EXPECT(buffer.GetNextDeadlineUs() == -1);
+    uint16_t seqs[8];
+    uint32_t ssrc;
+    EXPECT(buffer.CollectNacks(2000000, seqs, 8, &ssrc) == 0);
+    printf("testInOrderPassThrough passed\n");
+}
+
+static void testGapRecovered() {
+    Sink sink;
+    RtpNackBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    buffer.SetTiming(80000, 20000, 3);
+    std::vector<TestRtpPacket> packets = sPackets(1000, 10);
+    long long now = 1000000;
+
+    for (int i = 0; i < 10; i++) {
+        if (i != 3 && i != 4)
+            sPush(buffer, packets[i], now);
+    }
+    // 1000..1002 went on, the rest waits for 1003 and 1004
+    EXPECT(sink.delivered.size() == 3);
+    EXPECT(buffer.GetHeldPackets() == 5);
+    EXPECT(buffer.GetNextDeadlineUs() == now);
+
+    uint16_t seqs[8];
+    uint32_t ssrc = 0;
+    EXPECT(buffer.CollectNacks(now, seqs, 8, &ssrc) == 2);
+    EXPECT(seqs[0] == 1003 && seqs[1] == 1004);
+    EXPECT(ssrc == 0x12345678);
+    // not again before the retry interval
+    EXPECT(buffer.CollectNacks(now + 10000, seqs, 8, &ssrc) == 0);
+    EXPECT(buffer.GetNextDeadlineUs() == now + 20000);
+
+    sPush(buffer, packets[4], now + 15000);
+    EXPECT(sink.delivered.size() == 3);
+    EXPECT(buffer.CollectNacks(now + 20000, seqs, 8, &ssrc) == 1);
+    EXPECT(seqs[0] == 1003);
+    sPush(buffer, packets[3], now + 25000);
+
+    EXPECT(sink.delivered.size() == 10);
+    for (size_t i = 0; i < sink.delivered.size(); i++)
+        EXPECT(sink.delivered[i] == 1000 + i);
+    const RtpNackBuffer::Stats &stats = buffer.GetStats();
+    EXPECT(stats.missing == 2);
+    EXPECT(stats.requested == 3);
+    EXPECT(stats.recovered == 2);
+    EXPECT(stats.lost == 0);
+    EXPECT(buffer.GetNextDeadlineUs() == -1);
+    printf("testGapRecovered passed\n");
+}
+
+static void testGiveUp() {
+    Sink sink;
+    RtpNackBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    buffer.SetTiming(80000, 20000, 2);
+    std::vector<TestRtpPacket> packets = sPackets(2000, 6);
+    long long now = 1000000;
+    uint16_t seqs[8];
+    uint32_t ssrc;
+
+    sPush(buffer, packets[0], now);
+    sPush(buffer, packets[2], now);
+    EXPECT(buffer.CollectNacks(now, seqs, 8, &ssrc) == 1);
+    EXPECT(buffer.CollectNacks(now + 20000, seqs, 8, &ssrc) == 1);
+    // out of requests: one more interval for the last answer, then it is lost
+    EXPECT(buffer.CollectNacks(now + 40000, seqs, 8, &ssrc) == 0);
+    buffer.Poll(now + 39999);
+    EXPECT(sink.delivered.size() == 1);
+    buffer.Poll(now + 40000);
+    EXPECT(sink.delivered.size() == 2);
+    EXPECT(buffer.GetStats().lost == 1);
+
+    // too late now, and a duplicate of something delivered
+    sPush(buffer, packets[1], now + 50000);
+    sPush(buffer, packets[2], now + 50000);
+    EXPECT(sink.released == 2);
+    EXPECT(buffer.GetStats().late == 2);
+
+    // the hold time alone ends a gap as well
+    buffer.SetTiming(30000, 20000, 10);
+    sPush(buffer, packets[4], now + 100000);
+    sPush(buffer, packets[5], now + 100000);
+    sPush(buffer, packets[5], now + 100000);
+    EXPECT(buffer.GetStats().duplicates == 1);
+    EXPECT(buffer.GetNextDeadlineUs() == now + 100000);
+    buffer.Poll(now + 129999);
+    EXPECT(sink.delivered.size() == 2);
+    buffer.Poll(now + 130000);
+    EXPECT(sink.delivered.size() == 4);
+    EXPECT(buffer.GetStats().lost == 2);
+    EXPECT(buffer.GetHeldPackets() == 0);
+    printf("testGiveUp passed\n");
+}
+
+static void testUnordered() {
+    Sink sink;
+    RtpNackBuffer buffer(sSinkDeliver, sSinkRelease, &sink);
+    buffer.SetTiming(80000, 20000, 3);
+    buffer.SetOrdering(false);
+    std::vector<TestRtpPacket> packets = sPackets(3000, 6);
+    long long now = 1000000;
+    uint16_t seqs[8];
+    uint32_t ssrc;
+
+    // everything goes on as it arrives, the gap is still requested
+    sPush(buffer, packets[0], now);
+    sPush(buffer, packets[2], now);
+    sPush(buffer, packets[3], now);
+    EXPECT(sink.delivered.size() == 3);
+    EXPECT(buffer.GetHeldPackets() == 0);
+    EXPECT(buffer.CollectNacks(now, seqs, 8, &ssrc) == 1);
+    EXPECT(seqs[0] == 3001);
+    sPush(buffer, packets[3], now + 1000);
+    EXPECT(buffer.GetStats().duplicates == 1);
+    sPush(buffer, packets[1], now + 10000);
+    EXPECT(sink.delivered.size() == 4);
+    EXPECT(sink.delivered[3] == 3001);
+    EXPECT(buffer.GetStats().recovered == 1);
+    EXPECT(buffer.GetNextDeadlineUs() == -1);
+
+    // given up on, and still passed on when it turns up after all
+    sPush(buffer, packets[5], now + 20000);
+    buffer.Poll(now + 100000);
+    EXPECT(buffer.GetStats().lost == 1);
+    sPush(buffer, packets[4], now + 110000);
+    EXPECT(sink.delivered.size() == 6);
+    EXPECT(buffer.GetStats().late == 1);
+    EXPECT(sink.released == 1);
+    printf("testUnordered passed\n");
+}
+
+static void testRestartAndPassThrough() {
+    Sink sink;
+    RtpNackBuffer buffer(sSinkDeliver, sSinkRelease, &sink, 64);
+    std::vector<TestRtpPacket> a = sPackets(100, 4);
+    std::vector<TestRtpPacket> b = sPackets(5000, 2, 0x87654321);
+    long long now = 1000000;
+
+    sPush(buffer, a[0], now);
+    sPush(buffer, a[2], now);
+    // a new SSRC flushes the old stream in order
+    sPush(buffer, b[0], now);
+    EXPECT(sink.delivered.size() == 3);
+    EXPECT(sink.delivered[1] == 102 && sink.delivered[2] == 5000);
+    // a jump beyond the ring starts over as well
+    std::vector<TestRtpPacket> far = sPackets(5001 + 200, 1, 0x87654321);
+    sPush(buffer, far[0], now);
+    EXPECT(sink.delivered.size() == 4);
+    EXPECT(buffer.GetHeldPackets() == 0);
+
+    // hold 0: nothing held, nothing requested
+    buffer.SetTiming(0, 20000, 3);
+    std::vector<TestRtpPacket> c = sPackets(7000, 4, 0x87654321);
+    sPush(buffer, c[3], now);
+    sPush(buffer, c[1], now);
+    EXPECT(sink.delivered.size() == 6);
+    EXPECT(sink.delivered[4] == 7003 && sink.delivered[5] == 7001);
+    uint16_t seqs[8];
+    uint32_t ssrc;
+    EXPECT(buffer.CollectNacks(now + 100000, seqs, 8, &ssrc) == 0);
+
+    // Reset releases what is held
+    buffer.SetTiming(80000, 20000, 3);
+    std::vector<TestRtpPacket> d = sPackets(9000, 3, 0x87654321);
+    sPush(buffer, d[0], now);
+    sPush(buffer, d[2], now);
+    buffer.Reset();
+    EXPECT(sink.released == 1);
+    EXPECT(buffer.GetHeldPackets() == 0);
+    printf("testRestartAndPassThrough passed\n");
+}
+
+static void testRetransmitCache() {
+    RtpRetransmitCache cache(16, 64);
+    std::vector<TestRtpPacket> packets = sPackets(65530, 20);
+    for (size_t i = 0; i < packets.size(); i++) {
+        const ByteVector &b = packets[i].bytes;
+        cache.Store(b.data(), 12, b.data() + 12, b.size() - 12);
+    }
+    uint8_t out[64];
+    // the last 16 are held, byte for byte
+    EXPECT(cache.Lookup(13, out, sizeof(out)) == packets[19].bytes.size());
+    EXPECT(memcmp(out, packets[19].bytes.data(), packets[19].bytes.size()) == 0);
+    EXPECT(cache.Lookup(65534, out, sizeof(out)) == packets[4].bytes.size());
+    EXPECT(cache.Lookup(65533, out, sizeof(out)) == 0);
+    EXPECT(cache.Lookup(14, out, sizeof(out)) == 0);
+    // too big to keep
+    ByteVector big(100, 0x80);
+    big[2] = 0;
+    big[3] = 14;
+    cache.Store(big.data(), big.size(), NULL, 0);
+    EXPECT(cache.Lookup(14, out, sizeof(out)) == 0);
+
+    RtpRetransmitCache::Stats stats = cache.GetStats();
+    EXPECT(stats.stored == 20);
+    EXPECT(stats.requested == 5);
+    EXPECT(stats.resent == 2);
+    EXPECT(stats.missed == 3);
+    printf("testRetransmitCache passed\n");
+}
+
+// ---- lossy loopback ----
+
+// Drops RTP packets at random, retransmissions included; RTCP goes through.
+class LossyTransmitter : public RTPUDPv4Transmitter
+{
+public:
+    LossyTransmitter(int lossPercent, uint32_t seed)
+        : RTPUDPv4Transmitter(0), mLossPercent(lossPercent), mSeed(seed), mDropped(0) {}
+
+    int SendRTPData(const void *data, size_t len) {
+        if (Drop())
+            return 0;
+        return RTPUDPv4Transmitter::SendRTPData(data, len);
+    }
+
+    int SendRTPDataGather(const RTPGatherPacket *packets, int count) {
+        std::vector<RTPGatherPacket> kept;
+        for (int i = 0; i < count; i++) {
+            if (!Drop())
+                kept.push_back(packets[i]);
+        }
+        if (count > 0 && kept.empty())
+            return 0;
+        return RTPUDPv4Transmitter::SendRTPDataGather(kept.empty() ? packets : kept.data(), (int)kept.size());
+    }
+
+    long long GetDropped() const { return mDropped; }
+
+private:
+    bool Drop() {
+        if ((int)(sTestRand(&mSeed) % 100) >= mLossPercent)
+            return false;
+        mDropped++;
+        return true;
+    }
+
+    int mLossPercent;
+    uint32_t mSeed;
+    long long mDropped;
+};
+
+// What NotifyRTPSession in the JNI sender does with its retransmitCache.
+class NackSender : public RTPSession
+{
+public:
+    NackSender() : cache(1024, RTP_DEFAULTPACKETSIZE) {}
+
+    RtpRetransmitCache cache;
+
+protected:
+    void OnSendRTPPacket(const RTPGatherPacket &packet) {
+        cache.Store(packet.header, packet.headerlen, packet.payload, packet.payloadlen);
+    }
+
+    void OnUnknownPacketType(RTCPPacket *rtcppack, const RTPTime &, const RTPAddress *) {
+        uint16_t seqs[256];
+        uint8_t data[RTP_DEFAULTPACKETSIZE];
+        uint32_t ssrc;
+        int count = RtpNack_Parse(rtcppack->GetPacketData(), rtcppack->GetPacketLength(), &ssrc, seqs, 256);
+        if (count <= 0 || ssrc != GetLocalSSRC())
+            return;
+        for (int i = 0; i < count; i++) {
+            size_t len = cache.Lookup(seqs[i], data, sizeof(data));
+            if (len > 0)
+                SendRawData(data, len, true);
+        }
+    }
+};
+
+struct Receiver {
+    RTPSession session;
+    H264Depacketizer *depacketizer;
+    long long units;
+};
+
+static int sCountUnit(void *userdata, H264AccessUnit *unit) {
+    ((Receiver *)userdata)->units++;
+    H264Depacketizer::ReleaseUnit(unit->opaque, unit->data);
+    return 0;
+}
+
+static void sReceiverDeliver(void *userdata, RTPPacket *packet) {
+    Receiver *r = (Receiver *)userdata;
+    r->depacketizer->ProcessPacket(packet);
+    r->session.DeletePacket(packet);
+}
+
+static void sReceiverRelease(void *userdata, RTPPacket *packet) {
+    ((Receiver *)userdata)->session.DeletePacket(packet);
+}
+
+static bool sCreate(RTPSession &session, RTPUDPv4Transmitter &transmitter, const char *cname) {
+    RTPUDPv4TransmissionParams transparams;
+    transparams.SetPortbase(0);
+    transparams.SetRTPReceiveBuffer(4 * 1024 * 1024);
+    RTPSessionParams sessionparams;
+    sessionparams.SetOwnTimestampUnit(1.0 / 90000.0);
+    sessionparams.SetUsePollThread(false);
+    sessionparams.SetCNAME(cname);      // no login name in containers
+    int status;
+    if ((status = transmitter.Init(false)) < 0
+            || (status = transmitter.Create(sessionparams.GetMaximumPacketSize(), &transparams)) < 0
+            || (status = session.Create(sessionparams, &transmitter)) < 0) {
+        fprintf(stderr, "cannot create the %s session: %s\n", cname, RTPGetErrorString(status).c_str());
+        return false;
+    }
+    return true;
+}
+
+static RTPIPv4Address sAddressOf(RTPUDPv4Transmitter &transmitter) {
+    uint8_t loopback[] = { 127, 0, 0, 1 };
+    RTPUDPv4TransmissionInfo *info = (RTPUDPv4TransmissionInfo *)transmitter.GetTransmissionInfo();
+    RTPIPv4Address addr(loopback, info->GetRTPPort(), info->GetRTCPPort());
+    transmitter.DeleteTransmissionInfo(info);
+    return addr;
+}
+
+struct LoopbackResult {
+    long long units;
+    long long dropped;
+    RtpNackBuffer::Stats nack;
+    H264Depacketizer::Stats depacketizer;
+    RtpRetransmitCache::Stats cache;
+};
+
+// Sends frames over a lossy loopback link and runs the receive side the way
+// the service does; holdUs 0 runs it without NACKs.
+static bool sLoopback(const std::vector<TestFrame> &frames, int lossPercent, long long holdUs,
+        LoopbackResult *result) {
+    LossyTransmitter lossy(lossPercent, 7);
+    RTPUDPv4Transmitter receiving(0);
+    NackSender sender;
+    Receiver receiver;
+    if (!sCreate(sender, lossy, "sender") || !sCreate(receiver.session, receiving, "receiver"))
+        return false;
+    sender.AddDestination(sAddressOf(receiving));
+    receiver.session.AddDestination(sAddressOf(lossy));
+
+    H264Depacketizer depacketizer(sCountUnit, &receiver);
+    receiver.depacketizer = &depacketizer;
+    receiver.units = 0;
+    RtpNackBuffer buffer(sReceiverDeliver, sReceiverRelease, &receiver);
+    buffer.SetTiming(holdUs, 20000, 3);
+
+    long long now = 1000000;
+    for (size_t f = 0; f < frames.size() + 10; f++) {
+        // a trailing parameter set buffer reveals losses at the end of the last frame
+        if (f <= frames.size()) {
+            const ByteVector &data = frames[f < frames.size() ? f : 0].data;
+            sender.SendPacketAfterSlice(data.data(), data.size(), 96, true, 10);
+        }
+        // four receive loop turns per 16 ms frame
+        for (int step = 0; step < 4; step++, now += 4000) {
+            receiver.session.Poll();
+            receiver.session.BeginDataAccess();
+            if (receiver.session.GotoFirstSource()) {
+                do {
+                    RTPPacket *packet;
+                    while ((packet = receiver.session.GetNextPacket()) != 0)
+                        buffer.Push(packet, now);
+                } while (receiver.session.GotoNextSource());
+            }
+            receiver.session.EndDataAccess();
+
+            uint16_t seqs[64];
+            uint32_t ssrc;
+            int count = buffer.CollectNacks(now, seqs, 64, &ssrc);
+            if (count > 0) {
+                uint8_t fci[4 + 64 * 4];
+                size_t len = RtpNack_BuildFci(ssrc, seqs, count, fci, sizeof(fci));
+                int status = receiver.session.SendUnknownPacket(false, RTCP_RTPFB, RTCP_RTPFB_FMT_NACK, fci, len);
+                EXPECT(status >= 0);
+            }
+            buffer.Poll(now);
+            // answers the NACKs; loopback delivery is synchronous
+            sender.Poll();
+        }
+    }
+    buffer.Flush();
+
+    result->units = receiver.units;
+    result->dropped = lossy.GetDropped();
+    result->nack = buffer.GetStats();
+    result->depacketizer = depacketizer.GetStats();
+    result->cache = sender.cache.GetStats();
+
+    buffer.Reset();
+    receiver.session.Destroy();
+    sender.Destroy();
+    receiving.Destroy();
+    lossy.Destroy();
+    return true;
+}
+
+static void testLossyLoopback(int frames, int lossPercent) {
+    std::vector<TestFrame> stream = sMakeStream(frames, 30, 60000, 6000, 3);
+    LoopbackResult with, without;
+    if (!sLoopback(stream, lossPercent, 80000, &with) || !sLoopback(stream, lossPercent, 0, &without)) {
+        sFailures++;
+        return;
+    }
+
+    const char *names[] = { "nack", "no nack" };
+    LoopbackResult *results[] = { &with, &without };
+    for (int i = 0; i < 2; i++) {
+        LoopbackResult &r = *results[i];
+        printf("%-14s %6lld/%zu units %6" PRIu64 " lost packets %6lld dropped %6" PRIu64 " requested %6" PRIu64
+               " recovered %6" PRIu64 " resent\n", names[i], r.units, stream.size(), r.depacketizer.lostPackets,
+               r.dropped, r.nack.requested, r.nack.recovered, r.cache.resent);
+    }
+    if (lossPercent > 0) {
+        EXPECT(with.dropped > 0);
+        EXPECT(with.nack.recovered > 0);
+        EXPECT(with.cache.resent >= with.nack.recovered);
+        EXPECT(without.depacketizer.lostPackets > 0);
+        EXPECT(without.units < (long long)stream.size());
+    }
+    // at a few percent, three retries leave (next to) nothing unrecovered
+    EXPECT(with.depacketizer.lostPackets == with.nack.lost);
+    if (lossPercent <= 5) {
+        EXPECT(with.nack.lost == 0);
+        EXPECT(with.units >= (long long)stream.size());
+    }
+    printf("testLossyLoopback passed\n");
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 120;
+    int loss = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 'l':
+            loss = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-l loss percent]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames <= 0 || loss < 0 || loss > 50) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    testFciRoundTrip();
+    testInOrderPassThrough();
+    testGapRecovered();
+    testGiveUp();
+    testUnordered();
+    testRestartAndPassThrough();
+    testRetransmitCache();
+    testLossyLoopback(frames, loss);
+
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("rtpnacktest: all passed\n");
+    return 0;
+}
@@ -0,0 +1,362 @@
+// Allocation benchmark for RTPPoolMemoryManager against the heap, which every
+// session used before RTPSessionParams::SetUseMemoryPool:
+//
+//   alloc     thread pairs: one allocates what receiving a packet takes (the
+//             datagram buffer, RTPRawPacket, RTPPacket, source address), the
+//             other frees it a window of packets later, as the receive thread
+//             and the decode thread do
+//   session   a receiving RTPSession fed over loopback, its packets taken and
+//             deleted; with the pool, everything has to be back after Destroy
+//
+// Every run is a child process, so the peak resident set is its own.
+//
+//   rtppoolbench [-n packets] [-t thread pairs] [-w packets in flight]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <new>
+
+#include "rtpsession.h"
+#include "rtpsessionparams.h"
+#include "rtpudpv4transmitter.h"
+#include "rtpipv4address.h"
+#include "rtppoolmemorymanager.h"
+#include "rtprawpacket.h"
+#include "rtppacket.h"
+#include "rtpsourcedata.h"
+
+using namespace jrtplib;
+
+#define BLOCKS_PER_PACKET   4
+
+static long long sClockNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Result {
+    long long packets;
+    long long bad;
+    long long wallNs;
+    long long cpuNs;
+    long maxRssKb;
+    RTPPoolMemoryManager::Stats pool;
+    size_t slabBytes;
+};
+
+// The blocks of one received packet, allocated as the transmitter and the
+// source table do.
+struct PacketBlocks {
+    void *blocks[BLOCKS_PER_PACKET];
+};
+
+struct Pair {
+    RTPPoolMemoryManager *pool;     // NULL: the heap
+    int packets;
+    int window;
+    int capacity;
+    PacketBlocks *ring;
+    std::atomic<int> head;          // next to write, producer only
+    std::atomic<int> tail;          // next to free, consumer only
+    std::atomic<bool> done;
+    long long bad;
+};
+
+static void *sAllocate(RTPPoolMemoryManager *pool, size_t size, int memtype) {
+    return pool ? pool->AllocateBuffer(size, memtype) : operator new(size);
+}
+
+static void sFree(RTPPoolMemoryManager *pool, void *block) {
+    if (pool)
+        pool->FreeBuffer(block);
+    else
+        operator delete(block);
+}
+
+static void *sProducer(void *arg) {
+    Pair *pair = (Pair *)arg;
+    uint32_t seed = 1;
+    for (int i = 0; i < pair->packets; i++) {
+        int head = pair->head.load(std::memory_order_relaxed);
+        while (head - pair->tail.load(std::memory_order_acquire) >= pair->capacity)
+            sched_yield();
+        // slices of the legacy sender vary in size; the RTP header comes on top
+        seed = seed * 1103515245u + 12345u;
+        size_t datagram = 12 + 200 + (seed >> 8) % 1200;
+        PacketBlocks &p = pair->ring[head % pair->capacity];
+        p.blocks[0] = sAllocate(pair->pool, datagram, RTPMEM_TYPE_BUFFER_RECEIVEDRTPPACKET);
+        p.blocks[1] = sAllocate(pair->pool, sizeof(RTPRawPacket), RTPMEM_TYPE_CLASS_RTPRAWPACKET);
+        p.blocks[2] = sAllocate(pair->pool, sizeof(RTPPacket), RTPMEM_TYPE_CLASS_RTPPACKET);
+        p.blocks[3] = sAllocate(pair->pool, sizeof(RTPIPv4Address), RTPMEM_TYPE_CLASS_RTPADDRESS);
+        // touched as a received packet would be
+        memset(p.blocks[0], (uint8_t)i, datagram);
+        ((uint8_t *)p.blocks[1])[0] = (uint8_t)i;
+        ((uint8_t *)p.blocks[2])[0] = (uint8_t)i;
+        ((uint8_t *)p.blocks[3])[0] = (uint8_t)i;
+        pair->head.store(head + 1, std::memory_order_release);
+    }
+    pair->done.store(true, std::memory_order_release);
+    return NULL;
+}
+
+static void *sConsumer(void *arg) {
+    Pair *pair = (Pair *)arg;
+    int tail = 0;
+    while (tail < pair->packets) {
+        int head = pair->head.load(std::memory_order_acquire);
+        if (head - tail <= pair->window && !pair->done.load(std::memory_order_acquire)) {
+            sched_yield();
+            continue;
+        }
+        PacketBlocks &p = pair->ring[tail % pair->capacity];
+        for (int b = 0; b < BLOCKS_PER_PACKET; b++) {
+            if (((uint8_t *)p.blocks[b])[0] != (uint8_t)tail)
+                pair->bad++;
+            sFree(pair->pool, p.blocks[b]);
+        }
+        tail++;
+        pair->tail.store(tail, std::memory_order_release);
+    }
+    return NULL;
+}
+
+static bool sRunAlloc(bool pooled, int packets, int pairs, int window, Result *result) {
+    RTPPoolMemoryManager *pool = NULL;
+    if (pooled) {
+        pool = new RTPPoolMemoryManager();
+        if (pool->Init(true) < 0)
+            return false;
+    }
+    Pair *all = new Pair[pairs];
+    pthread_t threads[2 * 16];
+    long long wall = sClockNs(CLOCK_MONOTONIC);
+    long long cpu = sClockNs(CLOCK_PROCESS_CPUTIME_ID);
+    for (int i = 0; i < pairs; i++) {
+        Pair &pair = all[i];
+        pair.pool = pool;
+        pair.packets = packets;
+        pair.window = window;
+        pair.capacity = window + 64;
+        pair.ring = new PacketBlocks[pair.capacity];
+        pair.head.store(0);
+        pair.tail.store(0);
+        pair.done.store(false);
+        pair.bad = 0;
+        pthread_create(&threads[2 * i], NULL, sProducer, &pair);
+        pthread_create(&threads[2 * i + 1], NULL, sConsumer, &pair);
+    }
+    for (int i = 0; i < 2 * pairs; i++)
+        pthread_join(threads[i], NULL);
+    result->wallNs = sClockNs(CLOCK_MONOTONIC) - wall;
+    result->cpuNs = sClockNs(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    result->packets = (long long)packets * pairs;
+    for (int i = 0; i < pairs; i++) {
+        result->bad += all[i].bad;
+        delete [] all[i].ring;
+    }
+    delete [] all;
+    if (pool) {
+        result->pool = pool->GetTotalStats();
+        result->slabBytes = pool->GetSlabBytes();
+        if (result->pool.inuse != 0)
+            result->bad++;
+        delete pool;
+    }
+    return true;
+}
+
+static bool sRunSession(bool pooled, int packets, Result *result) {
+    RTPUDPv4TransmissionParams transparams;
+    transparams.SetPortbase(0);
+    transparams.SetRTPReceiveBuffer(4 * 1024 * 1024);
+    transparams.SetBatchReceive(32);
+    RTPSessionParams sessionparams;
+    sessionparams.SetOwnTimestampUnit(1.0 / 90000.0);
+    sessionparams.SetUsePollThread(false);
+    sessionparams.SetCNAME("rtppoolbench");     // no login name in containers
+    sessionparams.SetUseMemoryPool(pooled);
+    RTPSession session;
+    int status;
+    if ((status = session.Create(sessionparams, &transparams)) < 0) {
+        fprintf(stderr, "cannot create the session: %s\n", RTPGetErrorString(status).c_str());
+        return false;
+    }
+    if ((session.GetMemoryPool() != NULL) != pooled) {
+        fprintf(stderr, "the session %s a memory pool\n", pooled ? "has no" : "has");
+        return false;
+    }
+    RTPUDPv4TransmissionInfo *info = (RTPUDPv4TransmissionInfo *)session.GetTransmissionInfo();
+    uint16_t port = info->GetRTPPort();
+    session.DeleteTransmissionInfo(info);
+
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    uint8_t datagram[1412];
+    memset(datagram, 0, sizeof(datagram));
+    datagram[0] = 0x80;             // RTP version 2
+    datagram[1] = 96;
+    datagram[8] = 0x12;             // SSRC
+    datagram[9] = 0x34;
+    datagram[10] = 0x56;
+    datagram[11] = 0x78;
+    const int burst = 64;
+    long long cpuNs = 0;
+    long long wall = sClockNs(CLOCK_MONOTONIC);
+    uint16_t expected = 0;
+    for (int sent = 0; sent < packets; ) {
+        for (int i = 0; i < burst && sent < packets; i++, sent++) {
+            uint16_t seq = (uint16_t)sent;
+            size_t size = 12 + 200 + (seq * 37) % 1200;
+            datagram[2] = seq >> 8;
+            datagram[3] = seq & 0xff;
+            datagram[size - 1] = (uint8_t)seq;
+            sendto(sender, datagram, size, 0, (struct sockaddr *)&to, sizeof(to));
+        }
+        long long cpu = sClockNs(CLOCK_THREAD_CPUTIME_ID);
+        // loopback delivery is synchronous, one Poll normally takes the burst
+        for (int tries = 0; tries < 100 && result->packets < sent; tries++) {
+            session.Poll();
+            session.BeginDataAccess();
+            if (session.GotoFirstSourceWithData()) {
+                do {
+                    RTPPacket *packet;
+                    while ((packet = session.GetNextPacket()) != NULL) {
+                        uint16_t seq = packet->GetSequenceNumber();
+                        size_t size = 12 + 200 + (seq * 37) % 1200;
+                        if (seq != expected || packet->GetPacketLength() != size
+                                || packet->GetPacketData()[size - 1] != (uint8_t)seq)
+                            result->bad++;
+                        expected = (uint16_t)(seq + 1);
+                        result->packets++;
+                        session.DeletePacket(packet);
+                    }
+                } while (session.GotoNextSourceWithData());
+            }
+            session.EndDataAccess();
+        }
+        cpuNs += sClockNs(CLOCK_THREAD_CPUTIME_ID) - cpu;
+    }
+    result->wallNs = sClockNs(CLOCK_MONOTONIC) - wall;
+    result->cpuNs = cpuNs;
+    close(sender);
+    session.Destroy();
+    if (pooled) {
+        // still there after Destroy, with everything handed back
+        result->pool = session.GetMemoryPool()->GetTotalStats();
+        result->slabBytes = session.GetMemoryPool()->GetSlabBytes();
+        if (result->pool.inuse != 0) {
+            fprintf(stderr, "%zu blocks still in use after Destroy\n", result->pool.inuse);
+            result->bad++;
+        }
+    }
+    return true;
+}
+
+// Runs one mode in a child process and reads its result back.
+static bool sFork(int mode, bool pooled, int packets, int pairs, int window, Result *result) {
+    int fds[2];
+    if (pipe(fds) < 0)
+        return false;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        Result r = Result();
+        bool ok = mode == 0 ? sRunAlloc(pooled, packets, pairs, window, &r) : sRunSession(pooled, packets, &r);
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        r.maxRssKb = usage.ru_maxrss;
+        if (write(fds[1], &r, sizeof(r)) != (ssize_t)sizeof(r))
+            ok = false;
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    bool ok = pid > 0 && read(fds[0], result, sizeof(*result)) == (ssize_t)sizeof(*result);
+    close(fds[0]);
+    int status = 1;
+    if (pid > 0)
+        waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    int packets = 200000;
+    int pairs = 2;
+    int window = 256;           // about a jitter buffer's worth of packets
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:w:")) != -1) {
+        switch (opt) {
+        case 'n':
+            packets = atoi(optarg);
+            break;
+        case 't':
+            pairs = atoi(optarg);
+            break;
+        case 'w':
+            window = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n packets] [-t thread pairs] [-w packets in flight]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (packets <= 0 || pairs <= 0 || pairs > 16 || window <= 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    printf("%d packets, %d thread pairs, %d in flight\n", packets, pairs, window);
+    const char *modes[] = { "alloc", "session" };
+    int failures = 0;
+    for (int mode = 0; mode < 2; mode++) {
+        for (int pooled = 0; pooled < 2; pooled++) {
+            Result r = Result();
+            char name[32];
+            snprintf(name, sizeof(name), "%s %s", modes[mode], pooled ? "pool" : "heap");
+            if (!sFork(mode, pooled != 0, packets, pairs, window, &r)) {
+                fprintf(stderr, "%s: failed\n", name);
+                failures++;
+                continue;
+            }
+            double n = r.packets > 0 ? (double)r.packets : 1;
+            printf("%-14s %8.1f ns wall/packet %8.1f ns cpu/packet %7ld KiB max RSS", name, r.wallNs / n,
+                   r.cpuNs / n, r.maxRssKb);
+            if (pooled) {
+                double allocations = r.pool.allocations > 0 ? (double)r.pool.allocations : 1;
+                printf(" %5.1f%% hits, %zu high water, %zu KiB slabs, %llu from the heap",
+                       r.pool.hits * 100.0 / allocations, r.pool.highwater, r.slabBytes / 1024,
+                       (unsigned long long)r.pool.heapallocations);
+            }
+            printf("\n");
+            long long expected = mode == 0 ? (long long)packets * pairs : packets;
+            if (r.packets != expected || r.bad) {
+                fprintf(stderr, "%s: %lld of %lld packets, %lld bad\n", name, r.packets, expected, r.bad);
+                failures++;
+            }
+            // once the window is allocated, packets only ever reuse blocks
+            if (pooled && r.pool.hits < r.pool.allocations * 9 / 10) {
+                fprintf(stderr, "%s: only %llu of %llu allocations reused a block\n", name,
+                        (unsigned long long)r.pool.hits, (unsigned long long)r.pool.allocations);
+                failures++;
+            }
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,259 @@
+// Simulation harness for RtpRateController: an encoder following the target
+// bitrate sends its frames as bursts of packets through a bottleneck link
+// (drop-tail queue, propagation delay, random loss) to a receiver that runs
+// the controller the way VirtualCameraService does, and whose target reaches
+// the encoder one propagation delay later, as the RTCP APP packet would.
+// The link capacity steps down part way through.
+//
+//   rtpratesim [-c kbit/s] [-s kbit/s after the step] [-S step second] [-t seconds]
+//              [-b queue ms] [-d one way delay ms] [-l loss percent] [-T] [-v]
+//
+// -T stamps every frame with a fixed increment, as the JNI sender used to:
+// only the loss based part can work then, and it lets the queue fill up. -v
+// prints one line per second. The run fails when the link is badly used or
+// overrun once the controller has had 10 s to settle before and after the step.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <deque>
+
+#include "RtpRateControl.h"
+#include "rtpteststream.h"
+
+#define SIM_FPS             30
+#define SIM_GOP             30
+#define SIM_KEYFRAME_SCALE  3.0     // an IDR against the average frame
+#define SIM_PAYLOAD         1200
+#define SIM_OVERHEAD        40      // RTP, UDP and IPv4 headers
+#define SIM_SETTLE_US       10000000LL
+
+struct SimPacket {
+    long long enqueueUs;
+    long long departUs;
+    uint16_t seq;
+    uint32_t timestamp;
+    size_t bytes;
+};
+
+struct Phase {
+    long long fromUs;
+    long long toUs;
+    uint32_t capacity;
+    uint64_t bytes;
+    uint64_t sent;
+    uint64_t dropped;
+    double queueMsSum;
+    uint64_t arrived;
+
+    double Utilization() const { return (double)bytes * 8 * 1000000.0 / (toUs - fromUs) / capacity; }
+    double Loss() const { return sent ? (double)dropped / sent : 0; }
+    double QueueMs() const { return arrived ? queueMsSum / arrived : 0; }
+};
+
+static void sAccount(Phase *phase, long long nowUs, const SimPacket *arrived, bool dropped) {
+    if (nowUs < phase->fromUs || nowUs >= phase->toUs)
+        return;
+    if (arrived == NULL) {
+        phase->sent++;
+        if (dropped)
+            phase->dropped++;
+        return;
+    }
+    phase->bytes += arrived->bytes;
+    phase->arrived++;
+    phase->queueMsSum += (arrived->departUs - arrived->enqueueUs) / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    int capacityKbps = 3000;
+    int stepKbps = 1200;
+    int stepS = 30;
+    int seconds = 60;
+    int queueMs = 300;
+    int delayMs = 20;
+    int lossPercent = 0;
+    bool legacyTimestamps = false;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:s:S:t:b:d:l:Tv")) != -1) {
+        switch (opt) {
+        case 'c': capacityKbps = atoi(optarg); break;
+        case 's': stepKbps = atoi(optarg); break;
+        case 'S': stepS = atoi(optarg); break;
+        case 't': seconds = atoi(optarg); break;
+        case 'b': queueMs = atoi(optarg); break;
+        case 'd': delayMs = atoi(optarg); break;
+        case 'l': lossPercent = atoi(optarg); break;
+        case 'T': legacyTimestamps = true; break;
+        case 'v': verbose = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-c kbit/s] [-s kbit/s after the step] [-S step second] [-t seconds]\n"
+                    "       [-b queue ms] [-d one way delay ms] [-l loss percent] [-T] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (capacityKbps <= 0 || stepKbps <= 0 || seconds <= 0 || stepS <= 0 || queueMs <= 0 || delayMs < 0
+            || lossPercent < 0 || lossPercent >= 100) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    RtpRateController::Config config;
+    RtpRateController::GetDefaultConfig(&config);
+    config.startBitrate = 1000000;
+    RtpRateController controller(config);
+
+    long long endUs = seconds * 1000000LL;
+    long long stepUs = stepS * 1000000LL;
+    long long delayUs = delayMs * 1000LL;
+    Phase phases[2] = {
+        { SIM_SETTLE_US, stepUs, (uint32_t)capacityKbps * 1000, 0, 0, 0, 0, 0 },
+        { stepUs + SIM_SETTLE_US, endUs, (uint32_t)stepKbps * 1000, 0, 0, 0, 0, 0 },
+    };
+
+    std::deque<SimPacket> link;         // queued or in flight, in departure order
+    std::deque<std::pair<long long, uint32_t> > feedback;  // (arrival at the sender, bitrate)
+    uint32_t encoderBitrate = config.startBitrate;
+    long long linkFreeUs = 0;
+    uint32_t seed = 1;
+    uint16_t seq = 0;
+    int frame = 0;
+    long long nextFrameUs = 0;
+
+    // receiver side, as RTPSourceData would count
+    RtpRateController::SourceStats source = RtpRateController::SourceStats();
+    bool haveSeq = false;
+    uint16_t highestSeq = 0;
+    uint32_t cycles = 0;
+    double jitter = 0;
+    long long lastTransitUs = 0;
+    bool haveTransit = false;
+
+    // per second
+    uint64_t secondBytes = 0, secondSent = 0, secondDropped = 0;
+    double secondQueueMs = 0;
+    uint64_t secondArrived = 0;
+
+    if (verbose)
+        printf("   s  capacity    target  received  loss%%  queue ms  usage  trend/threshold\n");
+    for (long long nowUs = 0; nowUs < endUs; nowUs += 1000) {
+        uint32_t capacity = (uint32_t)(nowUs < stepUs ? capacityKbps : stepKbps) * 1000;
+
+        while (!feedback.empty() && feedback.front().first <= nowUs) {
+            encoderBitrate = feedback.front().second;
+            feedback.pop_front();
+        }
+
+        // the encoder sends every frame as one burst
+        if (nowUs >= nextFrameUs) {
+            double average = (double)encoderBitrate / 8 / SIM_FPS;
+            // the IDR's extra bytes come out of the P frames of its GOP
+            double scale = frame % SIM_GOP == 0 ? SIM_KEYFRAME_SCALE
+                    : (SIM_GOP - SIM_KEYFRAME_SCALE) / (SIM_GOP - 1);
+            size_t size = (size_t)(average * scale);
+            uint32_t timestamp = legacyTimestamps ? (uint32_t)frame * 10 : (uint32_t)(nextFrameUs * 9 / 100);
+            while (size > 0) {
+                size_t payload = size > SIM_PAYLOAD ? SIM_PAYLOAD : size;
+                size -= payload;
+                SimPacket packet;
+                packet.enqueueUs = nowUs;
+                packet.seq = seq++;
+                packet.timestamp = timestamp;
+                packet.bytes = payload + SIM_OVERHEAD;
+
+                // drop-tail: the queue holds queueMs worth of the current capacity
+                long long backlogUs = linkFreeUs > nowUs ? linkFreeUs - nowUs : 0;
+                bool dropped = backlogUs > queueMs * 1000LL
+                        || sTestRand(&seed) % 100 < (uint32_t)lossPercent;
+                sAccount(&phases[0], nowUs, NULL, dropped);
+                sAccount(&phases[1], nowUs, NULL, dropped);
+                secondSent++;
+                if (dropped) {
+                    secondDropped++;
+                    // a random loss still took its time on the link
+                    if (backlogUs <= queueMs * 1000LL)
+                        linkFreeUs = (linkFreeUs > nowUs ? linkFreeUs : nowUs) + packet.bytes * 8 * 1000000LL / capacity;
+                    continue;
+                }
+                linkFreeUs = (linkFreeUs > nowUs ? linkFreeUs : nowUs) + packet.bytes * 8 * 1000000LL / capacity;
+                packet.departUs = linkFreeUs;
+                link.push_back(packet);
+            }
+            frame++;
+            nextFrameUs = frame * 1000000LL / SIM_FPS;
+        }
+
+        while (!link.empty() && link.front().departUs + delayUs <= nowUs) {
+            SimPacket packet = link.front();
+            link.pop_front();
+            long long arrivalUs = packet.departUs + delayUs;
+            controller.OnPacket(arrivalUs, packet.timestamp, packet.bytes);
+            sAccount(&phases[0], arrivalUs, &packet, false);
+            sAccount(&phases[1], arrivalUs, &packet, false);
+            secondBytes += packet.bytes;
+            secondArrived++;
+            secondQueueMs += (packet.departUs - packet.enqueueUs) / 1000.0;
+
+            if (!haveSeq) {
+                haveSeq = true;
+                highestSeq = packet.seq;
+            } else if ((int16_t)(uint16_t)(packet.seq - highestSeq) > 0) {
+                if (packet.seq < highestSeq)
+                    cycles += 0x10000;
+                highestSeq = packet.seq;
+            }
+            source.extendedHighestSeq = cycles + highestSeq;
+            source.packetsReceived++;
+            // RFC 3550 A.8
+            long long transitUs = arrivalUs - (long long)packet.timestamp * 100 / 9;
+            if (haveTransit) {
+                long long d = transitUs - lastTransitUs;
+                jitter += ((d < 0 ? -d : d) * 0.09 - jitter) / 16;
+            }
+            haveTransit = true;
+            lastTransitUs = transitUs;
+            source.jitter = (uint32_t)jitter;
+        }
+
+        if (controller.Update(nowUs, source))
+            feedback.push_back(std::make_pair(nowUs + delayUs, controller.GetTargetBitrate()));
+
+        if (verbose && (nowUs + 1000) % 1000000 == 0) {
+            const RtpRateController::Stats &stats = controller.GetStats();
+            static const char *usages[] = { "normal", "over", "under" };
+            printf("%4lld %9u %9u %9llu %6.1f %9.1f %6s %7.1f/%.1f%s\n", nowUs / 1000000, capacity,
+                   controller.GetTargetBitrate(), (unsigned long long)secondBytes * 8,
+                   secondSent ? 100.0 * secondDropped / secondSent : 0.0,
+                   secondArrived ? secondQueueMs / secondArrived : 0.0, usages[stats.usage], stats.trend,
+                   stats.threshold, stats.clockValid ? "" : " (loss only)");
+            secondBytes = secondSent = secondDropped = secondArrived = 0;
+            secondQueueMs = 0;
+        }
+    }
+
+    const RtpRateController::Stats &stats = controller.GetStats();
+    printf("%s timestamps, %d -> %d kbit/s at %d s, %d ms queue, %d ms delay, %d%% random loss\n",
+           legacyTimestamps ? "fixed increment" : "90 kHz", capacityKbps, stepKbps, stepS, queueMs, delayMs,
+           lossPercent);
+    int failures = 0;
+    for (int i = 0; i < 2; i++) {
+        const Phase &p = phases[i];
+        printf("%lld-%lld s: %.0f%% of %u kbit/s used, %.1f%% lost, %.1f ms queueing\n", p.fromUs / 1000000,
+               p.toUs / 1000000, p.Utilization() * 100, p.capacity / 1000, p.Loss() * 100, p.QueueMs());
+        // settled: most of the link used, not much more than random loss and, when
+        // the delay part can see it, the queue not standing full
+        if (p.toUs <= p.fromUs)
+            continue;
+        if (p.Utilization() < 0.5 || p.Loss() > lossPercent / 100.0 + 0.05
+                || (!legacyTimestamps && p.QueueMs() > queueMs * 0.75)) {
+            fprintf(stderr, "%lld-%lld s: controller did not settle\n", p.fromUs / 1000000, p.toUs / 1000000);
+            failures++;
+        }
+    }
+    printf("%llu updates, %llu delay based and %llu loss based decreases, final target %u bit/s\n",
+           (unsigned long long)stats.updates, (unsigned long long)stats.overuses,
+           (unsigned long long)stats.lossDecreases, controller.GetTargetBitrate());
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+// Loopback receive benchmark for RTPUDPv4Transmitter: bursts of RTP sized
+// datagrams are sent to the transmitter's RTP port from a plain UDP socket,
+// then Poll() drains them and the raw packets are taken and deleted, as
+// RTPSession does. The ioctl/recvfrom loop is compared with recvmmsg batches.
+//
+//   rtprecvbench [-n bursts] [-b packets per burst] [-s datagram size] [-m batch]
+//
+// Bursts stay small enough for the default net.core.rmem_max, so nothing is
+// lost in the kernel and every mode sees the same packets.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "rtpudpv4transmitter.h"
+#include "rtprawpacket.h"
+
+using namespace jrtplib;
+
+static long long sClockNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Result {
+    long long packets;
+    long long bad;
+    long long wallNs;
+    long long cpuNs;
+    long long polls;
+};
+
+static bool sRun(int batch, int bursts, int burst, size_t size, Result *result) {
+    memset(result, 0, sizeof(*result));
+
+    RTPUDPv4Transmitter transmitter(0);
+    RTPUDPv4TransmissionParams params;
+    params.SetPortbase(0);          // any free pair
+    params.SetRTPReceiveBuffer(4 * 1024 * 1024);
+    params.SetBatchReceive(batch);
+    if (transmitter.Init(false) < 0 || transmitter.Create(1400, &params) < 0) {
+        fprintf(stderr, "cannot create the transmitter\n");
+        return false;
+    }
+    RTPUDPv4TransmissionInfo *info = (RTPUDPv4TransmissionInfo *)transmitter.GetTransmissionInfo();
+    uint16_t port = info->GetRTPPort();
+    transmitter.DeleteTransmissionInfo(info);
+
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    uint8_t *datagram = (uint8_t *)malloc(size);
+    memset(datagram, 0, size);
+    datagram[0] = 0x80;             // RTP version 2
+    datagram[1] = 96;
+    for (int b = 0; b < bursts; b++) {
+        for (int i = 0; i < burst; i++) {
+            uint16_t seq = (uint16_t)(b * burst + i);
+            datagram[2] = seq >> 8;
+            datagram[3] = seq & 0xff;
+            datagram[size - 1] = (uint8_t)seq;
+            sendto(sender, datagram, size, 0, (struct sockaddr *)&to, sizeof(to));
+        }
+
+        long long received = 0;
+        long long wall = sClockNs(CLOCK_MONOTONIC);
+        long long cpu = sClockNs(CLOCK_THREAD_CPUTIME_ID);
+        // a burst normally takes one Poll; loopback delivery is synchronous
+        for (int tries = 0; received < burst && tries < 100; tries++) {
+            transmitter.Poll();
+            result->polls++;
+            RTPRawPacket *packet;
+            while ((packet = transmitter.GetNextPacket()) != 0) {
+                const uint8_t *data = packet->GetData();
+                uint16_t seq = (uint16_t)(data[2] << 8 | data[3]);
+                if (packet->GetDataLength() != size || data[size - 1] != (uint8_t)seq)
+                    result->bad++;
+                received++;
+                delete packet;
+            }
+        }
+        result->cpuNs += sClockNs(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        result->wallNs += sClockNs(CLOCK_MONOTONIC) - wall;
+        result->packets += received;
+    }
+
+    free(datagram);
+    close(sender);
+    transmitter.Destroy();
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int bursts = 2000;
+    int burst = 64;
+    int size = 1212;            // 1200 byte legacy slice + RTP header
+    int batch = 32;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:s:m:")) != -1) {
+        switch (opt) {
+        case 'n':
+            bursts = atoi(optarg);
+            break;
+        case 'b':
+            burst = atoi(optarg);
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 'm':
+            batch = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n bursts] [-b packets per burst] [-s datagram size] [-m batch]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (bursts <= 0 || burst <= 0 || size < 12 || size > 2048 || batch <= 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    printf("%d bursts of %d datagrams of %d bytes\n", bursts, burst, size);
+    const int modes[] = { 0, batch };
+    int failures = 0;
+    for (int m = 0; m < 2; m++) {
+        Result r;
+        if (!sRun(modes[m], bursts, burst, (size_t)size, &r))
+            return 1;
+        char name[32];
+        snprintf(name, sizeof(name), modes[m] ? "recvmmsg x%d" : "recvfrom", modes[m]);
+        double packets = r.packets > 0 ? (double)r.packets : 1;
+        printf("%-14s %10.0f packets/s %8.1f ns cpu/packet %6.2f polls/burst %lld/%lld received\n", name,
+               packets * 1e9 / (r.wallNs > 0 ? r.wallNs : 1), r.cpuNs / packets, (double)r.polls / bursts,
+               r.packets, (long long)bursts * burst);
+        if (r.packets != (long long)bursts * burst || r.bad) {
+            fprintf(stderr, "%s: %lld of %lld datagrams received, %lld corrupt\n", name, r.packets,
+                    (long long)bursts * burst, r.bad);
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+// Loopback send benchmark for RTPSession::SendPacketAfterSlice: an access unit
+// is fragmented and sent to a plain UDP socket, which then drains and checks
+// every datagram. Three paths are compared on the same transmitter:
+//
+//   copy      slice_data memcpy, RTPPacketBuilder copy and one sendto per fragment
+//   sendmmsg  headers built in place, payloads sent from the caller's buffer
+//   gso       as sendmmsg, with runs of fragments in one UDP_SEGMENT send
+//
+//   rtpsendbench [-n frames] [-s access unit bytes]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "rtpsession.h"
+#include "rtpsessionparams.h"
+#include "rtpudpv4transmitter.h"
+#include "rtpipv4address.h"
+
+using namespace jrtplib;
+
+// Refuses gathered sends, so the session takes the slice_data path.
+class CopyingTransmitter : public RTPUDPv4Transmitter
+{
+public:
+    CopyingTransmitter() : RTPUDPv4Transmitter(0) {}
+    int SendRTPDataGather(const RTPGatherPacket *, int) { return ERR_RTP_TRANS_NOGATHERSUPPORT; }
+};
+
+static long long sClockNs(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Result {
+    long long datagrams;
+    long long bad;
+    long long cpuNs;
+    uint64_t sendCalls;
+};
+
+// Checks the FU-A fragments of one unit and returns how many arrived.
+static int sDrain(int sock, const uint8_t *unit, size_t size, long long *bad) {
+    static uint8_t buf[65536];
+    size_t offset = 0;
+    int count = 0;
+    ssize_t len;
+
+    while ((len = recv(sock, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        // 12 byte RTP header, FU indicator, FU header, then the unit's own bytes
+        bool last = (buf[13] & 0x40) != 0;
+        size_t payload = (size_t)len - 14;
+        if ((buf[12] & 0x1f) != 28 || ((buf[13] & 0x80) != 0) != (offset == 0) || ((buf[1] & 0x80) != 0) != last
+                || offset + payload > size || memcmp(buf + 14, unit + offset, payload) != 0)
+            (*bad)++;
+        offset += payload;
+        count++;
+        if (last)
+            break;
+    }
+    if (offset != size)
+        (*bad)++;
+    return count;
+}
+
+static bool sRun(int mode, int frames, size_t size, const uint8_t *unit, Result *result) {
+    memset(result, 0, sizeof(*result));
+
+    int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(receiver, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in local;
+    socklen_t locallen = sizeof(local);
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(receiver, (struct sockaddr *)&local, sizeof(local));
+    getsockname(receiver, (struct sockaddr *)&local, &locallen);
+
+    CopyingTransmitter copying;
+    RTPUDPv4Transmitter gathering(0);
+    RTPUDPv4Transmitter *transmitter = mode == 0 ? &copying : &gathering;
+    RTPUDPv4TransmissionParams transparams;
+    transparams.SetPortbase(0);
+    transparams.SetSegmentationOffload(mode == 2);
+    RTPSessionParams sessionparams;
+    sessionparams.SetOwnTimestampUnit(1.0 / 90000.0);
+    sessionparams.SetCNAME("rtpsendbench");   // no login name in containers
+    RTPSession session;
+    uint8_t loopback[] = { 127, 0, 0, 1 };
+    int status;
+    if ((status = transmitter->Init(false)) < 0
+            || (status = transmitter->Create(sessionparams.GetMaximumPacketSize(), &transparams)) < 0
+            || (status = session.Create(sessionparams, transmitter)) < 0
+            || (status = session.AddDestination(RTPIPv4Address(loopback, ntohs(local.sin_port)))) < 0) {
+        fprintf(stderr, "cannot create the session: %s\n", RTPGetErrorString(status).c_str());
+        close(receiver);
+        return false;
+    }
+
+    for (int f = 0; f < frames; f++) {
+        long long cpu = sClockNs(CLOCK_THREAD_CPUTIME_ID);
+        session.SendPacketAfterSlice(unit, size, 96, true, 3000);
+        result->cpuNs += sClockNs(CLOCK_THREAD_CPUTIME_ID) - cpu;
+        result->datagrams += sDrain(receiver, unit, size, &result->bad);
+    }
+    result->sendCalls = transmitter->GetRTPSendCallCount();
+
+    session.Destroy();
+    transmitter->Destroy();
+    close(receiver);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 1000;
+    int size = 150 * 1024;      // a 1080p I-frame
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = atoi(optarg);
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-s access unit bytes]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (frames <= 0 || size < 2048 || size > 1024 * 1024) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    uint8_t *unit = (uint8_t *)malloc(size);
+    unit[0] = unit[1] = unit[2] = 0;
+    unit[3] = 1;
+    unit[4] = 0x65;
+    for (int i = 5; i < size; i++)
+        unit[i] = (uint8_t)(i * 7 + (i >> 8));
+
+    printf("%d access units of %d bytes\n", frames, size);
+    const char *names[] = { "copy", "sendmmsg", "gso" };
+    int failures = 0;
+    for (int mode = 0; mode < 3; mode++) {
+        Result r;
+        if (!sRun(mode, frames, (size_t)size, unit, &r)) {
+            free(unit);
+            return 1;
+        }
+        printf("%-14s %10.1f us cpu/unit %8.1f ns cpu/packet %8.1f send calls/unit %lld datagrams\n", names[mode],
+               r.cpuNs / 1000.0 / frames, r.datagrams ? (double)r.cpuNs / r.datagrams : 0.0,
+               (double)r.sendCalls / frames, r.datagrams);
+        if (r.bad) {
+            fprintf(stderr, "%s: %lld bad or missing fragments\n", names[mode], r.bad);
+            failures++;
+        }
+    }
+    free(unit);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,369 @@
+#ifndef __RTP_TEST_STREAM_H__
+#define __RTP_TEST_STREAM_H__
+
+// Host-side helpers for the depacketizer test and benchmark: a synthetic H.264
+// stream, the two packetizers we see on the wire (the legacy
+// RTPSession::SendPacketAfterSlice format and RFC 6184 FU-A/STAP-A), and a
+// minimal classic pcap reader/writer so captured sessions can be replayed.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <JRTPLIB/src/rtppacket.h>
+#include <JRTPLIB/src/rtprawpacket.h>
+#include <JRTPLIB/src/rtptimeutilities.h>
+
+typedef std::vector<uint8_t> ByteVector;
+
+struct TestRtpPacket {
+    ByteVector bytes;           // complete RTP packet, header included
+    long long recvTimeUs;
+};
+
+static inline uint32_t sTestRand(uint32_t *state) {
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 8;
+}
+
+// A NAL with a 4-byte start code; the body never contains zero bytes so no
+// emulation prevention is needed and no false start code can appear.
+static inline ByteVector sMakeNal(uint8_t header, size_t bodyLen, uint32_t *seed) {
+    ByteVector nal;
+    nal.reserve(bodyLen + 5);
+    nal.push_back(0); nal.push_back(0); nal.push_back(0); nal.push_back(1);
+    nal.push_back(header);
+    for (size_t i = 0; i < bodyLen; i++) {
+        nal.push_back((uint8_t)(sTestRand(seed) % 255 + 1));
+    }
+    return nal;
+}
+
+// One encoder output buffer, as MediaMuxerWrapper hands it to the JNI layer:
+// either SPS+PPS in one buffer or a single slice.
+struct TestFrame {
+    ByteVector data;            // Annex-B
+    std::vector<size_t> nalOffsets;
+    bool keyframe;
+};
+
+// gop frames per IDR; every IDR is preceded by an SPS+PPS buffer
+static inline std::vector<TestFrame> sMakeStream(int frames, int gop, size_t idrSize, size_t pSize,
+        uint32_t seed) {
+    std::vector<TestFrame> out;
+    for (int i = 0; i < frames; i++) {
+        if (i % gop == 0) {
+            TestFrame ps;
+            ByteVector sps = sMakeNal(0x67, 12, &seed);
+            ByteVector pps = sMakeNal(0x68, 4, &seed);
+            ps.nalOffsets.push_back(0);
+            ps.nalOffsets.push_back(sps.size());
+            ps.data = sps;
+            ps.data.insert(ps.data.end(), pps.begin(), pps.end());
+            ps.keyframe = false;
+            out.push_back(ps);
+
+            TestFrame idr;
+            idr.data = sMakeNal(0x65, idrSize, &seed);
+            idr.nalOffsets.push_back(0);
+            idr.keyframe = true;
+            out.push_back(idr);
+        } else {
+            TestFrame p;
+            p.data = sMakeNal(0x41, pSize + sTestRand(&seed) % (pSize / 4 + 1), &seed);
+            p.nalOffsets.push_back(0);
+            p.keyframe = false;
+            out.push_back(p);
+        }
+    }
+    return out;
+}
+
+class TestPacketizer
+{
+public:
+    TestPacketizer(uint32_t ssrc = 0x12345678, uint16_t seq = 1000, uint32_t timestamp = 90000)
+        : mSsrc(ssrc), mSeq(seq), mTimestamp(timestamp), mRecvTimeUs(1000000) {}
+
+    void SetSequenceNumber(uint16_t seq) { mSeq = seq; }
+
+    // Mirrors RTPSession::SendPacketAfterSlice with the fixed timestamp increments
+    // the JNI sender used to stamp: payloads keep their start codes, FU-A
+    // fragments carry raw bytes.
+    void AddLegacy(const ByteVector &buf, size_t sliceMax, std::vector<TestRtpPacket> &out) {
+        if (buf.size() > sliceMax) {
+            uint8_t nalHeader = buf[4];
+            size_t n = (buf.size() + sliceMax - 1) / sliceMax;
+            for (size_t step = 0; step < n; step++) {
+                size_t off = step * sliceMax;
+                size_t len = buf.size() - off < sliceMax ? buf.size() - off : sliceMax;
+                ByteVector payload;
+                payload.push_back((nalHeader & 0xe0) | 28);
+                uint8_t fuHeader = nalHeader & 0x1f;
+                if (step == 0)
+                    fuHeader |= 0x80;
+                if (step == n - 1)
+                    fuHeader |= 0x40;
+                payload.push_back(fuHeader);
+                payload.insert(payload.end(), buf.begin() + off, buf.begin() + off + len);
+                Emit(payload, step == n - 1, step == 0 ? 10 : 0, out);
+            }
+        } else {
+            Emit(buf, true, 10, out);
+        }
+        mRecvTimeUs += 33333;
+    }
+
+    // The same payloads as the JNI sender now sends them: every packet of the
+    // buffer carries timestamp, and the last one is marked when the buffer
+    // ends a picture (not for the SPS+PPS buffer ahead of an IDR).
+    void AddTimed(const ByteVector &buf, size_t sliceMax, uint32_t timestamp, bool endOfFrame,
+            std::vector<TestRtpPacket> &out) {
+        mTimestamp = timestamp;
+        size_t first = out.size();
+        AddLegacy(buf, sliceMax, out);
+        for (size_t i = first; i < out.size(); i++) {
+            TestRtpPacket &p = out[i];
+            p.bytes[1] = (uint8_t)((i + 1 == out.size() && endOfFrame ? 0x80 : 0) | 96);
+            p.bytes[4] = (uint8_t)(timestamp >> 24);
+            p.bytes[5] = (uint8_t)(timestamp >> 16);
+            p.bytes[6] = (uint8_t)(timestamp >> 8);
+            p.bytes[7] = (uint8_t)timestamp;
+        }
+    }
+
+    // RFC 6184 non-interleaved mode: STAP-A for buffers with several small
+    // NALs, FU-A for NALs above mtu, single NAL packets otherwise.
+    void AddRfc(const TestFrame &frame, size_t mtu, std::vector<TestRtpPacket> &out) {
+        std::vector<ByteVector> nals;
+        for (size_t i = 0; i < frame.nalOffsets.size(); i++) {
+            size_t begin = frame.nalOffsets[i] + 4;
+            size_t end = i + 1 < frame.nalOffsets.size() ? frame.nalOffsets[i + 1] : frame.data.size();
+            nals.push_back(ByteVector(frame.data.begin() + begin, frame.data.begin() + end));
+        }
+        if (nals.size() > 1) {
+            ByteVector payload;
+            payload.push_back((nals[0][0] & 0x60) | 24);
+            for (size_t i = 0; i < nals.size(); i++) {
+                payload.push_back((uint8_t)(nals[i].size() >> 8));
+                payload.push_back((uint8_t)nals[i].size());
+                payload.insert(payload.end(), nals[i].begin(), nals[i].end());
+            }
+            Emit(payload, false, 0, out);
+        } else if (nals[0].size() <= mtu) {
+            Emit(nals[0], true, 0, out);
+        } else {
+            const ByteVector &nal = nals[0];
+            size_t off = 1;
+            while (off < nal.size()) {
+                size_t len = nal.size() - off < mtu ? nal.size() - off : mtu;
+                ByteVector payload;
+                payload.push_back((nal[0] & 0xe0) | 28);
+                uint8_t fuHeader = nal[0] & 0x1f;
+                if (off == 1)
+                    fuHeader |= 0x80;
+                if (off + len == nal.size())
+                    fuHeader |= 0x40;
+                payload.push_back(fuHeader);
+                payload.insert(payload.end(), nal.begin() + off, nal.begin() + off + len);
+                off += len;
+                Emit(payload, off == nal.size(), 0, out);
+            }
+        }
+        if (!nals.empty() && (nals.back()[0] & 0x1f) <= 5) {
+            // one frame per buffer, the next slice belongs to a new picture
+            mTimestamp += 3000;
+        }
+        mRecvTimeUs += 33333;
+    }
+
+private:
+    void Emit(const ByteVector &payload, bool marker, uint32_t tsinc, std::vector<TestRtpPacket> &out) {
+        TestRtpPacket p;
+        p.bytes.resize(12);
+        p.bytes[0] = 0x80;
+        p.bytes[1] = (uint8_t)((marker ? 0x80 : 0) | 96);
+        p.bytes[2] = (uint8_t)(mSeq >> 8);
+        p.bytes[3] = (uint8_t)mSeq;
+        p.bytes[4] = (uint8_t)(mTimestamp >> 24);
+        p.bytes[5] = (uint8_t)(mTimestamp >> 16);
+        p.bytes[6] = (uint8_t)(mTimestamp >> 8);
+        p.bytes[7] = (uint8_t)mTimestamp;
+        p.bytes[8] = (uint8_t)(mSsrc >> 24);
+        p.bytes[9] = (uint8_t)(mSsrc >> 16);
+        p.bytes[10] = (uint8_t)(mSsrc >> 8);
+        p.bytes[11] = (uint8_t)mSsrc;
+        p.bytes.insert(p.bytes.end(), payload.begin(), payload.end());
+        p.recvTimeUs = mRecvTimeUs;
+        out.push_back(p);
+        mSeq++;
+        // RTPPacketBuilder adds the increment after the packet went out
+        mTimestamp += tsinc;
+    }
+
+    uint32_t mSsrc;
+    uint16_t mSeq;
+    uint32_t mTimestamp;
+    long long mRecvTimeUs;
+};
+
+// Parses the bytes the way RTPSession does for incoming data. The caller owns
+// the result; NULL if the bytes are not a valid RTP packet.
+static inline jrtplib::RTPPacket *sParseRtp(const uint8_t *data, size_t len, long long recvTimeUs) {
+    uint8_t *copy = new uint8_t[len];
+    memcpy(copy, data, len);
+    jrtplib::RTPTime t(recvTimeUs / 1000000, (uint32_t)(recvTimeUs % 1000000));
+    jrtplib::RTPRawPacket raw(copy, len, NULL, t, true);
+    jrtplib::RTPPacket *packet = new jrtplib::RTPPacket(raw);
+    if (packet->GetCreationError() < 0) {
+        delete packet;
+        return NULL;
+    }
+    return packet;
+}
+
+// ---- classic libpcap files ----
+
+#define PCAP_MAGIC_US       0xa1b2c3d4
+#define PCAP_MAGIC_NS       0xa1b23c4d
+#define PCAP_LINK_ETHERNET  1
+#define PCAP_LINK_RAW       101
+#define PCAP_LINK_SLL       113
+#define PCAP_LINK_IPV4      228
+
+static inline uint32_t sPcapSwap32(uint32_t v, bool swap) {
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+static inline uint16_t sPcapSwap16(uint16_t v, bool swap) {
+    return swap ? __builtin_bswap16(v) : v;
+}
+
+// Extracts the UDP payloads of IPv4 packets from a pcap file. port == 0
+// accepts any destination port. Returns the number of packets read, < 0 if
+// the file cannot be used.
+static inline int sReadPcap(const char *path, uint16_t port, std::vector<TestRtpPacket> &out) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    uint32_t hdr[6];
+    if (fread(hdr, sizeof(hdr), 1, fp) != 1) {
+        fclose(fp);
+        return -1;
+    }
+    bool swap, nano;
+    if (hdr[0] == PCAP_MAGIC_US || hdr[0] == PCAP_MAGIC_NS) {
+        swap = false;
+    } else if (__builtin_bswap32(hdr[0]) == PCAP_MAGIC_US || __builtin_bswap32(hdr[0]) == PCAP_MAGIC_NS) {
+        swap = true;
+    } else {
+        fclose(fp);
+        return -1;
+    }
+    nano = sPcapSwap32(hdr[0], swap) == PCAP_MAGIC_NS;
+    uint32_t linktype = sPcapSwap32(hdr[5], swap) & 0x0fffffff;
+
+    int count = 0;
+    ByteVector frame;
+    uint32_t rec[4];
+    while (fread(rec, sizeof(rec), 1, fp) == 1) {
+        uint32_t caplen = sPcapSwap32(rec[2], swap);
+        if (caplen > 256 * 1024)
+            break;
+        frame.resize(caplen);
+        if (caplen > 0 && fread(frame.data(), caplen, 1, fp) != 1)
+            break;
+
+        size_t off;
+        uint16_t etherType = 0x0800;
+        if (linktype == PCAP_LINK_ETHERNET) {
+            if (caplen < 14)
+                continue;
+            off = 14;
+            etherType = (uint16_t)(frame[12] << 8 | frame[13]);
+            if (etherType == 0x8100 && caplen >= 18) {
+                etherType = (uint16_t)(frame[16] << 8 | frame[17]);
+                off = 18;
+            }
+        } else if (linktype == PCAP_LINK_SLL) {
+            if (caplen < 16)
+                continue;
+            off = 16;
+            etherType = (uint16_t)(frame[14] << 8 | frame[15]);
+        } else if (linktype == PCAP_LINK_RAW || linktype == PCAP_LINK_IPV4) {
+            off = 0;
+        } else {
+            fclose(fp);
+            return -1;
+        }
+        if (etherType != 0x0800 || off + 20 > caplen || (frame[off] >> 4) != 4 || frame[off + 9] != 17)
+            continue;
+        size_t ihl = (frame[off] & 0x0f) * 4;
+        // fragmented datagrams are not reassembled
+        if ((frame[off + 6] & 0x3f) != 0 || frame[off + 7] != 0)
+            continue;
+        size_t udp = off + ihl;
+        if (udp + 8 > caplen)
+            continue;
+        uint16_t dport = (uint16_t)(frame[udp + 2] << 8 | frame[udp + 3]);
+        uint16_t ulen = (uint16_t)(frame[udp + 4] << 8 | frame[udp + 5]);
+        if (port != 0 && dport != port)
+            continue;
+        if (ulen < 8 || udp + ulen > caplen)
+            continue;
+
+        TestRtpPacket p;
+        p.bytes.assign(frame.begin() + udp + 8, frame.begin() + udp + ulen);
+        uint32_t sec = sPcapSwap32(rec[0], swap);
+        uint32_t frac = sPcapSwap32(rec[1], swap);
+        p.recvTimeUs = (long long)sec * 1000000LL + (nano ? frac / 1000 : frac);
+        out.push_back(p);
+        count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+// Writes the packets as IPv4/UDP over raw IP (linktype 101), enough for
+// sReadPcap and for wireshark's "decode as RTP".
+static inline int sWritePcap(const char *path, uint16_t port, const std::vector<TestRtpPacket> &packets) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return -1;
+    uint32_t hdr[6] = { PCAP_MAGIC_US, 0x00040002, 0, 0, 65535, PCAP_LINK_RAW };
+    fwrite(hdr, sizeof(hdr), 1, fp);
+    for (size_t i = 0; i < packets.size(); i++) {
+        const ByteVector &rtp = packets[i].bytes;
+        uint8_t ip[28];
+        memset(ip, 0, sizeof(ip));
+        uint16_t total = (uint16_t)(rtp.size() + 28);
+        ip[0] = 0x45;
+        ip[2] = (uint8_t)(total >> 8);
+        ip[3] = (uint8_t)total;
+        ip[8] = 64;
+        ip[9] = 17;
+        ip[12] = 127; ip[15] = 1;
+        ip[16] = 127; ip[19] = 1;
+        ip[20] = (uint8_t)(port >> 8);
+        ip[21] = (uint8_t)port;
+        ip[22] = (uint8_t)(port >> 8);
+        ip[23] = (uint8_t)port;
+        ip[24] = (uint8_t)((rtp.size() + 8) >> 8);
+        ip[25] = (uint8_t)(rtp.size() + 8);
+        uint32_t rec[4];
+        rec[0] = (uint32_t)(packets[i].recvTimeUs / 1000000);
+        rec[1] = (uint32_t)(packets[i].recvTimeUs % 1000000);
+        rec[2] = rec[3] = total;
+        fwrite(rec, sizeof(rec), 1, fp);
+        fwrite(ip, sizeof(ip), 1, fp);
+        fwrite(rtp.data(), rtp.size(), 1, fp);
+    }
+    fclose(fp);
+    return 0;
+}
+
+#endif // __RTP_TEST_STREAM_H__
@@ -0,0 +1,290 @@
+// Host test for the receive thread setup: the scheduling options of
+// Common/thread and JThread (affinity, nice value, the real-time policy and
+// its fallback without CAP_SYS_NICE, the run delay counters), and the epoll
+// wait of RTPUDPv4Transmitter (timeouts, data, AbortWait) with the socket
+// drop count of the batch receive path.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "Common/thread/thread.h"
+#include "jthread/jthread.h"
+#include "testharness.h"
+
+#include "rtpudpv4transmitter.h"
+#include "rtprawpacket.h"
+#include "rtptimeutilities.h"
+
+using namespace jrtplib;
+
+static long long sNowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// The last CPU the process may run on, so pinning to it is allowed.
+static int sLastAllowedCpu() {
+    cpu_set_t set;
+    int last = 0;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                last = cpu;
+        }
+    }
+    return last;
+}
+
+struct Observed {
+    int cpu;
+    int policy;
+    int nice;
+};
+
+static void sObserve(Observed *observed) {
+    struct sched_param param;
+    // a little work, so there are timeslices and context switches to count
+    for (int i = 0; i < 20; i++)
+        usleep(1000);
+    observed->cpu = sched_getcpu();
+    pthread_getschedparam(pthread_self(), &observed->policy, &param);
+    observed->nice = getpriority(PRIO_PROCESS, 0);
+}
+
+static void sThreadFunc(void *userdata) {
+    sObserve((Observed *)userdata);
+}
+
+static void testThreadAffinityAndNice() {
+    int cpu = sLastAllowedCpu();
+    Observed observed;
+    ThreadSched sched;
+    ThreadSchedStats stats;
+    RTPThread *t = Thread_Create(sThreadFunc, &observed);
+
+    EXPECT(Thread_GetSchedStats(t, &stats) < 0);    // not started yet
+    memset(&sched, 0, sizeof(sched));
+    sched.policy = SCHED_OTHER;
+    sched.nice = 5;
+    sched.cpus = 1ULL << cpu;
+    EXPECT(Thread_SetSched(t, &sched) == 0);
+    EXPECT(Thread_Run(t) == 0);
+    Thread_Join(t);
+    EXPECT(observed.cpu == cpu);
+    EXPECT(observed.policy == SCHED_OTHER);
+    EXPECT(observed.nice == 5);
+    // final counters, after the thread returned
+    EXPECT(Thread_GetSchedStats(t, &stats) == 0);
+    EXPECT(stats.policy == SCHED_OTHER);
+    EXPECT(stats.nice == 5);
+    EXPECT(stats.cpus == (1ULL << cpu));
+    EXPECT(stats.timeslices > 0);
+    EXPECT(stats.voluntary_switches >= 20);
+    Thread_Destroy(t);
+
+    sched.policy = 42;
+    t = Thread_Create(sThreadFunc, &observed);
+    EXPECT(Thread_SetSched(t, &sched) < 0);
+    Thread_Destroy(t);
+    printf("testThreadAffinityAndNice passed\n");
+}
+
+// SCHED_FIFO where the process may use it, SCHED_OTHER at the nice value
+// where it may not; the stats say which one it got.
+static void testThreadRealtimeOrFallback() {
+    Observed observed;
+    ThreadSched sched;
+    ThreadSchedStats stats;
+    RTPThread *t = Thread_Create(sThreadFunc, &observed);
+
+    memset(&sched, 0, sizeof(sched));
+    sched.policy = SCHED_FIFO;
+    sched.priority = 2;
+    sched.nice = 3;
+    EXPECT(Thread_SetSched(t, &sched) == 0);
+    EXPECT(Thread_Run(t) == 0);
+    Thread_Join(t);
+    EXPECT(Thread_GetSchedStats(t, &stats) == 0);
+    EXPECT(stats.policy == observed.policy);
+    if (stats.policy == SCHED_FIFO) {
+        EXPECT(stats.priority == 2);
+    } else {
+        EXPECT(stats.policy == SCHED_OTHER);
+        EXPECT(stats.nice == 3 && observed.nice == 3);
+    }
+    printf("testThreadRealtimeOrFallback passed (%s)\n", stats.policy == SCHED_FIFO ? "SCHED_FIFO" : "fallback");
+    Thread_Destroy(t);
+}
+
+class ObservingThread : public jthread::JThread {
+public:
+    Observed observed;
+    void *Thread() {
+        ThreadStarted();
+        sObserve(&observed);
+        return 0;
+    }
+};
+
+static void testJThreadScheduling() {
+    int cpu = sLastAllowedCpu();
+    ObservingThread thread;
+    jthread::JThreadSchedulingStats stats;
+
+    EXPECT(thread.GetSchedulingStats(&stats) == ERR_JTHREAD_NOTRUNNING);
+    EXPECT(thread.SetScheduling(42, 0, 0) == ERR_JTHREAD_INVALIDSCHEDULING);
+    EXPECT(thread.SetScheduling(SCHED_RR, 1, 4, 1ULL << cpu) == 0);
+    EXPECT(thread.Start() == 0);
+    // live counters while it runs
+    EXPECT(thread.GetSchedulingStats(&stats) == 0);
+    EXPECT(stats.cpumask == (1ULL << cpu));
+    while (thread.IsRunning())
+        usleep(1000);
+    EXPECT(thread.GetSchedulingStats(&stats) == 0);
+    EXPECT(thread.observed.cpu == cpu);
+    EXPECT(stats.policy == thread.observed.policy);
+    if (stats.policy == SCHED_RR) {
+        EXPECT(stats.priority == 1);
+    } else {
+        EXPECT(stats.nice == 4 && thread.observed.nice == 4);
+    }
+    EXPECT(stats.timeslices > 0);
+    printf("testJThreadScheduling passed\n");
+}
+
+static bool sCreateTransmitter(RTPUDPv4Transmitter *transmitter, int batch, int rcvbuf) {
+    RTPUDPv4TransmissionParams transparams;
+    transparams.SetPortbase(0);
+    transparams.SetBindIP(ntohl(inet_addr("127.0.0.1")));
+    transparams.SetBatchReceive(batch);
+    if (rcvbuf > 0)
+        transparams.SetRTPReceiveBuffer(rcvbuf);
+    int status;
+    if ((status = transmitter->Init(true)) < 0 || (status = transmitter->Create(1400, &transparams)) < 0) {
+        fprintf(stderr, "cannot create the transmitter: %s\n", RTPGetErrorString(status).c_str());
+        return false;
+    }
+    return true;
+}
+
+static uint16_t sRtpPort(RTPUDPv4Transmitter *transmitter) {
+    RTPUDPv4TransmissionInfo *info = (RTPUDPv4TransmissionInfo *)transmitter->GetTransmissionInfo();
+    uint16_t port = info->GetRTPPort();
+    transmitter->DeleteTransmissionInfo(info);
+    return port;
+}
+
+static void sSendTo(int sock, uint16_t port, int count, size_t size) {
+    uint8_t buf[1400];
+    struct sockaddr_in addr;
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 0x80;
+    buf[1] = 96;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    for (int i = 0; i < count; i++)
+        sendto(sock, buf, size, 0, (struct sockaddr *)&addr, sizeof(addr));
+}
+
+static void *sAbortLater(void *userdata) {
+    usleep(50000);
+    ((RTPUDPv4Transmitter *)userdata)->AbortWait();
+    return 0;
+}
+
+static void testEpollWait() {
+    RTPUDPv4Transmitter transmitter(0);
+    if (!sCreateTransmitter(&transmitter, 0, 0)) {
+        sFailures++;
+        return;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    bool available = true;
+
+    // times out, and a sub-millisecond delay still sleeps rather than spins
+    long long start = sNowUs();
+    EXPECT(transmitter.WaitForIncomingData(RTPTime(0.030), &available) == 0);
+    EXPECT(!available);
+    EXPECT(sNowUs() - start >= 29000);
+    start = sNowUs();
+    EXPECT(transmitter.WaitForIncomingData(RTPTime(0.0002), &available) == 0);
+    EXPECT(sNowUs() - start >= 200);
+
+    sSendTo(sock, sRtpPort(&transmitter), 1, 100);
+    start = sNowUs();
+    EXPECT(transmitter.WaitForIncomingData(RTPTime(5.0), &available) == 0);
+    EXPECT(available);
+    EXPECT(sNowUs() - start < 1000000);
+    EXPECT(transmitter.Poll() == 0);
+    EXPECT(transmitter.NewDataAvailable());
+    delete transmitter.GetNextPacket();
+
+    pthread_t aborter;
+    pthread_create(&aborter, 0, sAbortLater, &transmitter);
+    start = sNowUs();
+    EXPECT(transmitter.WaitForIncomingData(RTPTime(5.0), &available) == 0);
+    EXPECT(!available);
+    EXPECT(sNowUs() - start < 1000000);
+    pthread_join(aborter, 0);
+
+    close(sock);
+    transmitter.Destroy();
+    printf("testEpollWait passed\n");
+}
+
+// A burst into a small receive buffer: the drops show up once the next
+// datagram after them is read.
+static void testSocketDropCount() {
+    RTPUDPv4Transmitter transmitter(0);
+    if (!sCreateTransmitter(&transmitter, 16, 8 * 1024)) {
+        sFailures++;
+        return;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    uint16_t port = sRtpPort(&transmitter);
+
+    EXPECT(transmitter.GetSocketDropCount() == 0);
+    sSendTo(sock, port, 500, 1200);
+    EXPECT(transmitter.Poll() == 0);
+    int received = 0;
+    while (transmitter.NewDataAvailable()) {
+        delete transmitter.GetNextPacket();
+        received++;
+    }
+    EXPECT(received > 0 && received < 500);
+    sSendTo(sock, port, 1, 1200);
+    EXPECT(transmitter.WaitForIncomingData(RTPTime(1.0)) == 0);
+    EXPECT(transmitter.Poll() == 0);
+    while (transmitter.NewDataAvailable())
+        delete transmitter.GetNextPacket();
+    EXPECT(transmitter.GetSocketDropCount() == (uint64_t)(500 - received));
+
+    close(sock);
+    transmitter.Destroy();
+    printf("testSocketDropCount passed (%d of 500 dropped)\n", 500 - received);
+}
+
+int main() {
+    testThreadAffinityAndNice();
+    testThreadRealtimeOrFallback();
+    testJThreadScheduling();
+    testEpollWait();
+    testSocketDropCount();
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("rtpthreadtest: all passed\n");
+    return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef __TEST_HARNESS_H__
+#define __TEST_HARNESS_H__
+
+// The host tests' check macro: a failed EXPECT is reported with its location
+// and counted in sFailures, which main turns into the exit status.
+
+#include <stdio.h>
+
+static int sFailures = 0;
+
+#define EXPECT(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__, __LINE__, #cond); \
+        sFailures++; \
+    } \
+} while (0)
+
+#endif // __TEST_HARNESS_H__
@@ -0,0 +1,109 @@
+// Microbenchmark for the camera HAL pixel kernels (camera_vir/device/
+// VirtualCameraConvert) at the 1280x800 IR frame size: YUYV -> NV12 / I420,
+// the IR limit and the 16 -> 8 bit grey NV12 the output thread builds, for
+// every kernel set the CPU supports, next to the yuyv_to_nv12 byte loops they
+// replaced.
+//
+//   vircamconvertbench [-n frames] [-w width] [-h height]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "VirtualCameraConvert.h"
+
+using virtuals::VirCamConvert;
+
+static long long sCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// yuyv_to_nv12 from VirtualCameraDeviceSession.cpp, for one frame
+static void sLegacyYuyvToNv12(const char* image_in, char* image_out, int width, int height) {
+    int pixNUM = width * height;
+    char* y = image_out;
+    char* uv = image_out + pixNUM;
+    int index = 0;
+    for (int j = 0; j < pixNUM * 2; j = j + 2) {
+        *(y + index) = *(image_in + j);
+        index++;
+    }
+    int uv_index = 0;
+    for (int j = 0; j < height; j = j + 2) {
+        for (int k = j * width * 2 + 1; k < width * 2 * (j + 1); k = k + 4) {
+            *(uv + uv_index) = *(image_in + k);
+            *(uv + uv_index + 1) = *(image_in + k + 2);
+            uv_index += 2;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 100, width = 1280, height = 800;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:h:")) != -1) {
+        switch (opt) {
+        case 'n': frames = atoi(optarg); break;
+        case 'w': width = atoi(optarg) & ~1; break;
+        case 'h': height = atoi(optarg) & ~1; break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-w width] [-h height]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    size_t count = (size_t)width * height;
+    std::vector<uint16_t> raw(count), limited(count);
+    for (size_t i = 0; i < count; i++)
+        raw[i] = (uint16_t)((i * 13 + (i >> 10)) & 0x3ff);
+    std::vector<uint8_t> yuyv(count * 2);
+    for (size_t i = 0; i < yuyv.size(); i++)
+        yuyv[i] = (uint8_t)(i * 7 + (i >> 12));
+    std::vector<uint8_t> out(count * 3 / 2);
+
+    printf("%dx%d, %d frames, CPU ms per frame\n", width, height, frames);
+    long long t = sCpuNs();
+    for (int f = 0; f < frames; f++) {
+        sLegacyYuyvToNv12((const char*)raw.data(), (char*)out.data(), width, height);
+        memset(out.data() + count, 0x80, count / 2);
+    }
+    printf("  %-6s grey-nv12 %6.3f\n", "legacy", (sCpuNs() - t) / (frames * 1e6));
+
+    static const VirCamConvert::Isa isas[] = {
+        VirCamConvert::ISA_C, VirCamConvert::ISA_SSE2, VirCamConvert::ISA_NEON
+    };
+    for (VirCamConvert::Isa isa : isas) {
+        if (VirCamConvert::setIsa(isa) < 0)
+            continue;
+        double ms[4];
+        t = sCpuNs();
+        for (int f = 0; f < frames; f++)
+            VirCamConvert::yuyvToNv12(yuyv.data(), width * 2, out.data(), width,
+                    out.data() + count, width, width, height);
+        ms[0] = (sCpuNs() - t) / (frames * 1e6);
+        t = sCpuNs();
+        for (int f = 0; f < frames; f++)
+            VirCamConvert::yuyvToI420(yuyv.data(), width * 2, out.data(), width,
+                    out.data() + count, out.data() + count * 5 / 4, width / 2, width, height);
+        ms[1] = (sCpuNs() - t) / (frames * 1e6);
+        t = sCpuNs();
+        for (int f = 0; f < frames; f++)
+            VirCamConvert::narrow16(raw.data(), limited.data(), count, VirCamConvert::kIrLimit);
+        ms[2] = (sCpuNs() - t) / (frames * 1e6);
+        t = sCpuNs();
+        for (int f = 0; f < frames; f++)
+            VirCamConvert::narrow16ToGreyNv12(limited.data(), out.data(), width, height,
+                    VirCamConvert::kLowByte);
+        ms[3] = (sCpuNs() - t) / (frames * 1e6);
+        printf("  %-6s grey-nv12 %6.3f  yuyv->nv12 %6.3f  yuyv->i420 %6.3f  ir-limit %6.3f\n",
+                VirCamConvert::isaName(isa), ms[3], ms[0], ms[1], ms[2]);
+    }
+    VirCamConvert::setIsa(VirCamConvert::ISA_AUTO);
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Host unit test for the camera HAL pixel kernels (camera_vir/device/
+// VirtualCameraConvert): golden pixels, bit-exact agreement with the loops
+// they replaced (yuyv_to_nv12 plus the grey chroma fill, ir_limit_max), and
+// agreement of every SIMD kernel set the CPU supports with the C one over
+// odd widths, heights, counts and padded strides.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "VirtualCameraConvert.h"
+#include "testharness.h"
+
+using virtuals::VirCamConvert;
+
+static const VirCamConvert::Isa sIsas[] = {
+    VirCamConvert::ISA_C, VirCamConvert::ISA_SSE2, VirCamConvert::ISA_NEON
+};
+
+// yuyv_to_nv12 from VirtualCameraDeviceSession.cpp, for one frame
+static void sLegacyYuyvToNv12(const uint8_t* in, uint8_t* out, int width, int height) {
+    int pixNUM = width * height;
+    uint8_t* y = out;
+    uint8_t* uv = out + pixNUM;
+    for (int j = 0; j < pixNUM * 2; j += 2)
+        *y++ = in[j];
+    int uv_index = 0;
+    for (int j = 0; j < height; j += 2) {
+        for (int k = j * width * 2 + 1; k < width * 2 * (j + 1); k += 4) {
+            uv[uv_index] = in[k];
+            uv[uv_index + 1] = in[k + 2];
+            uv_index += 2;
+        }
+    }
+}
+
+// the NEON ir_limit_max, in C; it dropped the last n % 8 samples
+static void sLegacyIrLimitMax(const uint16_t* src, int n, uint16_t* dest) {
+    for (int i = 0; i < n / 8 * 8; i++) {
+        uint16_t v = src[i] > 64 ? src[i] - 64 : 0;
+        dest[i] = v < 0xff ? v : 0xff;
+    }
+}
+
+static void sFill(std::vector<uint8_t>& buf, unsigned int seed) {
+    for (size_t i = 0; i < buf.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+static void sFill16(std::vector<uint16_t>& buf, unsigned int seed, uint16_t mask) {
+    for (size_t i = 0; i < buf.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = (uint16_t)(seed >> 12) & mask;
+    }
+    // the edges of every narrowing
+    if (buf.size() >= 6) {
+        buf[0] = 0;
+        buf[1] = 64;
+        buf[2] = 65;
+        buf[3] = 64 + 255;
+        buf[4] = 64 + 256;
+        buf[5] = mask;
+    }
+}
+
+static void testGolden() {
+    // two rows of four pixels: Y0 U Y1 V ...
+    const uint8_t yuyv[16] = {
+        10, 100, 11, 200,   12, 101, 13, 201,
+        20, 110, 21, 210,   22, 111, 23, 211,
+    };
+    uint8_t nv12[12];
+    uint8_t i420[12];
+    VirCamConvert::yuyvToNv12(yuyv, 8, nv12, 4, nv12 + 8, 4, 4, 2);
+    const uint8_t nv12Expected[12] = { 10, 11, 12, 13, 20, 21, 22, 23, 100, 200, 101, 201 };
+    EXPECT(memcmp(nv12, nv12Expected, sizeof(nv12)) == 0);
+    VirCamConvert::yuyvToI420(yuyv, 8, i420, 4, i420 + 8, i420 + 10, 2, 4, 2);
+    const uint8_t i420Expected[12] = { 10, 11, 12, 13, 20, 21, 22, 23, 100, 101, 200, 201 };
+    EXPECT(memcmp(i420, i420Expected, sizeof(i420)) == 0);
+
+    const uint16_t raw[6] = { 0, 64, 100, 319, 320, 1023 };
+    uint16_t limited[6];
+    uint8_t narrowed[6];
+    VirCamConvert::narrow16(raw, limited, 6, VirCamConvert::kIrLimit);
+    const uint16_t limitedExpected[6] = { 0, 0, 36, 255, 255, 255 };
+    EXPECT(memcmp(limited, limitedExpected, sizeof(limited)) == 0);
+    const VirCamConvert::Narrow raw10To8 = { 64, 2, 0xff };
+    VirCamConvert::narrow16To8(raw, narrowed, 6, raw10To8);
+    const uint8_t narrowedExpected[6] = { 0, 0, 9, 63, 64, 239 };
+    EXPECT(memcmp(narrowed, narrowedExpected, sizeof(narrowed)) == 0);
+    const uint16_t depth[2] = { 0x1234, 0x00ff };
+    VirCamConvert::narrow16To8(depth, narrowed, 2, VirCamConvert::kLowByte);
+    EXPECT(narrowed[0] == 0x34 && narrowed[1] == 0xff);
+    printf("testGolden passed\n");
+}
+
+// the replaced call sites: yuyv_to_nv12 with the chroma then set to 0x80,
+// on IR frames limited by ir_limit_max and on raw depth maps
+static void testMatchesLegacy() {
+    const int width = 640, height = 400;
+    size_t count = (size_t)width * height;
+    std::vector<uint16_t> raw(count), limited(count), legacyLimited(count);
+    std::vector<uint8_t> nv12(count * 3 / 2), legacy(count * 3 / 2);
+    sFill16(raw, 7, 0x3ff);
+
+    for (VirCamConvert::Isa isa : sIsas) {
+        if (VirCamConvert::setIsa(isa) < 0)
+            continue;
+        VirCamConvert::narrow16(raw.data(), limited.data(), count, VirCamConvert::kIrLimit);
+        sLegacyIrLimitMax(raw.data(), (int)count, legacyLimited.data());
+        EXPECT(limited == legacyLimited);
+
+        VirCamConvert::narrow16ToGreyNv12(limited.data(), nv12.data(), width, height,
+                VirCamConvert::kLowByte);
+        sLegacyYuyvToNv12((const uint8_t*)limited.data(), legacy.data(), width, height);
+        memset(legacy.data() + count, 0x80, count / 2);
+        EXPECT(nv12 == legacy);
+
+        // a depth map keeps its low bytes
+        sFill16(raw, 11, 0xffff);
+        VirCamConvert::narrow16ToGreyNv12(raw.data(), nv12.data(), width, height,
+                VirCamConvert::kLowByte);
+        sLegacyYuyvToNv12((const uint8_t*)raw.data(), legacy.data(), width, height);
+        memset(legacy.data() + count, 0x80, count / 2);
+        EXPECT(nv12 == legacy);
+        sFill16(raw, 7, 0x3ff);
+
+        // and true YUYV the way the driver path converted it
+        std::vector<uint8_t> yuyv(count * 2);
+        sFill(yuyv, 3);
+        VirCamConvert::yuyvToNv12(yuyv.data(), width * 2, nv12.data(), width,
+                nv12.data() + count, width, width, height);
+        sLegacyYuyvToNv12(yuyv.data(), legacy.data(), width, height);
+        EXPECT(nv12 == legacy);
+        printf("testMatchesLegacy passed (%s)\n", VirCamConvert::isaName(isa));
+    }
+    VirCamConvert::setIsa(VirCamConvert::ISA_AUTO);
+}
+
+static void testSimdMatchesC() {
+    static const int sizes[][2] = { { 2, 1 }, { 14, 3 }, { 16, 2 }, { 34, 5 }, { 62, 7 }, { 1280, 3 } };
+    static const VirCamConvert::Narrow narrows[] = {
+        VirCamConvert::kIrLimit, VirCamConvert::kLowByte, { 64, 2, 0xff }, { 0, 4, 0xfff }, { 1000, 0, 0x3ff },
+    };
+    const int pad = 6;
+    int compared = 0;
+
+    for (VirCamConvert::Isa isa : sIsas) {
+        if (isa == VirCamConvert::ISA_C || VirCamConvert::setIsa(isa) < 0)
+            continue;
+        for (const auto& size : sizes) {
+            int width = size[0], height = size[1];
+            int srcStride = width * 2 + pad, yStride = width + pad, cStride = width / 2 + pad;
+            int cRows = (height + 1) / 2;
+            std::vector<uint8_t> yuyv((size_t)srcStride * height);
+            sFill(yuyv, width * 31 + height);
+
+            std::vector<uint8_t> ref[2], out[2];
+            for (int pass = 0; pass < 2; pass++) {
+                std::vector<uint8_t>* dst = pass == 0 ? ref : out;
+                VirCamConvert::setIsa(pass == 0 ? VirCamConvert::ISA_C : isa);
+                dst[0].assign((size_t)yStride * height + (size_t)yStride * cRows, 0xee);
+                VirCamConvert::yuyvToNv12(yuyv.data(), srcStride, dst[0].data(), yStride,
+                        dst[0].data() + (size_t)yStride * height, yStride, width, height);
+                dst[1].assign((size_t)yStride * height + (size_t)cStride * cRows * 2, 0xee);
+                uint8_t* u = dst[1].data() + (size_t)yStride * height;
+                VirCamConvert::yuyvToI420(yuyv.data(), srcStride, dst[1].data(), yStride,
+                        u, u + (size_t)cStride * cRows, cStride, width, height);
+            }
+            EXPECT(ref[0] == out[0]);
+            EXPECT(ref[1] == out[1]);
+            compared++;
+        }
+
+        static const size_t counts[] = { 1, 7, 15, 16, 17, 33, 1000, 4099 };
+        for (size_t count : counts) {
+            std::vector<uint16_t> raw(count), ref16(count), out16(count);
+            std::vector<uint8_t> ref8(count), out8(count);
+            sFill16(raw, (unsigned int)count, 0xffff);
+            for (const VirCamConvert::Narrow& n : narrows) {
+                VirCamConvert::setIsa(VirCamConvert::ISA_C);
+                VirCamConvert::narrow16(raw.data(), ref16.data(), count, n);
+                VirCamConvert::narrow16To8(raw.data(), ref8.data(), count, n);
+                VirCamConvert::setIsa(isa);
+                VirCamConvert::narrow16(raw.data(), out16.data(), count, n);
+                VirCamConvert::narrow16To8(raw.data(), out8.data(), count, n);
+                EXPECT(ref16 == out16);
+                EXPECT(ref8 == out8);
+                // in place
+                out16 = raw;
+                VirCamConvert::narrow16(out16.data(), out16.data(), count, n);
+                EXPECT(ref16 == out16);
+                compared++;
+            }
+        }
+        printf("testSimdMatchesC passed (%s, %d cases)\n", VirCamConvert::isaName(isa), compared);
+    }
+    VirCamConvert::setIsa(VirCamConvert::ISA_AUTO);
+}
+
+static void testIsaSelection() {
+    EXPECT(VirCamConvert::setIsa(VirCamConvert::ISA_C) == 0);
+    EXPECT(VirCamConvert::getIsa() == VirCamConvert::ISA_C);
+    EXPECT(VirCamConvert::setIsa(VirCamConvert::ISA_AUTO) == 0);
+#if defined(__x86_64__)
+    EXPECT(VirCamConvert::getIsa() == VirCamConvert::ISA_SSE2);
+    EXPECT(VirCamConvert::setIsa(VirCamConvert::ISA_NEON) < 0);
+#elif defined(__aarch64__)
+    EXPECT(VirCamConvert::getIsa() == VirCamConvert::ISA_NEON);
+#endif
+    printf("testIsaSelection passed (auto is %s)\n", VirCamConvert::isaName(VirCamConvert::getIsa()));
+}
+
+int main() {
+    testGolden();
+    testMatchesLegacy();
+    testSimdMatchesC();
+    testIsaSelection();
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("vircamconverttest: all passed\n");
+    return 0;
+}
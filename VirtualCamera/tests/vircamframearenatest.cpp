@@ -0,0 +1,169 @@
+// Host unit test for the camera HAL's per-session scratch memory and debug
+// dumps (camera_vir/device/VirtualCameraFrameArena and
+// VirtualCameraFrameDumper): size class selection, recycling, the heap
+// overflow, an arena outliving its owner while buffers are out, and the
+// dump window, queue bound and write errors.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VirtualCameraFrameArena.h"
+#include "VirtualCameraFrameDumper.h"
+#include "testharness.h"
+
+using virtuals::VirCamFrameArena;
+using virtuals::VirCamFrameDumper;
+
+static void testSizeClasses() {
+    std::shared_ptr<VirCamFrameArena> arena = VirCamFrameArena::create({ { 1000, 2 }, { 100, 1 } });
+    EXPECT(arena != nullptr);
+    EXPECT(arena->stats().bytes == 2 * 1024 + 128);
+
+    std::shared_ptr<uint8_t> small = arena->acquire(50);
+    std::shared_ptr<uint8_t> small2 = arena->acquire(50);  // the small class is used up
+    std::shared_ptr<uint8_t> big = arena->acquire(1000);
+    EXPECT(small && small2 && big);
+    EXPECT((uintptr_t)small.get() % VirCamFrameArena::kAlignment == 0);
+    EXPECT((uintptr_t)small2.get() % VirCamFrameArena::kAlignment == 0);
+    EXPECT(small.get() != small2.get() && small2.get() != big.get());
+    memset(small.get(), 1, 50);
+    memset(big.get(), 2, 1000);
+
+    VirCamFrameArena::Stats stats = arena->stats();
+    EXPECT(stats.acquires == 3 && stats.overflows == 0 && stats.inUse == 3);
+
+    // both large buffers are out now: the next one comes from the heap
+    std::shared_ptr<uint8_t> overflow = arena->acquire(1000);
+    EXPECT(overflow != nullptr);
+    memset(overflow.get(), 3, 1000);
+    stats = arena->stats();
+    EXPECT(stats.overflows == 1 && stats.inUse == 4 && stats.highWater == 4);
+    overflow.reset();
+
+    // a released buffer is handed out again
+    uint8_t* bigData = big.get();
+    big.reset();
+    std::shared_ptr<uint8_t> again = arena->acquire(600);
+    EXPECT(again.get() == bigData);
+    stats = arena->stats();
+    EXPECT(stats.inUse == 3 && stats.overflows == 1);
+    printf("testSizeClasses passed\n");
+}
+
+// A reconfigured session drops its arena while the last request still holds
+// a buffer; the memory stays valid until that buffer is returned.
+static void testOutlivesOwner() {
+    std::shared_ptr<VirCamFrameArena> arena = VirCamFrameArena::create({ { 4096, 1 } });
+    std::shared_ptr<uint8_t> held = arena->acquire(4096);
+    std::weak_ptr<VirCamFrameArena> weak = arena;
+    arena.reset();
+    EXPECT(!weak.expired());
+    memset(held.get(), 0x5a, 4096);
+    held.reset();
+    EXPECT(weak.expired());
+
+    EXPECT(VirCamFrameArena::create({}) != nullptr);
+    printf("testOutlivesOwner passed\n");
+}
+
+static void testConcurrentRecycling() {
+    std::shared_ptr<VirCamFrameArena> arena = VirCamFrameArena::create({ { 256, 4 } });
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([arena, t] {
+            for (int i = 0; i < 10000; i++) {
+                std::shared_ptr<uint8_t> b = arena->acquire(200);
+                b.get()[0] = (uint8_t)t;
+                b.get()[199] = (uint8_t)i;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    VirCamFrameArena::Stats stats = arena->stats();
+    EXPECT(stats.acquires == 40000);
+    EXPECT(stats.inUse == 0);
+    EXPECT(stats.overflows == 0);
+    printf("testConcurrentRecycling passed\n");
+}
+
+static std::string sReadFile(const std::string& path) {
+    std::string data;
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+        return data;
+    }
+    char buf[256];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data.append(buf, n);
+    }
+    fclose(fp);
+    return data;
+}
+
+static void testDumper() {
+    char dir[] = "/tmp/vircamdumpXXXXXX";
+    EXPECT(mkdtemp(dir) != NULL);
+    const char frame[] = "frame";
+    {
+        // skip one, then two per tag
+        VirCamFrameDumper dumper(dir, 2, 1);
+        for (uint32_t i = 0; i < 5; i++) {
+            bool queued = dumper.dump("ir", 10 + i, 4, 2, "raw", frame, sizeof(frame));
+            EXPECT(queued == (i == 1 || i == 2));
+        }
+        EXPECT(dumper.dump("depth", 7, 4, 2, "raw", frame, sizeof(frame)) == false);
+        EXPECT(dumper.dump("depth", 8, 4, 2, "raw", frame, sizeof(frame)) == true);
+    }
+    // the destructor wrote what was queued
+    std::string base = std::string(dir) + "/";
+    EXPECT(sReadFile(base + "ir_4x2_11.raw") == std::string(frame, sizeof(frame)));
+    EXPECT(sReadFile(base + "ir_4x2_12.raw") == std::string(frame, sizeof(frame)));
+    EXPECT(sReadFile(base + "depth_4x2_8.raw") == std::string(frame, sizeof(frame)));
+    EXPECT(access((base + "ir_4x2_10.raw").c_str(), F_OK) != 0);
+    EXPECT(access((base + "ir_4x2_13.raw").c_str(), F_OK) != 0);
+    unlink((base + "ir_4x2_11.raw").c_str());
+    unlink((base + "ir_4x2_12.raw").c_str());
+    unlink((base + "depth_4x2_8.raw").c_str());
+    rmdir(dir);
+
+    {
+        // no room at all: counted as dropped
+        VirCamFrameDumper dumper(dir, 3, 0, 0);
+        EXPECT(dumper.dump("ir", 1, 4, 2, "raw", frame, sizeof(frame)) == false);
+        EXPECT(dumper.stats().dropped == 1);
+    }
+    {
+        // the directory is gone: counted as failed
+        VirCamFrameDumper dumper(dir, 1, 0);
+        EXPECT(dumper.dump("ir", 1, 4, 2, "raw", frame, sizeof(frame)));
+        for (int i = 0; i < 1000 && dumper.stats().failed == 0; i++) {
+            usleep(1000);
+        }
+        EXPECT(dumper.stats().failed == 1 && dumper.stats().written == 0);
+        EXPECT(dumper.lastError().find("ir_4x2_1.raw") != std::string::npos);
+    }
+    printf("testDumper passed\n");
+}
+
+int main() {
+    testSizeClasses();
+    testOutlivesOwner();
+    testConcurrentRecycling();
+    testDumper();
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("vircamframearenatest: all passed\n");
+    return 0;
+}
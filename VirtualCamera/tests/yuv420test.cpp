@@ -0,0 +1,103 @@
+// Host unit test for Yuv420_Copy: every pair of planar / semi-planar layouts,
+// odd sizes and padded strides.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "Common/yuv420.h"
+#include "testharness.h"
+
+enum Layout { I420, YV12, NV12, NV21 };
+
+struct Image {
+    std::vector<uint8_t> mem;
+    Yuv420Planes planes;
+};
+
+static void sAlloc(Image &img, Layout layout, int width, int height, int pad) {
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    int yStride = width + pad;
+    int cStride = (layout == NV12 || layout == NV21) ? cw * 2 + pad : cw + pad;
+    size_t ySize = (size_t)yStride * height;
+    size_t cSize = (size_t)cStride * ch;
+    img.mem.assign(ySize + cSize * 2, 0xee);
+    Yuv420Planes &p = img.planes;
+    p.y = img.mem.data();
+    p.y_stride = yStride;
+    p.c_stride = cStride;
+    switch (layout) {
+    case I420: p.cb = p.y + ySize; p.cr = p.cb + cSize; p.c_step = 1; break;
+    case YV12: p.cr = p.y + ySize; p.cb = p.cr + cSize; p.c_step = 1; break;
+    case NV12: p.cb = p.y + ySize; p.cr = p.cb + 1; p.c_step = 2; break;
+    case NV21: p.cr = p.y + ySize; p.cb = p.cr + 1; p.c_step = 2; break;
+    }
+}
+
+static uint8_t sY(int x, int y) { return (uint8_t)(x * 3 + y * 5); }
+static uint8_t sCb(int x, int y) { return (uint8_t)(x * 7 + y * 11 + 1); }
+static uint8_t sCr(int x, int y) { return (uint8_t)(x * 13 + y * 17 + 2); }
+
+static void sFill(Image &img, int width, int height) {
+    const Yuv420Planes &p = img.planes;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            p.y[(size_t)y * p.y_stride + x] = sY(x, y);
+    for (int y = 0; y < (height + 1) / 2; y++) {
+        for (int x = 0; x < (width + 1) / 2; x++) {
+            p.cb[(size_t)y * p.c_stride + x * p.c_step] = sCb(x, y);
+            p.cr[(size_t)y * p.c_stride + x * p.c_step] = sCr(x, y);
+        }
+    }
+}
+
+static bool sVerify(const Image &img, int width, int height) {
+    const Yuv420Planes &p = img.planes;
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            if (p.y[(size_t)y * p.y_stride + x] != sY(x, y))
+                return false;
+    for (int y = 0; y < (height + 1) / 2; y++) {
+        for (int x = 0; x < (width + 1) / 2; x++) {
+            if (p.cb[(size_t)y * p.c_stride + x * p.c_step] != sCb(x, y))
+                return false;
+            if (p.cr[(size_t)y * p.c_stride + x * p.c_step] != sCr(x, y))
+                return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    static const int sizes[][2] = { {16, 8}, {33, 17}, {1080, 64} };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int w = sizes[s][0], h = sizes[s][1];
+        for (int from = I420; from <= NV21; from++) {
+            for (int to = I420; to <= NV21; to++) {
+                for (int pad = 0; pad <= 32; pad += 32) {
+                    Image src, dst;
+                    sAlloc(src, (Layout)from, w, h, pad);
+                    sAlloc(dst, (Layout)to, w, h, 32 - pad);
+                    sFill(src, w, h);
+                    Yuv420_Copy(&src.planes, &dst.planes, w, h);
+                    bool ok = sVerify(dst, w, h);
+                    if (!ok)
+                        fprintf(stderr, "%dx%d layout %d -> %d pad %d\n", w, h, from, to, pad);
+                    EXPECT(ok);
+                    // the row padding of the destination is left alone
+                    const Yuv420Planes &d = dst.planes;
+                    if (d.y_stride > w)
+                        EXPECT(d.y[d.y_stride - 1] == 0xee);
+                }
+            }
+        }
+    }
+
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("yuv420test: all passed\n");
+    return 0;
+}
@@ -0,0 +1,133 @@
+// Microbenchmark for Common/yuv_convert at 1080x1920: RGBA -> NV21 / I420 and
+// I420 / NV12 -> RGBA for every kernel set the CPU supports, next to the
+// scalar rgbToYuv420 the service used to run per callback frame.
+//
+//   yuvconvertbench [-n frames] [-w width] [-h height]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Common/yuv_convert.h"
+
+static long long sCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// rgbToYuv420 from VirtualCameraService.cpp before the YUV delivery change
+static void rgbToYuv420(uint8_t* rgbBuf, size_t width, size_t height, uint8_t* yPlane,
+        uint8_t* crPlane, uint8_t* cbPlane, size_t chromaStep, size_t yStride, size_t chromaStride) {
+    uint8_t R, G, B;
+    double A = 0;
+    size_t index = 0;
+    for (size_t j = 0; j < height; j++) {
+        uint8_t* cr = crPlane;
+        uint8_t* cb = cbPlane;
+        uint8_t* y = yPlane;
+        bool jEven = (j & 1) == 0;
+        for (size_t i = 0; i < width; i++) {
+            R =  rgbBuf[index++];
+            G =  rgbBuf[index++];
+            B =  rgbBuf[index++];
+            A =  rgbBuf[index++] / 255.0;
+            (void)A;
+
+            *y++ = (77 * R + 150 * G +  29 * B) >> 8;
+            if (jEven && (i & 1) == 0) {
+                *cb = (( -43 * R - 85 * G + 128 * B) >> 8) + 128;
+                *cr = (( 128 * R - 107 * G - 21 * B) >> 8) + 128;
+                cr += chromaStep;
+                cb += chromaStep;
+            }
+        }
+        yPlane += yStride;
+        if (jEven) {
+            crPlane += chromaStride;
+            cbPlane += chromaStride;
+        }
+    }
+}
+
+static void sPlanes(std::vector<uint8_t> &mem, Yuv420Planes *p, int width, int height, bool semiPlanar, bool crFirst) {
+    size_t ySize = (size_t)width * height;
+    mem.assign(ySize * 3 / 2, 0);
+    p->y = mem.data();
+    p->y_stride = width;
+    if (semiPlanar) {
+        p->c_step = 2;
+        p->c_stride = width;
+        p->cb = p->y + ySize + (crFirst ? 1 : 0);
+        p->cr = p->y + ySize + (crFirst ? 0 : 1);
+    } else {
+        p->c_step = 1;
+        p->c_stride = width / 2;
+        p->cb = p->y + ySize;
+        p->cr = p->cb + ySize / 4;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 30, width = 1080, height = 1920;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:h:")) != -1) {
+        switch (opt) {
+        case 'n': frames = atoi(optarg); break;
+        case 'w': width = atoi(optarg) & ~1; break;
+        case 'h': height = atoi(optarg) & ~1; break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-w width] [-h height]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<uint8_t> rgba((size_t)width * height * 4);
+    for (size_t i = 0; i < rgba.size(); i++)
+        rgba[i] = (uint8_t)(i * 13 + (i >> 12));
+    std::vector<uint8_t> nv21Mem, i420Mem, nv12Mem;
+    Yuv420Planes nv21, i420, nv12;
+    sPlanes(nv21Mem, &nv21, width, height, true, true);
+    sPlanes(i420Mem, &i420, width, height, false, false);
+    sPlanes(nv12Mem, &nv12, width, height, true, false);
+    std::vector<uint8_t> out((size_t)width * height * 4);
+
+    printf("%dx%d, %d frames, CPU ms per frame\n", width, height, frames);
+    long long t = sCpuNs();
+    for (int f = 0; f < frames; f++)
+        rgbToYuv420(rgba.data(), width, height, nv21.y, nv21.cr, nv21.cb, 2, width, width);
+    printf("  %-6s rgba->nv21 %6.2f\n", "legacy", (sCpuNs() - t) / (frames * 1e6));
+
+    static const YuvConvertIsa isas[] = {
+        YUV_CONVERT_ISA_C, YUV_CONVERT_ISA_SSE2, YUV_CONVERT_ISA_AVX2, YUV_CONVERT_ISA_NEON
+    };
+    for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+        if (YuvConvert_SetIsa(isas[i]) < 0)
+            continue;
+        double ms[4];
+        t = sCpuNs();
+        for (int f = 0; f < frames; f++)
+            YuvConvert_RgbaToYuv420(rgba.data(), width * 4, &nv21, width, height);
+        ms[0] = (sCpuNs() - t) / (frames * 1e6);
+        t = sCpuNs();
+        for (int f = 0; f < frames; f++)
+            YuvConvert_RgbaToYuv420(rgba.data(), width * 4, &i420, width, height);
+        ms[1] = (sCpuNs() - t) / (frames * 1e6);
+        t = sCpuNs();
+        for (int f = 0; f < frames; f++)
+            YuvConvert_Yuv420ToRgba(&i420, 0, out.data(), width * 4, width, height);
+        ms[2] = (sCpuNs() - t) / (frames * 1e6);
+        t = sCpuNs();
+        for (int f = 0; f < frames; f++)
+            YuvConvert_Yuv420ToRgba(&nv12, 0, out.data(), width * 4, width, height);
+        ms[3] = (sCpuNs() - t) / (frames * 1e6);
+        printf("  %-6s rgba->nv21 %6.2f  rgba->i420 %6.2f  i420->rgba %6.2f  nv12->rgba %6.2f\n",
+                YuvConvert_IsaName(isas[i]), ms[0], ms[1], ms[2], ms[3]);
+    }
+    YuvConvert_SetIsa(YUV_CONVERT_ISA_AUTO);
+    return 0;
+}
@@ -0,0 +1,289 @@
+// Host unit test for Common/yuv_convert: golden pixels, closeness to the
+// floating point BT.601 equations, and bit-exact agreement of every SIMD
+// kernel set the CPU supports with the C one, over all four 4:2:0 layouts,
+// odd sizes and padded strides.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "Common/yuv_convert.h"
+#include "testharness.h"
+
+enum Layout { I420, YV12, NV12, NV21 };
+static const char *sLayoutNames[] = { "I420", "YV12", "NV12", "NV21" };
+
+struct Image {
+    std::vector<uint8_t> mem;
+    Yuv420Planes planes;
+    int width;
+    int height;
+};
+
+static void sAlloc(Image &img, Layout layout, int width, int height, int pad) {
+    int cw = (width + 1) / 2, ch = (height + 1) / 2;
+    int yStride = width + pad;
+    int cStride = (layout == NV12 || layout == NV21) ? cw * 2 + pad : cw + pad;
+    size_t ySize = (size_t)yStride * height;
+    size_t cSize = (size_t)cStride * ch;
+    img.mem.assign(ySize + cSize * 2, 0xee);
+    img.width = width;
+    img.height = height;
+    Yuv420Planes &p = img.planes;
+    p.y = img.mem.data();
+    p.y_stride = yStride;
+    p.c_stride = cStride;
+    switch (layout) {
+    case I420: p.cb = p.y + ySize; p.cr = p.cb + cSize; p.c_step = 1; break;
+    case YV12: p.cr = p.y + ySize; p.cb = p.cr + cSize; p.c_step = 1; break;
+    case NV12: p.cb = p.y + ySize; p.cr = p.cb + 1; p.c_step = 2; break;
+    case NV21: p.cr = p.y + ySize; p.cb = p.cr + 1; p.c_step = 2; break;
+    }
+}
+
+static uint8_t sYAt(const Image &img, int x, int y) {
+    return img.planes.y[(size_t)y * img.planes.y_stride + x];
+}
+
+static uint8_t sCbAt(const Image &img, int x, int y) {
+    return img.planes.cb[(size_t)(y / 2) * img.planes.c_stride + (x / 2) * img.planes.c_step];
+}
+
+static uint8_t sCrAt(const Image &img, int x, int y) {
+    return img.planes.cr[(size_t)(y / 2) * img.planes.c_stride + (x / 2) * img.planes.c_step];
+}
+
+static bool sSamePixels(const Image &a, const Image &b) {
+    for (int y = 0; y < a.height; y++) {
+        for (int x = 0; x < a.width; x++) {
+            if (sYAt(a, x, y) != sYAt(b, x, y) || sCbAt(a, x, y) != sCbAt(b, x, y) ||
+                    sCrAt(a, x, y) != sCrAt(b, x, y))
+                return false;
+        }
+    }
+    return true;
+}
+
+static void sRandom(std::vector<uint8_t> &buf, unsigned int seed) {
+    for (size_t i = 0; i < buf.size(); i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+static void testGoldenRgbaToYuv() {
+    // white, black, red, green, blue, grey in 2x2 blocks
+    static const uint8_t colours[][6] = {
+        // R    G    B     Y   Cb   Cr
+        {255, 255, 255,  255, 128, 128},
+        {  0,   0,   0,    0, 128, 128},
+        {255,   0,   0,   77,  85, 255},
+        {  0, 255,   0,  149,  44,  22},
+        {  0,   0, 255,   29, 255, 107},
+        {128, 128, 128,  128, 128, 128},
+    };
+    const int n = sizeof(colours) / sizeof(colours[0]);
+    const int w = n * 2, h = 2;
+    std::vector<uint8_t> rgba(w * h * 4);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            uint8_t *p = &rgba[(y * w + x) * 4];
+            memcpy(p, colours[x / 2], 3);
+            p[3] = 255;
+        }
+    }
+    Image img;
+    sAlloc(img, NV21, w, h, 0);
+    YuvConvert_RgbaToYuv420(rgba.data(), w * 4, &img.planes, w, h);
+    for (int i = 0; i < n; i++) {
+        EXPECT(sYAt(img, i * 2, 1) == colours[i][3]);
+        EXPECT(sCbAt(img, i * 2, 0) == colours[i][4]);
+        EXPECT(sCrAt(img, i * 2, 0) == colours[i][5]);
+        if (sYAt(img, i * 2, 1) != colours[i][3] || sCbAt(img, i * 2, 0) != colours[i][4] ||
+                sCrAt(img, i * 2, 0) != colours[i][5]) {
+            fprintf(stderr, "colour %d: got %d %d %d\n", i, sYAt(img, i * 2, 1),
+                    sCbAt(img, i * 2, 0), sCrAt(img, i * 2, 0));
+        }
+    }
+
+    // chroma is the mean of the block: black and white half and half is grey
+    uint8_t bw[2 * 2 * 4] = {0, 0, 0, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0, 0, 0, 255};
+    Image half;
+    sAlloc(half, I420, 2, 2, 0);
+    YuvConvert_RgbaToYuv420(bw, 8, &half.planes, 2, 2);
+    EXPECT(sCbAt(half, 0, 0) == 128 && sCrAt(half, 0, 0) == 128);
+    EXPECT(sYAt(half, 0, 0) == 0 && sYAt(half, 1, 0) == 255);
+}
+
+static void testGoldenYuvToRgba() {
+    Image img;
+    sAlloc(img, I420, 2, 2, 0);
+    uint8_t rgba[2 * 2 * 4];
+
+    // video range black and white, full range white
+    memset(img.planes.cb, 128, 1);
+    memset(img.planes.cr, 128, 1);
+    memset(img.planes.y, 235, 4);
+    YuvConvert_Yuv420ToRgba(&img.planes, 0, rgba, 8, 2, 2);
+    EXPECT(rgba[0] == 255 && rgba[1] == 255 && rgba[2] == 255 && rgba[3] == 255);
+    memset(img.planes.y, 16, 4);
+    YuvConvert_Yuv420ToRgba(&img.planes, 0, rgba, 8, 2, 2);
+    EXPECT(rgba[0] == 0 && rgba[1] == 0 && rgba[2] == 0 && rgba[3] == 255);
+    memset(img.planes.y, 255, 4);
+    YuvConvert_Yuv420ToRgba(&img.planes, 1, rgba, 8, 2, 2);
+    EXPECT(rgba[0] == 255 && rgba[1] == 255 && rgba[2] == 255);
+
+    // full range red as written by RgbaToYuv420
+    memset(img.planes.y, 77, 4);
+    memset(img.planes.cb, 85, 1);
+    memset(img.planes.cr, 255, 1);
+    YuvConvert_Yuv420ToRgba(&img.planes, 1, rgba, 8, 2, 2);
+    EXPECT(rgba[0] >= 250 && rgba[1] <= 3 && rgba[2] <= 3);
+}
+
+static double sClamp(double v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// every Y, Cb, Cr combination on a coarse grid against the BT.601 equations
+static void testAgainstFloat() {
+    int worst[2] = {0, 0};
+    for (int range = 0; range < 2; range++) {
+        for (int Y = 0; Y < 256; Y += 3) {
+            for (int U = 0; U < 256; U += 5) {
+                for (int V = 0; V < 256; V += 5) {
+                    uint8_t y[2] = {(uint8_t)Y, (uint8_t)Y};
+                    uint8_t cb = (uint8_t)U, cr = (uint8_t)V;
+                    Yuv420Planes p = {y, &cb, &cr, 2, 1, 1};
+                    uint8_t rgba[8];
+                    YuvConvert_Yuv420ToRgba(&p, range, rgba, 8, 2, 1);
+
+                    double c = range ? Y : 255.0 / 219.0 * (Y - 16);
+                    double s = range ? 1.0 : 255.0 / 224.0;
+                    double u = (U - 128) * s, v = (V - 128) * s;
+                    double ref[3] = {
+                        sClamp(c + 1.402 * v),
+                        sClamp(c - 0.344136 * u - 0.714136 * v),
+                        sClamp(c + 1.772 * u),
+                    };
+                    for (int i = 0; i < 3; i++) {
+                        int d = (int)fabs(rgba[i] - ref[i]);
+                        if (d > worst[range])
+                            worst[range] = d;
+                    }
+                }
+            }
+        }
+    }
+    printf("yuv->rgba max error vs float: video range %d, full range %d\n", worst[0], worst[1]);
+    EXPECT(worst[0] <= 3);
+    EXPECT(worst[1] <= 2);
+
+    int worstY = 0, worstC = 0;
+    for (int R = 0; R < 256; R += 5) {
+        for (int G = 0; G < 256; G += 5) {
+            for (int B = 0; B < 256; B += 5) {
+                uint8_t rgba[2 * 2 * 4];
+                for (int i = 0; i < 4; i++) {
+                    rgba[i * 4] = (uint8_t)R;
+                    rgba[i * 4 + 1] = (uint8_t)G;
+                    rgba[i * 4 + 2] = (uint8_t)B;
+                    rgba[i * 4 + 3] = 255;
+                }
+                uint8_t y[4], cb, cr;
+                Yuv420Planes p = {y, &cb, &cr, 2, 1, 1};
+                YuvConvert_RgbaToYuv420(rgba, 8, &p, 2, 2);
+                double refY = 0.299 * R + 0.587 * G + 0.114 * B;
+                double refCb = 128 - 0.168736 * R - 0.331264 * G + 0.5 * B;
+                double refCr = 128 + 0.5 * R - 0.418688 * G - 0.081312 * B;
+                int dy = (int)fabs(y[0] - refY);
+                int dc = (int)fmax(fabs(cb - sClamp(refCb)), fabs(cr - sClamp(refCr)));
+                if (dy > worstY)
+                    worstY = dy;
+                if (dc > worstC)
+                    worstC = dc;
+            }
+        }
+    }
+    printf("rgba->yuv max error vs float: luma %d, chroma %d\n", worstY, worstC);
+    EXPECT(worstY <= 1);
+    EXPECT(worstC <= 2);
+}
+
+// The C kernels are the reference; every other kernel set must match them
+// byte for byte, including the rows and columns left to the C tail.
+static void testKernelsMatchC() {
+    static const int sizes[][2] = { {1, 1}, {2, 2}, {15, 3}, {16, 2}, {31, 5}, {33, 17},
+                                    {64, 4}, {97, 9}, {1080, 6} };
+    static const YuvConvertIsa isas[] = { YUV_CONVERT_ISA_SSE2, YUV_CONVERT_ISA_AVX2, YUV_CONVERT_ISA_NEON };
+
+    for (size_t i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+        if (YuvConvert_SetIsa(isas[i]) < 0) {
+            printf("%s: not supported here, skipped\n", YuvConvert_IsaName(isas[i]));
+            continue;
+        }
+        int compared = 0;
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            int w = sizes[s][0], h = sizes[s][1];
+            int rgbaStride = w * 4 + 12;
+            std::vector<uint8_t> rgba((size_t)rgbaStride * h);
+            sRandom(rgba, (unsigned int)(w * 131 + h));
+
+            for (int layout = I420; layout <= NV21; layout++) {
+                Image ref, out;
+                sAlloc(ref, (Layout)layout, w, h, 7);
+                sAlloc(out, (Layout)layout, w, h, 7);
+                YuvConvert_SetIsa(YUV_CONVERT_ISA_C);
+                YuvConvert_RgbaToYuv420(rgba.data(), rgbaStride, &ref.planes, w, h);
+                YuvConvert_SetIsa(isas[i]);
+                YuvConvert_RgbaToYuv420(rgba.data(), rgbaStride, &out.planes, w, h);
+                bool same = sSamePixels(ref, out) && ref.mem == out.mem;
+                if (!same)
+                    fprintf(stderr, "%s rgba->%s %dx%d differs\n", YuvConvert_IsaName(isas[i]),
+                            sLayoutNames[layout], w, h);
+                EXPECT(same);
+
+                // back again from random YUV, both ranges
+                sRandom(ref.mem, (unsigned int)(w + h * 7 + layout));
+                for (int range = 0; range < 2; range++) {
+                    std::vector<uint8_t> a(rgba.size(), 0), b(rgba.size(), 0);
+                    YuvConvert_SetIsa(YUV_CONVERT_ISA_C);
+                    YuvConvert_Yuv420ToRgba(&ref.planes, range, a.data(), rgbaStride, w, h);
+                    YuvConvert_SetIsa(isas[i]);
+                    YuvConvert_Yuv420ToRgba(&ref.planes, range, b.data(), rgbaStride, w, h);
+                    if (a != b)
+                        fprintf(stderr, "%s %s->rgba range %d %dx%d differs\n", YuvConvert_IsaName(isas[i]),
+                                sLayoutNames[layout], range, w, h);
+                    EXPECT(a == b);
+                }
+                compared++;
+            }
+        }
+        printf("%s: %d layouts x sizes match the C kernels\n", YuvConvert_IsaName(isas[i]), compared);
+    }
+    YuvConvert_SetIsa(YUV_CONVERT_ISA_AUTO);
+}
+
+int main() {
+    printf("dispatch picked %s\n", YuvConvert_IsaName(YuvConvert_GetIsa()));
+    testGoldenRgbaToYuv();
+    testGoldenYuvToRgba();
+    testAgainstFloat();
+    testKernelsMatchC();
+
+    // golden values again through the C kernels
+    YuvConvert_SetIsa(YUV_CONVERT_ISA_C);
+    testGoldenRgbaToYuv();
+    testGoldenYuvToRgba();
+    YuvConvert_SetIsa(YUV_CONVERT_ISA_AUTO);
+
+    if (sFailures) {
+        fprintf(stderr, "%d failure(s)\n", sFailures);
+        return 1;
+    }
+    printf("yuvconverttest: all passed\n");
+    return 0;
+}
@@ -0,0 +1,159 @@
+// Per-frame CPU time of getting one decoded 1080x1920 picture onto the preview
+// (RGBA) and callback (YCbCr_420_888) surfaces.
+//
+//   before: decoder YUV -> RGBA, memcpy to the preview, RGBA -> YUV per pixel
+//           for the callback surface (rgbToYuv420 as it was in the service)
+//   after:  decoder YUV -> RGBA straight into the preview buffer, plane copy
+//           for the callback surface
+//
+// The YUV -> RGBA step stands in for sws_scale, which is not available on the
+// host; it is the same in both columns, so the difference is what the change
+// saves.
+//
+//   yuvdeliverybench [-n frames] [-w width] [-h height]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Common/yuv420.h"
+
+static long long sCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline uint8_t sClamp(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// BT.601 video range, 8 bit fixed point
+static void sYuvToRgba(const Yuv420Planes *src, int width, int height, uint8_t *dst, int dstStride) {
+    for (int j = 0; j < height; j++) {
+        const uint8_t *y = src->y + (size_t)j * src->y_stride;
+        const uint8_t *cb = src->cb + (size_t)(j / 2) * src->c_stride;
+        const uint8_t *cr = src->cr + (size_t)(j / 2) * src->c_stride;
+        uint8_t *d = dst + (size_t)j * dstStride;
+        for (int i = 0; i < width; i++) {
+            int c = (y[i] - 16) * 298;
+            int u = cb[(i / 2) * src->c_step] - 128;
+            int v = cr[(i / 2) * src->c_step] - 128;
+            d[0] = sClamp((c + 409 * v + 128) >> 8);
+            d[1] = sClamp((c - 100 * u - 208 * v + 128) >> 8);
+            d[2] = sClamp((c + 516 * u + 128) >> 8);
+            d[3] = 255;
+            d += 4;
+        }
+    }
+}
+
+// rgbToYuv420 from VirtualCameraService.cpp before the change, unmodified
+static void rgbToYuv420(uint8_t* rgbBuf, size_t width, size_t height, uint8_t* yPlane,
+        uint8_t* crPlane, uint8_t* cbPlane, size_t chromaStep, size_t yStride, size_t chromaStride) {
+    uint8_t R, G, B;
+    double A = 0;
+    size_t index = 0;
+    for (size_t j = 0; j < height; j++) {
+        uint8_t* cr = crPlane;
+        uint8_t* cb = cbPlane;
+        uint8_t* y = yPlane;
+        bool jEven = (j & 1) == 0;
+        for (size_t i = 0; i < width; i++) {
+            R =  rgbBuf[index++];
+            G =  rgbBuf[index++];
+            B =  rgbBuf[index++];
+            A =  rgbBuf[index++] / 255.0;
+            (void)A;
+
+            *y++ = (77 * R + 150 * G +  29 * B) >> 8;
+            if (jEven && (i & 1) == 0) {
+                *cb = (( -43 * R - 85 * G + 128 * B) >> 8) + 128;
+                *cr = (( 128 * R - 107 * G - 21 * B) >> 8) + 128;
+                cr += chromaStep;
+                cb += chromaStep;
+            }
+        }
+        yPlane += yStride;
+        if (jEven) {
+            crPlane += chromaStride;
+            cbPlane += chromaStride;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 30, width = 1080, height = 1920;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:h:")) != -1) {
+        switch (opt) {
+        case 'n': frames = atoi(optarg); break;
+        case 'w': width = atoi(optarg) & ~1; break;
+        case 'h': height = atoi(optarg) & ~1; break;
+        default:
+            fprintf(stderr, "usage: %s [-n frames] [-w width] [-h height]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // decoder output: I420 with ffmpeg's padded strides
+    int yStride = (width + 63) & ~63;
+    int cStride = yStride / 2;
+    std::vector<uint8_t> yuv((size_t)yStride * height + (size_t)cStride * height);
+    for (size_t i = 0; i < yuv.size(); i++)
+        yuv[i] = (uint8_t)(i * 7 + (i >> 11));
+    Yuv420Planes decoded;
+    decoded.y = yuv.data();
+    decoded.cb = decoded.y + (size_t)yStride * height;
+    decoded.cr = decoded.cb + (size_t)cStride * height / 2;
+    decoded.y_stride = yStride;
+    decoded.c_stride = cStride;
+    decoded.c_step = 1;
+
+    std::vector<uint8_t> rgba((size_t)width * height * 4);
+    std::vector<uint8_t> preview((size_t)width * height * 4);
+    // a typical YCbCr_420_888 gralloc layout: NV21
+    std::vector<uint8_t> callback((size_t)width * height * 3 / 2);
+    Yuv420Planes cb;
+    cb.y = callback.data();
+    cb.cr = cb.y + (size_t)width * height;
+    cb.cb = cb.cr + 1;
+    cb.y_stride = width;
+    cb.c_stride = width;
+    cb.c_step = 2;
+
+    long long before[3] = {0, 0, 0};
+    long long after[2] = {0, 0};
+    for (int f = 0; f < frames; f++) {
+        long long t0 = sCpuNs();
+        sYuvToRgba(&decoded, width, height, rgba.data(), width * 4);
+        long long t1 = sCpuNs();
+        memcpy(preview.data(), rgba.data(), rgba.size());
+        long long t2 = sCpuNs();
+        rgbToYuv420(rgba.data(), width, height, cb.y, cb.cr, cb.cb, cb.c_step, cb.y_stride, cb.c_stride);
+        long long t3 = sCpuNs();
+        before[0] += t1 - t0;
+        before[1] += t2 - t1;
+        before[2] += t3 - t2;
+
+        t0 = sCpuNs();
+        sYuvToRgba(&decoded, width, height, preview.data(), width * 4);
+        t1 = sCpuNs();
+        Yuv420_Copy(&decoded, &cb, width, height);
+        t2 = sCpuNs();
+        after[0] += t1 - t0;
+        after[1] += t2 - t1;
+    }
+
+    double n = frames * 1e6;
+    printf("%dx%d, %d frames, CPU ms per frame\n", width, height, frames);
+    printf("  before: yuv->rgba %.2f + preview copy %.2f + rgba->yuv callback %.2f = %.2f\n",
+            before[0] / n, before[1] / n, before[2] / n, (before[0] + before[1] + before[2]) / n);
+    printf("  after:  yuv->rgba into preview %.2f + callback plane copy %.2f = %.2f\n",
+            after[0] / n, after[1] / n, (after[0] + after[1]) / n);
+    return 0;
+}
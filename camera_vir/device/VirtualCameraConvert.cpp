@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <atomic>
+#include "VirtualCameraConvertPriv.h"
+
+namespace virtuals {
+
+const VirCamConvert::Narrow VirCamConvert::kIrLimit = { 64, 0, 0xff };
+const VirCamConvert::Narrow VirCamConvert::kLowByte = { 0, 0, 0xffff };
+
+namespace {
+
+struct Kernels {
+    VirCamConvert::Isa isa;
+    convert_yuyv_nv12_row yuyvToNv12;
+    convert_yuyv_i420_row yuyvToI420;
+    convert_narrow16 narrow16;
+    convert_narrow16_to8 narrow16To8;
+};
+
+const Kernels kKernelsC = { VirCamConvert::ISA_C, nullptr, nullptr, nullptr, nullptr };
+#ifdef VIRCAM_CONVERT_HAVE_X86
+const Kernels kKernelsSse2 = {
+    VirCamConvert::ISA_SSE2, convert_yuyv_nv12_row_sse2, convert_yuyv_i420_row_sse2,
+    convert_narrow16_sse2, convert_narrow16_to8_sse2
+};
+#endif
+#ifdef VIRCAM_CONVERT_HAVE_NEON
+const Kernels kKernelsNeon = {
+    VirCamConvert::ISA_NEON, convert_yuyv_nv12_row_neon, convert_yuyv_i420_row_neon,
+    convert_narrow16_neon, convert_narrow16_to8_neon
+};
+#endif
+
+std::atomic<const Kernels*> sKernels(nullptr);
+
+const Kernels* kernelsFor(VirCamConvert::Isa isa) {
+    switch (isa) {
+    case VirCamConvert::ISA_C:
+        return &kKernelsC;
+#ifdef VIRCAM_CONVERT_HAVE_X86
+    case VirCamConvert::ISA_SSE2:
+#if defined(__i386__)
+        if (!__builtin_cpu_supports("sse2"))
+            return nullptr;
+#endif
+        return &kKernelsSse2;
+#endif
+#ifdef VIRCAM_CONVERT_HAVE_NEON
+    // compiled in only when the target ABI guarantees NEON
+    case VirCamConvert::ISA_NEON:
+        return &kKernelsNeon;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+const Kernels* bestKernels() {
+    static const VirCamConvert::Isa order[] = { VirCamConvert::ISA_SSE2, VirCamConvert::ISA_NEON };
+    for (VirCamConvert::Isa isa : order) {
+        const Kernels* k = kernelsFor(isa);
+        if (k)
+            return k;
+    }
+    return &kKernelsC;
+}
+
+// Racing first callers all pick the same set.
+const Kernels* getKernels() {
+    const Kernels* k = sKernels.load(std::memory_order_acquire);
+    if (k == nullptr) {
+        k = bestKernels();
+        sKernels.store(k, std::memory_order_release);
+    }
+    return k;
+}
+
+inline uint16_t narrowSample(uint16_t v, const VirCamConvert::Narrow& n) {
+    unsigned int r = v > n.blackLevel ? (unsigned int)(v - n.blackLevel) >> n.shift : 0;
+    return r < n.maxValue ? (uint16_t)r : n.maxValue;
+}
+
+// Starts at column x (even).
+void yuyvToNv12RowC(const uint8_t* src, uint8_t* y, uint8_t* uv, int x, int width) {
+    for (; x < width; x += 2) {
+        const uint8_t* p = src + (size_t)x * 2;
+        y[x] = p[0];
+        y[x + 1] = p[2];
+        if (uv) {
+            uv[x] = p[1];
+            uv[x + 1] = p[3];
+        }
+    }
+}
+
+void yuyvToI420RowC(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v, int x, int width) {
+    for (; x < width; x += 2) {
+        const uint8_t* p = src + (size_t)x * 2;
+        y[x] = p[0];
+        y[x + 1] = p[2];
+        if (u) {
+            u[x / 2] = p[1];
+            v[x / 2] = p[3];
+        }
+    }
+}
+
+} // anonymous namespace
+
+void VirCamConvert::yuyvToNv12(const uint8_t* src, int srcStride,
+                               uint8_t* dstY, int yStride, uint8_t* dstUv, int uvStride,
+                               int width, int height) {
+    const Kernels* k = getKernels();
+    width &= ~1;
+    for (int j = 0; j < height; j++) {
+        const uint8_t* s = src + (size_t)j * srcStride;
+        uint8_t* y = dstY + (size_t)j * yStride;
+        uint8_t* uv = (j & 1) ? nullptr : dstUv + (size_t)(j / 2) * uvStride;
+        int x = k->yuyvToNv12 ? k->yuyvToNv12(s, y, uv, width) : 0;
+        yuyvToNv12RowC(s, y, uv, x, width);
+    }
+}
+
+void VirCamConvert::yuyvToI420(const uint8_t* src, int srcStride,
+                               uint8_t* dstY, int yStride, uint8_t* dstU, uint8_t* dstV,
+                               int cStride, int width, int height) {
+    const Kernels* k = getKernels();
+    width &= ~1;
+    for (int j = 0; j < height; j++) {
+        const uint8_t* s = src + (size_t)j * srcStride;
+        uint8_t* y = dstY + (size_t)j * yStride;
+        uint8_t* u = (j & 1) ? nullptr : dstU + (size_t)(j / 2) * cStride;
+        uint8_t* v = (j & 1) ? nullptr : dstV + (size_t)(j / 2) * cStride;
+        int x = k->yuyvToI420 ? k->yuyvToI420(s, y, u, v, width) : 0;
+        yuyvToI420RowC(s, y, u, v, x, width);
+    }
+}
+
+void VirCamConvert::narrow16(const uint16_t* src, uint16_t* dst, size_t count, const Narrow& n) {
+    const Kernels* k = getKernels();
+    size_t i = k->narrow16 ? k->narrow16(src, dst, count, n) : 0;
+    for (; i < count; i++)
+        dst[i] = narrowSample(src[i], n);
+}
+
+void VirCamConvert::narrow16To8(const uint16_t* src, uint8_t* dst, size_t count, const Narrow& n) {
+    const Kernels* k = getKernels();
+    size_t i = k->narrow16To8 ? k->narrow16To8(src, dst, count, n) : 0;
+    for (; i < count; i++)
+        dst[i] = (uint8_t)narrowSample(src[i], n);
+}
+
+void VirCamConvert::narrow16ToGreyNv12(const uint16_t* src, uint8_t* dst,
+                                       int width, int height, const Narrow& n) {
+    size_t ySize = (size_t)width * height;
+    narrow16To8(src, dst, ySize, n);
+    memset(dst + ySize, 0x80, (size_t)width * ((height + 1) / 2));
+}
+
+int VirCamConvert::setIsa(Isa isa) {
+    const Kernels* k = isa == ISA_AUTO ? bestKernels() : kernelsFor(isa);
+    if (k == nullptr)
+        return -1;
+    sKernels.store(k, std::memory_order_release);
+    return 0;
+}
+
+VirCamConvert::Isa VirCamConvert::getIsa() {
+    return getKernels()->isa;
+}
+
+const char* VirCamConvert::isaName(Isa isa) {
+    switch (isa) {
+    case ISA_AUTO: return "auto";
+    case ISA_C:    return "c";
+    case ISA_SSE2: return "sse2";
+    case ISA_NEON: return "neon";
+    default:       return "unknown";
+    }
+}
+
+} // namespace virtuals
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_EXTERNAL_CAMERA_CONVERT_PRIV
+#define ANDROID_EXTERNAL_CAMERA_CONVERT_PRIV
+
+#include "VirtualCameraConvert.h"
+
+// Shared between VirtualCameraConvert.cpp and the SIMD kernel files only.
+//
+// A SIMD kernel converts as many leading pixels or samples as fit its vector
+// width and returns how many it did; VirtualCameraConvert.cpp finishes the
+// rest in C. The chroma pointers of a YUYV row are null on odd rows.
+
+namespace virtuals {
+
+typedef int (*convert_yuyv_nv12_row)(const uint8_t* src, uint8_t* y, uint8_t* uv, int width);
+typedef int (*convert_yuyv_i420_row)(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+                                     int width);
+typedef size_t (*convert_narrow16)(const uint16_t* src, uint16_t* dst, size_t count,
+                                   const VirCamConvert::Narrow& n);
+typedef size_t (*convert_narrow16_to8)(const uint16_t* src, uint8_t* dst, size_t count,
+                                       const VirCamConvert::Narrow& n);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VIRCAM_CONVERT_HAVE_X86 1
+int convert_yuyv_nv12_row_sse2(const uint8_t* src, uint8_t* y, uint8_t* uv, int width);
+int convert_yuyv_i420_row_sse2(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+                               int width);
+size_t convert_narrow16_sse2(const uint16_t* src, uint16_t* dst, size_t count,
+                             const VirCamConvert::Narrow& n);
+size_t convert_narrow16_to8_sse2(const uint16_t* src, uint8_t* dst, size_t count,
+                                 const VirCamConvert::Narrow& n);
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VIRCAM_CONVERT_HAVE_NEON 1
+int convert_yuyv_nv12_row_neon(const uint8_t* src, uint8_t* y, uint8_t* uv, int width);
+int convert_yuyv_i420_row_neon(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+                               int width);
+size_t convert_narrow16_neon(const uint16_t* src, uint16_t* dst, size_t count,
+                             const VirCamConvert::Narrow& n);
+size_t convert_narrow16_to8_neon(const uint16_t* src, uint8_t* dst, size_t count,
+                                 const VirCamConvert::Narrow& n);
+#endif
+
+} // namespace virtuals
+
+#endif // ANDROID_EXTERNAL_CAMERA_CONVERT_PRIV
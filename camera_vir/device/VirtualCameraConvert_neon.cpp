@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "VirtualCameraConvertPriv.h"
+
+#ifdef VIRCAM_CONVERT_HAVE_NEON
+
+#include <arm_neon.h>
+
+// vld2/vld4 do the YUYV deinterleave; the same code serves arm and arm64.
+
+namespace virtuals {
+
+namespace {
+
+inline uint16x8_t neonNarrow(uint16x8_t v, uint16x8_t black, int16x8_t shift, uint16x8_t max) {
+    return vminq_u16(vshlq_u16(vqsubq_u16(v, black), shift), max);
+}
+
+} // anonymous namespace
+
+int convert_yuyv_nv12_row_neon(const uint8_t* src, uint8_t* y, uint8_t* uv, int width) {
+    int x;
+    for (x = 0; x + 16 <= width; x += 16) {
+        uint8x16x2_t p = vld2q_u8(src + x * 2);
+        vst1q_u8(y + x, p.val[0]);
+        if (uv)
+            vst1q_u8(uv + x, p.val[1]);
+    }
+    return x;
+}
+
+// 32 pixels per step: Y0 U Y1 V
+int convert_yuyv_i420_row_neon(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+                               int width) {
+    int x;
+    for (x = 0; x + 32 <= width; x += 32) {
+        uint8x16x4_t p = vld4q_u8(src + x * 2);
+        uint8x16x2_t luma;
+        luma.val[0] = p.val[0];
+        luma.val[1] = p.val[2];
+        vst2q_u8(y + x, luma);
+        if (u) {
+            vst1q_u8(u + x / 2, p.val[1]);
+            vst1q_u8(v + x / 2, p.val[3]);
+        }
+    }
+    return x;
+}
+
+size_t convert_narrow16_neon(const uint16_t* src, uint16_t* dst, size_t count,
+                             const VirCamConvert::Narrow& n) {
+    const uint16x8_t black = vdupq_n_u16(n.blackLevel);
+    const int16x8_t shift = vdupq_n_s16(-(int16_t)n.shift);
+    const uint16x8_t max = vdupq_n_u16(n.maxValue);
+    size_t i;
+    for (i = 0; i + 16 <= count; i += 16) {
+        uint16x8_t a = vld1q_u16(src + i);
+        uint16x8_t b = vld1q_u16(src + i + 8);
+        vst1q_u16(dst + i, neonNarrow(a, black, shift, max));
+        vst1q_u16(dst + i + 8, neonNarrow(b, black, shift, max));
+    }
+    return i;
+}
+
+// vmovn keeps the low bytes; with maxValue above 0xff that truncates
+size_t convert_narrow16_to8_neon(const uint16_t* src, uint8_t* dst, size_t count,
+                                 const VirCamConvert::Narrow& n) {
+    const uint16x8_t black = vdupq_n_u16(n.blackLevel);
+    const int16x8_t shift = vdupq_n_s16(-(int16_t)n.shift);
+    const uint16x8_t max = vdupq_n_u16(n.maxValue);
+    size_t i;
+    for (i = 0; i + 16 <= count; i += 16) {
+        uint16x8_t a = neonNarrow(vld1q_u16(src + i), black, shift, max);
+        uint16x8_t b = neonNarrow(vld1q_u16(src + i + 8), black, shift, max);
+        vst1q_u8(dst + i, vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+    }
+    return i;
+}
+
+} // namespace virtuals
+
+#endif // VIRCAM_CONVERT_HAVE_NEON
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "VirtualCameraConvertPriv.h"
+
+#ifdef VIRCAM_CONVERT_HAVE_X86
+
+#include <emmintrin.h>
+
+// Compiled with a target attribute so a 32 bit x86 build needs no -msse2;
+// only ever called after VirtualCameraConvert.cpp checked the CPU.
+#define SSE2_FN __attribute__((target("sse2")))
+
+namespace virtuals {
+
+namespace {
+
+// SSE2 has no unsigned 16 bit min
+inline SSE2_FN __m128i sse2MinU16(__m128i a, __m128i b) {
+    return _mm_sub_epi16(a, _mm_subs_epu16(a, b));
+}
+
+inline SSE2_FN __m128i sse2Narrow(__m128i v, __m128i black, __m128i shift, __m128i max) {
+    return sse2MinU16(_mm_srl_epi16(_mm_subs_epu16(v, black), shift), max);
+}
+
+} // anonymous namespace
+
+// 16 pixels per step: the even bytes are luma, the odd ones chroma, which
+// for YUYV already is the NV12 UV order.
+SSE2_FN int convert_yuyv_nv12_row_sse2(const uint8_t* src, uint8_t* y, uint8_t* uv, int width) {
+    const __m128i lowBytes = _mm_set1_epi16(0xff);
+    int x;
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + x * 2 + 16));
+        _mm_storeu_si128((__m128i*)(y + x),
+                _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes)));
+        if (uv)
+            _mm_storeu_si128((__m128i*)(uv + x),
+                    _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    return x;
+}
+
+SSE2_FN int convert_yuyv_i420_row_sse2(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+                                       int width) {
+    const __m128i lowBytes = _mm_set1_epi16(0xff);
+    int x;
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + x * 2 + 16));
+        _mm_storeu_si128((__m128i*)(y + x),
+                _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes)));
+        if (u) {
+            __m128i c = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            __m128i uu = _mm_and_si128(c, lowBytes);
+            __m128i vv = _mm_srli_epi16(c, 8);
+            _mm_storel_epi64((__m128i*)(u + x / 2), _mm_packus_epi16(uu, uu));
+            _mm_storel_epi64((__m128i*)(v + x / 2), _mm_packus_epi16(vv, vv));
+        }
+    }
+    return x;
+}
+
+SSE2_FN size_t convert_narrow16_sse2(const uint16_t* src, uint16_t* dst, size_t count,
+                                     const VirCamConvert::Narrow& n) {
+    const __m128i black = _mm_set1_epi16((short)n.blackLevel);
+    const __m128i shift = _mm_cvtsi32_si128(n.shift);
+    const __m128i max = _mm_set1_epi16((short)n.maxValue);
+    size_t i;
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i + 8));
+        _mm_storeu_si128((__m128i*)(dst + i), sse2Narrow(a, black, shift, max));
+        _mm_storeu_si128((__m128i*)(dst + i + 8), sse2Narrow(b, black, shift, max));
+    }
+    return i;
+}
+
+// the low bytes of 16 samples; with maxValue above 0xff that truncates
+SSE2_FN size_t convert_narrow16_to8_sse2(const uint16_t* src, uint8_t* dst, size_t count,
+                                         const VirCamConvert::Narrow& n) {
+    const __m128i black = _mm_set1_epi16((short)n.blackLevel);
+    const __m128i shift = _mm_cvtsi32_si128(n.shift);
+    const __m128i max = _mm_set1_epi16((short)n.maxValue);
+    const __m128i lowBytes = _mm_set1_epi16(0xff);
+    size_t i;
+    for (i = 0; i + 16 <= count; i += 16) {
+        __m128i a = sse2Narrow(_mm_loadu_si128((const __m128i*)(src + i)), black, shift, max);
+        __m128i b = sse2Narrow(_mm_loadu_si128((const __m128i*)(src + i + 8)), black, shift, max);
+        _mm_storeu_si128((__m128i*)(dst + i),
+                _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes)));
+    }
+    return i;
+}
+
+} // namespace virtuals
+
+#endif // VIRCAM_CONVERT_HAVE_X86
@@ -17,8 +17,10 @@
 //#define LOG_NDEBUG 0
 #define ATRACE_TAG ATRACE_TAG_CAMERA
 #include <log/log.h>
+#include <cutils/properties.h>
 
 #include <inttypes.h>
+#include <algorithm>
 
 #include "VirtualCameraDeviceSession_3.4.h"
 
@@ -35,6 +37,7 @@
 #include "RgaCropScale.h"
 #include <RockchipRga.h>
 #include "VirtualCameraGralloc4.h"
+#include "VirtualCameraConvert.h"
 #define NV12_HW_CONVERT
 #define PLANES_NUM 1
 
@@ -83,6 +86,14 @@ constexpr int IOCTL_RETRY_SLEEP_US = 33000; // 33ms * MAX_RETRY = 0.5 seconds
 static constexpr int kDumpLockRetries = 50;
 static constexpr int kDumpLockSleep = 60000;
 
+// Frames dumped per dump point when set, to kFrameDumpDir; off by default
+const char kFrameDumpProperty[] = "vendor.camera.virtual.dump_frames";
+const char kFrameDumpDir[] = "/data/camera";
+
+// When set, V4L2 captures into HAL allocated dmabufs (V4L2_MEMORY_DMABUF)
+// that RGA reads directly, instead of driver buffers mapped into the HAL
+const char kV4l2DmabufProperty[] = "vendor.camera.virtual.v4l2_dmabuf";
+
 bool tryLock(Mutex& mutex)
 {
     bool locked = false;
@@ -114,35 +125,16 @@ bool tryLock(std::mutex& mutex)
 // Static instances
 const int VirtualCameraDeviceSession::kMaxProcessedStream;
 const int VirtualCameraDeviceSession::kMaxStallStream;
+const size_t VirtualCameraDeviceSession::OutputThread::kScratchFramesInFlight;
+const size_t VirtualCameraDeviceSession::OutputThread::kDepthMapBytes;
 HandleImporter VirtualCameraDeviceSession::sHandleImporter;
 
 std::mutex VirtualCameraDeviceSession::sSubDeviceBufferLock;
 std::condition_variable VirtualCameraDeviceSession::sSubDeviceBufferPushed;
-
-uint8_t* SubDeviceInData = NULL;
-size_t SubDeviceInDataSize = 0;
-
-#include <arm_neon.h>
-void ir_limit_max(const char* src, int n, char* dest)
-{
-    int i;
-    uint16x8_t base = vdupq_n_u16(64);
-    uint16x8_t max = vdupq_n_u16(0xff);
-    n /= 8;
-
-    for (i = 0; i < n; i++) {
-        uint16x8_t orig = vld1q_u16((const uint16_t *)src);
-        uint16x8_t temp;
-        uint16x8_t result;
-
-        temp = vqsubq_u16(orig, base);
-        result = vminq_u16(temp, max);
-        vst1q_u16((uint16_t *)dest, result);
-
-        src  += 8*2;
-        dest += 8*2;
-    }
-}
+VirtualCameraDeviceSession::LentV4l2Frame VirtualCameraDeviceSession::sSubDeviceFrame;
+std::atomic<int> VirtualCameraDeviceSession::sNumLentFrames(0);
+std::atomic<uint32_t> VirtualCameraDeviceSession::sLendEpoch(0);
+const int VirtualCameraDeviceSession::kMaxLentFrames;
 
 #define RK803_SET_GPIO1         _IOW('p',  1, int)
 #define RK803_SET_GPIO2         _IOW('p',  2, int)
@@ -274,6 +266,8 @@ bool VirtualCameraDeviceSession::initialize() {
     // TODO: check is PRIORITY_DISPLAY enough?
     mOutputThread->run("ExtCamOut", PRIORITY_DISPLAY);
     mFormatConvertThread->run("ExtFmtCvt", PRIORITY_DISPLAY);
+    // Frames are timestamped at dequeue, so the sensor thread runs ahead of the others
+    mSensorThread->run("ExtCamSensor", PRIORITY_URGENT_DISPLAY);
     //mEventThread->run("VirEvent", PRIORITY_DISPLAY);
 
     return false;
@@ -292,6 +286,7 @@ void VirtualCameraDeviceSession::initOutputThread() {
     mOutputThread = new OutputThread(this, mCroppingType, mCameraCharacteristics);
     mFormatConvertThread = new FormatConvertThread(mOutputThread);
     mEventThread = new EventThread(mOutputThread,mFormatConvertThread);
+    mSensorThread = new SensorThread(this);
 
 }
 
@@ -394,8 +389,10 @@ void VirtualCameraDeviceSession::dumpState(const native_handle_t* handle) {
             std::lock_guard<std::mutex> lk(mV4l2BufferLock);
             numDequeuedV4l2Buffers = mNumDequeuedV4l2Buffers;
         }
-        dprintf(fd, "V4L2 buffer queue size %zu, dequeued %zu\n",
-                v4L2BufferCount, numDequeuedV4l2Buffers);
+        dprintf(fd, "V4L2 buffer queue size %zu, dequeued %zu, %s, lent to sub device %d\n",
+                v4L2BufferCount, numDequeuedV4l2Buffers,
+                mV4l2Memory == V4L2_MEMORY_DMABUF ? "DMABUF" : "MMAP", sNumLentFrames.load());
+        mSensorThread->dump(fd);
     }
 
     dprintf(fd, "In-flight frames (not sorted):");
@@ -587,6 +584,16 @@ Return<void> VirtualCameraDeviceSession::close(bool callerIsDtor) {
     Mutex::Autolock _il(mInterfaceLock);
     bool closed = isClosed();
     if (!closed) {
+        // Stop the sensor first so requests still waiting for a frame fail right away
+        if (mSensorThread != nullptr) {
+            mSensorThread->requestExit();
+            std::vector<sp<V4L2Frame>> frames;
+            mSensorThread->stop(&frames);
+            for (const auto& frame : frames) {
+                enqueueV4l2Frame(frame);
+            }
+            mSensorThread->join();
+        }
         if (callerIsDtor) {
             closeOutputThreadImpl();
         } else {
@@ -806,6 +813,9 @@ Status VirtualCameraDeviceSession::processOneCaptureRequest(const CaptureRequest
         }
 
         if (requestFpsMax != mV4l2StreamingFps) {
+            // Frames held by the sensor thread count as dequeued, return them first; the
+            // ones lent to the sub device are waited for by v4l2StreamOffLocked
+            stopSensorLocked();
             {
                 std::unique_lock<std::mutex> lk(mV4l2BufferLock);
                 while (mNumDequeuedV4l2Buffers != 0) {
@@ -813,6 +823,8 @@ Status VirtualCameraDeviceSession::processOneCaptureRequest(const CaptureRequest
                     int waitRet = waitForV4L2BufferReturnLocked(lk);
                     if (waitRet != 0) {
                         ALOGE("%s: wait for pipeline idle failed!", __FUNCTION__);
+                        lk.unlock();
+                        mSensorThread->start();
                         return Status::INTERNAL_ERROR;
                     }
                 }
@@ -826,18 +838,14 @@ Status VirtualCameraDeviceSession::processOneCaptureRequest(const CaptureRequest
         return status;
     }
     //ALOGE("processOneCaptureRequest");
-    nsecs_t shutterTs = 0;
-    sp<V4L2Frame> frameIn = dequeueV4l2FrameLocked(&shutterTs);
-    if ( frameIn == nullptr) {
-        ALOGE("%s: V4L2 deque frame failed!", __FUNCTION__);
-        return Status::INTERNAL_ERROR;
-    }
 
+    // frameIn is bound by FormatConvertThread to the latest sensor frame when it picks up
+    // the request, see bindLatestFrame
     std::shared_ptr<HalRequest> halReq = std::make_shared<HalRequest>();
     halReq->frameNumber = request.frameNumber;
     halReq->setting = mLatestReqSetting;
-    halReq->frameIn = frameIn;
-    halReq->shutterTs = shutterTs;
+    halReq->frameIn = nullptr;
+    halReq->shutterTs = 0;
     halReq->buffers.resize(numOutputBufs);
     for (size_t i = 0; i < numOutputBufs; i++) {
         HalStreamBuffer& halBuf = halReq->buffers[i];
@@ -888,10 +896,12 @@ Status VirtualCameraDeviceSession::processCaptureRequestError(
         /*out*/std::vector<NotifyMsg>* outMsgs,
         /*out*/std::vector<CaptureResult>* outResults) {
     ATRACE_CALL();
-    // Return V4L2 buffer to V4L2 buffer queue
+    // Return V4L2 buffer to V4L2 buffer queue, if the request got one
     sp<V3_4::virtuals::implementation::V4L2Frame> v4l2Frame =
             static_cast<V3_4::virtuals::implementation::V4L2Frame*>(req->frameIn.get());
-    enqueueV4l2Frame(v4l2Frame);
+    if (v4l2Frame != nullptr) {
+        enqueueV4l2Frame(v4l2Frame);
+    }
 
     if (outMsgs == nullptr) {
         notifyShutter(req->frameNumber, req->shutterTs);
@@ -1110,111 +1120,16 @@ int VirtualCameraDeviceSession::FormatConvertThread::jpegDecoder(
 void VirtualCameraDeviceSession::FormatConvertThread:: yuyvToNv12(
             int v4l2_fmt_dst, char *srcbuf, char *dstbuf,
             int src_w, int src_h,int dst_w, int dst_h) {
-    int *dstint_y, *dstint_uv, *srcint, y_size, i;
-
-    y_size = src_w * src_h;
     if (v4l2_fmt_dst == V4L2_PIX_FMT_NV12) {
         if ((src_w == dst_w) && (src_h == dst_h)) {
-            dstint_y = (int*)dstbuf;
-            srcint = (int*)srcbuf;
-            dstint_uv =  (int*)(dstbuf + y_size);
-#if defined(__arm64__) || defined(__aarch64__)
-ALOGE("64");
-            for (i = 0; i < src_h; i++) {
-                for (int j = 0; j < (src_w >> 2); j++) {
-                    if (i % 2 == 0) {
-                        *dstint_uv++ = (*(srcint+1) & 0xff000000) |
-                                    ((*(srcint+1) & 0x0000ff00) << 8) |
-                                    ((*srcint & 0xff000000) >> 16) |
-                                    ((*srcint & 0x0000ff00) >> 8);
-                    }
-                    *dstint_y++ = ((*(srcint+1) & 0x00ff0000) << 8) |
-                                    ((*(srcint+1) & 0x000000ff) << 16) |
-                                    ((*srcint & 0x00ff0000) >> 8) |
-                                    (*srcint & 0x000000ff);
-                    srcint += 2;
-                }
-            }
-#else
-ALOGE("32");
-            for (i = 0; i < src_h; i++) {
-                int n = src_w;
-                char tmp = i % 2; // get uv only when in even row
-                asm volatile (
-                    "   pld [%[src], %[src_stride], lsl #2]                 \n\t"
-                    "   cmp %[n], #16                                       \n\t"
-                    "   blt 5f                                              \n\t"
-                    "0: @ 16 pixel swap                                     \n\t"
-                    "   vld2.8  {q0,q1} , [%[src]]!  @ q0 = y q1 = uv       \n\t"
-                    "   vst1.16 {q0},[%[dst_y]]!     @ now q0  -> dst       \n\t"
-                    "   cmp %[tmp], #1                                      \n\t"
-                    "   bge 1f                                              \n\t"
-                    "   vst1.16 {q1},[%[dst_uv]]!    @ now q1  -> dst       \n\t"
-                    "1: @ don't need get uv in odd row                      \n\t"
-                    "   sub %[n], %[n], #16                                 \n\t"
-                    "   cmp %[n], #16                                       \n\t"
-                    "   bge 0b                                              \n\t"
-                    "5: @ end                                               \n\t"
-                    : [dst_y] "+r" (dstint_y), [dst_uv] "+r" (dstint_uv),
-                      [src] "+r" (srcint), [n] "+r" (n),[tmp] "+r" (tmp)
-                    : [src_stride] "r" (src_w)
-                    : "cc", "memory", "q0", "q1", "q2"
-                );
-            }
-#endif
+            ::virtuals::VirCamConvert::yuyvToNv12((const uint8_t*)srcbuf, src_w * 2,
+                    (uint8_t*)dstbuf, dst_w, (uint8_t*)dstbuf + dst_w * dst_h, dst_w,
+                    dst_w, dst_h);
         }
     } else {
         LOGE("don't support this format !");
     }
 }
- void yuyv_to_nv12(char * image_in, char* image_out, int width, int height, unsigned long int filesize)
-  {
-       /* 计算循环次数，YUYV 一个像素点占2个字节*/
-	   int pixNUM = width * height;
-	   unsigned int cycleNum = filesize /pixNUM/2;
-	   printf("cycleNUM = %d\n",cycleNum);
-
-	  /*单帧图像中 NV12格式的输出图像 Y分量 和 UV 分量的起始地址，并初始化*/
-	  char *y = image_out;
-	  char *uv = image_out + pixNUM ;
-
-	  char *start = image_in;
-      unsigned int i =0;
-	  int j =0,k =0;
-
-	  /*处理Y分量*/
-	  for(i= 0; i<cycleNum ;i++)
-	  {
-		int index =0;
-		for(j =0; j< pixNUM*2; j=j+2) //YUYV单行中每两个字节一个Y分量
-		{
-			*(y+index) = *(start + j);
-			index ++;
-		}
-		start = image_in + pixNUM*2*i;
-		y= y + pixNUM*3/2;
-	  }
-
-      /**处理UV分量**/
-	  start = image_in;
-	  for(i= 0; i<cycleNum ;i++)
-	  {
-	    int uv_index = 0;
-		for(j=0; j< height; j =j+2)  // 隔行, 我选择保留偶数行
-		{
-			for(k = j*width*2+1; k< width*2*(j+1); k=k+4) //YUYV单行中每四个字节含有一对UV分量
-			{
-				*(uv+ uv_index) = *(start + k);
-				*(uv +uv_index+1) = *(start +k +2);
-                // *(uv+ uv_index) = 0x1F;
-				// *(uv +uv_index+1) =  0x1F;
-				uv_index += 2;
-			}
-		}
-	    start = image_in + pixNUM*2*i;
-	    uv =uv + pixNUM*3/2;
-	  }
- }
 
 bool VirtualCameraDeviceSession::FormatConvertThread::threadLoop() {
     std::shared_ptr<HalRequest> req;
@@ -1228,6 +1143,10 @@ bool VirtualCameraDeviceSession::FormatConvertThread::threadLoop() {
         // No new request, wait again
         return true;
     }
+    if (mFmtOutputThread->bindLatestFrame(req) != Status::OK) {
+        // Already returned with an error
+        return true;
+    }
     if (req->frameIn->mFourcc != V4L2_PIX_FMT_MJPEG &&
             req->frameIn->mFourcc != V4L2_PIX_FMT_Z16 &&
             req->frameIn->mFourcc != V4L2_PIX_FMT_YUYV &&
@@ -1253,10 +1172,11 @@ bool VirtualCameraDeviceSession::FormatConvertThread::threadLoop() {
     {
         //debugShowFPS("NormalDevice");
     }
-    if(!mFmtOutputThread->isSubDevice()){
-        if (req->frameIn->getData(&inData, &inDataSize) != 0) {
-            LOGE("%s(%d)getData failed!\n", __FUNCTION__, __LINE__);
-        }
+    // On the sub device this maps the frame the main device lent it
+    if (req->frameIn->getData(&inData, &inDataSize) != 0) {
+        LOGE("%s(%d)getData failed!\n", __FUNCTION__, __LINE__);
+        mFmtOutputThread->submitRequest(req);
+        return true;
     }
 
     mShareFd = mCamMemManager->getBufferAddr(
@@ -1268,16 +1188,6 @@ bool VirtualCameraDeviceSession::FormatConvertThread::threadLoop() {
         req->inDataSize = inDataSize;
         //memset((void*)req->inData,0,(req->frameIn->mWidth*req->frameIn->mHeight /**3/2*/));
         ALOGV("%s,MainDevice mBufferIndex %d",__FUNCTION__,req->frameIn->mBufferIndex);
-        // if(req->frameIn->mBufferIndex%2==0){
-        //     std::lock_guard<std::mutex> lk(sSubDeviceBufferLock);
-        //     if(SubDeviceInData == NULL){
-        //         SubDeviceInData = (uint8_t*) malloc(inDataSize);
-        //     }
-        //     memcpy((void*)SubDeviceInData,(void*)inData,inDataSize);
-        //     SubDeviceInDataSize = inDataSize;
-        //     ALOGE("%s,MainDevice push %d",__FUNCTION__,req->frameIn->mBufferIndex);
-        //     sSubDeviceBufferPushed.notify_one();
-        // }
     }
 
 //    memcpy((void*)mVirAddr,(void*)inData,inDataSize);
@@ -1287,22 +1197,8 @@ bool VirtualCameraDeviceSession::FormatConvertThread::threadLoop() {
     int tmpH = (req->frameIn->mHeight + 15) & (~15);
 
     if(mFmtOutputThread->isMainDevice()){
-        static int frameCount = req->frameNumber;
-        if(++frameCount > 5 && frameCount<10){
-            FILE* fp =NULL;
-            char filename[128];
-            filename[0] = 0x00;
-            sprintf(filename, "data/camera/main_camera_dump_%dx%d_%d.raw",
-                    tmpW, tmpH, frameCount);
-            fp = fopen(filename, "wb+");
-            if (fp != NULL) {
-                fwrite((char*)req->inData, 1, req->inDataSize, fp);
-                fclose(fp);
-                ALOGE("Write success RAW data to %s",filename);
-            } else {
-                ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-            }
-        }
+        mFmtOutputThread->dumpFrame("main_camera_dump", req->frameNumber, tmpW, tmpH,
+                "raw", req->inData, req->inDataSize);
     }
 
     if (req->frameIn->mFourcc == V4L2_PIX_FMT_MJPEG) {
@@ -1313,26 +1209,8 @@ bool VirtualCameraDeviceSession::FormatConvertThread::threadLoop() {
             mFmtOutputThread->submitRequest(req);
             return true;
         }
-#ifdef DUMP_YUV
-        {
-            int frameCount = req->frameNumber;
-            if(frameCount > 5 && frameCount<10){
-                FILE* fp =NULL;
-                char filename[128];
-                filename[0] = 0x00;
-                sprintf(filename, "/data/camera/camera_dump_hwjpeg_%dx%d_%d.yuv",
-                        tmpW, tmpH, frameCount);
-                fp = fopen(filename, "wb+");
-                if (fp != NULL) {
-                    fwrite((char*)mVirAddr,1,tmpW*tmpH*1.5,fp);
-                    fclose(fp);
-                    ALOGI("Write success YUV data to %s",filename);
-                } else {
-                    ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                }
-            }
-        }
-#endif
+        mFmtOutputThread->dumpFrame("camera_dump_hwjpeg", req->frameNumber, tmpW, tmpH,
+                "yuv", (const void*)mVirAddr, tmpW * tmpH * 3 / 2);
 
 #endif
         req->mShareFd = mShareFd;
@@ -1346,94 +1224,36 @@ bool VirtualCameraDeviceSession::FormatConvertThread::threadLoop() {
     }
     if (req->frameIn->mFourcc == V4L2_PIX_FMT_SRGGB10) {
 
+        // Narrowed into a scratch frame the request keeps until its buffers are filled
         if(mFmtOutputThread->isSubDevice()){
-            std::unique_lock<std::mutex> lk(sSubDeviceBufferLock);
-            static uint8_t *temp_ir_limit =(uint8_t*) malloc(SubDeviceInDataSize);
-            static uint8_t *temp =(uint8_t*) malloc(SubDeviceInDataSize);
-            static uint8_t* tmpData = (uint8_t*) malloc(SubDeviceInDataSize);
-            memcpy((void*)temp_ir_limit,(void*)SubDeviceInData,SubDeviceInDataSize);
-            ir_limit_max((char*)temp_ir_limit,SubDeviceInDataSize/2,(char*)temp);
-            // yuyv_to_nv12((char*)temp,
-            //      (char*)tmpData, tmpW, tmpH,SubDeviceInDataSize);
-            // memset((void*)(tmpData+tmpW* tmpH),0x80,tmpW* tmpH /2);
-            req->inData = temp;
-            req->inDataSize = SubDeviceInDataSize;
-            ALOGV("%s,SubDevice mBufferIndex %d",__FUNCTION__,req->frameIn->mBufferIndex);
-            //memset((void*)SubDeviceInData,0,(req->frameIn->mWidth*req->frameIn->mHeight /**3/2*/));
-            if(mFmtOutputThread->isMainDevice()){
-                static int frameCount = req->frameNumber;
-                if(++frameCount > 5 && frameCount<10){
-                    FILE* fp =NULL;
-                    char filename[128];
-                    filename[0] = 0x00;
-                    sprintf(filename, "/data/camera/camera_dump_%dx%d_%d.low0.raw",
-                            tmpW, tmpH, frameCount);
-                    fp = fopen(filename, "wb+");
-                    if (fp != NULL) {
-                        fwrite((char*)temp, 1, req->inDataSize, fp);
-                        fclose(fp);
-                        ALOGD("Write success RAW data to %s",filename);
-                    } else {
-                        ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                    }
-                }
+            std::shared_ptr<uint8_t> scratch = mFmtOutputThread->acquireScratch(inDataSize);
+            if (scratch == nullptr) {
+                LOGE("no scratch frame for %zu bytes", inDataSize);
+                mFmtOutputThread->submitRequest(req);
+                return true;
             }
+            ::virtuals::VirCamConvert::narrow16((const uint16_t*)inData,
+                    (uint16_t*)scratch.get(), inDataSize / 2,
+                    ::virtuals::VirCamConvert::kIrLimit);
+            req->scratch = scratch;
+            req->inData = scratch.get();
+            req->inDataSize = inDataSize;
+            ALOGV("%s,SubDevice mBufferIndex %d",__FUNCTION__,req->frameIn->mBufferIndex);
             if(mFmtOutputThread->isMainDevice()){
-                static int frameCount = req->frameNumber;
-                if(++frameCount > 5 && frameCount<10){
-                    FILE* fp =NULL;
-                    char filename[128];
-                    filename[0] = 0x00;
-                    sprintf(filename, "/data/camera/camera_dump_%dx%d_%d.low0.nv12",
-                            tmpW, tmpH, frameCount);
-                    fp = fopen(filename, "wb+");
-                    if (fp != NULL) {
-                        fwrite((char*)tmpData, 1, req->inDataSize, fp);
-                        fclose(fp);
-                        ALOGD("Write success RAW data to %s",filename);
-                    } else {
-                        ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                    }
-                }
+                mFmtOutputThread->dumpFrame("camera_dump_low0", req->frameNumber, tmpW, tmpH,
+                        "raw", req->inData, req->inDataSize);
             }
         }else{
-            static uint8_t *temp_ir_limit =(uint8_t*) malloc(inDataSize);
-            static uint8_t *temp =(uint8_t*) malloc(inDataSize);
-            static uint8_t* tmpData = (uint8_t*) malloc(inDataSize);
-
-            static char * buf = (char *)malloc(tmpW*tmpH * 2);
-            memcpy((void*)buf,(void*)inData,inDataSize);
-            static unsigned short * depthMap = (unsigned short *)malloc(tmpW*tmpH*2);
-
-            // ALOGE("doAlgo in");
-            // doAlgo(buf, tmpW, tmpH, 16, depthMap);
-            // {
-            //     static int frameCount = req->frameNumber;
-            //     if(++frameCount > 5 && frameCount<10){
-            //         FILE* fp =NULL;
-            //         char filename[128];
-            //         filename[0] = 0x00;
-            //         sprintf(filename, "/data/camera/depthMap_dump_%dx%d_%d.raw",
-            //                 tmpW, tmpH, frameCount);
-            //         fp = fopen(filename, "wb+");
-            //         if (fp != NULL) {
-            //             fwrite((char*)depthMap, 1, req->inDataSize, fp);
-            //             fclose(fp);
-            //             ALOGE("Write success RAW data to %s",filename);
-            //         } else {
-            //             ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-            //         }
-            //     }
-            // }
-            // ALOGE("doAlgo out");
-
-            memcpy((void*)temp_ir_limit,(void*)inData,inDataSize);
-            ir_limit_max((char*)temp_ir_limit,tmpW*tmpH,(char*)temp);
-
-            // yuyv_to_nv12((char*)temp,
-            //      (char*)tmpData, tmpW, tmpH,inDataSize);
-            // memset((void*)(tmpData+tmpW* tmpH),0x80,tmpW* tmpH /2);
-            req->inData = temp;
+            std::shared_ptr<uint8_t> scratch = mFmtOutputThread->acquireScratch(inDataSize);
+            if (scratch == nullptr) {
+                LOGE("no scratch frame for %zu bytes", inDataSize);
+                mFmtOutputThread->submitRequest(req);
+                return true;
+            }
+            ::virtuals::VirCamConvert::narrow16((const uint16_t*)inData, (uint16_t*)scratch.get(),
+                    inDataSize / 2, ::virtuals::VirCamConvert::kIrLimit);
+            req->scratch = scratch;
+            req->inData = scratch.get();
             req->inDataSize = inDataSize;
         }
         // ALOGE("cvt nv12:%dx%d,inDataSize：%d",tmpW,tmpH,inDataSize);
@@ -1663,7 +1483,99 @@ VirtualCameraDeviceSession::OutputThread::OutputThread(
         const common::V1_0::helper::CameraMetadata& chars) :
         mParent(parent), mCroppingType(ct), mCameraCharacteristics(chars) {}
 
-VirtualCameraDeviceSession::OutputThread::~OutputThread() {}
+VirtualCameraDeviceSession::OutputThread::~OutputThread() {
+    for (auto& worker : mBufferWorkers) {
+        worker->requestExit();
+    }
+    for (auto& worker : mBufferWorkers) {
+        worker->join();
+    }
+}
+
+status_t VirtualCameraDeviceSession::OutputThread::readyToRun() {
+    for (int i = 0; i < kNumBufferWorkers; i++) {
+        sp<BufferWorkerThread> worker = new BufferWorkerThread(*this);
+        status_t ret = worker->run("ExtCamOutWorker", PRIORITY_DISPLAY);
+        if (ret != OK) {
+            // The buffers are filled on the OutputThread alone then
+            ALOGW("%s: starting buffer worker %d failed: %d", __FUNCTION__, i, ret);
+            break;
+        }
+        mBufferWorkers.push_back(worker);
+    }
+    return OK;
+}
+
+VirtualCameraDeviceSession::OutputThread::BufferWorkerThread::BufferWorkerThread(
+        OutputThread& owner) : mOwner(owner) {}
+
+bool VirtualCameraDeviceSession::OutputThread::BufferWorkerThread::threadLoop() {
+    mOwner.runBufferTask(kReqWaitTimeoutMs);
+    return true;
+}
+
+bool VirtualCameraDeviceSession::OutputThread::runBufferTask(int timeoutMs) {
+    std::unique_lock<std::mutex> lk(mBufferTaskLock);
+    if (mBufferTasks.empty()) {
+        if (timeoutMs == 0) {
+            return false;
+        }
+        mBufferTaskCond.wait_for(lk, std::chrono::milliseconds(timeoutMs));
+        if (mBufferTasks.empty()) {
+            return false;
+        }
+    }
+    std::function<void()> task = std::move(mBufferTasks.front());
+    mBufferTasks.pop_front();
+    lk.unlock();
+
+    task();
+
+    lk.lock();
+    mBufferTasksPending--;
+    lk.unlock();
+    mBufferTaskDoneCond.notify_all();
+    return true;
+}
+
+void VirtualCameraDeviceSession::OutputThread::runBufferTasks(
+        size_t count, const std::function<void(size_t)>& fn) {
+    ATRACE_CALL();
+    if (count == 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mBufferTaskLock);
+        mBufferTasksPending += count - 1;
+        for (size_t i = 1; i < count; i++) {
+            mBufferTasks.push_back([&fn, i] { fn(i); });
+        }
+    }
+    mBufferTaskCond.notify_all();
+
+    // The first buffer here, then whatever the workers have not picked up yet
+    fn(0);
+    while (runBufferTask(/*timeoutMs*/0)) {}
+
+    std::unique_lock<std::mutex> lk(mBufferTaskLock);
+    while (mBufferTasksPending != 0) {
+        mBufferTaskDoneCond.wait(lk);
+    }
+}
+
+void VirtualCameraDeviceSession::OutputThread::recordBufferTiming(
+        int streamId, nsecs_t startTs, nsecs_t fenceDoneTs, nsecs_t doneTs) {
+    std::lock_guard<std::mutex> lk(mTimingLock);
+    StreamTiming& timing = mStreamTimings[streamId];
+    nsecs_t processNs = doneTs - fenceDoneTs;
+    timing.buffers++;
+    timing.totalFenceWaitNs += fenceDoneTs - startTs;
+    timing.totalProcessNs += processNs;
+    timing.lastProcessNs = processNs;
+    if (processNs > timing.maxProcessNs) {
+        timing.maxProcessNs = processNs;
+    }
+}
 
 void VirtualCameraDeviceSession::OutputThread::setExifMakeModel(
         const std::string& make, const std::string& model) {
@@ -1673,6 +1585,7 @@ void VirtualCameraDeviceSession::OutputThread::setExifMakeModel(
 
 int VirtualCameraDeviceSession::OutputThread::cropAndScaleLocked(
         sp<AllocatedFrame>& in, const Size& outSz, YCbCrLayout* out) {
+    std::lock_guard<std::mutex> scaleLk(mScaleLock);
     Size inSz = {in->mWidth, in->mHeight};
 
     int ret;
@@ -1682,6 +1595,7 @@ int VirtualCameraDeviceSession::OutputThread::cropAndScaleLocked(
             ALOGE("%s: failed to get input image layout", __FUNCTION__);
             return ret;
         }
+        mScaleViews++;
         return ret;
     }
 
@@ -1702,26 +1616,30 @@ int VirtualCameraDeviceSession::OutputThread::cropAndScaleLocked(
         return ret;
     }
 
-    if ((mCroppingType == VERTICAL && inSz.width == outSz.width) ||
-            (mCroppingType == HORIZONTAL && inSz.height == outSz.height)) {
-        // No scale is needed
+    if (inputCrop.width == static_cast<int32_t>(outSz.width) &&
+            inputCrop.height == static_cast<int32_t>(outSz.height)) {
+        // No scale is needed, the cropped planes are the output
         *out = croppedLayout;
+        mScaleViews++;
         return 0;
     }
 
-    auto it = mScaledYu12Frames.find(outSz);
-    sp<AllocatedFrame> scaledYu12Buf;
-    if (it != mScaledYu12Frames.end()) {
-        scaledYu12Buf = it->second;
-    } else {
-        it = mIntermediateBuffers.find(outSz);
-        if (it == mIntermediateBuffers.end()) {
-            ALOGE("%s: failed to find intermediate buffer size %dx%d",
-                    __FUNCTION__, outSz.width, outSz.height);
-            return -1;
-        }
-        scaledYu12Buf = it->second;
+    // Streams of the same geometry share one scale pass per request
+    ScaleKey key {inputCrop, outSz};
+    auto memo = mScaledYu12Frames.find(key);
+    if (memo != mScaledYu12Frames.end()) {
+        *out = memo->second;
+        mScaleReuses++;
+        return 0;
+    }
+
+    auto it = mIntermediateBuffers.find(outSz);
+    if (it == mIntermediateBuffers.end()) {
+        ALOGE("%s: failed to find intermediate buffer size %dx%d",
+                __FUNCTION__, outSz.width, outSz.height);
+        return -1;
     }
+    sp<AllocatedFrame> scaledYu12Buf = it->second;
     // Scale
     YCbCrLayout outLayout;
     ret = scaledYu12Buf->getLayout(&outLayout);
@@ -1758,13 +1676,15 @@ int VirtualCameraDeviceSession::OutputThread::cropAndScaleLocked(
     }
 
     *out = outLayout;
-    mScaledYu12Frames.insert({outSz, scaledYu12Buf});
+    mScaledYu12Frames.insert({key, outLayout});
+    mScalePasses++;
     return 0;
 }
 
 
 int VirtualCameraDeviceSession::OutputThread::cropAndScaleThumbLocked(
         sp<AllocatedFrame>& in, const Size &outSz, YCbCrLayout* out) {
+    std::lock_guard<std::mutex> scaleLk(mScaleLock);
     Size inSz  {in->mWidth, in->mHeight};
 
     if ((outSz.width * outSz.height) >
@@ -2162,6 +2082,355 @@ int VirtualCameraDeviceSession::OutputThread::createJpegLocked(
 }
 
 
+// Fills one output buffer of req from mYu12Frame or the V4L2 input, which are not written
+// here; runs on the OutputThread or a BufferWorkerThread while OutputThread holds mBufferLock
+int VirtualCameraDeviceSession::OutputThread::processOutputBufferLocked(
+        const std::shared_ptr<HalRequest>& req, HalStreamBuffer& halBuf,
+        int tempFrameWidth, int tempFrameHeight, int is16Align,
+        const unsigned short* depthMap) {
+    ATRACE_CALL();
+    const int kSyncWaitTimeoutMs = 500;
+    nsecs_t startTs = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (*(halBuf.bufPtr) == nullptr) {
+        ALOGW("%s: buffer for stream %d missing", __FUNCTION__, halBuf.streamId);
+        halBuf.fenceTimeout = true;
+    } else if (halBuf.acquireFence >= 0) {
+        int ret = sync_wait(halBuf.acquireFence, kSyncWaitTimeoutMs);
+        if (ret) {
+            halBuf.fenceTimeout = true;
+        } else {
+            ::close(halBuf.acquireFence);
+            halBuf.acquireFence = -1;
+        }
+    }
+
+    nsecs_t fenceDoneTs = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (halBuf.fenceTimeout) {
+        recordBufferTiming(halBuf.streamId, startTs, fenceDoneTs, fenceDoneTs);
+        return 0;
+    }
+    //ALOGE("halBuf.format:%d",halBuf.format);
+
+    // Gralloc lockYCbCr the buffer
+    switch (halBuf.format) {
+        case PixelFormat::BLOB: {
+            int ret = createJpegLocked(halBuf, req->setting);
+
+            if(ret != 0) {
+                ALOGE("%s: createJpegLocked failed with %d", __FUNCTION__, ret);
+                return -1;
+            }
+        } break;
+        case PixelFormat::Y16: {
+            void* outLayout = sHandleImporter.lock(*(halBuf.bufPtr), halBuf.usage, req->inDataSize);
+
+            std::memcpy(outLayout, req->inData, req->inDataSize);
+
+            int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
+            if (relFence >= 0) {
+                halBuf.acquireFence = relFence;
+            }
+        } break;
+        case PixelFormat::RAW10:
+        {
+            ALOGV("@%s,PixelFormat::RAW ->:%d,",__FUNCTION__,halBuf.format);
+            const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
+                    void* mVirAddr = NULL;
+                    int ret = ::virtuals::VirCamGralloc4::vir_lock(
+                                tmp_hand,
+                                halBuf.usage,
+                                0,
+                                0,
+                                halBuf.width,
+                                halBuf.height,
+                                (void**)&mVirAddr);
+                    if (ret) {
+                        LOGE("lock buffer error : %s", strerror(errno));
+                    }
+                    ::virtuals::VirCamGralloc4::vir_unlock(tmp_hand);
+
+            ALOGV("isMainDevice:%d,isSubDevice:%d,memcpy: req->inDataSize %d",isMainDevice(),isSubDevice(),req->inDataSize);
+            std::memcpy(mVirAddr, req->inData, halBuf.width*halBuf.height*1.25);
+            ALOGV("@%s,PixelFormat::RAW :%d,",__FUNCTION__,halBuf.format);
+            break;
+
+        }
+        case PixelFormat::RAW12:
+        case PixelFormat::RAW16:
+        {
+            ALOGV("@%s,PixelFormat::RAW ->:%d,",__FUNCTION__,halBuf.format);
+            const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
+                    void* mVirAddr = NULL;
+                    int ret = ::virtuals::VirCamGralloc4::vir_lock(
+                                tmp_hand,
+                                halBuf.usage,
+                                0,
+                                0,
+                                halBuf.width,
+                                halBuf.height,
+                                (void**)&mVirAddr);
+                    if (ret) {
+                        LOGE("lock buffer error : %s", strerror(errno));
+                    }
+                    ::virtuals::VirCamGralloc4::vir_unlock(tmp_hand);
+            ALOGV("isMainDevice:%d,isSubDevice:%d,memcpy: req->inDataSize %d",isMainDevice(),isSubDevice(),req->inDataSize);
+            if(isSubDevice()&&req->frameIn->mBufferIndex%2==0){
+                std::memcpy(mVirAddr, depthMap, halBuf.width*halBuf.height*2);
+            }else{
+                std::memcpy(mVirAddr, req->inData, halBuf.width*halBuf.height*2);
+            }
+            ALOGV("@%s,PixelFormat::RAW :%d,",__FUNCTION__,halBuf.format);
+            break;
+
+        }
+        case PixelFormat::YV12: {
+            IMapper::Rect outRect {0, 0,
+                    static_cast<int32_t>(halBuf.width),
+                    static_cast<int32_t>(halBuf.height)};
+            YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
+                    *(halBuf.bufPtr), halBuf.usage, outRect);
+            ALOGV("%s: outLayout y %p cb %p cr %p y_str %d c_str %d c_step %d",
+                    __FUNCTION__, outLayout.y, outLayout.cb, outLayout.cr,
+                    outLayout.yStride, outLayout.cStride, outLayout.chromaStep);
+
+            // Convert to output buffer size/format
+            uint32_t outputFourcc = getFourCcFromLayout(outLayout);
+            ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__,
+                    outputFourcc & 0xFF,
+                    (outputFourcc >> 8) & 0xFF,
+                    (outputFourcc >> 16) & 0xFF,
+                    (outputFourcc >> 24) & 0xFF);
+
+            YCbCrLayout cropAndScaled;
+            ATRACE_BEGIN("cropAndScaleLocked");
+            int ret = cropAndScaleLocked(
+                    mYu12Frame,
+                    Size { halBuf.width, halBuf.height },
+                    &cropAndScaled);
+            ATRACE_END();
+            if (ret != 0) {
+                ALOGE("%s: crop and scale failed!", __FUNCTION__);
+                return -1;
+            }
+
+            Size sz {halBuf.width, halBuf.height};
+            ATRACE_BEGIN("formatConvert");
+            ret = formatConvert(cropAndScaled, outLayout, sz, outputFourcc);
+            ATRACE_END();
+            if (ret != 0) {
+                ALOGE("%s: format coversion failed!", __FUNCTION__);
+                return -1;
+            }
+            int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
+            if (relFence >= 0) {
+                halBuf.acquireFence = relFence;
+            }
+        } break;
+        case PixelFormat::YCBCR_420_888:
+        case PixelFormat::IMPLEMENTATION_DEFINED:
+        case PixelFormat::YCRCB_420_SP: {
+            if (req->frameIn->mFourcc == V4L2_PIX_FMT_YUYV){
+                // mYu12Frame was converted once for all buffers in threadLoop
+                int ret = 0;
+                IMapper::Rect outRect {0, 0,
+                        static_cast<int32_t>(halBuf.width),
+                        static_cast<int32_t>(halBuf.height)};
+                YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
+                        *(halBuf.bufPtr), halBuf.usage, outRect);
+                ALOGV("%s: outLayout y %p cb %p cr %p y_str %d c_str %d c_step %d",
+                        __FUNCTION__, outLayout.y, outLayout.cb, outLayout.cr,
+                        outLayout.yStride, outLayout.cStride, outLayout.chromaStep);
+
+                // Convert to output buffer size/format
+                uint32_t outputFourcc = getFourCcFromLayout(outLayout);
+                ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__,
+                        outputFourcc & 0xFF,
+                        (outputFourcc >> 8) & 0xFF,
+                        (outputFourcc >> 16) & 0xFF,
+                        (outputFourcc >> 24) & 0xFF);
+
+                YCbCrLayout cropAndScaled;
+                ATRACE_BEGIN("cropAndScaleLocked");
+                ret = cropAndScaleLocked(
+                        mYu12Frame,
+                        Size { halBuf.width, halBuf.height },
+                        &cropAndScaled);
+                ATRACE_END();
+                if (ret != 0) {
+                    ALOGE("%s: crop and scale failed!", __FUNCTION__);
+                    return -1;
+                }
+                Size sz {halBuf.width, halBuf.height};
+                ATRACE_BEGIN("formatConvert");
+                ret = formatConvert(cropAndScaled, outLayout, sz, outputFourcc);
+                ATRACE_END();
+                if (ret != 0) {
+                    ALOGE("%s: format coversion failed!", __FUNCTION__);
+                    return -1;
+                }
+                int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
+                if (relFence >= 0) {
+                    halBuf.acquireFence = relFence;
+                }
+            } else if (req->frameIn->mFourcc == V4L2_PIX_FMT_NV12){
+
+                int handle_fd = -1, ret;
+                const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
+                ret = ::virtuals::VirCamGralloc4::get_share_fd(tmp_hand, &handle_fd);
+                if (handle_fd == -1) {
+                    LOGE("convert tmp_hand to dst_fd error");
+                    return -1;
+                }
+                ALOGV("%s(%d) halBuf handle_fd(%d) halbuf_wxh(%dx%d) frameNumber(%d)", __FUNCTION__, __LINE__,handle_fd,
+                    halBuf.width, halBuf.height, req->frameNumber);
+                int frameFd = req->frameIn->getShareFd();
+                if (frameFd >= 0 && req->scratch == nullptr &&
+                        req->inDataSize < (size_t)halBuf.width * halBuf.height * 2) {
+                    // An 8 bit frame the driver wrote to a dmabuf: RGA reads the capture buffer
+                    camera2::RgaCropScale::rga_nv12_scale_crop(
+                        tempFrameWidth, tempFrameHeight, frameFd, handle_fd,
+                        halBuf.width, halBuf.height, 100, false, true,
+                        (halBuf.format == PixelFormat::YCRCB_420_SP), is16Align,
+                        false);
+                    break;
+                }
+                unsigned long vir_addr =  reinterpret_cast<unsigned long>(req->inData);
+                //memcpy(halBuf.bufPtr,(const void*)vir_addr, halBuf.width*halBuf.height);
+                // Every buffer filled in parallel stages in a scratch frame of its own
+                std::shared_ptr<uint8_t> staging =
+                        acquireScratch((size_t)halBuf.width * (halBuf.height + (halBuf.height + 1) / 2));
+                if (staging == nullptr) {
+                    LOGE("no NV12 staging frame for %dx%d", halBuf.width, halBuf.height);
+                    return -1;
+                }
+                uint8_t* mVirAddr = staging.get();
+                if (req->inDataSize >= (size_t)halBuf.width * halBuf.height * 2) {
+                    ::virtuals::VirCamConvert::narrow16ToGreyNv12((const uint16_t*)req->inData,
+                            mVirAddr, halBuf.width, halBuf.height, ::virtuals::VirCamConvert::kLowByte);
+                } else {
+                    // Too small for 16 bit samples: take the luma plane as is
+                    memcpy(mVirAddr, req->inData, halBuf.width * halBuf.height);
+                    memset(mVirAddr + halBuf.width * halBuf.height, 0x80, halBuf.width * halBuf.height / 2);
+                }
+
+                camera2::RgaCropScale::rga_nv12_scale_crop(
+                    tempFrameWidth, tempFrameHeight,reinterpret_cast<unsigned long>( mVirAddr), handle_fd,
+                    halBuf.width, halBuf.height, 100, false, true,
+                    (halBuf.format == PixelFormat::YCRCB_420_SP), is16Align,
+                    true);
+            } else if (req->frameIn->mFourcc == V4L2_PIX_FMT_SRGGB10){
+
+                // int handle_fd = -1, ret;
+                // const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
+                // ret = ::virtuals::VirCamGralloc4::get_share_fd(tmp_hand, &handle_fd);
+                // if (handle_fd == -1) {
+                //     LOGE("convert tmp_hand to dst_fd error");
+                //     return -EINVAL;
+                // }
+                // ALOGD("%s(%d) halBuf handle_fd(%d) halbuf_wxh(%dx%d) frameNumber(%d)", __FUNCTION__, __LINE__,handle_fd,
+                //     halBuf.width, halBuf.height, req->frameNumber);
+                // unsigned long vir_addr =  reinterpret_cast<unsigned long>(req->inData);
+                // //memcpy(halBuf.bufPtr,(const void*)vir_addr, halBuf.width*halBuf.height);
+                // camera2::RgaCropScale::rga_nv12_scale_crop(
+                //     tempFrameWidth, tempFrameHeight, vir_addr, handle_fd,
+                //     halBuf.width, halBuf.height, 100, false, true,
+                //     (halBuf.format == PixelFormat::YCRCB_420_SP), is16Align,
+                //     true);
+
+                    //ALOGE("@%s,PixelFormat::RAW ->:%d,",__FUNCTION__,halBuf.format);
+                const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
+                        void* mVirAddr = NULL;
+
+                        int ret = ::virtuals::VirCamGralloc4::vir_lock(
+                                    tmp_hand,
+                                    halBuf.usage,
+                                    0,
+                                    0,
+                                    halBuf.width,
+                                    halBuf.height,
+                                    (void**)&mVirAddr);
+                        if (ret) {
+                            LOGE("lock buffer error : %s", strerror(errno));
+                        }
+
+                        ::virtuals::VirCamGralloc4::vir_unlock(tmp_hand);
+
+                // yuyvToNv12(V4L2_PIX_FMT_NV12, (char*)inData,
+                //     (char*)mVirAddr, tempFrameWidth, tempFrameHeight, tempFrameWidth, tempFrameHeight);
+                //std::memcpy(mVirAddr, req->inData, req->inDataSize);
+                //static uint8_t* mVirAddr = (uint8_t*)malloc(req->inDataSize);
+
+                if(isSubDevice()){
+                    //std::memcpy(mVirAddr, depthMap, halBuf.width*halBuf.height*2);
+                    ::virtuals::VirCamConvert::narrow16ToGreyNv12(depthMap, (uint8_t*)mVirAddr,
+                            halBuf.width, halBuf.height, ::virtuals::VirCamConvert::kLowByte);
+                }else{
+                    // static unsigned short * depthMap = (unsigned short *)malloc(halBuf.width*halBuf.height*2);
+                    // doAlgo((char*)req->inData, halBuf.width, halBuf.height, 16, depthMap);
+                    ::virtuals::VirCamConvert::narrow16ToGreyNv12((const uint16_t*)req->inData,
+                            (uint8_t*)mVirAddr, halBuf.width, halBuf.height,
+                            ::virtuals::VirCamConvert::kLowByte);
+                    if(isMainDevice()){
+                        dumpFrame("IR_dump", req->frameNumber, halBuf.width, halBuf.height, "raw",
+                                mVirAddr, halBuf.width * halBuf.height * 3 / 2);
+                    }
+                }
+
+                ALOGV("@%s, sub:%d.main:%d,PixelFormat::RAW :%d,",__FUNCTION__,isSubDevice(),isMainDevice(),halBuf.format);
+
+            }else {
+
+                // mShareFd is checked, and without RK_HW_JPEG_DECODER the frame decoded, once
+                // for all buffers in threadLoop
+                int handle_fd = -1, ret;
+                const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
+                ret = ::virtuals::VirCamGralloc4::get_share_fd(tmp_hand, &handle_fd);
+                if (handle_fd == -1) {
+                    LOGE("convert tmp_hand to dst_fd error");
+                    return -1;
+                }
+                ALOGV("%s(%d): halBuf handle_fd(%d)", __FUNCTION__, __LINE__, handle_fd);
+                ALOGV("%s(%d) halbuf_wxh(%dx%d) frameNumber(%d)", __FUNCTION__, __LINE__,
+                    halBuf.width, halBuf.height, req->frameNumber);
+
+                camera2::RgaCropScale::rga_nv12_scale_crop(
+                    tempFrameWidth, tempFrameHeight, req->mShareFd, handle_fd,
+                    halBuf.width, halBuf.height, 100, false, true,
+                    (halBuf.format == PixelFormat::YCRCB_420_SP), is16Align,
+                    req->frameIn->mFourcc == V4L2_PIX_FMT_YUYV);
+#ifdef DUMP_YUV
+                {
+                    void* mVirAddr = NULL;
+                    ret = ::virtuals::VirCamGralloc4::vir_lock(
+                                tmp_hand,
+                                halBuf.usage,
+                                0,
+                                0,
+                                halBuf.width,
+                                halBuf.height,
+                                (void**)&mVirAddr);
+                    if (ret) {
+                        LOGE("lock buffer error : %s", strerror(errno));
+                    }
+                    ::virtuals::VirCamGralloc4::vir_unlock(tmp_hand);
+                    dumpFrame("camera_dump", req->frameNumber, tempFrameWidth, tempFrameHeight,
+                            "yuv", (const void*)req->mVirAddr, tempFrameWidth * tempFrameHeight * 3 / 2);
+                    dumpFrame("camera_dump_halbuf", req->frameNumber, halBuf.width, halBuf.height,
+                            "yuv", mVirAddr, halBuf.width * halBuf.height * 3 / 2);
+                }
+#endif
+
+            }
+        } break;
+        default:
+            ALOGE("%s: unknown output format %x", __FUNCTION__, halBuf.format);
+            return -1;
+    }
+    recordBufferTiming(halBuf.streamId, startTs, fenceDoneTs,
+            systemTime(SYSTEM_TIME_MONOTONIC));
+    return 0;
+}
+
 bool VirtualCameraDeviceSession::OutputThread::threadLoop() {
     std::shared_ptr<HalRequest> req;
     auto parent = mParent.promote();
@@ -2170,9 +2439,6 @@ bool VirtualCameraDeviceSession::OutputThread::threadLoop() {
        return false;
     }
 
-    // TODO: maybe we need to setup a sensor thread to dq/enq v4l frames
-    //       regularly to prevent v4l buffer queue filled with stale buffers
-    //       when app doesn't program a preveiw request
     waitForNextRequest(&req);
     if (req == nullptr) {
         // No new request, wait again
@@ -2405,473 +2671,115 @@ bool VirtualCameraDeviceSession::OutputThread::threadLoop() {
     }
     int tmpW = (req->frameIn->mWidth + 15) & (~15);
     int tmpH = (req->frameIn->mHeight + 15) & (~15);
-    static unsigned short * depthMap = (unsigned short *)malloc(640*400*2);
+    // The depth map of the sub device lives as long as this request's buffers are filled
+    std::shared_ptr<uint8_t> depthScratch;
+    unsigned short* depthMap = nullptr;
     if(isSubDevice()){
-        ALOGV("doAlgo in:%dx%d,req->inDataSize:%d",tmpW*2, tmpH*2,req->inDataSize);
-        {
-                static int frameCount = req->frameNumber;
-                if(++frameCount > 5 && frameCount<10){
-                    FILE* fp =NULL;
-                    char filename[128];
-                    filename[0] = 0x00;
-                    sprintf(filename, "/data/camera/inData_dump_%dx%d_%d.raw",
-                            tmpW*2, tmpH*2, frameCount);
-                    fp = fopen(filename, "wb+");
-                    if (fp != NULL) {
-                        fwrite((char*)req->inData, 1,req->inDataSize , fp);
-                        fclose(fp);
-                        ALOGD("Write success RAW data to %s",filename);
-                    } else {
-                        ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                    }
-                }
-        }
-        doAlgo((char*)req->inData, tmpW*2, tmpH*2, 16, depthMap);
-        {
-            static int frameCount = req->frameNumber;
-            if(++frameCount > 5 && frameCount<10){
-                FILE* fp =NULL;
-                char filename[128];
-                filename[0] = 0x00;
-                sprintf(filename, "/data/camera/depthMap_dump_%dx%d_%d.raw",
-                        tmpW, tmpH, frameCount);
-                fp = fopen(filename, "wb+");
-                if (fp != NULL) {
-                    fwrite((char*)depthMap, 1,tmpW*tmpH*2 , fp);
-                    fclose(fp);
-                    ALOGD("Write success RAW data to %s",filename);
-                } else {
-                    ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                }
+        depthScratch = acquireScratch(std::max(kDepthMapBytes, (size_t)tmpW * tmpH * 2));
+        if (depthScratch == nullptr) {
+            ALOGE("%s: no depth map frame for %dx%d", __FUNCTION__, tmpW, tmpH);
+            lk.unlock();
+            Status st = parent->processCaptureRequestError(req);
+            if (st != Status::OK) {
+                return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
             }
+            signalRequestDone();
+            return true;
         }
+        depthMap = reinterpret_cast<unsigned short*>(depthScratch.get());
+        ALOGV("doAlgo in:%dx%d,req->inDataSize:%d",tmpW*2, tmpH*2,req->inDataSize);
+        dumpFrame("inData_dump", req->frameNumber, tmpW * 2, tmpH * 2, "raw",
+                req->inData, req->inDataSize);
+        doAlgo((char*)req->inData, tmpW*2, tmpH*2, 16, depthMap);
+        dumpFrame("depthMap_dump", req->frameNumber, tmpW, tmpH, "raw",
+                depthMap, (size_t)tmpW * tmpH * 2);
         //ALOGE("doAlgo out");
         //req->inData = (uint8_t*)depthMap;
         //req->inDataSize = 640*400*2;
         //std::memcpy(mVirAddr, depthMap, halBuf.width*halBuf.height*2);
     }
-    ALOGV("%s processing new request", __FUNCTION__);
-    const int kSyncWaitTimeoutMs = 500;
-    for (auto& halBuf : req->buffers) {
-        if (*(halBuf.bufPtr) == nullptr) {
-            ALOGW("%s: buffer for stream %d missing", __FUNCTION__, halBuf.streamId);
-            halBuf.fenceTimeout = true;
-        } else if (halBuf.acquireFence >= 0) {
-            int ret = sync_wait(halBuf.acquireFence, kSyncWaitTimeoutMs);
-            if (ret) {
-                halBuf.fenceTimeout = true;
-            } else {
-                ::close(halBuf.acquireFence);
-                halBuf.acquireFence = -1;
-            }
-        }
-
-        if (halBuf.fenceTimeout) {
-            continue;
+    // The input is brought into mYu12Frame (and the RGA source) once here; from now on the
+    // output buffers only read it and are filled in parallel
+    bool hasYCbCrOutput = false;
+    for (const auto& halBuf : req->buffers) {
+        if (halBuf.format == PixelFormat::YCBCR_420_888 ||
+                halBuf.format == PixelFormat::IMPLEMENTATION_DEFINED ||
+                halBuf.format == PixelFormat::YCRCB_420_SP) {
+            hasYCbCrOutput = true;
         }
-        //ALOGE("halBuf.format:%d",halBuf.format);
-
-        // Gralloc lockYCbCr the buffer
-        switch (halBuf.format) {
-            case PixelFormat::BLOB: {
-                int ret = createJpegLocked(halBuf, req->setting);
-
-                if(ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: createJpegLocked failed with %d",
-                          __FUNCTION__, ret);
-                }
-            } break;
-            case PixelFormat::Y16: {
-                void* outLayout = sHandleImporter.lock(*(halBuf.bufPtr), halBuf.usage, req->inDataSize);
-
-                std::memcpy(outLayout, req->inData, req->inDataSize);
-
-                int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
-                if (relFence >= 0) {
-                    halBuf.acquireFence = relFence;
-                }
-            } break;
-            case PixelFormat::RAW10:
-            {
-                ALOGV("@%s,PixelFormat::RAW ->:%d,",__FUNCTION__,halBuf.format);
-                const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
-                        void* mVirAddr = NULL;
-                        int ret = ::virtuals::VirCamGralloc4::vir_lock(
-                                    tmp_hand,
-                                    halBuf.usage,
-                                    0,
-                                    0,
-                                    halBuf.width,
-                                    halBuf.height,
-                                    (void**)&mVirAddr);
-                        if (ret) {
-                            LOGE("lock buffer error : %s", strerror(errno));
-                        }
-                        ::virtuals::VirCamGralloc4::vir_unlock(tmp_hand);
-
-                ALOGV("isMainDevice:%d,isSubDevice:%d,memcpy: req->inDataSize %d",isMainDevice(),isSubDevice(),req->inDataSize);
-                std::memcpy(mVirAddr, req->inData, halBuf.width*halBuf.height*1.25);
-                ALOGV("@%s,PixelFormat::RAW :%d,",__FUNCTION__,halBuf.format);
-                break;
-
-            }
-            case PixelFormat::RAW12:
-            case PixelFormat::RAW16:
-            {
-                ALOGV("@%s,PixelFormat::RAW ->:%d,",__FUNCTION__,halBuf.format);
-                const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
-                        void* mVirAddr = NULL;
-                        int ret = ::virtuals::VirCamGralloc4::vir_lock(
-                                    tmp_hand,
-                                    halBuf.usage,
-                                    0,
-                                    0,
-                                    halBuf.width,
-                                    halBuf.height,
-                                    (void**)&mVirAddr);
-                        if (ret) {
-                            LOGE("lock buffer error : %s", strerror(errno));
-                        }
-                        ::virtuals::VirCamGralloc4::vir_unlock(tmp_hand);
-                ALOGV("isMainDevice:%d,isSubDevice:%d,memcpy: req->inDataSize %d",isMainDevice(),isSubDevice(),req->inDataSize);
-                if(isSubDevice()&&req->frameIn->mBufferIndex%2==0){
-                    std::memcpy(mVirAddr, depthMap, halBuf.width*halBuf.height*2);
-                }else{
-                    std::memcpy(mVirAddr, req->inData, halBuf.width*halBuf.height*2);
-                }
-                ALOGV("@%s,PixelFormat::RAW :%d,",__FUNCTION__,halBuf.format);
-                break;
-
+    }
+    if (hasYCbCrOutput && !isBlobOrYv12 && req->frameIn->mFourcc == V4L2_PIX_FMT_YUYV) {
+        ALOGV("%s libyuvToI420", __FUNCTION__);
+        ATRACE_BEGIN("YUYVtoI420");
+        int ret = libyuv::YUY2ToI420(
+                req->inData, (mYu12Frame->mWidth)*2, static_cast<uint8_t*>(mYu12FrameLayout.y), mYu12FrameLayout.yStride,
+                static_cast<uint8_t*>(mYu12FrameLayout.cb), mYu12FrameLayout.cStride,
+                static_cast<uint8_t*>(mYu12FrameLayout.cr), mYu12FrameLayout.cStride,
+                mYu12Frame->mWidth, mYu12Frame->mHeight);
+        ATRACE_END();
+        if (ret != 0) {
+            ALOGE("%s: Convert V4L2 frame to YU12 failed! res %d", __FUNCTION__, ret);
+        }
+    }
+    if (hasYCbCrOutput && req->frameIn->mFourcc != V4L2_PIX_FMT_YUYV &&
+            req->frameIn->mFourcc != V4L2_PIX_FMT_NV12 &&
+            req->frameIn->mFourcc != V4L2_PIX_FMT_SRGGB10) {
+        // Scaled by RGA from req->mShareFd
+        if (req->mShareFd <= 0) {
+            lk.unlock();
+            Status st = parent->processCaptureRequestError(req);
+            if (st != Status::OK) {
+                return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
             }
-            case PixelFormat::YV12: {
-                IMapper::Rect outRect {0, 0,
-                        static_cast<int32_t>(halBuf.width),
-                        static_cast<int32_t>(halBuf.height)};
-                YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
-                        *(halBuf.bufPtr), halBuf.usage, outRect);
-                ALOGV("%s: outLayout y %p cb %p cr %p y_str %d c_str %d c_step %d",
-                        __FUNCTION__, outLayout.y, outLayout.cb, outLayout.cr,
-                        outLayout.yStride, outLayout.cStride, outLayout.chromaStep);
-
-                // Convert to output buffer size/format
-                uint32_t outputFourcc = getFourCcFromLayout(outLayout);
-                ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__,
-                        outputFourcc & 0xFF,
-                        (outputFourcc >> 8) & 0xFF,
-                        (outputFourcc >> 16) & 0xFF,
-                        (outputFourcc >> 24) & 0xFF);
-
-                YCbCrLayout cropAndScaled;
-                ATRACE_BEGIN("cropAndScaleLocked");
-                int ret = cropAndScaleLocked(
-                        mYu12Frame,
-                        Size { halBuf.width, halBuf.height },
-                        &cropAndScaled);
-                ATRACE_END();
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: crop and scale failed!", __FUNCTION__);
-                }
-
-                Size sz {halBuf.width, halBuf.height};
-                ATRACE_BEGIN("formatConvert");
-                ret = formatConvert(cropAndScaled, outLayout, sz, outputFourcc);
-                ATRACE_END();
-                if (ret != 0) {
-                    lk.unlock();
-                    return onDeviceError("%s: format coversion failed!", __FUNCTION__);
-                }
-                int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
-                if (relFence >= 0) {
-                    halBuf.acquireFence = relFence;
-                }
-            } break;
-            case PixelFormat::YCBCR_420_888:
-            case PixelFormat::IMPLEMENTATION_DEFINED:
-            case PixelFormat::YCRCB_420_SP: {
-                if (req->frameIn->mFourcc == V4L2_PIX_FMT_YUYV){
-                    ALOGV("%s libyuvToI420", __FUNCTION__);
-                    ATRACE_BEGIN("YUYVtoI420");
-
-#if 1
-                int ret = 0;
-                //if(!parent->isSubDevice()){
-                        ret = libyuv::YUY2ToI420(
-                        req->inData, (mYu12Frame->mWidth)*2, static_cast<uint8_t*>(mYu12FrameLayout.y), mYu12FrameLayout.yStride,
-                        static_cast<uint8_t*>(mYu12FrameLayout.cb), mYu12FrameLayout.cStride,
-                        static_cast<uint8_t*>(mYu12FrameLayout.cr), mYu12FrameLayout.cStride,
-                        mYu12Frame->mWidth, mYu12Frame->mHeight);
-                //}
-#else
-                    int ret  = 0;
-#endif
-                    ATRACE_END();
-                    IMapper::Rect outRect {0, 0,
-                            static_cast<int32_t>(halBuf.width),
-                            static_cast<int32_t>(halBuf.height)};
-                    YCbCrLayout outLayout = sHandleImporter.lockYCbCr(
-                            *(halBuf.bufPtr), halBuf.usage, outRect);
-                    ALOGV("%s: outLayout y %p cb %p cr %p y_str %d c_str %d c_step %d",
-                            __FUNCTION__, outLayout.y, outLayout.cb, outLayout.cr,
-                            outLayout.yStride, outLayout.cStride, outLayout.chromaStep);
-
-                    // Convert to output buffer size/format
-                    uint32_t outputFourcc = getFourCcFromLayout(outLayout);
-                    ALOGV("%s: converting to format %c%c%c%c", __FUNCTION__,
-                            outputFourcc & 0xFF,
-                            (outputFourcc >> 8) & 0xFF,
-                            (outputFourcc >> 16) & 0xFF,
-                            (outputFourcc >> 24) & 0xFF);
-
-                    YCbCrLayout cropAndScaled;
-                    ATRACE_BEGIN("cropAndScaleLocked");
-                    ret = cropAndScaleLocked(
-                            mYu12Frame,
-                            Size { halBuf.width, halBuf.height },
-                            &cropAndScaled);
-                    ATRACE_END();
-                    if (ret != 0) {
-                        lk.unlock();
-                        return onDeviceError("%s: crop and scale failed!", __FUNCTION__);
-                    }
-                    Size sz {halBuf.width, halBuf.height};
-                    ATRACE_BEGIN("formatConvert");
-                    ret = formatConvert(cropAndScaled, outLayout, sz, outputFourcc);
-                    ATRACE_END();
-                    if (ret != 0) {
-                        lk.unlock();
-                        return onDeviceError("%s: format coversion failed!", __FUNCTION__);
-                    }
-                    int relFence = sHandleImporter.unlock(*(halBuf.bufPtr));
-                    if (relFence >= 0) {
-                        halBuf.acquireFence = relFence;
-                    }
-                } else if (req->frameIn->mFourcc == V4L2_PIX_FMT_NV12){
-
-                    int handle_fd = -1, ret;
-                    const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
-                    ret = ::virtuals::VirCamGralloc4::get_share_fd(tmp_hand, &handle_fd);
-                    if (handle_fd == -1) {
-                        LOGE("convert tmp_hand to dst_fd error");
-                        return -EINVAL;
-                    }
-                    ALOGV("%s(%d) halBuf handle_fd(%d) halbuf_wxh(%dx%d) frameNumber(%d)", __FUNCTION__, __LINE__,handle_fd,
-                        halBuf.width, halBuf.height, req->frameNumber);
-                    unsigned long vir_addr =  reinterpret_cast<unsigned long>(req->inData);
-                    //memcpy(halBuf.bufPtr,(const void*)vir_addr, halBuf.width*halBuf.height);
-                    static uint8_t* mVirAddr = (uint8_t*)malloc(req->inDataSize);
-                    yuyv_to_nv12((char*)req->inData,
-                        (char*)mVirAddr, halBuf.width, halBuf.height,req->inDataSize);
-                    memset((void*)(((uint8_t*)mVirAddr)+halBuf.width* halBuf.height),0x80,halBuf.width* halBuf.height /2);
-
-                    camera2::RgaCropScale::rga_nv12_scale_crop(
-                        tempFrameWidth, tempFrameHeight,reinterpret_cast<unsigned long>( mVirAddr), handle_fd,
-                        halBuf.width, halBuf.height, 100, false, true,
-                        (halBuf.format == PixelFormat::YCRCB_420_SP), is16Align,
-                        true);
-                } else if (req->frameIn->mFourcc == V4L2_PIX_FMT_SRGGB10){
-
-                    // int handle_fd = -1, ret;
-                    // const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
-                    // ret = ::virtuals::VirCamGralloc4::get_share_fd(tmp_hand, &handle_fd);
-                    // if (handle_fd == -1) {
-                    //     LOGE("convert tmp_hand to dst_fd error");
-                    //     return -EINVAL;
-                    // }
-                    // ALOGD("%s(%d) halBuf handle_fd(%d) halbuf_wxh(%dx%d) frameNumber(%d)", __FUNCTION__, __LINE__,handle_fd,
-                    //     halBuf.width, halBuf.height, req->frameNumber);
-                    // unsigned long vir_addr =  reinterpret_cast<unsigned long>(req->inData);
-                    // //memcpy(halBuf.bufPtr,(const void*)vir_addr, halBuf.width*halBuf.height);
-                    // camera2::RgaCropScale::rga_nv12_scale_crop(
-                    //     tempFrameWidth, tempFrameHeight, vir_addr, handle_fd,
-                    //     halBuf.width, halBuf.height, 100, false, true,
-                    //     (halBuf.format == PixelFormat::YCRCB_420_SP), is16Align,
-                    //     true);
-
-                        //ALOGE("@%s,PixelFormat::RAW ->:%d,",__FUNCTION__,halBuf.format);
-                    const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
-                            void* mVirAddr = NULL;
-
-                            int ret = ::virtuals::VirCamGralloc4::vir_lock(
-                                        tmp_hand,
-                                        halBuf.usage,
-                                        0,
-                                        0,
-                                        halBuf.width,
-                                        halBuf.height,
-                                        (void**)&mVirAddr);
-                            if (ret) {
-                                LOGE("lock buffer error : %s", strerror(errno));
-                            }
-
-                            ::virtuals::VirCamGralloc4::vir_unlock(tmp_hand);
-
-                    // yuyvToNv12(V4L2_PIX_FMT_NV12, (char*)inData,
-                    //     (char*)mVirAddr, tempFrameWidth, tempFrameHeight, tempFrameWidth, tempFrameHeight);
-                    //std::memcpy(mVirAddr, req->inData, req->inDataSize);
-                    //static uint8_t* mVirAddr = (uint8_t*)malloc(req->inDataSize);
-
-                    if(isSubDevice()){
-                        //std::memcpy(mVirAddr, depthMap, halBuf.width*halBuf.height*2);
-                        yuyv_to_nv12((char*)depthMap,
-                        (char*)mVirAddr, halBuf.width, halBuf.height,halBuf.width*halBuf.height*2);
-                        memset((void*)(((uint8_t*)mVirAddr)+halBuf.width* halBuf.height),0x80,halBuf.width* halBuf.height /2);
-                    }else{
-                        // static unsigned short * depthMap = (unsigned short *)malloc(halBuf.width*halBuf.height*2);
-                        // doAlgo((char*)req->inData, halBuf.width, halBuf.height, 16, depthMap);
-                        yuyv_to_nv12((char*)req->inData,
-                            (char*)mVirAddr, halBuf.width, halBuf.height,req->inDataSize);
-                        memset((void*)(((uint8_t*)mVirAddr)+halBuf.width* halBuf.height),0x80,halBuf.width* halBuf.height /2);
-                        if(isMainDevice()){
-                            static int frameCount = req->frameNumber;
-                            if(++frameCount > 5 && frameCount<10){
-                                FILE* fp =NULL;
-                                char filename[128];
-                                filename[0] = 0x00;
-                                sprintf(filename, "/data/camera/IR_dump_%dx%d_%d.raw",
-                                        halBuf.width, halBuf.height, frameCount);
-                                fp = fopen(filename, "wb+");
-                                if (fp != NULL) {
-                                    fwrite((char*)mVirAddr, 1,1280*800*1.5 , fp);
-                                    fclose(fp);
-                                    ALOGE("Write success RAW data to %s",filename);
-                                } else {
-                                    ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                                }
-                            }
-                        }
-                    }
-
-                    ALOGV("@%s, sub:%d.main:%d,PixelFormat::RAW :%d,",__FUNCTION__,isSubDevice(),isMainDevice(),halBuf.format);
-
-                }else {
-
-                    if (req->mShareFd <= 0) {
-                        lk.unlock();
-                        Status st = parent->processCaptureRequestError(req);
-                        if (st != Status::OK) {
-                            return onDeviceError("%s: failed to process capture request error!", __FUNCTION__);
-                        }
-                        signalRequestDone();
-                        return true;
-                    }
+            signalRequestDone();
+            return true;
+        }
 #ifndef RK_HW_JPEG_DECODER
-                     int res = libyuv::MJPGToI420(
-                         req->inData, req->inDataSize, static_cast<uint8_t*>(mYu12FrameLayout.y), mYu12FrameLayout.yStride,
-                         static_cast<uint8_t*>(mYu12FrameLayout.cb), mYu12FrameLayout.cStride,
-                         static_cast<uint8_t*>(mYu12FrameLayout.cr), mYu12FrameLayout.cStride,
-                         mYu12Frame->mWidth, mYu12Frame->mHeight, mYu12Frame->mWidth, mYu12Frame->mHeight);
-                     ALOGV("%s MJPGToI420 end, I420ToNV12 start", __FUNCTION__);
-                     ATRACE_BEGIN("I420ToNV12");
-                     YCbCrLayout output;
-                     output.y = (uint8_t*)req->mVirAddr;
-                     output.yStride = mYu12Frame->mWidth;
-                     output.cb = (uint8_t*)(req->mVirAddr) + tempFrameWidth * tempFrameHeight;
-                     output.cStride = mYu12Frame->mWidth;
-
-                     res = libyuv::I420ToNV12(
-                             static_cast<uint8_t*>(mYu12FrameLayout.y),
-                             mYu12FrameLayout.yStride,
-                             static_cast<uint8_t*>(mYu12FrameLayout.cb),
-                             mYu12FrameLayout.cStride,
-                             static_cast<uint8_t*>(mYu12FrameLayout.cr),
-                             mYu12FrameLayout.cStride,
-                             static_cast<uint8_t*>(output.y),
-                             output.yStride,
-                             static_cast<uint8_t*>(output.cb),
-                             output.cStride,
-                             mYu12Frame->mWidth, mYu12Frame->mHeight);
-                    ATRACE_END();
-#ifdef DUMP_YUV
-                    {
-                        static int frameCount = req->frameNumber;
-                        if(++frameCount > 5 && frameCount<10){
-                            FILE* fp =NULL;
-                            char filename[128];
-                            filename[0] = 0x00;
-                            sprintf(filename, "/data/camera/camera_dump_%dx%d_%d.yuv",
-                                    tempFrameWidth, tempFrameHeight, frameCount);
-                            fp = fopen(filename, "wb+");
-                            if (fp != NULL) {
-                                fwrite((char*)req->mVirAddr, 1, tempFrameWidth*tempFrameHeight*1.5, fp);
-                                fclose(fp);
-                                ALOGI("Write success YUV data to %s",filename);
-                            } else {
-                                ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                            }
-                        }
-                    }
-#endif
-#endif
-
-                    int handle_fd = -1, ret;
-                    const native_handle_t* tmp_hand = (const native_handle_t*)(*(halBuf.bufPtr));
-                    ret = ::virtuals::VirCamGralloc4::get_share_fd(tmp_hand, &handle_fd);
-                    if (handle_fd == -1) {
-                        LOGE("convert tmp_hand to dst_fd error");
-                        return -EINVAL;
-                    }
-                    ALOGV("%s(%d): halBuf handle_fd(%d)", __FUNCTION__, __LINE__, handle_fd);
-                    ALOGV("%s(%d) halbuf_wxh(%dx%d) frameNumber(%d)", __FUNCTION__, __LINE__,
-                        halBuf.width, halBuf.height, req->frameNumber);
-
-                    camera2::RgaCropScale::rga_nv12_scale_crop(
-                        tempFrameWidth, tempFrameHeight, req->mShareFd, handle_fd,
-                        halBuf.width, halBuf.height, 100, false, true,
-                        (halBuf.format == PixelFormat::YCRCB_420_SP), is16Align,
-                        req->frameIn->mFourcc == V4L2_PIX_FMT_YUYV);
-#ifdef DUMP_YUV
-                    {
-                        void* mVirAddr = NULL;
-                        ret = ::virtuals::VirCamGralloc4::vir_lock(
-                                    tmp_hand,
-                                    halBuf.usage,
-                                    0,
-                                    0,
-                                    halBuf.width,
-                                    halBuf.height,
-                                    (void**)&mVirAddr);
-                        if (ret) {
-                            LOGE("lock buffer error : %s", strerror(errno));
-                        }
-                        ::virtuals::VirCamGralloc4::vir_unlock(tmp_hand);
-                        int frameCount = req->frameNumber;
-                        if( frameCount > 4 && frameCount<10){
-                            FILE* fp =NULL;
-                            char filename[128];
-                            filename[0] = 0x00;
-                            sprintf(filename, "/data/camera/camera_dump_%dx%d_%d.yuv",
-                                    tempFrameWidth, tempFrameHeight, frameCount);
-                            fp = fopen(filename, "wb+");
-                            if (fp != NULL) {
-                                fwrite((char*)req->mVirAddr, 1, tempFrameWidth*tempFrameHeight*1.5, fp);
-                                fclose(fp);
-                                ALOGI("Write success YUV data to %s",filename);
-                            } else {
-                                ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                            }
-                            sprintf(filename, "/data/camera/camera_dump_halbuf_%dx%d_%d.yuv",
-                                    halBuf.width, halBuf.height, frameCount);
-                            fp = fopen(filename, "wb+");
-                            if (fp != NULL) {
-                                fwrite((char*)mVirAddr, 1, tempFrameWidth*tempFrameHeight*1.5, fp);
-                                fclose(fp);
-                                ALOGI("Write success YUV data to %s",filename);
-                            } else {
-                                ALOGE("Create %s failed(%d, %s)",filename,fp, strerror(errno));
-                            }
-                        }
-                    }
+        int res = libyuv::MJPGToI420(
+            req->inData, req->inDataSize, static_cast<uint8_t*>(mYu12FrameLayout.y), mYu12FrameLayout.yStride,
+            static_cast<uint8_t*>(mYu12FrameLayout.cb), mYu12FrameLayout.cStride,
+            static_cast<uint8_t*>(mYu12FrameLayout.cr), mYu12FrameLayout.cStride,
+            mYu12Frame->mWidth, mYu12Frame->mHeight, mYu12Frame->mWidth, mYu12Frame->mHeight);
+        ALOGV("%s MJPGToI420 end, I420ToNV12 start", __FUNCTION__);
+        ATRACE_BEGIN("I420ToNV12");
+        YCbCrLayout output;
+        output.y = (uint8_t*)req->mVirAddr;
+        output.yStride = mYu12Frame->mWidth;
+        output.cb = (uint8_t*)(req->mVirAddr) + tempFrameWidth * tempFrameHeight;
+        output.cStride = mYu12Frame->mWidth;
+
+        res = libyuv::I420ToNV12(
+                static_cast<uint8_t*>(mYu12FrameLayout.y),
+                mYu12FrameLayout.yStride,
+                static_cast<uint8_t*>(mYu12FrameLayout.cb),
+                mYu12FrameLayout.cStride,
+                static_cast<uint8_t*>(mYu12FrameLayout.cr),
+                mYu12FrameLayout.cStride,
+                static_cast<uint8_t*>(output.y),
+                output.yStride,
+                static_cast<uint8_t*>(output.cb),
+                output.cStride,
+                mYu12Frame->mWidth, mYu12Frame->mHeight);
+        ATRACE_END();
+        dumpFrame("camera_dump", req->frameNumber, tempFrameWidth, tempFrameHeight, "yuv",
+                (const void*)req->mVirAddr, tempFrameWidth * tempFrameHeight * 3 / 2);
 #endif
+    }
 
-                }
-            } break;
-            default:
-                lk.unlock();
-                return onDeviceError("%s: unknown output format %x", __FUNCTION__, halBuf.format);
+    ALOGV("%s processing new request", __FUNCTION__);
+    // Scaled intermediates are only valid for this frame
+    mScaledYu12Frames.clear();
+    std::vector<int> results(req->buffers.size(), 0);
+    runBufferTasks(req->buffers.size(), [&](size_t i) {
+        results[i] = processOutputBufferLocked(req, req->buffers[i],
+                tempFrameWidth, tempFrameHeight, is16Align, depthMap);
+    });
+    for (int result : results) {
+        if (result != 0) {
+            lk.unlock();
+            return onDeviceError("%s: filling output buffers failed!", __FUNCTION__);
         }
-    } // for each buffer
+    }
     mScaledYu12Frames.clear();
 
     // Don't hold the lock while calling back to parent
@@ -2926,6 +2834,12 @@ Status VirtualCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
         if (sz == v4lSize) {
             continue; // Don't need an intermediate buffer same size as v4lBuffer
         }
+        IMapper::Rect crop;
+        if (getCropRect(mCroppingType, v4lSize, sz, &crop) == 0 &&
+                crop.width == static_cast<int32_t>(sz.width) &&
+                crop.height == static_cast<int32_t>(sz.height)) {
+            continue; // Only cropped, the output is a view of mYu12Frame
+        }
         if (mIntermediateBuffers.count(sz) == 0) {
             // Create new intermediate buffer
             sp<AllocatedFrame> buf = new AllocatedFrame(stream.width, stream.height);
@@ -2958,15 +2872,81 @@ Status VirtualCameraDeviceSession::OutputThread::allocateIntermediateBuffers(
     }
 
     mBlobBufferSize = blobBufferSize;
+    {
+        std::lock_guard<std::mutex> timingLk(mTimingLock);
+        mStreamTimings.clear();
+    }
+
+    // Scratch frames: narrowed sensor frames in flight, the NV12 staging of the buffers filled
+    // in parallel, and the sub device's depth maps. The previous arena goes away with the last
+    // request still holding one of its frames
+    size_t frameBytes = (size_t)((v4lSize.width + 15) & ~15) * ((v4lSize.height + 15) & ~15) *
+            kMaxBytesPerPixel;
+    size_t stagingBytes = 0;
+    for (const auto& stream : streams) {
+        stagingBytes = std::max(stagingBytes,
+                (size_t)stream.width * (stream.height + (stream.height + 1) / 2));
+    }
+    std::vector<::virtuals::VirCamFrameArena::SizeClass> classes = {
+        { frameBytes, kScratchFramesInFlight },
+        { stagingBytes, kNumBufferWorkers + 1 },
+    };
+    if (isSubDevice()) {
+        classes.push_back({ std::max(kDepthMapBytes, frameBytes), 2 });
+    }
+    std::shared_ptr<::virtuals::VirCamFrameArena> arena = ::virtuals::VirCamFrameArena::create(classes);
+    if (arena == nullptr) {
+        ALOGE("%s: allocating scratch frames failed!", __FUNCTION__);
+        return Status::INTERNAL_ERROR;
+    }
+    int dumpFrames = property_get_int32(kFrameDumpProperty, 0);
+    std::shared_ptr<::virtuals::VirCamFrameDumper> dumper;
+    if (dumpFrames > 0) {
+        ALOGI("%s: dumping %d frames per dump point to %s", __FUNCTION__, dumpFrames, kFrameDumpDir);
+        dumper = std::make_shared<::virtuals::VirCamFrameDumper>(kFrameDumpDir, dumpFrames);
+    }
+    {
+        std::lock_guard<std::mutex> scratchLk(mScratchLock);
+        mFrameArena = arena;
+        mFrameDumper = dumper;
+    }
     return Status::OK;
 }
 
+std::shared_ptr<uint8_t> VirtualCameraDeviceSession::OutputThread::acquireScratch(size_t size) {
+    std::shared_ptr<::virtuals::VirCamFrameArena> arena;
+    {
+        std::lock_guard<std::mutex> lk(mScratchLock);
+        arena = mFrameArena;
+    }
+    if (arena == nullptr) {
+        ALOGE("%s: streams not configured", __FUNCTION__);
+        return nullptr;
+    }
+    return arena->acquire(size);
+}
+
+void VirtualCameraDeviceSession::OutputThread::dumpFrame(const char* tag, uint32_t frameNumber,
+        int width, int height, const char* ext, const void* data, size_t size) {
+    std::shared_ptr<::virtuals::VirCamFrameDumper> dumper;
+    {
+        std::lock_guard<std::mutex> lk(mScratchLock);
+        dumper = mFrameDumper;
+    }
+    if (dumper != nullptr && data != nullptr) {
+        dumper->dump(tag, frameNumber, width, height, ext, data, size);
+    }
+}
+
 void VirtualCameraDeviceSession::OutputThread::clearIntermediateBuffers() {
     std::lock_guard<std::mutex> lk(mBufferLock);
     mYu12Frame.clear();
     mYu12ThumbFrame.clear();
     mIntermediateBuffers.clear();
     mBlobBufferSize = 0;
+    std::lock_guard<std::mutex> scratchLk(mScratchLock);
+    mFrameArena.reset();
+    mFrameDumper.reset();
 }
 
 Status VirtualCameraDeviceSession::OutputThread::submitRequest(
@@ -3004,6 +2984,21 @@ void VirtualCameraDeviceSession::OutputThread::flush() {
     }
 }
 
+Status VirtualCameraDeviceSession::OutputThread::bindLatestFrame(
+        const std::shared_ptr<HalRequest>& req) {
+    auto parent = mParent.promote();
+    if (parent == nullptr) {
+       ALOGE("%s: session has been disconnected!", __FUNCTION__);
+       return Status::INTERNAL_ERROR;
+    }
+
+    Status st = parent->bindLatestFrame(req);
+    if (st != Status::OK) {
+        parent->processCaptureRequestError(req);
+    }
+    return st;
+}
+
 std::list<std::shared_ptr<HalRequest>>
 VirtualCameraDeviceSession::OutputThread::switchToOffline() {
     ATRACE_CALL();
@@ -3080,6 +3075,39 @@ void VirtualCameraDeviceSession::OutputThread::dump(int fd) {
         dprintf(fd, "%d, ", req->frameNumber);
     }
     dprintf(fd, "\n");
+
+    std::lock_guard<std::mutex> timingLk(mTimingLock);
+    dprintf(fd, "OutputThread buffer workers %zu\n", mBufferWorkers.size());
+    {
+        std::lock_guard<std::mutex> scaleLk(mScaleLock);
+        dprintf(fd, "OutputThread YU12 scale passes %" PRIu64 ", reused %" PRIu64
+                ", plane views %" PRIu64 "\n", mScalePasses, mScaleReuses, mScaleViews);
+    }
+    {
+        std::lock_guard<std::mutex> scratchLk(mScratchLock);
+        if (mFrameArena != nullptr) {
+            ::virtuals::VirCamFrameArena::Stats stats = mFrameArena->stats();
+            dprintf(fd, "OutputThread scratch frames %zu bytes, %" PRIu64 " acquired, %" PRIu64
+                    " from the heap, %zu in use, high water %zu\n", stats.bytes, stats.acquires,
+                    stats.overflows, stats.inUse, stats.highWater);
+        }
+        if (mFrameDumper != nullptr) {
+            ::virtuals::VirCamFrameDumper::Stats stats = mFrameDumper->stats();
+            std::string error = mFrameDumper->lastError();
+            dprintf(fd, "OutputThread frame dumps %" PRIu64 " queued, %" PRIu64 " written, %" PRIu64
+                    " dropped, %" PRIu64 " failed%s%s\n", stats.queued, stats.written, stats.dropped,
+                    stats.failed, error.empty() ? "" : ", last error ", error.c_str());
+        }
+    }
+    for (const auto& pair : mStreamTimings) {
+        const StreamTiming& timing = pair.second;
+        dprintf(fd, "Stream %d: %" PRIu64 " buffers, fence wait avg %.2f ms, "
+                "fill avg %.2f ms max %.2f ms last %.2f ms\n",
+                pair.first, timing.buffers,
+                timing.totalFenceWaitNs / 1e6 / timing.buffers,
+                timing.totalProcessNs / 1e6 / timing.buffers,
+                timing.maxProcessNs / 1e6, timing.lastProcessNs / 1e6);
+    }
 }
 
 void VirtualCameraDeviceSession::cleanupBuffersLocked(int id) {
@@ -3179,8 +3207,19 @@ int VirtualCameraDeviceSession::v4l2StreamOffLocked() {
         return OK;
     }
 
+    stopSensorLocked();
+
     {
-        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        std::unique_lock<std::mutex> lk(mV4l2BufferLock);
+        if (isMainDevice()) {
+            // The sub device's requests still holding lent frames finish on their own
+            if (!mV4L2BufferReturned.wait_for(lk, std::chrono::seconds(kBufferWaitTimeoutSec),
+                    [] { return sNumLentFrames == 0; })) {
+                ALOGE("%s: there are %d V4L buffers lent to the sub device",
+                    __FUNCTION__, sNumLentFrames.load());
+                return -1;
+            }
+        }
         if (mNumDequeuedV4l2Buffers != 0)  {
             ALOGE("%s: there are %zu inflight V4L buffers",
                 __FUNCTION__, mNumDequeuedV4l2Buffers);
@@ -3207,12 +3246,16 @@ int VirtualCameraDeviceSession::v4l2StreamOffLocked() {
             req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
         else
             req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        req_buffers.memory = V4L2_MEMORY_MMAP;
+        req_buffers.memory = mV4l2Memory;
         req_buffers.count = 0;
         if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers)) < 0) {
             ALOGE("%s: REQBUFS failed: %s", __FUNCTION__, strerror(errno));
             return -errno;
         }
+        // The driver has dropped its references to the capture buffers
+        mCaptureMemManager.clear();
+        mCaptureBufferSize = 0;
+        mV4l2Memory = V4L2_MEMORY_MMAP;
     }
 #endif
     mV4l2Streaming = false;
@@ -3380,11 +3423,26 @@ int VirtualCameraDeviceSession::configureV4l2StreamLocked(
             req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
         else
             req_buffers.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        req_buffers.memory = V4L2_MEMORY_MMAP;
-        req_buffers.count = v4lBufferCount;
-        if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers)) < 0) {
-            ALOGE("%s: VIDIOC_REQBUFS failed: %s", __FUNCTION__, strerror(errno));
-            return -errno;
+        mV4l2Memory = V4L2_MEMORY_MMAP;
+        if (property_get_int32(kV4l2DmabufProperty, 0) > 0) {
+            req_buffers.memory = V4L2_MEMORY_DMABUF;
+            req_buffers.count = v4lBufferCount;
+            if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers)) == 0 &&
+                    createCaptureBuffersLocked(req_buffers.count, fmt.fmt.pix.width, bufferSize)) {
+                mV4l2Memory = V4L2_MEMORY_DMABUF;
+            } else {
+                ALOGW("%s: DMABUF capture not available, using MMAP buffers", __FUNCTION__);
+                req_buffers.count = 0;
+                TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers));
+            }
+        }
+        if (mV4l2Memory == V4L2_MEMORY_MMAP) {
+            req_buffers.memory = V4L2_MEMORY_MMAP;
+            req_buffers.count = v4lBufferCount;
+            if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_REQBUFS, &req_buffers)) < 0) {
+                ALOGE("%s: VIDIOC_REQBUFS failed: %s", __FUNCTION__, strerror(errno));
+                return -errno;
+            }
         }
 
         // Driver can indeed return more buffer if it needs more to operate
@@ -3400,7 +3458,7 @@ int VirtualCameraDeviceSession::configureV4l2StreamLocked(
         for (uint32_t i = 0; i < req_buffers.count; i++) {
             v4l2_buffer buffer;
             buffer.index = i;
-            buffer.memory = V4L2_MEMORY_MMAP;
+            buffer.memory = mV4l2Memory;
             if (mCapability.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
                 buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
             else
@@ -3415,6 +3473,7 @@ int VirtualCameraDeviceSession::configureV4l2StreamLocked(
                 return -errno;
             }
 
+            setV4l2BufferFd(&buffer);
             if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
                 ALOGE("%s: QBUF %d failed: %s", __FUNCTION__, i,  strerror(errno));
                 return -errno;
@@ -3452,7 +3511,7 @@ int VirtualCameraDeviceSession::configureV4l2StreamLocked(
                 buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
             else
                 buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            buffer.memory = V4L2_MEMORY_MMAP;
+            buffer.memory = mV4l2Memory;
             if (V4L2_TYPE_IS_MULTIPLANAR(buffer.type)) {
                 buffer.m.planes = planes;
                 buffer.length = PLANES_NUM;
@@ -3464,6 +3523,7 @@ int VirtualCameraDeviceSession::configureV4l2StreamLocked(
             }
         ALOGV("VIDIOC_DQBUF ok");
         ALOGV("VIDIOC_QBUF");
+            setV4l2BufferFd(&buffer);
             if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
                 ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__, buffer.index, strerror(errno));
                 return -errno;
@@ -3483,27 +3543,82 @@ int VirtualCameraDeviceSession::configureV4l2StreamLocked(
                 __FUNCTION__, v4l2Fmt.width, v4l2Fmt.height, mV4l2StreamingFps);
     mV4l2StreamingFmt = v4l2Fmt;
     mV4l2Streaming = true;
+    mSensorThread->start();
     return OK;
 }
 
-sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t* shutterTs) {
+bool VirtualCameraDeviceSession::createCaptureBuffersLocked(
+        uint32_t count, uint32_t width, uint32_t sizeImage) {
+    struct bufferinfo_s captureBuf;
+
+    memset(&captureBuf, 0, sizeof(struct bufferinfo_s));
+    captureBuf.mNumBffers = count;
+    captureBuf.mPerBuffersize = PAGE_ALIGN(sizeImage);
+    captureBuf.mBufType = ::android::virtuals::PREVIEWBUFFER;
+    // gralloc sizes the buffer from its geometry: make the luma plane alone hold a frame
+    captureBuf.width = (width + 15) & (~15);
+    captureBuf.height = ((sizeImage + captureBuf.width - 1) / captureBuf.width + 15) & (~15);
+    ALOGD("createCaptureBuffers %u buffers W:H=%dx%d for %u bytes", count,
+            captureBuf.width, captureBuf.height, sizeImage);
+    sp<::android::virtuals::MemManagerBase> manager =
+            new ::android::virtuals::GrallocDrmMemManager(false);
+    if (manager->createPreviewBuffer(&captureBuf)) {
+        LOGE("alloc capture buffers failed !");
+        return false;
+    }
+    mCaptureMemManager = manager;
+    mCaptureBufferSize = captureBuf.mPerBuffersize;
+    return true;
+}
+
+void VirtualCameraDeviceSession::setV4l2BufferFd(v4l2_buffer* buffer) {
+    if (mV4l2Memory != V4L2_MEMORY_DMABUF) {
+        return;
+    }
+    int shareFd = (int)mCaptureMemManager->getBufferAddr(
+            ::android::virtuals::PREVIEWBUFFER, buffer->index, ::android::virtuals::buffer_sharre_fd);
+    if (V4L2_TYPE_IS_MULTIPLANAR(buffer->type)) {
+        buffer->m.planes[0].m.fd = shareFd;
+        buffer->m.planes[0].length = mCaptureBufferSize;
+    } else {
+        buffer->m.fd = shareFd;
+        buffer->length = mCaptureBufferSize;
+    }
+}
+
+void VirtualCameraDeviceSession::stopSensorLocked() {
+    std::vector<sp<V4L2Frame>> frames;
+    mSensorThread->stop(&frames);
+    for (const auto& frame : frames) {
+        enqueueV4l2Frame(frame);
+    }
+
+    if (isMainDevice()) {
+        // Take back the frame the sub device has not picked up, and have it give back the
+        // ones its SensorThread keeps; those its requests hold come back as they complete
+        std::shared_ptr<V4L2Frame> unclaimed;
+        {
+            std::lock_guard<std::mutex> lk(sSubDeviceBufferLock);
+            unclaimed.swap(sSubDeviceFrame.frame);
+        }
+        sLendEpoch++;
+    }
+}
+
+sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2Frame(
+        /*out*/nsecs_t* shutterTs, int timeoutMs) {
     ATRACE_CALL();
     sp<V4L2Frame> ret = nullptr;
-    //ALOGE("dequeueV4l2FrameLocked");
+    //ALOGE("dequeueV4l2Frame");
     if (shutterTs == nullptr) {
         ALOGE("%s: shutterTs must not be null!", __FUNCTION__);
         return ret;
     }
 
-    {
-        std::unique_lock<std::mutex> lk(mV4l2BufferLock);
-        //ALOGE("mNumDequeuedV4l2Buffers:%d,mV4L2BufferCount:%d",mNumDequeuedV4l2Buffers,mV4L2BufferCount);
-        if (mNumDequeuedV4l2Buffers == mV4L2BufferCount) {
-            int waitRet = waitForV4L2BufferReturnLocked(lk);
-            if (waitRet != 0) {
-                return ret;
-            }
-        }
+    // SensorThread only calls in here with a buffer queued to the driver. Wait for it with a
+    // timeout rather than block in DQBUF, so the thread can be stopped while no frame comes.
+    if (!isSubDevice() && !waitV4l2Frame(timeoutMs)) {
+        return ret;
     }
 
     ATRACE_BEGIN("VIDIOC_DQBUF");
@@ -3515,7 +3630,7 @@ sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t*
             buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
         else
             buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.memory = mV4l2Memory;
         if (V4L2_TYPE_IS_MULTIPLANAR(buffer.type)) {
             buffer.m.planes = planes;
             buffer.length = PLANES_NUM;
@@ -3523,6 +3638,7 @@ sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t*
 
         if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &buffer)) < 0) {
             ALOGE("%s: DQBUF fails: %s", __FUNCTION__, strerror(errno));
+            ATRACE_END();
             return ret;
         }
             if (buffer.index % 2 == 0) {
@@ -3535,41 +3651,29 @@ sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t*
         // ALOGD("%s(%d) dequeue buffer.index(%d), length(%d), mem_offset(%d)",__FUNCTION__, __LINE__,
         //         buffer.index, buffer.m.planes[0].length, buffer.m.planes[0].m.mem_offset);
         if(isMainDevice() && buffer.index %2 ==0){
-            sp<V4L2Frame> virtualFrame = nullptr;
-            if (mCapability.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
-                virtualFrame = new V4L2Frame(
-                        mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
-                        buffer.index, mV4l2Fd.get(), buffer.m.planes[0].length, buffer.m.planes[0].m.mem_offset);
-            else
-                virtualFrame = new V4L2Frame(
-                        mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
-                        buffer.index, mV4l2Fd.get(), buffer.bytesused, buffer.m.offset);
-            {
-                std::lock_guard<std::mutex> lk(sSubDeviceBufferLock);
-                uint8_t* tmpData;
-                size_t tmpDataSize;
-                if (virtualFrame->getData(&tmpData, &tmpDataSize) != 0) {
-                    LOGE("%s(%d)getData failed!\n", __FUNCTION__, __LINE__);
-                }
-                if(SubDeviceInData == NULL){
-                    SubDeviceInData = (uint8_t*) malloc(tmpDataSize);
+            // The even frames go to the sub device, by reference, if it may take one more
+            if (lendToSubDevice(newV4l2Frame(buffer), buffer)) {
+                ALOGV("%s,MainDevice lent %d",__FUNCTION__,buffer.index);
+            } else {
+                setV4l2BufferFd(&buffer);
+                if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
+                    ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__,
+                            buffer.index, strerror(errno));
+                    ATRACE_END();
+                    return ret;
                 }
-                memcpy((void*)SubDeviceInData,(void*)tmpData,tmpDataSize);
-                SubDeviceInDataSize = tmpDataSize;
-                ALOGV("%s,MainDevice push %d",__FUNCTION__,buffer.index);
-                sSubDeviceBufferPushed.notify_one();
+                ALOGV("%s(%d) enqueue buffer.index(%d), length(%d), mem_offset(%d)",__FUNCTION__, __LINE__,
+                    buffer.index, buffer.m.planes[0].length, buffer.m.planes[0].m.mem_offset);
             }
-
-            virtualFrame->unmap();
-            if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
-                ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__,
-                        buffer.index, strerror(errno));
+            // The even frame is lent or back with the driver, so there is nothing of this
+            // device's to return if the odd one does not come; SensorThread calls again
+            if (!waitV4l2Frame(timeoutMs)) {
+                ATRACE_END();
                 return ret;
             }
-            ALOGV("%s(%d) enqueue buffer.index(%d), length(%d), mem_offset(%d)",__FUNCTION__, __LINE__,
-                buffer.index, buffer.m.planes[0].length, buffer.m.planes[0].m.mem_offset);
             if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_DQBUF, &buffer)) < 0) {
                 ALOGE("%s: DQBUF fails: %s", __FUNCTION__, strerror(errno));
+                ATRACE_END();
                 return ret;
             }
             if (buffer.index % 2 == 0) {
@@ -3583,13 +3687,23 @@ sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t*
                 buffer.index, buffer.m.planes[0].length, buffer.m.planes[0].m.mem_offset);
         }
     }
+    std::shared_ptr<V4L2Frame> lentFrame;
+    uint32_t maxBufferSize = mMaxV4L2BufferSize;
     if(isSubDevice()){
         std::unique_lock<std::mutex> lk(sSubDeviceBufferLock);
-        std::chrono::seconds timeout = std::chrono::seconds(kBufferWaitTimeoutSec);
-        auto st = sSubDeviceBufferPushed.wait_for(lk, timeout);
-        if (st == std::cv_status::timeout) {
-            ALOGE("wait mSubDeviceBufferPushed timeout");
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(timeoutMs);
+        if (!sSubDeviceBufferPushed.wait_for(lk, timeout, [] { return sSubDeviceFrame.frame != nullptr; })) {
+            // The main device is not streaming (yet), there is nothing to hand out
+            ATRACE_END();
+            return ret;
         }
+        lentFrame.swap(sSubDeviceFrame.frame);
+        // Timestamped and checked like a frame of its own; the index stays 0, the
+        // sub device has a single buffer slot and never queues it to a driver
+        buffer.timestamp = sSubDeviceFrame.timestamp;
+        buffer.flags = sSubDeviceFrame.flags;
+        buffer.bytesused = sSubDeviceFrame.bytesused;
+        maxBufferSize = sSubDeviceFrame.maxBufferSize;
         ALOGV("%s,SubDevice get buffer",__FUNCTION__);
     }
 #endif
@@ -3605,9 +3719,9 @@ sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t*
         // TODO: try to dequeue again
     }
 
-    if (buffer.bytesused > mMaxV4L2BufferSize) {
+    if (buffer.bytesused > maxBufferSize) {
         ALOGE("%s: v4l2 buffer bytes used: %u maximum %u", __FUNCTION__, buffer.bytesused,
-                mMaxV4L2BufferSize);
+                maxBufferSize);
         return ret;
     }
 
@@ -3632,6 +3746,34 @@ sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t*
         //         buffer.index, buffer.m.planes[0].length, buffer.m.planes[0].m.mem_offset);
     }
 
+    if (isSubDevice()) {
+        return new V4L2Frame(
+                mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
+                buffer.index, lentFrame);
+    }
+    return newV4l2Frame(buffer);
+}
+
+bool VirtualCameraDeviceSession::waitV4l2Frame(int timeoutMs) {
+    struct pollfd pfd = { .fd = mV4l2Fd.get(), .events = POLLIN, .revents = 0 };
+    int pollRet = TEMP_FAILURE_RETRY(poll(&pfd, 1, timeoutMs));
+    if (pollRet < 0) {
+        ALOGE("%s: poll fails: %s", __FUNCTION__, strerror(errno));
+        return false;
+    }
+    return pollRet > 0 && (pfd.revents & POLLIN);
+}
+
+sp<V4L2Frame> VirtualCameraDeviceSession::newV4l2Frame(const v4l2_buffer& buffer) {
+    if (mV4l2Memory == V4L2_MEMORY_DMABUF) {
+        int shareFd = (int)mCaptureMemManager->getBufferAddr(
+                ::android::virtuals::PREVIEWBUFFER, buffer.index, ::android::virtuals::buffer_sharre_fd);
+        uint8_t* data = (uint8_t*)mCaptureMemManager->getBufferAddr(
+                ::android::virtuals::PREVIEWBUFFER, buffer.index, ::android::virtuals::buffer_addr_vir);
+        return new V4L2Frame(
+                mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
+                buffer.index, shareFd, mMaxV4L2BufferSize, data);
+    }
     if (mCapability.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
         return new V4L2Frame(
                 mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
@@ -3640,42 +3782,246 @@ sp<V4L2Frame> VirtualCameraDeviceSession::dequeueV4l2FrameLocked(/*out*/nsecs_t*
         return new V4L2Frame(
                 mV4l2StreamingFmt.width, mV4l2StreamingFmt.height, mV4l2StreamingFmt.fourcc,
                 buffer.index, mV4l2Fd.get(), buffer.bytesused, buffer.m.offset);
-
 }
 
 void VirtualCameraDeviceSession::enqueueV4l2Frame(const sp<V4L2Frame>& frame) {
     ATRACE_CALL();
+    queueV4l2Buffer(frame);
+
+    {
+        std::lock_guard<std::mutex> lk(mV4l2BufferLock);
+        mNumDequeuedV4l2Buffers--;
+        mV4L2BufferReturned.notify_all();
+    }
+}
+
+bool VirtualCameraDeviceSession::queueV4l2Buffer(const sp<V4L2Frame>& frame) {
     frame->unmap();
     ATRACE_BEGIN("VIDIOC_QBUF");
     v4l2_buffer buffer{};
+    // Not the planes of dequeueV4l2Frame: a frame the sub device held comes back on its threads
+    struct v4l2_plane qbufPlanes[PLANES_NUM] = {};
     if (mCapability.device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
         buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     else
         buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.memory = mV4l2Memory;
     if (V4L2_TYPE_IS_MULTIPLANAR(buffer.type)) {
-        buffer.m.planes = planes;
+        buffer.m.planes = qbufPlanes;
         buffer.length = PLANES_NUM;
     }
 
     buffer.index = frame->mBufferIndex;
+    setV4l2BufferFd(&buffer);
     //ALOGE("frame->mBufferIndex:%d",frame->mBufferIndex);
 #if 1
     if(!isSubDevice()){
         if (TEMP_FAILURE_RETRY(ioctl(mV4l2Fd.get(), VIDIOC_QBUF, &buffer)) < 0) {
             ALOGE("%s: QBUF index %d fails: %s", __FUNCTION__,
                     frame->mBufferIndex, strerror(errno));
-            return;
+            ATRACE_END();
+            return false;
         }
     }
 #endif
     ATRACE_END();
+    return true;
+}
+
+size_t VirtualCameraDeviceSession::numV4l2BuffersOut() const {
+    return mNumDequeuedV4l2Buffers + (isMainDevice() ? sNumLentFrames.load() : 0);
+}
 
+bool VirtualCameraDeviceSession::lendToSubDevice(const sp<V4L2Frame>& frame, const v4l2_buffer& buffer) {
     {
         std::lock_guard<std::mutex> lk(mV4l2BufferLock);
-        mNumDequeuedV4l2Buffers--;
-        mV4L2BufferReturned.notify_one();
+        // Keep a buffer with the driver for the DQBUF that follows
+        if (sNumLentFrames >= kMaxLentFrames || numV4l2BuffersOut() + 2 > mV4L2BufferCount) {
+            return false;
+        }
+        sNumLentFrames++;
+    }
+
+    // Whichever session drops the last reference queues the buffer back here. The
+    // capture buffers stay allocated until then, even if this session is gone.
+    wp<VirtualCameraDeviceSession> weakThis(this);
+    sp<::android::virtuals::MemManagerBase> pool = mCaptureMemManager;
+    std::shared_ptr<V4L2Frame> lent(frame.get(), [weakThis, frame, pool](V4L2Frame*) {
+        sp<VirtualCameraDeviceSession> owner = weakThis.promote();
+        if (owner == nullptr) {
+            sNumLentFrames--;
+            return;
+        }
+        owner->queueV4l2Buffer(frame);
+        {
+            std::lock_guard<std::mutex> lk(owner->mV4l2BufferLock);
+            sNumLentFrames--;
+        }
+        owner->mV4L2BufferReturned.notify_all();
+    });
+    // The sub device only wants the newest frame, the one it did not take goes back
+    std::shared_ptr<V4L2Frame> unclaimed = lent;
+    {
+        std::lock_guard<std::mutex> lk(sSubDeviceBufferLock);
+        sSubDeviceFrame.frame.swap(unclaimed);
+        sSubDeviceFrame.timestamp = buffer.timestamp;
+        sSubDeviceFrame.flags = buffer.flags;
+        sSubDeviceFrame.bytesused = V4L2_TYPE_IS_MULTIPLANAR(buffer.type) ?
+                buffer.m.planes[0].bytesused : buffer.bytesused;
+        sSubDeviceFrame.maxBufferSize = mMaxV4L2BufferSize;
+    }
+    sSubDeviceBufferPushed.notify_one();
+    return true;
+}
+
+Status VirtualCameraDeviceSession::bindLatestFrame(const std::shared_ptr<HalRequest>& req) {
+    ATRACE_CALL();
+    nsecs_t shutterTs = 0;
+    std::vector<sp<V4L2Frame>> staleFrames;
+    sp<V4L2Frame> frame = mSensorThread->takeLatestFrame(&shutterTs, &staleFrames);
+    for (const auto& staleFrame : staleFrames) {
+        enqueueV4l2Frame(staleFrame);
+    }
+    if (frame == nullptr) {
+        ALOGE("%s: no V4L2 frame for request %d!", __FUNCTION__, req->frameNumber);
+        return Status::INTERNAL_ERROR;
+    }
+    req->frameIn = frame;
+    req->shutterTs = shutterTs;
+    return Status::OK;
+}
+
+VirtualCameraDeviceSession::SensorThread::SensorThread(wp<VirtualCameraDeviceSession> parent) :
+        mParent(parent) {}
+
+VirtualCameraDeviceSession::SensorThread::~SensorThread() {}
+
+bool VirtualCameraDeviceSession::SensorThread::threadLoop() {
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(kDequeueTimeoutMs);
+    auto parent = mParent.promote();
+    if (parent == nullptr) {
+       ALOGE("%s: session has been disconnected!", __FUNCTION__);
+       return false;
+    }
+
+    std::unique_lock<std::mutex> lk(mLock);
+    if (!mStreaming) {
+        mFrameCond.wait_for(lk, timeout);
+        return true;
+    }
+
+    uint32_t lendEpoch = sLendEpoch;
+    if (parent->isSubDevice() && lendEpoch != mLendEpoch) {
+        // The main device stopped and waits for the frames it lent
+        mLendEpoch = lendEpoch;
+        std::deque<SensorFrame> lentFrames;
+        lentFrames.swap(mFrames);
+        mStaleFrames += lentFrames.size();
+        lk.unlock();
+        for (const auto& f : lentFrames) {
+            parent->enqueueV4l2Frame(f.frame);
+        }
+        return true;
+    }
+
+    size_t numQueued = 0;
+    {
+        std::lock_guard<std::mutex> bufLk(parent->mV4l2BufferLock);
+        numQueued = parent->mV4L2BufferCount - parent->numV4l2BuffersOut();
+    }
+    // Make room for the next frame: the ring is full, or the in-flight requests hold all the
+    // other buffers and the driver has nothing left to fill
+    sp<V4L2Frame> staleFrame;
+    if (!mFrames.empty() && (mFrames.size() >= kRingSize || numQueued == 0)) {
+        staleFrame = mFrames.front().frame;
+        mFrames.pop_front();
+        mStaleFrames++;
+        numQueued++;
+    }
+    if (numQueued == 0) {
+        lk.unlock();
+        std::unique_lock<std::mutex> bufLk(parent->mV4l2BufferLock);
+        parent->mV4L2BufferReturned.wait_for(bufLk, timeout, [&parent] {
+            return parent->numV4l2BuffersOut() < parent->mV4L2BufferCount;
+        });
+        return true;
+    }
+    mDequeuing = true;
+    lk.unlock();
+
+    if (staleFrame != nullptr) {
+        parent->enqueueV4l2Frame(staleFrame);
     }
+    nsecs_t shutterTs = 0;
+    sp<V4L2Frame> frame = parent->dequeueV4l2Frame(&shutterTs, kDequeueTimeoutMs);
+
+    lk.lock();
+    mDequeuing = false;
+    if (frame != nullptr) {
+        mFrames.push_back({frame, shutterTs});
+        mDequeuedFrames++;
+        mFrameCond.notify_all();
+    }
+    mIdleCond.notify_all();
+    return true;
+}
+
+void VirtualCameraDeviceSession::SensorThread::start() {
+    std::lock_guard<std::mutex> lk(mLock);
+    mStreaming = true;
+    mFrameCond.notify_all();
+}
+
+void VirtualCameraDeviceSession::SensorThread::stop(/*out*/std::vector<sp<V4L2Frame>>* frames) {
+    ATRACE_CALL();
+    std::unique_lock<std::mutex> lk(mLock);
+    mStreaming = false;
+    mFrameCond.notify_all();
+    while (mDequeuing) {
+        mIdleCond.wait(lk);
+    }
+    for (const auto& f : mFrames) {
+        frames->push_back(f.frame);
+    }
+    mFrames.clear();
+}
+
+sp<V4L2Frame> VirtualCameraDeviceSession::SensorThread::takeLatestFrame(
+        /*out*/nsecs_t* shutterTs, /*out*/std::vector<sp<V4L2Frame>>* staleFrames) {
+    ATRACE_CALL();
+    auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::seconds(kBufferWaitTimeoutSec);
+    std::unique_lock<std::mutex> lk(mLock);
+    while (mFrames.empty()) {
+        if (exitPending() ||
+                mFrameCond.wait_until(lk, deadline) == std::cv_status::timeout) {
+            if (!mFrames.empty()) {
+                break;
+            }
+            mBindTimeouts++;
+            return nullptr;
+        }
+    }
+
+    SensorFrame latest = mFrames.back();
+    mFrames.pop_back();
+    // Frames older than the one bound would go out of order, give them back
+    for (const auto& f : mFrames) {
+        staleFrames->push_back(f.frame);
+    }
+    mStaleFrames += mFrames.size();
+    mFrames.clear();
+    mBoundFrames++;
+    *shutterTs = latest.shutterTs;
+    return latest.frame;
+}
+
+void VirtualCameraDeviceSession::SensorThread::dump(int fd) {
+    std::lock_guard<std::mutex> lk(mLock);
+    dprintf(fd, "Sensor thread %s, holding %zu frames: dequeued %" PRIu64 ", bound %" PRIu64
+            ", returned stale %" PRIu64 ", bind timeouts %" PRIu64 "\n",
+            mStreaming ? "streaming" : "stopped", mFrames.size(),
+            mDequeuedFrames, mBoundFrames, mStaleFrames, mBindTimeouts);
 }
 
 Status VirtualCameraDeviceSession::isStreamCombinationSupported(
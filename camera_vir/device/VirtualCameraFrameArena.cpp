@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <algorithm>
+#include "VirtualCameraFrameArena.h"
+
+namespace virtuals {
+
+namespace {
+
+size_t alignUp(size_t size) {
+    return (size + VirCamFrameArena::kAlignment - 1) & ~(VirCamFrameArena::kAlignment - 1);
+}
+
+} // anonymous namespace
+
+const size_t VirCamFrameArena::kAlignment;
+
+std::shared_ptr<VirCamFrameArena> VirCamFrameArena::create(const std::vector<SizeClass>& classes) {
+    std::shared_ptr<VirCamFrameArena> arena(new VirCamFrameArena());
+    std::vector<SizeClass> sorted;
+    size_t total = 0;
+
+    for (const auto& sc : classes) {
+        if (sc.size == 0 || sc.count == 0) {
+            continue;
+        }
+        // classes of the same aligned size are merged
+        SizeClass aligned = { alignUp(sc.size), sc.count };
+        auto it = std::find_if(sorted.begin(), sorted.end(),
+                [&](const SizeClass& s) { return s.size == aligned.size; });
+        if (it != sorted.end()) {
+            it->count += aligned.count;
+        } else {
+            sorted.push_back(aligned);
+        }
+        total += aligned.size * aligned.count;
+    }
+    std::sort(sorted.begin(), sorted.end(),
+            [](const SizeClass& a, const SizeClass& b) { return a.size < b.size; });
+
+    if (total > 0 && posix_memalign((void**)&arena->mMemory, kAlignment, total) != 0) {
+        return nullptr;
+    }
+    uint8_t* p = arena->mMemory;
+    for (const auto& sc : sorted) {
+        Class cls;
+        cls.size = sc.size;
+        for (size_t i = 0; i < sc.count; i++) {
+            cls.free.push_back(p);
+            p += sc.size;
+        }
+        arena->mClasses.push_back(std::move(cls));
+    }
+    arena->mStats.bytes = total;
+    return arena;
+}
+
+VirCamFrameArena::~VirCamFrameArena() {
+    free(mMemory);
+}
+
+std::shared_ptr<uint8_t> VirCamFrameArena::acquire(size_t size) {
+    std::shared_ptr<VirCamFrameArena> self = shared_from_this();
+    std::lock_guard<std::mutex> lk(mLock);
+    mStats.acquires++;
+    if (++mStats.inUse > mStats.highWater) {
+        mStats.highWater = mStats.inUse;
+    }
+    for (size_t i = 0; i < mClasses.size(); i++) {
+        Class& cls = mClasses[i];
+        if (cls.size < size || cls.free.empty()) {
+            continue;
+        }
+        uint8_t* data = cls.free.back();
+        cls.free.pop_back();
+        int index = (int)i;
+        // the deleter keeps the arena alive until the buffer is back
+        return std::shared_ptr<uint8_t>(data, [self, index](uint8_t* d) { self->release(index, d); });
+    }
+
+    mStats.overflows++;
+    uint8_t* data = nullptr;
+    if (posix_memalign((void**)&data, kAlignment, std::max(size, (size_t)1)) != 0) {
+        mStats.inUse--;
+        return nullptr;
+    }
+    return std::shared_ptr<uint8_t>(data, [self](uint8_t* d) { self->release(-1, d); });
+}
+
+void VirCamFrameArena::release(int cls, uint8_t* data) {
+    std::lock_guard<std::mutex> lk(mLock);
+    mStats.inUse--;
+    if (cls < 0) {
+        free(data);
+    } else {
+        mClasses[cls].free.push_back(data);
+    }
+}
+
+VirCamFrameArena::Stats VirCamFrameArena::stats() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mStats;
+}
+
+} // namespace virtuals
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include "VirtualCameraFrameDumper.h"
+
+namespace virtuals {
+
+const size_t VirCamFrameDumper::kDefaultQueueDepth;
+const int VirCamFrameDumper::kDefaultSkipFrames;
+
+VirCamFrameDumper::VirCamFrameDumper(const std::string& dir, int framesPerTag,
+                                     int skipFrames, size_t queueDepth)
+    : mDir(dir), mFramesPerTag(framesPerTag), mSkipFrames(skipFrames),
+      mQueueDepth(queueDepth) {
+    mWriter = std::thread(&VirCamFrameDumper::writerLoop, this);
+}
+
+VirCamFrameDumper::~VirCamFrameDumper() {
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mExiting = true;
+    }
+    mQueued.notify_all();
+    mWriter.join();
+}
+
+bool VirCamFrameDumper::dump(const char* tag, uint32_t frameNumber, int width, int height,
+                             const char* ext, const void* data, size_t size) {
+    std::unique_lock<std::mutex> lk(mLock);
+    int& seen = mSeen[tag];
+    if (seen >= mSkipFrames + mFramesPerTag || ++seen <= mSkipFrames) {
+        return false;
+    }
+    if (mQueue.size() + mCopying >= mQueueDepth) {
+        mStats.dropped++;
+        return false;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "_%dx%d_%u.%s", width, height, frameNumber, ext);
+    Dump d;
+    d.path = mDir + "/" + tag + name;
+    // the copy runs outside the lock, in a slot kept for it
+    mCopying++;
+    lk.unlock();
+    d.data.assign((const uint8_t*)data, (const uint8_t*)data + size);
+    lk.lock();
+    mCopying--;
+    mQueue.push_back(std::move(d));
+    mStats.queued++;
+    lk.unlock();
+    mQueued.notify_one();
+    return true;
+}
+
+void VirCamFrameDumper::writerLoop() {
+    std::unique_lock<std::mutex> lk(mLock);
+    for (;;) {
+        mQueued.wait(lk, [this] { return mExiting || !mQueue.empty(); });
+        if (mQueue.empty()) {
+            return; // exiting, and everything is written
+        }
+        Dump d = std::move(mQueue.front());
+        mQueue.pop_front();
+        lk.unlock();
+
+        bool ok = false;
+        FILE* fp = fopen(d.path.c_str(), "wb");
+        if (fp != NULL) {
+            ok = fwrite(d.data.data(), 1, d.data.size(), fp) == d.data.size();
+            ok = fclose(fp) == 0 && ok;
+        }
+        std::string error = ok ? std::string() : d.path + ": " + strerror(errno);
+
+        lk.lock();
+        if (ok) {
+            mStats.written++;
+        } else {
+            mStats.failed++;
+            mLastError = error;
+        }
+    }
+}
+
+VirCamFrameDumper::Stats VirCamFrameDumper::stats() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mStats;
+}
+
+std::string VirCamFrameDumper::lastError() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mLastError;
+}
+
+} // namespace virtuals
@@ -19,7 +19,9 @@
 
 #include <cmath>
 #include <cstring>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include <linux/videodev2.h>
 
 #define HAVE_JPEG // required for libyuv.h to export MJPEG decode APIs
@@ -35,6 +37,23 @@ namespace {
 
 buffer_handle_t sEmptyBuffer = nullptr;
 
+// From linux/dma-buf.h: brackets CPU access to a dmabuf the device writes
+struct dma_buf_sync {
+    __u64 flags;
+};
+
+#define DMA_BUF_SYNC_READ      (1 << 0)
+#define DMA_BUF_SYNC_START     (0 << 2)
+#define DMA_BUF_SYNC_END       (1 << 2)
+#define DMA_BUF_BASE            'b'
+#define DMA_BUF_IOCTL_SYNC      _IOW(DMA_BUF_BASE, 0, struct dma_buf_sync)
+
+int syncDmaBuf(int fd, __u64 flags) {
+    struct dma_buf_sync sync_args;
+    sync_args.flags = flags | DMA_BUF_SYNC_READ;
+    return TEMP_FAILURE_RETRY(ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync_args));
+}
+
 } // Anonymous namespace
 
 namespace android {
@@ -56,6 +75,19 @@ V4L2Frame::V4L2Frame(
 
         }
 
+V4L2Frame::V4L2Frame(
+        uint32_t w, uint32_t h, uint32_t fourcc,
+        int bufIdx, int shareFd, uint32_t dataSize, uint8_t* data) :
+        Frame(w, h, fourcc),
+        mBufferIndex(bufIdx), mFd(-1), mDataSize(dataSize), mOffset(0),
+        mShareFd(shareFd), mData(data) {}
+
+V4L2Frame::V4L2Frame(
+        uint32_t w, uint32_t h, uint32_t fourcc,
+        int bufIdx, const std::shared_ptr<V4L2Frame>& lent) :
+        Frame(w, h, fourcc),
+        mBufferIndex(bufIdx), mFd(-1), mDataSize(0), mOffset(0), mLent(lent) {}
+
 int V4L2Frame::map(uint8_t** data, size_t* dataSize) {
     //ALOGE("map");
     if (data == nullptr || dataSize == nullptr) {
@@ -64,8 +96,19 @@ int V4L2Frame::map(uint8_t** data, size_t* dataSize) {
         return -EINVAL;
     }
 
+    if (mLent != nullptr) {
+        // mapped, and unmapped before it is queued again, by the owner
+        return mLent->map(data, dataSize);
+    }
+
     std::lock_guard<std::mutex> lk(mLock);
-    if (!mMapped) {
+    if (!mMapped && mShareFd >= 0) {
+        // Mapped for good by gralloc; the device wrote it behind the CPU cache
+        if (syncDmaBuf(mShareFd, DMA_BUF_SYNC_START) != 0) {
+            ALOGW("%s: DMA_BUF_IOCTL_SYNC start failed: %s", __FUNCTION__, strerror(errno));
+        }
+        mMapped = true;
+    } else if (!mMapped) {
 #if 1
         void* addr = mmap(NULL, mDataSize, PROT_READ, MAP_SHARED, mFd, mOffset);
 
@@ -88,7 +131,10 @@ int V4L2Frame::map(uint8_t** data, size_t* dataSize) {
 
 int V4L2Frame::unmap() {
     std::lock_guard<std::mutex> lk(mLock);
-    if (mMapped) {
+    if (mMapped && mShareFd >= 0) {
+        syncDmaBuf(mShareFd, DMA_BUF_SYNC_END);
+        mMapped = false;
+    } else if (mMapped) {
         ALOGV("%s: V4L unmap data %p size %zu", __FUNCTION__, mData, mDataSize);
 #if 1
         if (munmap(mData, mDataSize) != 0) {
@@ -110,6 +156,10 @@ int V4L2Frame::getData(uint8_t** outData, size_t* dataSize) {
     return map(outData, dataSize);
 }
 
+int V4L2Frame::getShareFd() const {
+    return mLent != nullptr ? mLent->getShareFd() : mShareFd;
+}
+
 AllocatedFrame::AllocatedFrame(
         uint32_t w, uint32_t h) :
         Frame(w, h, V4L2_PIX_FMT_YUV420) {};
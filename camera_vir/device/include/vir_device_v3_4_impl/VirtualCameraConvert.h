@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_EXTERNAL_CAMERA_CONVERT
+#define ANDROID_EXTERNAL_CAMERA_CONVERT
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace virtuals {
+
+// CPU pixel kernels for the frames RGA cannot take as they come: YUYV to
+// NV12/I420, and the 16 bit SRGGB10, RAW16, IR and depth samples narrowed
+// for display.
+//
+// Every kernel has a plain C reference and SIMD versions (SSE2 on x86, NEON
+// on ARM); the fastest one the build and CPU support is picked on first use,
+// and all of them produce bit-identical output. Nothing here depends on
+// Android, so the kernels also build and run in the host tests.
+class VirCamConvert {
+ public:
+    enum Isa {
+        ISA_AUTO = 0,
+        ISA_C,
+        ISA_SSE2,
+        ISA_NEON,
+    };
+
+    // 16 bit narrowing: out = min((max(in - blackLevel, 0) >> shift), maxValue),
+    // of which the 8 bit kernels keep the low byte.
+    struct Narrow {
+        uint16_t blackLevel;
+        uint16_t shift;
+        uint16_t maxValue;
+    };
+
+    // The IR limit of the SRGGB10 sensors: black level 64, clipped to 8 bits
+    // without scaling (what ir_limit_max did).
+    static const Narrow kIrLimit;
+    // The low byte as is, the luma yuyv_to_nv12 took from 16 bit samples.
+    static const Narrow kLowByte;
+
+    // YUYV (width even) to NV12 or I420. Chroma comes from the even rows,
+    // as the V4L2 driver path always did; odd heights get a last chroma row.
+    static void yuyvToNv12(const uint8_t* src, int srcStride,
+                           uint8_t* dstY, int yStride, uint8_t* dstUv, int uvStride,
+                           int width, int height);
+    static void yuyvToI420(const uint8_t* src, int srcStride,
+                           uint8_t* dstY, int yStride, uint8_t* dstU, uint8_t* dstV,
+                           int cStride, int width, int height);
+
+    // count 16 bit samples narrowed into 16 or 8 bit samples; src and dst
+    // may be the same buffer for narrow16.
+    static void narrow16(const uint16_t* src, uint16_t* dst, size_t count, const Narrow& n);
+    static void narrow16To8(const uint16_t* src, uint8_t* dst, size_t count, const Narrow& n);
+
+    // A width x height frame of 16 bit samples as grey NV12 in dst: narrowed
+    // luma, then (height + 1) / 2 rows of chroma 0x80.
+    static void narrow16ToGreyNv12(const uint16_t* src, uint8_t* dst,
+                                   int width, int height, const Narrow& n);
+
+    // Forces a kernel set, for tests and benchmarks; ISA_AUTO goes back to
+    // the best supported one. Returns -1 if the CPU or the build does not
+    // support isa. Not safe against conversions running at the same time.
+    static int setIsa(Isa isa);
+    static Isa getIsa();
+    static const char* isaName(Isa isa);
+};
+
+} // namespace virtuals
+
+#endif // ANDROID_EXTERNAL_CAMERA_CONVERT
@@ -23,9 +23,14 @@
 #include <hidl/MQDescriptor.h>
 #include <hidl/Status.h>
 #include <include/convert.h>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <list>
+#include <map>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include "CameraMetadata.h"
@@ -39,6 +44,8 @@
 #include "MpiJpegDecoder.h"
 #include <utils/Singleton.h>
 #include "VirtualCameraMemManager.h"
+#include "VirtualCameraFrameArena.h"
+#include "VirtualCameraFrameDumper.h"
 #include <linux/videodev2.h>
 
 
@@ -149,6 +156,16 @@ struct VirtualCameraDeviceSession : public virtual RefBase,
                 return parent->isMainDevice();
         }
 
+        // Binds the request to the latest sensor frame, failing the request if there is none
+        Status bindLatestFrame(const std::shared_ptr<HalRequest>& req);
+
+        // A scratch frame of at least size bytes from the arena of the current configuration;
+        // it goes back to the arena when the last reference is dropped
+        std::shared_ptr<uint8_t> acquireScratch(size_t size);
+        // Queues a debug dump if dumps are enabled (vendor.camera.virtual.dump_frames)
+        void dumpFrame(const char* tag, uint32_t frameNumber, int width, int height,
+                const char* ext, const void* data, size_t size);
+
     protected:
         // Methods to request output buffer in parallel
         // No-op for device@3.4. Implemented in device@3.5
@@ -163,6 +180,29 @@ struct VirtualCameraDeviceSession : public virtual RefBase,
         void waitForNextRequest(std::shared_ptr<HalRequest>* out);
         void signalRequestDone();
 
+        virtual status_t readyToRun() override;
+
+        // The output buffers of a request are filled in parallel: the first one on the
+        // OutputThread, the others on kNumBufferWorkers BufferWorkerThreads
+        class BufferWorkerThread : public android::Thread {
+        public:
+            BufferWorkerThread(OutputThread& owner);
+            virtual bool threadLoop() override;
+        private:
+            OutputThread& mOwner; // joins its workers before it goes away
+        };
+
+        // Runs fn(0) .. fn(count - 1) across the workers and returns when all are done
+        void runBufferTasks(size_t count, const std::function<void(size_t)>& fn);
+        // Runs one queued task, waiting up to timeoutMs for one; false if there was none
+        bool runBufferTask(int timeoutMs);
+
+        int processOutputBufferLocked(const std::shared_ptr<HalRequest>& req,
+                HalStreamBuffer& halBuf, int tempFrameWidth, int tempFrameHeight,
+                int is16Align, const unsigned short* depthMap);
+        void recordBufferTiming(int streamId, nsecs_t startTs, nsecs_t fenceDoneTs,
+                nsecs_t doneTs);
+
         int cropAndScaleLocked(
                 sp<AllocatedFrame>& in, const Size& outSize,
                 YCbCrLayout* out);
@@ -199,10 +239,63 @@ struct VirtualCameraDeviceSession : public virtual RefBase,
         sp<AllocatedFrame> mYu12Frame;
         sp<AllocatedFrame> mYu12ThumbFrame;
         std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mIntermediateBuffers;
-        std::unordered_map<Size, sp<AllocatedFrame>, SizeHasher> mScaledYu12Frames;
+        // Crop and output size of a scale pass out of mYu12Frame
+        struct ScaleKey {
+            IMapper::Rect crop;
+            Size size;
+            bool operator==(const ScaleKey& o) const {
+                return crop.left == o.crop.left && crop.top == o.crop.top &&
+                        crop.width == o.crop.width && crop.height == o.crop.height &&
+                        size == o.size;
+            }
+        };
+        struct ScaleKeyHasher {
+            size_t operator()(const ScaleKey& key) const {
+                size_t result = SizeHasher()(key.size);
+                result = 31 * result + key.crop.left;
+                result = 31 * result + key.crop.top;
+                result = 31 * result + key.crop.width;
+                result = 31 * result + key.crop.height;
+                return result;
+            }
+        };
+        // Scale passes done for the current request, laid out in mIntermediateBuffers
+        std::unordered_map<ScaleKey, YCbCrLayout, ScaleKeyHasher> mScaledYu12Frames;
         YCbCrLayout mYu12FrameLayout;
         YCbCrLayout mYu12ThumbFrameLayout;
         uint32_t mBlobBufferSize = 0; // 0 -> HAL derive buffer size, else: use given size
+        // Buffers filled in parallel scale one at a time: mScaledYu12Frames, the
+        // intermediate buffers and the counters below are shared
+        std::mutex mScaleLock;
+        uint64_t mScalePasses = 0;  // I420Scale runs
+        uint64_t mScaleReuses = 0;  // outputs served from mScaledYu12Frames
+        uint64_t mScaleViews = 0;   // outputs that needed no scale, a view of mYu12Frame
+
+        // Scratch frames of a request: the narrowed sensor frame, the depth map and the
+        // NV12 staging of every buffer filled in parallel
+        static const size_t kScratchFramesInFlight = 4;
+        static const size_t kDepthMapBytes = 640 * 400 * 2;
+        std::mutex mScratchLock;                      // Protect the two pointers below
+        std::shared_ptr<::virtuals::VirCamFrameArena> mFrameArena;
+        std::shared_ptr<::virtuals::VirCamFrameDumper> mFrameDumper;
+
+        static const int kNumBufferWorkers = 2;
+        std::vector<sp<BufferWorkerThread>> mBufferWorkers;
+        std::mutex mBufferTaskLock;                   // Protect the tasks and count below
+        std::condition_variable mBufferTaskCond;      // signaled when tasks are queued
+        std::condition_variable mBufferTaskDoneCond;  // signaled when a task is done
+        std::list<std::function<void()>> mBufferTasks;
+        size_t mBufferTasksPending = 0;               // queued or running on a worker
+
+        struct StreamTiming {
+            uint64_t buffers = 0;
+            nsecs_t totalFenceWaitNs = 0;
+            nsecs_t totalProcessNs = 0;
+            nsecs_t maxProcessNs = 0;
+            nsecs_t lastProcessNs = 0;
+        };
+        std::mutex mTimingLock;                       // Protect mStreamTimings
+        std::map<int, StreamTiming> mStreamTimings;   // stream ID -> fill timing, for dump
 
         std::string mExifMake;
         std::string mExifModel;
@@ -263,6 +356,51 @@ struct VirtualCameraDeviceSession : public virtual RefBase,
         static const int kReqWaitTimesMax = 90;    // 33ms * 90 ~= 3 sec
     };
 
+    // Dequeues V4L2 frames for as long as the stream is on and keeps the latest kRingSize of
+    // them, so a request is bound to the freshest frame when FormatConvertThread picks it up
+    // instead of waiting for a DQBUF inside processCaptureRequest. Older frames go back to
+    // the driver as soon as a newer one is in.
+    class SensorThread : public android::Thread {
+    public:
+        SensorThread(wp<VirtualCameraDeviceSession> parent);
+        ~SensorThread();
+        virtual bool threadLoop() override;
+
+        // Called after V4L2 streamOn
+        void start();
+        // Called before V4L2 streamOff or reconfiguration: waits for a dequeue in progress and
+        // hands back the frames held, which the caller returns to the driver
+        void stop(/*out*/std::vector<sp<V4L2Frame>>* frames);
+        // Takes the newest frame, waiting up to kBufferWaitTimeoutSec for one; the frames
+        // older than it are handed back as stale
+        sp<V4L2Frame> takeLatestFrame(/*out*/nsecs_t* shutterTs,
+                /*out*/std::vector<sp<V4L2Frame>>* staleFrames);
+        void dump(int fd);
+
+    private:
+        struct SensorFrame {
+            sp<V4L2Frame> frame;
+            nsecs_t shutterTs;
+        };
+
+        static const size_t kRingSize = 2;
+        static const int kDequeueTimeoutMs = 100; // bounds how long stop() waits
+
+        const wp<VirtualCameraDeviceSession> mParent;
+
+        std::mutex mLock;                      // Protect all members below
+        std::condition_variable mFrameCond;    // signaled when a frame is added or on exit
+        std::condition_variable mIdleCond;     // signaled when a dequeue finishes
+        std::deque<SensorFrame> mFrames;       // oldest first
+        bool mStreaming = false;
+        bool mDequeuing = false;
+        uint64_t mDequeuedFrames = 0;
+        uint64_t mBoundFrames = 0;
+        uint64_t mStaleFrames = 0;             // returned to the driver without being bound
+        uint64_t mBindTimeouts = 0;
+        uint32_t mLendEpoch = 0;               // sub device: last sLendEpoch seen
+    };
+
 protected:
 
     // Methods from ::android::hardware::camera::device::V3_2::ICameraDeviceSession follow
@@ -321,6 +459,8 @@ protected:
 
     virtual bool isMainDevice() const override;
 
+    virtual Status bindLatestFrame(const std::shared_ptr<HalRequest>&) override;
+
     virtual void notifyError(uint32_t frameNumber, int32_t streamId, ErrorCode ec) override;
     // End of OutputThreadInterface methods
 
@@ -345,13 +485,32 @@ protected:
     int configureV4l2StreamLocked(SupportedV4L2Format& fmt, double fps = 0.0);
     int v4l2StreamOffLocked();
     int setV4l2FpsLocked(double fps);
+    // Stop the SensorThread and return the frames it holds to the driver
+    void stopSensorLocked();
     static Status isStreamCombinationSupported(const V3_2::StreamConfiguration& config,
             const std::vector<SupportedV4L2Format>& supportedFormats,
             const VirtualCameraConfig& devCfg);
 
     // TODO: change to unique_ptr for better tracking
-    sp<V4L2Frame> dequeueV4l2FrameLocked(/*out*/nsecs_t* shutterTs); // Called with mLock hold
+    // Called by SensorThread only, without mLock; nullptr if no frame came within timeoutMs
+    sp<V4L2Frame> dequeueV4l2Frame(/*out*/nsecs_t* shutterTs, int timeoutMs);
+    // Main and normal devices: false if the driver filled no buffer within timeoutMs
+    bool waitV4l2Frame(int timeoutMs);
     void enqueueV4l2Frame(const sp<V4L2Frame>&);
+    // VIDIOC_QBUF only, the buffer counts are up to the caller
+    bool queueV4l2Buffer(const sp<V4L2Frame>& frame);
+    // Buffers not with the driver: dequeued here, or lent to the sub device.
+    // Call with mV4l2BufferLock held.
+    size_t numV4l2BuffersOut() const;
+    // V4L2_MEMORY_DMABUF: allocate the capture buffers the driver fills; false on failure
+    bool createCaptureBuffersLocked(uint32_t count, uint32_t width, uint32_t sizeImage);
+    sp<V4L2Frame> newV4l2Frame(const v4l2_buffer& buffer);
+    // Point a DMABUF buffer at the dmabuf of its index before VIDIOC_QBUF
+    void setV4l2BufferFd(v4l2_buffer* buffer);
+    // Main device: hand the frame dequeued as buffer to the sub device instead
+    // of copying it. Returns false if the sub device already holds as many
+    // frames as it may, the caller then queues the frame back to the driver.
+    bool lendToSubDevice(const sp<V4L2Frame>& frame, const v4l2_buffer& buffer);
 
     // Check if input Stream is one of supported stream setting on this device
     static bool isSupported(const Stream& stream,
@@ -424,6 +583,11 @@ protected:
     SupportedV4L2Format mV4l2StreamingFmt;
     double mV4l2StreamingFps = 0.0;
     size_t mV4L2BufferCount = 0;
+    // V4L2_MEMORY_DMABUF when the driver fills buffers of mCaptureMemManager
+    // (vendor.camera.virtual.v4l2_dmabuf), V4L2_MEMORY_MMAP otherwise
+    uint32_t mV4l2Memory = V4L2_MEMORY_MMAP;
+    sp<::android::virtuals::MemManagerBase> mCaptureMemManager;
+    size_t mCaptureBufferSize = 0;
     struct v4l2_plane planes[1];
     struct v4l2_capability mCapability;
 
@@ -437,11 +601,29 @@ protected:
 
     static std::mutex sSubDeviceBufferLock;
     static std::condition_variable sSubDeviceBufferPushed;
+    // A lent frame with what the main device's DQBUF said about it
+    struct LentV4l2Frame {
+        std::shared_ptr<V4L2Frame> frame;
+        struct timeval timestamp;
+        uint32_t flags;
+        uint32_t bytesused;
+        uint32_t maxBufferSize;     // the main device's mMaxV4L2BufferSize
+    };
+    // The last frame the main device lent and the sub device has not taken yet
+    static LentV4l2Frame sSubDeviceFrame;
+    // Main device frames out with the sub device, in sSubDeviceFrame, its SensorThread
+    // or its requests; not part of the main device's mNumDequeuedV4l2Buffers
+    static std::atomic<int> sNumLentFrames;
+    static const int kMaxLentFrames = 2;
+    // Bumped when the main device stops lending, the sub device's SensorThread then
+    // hands back the frames it keeps, as no newer frame would ever push them out
+    static std::atomic<uint32_t> sLendEpoch;
 
     // Not protected by mLock (but might be used when mLock is locked)
     sp<OutputThread> mOutputThread;
     sp<FormatConvertThread> mFormatConvertThread;
     sp<EventThread> mEventThread;
+    sp<SensorThread> mSensorThread;
 
     // Stream ID -> Camera3Stream cache
     std::unordered_map<int, Stream> mStreamMap;
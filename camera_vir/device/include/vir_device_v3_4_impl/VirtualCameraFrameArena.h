@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_EXTERNAL_CAMERA_FRAME_ARENA
+#define ANDROID_EXTERNAL_CAMERA_FRAME_ARENA
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace virtuals {
+
+// Scratch frames for one configured session: a fixed set of buffers in a few
+// size classes, carved from one allocation when the streams are configured
+// and recycled from request to request.
+//
+// acquire() hands out the smallest free buffer that fits. The buffer goes
+// back when the last reference to it is dropped, so a request can carry it
+// from the format convert thread to the output thread. When every buffer
+// that fits is in use, the frame comes from the heap and is counted as an
+// overflow; the arena itself never grows. The arena stays alive until its
+// last buffer is returned, so the session may configure a new one while
+// frames of the old configuration are still in flight.
+class VirCamFrameArena : public std::enable_shared_from_this<VirCamFrameArena> {
+ public:
+    struct SizeClass {
+        size_t size;
+        size_t count;
+    };
+
+    struct Stats {
+        uint64_t acquires = 0;
+        uint64_t overflows = 0;
+        size_t inUse = 0;
+        size_t highWater = 0;
+        size_t bytes = 0;
+    };
+
+    // Every buffer starts on a 64 byte boundary, for the SIMD kernels and
+    // for cache lines shared between threads.
+    static const size_t kAlignment = 64;
+
+    // Returns nullptr if the memory cannot be allocated.
+    static std::shared_ptr<VirCamFrameArena> create(const std::vector<SizeClass>& classes);
+    ~VirCamFrameArena();
+
+    // A buffer of at least size bytes; nullptr only if the heap is exhausted too.
+    std::shared_ptr<uint8_t> acquire(size_t size);
+
+    Stats stats();
+
+ private:
+    struct Class {
+        size_t size;
+        std::vector<uint8_t*> free;
+    };
+
+    VirCamFrameArena() = default;
+    void release(int cls, uint8_t* data);
+
+    std::mutex mLock;
+    uint8_t* mMemory = nullptr;
+    std::vector<Class> mClasses; // ascending size
+    Stats mStats;
+};
+
+} // namespace virtuals
+
+#endif // ANDROID_EXTERNAL_CAMERA_FRAME_ARENA
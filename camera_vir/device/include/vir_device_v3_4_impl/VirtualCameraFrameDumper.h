@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2018, Fuzhou Rockchip Electronics Co., Ltd
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_EXTERNAL_CAMERA_FRAME_DUMPER
+#define ANDROID_EXTERNAL_CAMERA_FRAME_DUMPER
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace virtuals {
+
+// Debug dumps of the frames going through the HAL, written to files by a
+// thread of their own so that a dump never blocks the capture path.
+//
+// Each dump point (tag) skips its first skipFrames frames and then dumps the
+// next framesPerTag ones as <dir>/<tag>_<w>x<h>_<frame>.<ext>. dump() copies
+// the data into a bounded queue and returns; a frame that finds the queue
+// full is dropped and counted.
+class VirCamFrameDumper {
+ public:
+    struct Stats {
+        uint64_t queued = 0;
+        uint64_t written = 0;
+        uint64_t dropped = 0;
+        uint64_t failed = 0;
+    };
+
+    static const size_t kDefaultQueueDepth = 4;
+    static const int kDefaultSkipFrames = 5;
+
+    VirCamFrameDumper(const std::string& dir, int framesPerTag,
+                      int skipFrames = kDefaultSkipFrames,
+                      size_t queueDepth = kDefaultQueueDepth);
+    // Writes what is still queued, then stops the writer.
+    ~VirCamFrameDumper();
+
+    // Counts the frame for tag; returns true if it was queued. Outside the
+    // tag's window this is a map lookup, without copying anything.
+    bool dump(const char* tag, uint32_t frameNumber, int width, int height, const char* ext,
+              const void* data, size_t size);
+
+    Stats stats();
+    // The last file that could not be written, empty if none.
+    std::string lastError();
+
+ private:
+    struct Dump {
+        std::string path;
+        std::vector<uint8_t> data;
+    };
+
+    void writerLoop();
+
+    const std::string mDir;
+    const int mFramesPerTag;
+    const int mSkipFrames;
+    const size_t mQueueDepth;
+
+    std::mutex mLock;
+    std::condition_variable mQueued;
+    std::deque<Dump> mQueue;
+    size_t mCopying = 0; // queue slots taken by dumps still being copied
+    std::map<std::string, int> mSeen; // frames offered per tag
+    bool mExiting = false;
+    Stats mStats;
+    std::string mLastError;
+    std::thread mWriter;
+};
+
+} // namespace virtuals
+
+#endif // ANDROID_EXTERNAL_CAMERA_FRAME_DUMPER
@@ -22,6 +22,7 @@
 #include <android/hardware/graphics/common/1.0/types.h>
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
 #include <inttypes.h>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
@@ -150,10 +151,21 @@ class V4L2Frame : public Frame {
 public:
     V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx, int fd,
               uint32_t dataSize, uint64_t offset);
+    // A V4L2_MEMORY_DMABUF buffer: the HAL allocated dmabuf shareFd, already
+    // mapped at data by its allocator. Doesn't claim ownership of either.
+    V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx, int shareFd,
+              uint32_t dataSize, uint8_t* data);
+    // A frame dequeued by another session and lent to this one; its owner
+    // gets the buffer back when the last reference to lent is dropped.
+    V4L2Frame(uint32_t w, uint32_t h, uint32_t fourcc, int bufIdx,
+              const std::shared_ptr<V4L2Frame>& lent);
     ~V4L2Frame() override;
 
     virtual int getData(uint8_t** outData, size_t* dataSize) override;
 
+    // The dmabuf holding the frame, for RGA; -1 for a MMAP buffer
+    int getShareFd() const;
+
     const int mBufferIndex; // for later enqueue
     int map(uint8_t** data, size_t* dataSize);
     int unmap();
@@ -162,6 +174,8 @@ private:
     const int mFd; // used for mmap but doesn't claim ownership
     const size_t mDataSize;
     const uint64_t mOffset; // used for mmap
+    const int mShareFd = -1;
+    const std::shared_ptr<V4L2Frame> mLent;
     uint8_t* mData = nullptr;
     bool  mMapped = false;
 };
@@ -218,6 +232,8 @@ struct HalRequest {
     unsigned long mVirAddr;
     uint8_t* inData;
     size_t inDataSize;
+    // Owns inData when it is a converted copy of the V4L2 frame
+    std::shared_ptr<uint8_t> scratch;
 };
 
 static const uint64_t BUFFER_ID_NO_BUFFER = 0;
@@ -288,6 +304,10 @@ struct OutputThreadInterface : public virtual RefBase {
     virtual bool isSubDevice() const = 0;
 
     virtual bool isMainDevice() const = 0;
+
+    // Sets frameIn and shutterTs of a request that has not been bound to a V4L2 frame yet
+    virtual ::android::hardware::camera::common::V1_0::Status bindLatestFrame(
+            const std::shared_ptr<HalRequest>&) = 0;
 };
 
 }  // namespace implementation